@@ -23,11 +23,13 @@ class build_py(_build_py):
 
 # compiler inputs
 include_dirs = ["src"]
-depends = []
+depends = ["stomp/generators.i", "stomp/numpy_views.i",
+           "stomp/pickling.i"]
 swig_file = "stomp/stomp.i"
 wrap_file = "stomp/stomp_wrap.cpp"
 # compiler flags
-extra_compile_args = ["-std=c++11"]
+extra_compile_args = ["-std=c++11", "-fopenmp"]
+extra_link_args = ["-fopenmp"]
 swig_opts = ["-c++", "-py3"]
 try:  # check if numpy extension will be used
     import numpy
@@ -54,16 +56,27 @@ stomp_module = Extension(
         "src/stomp/stomp_pixel.cc",
         "src/stomp/stomp_scalar_pixel.cc",
         "src/stomp/stomp_tree_pixel.cc",
+        "src/stomp/stomp_compact_leaf.cc",
         "src/stomp/stomp_itree_pixel.cc",
+        "src/stomp/stomp_pixel_index.cc",
         "src/stomp/stomp_base_map.cc",
         "src/stomp/stomp_map.cc",
+        "src/stomp/stomp_map_expr.cc",
+        "src/stomp/stomp_map_cache.cc",
+        "src/stomp/stomp_map_raster.cc",
         "src/stomp/stomp_scalar_map.cc",
+        "src/stomp/stomp_multi_scalar_map.cc",
         "src/stomp/stomp_tree_map.cc",
+        "src/stomp/stomp_partitioned_tree_map.cc",
+        "src/stomp/stomp_frozen_tree.cc",
+        "src/stomp/stomp_kdtree_map.cc",
+        "src/stomp/stomp_counts_in_cells.cc",
         "src/stomp/stomp_itree_map.cc",
         "src/stomp/stomp_geometry.cc",
         "src/stomp/stomp_util.cc",
         wrap_file],
     extra_compile_args=extra_compile_args,
+    extra_link_args=extra_link_args,
     swig_opts=swig_opts)
 
 # read the long description
@@ -25,11 +25,22 @@
 #include <stomp/stomp_pixel.h>
 #include <stomp/stomp_scalar_pixel.h>
 #include <stomp/stomp_tree_pixel.h>
+#include <stomp/stomp_compact_leaf.h>
 #include <stomp/stomp_itree_pixel.h>
+#include <stomp/stomp_pixel_index.h>
 #include <stomp/stomp_base_map.h>
 #include <stomp/stomp_map.h>
+#include <stomp/stomp_map_expr.h>
+#include <stomp/stomp_map_cache.h>
+#include <stomp/stomp_map_raster.h>
+#include <stomp/stomp_mask_server.h>
 #include <stomp/stomp_scalar_map.h>
+#include <stomp/stomp_multi_scalar_map.h>
 #include <stomp/stomp_tree_map.h>
+#include <stomp/stomp_partitioned_tree_map.h>
+#include <stomp/stomp_frozen_tree.h>
+#include <stomp/stomp_kdtree_map.h>
+#include <stomp/stomp_counts_in_cells.h>
 #include <stomp/stomp_itree_map.h>
 #include <stomp/stomp_geometry.h>
 #include <stomp/stomp_util.h>
@@ -13,6 +13,7 @@
 #include "stomp_angular_bin.h"
 #include "stomp_pixel.h"
 #include "stomp_angular_coordinate.h"
+#include "stomp_util.h"
 
 namespace Stomp {
 
@@ -26,6 +27,7 @@ AngularBin::AngularBin() {
   ClearRegions();
   set_wtheta_ = false;
   set_wtheta_error_ = false;
+  use_annulus_kernel_ = false;
 }
 
 AngularBin::AngularBin(double theta_min, double theta_max) {
@@ -38,6 +40,7 @@ AngularBin::AngularBin(double theta_min, double theta_max) {
   resolution_ = 0;
   set_wtheta_ = false;
   set_wtheta_error_ = false;
+  use_annulus_kernel_ = false;
 }
 
 AngularBin::AngularBin(double theta_min, double theta_max, int16_t n_regions) {
@@ -51,6 +54,7 @@ AngularBin::AngularBin(double theta_min, double theta_max, int16_t n_regions) {
   resolution_ = 0;
   set_wtheta_ = false;
   set_wtheta_error_ = false;
+  use_annulus_kernel_ = false;
 }
 
 AngularBin::~AngularBin() {
@@ -62,6 +66,7 @@ AngularBin::~AngularBin() {
   resolution_ = 0;
   set_wtheta_ = false;
   set_wtheta_error_ = false;
+  use_annulus_kernel_ = false;
 }
 
 void AngularBin::ClearRegions() {
@@ -174,9 +179,20 @@ void AngularBin::CalculateResolution(double lammin, double lammax,
     }
   }
 
+  if (use_annulus_kernel_ && (pixel_resolution > HPixResolution))
+    pixel_resolution /= 2;
+
   SetResolution(pixel_resolution);
 }
 
+void AngularBin::UseAnnulusKernel(bool use_annulus_kernel) {
+  use_annulus_kernel_ = use_annulus_kernel;
+}
+
+bool AngularBin::UsingAnnulusKernel() {
+  return use_annulus_kernel_;
+}
+
 void AngularBin::SetTheta(double theta) {
   theta_ = theta;
 }
@@ -254,6 +270,32 @@ void AngularBin::AddToCounter(uint32_t step, int16_t region) {
   }
 }
 
+void AngularBin::PackPairCounts(std::vector<double>& pair_counts) {
+  pair_counts.clear();
+  pair_counts.reserve(2 + 2*n_region_);
+  pair_counts.push_back(weight_);
+  pair_counts.push_back(static_cast<double>(counter_));
+  for (int16_t k=0;k<n_region_;k++)
+    pair_counts.push_back(weight_region_[k]);
+  for (int16_t k=0;k<n_region_;k++)
+    pair_counts.push_back(static_cast<double>(counter_region_[k]));
+}
+
+bool AngularBin::AddPairCounts(std::vector<double>& pair_counts) {
+  int16_t n_region = (n_region_ > 0 ? n_region_ : 0);
+  if (pair_counts.size() != static_cast<uint32_t>(2 + 2*n_region))
+    return false;
+
+  weight_ += pair_counts[0];
+  counter_ += static_cast<uint32_t>(pair_counts[1]);
+  for (int16_t k=0;k<n_region;k++) {
+    weight_region_[k] += pair_counts[2 + k];
+    counter_region_[k] += static_cast<uint32_t>(pair_counts[2 + n_region + k]);
+  }
+
+  return true;
+}
+
 void AngularBin::MoveWeightToGalGal() {
   gal_gal_ += weight_;
   weight_ = 0.0;
@@ -593,4 +635,80 @@ bool AngularBin::ReverseResolutionOrder(AngularBin theta_a,
   return (theta_b.Resolution() < theta_a.Resolution() ? true : false);
 }
 
+void AngularBin::Serialize(BinaryWriter& writer) {
+  writer.Write(theta_min_);
+  writer.Write(theta_max_);
+  writer.Write(theta_);
+  writer.Write(costheta_min_);
+  writer.Write(costheta_max_);
+  writer.Write(sin2theta_min_);
+  writer.Write(sin2theta_max_);
+  writer.Write(weight_);
+  writer.Write(gal_gal_);
+  writer.Write(gal_rand_);
+  writer.Write(rand_gal_);
+  writer.Write(rand_rand_);
+  writer.Write(pixel_wtheta_);
+  writer.Write(pixel_weight_);
+  writer.Write(wtheta_);
+  writer.Write(wtheta_error_);
+  writer.Write(counter_);
+  writer.Write(resolution_);
+  writer.Write(n_region_);
+  writer.Write(static_cast<uint8_t>(set_wtheta_error_));
+  writer.Write(static_cast<uint8_t>(set_wtheta_));
+  writer.Write(static_cast<uint8_t>(use_annulus_kernel_));
+  writer.WriteVector(weight_region_);
+  writer.WriteVector(gal_gal_region_);
+  writer.WriteVector(gal_rand_region_);
+  writer.WriteVector(rand_gal_region_);
+  writer.WriteVector(rand_rand_region_);
+  writer.WriteVector(pixel_wtheta_region_);
+  writer.WriteVector(pixel_weight_region_);
+  writer.WriteVector(wtheta_region_);
+  writer.WriteVector(wtheta_error_region_);
+  writer.WriteVector(counter_region_);
+}
+
+bool AngularBin::Deserialize(BinaryReader& reader) {
+  uint8_t set_wtheta_error = 0, set_wtheta = 0, use_annulus_kernel = 0;
+  reader.Read(theta_min_);
+  reader.Read(theta_max_);
+  reader.Read(theta_);
+  reader.Read(costheta_min_);
+  reader.Read(costheta_max_);
+  reader.Read(sin2theta_min_);
+  reader.Read(sin2theta_max_);
+  reader.Read(weight_);
+  reader.Read(gal_gal_);
+  reader.Read(gal_rand_);
+  reader.Read(rand_gal_);
+  reader.Read(rand_rand_);
+  reader.Read(pixel_wtheta_);
+  reader.Read(pixel_weight_);
+  reader.Read(wtheta_);
+  reader.Read(wtheta_error_);
+  reader.Read(counter_);
+  reader.Read(resolution_);
+  reader.Read(n_region_);
+  reader.Read(set_wtheta_error);
+  reader.Read(set_wtheta);
+  reader.Read(use_annulus_kernel);
+  reader.ReadVector(weight_region_);
+  reader.ReadVector(gal_gal_region_);
+  reader.ReadVector(gal_rand_region_);
+  reader.ReadVector(rand_gal_region_);
+  reader.ReadVector(rand_rand_region_);
+  reader.ReadVector(pixel_wtheta_region_);
+  reader.ReadVector(pixel_weight_region_);
+  reader.ReadVector(wtheta_region_);
+  reader.ReadVector(wtheta_error_region_);
+  reader.ReadVector(counter_region_);
+  set_wtheta_error_ = (set_wtheta_error != 0);
+  set_wtheta_ = (set_wtheta != 0);
+  use_annulus_kernel_ = (use_annulus_kernel != 0);
+
+  return reader.Status();
+}
+
 } // end namespace Stomp
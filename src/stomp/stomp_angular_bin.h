@@ -22,6 +22,8 @@
 
 namespace Stomp {
 
+class BinaryWriter;  // class declaration in stomp_util.h
+class BinaryReader;  // class declaration in stomp_util.h
 class AngularBin;
 
 typedef std::vector<AngularBin> ThetaVector;
@@ -76,6 +78,16 @@ class AngularBin {
   void CalculateResolution(double lammin = -70.0, double lammax = 70.0,
 			   uint32_t max_resolution = MaxPixelResolution);
 
+  // By default, the pixel-based estimator assigns each pair of pixels to a
+  // bin by the separation of their centers, which is why CalculateResolution
+  // needs pixels smaller than the bin.  With the annulus kernel, each pixel
+  // pair is instead weighted by the fraction of the pair's area whose
+  // separation falls within the bin (see ScalarMap::AutoCorrelate).  That
+  // binning stays accurate for coarser pixels, so CalculateResolution picks
+  // a resolution one step lower (a quarter of the pixels) when it's set.
+  void UseAnnulusKernel(bool use_annulus_kernel);
+  bool UsingAnnulusKernel();
+
   // Seting the angular minima, maxima and mid-point.
   //
   // Depending on whether we're using linear or logarithmic angular binning,
@@ -114,6 +126,16 @@ class AngularBin {
   void AddToWeight(double weight, int16_t region = -1);
   void AddToCounter(uint32_t step=1, int16_t region = -1);
 
+  // When the pair counting is split up between several processes, each of
+  // them accumulates its own Weight and Counter values (including the
+  // per-region values).  These methods pack that state into a flat vector of
+  // doubles and add such a vector from another copy of the bin back into the
+  // current one.  The layout is Weight, Counter, then the region Weights and
+  // region Counters.  The return value of AddPairCounts is false if the
+  // input vector doesn't match the number of regions in the current bin.
+  void PackPairCounts(std::vector<double>& pair_counts);
+  bool AddPairCounts(std::vector<double>& pair_counts);
+
   // For calculating the pair-based w(theta), we use the Landy-Szalay estimator.
   // In the general case of a cross-correlation between two galaxy data sets,
   // there are four terms:
@@ -198,6 +220,12 @@ class AngularBin {
   static bool ReverseResolutionOrder(AngularBin theta_a,
 				     AngularBin theta_b);
 
+  // Pack the bin's limits, resolution and accumulated pair counts (including
+  // the per-region values) into a binary string, as part of
+  // AngularCorrelation::Serialize, and restore them.
+  void Serialize(BinaryWriter& writer);
+  bool Deserialize(BinaryReader& reader);
+
  private:
   double theta_min_, theta_max_, theta_;
   double costheta_min_, costheta_max_, sin2theta_min_, sin2theta_max_;
@@ -211,7 +239,7 @@ class AngularBin {
   std::vector<uint32_t> counter_region_;
   uint32_t resolution_;
   int16_t n_region_;
-  bool set_wtheta_error_, set_wtheta_;
+  bool set_wtheta_error_, set_wtheta_, use_annulus_kernel_;
 };
 
 } // end namespace Stomp
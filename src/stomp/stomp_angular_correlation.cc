@@ -13,11 +13,24 @@
 // large angular scales, so this class draws on nearly the entire breadth of
 // the STOMP library.
 
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <thread>
+#ifdef WITH_MPI
+#include <mpi.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "stomp_core.h"
 #include "stomp_angular_correlation.h"
 #include "stomp_map.h"
 #include "stomp_scalar_map.h"
 #include "stomp_tree_map.h"
+#include "stomp_util.h"
 
 namespace Stomp {
 
@@ -25,9 +38,50 @@ AngularCorrelation::AngularCorrelation() {
   theta_min_ = theta_max_ = sin2theta_min_ = sin2theta_max_ = 0.0;
   min_resolution_ = HPixResolution;
   max_resolution_ = HPixResolution;
+  resolution_floor_ = HPixResolution;
+  resolution_limit_ = MaxPixelResolution;
+  lammin_ = -70.0;
+  lammax_ = 70.0;
   regionation_resolution_ = 0;
   n_region_ = -1;
   manual_resolution_break_ = false;
+  theta_pixel_begin_ = theta_pixel_end_ = thetabin_.begin();
+  theta_pair_begin_ = theta_pair_end_ = thetabin_.begin();
+}
+
+AngularCorrelation::AngularCorrelation(const AngularCorrelation& wtheta) {
+  *this = wtheta;
+}
+
+AngularCorrelation& AngularCorrelation::operator=(
+  const AngularCorrelation& wtheta) {
+  if (this != &wtheta) {
+    uint32_t pixel_begin = wtheta.theta_pixel_begin_ - wtheta.thetabin_.begin();
+    uint32_t pixel_end = wtheta.theta_pixel_end_ - wtheta.thetabin_.begin();
+    uint32_t pair_begin = wtheta.theta_pair_begin_ - wtheta.thetabin_.begin();
+    uint32_t pair_end = wtheta.theta_pair_end_ - wtheta.thetabin_.begin();
+
+    thetabin_ = wtheta.thetabin_;
+    theta_pixel_begin_ = thetabin_.begin() + pixel_begin;
+    theta_pixel_end_ = thetabin_.begin() + pixel_end;
+    theta_pair_begin_ = thetabin_.begin() + pair_begin;
+    theta_pair_end_ = thetabin_.begin() + pair_end;
+    theta_min_ = wtheta.theta_min_;
+    theta_max_ = wtheta.theta_max_;
+    sin2theta_min_ = wtheta.sin2theta_min_;
+    sin2theta_max_ = wtheta.sin2theta_max_;
+    min_resolution_ = wtheta.min_resolution_;
+    max_resolution_ = wtheta.max_resolution_;
+    resolution_floor_ = wtheta.resolution_floor_;
+    resolution_limit_ = wtheta.resolution_limit_;
+    lammin_ = wtheta.lammin_;
+    lammax_ = wtheta.lammax_;
+    regionation_resolution_ = wtheta.regionation_resolution_;
+    n_region_ = wtheta.n_region_;
+    manual_resolution_break_ = wtheta.manual_resolution_break_;
+  }
+
+  return *this;
 }
 
 AngularCorrelation::AngularCorrelation(double theta_min, double theta_max,
@@ -55,6 +109,10 @@ AngularCorrelation::AngularCorrelation(double theta_min, double theta_max,
   sin2theta_max_ = thetabin_[thetabin_.size()-1].Sin2ThetaMax();
 
   regionation_resolution_ = 0;
+  resolution_floor_ = HPixResolution;
+  resolution_limit_ = MaxPixelResolution;
+  lammin_ = -70.0;
+  lammax_ = 70.0;
 
   if (assign_resolutions) {
     AssignBinResolutions();
@@ -95,6 +153,10 @@ AngularCorrelation::AngularCorrelation(uint32_t n_bins,
   sin2theta_max_ = thetabin_[n_bins-1].Sin2ThetaMax();
 
   regionation_resolution_ = 0;
+  resolution_floor_ = HPixResolution;
+  resolution_limit_ = MaxPixelResolution;
+  lammin_ = -70.0;
+  lammax_ = 70.0;
 
   if (assign_resolutions) {
     AssignBinResolutions();
@@ -121,6 +183,13 @@ void AngularCorrelation::AssignBinResolutions(double lammin, double lammax,
   min_resolution_ = MaxPixelResolution;
   max_resolution_ = HPixResolution;
 
+  // Hang on to the limits so that the resolutions can be recalculated the
+  // same way if the bins switch to the annulus kernels.
+  lammin_ = lammin;
+  lammax_ = lammax;
+  resolution_limit_ = max_resolution;
+  resolution_floor_ = HPixResolution;
+
   for (ThetaIterator iter=thetabin_.begin();iter!=thetabin_.end();++iter) {
     iter->CalculateResolution(lammin, lammax, max_resolution);
 
@@ -156,6 +225,7 @@ void AngularCorrelation::SetMaxResolution(uint32_t resolution,
 
 void AngularCorrelation::SetMinResolution(uint32_t resolution) {
   min_resolution_ = resolution;
+  resolution_floor_ = resolution;
   for (ThetaIterator iter=theta_pixel_begin_;iter!=theta_pixel_end_;++iter) {
     if (iter->Resolution() < min_resolution_) {
       iter->SetResolution(min_resolution_);
@@ -163,6 +233,34 @@ void AngularCorrelation::SetMinResolution(uint32_t resolution) {
   }
 }
 
+void AngularCorrelation::UseAnnulusKernels(bool use_annulus_kernels) {
+  bool pixel_bins = false;
+  uint32_t min_resolution = MaxPixelResolution;
+  uint32_t max_resolution = HPixResolution;
+  for (ThetaIterator iter=thetabin_.begin();iter!=thetabin_.end();++iter) {
+    iter->UseAnnulusKernel(use_annulus_kernels);
+
+    // Bins with a resolution of 0 are using the pair-based estimator.
+    if (iter->Resolution() > 0) {
+      pixel_bins = true;
+      iter->CalculateResolution(lammin_, lammax_, resolution_limit_);
+      if (manual_resolution_break_ && (iter->Resolution() > max_resolution_))
+	iter->SetResolution(max_resolution_);
+      if (iter->Resolution() < resolution_floor_)
+	iter->SetResolution(resolution_floor_);
+      if (iter->Resolution() < min_resolution)
+	min_resolution = iter->Resolution();
+      if (iter->Resolution() > max_resolution)
+	max_resolution = iter->Resolution();
+    }
+  }
+
+  if (pixel_bins) {
+    min_resolution_ = min_resolution;
+    if (!manual_resolution_break_) max_resolution_ = max_resolution;
+  }
+}
+
 void AngularCorrelation::AutoMaxResolution(uint32_t n_obj, double area) {
   uint32_t max_resolution = 2048;
 
@@ -783,6 +881,357 @@ void AngularCorrelation::FindPairCrossCorrelation(Map& stomp_map_a,
   }
 }
 
+void AngularCorrelation::FindPartitionedPairs(Map& stomp_map,
+					      WAngularVector& galaxy,
+					      WAngularVector& tree_galaxy,
+					      uint16_t n_partitions) {
+  RegionDict partition_dict;
+  n_partitions = _AssignPartitions(galaxy, n_partitions, partition_dict);
+  if (n_partitions == 0) return;
+
+  // The bin values are accumulated separately for each partition and then
+  // added back in, so we store the current state of the bins and start each
+  // partition from zero.
+  std::vector<double> bin_state;
+  std::vector<std::vector<double> > initial_state;
+  for (ThetaIterator iter=theta_pair_begin_;iter!=theta_pair_end_;++iter) {
+    iter->PackPairCounts(bin_state);
+    initial_state.push_back(bin_state);
+    iter->ResetWeight();
+    iter->ResetCounter();
+  }
+  uint32_t n_values = 0;
+  for (uint32_t i=0;i<initial_state.size();i++)
+    n_values += initial_state[i].size();
+
+#ifdef WITH_MPI
+  int mpi_initialized = 0;
+  MPI_Initialized(&mpi_initialized);
+  if (mpi_initialized) {
+    int rank = 0, n_rank = 1;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &n_rank);
+
+    for (int16_t partition=0;partition<n_partitions;partition++) {
+      if (partition % n_rank == rank)
+	_FindPartitionPairs(stomp_map, galaxy, tree_galaxy,
+			    partition_dict, partition);
+    }
+
+    std::vector<double> local_counts, total_counts(n_values, 0.0);
+    for (ThetaIterator iter=theta_pair_begin_;iter!=theta_pair_end_;++iter) {
+      iter->PackPairCounts(bin_state);
+      local_counts.insert(local_counts.end(), bin_state.begin(),
+			  bin_state.end());
+    }
+    MPI_Allreduce(&local_counts[0], &total_counts[0], n_values,
+		  MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+    uint32_t idx = 0, bin_idx = 0;
+    for (ThetaIterator iter=theta_pair_begin_;
+	 iter!=theta_pair_end_;++iter,bin_idx++) {
+      iter->ResetWeight();
+      iter->ResetCounter();
+      bin_state.assign(total_counts.begin() + idx,
+		       total_counts.begin() + idx +
+		       initial_state[bin_idx].size());
+      idx += initial_state[bin_idx].size();
+      iter->AddPairCounts(initial_state[bin_idx]);
+      iter->AddPairCounts(bin_state);
+    }
+    return;
+  }
+#endif
+
+  // Without MPI, each partition gets its own child process, which writes its
+  // bin values back to us through a pipe.  At most one child per core runs
+  // at a time; the pipes of the running children are read as the data comes
+  // in (a child blocks once its pipe fills) and each child is reaped as soon
+  // as it finishes, making room for the next partition.
+  std::cout.flush();
+  uint16_t n_core = std::thread::hardware_concurrency();
+  uint16_t max_children = (n_core > 0 ? n_core : 1);
+  if (max_children > n_partitions) max_children = n_partitions;
+
+  std::vector<pid_t> child_pid(n_partitions, 0);
+  std::vector<int> child_pipe(n_partitions, -1);
+  std::vector<size_t> n_bytes_read(n_partitions, 0);
+  std::vector<std::vector<double> > partition_counts(n_partitions);
+  std::vector<struct pollfd> child_poll;
+  std::vector<int16_t> poll_partition;
+  bool partition_failed = false;
+  size_t n_bytes = n_values*sizeof(double);
+  int16_t next_partition = 0;
+  uint16_t n_running = 0;
+  while ((next_partition < n_partitions) || (n_running > 0)) {
+    while ((next_partition < n_partitions) && (n_running < max_children)) {
+      int16_t partition = next_partition;
+      int pipe_fd[2];
+      if (pipe(pipe_fd) != 0) {
+	std::cout << "Stomp::AngularCorrelation::FindPartitionedPairs - " <<
+	  "Failed to create pipe.  Exiting.\n";
+	exit(2);
+      }
+
+      pid_t pid = fork();
+      if (pid < 0) {
+	std::cout << "Stomp::AngularCorrelation::FindPartitionedPairs - " <<
+	  "Failed to fork partition " << partition << ".  Exiting.\n";
+	exit(2);
+      }
+
+      if (pid == 0) {
+	// The read ends of the other running children's pipes came along with
+	// the fork; if we held them open, those children's pipes wouldn't
+	// close when they exit.  The parent's OpenMP thread pool doesn't
+	// survive the fork, so we stay single-threaded.
+	close(pipe_fd[0]);
+	for (int16_t i=0;i<partition;i++)
+	  if (child_pipe[i] >= 0) close(child_pipe[i]);
+#ifdef _OPENMP
+	omp_set_num_threads(1);
+#endif
+	_FindPartitionPairs(stomp_map, galaxy, tree_galaxy,
+			    partition_dict, partition);
+	std::vector<double> counts;
+	for (ThetaIterator iter=theta_pair_begin_;
+	     iter!=theta_pair_end_;++iter) {
+	  iter->PackPairCounts(bin_state);
+	  counts.insert(counts.end(), bin_state.begin(), bin_state.end());
+	}
+	const char* buffer = reinterpret_cast<const char*>(&counts[0]);
+	size_t n_write = counts.size()*sizeof(double);
+	while (n_write > 0) {
+	  ssize_t n_written = write(pipe_fd[1], buffer, n_write);
+	  if (n_written <= 0) _exit(1);
+	  buffer += n_written;
+	  n_write -= n_written;
+	}
+	close(pipe_fd[1]);
+	_exit(0);
+      }
+
+      close(pipe_fd[1]);
+      child_pid[partition] = pid;
+      child_pipe[partition] = pipe_fd[0];
+      partition_counts[partition].resize(n_values);
+      next_partition++;
+      n_running++;
+    }
+
+    child_poll.clear();
+    poll_partition.clear();
+    for (int16_t partition=0;partition<next_partition;partition++) {
+      if (child_pipe[partition] < 0) continue;
+      struct pollfd child_fd;
+      child_fd.fd = child_pipe[partition];
+      child_fd.events = POLLIN;
+      child_fd.revents = 0;
+      child_poll.push_back(child_fd);
+      poll_partition.push_back(partition);
+    }
+    if (poll(&child_poll[0], child_poll.size(), -1) < 0) {
+      if (errno == EINTR) continue;
+      std::cout << "Stomp::AngularCorrelation::FindPartitionedPairs - " <<
+	"Failed to poll partitions.  Exiting.\n";
+      exit(2);
+    }
+
+    for (uint16_t i=0;i<child_poll.size();i++) {
+      if (child_poll[i].revents == 0) continue;
+      int16_t partition = poll_partition[i];
+
+      // Read what's there; the child is finished once the pipe closes (or
+      // something goes wrong with it).
+      char* buffer =
+	reinterpret_cast<char*>(&partition_counts[partition][0]);
+      ssize_t n_read = 0;
+      if (n_bytes_read[partition] < n_bytes) {
+	n_read = read(child_pipe[partition], buffer + n_bytes_read[partition],
+		      n_bytes - n_bytes_read[partition]);
+	if ((n_read < 0) && (errno == EINTR)) continue;
+	if (n_read > 0) n_bytes_read[partition] += n_read;
+      }
+      if (n_read > 0) continue;
+
+      close(child_pipe[partition]);
+      child_pipe[partition] = -1;
+      n_running--;
+
+      int status = 0;
+      waitpid(child_pid[partition], &status, 0);
+      if ((n_bytes_read[partition] < n_bytes) || !WIFEXITED(status) ||
+	  (WEXITSTATUS(status) != 0)) {
+	std::cout << "Stomp::AngularCorrelation::FindPartitionedPairs - " <<
+	  "Partition " << partition << " failed.\n";
+	partition_failed = true;
+      }
+    }
+  }
+
+  if (partition_failed) {
+    std::cout << "Stomp::AngularCorrelation::FindPartitionedPairs - " <<
+      "Exiting.\n";
+    exit(2);
+  }
+
+  uint32_t bin_idx = 0, idx = 0;
+  for (ThetaIterator iter=theta_pair_begin_;
+       iter!=theta_pair_end_;++iter,bin_idx++) {
+    iter->AddPairCounts(initial_state[bin_idx]);
+    uint32_t n_bin_values = initial_state[bin_idx].size();
+    for (int16_t partition=0;partition<n_partitions;partition++) {
+      bin_state.assign(partition_counts[partition].begin() + idx,
+		       partition_counts[partition].begin() + idx +
+		       n_bin_values);
+      iter->AddPairCounts(bin_state);
+    }
+    idx += n_bin_values;
+  }
+}
+
+void AngularCorrelation::FindPartitionedPairAutoCorrelation(
+    Map& stomp_map, WAngularVector& galaxy, uint16_t n_partitions,
+    uint8_t random_iterations, bool use_weighted_randoms) {
+  // Same sequence as FindPairAutoCorrelation, but with each of the pair
+  // counting steps handed off to FindPartitionedPairs.
+  WAngularVector map_galaxy;
+  for (WAngularIterator iter=galaxy.begin();iter!=galaxy.end();++iter) {
+    if (stomp_map.Contains(*iter)) map_galaxy.push_back(*iter);
+  }
+  std::cout << "Stomp::AngularCorrelation::FindPartitionedPairAutoCorrelation"
+	    << " - " << map_galaxy.size() << "/" << galaxy.size() <<
+    " objects in map; using " << n_partitions << " partitions...\n";
+
+  // Galaxy-galaxy
+  FindPartitionedPairs(stomp_map, galaxy, map_galaxy, n_partitions);
+  for (ThetaIterator iter=theta_pair_begin_;iter!=theta_pair_end_;++iter)
+    iter->MoveWeightToGalGal();
+
+  for (ThetaIterator iter=theta_pair_begin_;iter!=theta_pair_end_;++iter) {
+    iter->ResetGalRand();
+    iter->ResetRandGal();
+    iter->ResetRandRand();
+  }
+
+  for (uint8_t rand_iter=0;rand_iter<random_iterations;rand_iter++) {
+    WAngularVector random_galaxy;
+    stomp_map.GenerateRandomPoints(random_galaxy, galaxy, use_weighted_randoms);
+
+    // Galaxy-Random
+    FindPartitionedPairs(stomp_map, galaxy, random_galaxy, n_partitions);
+    for (ThetaIterator iter=theta_pair_begin_;iter!=theta_pair_end_;++iter)
+      iter->MoveWeightToGalRand(true);
+
+    // Random-Random
+    FindPartitionedPairs(stomp_map, random_galaxy, random_galaxy,
+			 n_partitions);
+    for (ThetaIterator iter=theta_pair_begin_;iter!=theta_pair_end_;++iter)
+      iter->MoveWeightToRandRand();
+  }
+
+  for (ThetaIterator iter=theta_pair_begin_;iter!=theta_pair_end_;++iter) {
+    iter->RescaleGalRand(1.0*random_iterations);
+    iter->RescaleRandGal(1.0*random_iterations);
+    iter->RescaleRandRand(1.0*random_iterations);
+  }
+}
+
+uint16_t AngularCorrelation::_AssignPartitions(WAngularVector& galaxy,
+					       uint16_t n_partitions,
+					       RegionDict& partition_dict) {
+  // Much like the RegionMap, we walk through the superpixels in order and
+  // cut them into contiguous groups.  Rather than equal area, we aim for
+  // equal numbers of input points, since that sets the amount of work done
+  // in each partition.
+  partition_dict.clear();
+  if ((n_partitions == 0) || galaxy.empty()) return 0;
+
+  std::map<uint32_t, uint32_t> superpix_count;
+  for (WAngularIterator iter=galaxy.begin();iter!=galaxy.end();++iter) {
+    uint32_t superpixnum = 0;
+    Pixel::Ang2Pix(HPixResolution, *iter, superpixnum);
+    superpix_count[superpixnum]++;
+  }
+
+  if (n_partitions > superpix_count.size())
+    n_partitions = superpix_count.size();
+
+  double target = 1.0*galaxy.size()/n_partitions;
+  uint32_t n_assigned = 0;
+  int16_t partition = 0;
+  for (std::map<uint32_t, uint32_t>::iterator iter=superpix_count.begin();
+       iter!=superpix_count.end();++iter) {
+    partition_dict[iter->first] = partition;
+    n_assigned += iter->second;
+    if ((n_assigned >= target*(partition + 1)) &&
+	(partition < n_partitions - 1)) partition++;
+  }
+
+  return partition + 1;
+}
+
+void AngularCorrelation::_FindPartitionPairs(Map& stomp_map,
+					     WAngularVector& galaxy,
+					     WAngularVector& tree_galaxy,
+					     RegionDict& partition_dict,
+					     int16_t partition) {
+  double theta_max = 0.0;
+  for (ThetaIterator iter=theta_pair_begin_;iter!=theta_pair_end_;++iter)
+    if (iter->ThetaMax() > theta_max) theta_max = iter->ThetaMax();
+
+  // Input points in our superpixels.
+  WAngularVector local_galaxy;
+  for (WAngularIterator iter=galaxy.begin();iter!=galaxy.end();++iter) {
+    uint32_t superpixnum = 0;
+    Pixel::Ang2Pix(HPixResolution, *iter, superpixnum);
+    if (partition_dict[superpixnum] == partition)
+      local_galaxy.push_back(*iter);
+  }
+
+  // Tree points in our superpixels, plus the halo of points from neighboring
+  // superpixels that are close enough to pair with one of our input points.
+  int16_t tree_resolution = min_resolution_;
+  if (regionation_resolution_ > min_resolution_)
+    tree_resolution = regionation_resolution_;
+  TreeMap* galaxy_tree = new TreeMap(tree_resolution, 200);
+
+  Pixel superpix;
+  superpix.SetResolution(HPixResolution);
+  PixelVector bound_pix;
+  for (WAngularIterator iter=tree_galaxy.begin();
+       iter!=tree_galaxy.end();++iter) {
+    superpix.BoundingRadius(*iter, theta_max, bound_pix);
+    for (PixelIterator pix_iter=bound_pix.begin();
+	 pix_iter!=bound_pix.end();++pix_iter) {
+      RegionIterator region_iter = partition_dict.find(pix_iter->Pixnum());
+      if ((region_iter != partition_dict.end()) &&
+	  (region_iter->second == partition)) {
+	galaxy_tree->AddPoint(*iter);
+	break;
+      }
+    }
+  }
+
+  if (stomp_map.NRegion() > 0) {
+    if (!galaxy_tree->InitializeRegions(stomp_map)) {
+      std::cout << "Stomp::AngularCorrelation::_FindPartitionPairs - " <<
+	"Failed to initialize regions on TreeMap  Exiting.\n";
+      exit(2);
+    }
+  }
+
+  for (ThetaIterator iter=theta_pair_begin_;iter!=theta_pair_end_;++iter) {
+    if (stomp_map.NRegion() > 0) {
+      galaxy_tree->FindWeightedPairsWithRegions(local_galaxy, *iter);
+    } else {
+      galaxy_tree->FindWeightedPairs(local_galaxy, *iter);
+    }
+  }
+
+  delete galaxy_tree;
+}
+
 bool AngularCorrelation::Write(const std::string& output_file_name) {
   bool wrote_file = false;
 
@@ -815,6 +1264,105 @@ bool AngularCorrelation::Write(const std::string& output_file_name) {
   return wrote_file;
 }
 
+void AngularCorrelation::Serialize(std::string& buffer) {
+  BinaryWriter writer(buffer, "Stomp::AngularCorrelation");
+  writer.Write(theta_min_);
+  writer.Write(theta_max_);
+  writer.Write(sin2theta_min_);
+  writer.Write(sin2theta_max_);
+  writer.Write(min_resolution_);
+  writer.Write(max_resolution_);
+  writer.Write(regionation_resolution_);
+  writer.Write(n_region_);
+  writer.Write(static_cast<uint8_t>(manual_resolution_break_));
+  writer.Write(resolution_floor_);
+  writer.Write(resolution_limit_);
+  writer.Write(lammin_);
+  writer.Write(lammax_);
+
+  // The pixel- and pair-based ranges are stored as offsets into the bins.
+  writer.Write(static_cast<uint32_t>(theta_pixel_begin_ - thetabin_.begin()));
+  writer.Write(static_cast<uint32_t>(theta_pixel_end_ - thetabin_.begin()));
+  writer.Write(static_cast<uint32_t>(theta_pair_begin_ - thetabin_.begin()));
+  writer.Write(static_cast<uint32_t>(theta_pair_end_ - thetabin_.begin()));
+
+  writer.Write(static_cast<uint32_t>(thetabin_.size()));
+  for (ThetaIterator iter=thetabin_.begin();iter!=thetabin_.end();++iter)
+    iter->Serialize(writer);
+}
+
+bool AngularCorrelation::Deserialize(const std::string& buffer) {
+  BinaryReader reader(buffer, "Stomp::AngularCorrelation");
+  double theta_min = 0.0, theta_max = 0.0;
+  double sin2theta_min = 0.0, sin2theta_max = 0.0;
+  uint32_t min_resolution = 0, max_resolution = 0;
+  uint32_t regionation_resolution = 0;
+  int16_t n_region = -1;
+  uint8_t manual_resolution_break = 0;
+  uint32_t resolution_floor = 0, resolution_limit = 0;
+  double lammin = 0.0, lammax = 0.0;
+  uint32_t pixel_begin = 0, pixel_end = 0, pair_begin = 0, pair_end = 0;
+  uint32_t n_bins = 0;
+  reader.Read(theta_min);
+  reader.Read(theta_max);
+  reader.Read(sin2theta_min);
+  reader.Read(sin2theta_max);
+  reader.Read(min_resolution);
+  reader.Read(max_resolution);
+  reader.Read(regionation_resolution);
+  reader.Read(n_region);
+  reader.Read(manual_resolution_break);
+  reader.Read(resolution_floor);
+  reader.Read(resolution_limit);
+  reader.Read(lammin);
+  reader.Read(lammax);
+  reader.Read(pixel_begin);
+  reader.Read(pixel_end);
+  reader.Read(pair_begin);
+  reader.Read(pair_end);
+  reader.Read(n_bins);
+
+  // Each AngularBin stores at least the lengths of its ten per-region
+  // vectors, which bounds the number of bins the buffer can hold.
+  ThetaVector thetabin;
+  if (reader.Status() && (pixel_begin <= pixel_end) &&
+      (pixel_end <= n_bins) && (pair_begin <= pair_end) &&
+      (pair_end <= n_bins) &&
+      (n_bins <= reader.Remaining()/(10*sizeof(uint32_t)))) {
+    thetabin.resize(n_bins);
+    for (ThetaIterator iter=thetabin.begin();
+	 (iter!=thetabin.end()) && reader.Status();++iter)
+      iter->Deserialize(reader);
+  }
+
+  if (!reader.Finished()) {
+    std::cout << "Stomp::AngularCorrelation::Deserialize - " <<
+      "Invalid AngularCorrelation buffer.\n";
+    return false;
+  }
+
+  thetabin_.swap(thetabin);
+  theta_pixel_begin_ = thetabin_.begin() + pixel_begin;
+  theta_pixel_end_ = thetabin_.begin() + pixel_end;
+  theta_pair_begin_ = thetabin_.begin() + pair_begin;
+  theta_pair_end_ = thetabin_.begin() + pair_end;
+  theta_min_ = theta_min;
+  theta_max_ = theta_max;
+  sin2theta_min_ = sin2theta_min;
+  sin2theta_max_ = sin2theta_max;
+  min_resolution_ = min_resolution;
+  max_resolution_ = max_resolution;
+  regionation_resolution_ = regionation_resolution;
+  n_region_ = n_region;
+  manual_resolution_break_ = (manual_resolution_break != 0);
+  resolution_floor_ = resolution_floor;
+  resolution_limit_ = resolution_limit;
+  lammin_ = lammin;
+  lammax_ = lammax;
+
+  return true;
+}
+
 void AngularCorrelation::UseOnlyPixels() {
   AssignBinResolutions();
   theta_pixel_begin_ = thetabin_.begin();
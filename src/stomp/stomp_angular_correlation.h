@@ -20,6 +20,7 @@
 #include "stomp_core.h"
 #include "stomp_angular_coordinate.h"
 #include "stomp_angular_bin.h"
+#include "stomp_base_map.h"
 
 namespace Stomp {
 
@@ -61,6 +62,11 @@ class AngularCorrelation {
     thetabin_.clear();
   };
 
+  // The object keeps iterators into its vector of angular bins, so copies
+  // need to have those iterators pointed at their own bins.
+  AngularCorrelation(const AngularCorrelation& wtheta);
+  AngularCorrelation& operator=(const AngularCorrelation& wtheta);
+
   // Find the resolution we would use to calculate correlation functions for
   // each of the bins.  If this method is not called, then the resolution
   // for each bin is set to -1, which would indicate that any correlation
@@ -87,6 +93,14 @@ class AngularCorrelation {
   // correlation function calculation and the area involved.
   void AutoMaxResolution(uint32_t n_obj, double area);
 
+  // Switch the pixel-based bins to the exact pixel-pair annulus kernels (see
+  // AngularBin::UseAnnulusKernel).  Bins that already have a resolution
+  // assigned have it recalculated, which moves them to coarser maps when the
+  // kernels are on.  The recalculation uses the lambda limits and maximum
+  // resolution from the last call to AssignBinResolutions and still respects
+  // any limits set with SetMinResolution or (by hand) SetMaxResolution.
+  void UseAnnulusKernels(bool use_annulus_kernels = true);
+
   // If we're going to use regions to find jack-knife errors, then we need
   // to initialize the AngularBins to handle this state of affairs or possibly
   // clear out previous calculations.
@@ -146,6 +160,31 @@ class AngularCorrelation {
 				uint8_t random_iterations = 1,
 				bool use_weighted_randoms = false);
 
+  // For the largest data sets, the pair-based estimator can be split across
+  // several processes.  The sky is divided into n_partitions contiguous
+  // groups of superpixels with roughly equal numbers of input points.  Each
+  // partition is handed to a separate process, which builds a TreeMap from
+  // the tree points in its superpixels plus a halo of tree points within
+  // ThetaMax of them (found with Pixel::BoundingRadius) and then finds the
+  // pairs for the input points that fall in its own superpixels.  Since every
+  // input point belongs to exactly one partition, no pair is counted twice.
+  // The Weight and Counter values (including the region values, if the Map
+  // has been regionated) are then added back into the pair-based bins.
+  //
+  // By default, the partitions are run as forked child processes on the
+  // local machine, at most one per core at a time.  If the library is built
+  // with WITH_MPI and MPI has been initialized by the caller, the partitions
+  // are instead spread across the MPI ranks (each rank is assumed to hold the
+  // full input vectors) and the bin values are combined on every rank.
+  void FindPartitionedPairs(Map& stomp_map, WAngularVector& galaxy,
+			    WAngularVector& tree_galaxy,
+			    uint16_t n_partitions);
+  void FindPartitionedPairAutoCorrelation(Map& stomp_map,
+					  WAngularVector& galaxy,
+					  uint16_t n_partitions,
+					  uint8_t random_iterations = 1,
+					  bool use_weighted_randoms = false);
+
   // Once we're done calculating our correlation function, we can write it out
   // to an ASCII file.  The output format will be
   //
@@ -156,6 +195,12 @@ class AngularCorrelation {
   // calculated without regions, then this column will be omitted.
   bool Write(const std::string& output_file_name);
 
+  // Pack the full state of the object (the angular bins, their pair counts
+  // and the resolution and region settings) into a binary string for passing
+  // between processes, and restore it from one.
+  void Serialize(std::string& buffer);
+  bool Deserialize(const std::string& buffer);
+
   // In some cases, we want to default to using either the pair-based or
   // pixel-based estimator for all of our bins, regardless of angular scale.
   // These methods allow us to over-ride the default behavior of the
@@ -195,11 +240,23 @@ class AngularCorrelation {
 
 
  private:
+  // Internal methods for the partitioned pair finding: the first assigns each
+  // superpixel containing input points to a partition and the second finds
+  // the pairs for a single partition, leaving the results in the pair-based
+  // bins.
+  uint16_t _AssignPartitions(WAngularVector& galaxy, uint16_t n_partitions,
+			     RegionDict& partition_dict);
+  void _FindPartitionPairs(Map& stomp_map, WAngularVector& galaxy,
+			   WAngularVector& tree_galaxy,
+			   RegionDict& partition_dict, int16_t partition);
+
   ThetaVector thetabin_;
   ThetaIterator theta_pixel_begin_, theta_pixel_end_;
   ThetaIterator theta_pair_begin_, theta_pair_end_;
   double theta_min_, theta_max_, sin2theta_min_, sin2theta_max_;
   uint32_t min_resolution_, max_resolution_, regionation_resolution_;
+  uint32_t resolution_floor_, resolution_limit_;
+  double lammin_, lammax_;
   int16_t n_region_;
   bool manual_resolution_break_;
 };
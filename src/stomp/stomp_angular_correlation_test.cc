@@ -4,10 +4,12 @@
 #include <string>
 #include <gflags/gflags.h>
 #include "stomp_core.h"
+#include "stomp_util.h"
 #include "stomp_angular_bin.h"
 #include "stomp_angular_correlation.h"
 #include "stomp_map.h"
 #include "stomp_scalar_map.h"
+#include "stomp_tree_map.h"
 
 void AngularBinningTests() {
   // Now we break out the angular bin code.  This class lets you define either
@@ -137,13 +139,69 @@ void AngularBinningTests() {
   }
 }
 
+void AngularCorrelationPartitionedTests() {
+  std::cout << "\n";
+  std::cout << "********************************************\n";
+  std::cout << "*** AngularCorrelation Partitioned Tests ***\n";
+  std::cout << "********************************************\n";
+  // Generate a set of points spread over a number of superpixels and compare
+  // the pair counts from the partitioned code with a single TreeMap.
+  Stomp::AngularCoordinate ang(60.0, 0.0, Stomp::AngularCoordinate::Survey);
+  Stomp::Pixel tmp_pix(ang, 32);
+  Stomp::PixelVector circle_pix;
+  tmp_pix.WithinRadius(8.0, circle_pix);
+  Stomp::Map* stomp_map = new Stomp::Map(circle_pix);
+  Stomp::AngularVector angVec;
+  stomp_map->GenerateRandomPoints(angVec, 10000);
+  Stomp::WAngularVector galaxy;
+  for (Stomp::AngularIterator iter=angVec.begin();iter!=angVec.end();++iter)
+    galaxy.push_back(Stomp::WeightedAngularCoordinate(iter->UnitSphereX(),
+                                                      iter->UnitSphereY(),
+                                                      iter->UnitSphereZ(),
+                                                      1.0));
+
+  Stomp::AngularCorrelation wtheta(0.01, 1.0, 5.0, false);
+  Stomp::AngularCorrelation wtheta_tree(0.01, 1.0, 5.0, false);
+
+  Stomp::StompWatch stomp_watch;
+  uint16_t n_partitions = 4;
+  stomp_watch.StartTimer();
+  wtheta.FindPartitionedPairs(*stomp_map, galaxy, galaxy, n_partitions);
+  stomp_watch.StopTimer();
+  std::cout << "\t" << n_partitions << " partitions: " <<
+    stomp_watch.ElapsedTime() << " seconds.\n";
+
+  Stomp::TreeMap tree_map(Stomp::HPixResolution, 200);
+  for (Stomp::WAngularIterator iter=galaxy.begin();iter!=galaxy.end();++iter)
+    tree_map.AddPoint(*iter);
+  stomp_watch.StartTimer();
+  tree_map.FindWeightedPairs(galaxy, wtheta_tree);
+  stomp_watch.StopTimer();
+  std::cout << "\tSingle TreeMap: " << stomp_watch.ElapsedTime() <<
+    " seconds.\n";
+
+  std::cout << "TreeMap comparison:\n";
+  Stomp::ThetaIterator tree_iter = wtheta_tree.Begin();
+  for (Stomp::ThetaIterator iter=wtheta.Begin();
+       iter!=wtheta.End();++iter,++tree_iter) {
+    std::cout << "\t" << iter->ThetaMin() << " - " << iter->ThetaMax() <<
+      ": " << iter->Weight() << " pairs; " << tree_iter->Weight() <<
+      " TreeMap pairs.\n";
+  }
+
+  delete stomp_map;
+}
+
 // Define our command line flags
 DEFINE_bool(all_angular_correlation_tests, false, "Run all class unit tests.");
 DEFINE_bool(angular_binning_tests, false,
             "Run AngularCorrelation binning tests");
+DEFINE_bool(angular_correlation_partitioned_tests, false,
+            "Run AngularCorrelation partitioned pair tests");
 
 void AngularCorrelationUnitTests(bool run_all_tests) {
   void AngularBinningTests();
+  void AngularCorrelationPartitionedTests();
 
   if (run_all_tests) FLAGS_all_angular_correlation_tests = true;
 
@@ -151,4 +209,9 @@ void AngularCorrelationUnitTests(bool run_all_tests) {
   // classes.
   if (FLAGS_all_angular_correlation_tests || FLAGS_angular_binning_tests)
     AngularBinningTests();
+
+  // Check that the partitioned pair counting matches a single TreeMap.
+  if (FLAGS_all_angular_correlation_tests ||
+      FLAGS_angular_correlation_partitioned_tests)
+    AngularCorrelationPartitionedTests();
 }
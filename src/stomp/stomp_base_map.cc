@@ -19,6 +19,7 @@
 #include "stomp_core.h"
 #include "stomp_geometry.h"
 #include "stomp_base_map.h"
+#include "stomp_util.h"
 
 namespace Stomp {
 
@@ -418,6 +419,48 @@ bool RegionMap::InitializeRegions(BaseMap* base_map, BaseMap& stomp_map) {
   return initialized_region_map;
 }
 
+bool RegionMap::InitializeRegions(BaseMap* base_map, RegionDict& region_dict,
+				  uint32_t region_resolution) {
+  ClearRegions();
+
+  if ((region_resolution < HPixResolution) ||
+      (region_resolution > 2048) || (region_resolution % 2 != 0) ||
+      region_dict.empty()) {
+    std::cout << "Stomp::RegionMap::InitializeRegions - " <<
+      "Invalid region resolution or empty region dictionary.\n";
+    return false;
+  }
+
+  if ((base_map->MinResolution() == base_map->MaxResolution()) &&
+      base_map->MinResolution() < region_resolution) {
+    std::cout << "Stomp::RegionMap::InitializeRegions - " <<
+      "Map resolution too low for the region resolution.\n";
+    return false;
+  }
+
+  int16_t max_region = -1;
+  for (RegionIterator iter=region_dict.begin();
+       iter!=region_dict.end();++iter) {
+    if (iter->second < 0) {
+      std::cout << "Stomp::RegionMap::InitializeRegions - " <<
+	"Invalid region index: " << iter->second << "\n";
+      return false;
+    }
+    if (iter->second > max_region) max_region = iter->second;
+  }
+
+  region_map_ = region_dict;
+  region_resolution_ = region_resolution;
+  n_region_ = static_cast<uint16_t>(max_region + 1);
+
+  region_area_.clear();
+  std::vector<int16_t> regions;
+  for (int16_t i=0;i<=max_region;i++) regions.push_back(i);
+  UpdateRegionArea(base_map, regions);
+
+  return true;
+}
+
 void RegionMap::_FindRegionResolution(BaseMap* base_map, uint16_t n_region,
 				      uint32_t region_resolution) {
   // If we have the default value for the resolution, we need to attempt to
@@ -655,6 +698,27 @@ double RegionMap::RegionArea(int16_t region) {
 	  region_area_[region] : 0.0);
 }
 
+void RegionMap::UpdateRegionArea(BaseMap* base_map,
+				 std::vector<int16_t>& regions) {
+  std::vector<bool> update_region(n_region_, false);
+  for (uint32_t i=0;i<regions.size();i++) {
+    if ((regions[i] >= 0) && (regions[i] < n_region_)) {
+      update_region[regions[i]] = true;
+      region_area_[regions[i]] = 0.0;
+    }
+  }
+
+  for (RegionIterator iter=region_map_.begin();
+       iter!=region_map_.end();++iter) {
+    if ((iter->second >= 0) && (iter->second < n_region_) &&
+	update_region[iter->second]) {
+      Pixel tmp_pix(region_resolution_, iter->first, 1.0);
+      region_area_[iter->second] +=
+	base_map->FindUnmaskedFraction(tmp_pix)*tmp_pix.Area();
+    }
+  }
+}
+
 uint16_t RegionMap::NRegion() {
   return n_region_;
 }
@@ -744,6 +808,11 @@ bool BaseMap::InitializeRegions(BaseMap& base_map) {
   return region_map_.InitializeRegions(this, base_map);
 }
 
+bool BaseMap::InitializeRegions(RegionDict& region_dict,
+				uint32_t region_resolution) {
+  return region_map_.InitializeRegions(this, region_dict, region_resolution);
+}
+
 int16_t BaseMap::FindRegion(AngularCoordinate& ang) {
   return region_map_.FindRegion(ang);
 }
@@ -768,6 +837,10 @@ double BaseMap::RegionArea(int16_t region) {
   return region_map_.RegionArea(region);
 }
 
+void BaseMap::UpdateRegionArea(std::vector<int16_t>& regions) {
+  region_map_.UpdateRegionArea(this, regions);
+}
+
 uint16_t BaseMap::NRegion() {
   return region_map_.NRegion();
 }
@@ -788,4 +861,39 @@ RegionIterator BaseMap::RegionEnd() {
   return region_map_.End();
 }
 
+void BaseMap::SerializeRegions(BinaryWriter& writer) {
+  std::vector<uint32_t> region_pixnum;
+  std::vector<int16_t> region;
+  if (region_map_.Initialized()) {
+    for (RegionIterator iter=region_map_.Begin();
+	 iter!=region_map_.End();++iter) {
+      region_pixnum.push_back(iter->first);
+      region.push_back(iter->second);
+    }
+  }
+
+  writer.Write(region_map_.Initialized() ? region_map_.Resolution() : 0);
+  writer.WriteVector(region_pixnum);
+  writer.WriteVector(region);
+}
+
+bool BaseMap::DeserializeRegions(BinaryReader& reader) {
+  uint32_t region_resolution = 0;
+  std::vector<uint32_t> region_pixnum;
+  std::vector<int16_t> region;
+  if (!reader.Read(region_resolution) || !reader.ReadVector(region_pixnum) ||
+      !reader.ReadVector(region) || (region_pixnum.size() != region.size()))
+    return false;
+
+  ClearRegions();
+  if (region_resolution == 0) return true;
+
+  RegionDict region_dict;
+  for (uint32_t i=0;i<region_pixnum.size();i++)
+    region_dict.insert(region_dict.end(),
+		       std::make_pair(region_pixnum[i], region[i]));
+
+  return InitializeRegions(region_dict, region_resolution);
+}
+
 } // end namespace Stomp
@@ -32,6 +32,8 @@ class AngularCoordinate;  // class declaration in stomp_angular_coordinate.h
 class Pixel;              // class declaration in stomp_pixel.h
 class PixelOrdering;      // class declaration in stomp_pixel.h
 class GeometricBound;     // class declaration in stomp_geometry.h
+class BinaryWriter;       // class declaration in stomp_util.h
+class BinaryReader;       // class declaration in stomp_util.h
 class RegionBound;
 class RegionMap;
 class BaseMap;
@@ -166,6 +168,14 @@ class RegionMap {
   // expected result.  Other use cases are strictly caveat emptor.
   bool InitializeRegions(BaseMap* base_map, BaseMap& source_map);
 
+  // Finally, we can restore a regionation directly from a set of region
+  // indices keyed on the pixel index at region_resolution (as returned by the
+  // Begin and End iterators), say one that was saved to disk earlier.  The
+  // region areas are recalculated from the base_map.  The same caveats apply
+  // as for importing the regionation from another BaseMap.
+  bool InitializeRegions(BaseMap* base_map, RegionDict& region_dict,
+			 uint32_t region_resolution);
+
   // Some internal methods we'll use to handle the actual work of regionation.
   //
   // First up, if we aren't given a specific resolution to use for regionation,
@@ -227,6 +237,11 @@ class RegionMap {
   // Given a region index, return the area associated with that region.
   double RegionArea(int16_t region);
 
+  // If the BaseMap changes without changing the pixels it covers at the
+  // region resolution, the region assignments are still good, but the areas
+  // of the affected regions need to be recalculated.
+  void UpdateRegionArea(BaseMap* base_map, std::vector<int16_t>& regions);
+
   // Some getter methods to describe the state of the RegionMap.
   uint16_t NRegion();
   uint32_t Resolution();
@@ -291,18 +306,27 @@ class BaseMap {
 			     uint16_t n_region,
 			     uint32_t region_resolution = 0);
   bool InitializeRegions(BaseMap& base_map);
+  bool InitializeRegions(RegionDict& region_dict, uint32_t region_resolution);
   int16_t FindRegion(AngularCoordinate& ang);
   int16_t FindRegion(Pixel& pix);
   void ClearRegions();
   void RegionArea(int16_t region, PixelVector& pix);
   int16_t Region(uint32_t region_idx);
   double RegionArea(int16_t region);
+  void UpdateRegionArea(std::vector<int16_t>& regions);
   uint16_t NRegion();
   uint32_t RegionResolution();
   bool RegionsInitialized();
   RegionIterator RegionBegin();
   RegionIterator RegionEnd();
 
+  // Pack the current regionation into (or restore it from) a binary string,
+  // as part of the Serialize and Deserialize methods of the derived classes.
+  // The region areas are recalculated on restoring, so the BaseMap needs to
+  // be restored first.
+  void SerializeRegions(BinaryWriter& writer);
+  bool DeserializeRegions(BinaryReader& reader);
+
  private:
   RegionMap region_map_;
 };
@@ -0,0 +1,237 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This file contains the CompactLeaf class, which stores the points in tree
+// leaf nodes as single precision offsets from the node center.
+
+#include <math.h>
+#include "stomp_core.h"
+#include "stomp_compact_leaf.h"
+#include "stomp_angular_bin.h"
+
+namespace Stomp {
+
+CompactLeaf::CompactLeaf(double center_x, double center_y, double center_z,
+			 uint16_t n_points) {
+  center_x_ = center_x;
+  center_y_ = center_y;
+  center_z_ = center_z;
+
+  if (n_points > 0) {
+    x_.reserve(n_points);
+    y_.reserve(n_points);
+    z_.reserve(n_points);
+  }
+}
+
+CompactLeaf::~CompactLeaf() {
+  Clear();
+}
+
+void CompactLeaf::AddPoint(WeightedAngularCoordinate& w_ang) {
+  x_.push_back(static_cast<float>(w_ang.UnitSphereX() - center_x_));
+  y_.push_back(static_cast<float>(w_ang.UnitSphereY() - center_y_));
+  z_.push_back(static_cast<float>(w_ang.UnitSphereZ() - center_z_));
+  weight_.push_back(static_cast<float>(w_ang.Weight()));
+}
+
+void CompactLeaf::AddPoint(IndexedAngularCoordinate& i_ang) {
+  x_.push_back(static_cast<float>(i_ang.UnitSphereX() - center_x_));
+  y_.push_back(static_cast<float>(i_ang.UnitSphereY() - center_y_));
+  z_.push_back(static_cast<float>(i_ang.UnitSphereZ() - center_z_));
+  index_.push_back(i_ang.Index());
+}
+
+uint32_t CompactLeaf::NPoints() {
+  return x_.size();
+}
+
+void CompactLeaf::Point(uint32_t idx, WeightedAngularCoordinate& w_ang) {
+  w_ang.SetUnitSphereCoordinates(center_x_ + x_[idx], center_y_ + y_[idx],
+				 center_z_ + z_[idx]);
+  w_ang.SetWeight(Weight(idx));
+}
+
+void CompactLeaf::Point(uint32_t idx, IndexedAngularCoordinate& i_ang) {
+  i_ang.SetUnitSphereCoordinates(center_x_ + x_[idx], center_y_ + y_[idx],
+				 center_z_ + z_[idx]);
+  i_ang.SetIndex(Index(idx));
+}
+
+double CompactLeaf::Weight(uint32_t idx) {
+  return (idx < weight_.size() ? weight_[idx] : 0.0);
+}
+
+uint32_t CompactLeaf::Index(uint32_t idx) {
+  return (idx < index_.size() ? index_[idx] : 0);
+}
+
+bool CompactLeaf::SinglePrecisionBin(AngularBin& theta,
+				     double precision_threshold) {
+  // A bin edge at zero doesn't need to be resolved, so only the non-zero
+  // edges need to be larger than the threshold.
+  return ((DoubleLE(theta.ThetaMin(), 0.0) ||
+	   (theta.ThetaMin() >= precision_threshold)) &&
+	  (theta.ThetaMax() >= precision_threshold) ? true : false);
+}
+
+uint32_t CompactLeaf::FindPairs(AngularCoordinate& ang, AngularBin& theta,
+				bool single_precision) {
+  double chord2_min, chord2_max;
+  _ChordBounds(theta, chord2_min, chord2_max);
+
+  double dx = ang.UnitSphereX() - center_x_;
+  double dy = ang.UnitSphereY() - center_y_;
+  double dz = ang.UnitSphereZ() - center_z_;
+
+  uint32_t n_points = x_.size();
+  const float* x = (n_points > 0 ? &x_[0] : NULL);
+  const float* y = (n_points > 0 ? &y_[0] : NULL);
+  const float* z = (n_points > 0 ? &z_[0] : NULL);
+
+  // The loops are written without branches so that the compiler can
+  // vectorize them.
+  uint32_t pair_count = 0;
+  if (single_precision) {
+    float fx = static_cast<float>(dx);
+    float fy = static_cast<float>(dy);
+    float fz = static_cast<float>(dz);
+    float fmin = static_cast<float>(chord2_min);
+    float fmax = static_cast<float>(chord2_max);
+    for (uint32_t i=0;i<n_points;i++) {
+      float cx = fx - x[i];
+      float cy = fy - y[i];
+      float cz = fz - z[i];
+      float chord2 = cx*cx + cy*cy + cz*cz;
+      pair_count += ((chord2 >= fmin) & (chord2 <= fmax));
+    }
+  } else {
+    for (uint32_t i=0;i<n_points;i++) {
+      double cx = dx - x[i];
+      double cy = dy - y[i];
+      double cz = dz - z[i];
+      double chord2 = cx*cx + cy*cy + cz*cz;
+      pair_count += ((chord2 >= chord2_min) & (chord2 <= chord2_max));
+    }
+  }
+
+  return pair_count;
+}
+
+uint32_t CompactLeaf::FindWeightedPairs(AngularCoordinate& ang,
+					AngularBin& theta,
+					bool single_precision,
+					double& total_weight) {
+  double chord2_min, chord2_max;
+  _ChordBounds(theta, chord2_min, chord2_max);
+
+  double dx = ang.UnitSphereX() - center_x_;
+  double dy = ang.UnitSphereY() - center_y_;
+  double dz = ang.UnitSphereZ() - center_z_;
+
+  uint32_t n_points = x_.size();
+  const float* x = (n_points > 0 ? &x_[0] : NULL);
+  const float* y = (n_points > 0 ? &y_[0] : NULL);
+  const float* z = (n_points > 0 ? &z_[0] : NULL);
+  const float* w = (weight_.size() == n_points && n_points > 0 ?
+		    &weight_[0] : NULL);
+
+  // The weights are stored in single precision, but we accumulate them in
+  // double precision.
+  uint32_t pair_count = 0;
+  total_weight = 0.0;
+  if (single_precision) {
+    float fx = static_cast<float>(dx);
+    float fy = static_cast<float>(dy);
+    float fz = static_cast<float>(dz);
+    float fmin = static_cast<float>(chord2_min);
+    float fmax = static_cast<float>(chord2_max);
+    for (uint32_t i=0;i<n_points;i++) {
+      float cx = fx - x[i];
+      float cy = fy - y[i];
+      float cz = fz - z[i];
+      float chord2 = cx*cx + cy*cy + cz*cz;
+      uint32_t in_bin = ((chord2 >= fmin) & (chord2 <= fmax));
+      pair_count += in_bin;
+      if (w != NULL) total_weight += (in_bin ? w[i] : 0.0);
+    }
+  } else {
+    for (uint32_t i=0;i<n_points;i++) {
+      double cx = dx - x[i];
+      double cy = dy - y[i];
+      double cz = dz - z[i];
+      double chord2 = cx*cx + cy*cy + cz*cz;
+      uint32_t in_bin = ((chord2 >= chord2_min) & (chord2 <= chord2_max));
+      pair_count += in_bin;
+      if (w != NULL) total_weight += (in_bin ? w[i] : 0.0);
+    }
+  }
+
+  return pair_count;
+}
+
+void CompactLeaf::MatchPairs(AngularCoordinate& ang, AngularBin& theta,
+			     bool single_precision,
+			     std::vector<uint32_t>& match_idx) {
+  double chord2_min, chord2_max;
+  _ChordBounds(theta, chord2_min, chord2_max);
+
+  double dx = ang.UnitSphereX() - center_x_;
+  double dy = ang.UnitSphereY() - center_y_;
+  double dz = ang.UnitSphereZ() - center_z_;
+
+  uint32_t n_points = x_.size();
+  if (single_precision) {
+    float fx = static_cast<float>(dx);
+    float fy = static_cast<float>(dy);
+    float fz = static_cast<float>(dz);
+    float fmin = static_cast<float>(chord2_min);
+    float fmax = static_cast<float>(chord2_max);
+    for (uint32_t i=0;i<n_points;i++) {
+      float cx = fx - x_[i];
+      float cy = fy - y_[i];
+      float cz = fz - z_[i];
+      float chord2 = cx*cx + cy*cy + cz*cz;
+      if ((chord2 >= fmin) && (chord2 <= fmax)) match_idx.push_back(i);
+    }
+  } else {
+    for (uint32_t i=0;i<n_points;i++) {
+      double cx = dx - x_[i];
+      double cy = dy - y_[i];
+      double cz = dz - z_[i];
+      double chord2 = cx*cx + cy*cy + cz*cz;
+      if ((chord2 >= chord2_min) && (chord2 <= chord2_max))
+	match_idx.push_back(i);
+    }
+  }
+}
+
+void CompactLeaf::Clear() {
+  x_.clear();
+  y_.clear();
+  z_.clear();
+  weight_.clear();
+  index_.clear();
+}
+
+void CompactLeaf::_ChordBounds(AngularBin& theta, double& chord2_min,
+			       double& chord2_max) {
+  // The squared chord length between two points on the unit sphere separated
+  // by an angle theta is 4*sin^2(theta/2).  Unlike 1 - cos(theta), this
+  // doesn't suffer from cancellation for small angles.  As with the cosine
+  // bounds in AngularBin, we pad the bounds by a small tolerance.
+  double sin_half_min = sin(0.5*theta.ThetaMin()*DegToRad);
+  double sin_half_max = sin(0.5*theta.ThetaMax()*DegToRad);
+
+  chord2_min = 4.0*sin_half_min*sin_half_min - 1.0e-15;
+  chord2_max = 4.0*sin_half_max*sin_half_max + 1.0e-15;
+}
+
+} // end namespace Stomp
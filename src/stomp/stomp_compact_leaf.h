@@ -0,0 +1,93 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This header file contains the CompactLeaf class, an alternative storage
+// scheme for the points in the leaf nodes of the TreePixel and
+// IndexedTreePixel classes.  Rather than a vector of pointers to individually
+// allocated WeightedAngularCoordinate or IndexedAngularCoordinate objects, the
+// leaf keeps the point positions in single precision arrays, which shrinks
+// the memory footprint of a tree by a large factor and lets the pair-finding
+// loops run over contiguous data.
+
+#ifndef STOMP_COMPACT_LEAF_H
+#define STOMP_COMPACT_LEAF_H
+
+#include <stdint.h>
+#include <vector>
+#include "stomp_angular_coordinate.h"
+
+namespace Stomp {
+
+class AngularBin;           // class definition in stomp_angular_bin.h
+class CompactLeaf;
+
+class CompactLeaf {
+  // Class object for holding the points in a tree leaf node in single
+  // precision.  Simply truncating the unit sphere coordinates to floats would
+  // limit us to separations of a few arcseconds, so instead each point is
+  // stored as its offset from the node center (which is kept in double
+  // precision).  Since leaf nodes are small, the offsets are small and the
+  // error from truncating them is a tiny fraction of the node size.  The
+  // pair-finding tests use the squared chord distance between the input point
+  // and the stored points, which doesn't lose precision at small separations
+  // the way the cosine does.  The per-point weight (for TreePixel) or index
+  // (for IndexedTreePixel) is stored alongside the positions; the Field values
+  // for WeightedAngularCoordinates are not.
+ public:
+  CompactLeaf(double center_x, double center_y, double center_z,
+	      uint16_t n_points = 0);
+  ~CompactLeaf();
+
+  // Add points to the leaf.  Either form can be used, but the Weight and
+  // Index accessors below will only return meaningful values for points
+  // added with the corresponding form.
+  void AddPoint(WeightedAngularCoordinate& w_ang);
+  void AddPoint(IndexedAngularCoordinate& i_ang);
+  uint32_t NPoints();
+
+  // Reconstruct a copy of a point in double precision.
+  void Point(uint32_t idx, WeightedAngularCoordinate& w_ang);
+  void Point(uint32_t idx, IndexedAngularCoordinate& i_ang);
+  double Weight(uint32_t idx);
+  uint32_t Index(uint32_t idx);
+
+  // The pair-finding methods.  If single_precision is true, the distance
+  // calculations are done in single precision, otherwise the stored offsets
+  // are promoted to double precision first.  The former is faster, but the
+  // rounding of the offset between the input point and the node center means
+  // that the results can't be trusted for very small angular bins, so
+  // SinglePrecisionBin checks whether an AngularBin is safe given a
+  // precision threshold (in degrees).  FindPairs returns the number of points
+  // in the bin, FindWeightedPairs also returns the sum of their weights and
+  // MatchPairs returns the leaf indices of the matching points.
+  static bool SinglePrecisionBin(AngularBin& theta,
+				 double precision_threshold);
+  uint32_t FindPairs(AngularCoordinate& ang, AngularBin& theta,
+		     bool single_precision);
+  uint32_t FindWeightedPairs(AngularCoordinate& ang, AngularBin& theta,
+			     bool single_precision, double& total_weight);
+  void MatchPairs(AngularCoordinate& ang, AngularBin& theta,
+		  bool single_precision, std::vector<uint32_t>& match_idx);
+
+  // Remove all of the points from the leaf.
+  void Clear();
+
+ private:
+  void _ChordBounds(AngularBin& theta, double& chord2_min,
+		    double& chord2_max);
+
+  double center_x_, center_y_, center_z_;
+  std::vector<float> x_, y_, z_, weight_;
+  std::vector<uint32_t> index_;
+};
+
+} // end namespace Stomp
+
+#endif
@@ -38,6 +38,12 @@ const double HPixArea =
       4.0*Pi*StradToDeg/(HPixResolution*HPixResolution*Nx0*Ny0);
 const uint32_t MaxPixnum = Nx0*Ny0*2048*2048;
 const uint32_t MaxSuperpixnum = Nx0*Ny0*HPixResolution*HPixResolution;
+const double SinglePrecisionThreshold = 1.0/3600.0;  // 1 arcsecond
+const uint32_t MinParallelArraySize = 1 << 16;
+const double DenseLookupFillFraction = 0.25;
+const uint32_t AnnulusKernelSampling = 4;
+const uint32_t RasterSubSampling = 8;
+const uint64_t MaxRasterThreadBytes = static_cast<uint64_t>(1) << 29;  // 512MB
 
 bool DoubleLT(double a, double b) {
   return (a < b - 1.0e-15 ? true : false);
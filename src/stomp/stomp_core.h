@@ -65,6 +65,34 @@ extern const double HPixArea;
 extern const uint32_t MaxPixnum;
 extern const uint32_t MaxSuperpixnum;
 
+// The tree classes can optionally store their points in single precision.
+// Angular bins with edges smaller than this scale (in degrees) fall back to
+// double precision arithmetic.
+extern const double SinglePrecisionThreshold;
+
+// The array forms of the Pixel index methods only split the work among
+// OpenMP threads for arrays at least this long; below that, starting the
+// threads costs more than it saves.
+extern const uint32_t MinParallelArraySize;
+
+// ScalarMaps switch to a dense look-up table for their pixels when at least
+// this fraction of the pixels in their occupied superpixels are in the map.
+extern const double DenseLookupFillFraction;
+
+// The pixel-pair annulus kernels sample each pixel at this many times the
+// map resolution (per side) when finding the fraction of a pixel pair's area
+// within an angular bin.  Must be a power of 2.
+extern const uint32_t AnnulusKernelSampling;
+
+// Outside of Survey coordinates, MapRaster splits each pixel into sub-pixels
+// at least this many times smaller (per side) than the output cells.
+extern const uint32_t RasterSubSampling;
+
+// MapRaster gives each thread its own copy of the image sums.  For large
+// images, the number of threads is cut back so that the copies take no more
+// than this many bytes in total.
+extern const uint64_t MaxRasterThreadBytes;
+
 // Some methods to deal with comparisons between doubles.
 bool DoubleLT(double a, double b);
 bool DoubleLE(double a, double b);
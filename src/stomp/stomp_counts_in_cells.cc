@@ -0,0 +1,435 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This file contains the CountsInCells class.  Counts-in-cells statistics
+// can be measured with repeated calls to TreeMap::FindPairs, but this class
+// packages that process up, measuring the counts and unmasked area for a
+// set of cells and radii in a single call.
+
+#include <algorithm>
+#include <map>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "stomp_core.h"
+#include "stomp_counts_in_cells.h"
+#include "stomp_angular_bin.h"
+#include "stomp_pixel.h"
+#include "stomp_map.h"
+#include "stomp_tree_map.h"
+
+namespace Stomp {
+
+CountsInCells::CountsInCells() {
+  area_resolution_ = 0;
+  n_threads_ = 0;
+}
+
+CountsInCells::CountsInCells(double radius) {
+  area_resolution_ = 0;
+  n_threads_ = 0;
+  AddRadius(radius);
+}
+
+CountsInCells::CountsInCells(std::vector<double>& radii) {
+  area_resolution_ = 0;
+  n_threads_ = 0;
+  SetRadii(radii);
+}
+
+CountsInCells::~CountsInCells() {
+  cell_ang_.clear();
+  radii_.clear();
+  ClearCounts();
+}
+
+void CountsInCells::SetRadii(std::vector<double>& radii) {
+  radii_.clear();
+  for (std::vector<double>::iterator iter=radii.begin();
+       iter!=radii.end();++iter) {
+    if (*iter > 0.0) radii_.push_back(*iter);
+  }
+  std::sort(radii_.begin(), radii_.end());
+  ClearCounts();
+}
+
+void CountsInCells::AddRadius(double radius) {
+  if (radius > 0.0) {
+    radii_.push_back(radius);
+    std::sort(radii_.begin(), radii_.end());
+  }
+  ClearCounts();
+}
+
+uint32_t CountsInCells::NRadii() {
+  return radii_.size();
+}
+
+double CountsInCells::Radius(uint32_t radius_idx) {
+  return (radius_idx < radii_.size() ? radii_[radius_idx] : -1.0);
+}
+
+void CountsInCells::SetCells(AngularVector& cell_ang) {
+  cell_ang_.clear();
+  cell_ang_.reserve(cell_ang.size());
+  for (AngularIterator iter=cell_ang.begin();iter!=cell_ang.end();++iter)
+    cell_ang_.push_back(*iter);
+  ClearCounts();
+}
+
+void CountsInCells::AddCell(AngularCoordinate& cell_ang) {
+  cell_ang_.push_back(cell_ang);
+  ClearCounts();
+}
+
+void CountsInCells::GenerateRandomCells(Map& stomp_map, uint32_t n_cells,
+					bool use_weighted_sampling) {
+  cell_ang_.clear();
+  stomp_map.GenerateRandomPoints(cell_ang_, n_cells, use_weighted_sampling);
+  ClearCounts();
+}
+
+void CountsInCells::GenerateGridCells(Map& stomp_map,
+				      uint32_t grid_resolution) {
+  cell_ang_.clear();
+
+  PixelVector grid_pix;
+  stomp_map.Coverage(grid_pix, grid_resolution, false);
+
+  for (PixelIterator iter=grid_pix.begin();iter!=grid_pix.end();++iter) {
+    AngularCoordinate ang;
+    iter->Ang(ang);
+    if (stomp_map.Contains(ang)) cell_ang_.push_back(ang);
+  }
+  ClearCounts();
+}
+
+uint32_t CountsInCells::NCells() {
+  return cell_ang_.size();
+}
+
+void CountsInCells::Cells(AngularVector& cell_ang) {
+  if (!cell_ang.empty()) cell_ang.clear();
+  cell_ang.reserve(cell_ang_.size());
+  for (AngularIterator iter=cell_ang_.begin();iter!=cell_ang_.end();++iter)
+    cell_ang.push_back(*iter);
+}
+
+void CountsInCells::SetAreaResolution(uint32_t resolution) {
+  area_resolution_ = resolution;
+}
+
+uint32_t CountsInCells::AreaResolution(uint32_t radius_idx) {
+  if (area_resolution_ > 0) return area_resolution_;
+
+  // We want enough pixels in each cell that the pixelized cell is a good
+  // approximation of the circle.  Roughly 256 pixels per cell keeps the
+  // error on the cell area at the percent level while keeping the number of
+  // unmasked fraction calls manageable.
+  uint32_t resolution = HPixResolution;
+  if (radius_idx < radii_.size()) {
+    AngularBin theta(0.0, radii_[radius_idx]);
+    double target_area = theta.Area()/256.0;
+    while ((Pixel::PixelArea(resolution) > target_area) &&
+	   (resolution < MaxPixelResolution)) resolution *= 2;
+  }
+
+  return resolution;
+}
+
+void CountsInCells::SetNThreads(uint16_t n_threads) {
+  n_threads_ = n_threads;
+}
+
+uint16_t CountsInCells::NThreads() {
+#ifdef _OPENMP
+  return (n_threads_ > 0 ? n_threads_ : omp_get_max_threads());
+#else
+  return 1;
+#endif
+}
+
+void CountsInCells::FindCounts(TreeMap& tree_map, Map& stomp_map,
+			       bool use_weighted_points) {
+  if (cell_ang_.empty() || radii_.empty()) {
+    std::cout << "Stomp::CountsInCells::FindCounts - " <<
+      "Need at least one cell and one radius.  Exiting.\n";
+    return;
+  }
+
+  uint32_t n_cells = cell_ang_.size();
+  uint32_t n_radii = radii_.size();
+
+  count_.assign(n_cells*n_radii, 0.0);
+  unmasked_area_.assign(n_cells*n_radii, 0.0);
+  unmasked_fraction_.assign(n_cells*n_radii, 0.0);
+
+  // The area pixelization only depends on the radius, so we find it once up
+  // front rather than in each thread.
+  std::vector<uint32_t> area_resolution;
+  area_resolution.reserve(n_radii);
+  for (uint32_t j=0;j<n_radii;j++)
+    area_resolution.push_back(AreaResolution(j));
+
+  // Each cell only touches its own entries in the output vectors and the
+  // TreeMap and Map are only queried, so the cells can be handed out to
+  // separate threads without any further coordination.  Cells near the edges
+  // of the Map are cheaper than those in the interior, so we use dynamic
+  // scheduling to keep the threads balanced.
+  int32_t n_cells_int = static_cast<int32_t>(n_cells);
+#ifdef _OPENMP
+  int n_threads = static_cast<int>(NThreads());
+#pragma omp parallel for schedule(dynamic, 16) num_threads(n_threads)
+#endif
+  for (int32_t i=0;i<n_cells_int;i++) {
+    AngularCoordinate& ang = cell_ang_[i];
+
+    // The radii are sorted, so one pass through the tree out to the largest
+    // radius gives us the counts for all of them.
+    std::vector<uint32_t> cell_counts;
+    std::vector<double> cell_weights;
+    tree_map.FindCumulativePairs(ang, radii_, cell_counts, cell_weights);
+
+    for (uint32_t j=0;j<n_radii;j++) {
+      uint32_t idx = _CellIndex(i, j);
+
+      AngularBin theta(0.0, radii_[j]);
+      if (use_weighted_points) {
+	count_[idx] = cell_weights[j];
+      } else {
+	count_[idx] = static_cast<double>(cell_counts[j]);
+      }
+
+      PixelVector cell_pix;
+      Pixel::WithinAnnulus(ang, area_resolution[j], theta, cell_pix);
+
+      // Most cells are either entirely inside or outside the Map, so we
+      // check the status of the cell pixels' parents first and only find the
+      // unmasked fraction of the individual pixels where a parent straddles
+      // the Map boundary.
+      uint32_t parent_resolution = area_resolution[j]/4;
+      if (parent_resolution < HPixResolution)
+	parent_resolution = HPixResolution;
+      std::map<uint32_t, int8_t> parent_status;
+
+      double unmasked_pixels = 0.0;
+      for (PixelIterator iter=cell_pix.begin();iter!=cell_pix.end();++iter) {
+	Pixel parent_pix = *iter;
+	parent_pix.SetToSuperPix(parent_resolution);
+
+	std::map<uint32_t, int8_t>::iterator status_iter =
+	  parent_status.find(parent_pix.Pixnum());
+	if (status_iter == parent_status.end()) {
+	  status_iter = parent_status.insert(
+	    std::make_pair(parent_pix.Pixnum(),
+			   stomp_map.FindUnmaskedStatus(parent_pix))).first;
+	}
+
+	if (status_iter->second == 1) {
+	  unmasked_pixels += 1.0;
+	} else {
+	  if (status_iter->second == -1)
+	    unmasked_pixels += stomp_map.FindUnmaskedFraction(*iter);
+	}
+      }
+
+      if (!cell_pix.empty()) {
+	unmasked_area_[idx] =
+	  unmasked_pixels*Pixel::PixelArea(area_resolution[j]);
+	unmasked_fraction_[idx] = unmasked_pixels/cell_pix.size();
+      }
+    }
+  }
+}
+
+double CountsInCells::Count(uint32_t cell_idx, uint32_t radius_idx) {
+  uint32_t idx = _CellIndex(cell_idx, radius_idx);
+  return (idx < count_.size() ? count_[idx] : 0.0);
+}
+
+double CountsInCells::UnmaskedArea(uint32_t cell_idx, uint32_t radius_idx) {
+  uint32_t idx = _CellIndex(cell_idx, radius_idx);
+  return (idx < unmasked_area_.size() ? unmasked_area_[idx] : 0.0);
+}
+
+double CountsInCells::UnmaskedFraction(uint32_t cell_idx,
+				       uint32_t radius_idx) {
+  uint32_t idx = _CellIndex(cell_idx, radius_idx);
+  return (idx < unmasked_fraction_.size() ? unmasked_fraction_[idx] : 0.0);
+}
+
+uint32_t CountsInCells::NValidCells(uint32_t radius_idx,
+				    double min_unmasked_fraction) {
+  uint32_t n_valid = 0;
+  for (uint32_t i=0;i<cell_ang_.size();i++)
+    if (_ValidCell(i, radius_idx, min_unmasked_fraction)) n_valid++;
+
+  return n_valid;
+}
+
+void CountsInCells::Moments(uint32_t radius_idx, std::vector<double>& moments,
+			    double min_unmasked_fraction) {
+  moments.assign(4, 0.0);
+
+  uint32_t n_valid = 0;
+  double mean = 0.0;
+  for (uint32_t i=0;i<cell_ang_.size();i++) {
+    if (_ValidCell(i, radius_idx, min_unmasked_fraction)) {
+      mean += count_[_CellIndex(i, radius_idx)];
+      n_valid++;
+    }
+  }
+  if (n_valid == 0) return;
+  mean /= n_valid;
+
+  // Central moments of the count distribution.
+  double mu2 = 0.0, mu3 = 0.0, mu4 = 0.0;
+  for (uint32_t i=0;i<cell_ang_.size();i++) {
+    if (_ValidCell(i, radius_idx, min_unmasked_fraction)) {
+      double delta = count_[_CellIndex(i, radius_idx)] - mean;
+      double delta2 = delta*delta;
+      mu2 += delta2;
+      mu3 += delta2*delta;
+      mu4 += delta2*delta2;
+    }
+  }
+  mu2 /= n_valid;
+  mu3 /= n_valid;
+  mu4 /= n_valid;
+
+  moments[0] = mean;
+  moments[1] = mu2;
+  if (mu2 > 0.0) {
+    moments[2] = mu3/(mu2*sqrt(mu2));
+    moments[3] = mu4/(mu2*mu2) - 3.0;
+  }
+}
+
+double CountsInCells::MeanCount(uint32_t radius_idx,
+				double min_unmasked_fraction) {
+  std::vector<double> moments;
+  Moments(radius_idx, moments, min_unmasked_fraction);
+  return moments[0];
+}
+
+double CountsInCells::CountVariance(uint32_t radius_idx,
+				    double min_unmasked_fraction) {
+  std::vector<double> moments;
+  Moments(radius_idx, moments, min_unmasked_fraction);
+  return moments[1];
+}
+
+void CountsInCells::Histogram(uint32_t radius_idx,
+			      std::vector<uint32_t>& histogram,
+			      double min_unmasked_fraction) {
+  if (!histogram.empty()) histogram.clear();
+
+  for (uint32_t i=0;i<cell_ang_.size();i++) {
+    if (_ValidCell(i, radius_idx, min_unmasked_fraction)) {
+      double count = count_[_CellIndex(i, radius_idx)];
+      uint32_t n = (count > 0.0 ? static_cast<uint32_t>(count) : 0);
+      if (n >= histogram.size()) histogram.resize(n + 1, 0);
+      histogram[n]++;
+    }
+  }
+}
+
+bool CountsInCells::Write(const std::string& output_file_name) {
+  bool wrote_file = false;
+
+  std::ofstream output_file(output_file_name.c_str());
+
+  if (output_file.is_open()) {
+    wrote_file = true;
+
+    for (uint32_t i=0;i<cell_ang_.size();i++) {
+      for (uint32_t j=0;j<radii_.size();j++) {
+	output_file << std::setprecision(12) << cell_ang_[i].RA() << " " <<
+	  cell_ang_[i].DEC() << " " << std::setprecision(6) << radii_[j] <<
+	  " " << Count(i, j) << " " << UnmaskedArea(i, j) << " " <<
+	  UnmaskedFraction(i, j) << "\n";
+      }
+    }
+
+    output_file.close();
+  }
+
+  return wrote_file;
+}
+
+bool CountsInCells::WriteHistogram(const std::string& output_file_name,
+				   double min_unmasked_fraction) {
+  bool wrote_file = false;
+
+  std::ofstream output_file(output_file_name.c_str());
+
+  if (output_file.is_open()) {
+    wrote_file = true;
+
+    for (uint32_t j=0;j<radii_.size();j++) {
+      std::vector<uint32_t> histogram;
+      Histogram(j, histogram, min_unmasked_fraction);
+      uint32_t n_valid = NValidCells(j, min_unmasked_fraction);
+
+      for (uint32_t n=0;n<histogram.size();n++) {
+	output_file << std::setprecision(6) << radii_[j] << " " << n << " " <<
+	  histogram[n] << " " << 1.0*histogram[n]/n_valid << "\n";
+      }
+    }
+
+    output_file.close();
+  }
+
+  return wrote_file;
+}
+
+bool CountsInCells::WriteMoments(const std::string& output_file_name,
+				 double min_unmasked_fraction) {
+  bool wrote_file = false;
+
+  std::ofstream output_file(output_file_name.c_str());
+
+  if (output_file.is_open()) {
+    wrote_file = true;
+
+    for (uint32_t j=0;j<radii_.size();j++) {
+      std::vector<double> moments;
+      Moments(j, moments, min_unmasked_fraction);
+
+      output_file << std::setprecision(6) << radii_[j] << " " <<
+	NValidCells(j, min_unmasked_fraction) << " " << moments[0] << " " <<
+	moments[1] << " " << moments[2] << " " << moments[3] << "\n";
+    }
+
+    output_file.close();
+  }
+
+  return wrote_file;
+}
+
+void CountsInCells::ClearCounts() {
+  count_.clear();
+  unmasked_area_.clear();
+  unmasked_fraction_.clear();
+}
+
+uint32_t CountsInCells::_CellIndex(uint32_t cell_idx, uint32_t radius_idx) {
+  return cell_idx*radii_.size() + radius_idx;
+}
+
+bool CountsInCells::_ValidCell(uint32_t cell_idx, uint32_t radius_idx,
+			       double min_unmasked_fraction) {
+  if ((radius_idx >= radii_.size()) || count_.empty()) return false;
+
+  return DoubleGE(unmasked_fraction_[_CellIndex(cell_idx, radius_idx)],
+		  min_unmasked_fraction);
+}
+
+} // end namespace Stomp
@@ -0,0 +1,155 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This header file contains the CountsInCells class.  Counts-in-cells
+// statistics (the distribution of the number of objects found in circular
+// cells of a given radius placed throughout a survey) can be measured with
+// repeated calls to TreeMap::FindPairs, but this class packages that process
+// up: a single call measures the counts and unmasked area for every cell and
+// every cell radius and the resulting distributions can be reduced to
+// histograms and moments directly.
+
+#ifndef STOMP_COUNTS_IN_CELLS_H
+#define STOMP_COUNTS_IN_CELLS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "stomp_core.h"
+#include "stomp_angular_coordinate.h"
+
+namespace Stomp {
+
+class Map;          // class definition in stomp_map.h
+class TreeMap;      // class definition in stomp_tree_map.h
+class CountsInCells;
+
+class CountsInCells {
+  // Class object for measuring counts-in-cells statistics.  The object holds
+  // a set of cell centers and a set of cell radii (in degrees).  For each
+  // cell, FindCounts makes a single pass through a TreeMap out to the
+  // largest radius to count the objects within every radius (taking the
+  // total number of points for any node that falls between two consecutive
+  // radii rather than checking the individual points) and uses a Map to find
+  // the unmasked area of the cell at each radius.
+  // The unmasked area is found by pixelizing each cell at a resolution fine
+  // enough to put a few hundred pixels in the cell and summing the unmasked
+  // fraction of those pixels.
+  //
+  // Since every cell is independent of the others, the cells are processed
+  // in parallel if the library is compiled with OpenMP support.
+
+ public:
+  CountsInCells();
+  CountsInCells(double radius);
+  CountsInCells(std::vector<double>& radii);
+  ~CountsInCells();
+
+  // The cell radii are stored in ascending order.  Changing the radii or
+  // the cells clears any existing measurements.
+  void SetRadii(std::vector<double>& radii);
+  void AddRadius(double radius);
+  uint32_t NRadii();
+  double Radius(uint32_t radius_idx);
+
+  // There are three ways to specify where the cells go.  The first two take
+  // an explicit list of centers.  The third generates random centers within
+  // the input Map, optionally following the Map weights.  The last places
+  // the cells on a regular grid using the centers of the Map's coverage
+  // pixels at the requested resolution (provided that the pixel center is
+  // within the Map).
+  void SetCells(AngularVector& cell_ang);
+  void AddCell(AngularCoordinate& cell_ang);
+  void GenerateRandomCells(Map& stomp_map, uint32_t n_cells,
+			   bool use_weighted_sampling = false);
+  void GenerateGridCells(Map& stomp_map, uint32_t grid_resolution);
+  uint32_t NCells();
+  void Cells(AngularVector& cell_ang);
+
+  // By default, the pixelization used to find the unmasked area of each cell
+  // is chosen separately for each radius.  Setting the resolution by hand
+  // over-rides this (a value of 0 returns to the default behavior).
+  void SetAreaResolution(uint32_t resolution);
+  uint32_t AreaResolution(uint32_t radius_idx);
+
+  // If OpenMP is available, the cells are divided among n_threads threads.
+  // The default (0) uses the OpenMP default.  Without OpenMP, this value is
+  // ignored.
+  void SetNThreads(uint16_t n_threads);
+  uint16_t NThreads();
+
+  // The main method.  For every cell and radius, find the number of points
+  // in the TreeMap within the cell (or the sum of their weights if
+  // use_weighted_points is true) and the unmasked area of the cell in the
+  // input Map.
+  void FindCounts(TreeMap& tree_map, Map& stomp_map,
+		  bool use_weighted_points = false);
+
+  // Access to the results for individual cells.  The unmasked area is in
+  // square degrees and the unmasked fraction is relative to the pixelized
+  // cell area, so a cell that is completely within the Map will have an
+  // unmasked fraction of exactly 1.
+  double Count(uint32_t cell_idx, uint32_t radius_idx);
+  double UnmaskedArea(uint32_t cell_idx, uint32_t radius_idx);
+  double UnmaskedFraction(uint32_t cell_idx, uint32_t radius_idx);
+
+  // Summary statistics for a given radius.  Only cells with an unmasked
+  // fraction of at least min_unmasked_fraction are used.  Moments returns the
+  // mean, variance, skewness and (excess) kurtosis of the counts, in that
+  // order.  Histogram returns the number of cells containing N objects for
+  // N = 0 up to the maximum count (for weighted counts, the count is
+  // truncated to an integer).
+  uint32_t NValidCells(uint32_t radius_idx,
+		       double min_unmasked_fraction = 1.0);
+  void Moments(uint32_t radius_idx, std::vector<double>& moments,
+	       double min_unmasked_fraction = 1.0);
+  double MeanCount(uint32_t radius_idx, double min_unmasked_fraction = 1.0);
+  double CountVariance(uint32_t radius_idx,
+		       double min_unmasked_fraction = 1.0);
+  void Histogram(uint32_t radius_idx, std::vector<uint32_t>& histogram,
+		 double min_unmasked_fraction = 1.0);
+
+  // Write the results to ASCII files.  The cell file has one line per cell
+  // and radius, formatted as
+  //
+  //   RA  DEC  RADIUS  COUNT  UNMASKED_AREA  UNMASKED_FRACTION
+  //
+  // while the histogram file has one line per radius and count
+  //
+  //   RADIUS  N  N_CELLS  P(N)
+  //
+  // and the moments file has one line per radius
+  //
+  //   RADIUS  N_CELLS  MEAN  VARIANCE  SKEWNESS  KURTOSIS
+  //
+  bool Write(const std::string& output_file_name);
+  bool WriteHistogram(const std::string& output_file_name,
+		      double min_unmasked_fraction = 1.0);
+  bool WriteMoments(const std::string& output_file_name,
+		    double min_unmasked_fraction = 1.0);
+
+  // Remove the measurements (but not the cells or radii).
+  void ClearCounts();
+
+ private:
+  uint32_t _CellIndex(uint32_t cell_idx, uint32_t radius_idx);
+  bool _ValidCell(uint32_t cell_idx, uint32_t radius_idx,
+		  double min_unmasked_fraction);
+
+  AngularVector cell_ang_;
+  std::vector<double> radii_;
+  std::vector<double> count_, unmasked_area_, unmasked_fraction_;
+  uint32_t area_resolution_;
+  uint16_t n_threads_;
+};
+
+} // end namespace Stomp
+
+#endif
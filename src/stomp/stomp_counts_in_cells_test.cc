@@ -0,0 +1,170 @@
+#include <stdint.h>
+#include <iostream>
+#include <math.h>
+#include <string>
+#include <gflags/gflags.h>
+#include "stomp_core.h"
+#include "stomp_util.h"
+#include "stomp_angular_coordinate.h"
+#include "stomp_pixel.h"
+#include "stomp_map.h"
+#include "stomp_tree_map.h"
+#include "stomp_counts_in_cells.h"
+
+void CountsInCellsBasicTests() {
+  // Checking the counts-in-cells measurements against brute force counts.
+  std::cout << "\n";
+  std::cout << "*********************************\n";
+  std::cout << "*** CountsInCells Basic Tests ***\n";
+  std::cout << "*********************************\n";
+
+  // We start with a circular Map and fill a TreeMap with random points.
+  Stomp::AngularCoordinate ang(60.0, 0.0, Stomp::AngularCoordinate::Survey);
+  double theta_bound = 5.0;
+  uint32_t map_resolution = 256;
+  Stomp::Pixel tmp_pix(ang, map_resolution);
+  Stomp::PixelVector map_pix;
+  tmp_pix.WithinRadius(theta_bound, map_pix);
+  Stomp::Map* stomp_map = new Stomp::Map(map_pix);
+  std::cout << "Built Map with " << stomp_map->Area() <<
+    " sq. degrees.\n";
+
+  uint32_t n_points = 100000;
+  Stomp::AngularVector angVec;
+  stomp_map->GenerateRandomPoints(angVec, n_points);
+
+  Stomp::TreeMap tree_map(128, 50);
+  for (Stomp::AngularIterator iter=angVec.begin();iter!=angVec.end();++iter) {
+    Stomp::WeightedAngularCoordinate tmp_ang(iter->UnitSphereX(),
+					     iter->UnitSphereY(),
+					     iter->UnitSphereZ(), 1.0);
+    tree_map.AddPoint(tmp_ang);
+  }
+  double density = 1.0*n_points/stomp_map->Area();
+  std::cout << "\t" << tree_map.NPoints() << " points in TreeMap; " <<
+    density << " points/sq. degree.\n";
+
+  std::vector<double> radii;
+  radii.push_back(0.5);
+  radii.push_back(0.1);
+  radii.push_back(0.25);
+  Stomp::CountsInCells cic(radii);
+
+  uint32_t n_cells = 2000;
+  cic.GenerateRandomCells(*stomp_map, n_cells);
+  std::cout << "\n" << cic.NCells() << " random cells, " << cic.NRadii() <<
+    " radii (";
+  for (uint32_t j=0;j<cic.NRadii();j++)
+    std::cout << cic.Radius(j) << (j + 1 < cic.NRadii() ? ", " : ")\n");
+  std::cout << "\tUsing " << cic.NThreads() << " thread(s).\n";
+
+  Stomp::StompWatch stomp_watch;
+  stomp_watch.StartTimer();
+  cic.FindCounts(tree_map, *stomp_map);
+  stomp_watch.StopTimer();
+  std::cout << "\tFindCounts: " << stomp_watch.ElapsedTime() << "s\n";
+
+  // The same counts, done one cell and radius at a time.
+  Stomp::AngularVector cells;
+  cic.Cells(cells);
+  uint32_t n_mismatch = 0;
+  stomp_watch.StartTimer();
+  for (uint32_t i=0;i<cic.NCells();i++) {
+    for (uint32_t j=0;j<cic.NRadii();j++) {
+      uint32_t n_pairs = tree_map.FindPairs(cells[i], cic.Radius(j));
+      if (n_pairs != static_cast<uint32_t>(cic.Count(i, j))) n_mismatch++;
+    }
+  }
+  stomp_watch.StopTimer();
+  std::cout << "\tTreeMap::FindPairs: " << stomp_watch.ElapsedTime() <<
+    "s; " << n_mismatch << " mismatched counts.\n";
+
+  // FindCounts gets all of the radii for a cell from a single traversal.
+  std::vector<double> sorted_radii;
+  for (uint32_t j=0;j<cic.NRadii();j++) sorted_radii.push_back(cic.Radius(j));
+  n_mismatch = 0;
+  stomp_watch.StartTimer();
+  for (uint32_t i=0;i<cic.NCells();i++) {
+    std::vector<uint32_t> counts;
+    std::vector<double> weights;
+    tree_map.FindCumulativePairs(cells[i], sorted_radii, counts, weights);
+    for (uint32_t j=0;j<cic.NRadii();j++) {
+      if ((counts[j] != static_cast<uint32_t>(cic.Count(i, j))) ||
+	  !Stomp::DoubleEQ(weights[j], cic.Count(i, j))) n_mismatch++;
+    }
+  }
+  stomp_watch.StopTimer();
+  std::cout << "\tTreeMap::FindCumulativePairs: " <<
+    stomp_watch.ElapsedTime() << "s; " << n_mismatch <<
+    " mismatched counts.\n";
+
+  // And a brute force check of a handful of cells.
+  n_mismatch = 0;
+  for (uint32_t i=0;i<10;i++) {
+    for (uint32_t j=0;j<cic.NRadii();j++) {
+      uint32_t n_brute = 0;
+      for (Stomp::AngularIterator iter=angVec.begin();
+	   iter!=angVec.end();++iter) {
+	if (cells[i].AngularDistance(*iter) <= cic.Radius(j)) n_brute++;
+      }
+      if (n_brute != static_cast<uint32_t>(cic.Count(i, j))) n_mismatch++;
+    }
+  }
+  std::cout << "\t" << n_mismatch << " mismatches against brute force" <<
+    " counts for the first 10 cells.\n";
+
+  // For random points, the mean count in fully unmasked cells should be the
+  // density times the cell area and the variance should be Poisson.
+  for (uint32_t j=0;j<cic.NRadii();j++) {
+    std::vector<double> moments;
+    cic.Moments(j, moments);
+    double cell_area = 0.0;
+    for (uint32_t i=0;i<cic.NCells();i++) {
+      if (Stomp::DoubleGE(cic.UnmaskedFraction(i, j), 1.0)) {
+	cell_area = cic.UnmaskedArea(i, j);
+	break;
+      }
+    }
+    std::cout << "\tr = " << cic.Radius(j) << ": " <<
+      cic.NValidCells(j) << " unmasked cells; cell area = " <<
+      cell_area << " sq. degrees.\n";
+    std::cout << "\t\t<N> = " << moments[0] << " (" <<
+      density*cell_area << " expected); Var(N) = " << moments[1] <<
+      "; skewness = " << moments[2] << "; kurtosis = " << moments[3] <<
+      "\n";
+  }
+
+  std::vector<uint32_t> histogram;
+  cic.Histogram(0, histogram);
+  std::cout << "\tHistogram for r = " << cic.Radius(0) << ":\n";
+  for (uint32_t n=0;n<histogram.size();n++) {
+    if (histogram[n] > 0)
+      std::cout << "\t\tN = " << n << ": " << histogram[n] << " cells\n";
+  }
+
+  // Finally, check that the grid placement keeps the cells inside the Map.
+  cic.GenerateGridCells(*stomp_map, 64);
+  cic.FindCounts(tree_map, *stomp_map);
+  std::cout << "\n" << cic.NCells() << " grid cells; " <<
+    cic.NValidCells(cic.NRadii() - 1) << " fully unmasked at r = " <<
+    cic.Radius(cic.NRadii() - 1) << ", mean count = " <<
+    cic.MeanCount(cic.NRadii() - 1) << "\n";
+
+  delete stomp_map;
+}
+
+// Define our command line flags here so we can use these flags later.
+DEFINE_bool(all_counts_in_cells_tests, false, "Run all class unit tests.");
+DEFINE_bool(counts_in_cells_basic_tests, false,
+            "Run CountsInCells basic tests");
+
+void CountsInCellsUnitTests(bool run_all_tests) {
+  void CountsInCellsBasicTests();
+
+  if (run_all_tests) FLAGS_all_counts_in_cells_tests = true;
+
+  // Check the counts-in-cells measurements against TreeMap and brute force
+  // counts.
+  if (FLAGS_all_counts_in_cells_tests || FLAGS_counts_in_cells_basic_tests)
+    CountsInCellsBasicTests();
+}
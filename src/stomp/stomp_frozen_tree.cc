@@ -0,0 +1,481 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This file contains the FrozenTree class, a read-only copy of a TreeMap
+// laid out in contiguous arrays for faster traversal.
+
+#include <math.h>
+#include <map>
+#include <queue>
+#include <algorithm>
+#include "stomp_core.h"
+#include "stomp_frozen_tree.h"
+#include "stomp_angular_bin.h"
+#include "stomp_pixel.h"
+#include "stomp_tree_pixel.h"
+
+// Software prefetching is a compiler extension, so we fall back to doing
+// nothing if it isn't available.
+#if defined(__GNUC__)
+#define STOMP_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define STOMP_PREFETCH(addr)
+#endif
+
+namespace Stomp {
+
+FrozenTree::FrozenTree() {
+  n_top_nodes_ = 0;
+}
+
+FrozenTree::~FrozenTree() {
+  Clear();
+}
+
+void FrozenTree::Build(TreeDict& tree_dict, uint32_t resolution) {
+  Clear();
+
+  if (tree_dict.empty()) return;
+
+  // First, we work out which coarser pixels contain the base level nodes.
+  // Level l has resolution 2^l, so the base level nodes are at level
+  // n_levels and we store the children of each pixel at the coarser levels.
+  uint32_t n_levels = 0;
+  for (uint32_t res=resolution;res>1;res/=2) n_levels++;
+
+  std::vector<std::map<uint32_t, std::vector<uint32_t> > > children(n_levels);
+  for (uint32_t level=n_levels;level>0;level--) {
+    uint32_t hi_res = 1 << level;
+    uint32_t lo_res = hi_res/2;
+    std::vector<uint32_t> pixnums;
+    if (level == n_levels) {
+      for (TreeDictIterator iter=tree_dict.begin();
+	   iter!=tree_dict.end();++iter) pixnums.push_back(iter->first);
+    } else {
+      for (std::map<uint32_t, std::vector<uint32_t> >::iterator iter=
+	     children[level].begin();iter!=children[level].end();++iter)
+	pixnums.push_back(iter->first);
+    }
+    for (std::vector<uint32_t>::iterator iter=pixnums.begin();
+	 iter!=pixnums.end();++iter) {
+      uint32_t x = ((*iter) % (Nx0*hi_res))/2;
+      uint32_t y = ((*iter)/(Nx0*hi_res))/2;
+      children[level-1][Nx0*lo_res*y + x].push_back(*iter);
+    }
+  }
+
+  // Now we lay the nodes out in breadth-first order.  For each node, we keep
+  // track of the source TreePixel (NULL for the coarser pixels we've added)
+  // and the level and pixel index (for those that aren't TreePixels).
+  std::vector<TreePixel*> tree_pix;
+  std::vector<uint32_t> node_level, node_pixnum;
+
+  if (n_levels == 0) {
+    for (TreeDictIterator iter=tree_dict.begin();
+	 iter!=tree_dict.end();++iter) {
+      tree_pix.push_back(iter->second);
+      node_level.push_back(0);
+      node_pixnum.push_back(iter->first);
+    }
+  } else {
+    for (std::map<uint32_t, std::vector<uint32_t> >::iterator iter=
+	   children[0].begin();iter!=children[0].end();++iter) {
+      tree_pix.push_back(NULL);
+      node_level.push_back(0);
+      node_pixnum.push_back(iter->first);
+    }
+  }
+  n_top_nodes_ = tree_pix.size();
+
+  for (uint32_t i=0;i<tree_pix.size();i++) {
+    FrozenNode node;
+    node.first_child = tree_pix.size();
+    node.n_children = 0;
+    node.point_begin = node.point_end = 0;
+
+    if (tree_pix[i] != NULL) {
+      _SetGeometry(node, *tree_pix[i]);
+      for (TreePtrIterator iter=tree_pix[i]->NodesBegin();
+	   iter!=tree_pix[i]->NodesEnd();++iter) {
+	tree_pix.push_back(*iter);
+	node_level.push_back(n_levels);
+	node_pixnum.push_back(0);
+	node.n_children++;
+      }
+    } else {
+      uint32_t res = 1 << node_level[i];
+      if (res >= HPixResolution) {
+	Pixel pix(node_pixnum[i] % (Nx0*res), node_pixnum[i]/(Nx0*res), res);
+	_SetGeometry(node, pix);
+      }
+      std::vector<uint32_t>& sub_pixnums =
+	children[node_level[i]][node_pixnum[i]];
+      for (std::vector<uint32_t>::iterator iter=sub_pixnums.begin();
+	   iter!=sub_pixnums.end();++iter) {
+	tree_pix.push_back(node_level[i] + 1 == n_levels ?
+			   tree_dict[*iter] : NULL);
+	node_level.push_back(node_level[i] + 1);
+	node_pixnum.push_back(*iter);
+	node.n_children++;
+      }
+    }
+    if (node.n_children == 0) node.first_child = 0;
+    nodes_.push_back(node);
+  }
+
+  // The Pixel class doesn't go any coarser than the superpixels, so the
+  // nodes above that level get the smallest cap around the caps of their
+  // children that we can easily find.  Children always come after their
+  // parents, so working backwards gives us the children first.
+  for (uint32_t i=nodes_.size();i>0;i--) {
+    if ((tree_pix[i - 1] == NULL) &&
+	((1U << node_level[i - 1]) < HPixResolution))
+      _SetBoundingGeometry(nodes_[i - 1]);
+  }
+
+  // Finally, we copy the points in depth-first order so that each node's
+  // points form a contiguous range.
+  node_weight_.resize(nodes_.size(), 0.0);
+  for (uint32_t i=0;i<n_top_nodes_;i++) _AddPoints(i, tree_pix);
+}
+
+void FrozenTree::_SetGeometry(FrozenNode& node, Pixel& pix) {
+  node.x = pix.UnitSphereX();
+  node.y = pix.UnitSphereY();
+  node.z = pix.UnitSphereZ();
+
+  // The pixel edges are either great circles (constant eta) or lines of
+  // constant lambda, so the most distant point of the pixel from its center
+  // is one of the corners.  We measure the distance with the chord length,
+  // which is accurate for small pixels, and pad the result slightly to cover
+  // rounding in the stored point positions.
+  double corner[4][3] = {
+    {pix.UnitSphereX_UL(), pix.UnitSphereY_UL(), pix.UnitSphereZ_UL()},
+    {pix.UnitSphereX_UR(), pix.UnitSphereY_UR(), pix.UnitSphereZ_UR()},
+    {pix.UnitSphereX_LL(), pix.UnitSphereY_LL(), pix.UnitSphereZ_LL()},
+    {pix.UnitSphereX_LR(), pix.UnitSphereY_LR(), pix.UnitSphereZ_LR()}};
+  double max_chord = 0.0;
+  for (uint32_t i=0;i<4;i++) {
+    double dx = corner[i][0] - node.x;
+    double dy = corner[i][1] - node.y;
+    double dz = corner[i][2] - node.z;
+    double chord = sqrt(dx*dx + dy*dy + dz*dz);
+    if (chord > max_chord) max_chord = chord;
+  }
+  if (max_chord > 2.0) max_chord = 2.0;
+
+  node.radius = 2.0*asin(0.5*max_chord)*(1.0 + 1.0e-6) + 1.0e-12;
+  if (node.radius > Pi) node.radius = Pi;
+  node.cos_radius = cos(node.radius);
+  node.sin_radius = sin(node.radius);
+}
+
+void FrozenTree::_SetBoundingGeometry(FrozenNode& node) {
+  double x = 0.0, y = 0.0, z = 0.0;
+  for (uint32_t i=node.first_child;i<node.first_child+node.n_children;i++) {
+    x += nodes_[i].x;
+    y += nodes_[i].y;
+    z += nodes_[i].z;
+  }
+  double norm = sqrt(x*x + y*y + z*z);
+  if (norm > 0.0) {
+    node.x = x/norm;
+    node.y = y/norm;
+    node.z = z/norm;
+  } else {
+    node.x = nodes_[node.first_child].x;
+    node.y = nodes_[node.first_child].y;
+    node.z = nodes_[node.first_child].z;
+  }
+
+  node.radius = 0.0;
+  for (uint32_t i=node.first_child;i<node.first_child+node.n_children;i++) {
+    double dx = nodes_[i].x - node.x;
+    double dy = nodes_[i].y - node.y;
+    double dz = nodes_[i].z - node.z;
+    double chord = sqrt(dx*dx + dy*dy + dz*dz);
+    if (chord > 2.0) chord = 2.0;
+    double radius = 2.0*asin(0.5*chord) + nodes_[i].radius;
+    if (radius > node.radius) node.radius = radius;
+  }
+
+  node.radius = node.radius*(1.0 + 1.0e-6) + 1.0e-12;
+  if (node.radius > Pi) node.radius = Pi;
+  node.cos_radius = cos(node.radius);
+  node.sin_radius = sin(node.radius);
+}
+
+void FrozenTree::_AddPoints(uint32_t node_idx,
+			    std::vector<TreePixel*>& tree_pix) {
+  FrozenNode& node = nodes_[node_idx];
+  node.point_begin = x_.size();
+
+  double total_weight = 0.0;
+  if (node.n_children == 0) {
+    if (tree_pix[node_idx] != NULL) {
+      WAngularVector w_ang;
+      tree_pix[node_idx]->Points(w_ang);
+      for (WAngularIterator iter=w_ang.begin();iter!=w_ang.end();++iter) {
+	x_.push_back(iter->UnitSphereX());
+	y_.push_back(iter->UnitSphereY());
+	z_.push_back(iter->UnitSphereZ());
+	weight_.push_back(iter->Weight());
+	total_weight += iter->Weight();
+      }
+    }
+  } else {
+    for (uint32_t i=node.first_child;
+	 i<node.first_child+node.n_children;i++) {
+      _AddPoints(i, tree_pix);
+      total_weight += node_weight_[i];
+    }
+  }
+
+  node.point_end = x_.size();
+  node_weight_[node_idx] = total_weight;
+}
+
+uint32_t FrozenTree::FindPairs(AngularCoordinate& ang, AngularBin& theta) {
+  double total_weight = 0.0;
+  return _FindPairs(ang, theta, false, total_weight);
+}
+
+uint32_t FrozenTree::FindWeightedPairs(AngularCoordinate& ang,
+				       AngularBin& theta,
+				       double& total_weight) {
+  return _FindPairs(ang, theta, true, total_weight);
+}
+
+uint32_t FrozenTree::_FindPairs(AngularCoordinate& ang, AngularBin& theta,
+				bool use_weights, double& total_weight) {
+  uint32_t pair_count = 0;
+  total_weight = 0.0;
+
+  if (nodes_.empty()) return pair_count;
+
+  double ang_x = ang.UnitSphereX();
+  double ang_y = ang.UnitSphereY();
+  double ang_z = ang.UnitSphereZ();
+
+  double theta_min = theta.ThetaMin()*DegToRad;
+  double theta_max = theta.ThetaMax()*DegToRad;
+  double cos_theta_min = cos(theta_min), sin_theta_min = sin(theta_min);
+  double cos_theta_max = cos(theta_max), sin_theta_max = sin(theta_max);
+  bool zero_theta_min = DoubleLE(theta.ThetaMin(), 0.0);
+  bool use_cos_bounds = (theta.ThetaMax() < 90.0 ? true : false);
+
+  // The point tests use the same bounds as AngularBin::WithinCosBounds so
+  // that the results match the TreeMap.
+  double costheta_lo = theta.CosThetaMin() - 1.0e-15;
+  double costheta_hi = theta.CosThetaMax() + 1.0e-15;
+
+  std::vector<uint32_t> node_stack;
+  node_stack.reserve(64 + n_top_nodes_);
+  for (uint32_t i=n_top_nodes_;i>0;i--) node_stack.push_back(i - 1);
+
+  while (!node_stack.empty()) {
+    uint32_t node_idx = node_stack.back();
+    node_stack.pop_back();
+    const FrozenNode& node = nodes_[node_idx];
+
+    double costheta = ang_x*node.x + ang_y*node.y + ang_z*node.z;
+
+    // With d the distance to the node center and r the node radius, the
+    // node is outside the annulus if d - r > theta_max or d + r < theta_min
+    // and fully inside if d + r <= theta_max and d - r >= theta_min.  Each
+    // of these can be checked against the cosine of the sum or difference of
+    // the angles without any inverse trigonometry.
+    if ((theta_max + node.radius < Pi) &&
+	(costheta < cos_theta_max*node.cos_radius -
+	 sin_theta_max*node.sin_radius)) continue;
+    if ((theta_min > node.radius) &&
+	(costheta > cos_theta_min*node.cos_radius +
+	 sin_theta_min*node.sin_radius)) continue;
+
+    bool inside_outer = ((theta_max >= node.radius) &&
+			 (costheta >= cos_theta_max*node.cos_radius +
+			  sin_theta_max*node.sin_radius));
+    bool outside_inner = (zero_theta_min ||
+			  ((theta_min + node.radius < Pi) &&
+			   (costheta <= cos_theta_min*node.cos_radius -
+			    sin_theta_min*node.sin_radius)));
+
+    if (inside_outer && outside_inner) {
+      pair_count += node.point_end - node.point_begin;
+      if (use_weights) total_weight += node_weight_[node_idx];
+    } else if (node.n_children > 0) {
+      // The children are adjacent, so we can start pulling them into the
+      // cache before we get to them.
+      for (uint32_t i=node.first_child+node.n_children;
+	   i>node.first_child;i--) {
+	STOMP_PREFETCH(&nodes_[i - 1]);
+	node_stack.push_back(i - 1);
+      }
+    } else if (use_cos_bounds) {
+      const double* x = (x_.empty() ? NULL : &x_[0]);
+      const double* y = (y_.empty() ? NULL : &y_[0]);
+      const double* z = (z_.empty() ? NULL : &z_[0]);
+      const double* w = (weight_.empty() ? NULL : &weight_[0]);
+      for (uint32_t i=node.point_begin;i<node.point_end;i++) {
+	double point_costheta = ang_x*x[i] + ang_y*y[i] + ang_z*z[i];
+	uint32_t in_bin = ((point_costheta >= costheta_lo) &
+			   (point_costheta <= costheta_hi));
+	pair_count += in_bin;
+	if (use_weights) total_weight += (in_bin ? w[i] : 0.0);
+      }
+    } else {
+      for (uint32_t i=node.point_begin;i<node.point_end;i++) {
+	double point_costheta = ang_x*x_[i] + ang_y*y_[i] + ang_z*z_[i];
+	double point_theta =
+	  RadToDeg*asin(sqrt(fabs(1.0 - point_costheta*point_costheta)));
+	if (theta.WithinBounds(point_theta)) {
+	  pair_count++;
+	  if (use_weights) total_weight += weight_[i];
+	}
+      }
+    }
+  }
+
+  return pair_count;
+}
+
+double FrozenTree::_MinChord2(AngularCoordinate& ang, uint32_t node_idx) {
+  const FrozenNode& node = nodes_[node_idx];
+  double dx = ang.UnitSphereX() - node.x;
+  double dy = ang.UnitSphereY() - node.y;
+  double dz = ang.UnitSphereZ() - node.z;
+  double chord = sqrt(dx*dx + dy*dy + dz*dz);
+  if (chord > 2.0) chord = 2.0;
+
+  double min_theta = 2.0*asin(0.5*chord) - node.radius;
+  if (min_theta <= 0.0) return 0.0;
+
+  double sin_half = sin(0.5*min_theta);
+  return 4.0*sin_half*sin_half;
+}
+
+uint32_t FrozenTree::_NeighborSearch(
+  AngularCoordinate& ang, uint32_t n_neighbors,
+  std::vector<std::pair<double, uint32_t> >& neighbors) {
+  neighbors.clear();
+  uint32_t nodes_visited = 0;
+  if (nodes_.empty() || (n_neighbors == 0)) return nodes_visited;
+
+  // This is a best-first search: the nodes are kept in a queue ordered by
+  // the minimum possible squared chord distance to any of their points and
+  // the current neighbors are kept in a heap with the most distant on top.
+  // Once the nearest node in the queue is farther away than the kth
+  // neighbor, we're done.
+  typedef std::pair<double, uint32_t> DistanceIndexPair;
+  std::priority_queue<DistanceIndexPair, std::vector<DistanceIndexPair>,
+    std::greater<DistanceIndexPair> > node_queue;
+  for (uint32_t i=0;i<n_top_nodes_;i++)
+    node_queue.push(DistanceIndexPair(_MinChord2(ang, i), i));
+
+  double ang_x = ang.UnitSphereX();
+  double ang_y = ang.UnitSphereY();
+  double ang_z = ang.UnitSphereZ();
+
+  while (!node_queue.empty()) {
+    if ((neighbors.size() == n_neighbors) &&
+	(node_queue.top().first >= neighbors.front().first)) break;
+
+    uint32_t node_idx = node_queue.top().second;
+    node_queue.pop();
+    nodes_visited++;
+
+    const FrozenNode& node = nodes_[node_idx];
+    if (node.n_children > 0) {
+      for (uint32_t i=node.first_child;
+	   i<node.first_child+node.n_children;i++) {
+	STOMP_PREFETCH(&nodes_[i]);
+      }
+      for (uint32_t i=node.first_child;
+	   i<node.first_child+node.n_children;i++) {
+	double min_chord2 = _MinChord2(ang, i);
+	if ((neighbors.size() < n_neighbors) ||
+	    (min_chord2 < neighbors.front().first))
+	  node_queue.push(DistanceIndexPair(min_chord2, i));
+      }
+    } else {
+      for (uint32_t i=node.point_begin;i<node.point_end;i++) {
+	double dx = ang_x - x_[i];
+	double dy = ang_y - y_[i];
+	double dz = ang_z - z_[i];
+	double chord2 = dx*dx + dy*dy + dz*dz;
+	if (neighbors.size() < n_neighbors) {
+	  neighbors.push_back(DistanceIndexPair(chord2, i));
+	  std::push_heap(neighbors.begin(), neighbors.end());
+	} else if (chord2 < neighbors.front().first) {
+	  std::pop_heap(neighbors.begin(), neighbors.end());
+	  neighbors.back() = DistanceIndexPair(chord2, i);
+	  std::push_heap(neighbors.begin(), neighbors.end());
+	}
+      }
+    }
+  }
+
+  std::sort_heap(neighbors.begin(), neighbors.end());
+
+  return nodes_visited;
+}
+
+uint32_t FrozenTree::FindKNearestNeighbors(AngularCoordinate& ang,
+					   uint32_t n_neighbors,
+					   WAngularVector& neighbor_ang) {
+  if (!neighbor_ang.empty()) neighbor_ang.clear();
+
+  std::vector<std::pair<double, uint32_t> > neighbors;
+  uint32_t nodes_visited = _NeighborSearch(ang, n_neighbors, neighbors);
+
+  // To match the TreeNeighbor, the most distant neighbor comes first.
+  neighbor_ang.reserve(neighbors.size());
+  for (uint32_t i=neighbors.size();i>0;i--) {
+    uint32_t idx = neighbors[i - 1].second;
+    neighbor_ang.push_back(WeightedAngularCoordinate(x_[idx], y_[idx],
+						     z_[idx], weight_[idx]));
+  }
+
+  return nodes_visited;
+}
+
+double FrozenTree::KNearestNeighborDistance(AngularCoordinate& ang,
+					    uint32_t n_neighbors,
+					    uint32_t& nodes_visited) {
+  std::vector<std::pair<double, uint32_t> > neighbors;
+  nodes_visited = _NeighborSearch(ang, n_neighbors, neighbors);
+
+  // As with the TreeNeighbor, an incomplete list gives the maximum distance.
+  if (neighbors.size() < n_neighbors || neighbors.empty()) return 180.0;
+
+  double chord = sqrt(neighbors.back().first);
+  if (chord > 2.0) chord = 2.0;
+  return 2.0*RadToDeg*asin(0.5*chord);
+}
+
+uint32_t FrozenTree::NPoints() {
+  return x_.size();
+}
+
+uint32_t FrozenTree::NNodes() {
+  return nodes_.size();
+}
+
+void FrozenTree::Clear() {
+  nodes_.clear();
+  node_weight_.clear();
+  x_.clear();
+  y_.clear();
+  z_.clear();
+  weight_.clear();
+  n_top_nodes_ = 0;
+}
+
+} // end namespace Stomp
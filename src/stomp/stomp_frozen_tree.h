@@ -0,0 +1,106 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This header file contains the FrozenTree class.  Once a TreeMap has been
+// filled, the tree structure doesn't change, but the pair-finding and nearest
+// neighbor searches still have to chase pointers from node to node, each of
+// which is a separate heap allocation.  The FrozenTree is a read-only copy of
+// the tree laid out in contiguous arrays, so that traversals touch as few
+// cache lines as possible.
+
+#ifndef STOMP_FROZEN_TREE_H
+#define STOMP_FROZEN_TREE_H
+
+#include <stdint.h>
+#include <vector>
+#include "stomp_angular_coordinate.h"
+#include "stomp_tree_map.h"
+
+namespace Stomp {
+
+class AngularBin;           // class definition in stomp_angular_bin.h
+class FrozenTree;
+
+struct FrozenNode {
+  // The data we need to decide whether to descend into a node.  Each node is
+  // treated as a spherical cap around the pixel center whose radius reaches
+  // the farthest pixel corner, which keeps the intersection tests to a single
+  // dot product.  The struct is sized to fit in a single 64 byte cache line.
+  double x, y, z;
+  double radius, cos_radius, sin_radius;
+  uint32_t first_child, point_begin, point_end;
+  uint16_t n_children;
+};
+
+class FrozenTree {
+  // Class object for the flattened copy of a TreeMap.  The nodes are stored
+  // in breadth-first order, so the children of any node are adjacent in
+  // memory and can be prefetched together while the traversal is working on
+  // the current node.  The points are stored as separate coordinate arrays in
+  // depth-first order, so the points belonging to any node (not just the
+  // leaf nodes) form a contiguous range.  That lets a node that is fully
+  // contained in an angular bin report its point count without any extra
+  // storage.  Data that is only needed in that case (the total weight in each
+  // node) is kept in a separate array so that it doesn't dilute the node
+  // array.
+  //
+  // Above the base level nodes of the TreeMap, we add the coarser pixels that
+  // contain them, up to the coarsest resolution, so that every search starts
+  // from a short list of top level nodes regardless of the TreeMap
+  // resolution.  Below the superpixel resolution, these are built as caps
+  // around their children rather than from Pixel geometry.
+  //
+  // Field values are not copied into the FrozenTree.
+ public:
+  FrozenTree();
+  ~FrozenTree();
+
+  // Build the flattened tree from the base level nodes of a TreeMap.  Any
+  // existing contents are replaced.
+  void Build(TreeDict& tree_dict, uint32_t resolution);
+
+  // Pair-finding.  Unlike the TreePixel methods, the AngularBin is not
+  // modified.  FindWeightedPairs returns the number of pairs and sets the
+  // sum of the weights of the paired points.
+  uint32_t FindPairs(AngularCoordinate& ang, AngularBin& theta);
+  uint32_t FindWeightedPairs(AngularCoordinate& ang, AngularBin& theta,
+			     double& total_weight);
+
+  // Nearest neighbor searches.  As with the TreeMap, the neighbors are
+  // returned with the most distant first and the return value is the number
+  // of nodes visited.
+  uint32_t FindKNearestNeighbors(AngularCoordinate& ang, uint32_t n_neighbors,
+				 WAngularVector& neighbor_ang);
+  double KNearestNeighborDistance(AngularCoordinate& ang, uint32_t n_neighbors,
+				  uint32_t& nodes_visited);
+
+  uint32_t NPoints();
+  uint32_t NNodes();
+  void Clear();
+
+ private:
+  uint32_t _FindPairs(AngularCoordinate& ang, AngularBin& theta,
+		      bool use_weights, double& total_weight);
+  uint32_t _NeighborSearch(AngularCoordinate& ang, uint32_t n_neighbors,
+			   std::vector<std::pair<double, uint32_t> >& neighbors);
+  double _MinChord2(AngularCoordinate& ang, uint32_t node_idx);
+  void _SetGeometry(FrozenNode& node, Pixel& pix);
+  void _SetBoundingGeometry(FrozenNode& node);
+  void _AddPoints(uint32_t node_idx, std::vector<TreePixel*>& tree_pix);
+
+  std::vector<FrozenNode> nodes_;
+  std::vector<double> node_weight_;
+  std::vector<double> x_, y_, z_, weight_;
+  uint32_t n_top_nodes_;
+};
+
+} // end namespace Stomp
+
+#endif
@@ -259,17 +259,9 @@ bool GeometricBound::ContinuousBounds() {
 }
 
 void GeometricBound::GenerateRandomPoint(AngularCoordinate& ang) {
-  bool keep = false;
-
-  while (!keep) {
-    double z = z_min_ + mtrand_.rand(z_max_ - z_min_);
-    double lambda = asin(z)*RadToDeg;
-    double eta = etamin_ + mtrand_.rand(etamax_ - etamin_);
-    ang.SetSurveyCoordinates(lambda, eta);
-
-    if (CheckPoint(ang)) keep = true;
-  }
-
+  AngularVector angVec;
+  GenerateRandomPoints(angVec, 1);
+  ang = angVec[0];
 }
 
 void GeometricBound::GenerateRandomPoints(AngularVector& angVec,
@@ -277,19 +269,119 @@ void GeometricBound::GenerateRandomPoints(AngularVector& angVec,
   if (!angVec.empty()) angVec.clear();
   angVec.reserve(n_rand);
 
-  bool keep = false;
+  // We draw the uniform deviates for all of the outstanding points at once
+  // so that the derived classes can turn them into positions in a single
+  // loop over contiguous arrays, then go back for as many points as were
+  // rejected.
+  std::vector<double> u, v, unit_sphere_x, unit_sphere_y, unit_sphere_z;
   AngularCoordinate tmp_ang(0.0,0.0);
 
-  for (uint32_t i=0;i<n_rand;i++) {
-    while (!keep) {
-      double z = z_min_ + mtrand_.rand(z_max_ - z_min_);
-      double lambda = asin(z)*RadToDeg;
-      double eta = etamin_ + mtrand_.rand(etamax_ - etamin_);
+  while (angVec.size() < n_rand) {
+    uint32_t n_draw = n_rand - angVec.size();
+    u.resize(n_draw);
+    v.resize(n_draw);
+    for (uint32_t i=0;i<n_draw;i++) {
+      u[i] = mtrand_.randExc();
+      v[i] = mtrand_.randExc();
+    }
+
+    if (_DirectRandomPoints(u, v, unit_sphere_x, unit_sphere_y,
+			    unit_sphere_z)) {
+      for (uint32_t i=0;i<n_draw;i++) {
+	tmp_ang.SetUnitSphereCoordinates(unit_sphere_x[i], unit_sphere_y[i],
+					 unit_sphere_z[i]);
+	if (CheckPoint(tmp_ang)) angVec.push_back(tmp_ang);
+      }
+    } else {
+      for (uint32_t i=0;i<n_draw;i++) {
+	double z = z_min_ + u[i]*(z_max_ - z_min_);
+	double lambda = asin(z)*RadToDeg;
+	double eta = etamin_ + v[i]*(etamax_ - etamin_);
+
+	tmp_ang.SetSurveyCoordinates(lambda, eta);
+	if (CheckPoint(tmp_ang)) angVec.push_back(tmp_ang);
+      }
+    }
+  }
+}
+
+bool GeometricBound::_DirectRandomPoints(std::vector<double>& u,
+					 std::vector<double>& v,
+					 std::vector<double>& unit_sphere_x,
+					 std::vector<double>& unit_sphere_y,
+					 std::vector<double>& unit_sphere_z) {
+  return false;
+}
 
-      tmp_ang.SetSurveyCoordinates(lambda, eta);
-      if (CheckPoint(tmp_ang)) keep = true;
+// Given a center point, find a pair of unit vectors perpendicular to it (and
+// each other) to serve as the north and east directions for CapRandomPoints.
+// The orientation is arbitrary, so we just start from whichever axis is
+// furthest from the center point.
+static void CapFrame(const double center[3], double north[3], double east[3]) {
+  double axis[3] = {0.0, 0.0, 0.0};
+  if ((fabs(center[0]) <= fabs(center[1])) &&
+      (fabs(center[0]) <= fabs(center[2]))) {
+    axis[0] = 1.0;
+  } else {
+    if (fabs(center[1]) <= fabs(center[2])) {
+      axis[1] = 1.0;
+    } else {
+      axis[2] = 1.0;
     }
-    angVec.push_back(tmp_ang);
+  }
+
+  double dot = axis[0]*center[0] + axis[1]*center[1] + axis[2]*center[2];
+  for (int j=0;j<3;j++) north[j] = axis[j] - dot*center[j];
+  double norm = 1.0/sqrt(north[0]*north[0] + north[1]*north[1] +
+			 north[2]*north[2]);
+  for (int j=0;j<3;j++) north[j] *= norm;
+
+  east[0] = north[1]*center[2] - north[2]*center[1];
+  east[1] = north[2]*center[0] - north[0]*center[2];
+  east[2] = north[0]*center[1] - north[1]*center[0];
+}
+
+// Turn the uniform deviates into points drawn uniformly from the part of the
+// spherical cap about the center with 1 - cos(theta) between h_min and h_max
+// and azimuth between phi_min and phi_max (in radians, measured from the
+// north vector towards the east vector).  Since the area element on the
+// sphere is d(cos(theta))*d(phi), both are uniform.  Working with
+// 1 - cos(theta) rather than cos(theta) keeps small caps from losing their
+// precision.
+static void CapRandomPoints(const double center[3], const double north[3],
+			    const double east[3], double h_min, double h_max,
+			    double phi_min, double phi_max,
+			    std::vector<double>& u, std::vector<double>& v,
+			    std::vector<double>& unit_sphere_x,
+			    std::vector<double>& unit_sphere_y,
+			    std::vector<double>& unit_sphere_z) {
+  uint32_t n_point = u.size();
+  unit_sphere_x.resize(n_point);
+  unit_sphere_y.resize(n_point);
+  unit_sphere_z.resize(n_point);
+
+  double* x = &unit_sphere_x[0];
+  double* y = &unit_sphere_y[0];
+  double* z = &unit_sphere_z[0];
+  const double* u_ptr = &u[0];
+  const double* v_ptr = &v[0];
+  double delta_h = h_max - h_min;
+  double delta_phi = phi_max - phi_min;
+
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+  for (uint32_t i=0;i<n_point;i++) {
+    double h = h_min + u_ptr[i]*delta_h;
+    double costheta = 1.0 - h;
+    double sintheta = sqrt(h*(2.0 - h));
+    double phi = phi_min + v_ptr[i]*delta_phi;
+    double north_amp = sintheta*cos(phi);
+    double east_amp = sintheta*sin(phi);
+
+    x[i] = costheta*center[0] + north_amp*north[0] + east_amp*east[0];
+    y[i] = costheta*center[1] + north_amp*north[1] + east_amp*east[1];
+    z[i] = costheta*center[2] + north_amp*north[2] + east_amp*east[2];
   }
 }
 
@@ -342,6 +434,24 @@ bool CircleBound::CheckPoint(AngularCoordinate& ang) {
   return (DoubleGE(center_point_.DotProduct(ang), costhetamin_) ? true : false);
 }
 
+bool CircleBound::_DirectRandomPoints(std::vector<double>& u,
+				      std::vector<double>& v,
+				      std::vector<double>& unit_sphere_x,
+				      std::vector<double>& unit_sphere_y,
+				      std::vector<double>& unit_sphere_z) {
+  double center[3] = {center_point_.UnitSphereX(), center_point_.UnitSphereY(),
+		      center_point_.UnitSphereZ()};
+  double north[3], east[3];
+  CapFrame(center, north, east);
+
+  double sin_half_radius = sin(0.5*radius_*DegToRad);
+  CapRandomPoints(center, north, east, 0.0,
+		  2.0*sin_half_radius*sin_half_radius, 0.0, 2.0*Pi,
+		  u, v, unit_sphere_x, unit_sphere_y, unit_sphere_z);
+
+  return true;
+}
+
 AnnulusBound::AnnulusBound(const AngularCoordinate& center_point,
 			   double min_radius, double max_radius) {
   center_point_ = center_point;
@@ -417,6 +527,25 @@ bool AnnulusBound::CheckPoint(AngularCoordinate& ang) {
 	  DoubleGE(center_point_.DotProduct(ang), costhetamin_) ? true : false);
 }
 
+bool AnnulusBound::_DirectRandomPoints(std::vector<double>& u,
+				       std::vector<double>& v,
+				       std::vector<double>& unit_sphere_x,
+				       std::vector<double>& unit_sphere_y,
+				       std::vector<double>& unit_sphere_z) {
+  double center[3] = {center_point_.UnitSphereX(), center_point_.UnitSphereY(),
+		      center_point_.UnitSphereZ()};
+  double north[3], east[3];
+  CapFrame(center, north, east);
+
+  double sin_half_min = sin(0.5*min_radius_*DegToRad);
+  double sin_half_max = sin(0.5*max_radius_*DegToRad);
+  CapRandomPoints(center, north, east, 2.0*sin_half_min*sin_half_min,
+		  2.0*sin_half_max*sin_half_max, 0.0, 2.0*Pi,
+		  u, v, unit_sphere_x, unit_sphere_y, unit_sphere_z);
+
+  return true;
+}
+
 WedgeBound::WedgeBound(const AngularCoordinate& center_point, double radius,
 		       double position_angle_min, double position_angle_max,
 		       AngularCoordinate::Sphere sphere) {
@@ -539,6 +668,57 @@ bool WedgeBound::CheckPoint(AngularCoordinate& ang) {
   return within_bound;
 }
 
+bool WedgeBound::_DirectRandomPoints(std::vector<double>& u,
+				     std::vector<double>& v,
+				     std::vector<double>& unit_sphere_x,
+				     std::vector<double>& unit_sphere_y,
+				     std::vector<double>& unit_sphere_z) {
+  // The position angles are measured from the direction towards the pole of
+  // the wedge's coordinate system, so that's our north vector.  East is
+  // perpendicular to that, but the internal unit sphere coordinates have the
+  // opposite handedness to Survey coordinates, so we need to flip it there.
+  AngularCoordinate pole;
+  double east_sign = 1.0;
+  switch (sphere_) {
+  case AngularCoordinate::Survey:
+    pole.SetSurveyCoordinates(90.0, 0.0);
+    east_sign = -1.0;
+    break;
+  case AngularCoordinate::Equatorial:
+    pole.SetEquatorialCoordinates(0.0, 90.0);
+    break;
+  case AngularCoordinate::Galactic:
+    pole.SetGalacticCoordinates(0.0, 90.0);
+    break;
+  }
+
+  double center[3] = {center_point_.UnitSphereX(), center_point_.UnitSphereY(),
+		      center_point_.UnitSphereZ()};
+  double dot = center_point_.DotProduct(pole);
+  double north[3] = {pole.UnitSphereX() - dot*center[0],
+		     pole.UnitSphereY() - dot*center[1],
+		     pole.UnitSphereZ() - dot*center[2]};
+  double norm = sqrt(north[0]*north[0] + north[1]*north[1] +
+		     north[2]*north[2]);
+
+  // At the pole itself, the position angle isn't defined.
+  if (DoubleLE(norm, 0.0)) return false;
+
+  for (int j=0;j<3;j++) north[j] /= norm;
+  double east[3] = {north[1]*center[2] - north[2]*center[1],
+		    north[2]*center[0] - north[0]*center[2],
+		    north[0]*center[1] - north[1]*center[0]};
+  for (int j=0;j<3;j++) east[j] *= east_sign;
+
+  double sin_half_radius = sin(0.5*radius_*DegToRad);
+  CapRandomPoints(center, north, east, 0.0,
+		  2.0*sin_half_radius*sin_half_radius,
+		  position_angle_min_*DegToRad, position_angle_max_*DegToRad,
+		  u, v, unit_sphere_x, unit_sphere_y, unit_sphere_z);
+
+  return true;
+}
+
 PolygonBound::PolygonBound(AngularVector& ang) {
 
   for (AngularIterator iter=ang.begin();iter!=ang.end();++iter)
@@ -585,6 +765,7 @@ PolygonBound::PolygonBound(AngularVector& ang) {
   SetContinuousBounds(true);
   FindArea();
   FindAngularBounds();
+  _FindTriangles();
 }
 
 PolygonBound::~PolygonBound() {
@@ -596,6 +777,67 @@ PolygonBound::~PolygonBound() {
   n_vert_ = 0;
 }
 
+void PolygonBound::_FindTriangles() {
+  tri_area_.clear();
+  tri_alpha_.clear();
+  tri_cos_c_.clear();
+  tri_perp_x_.clear();
+  tri_perp_y_.clear();
+  tri_perp_z_.clear();
+
+  // The fan only covers the polygon if the polygon is convex, in which case
+  // all of the vertices are inside of all of the edges.
+  convex_ = (n_vert_ >= 3);
+  for (uint32_t i=0;(i<n_vert_) && convex_;i++)
+    if (!CheckPoint(ang_[i])) convex_ = false;
+  if (!convex_) return;
+
+  double a[3] = {ang_[0].UnitSphereX(), ang_[0].UnitSphereY(),
+		 ang_[0].UnitSphereZ()};
+  double area_sum = 0.0;
+
+  for (uint32_t k=1;k<n_vert_-1;k++) {
+    double b[3] = {ang_[k].UnitSphereX(), ang_[k].UnitSphereY(),
+		   ang_[k].UnitSphereZ()};
+    double c[3] = {ang_[k+1].UnitSphereX(), ang_[k+1].UnitSphereY(),
+		   ang_[k+1].UnitSphereZ()};
+
+    double ab = a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+    double bc = b[0]*c[0] + b[1]*c[1] + b[2]*c[2];
+    double ca = c[0]*a[0] + c[1]*a[1] + c[2]*a[2];
+    double triple = a[0]*(b[1]*c[2] - b[2]*c[1]) +
+      a[1]*(b[2]*c[0] - b[0]*c[2]) + a[2]*(b[0]*c[1] - b[1]*c[0]);
+
+    // The triangle area from the Van Oosterom & Strackee formula, which holds
+    // up better than the sum of the angles for small triangles.
+    area_sum += 2.0*atan2(fabs(triple), 1.0 + ab + bc + ca);
+
+    // The directions from the first vertex towards the other two, which give
+    // us the angle at the first vertex.
+    double t_b[3], t_c[3];
+    for (int j=0;j<3;j++) {
+      t_b[j] = b[j] - ab*a[j];
+      t_c[j] = c[j] - ca*a[j];
+    }
+    double cross_x = t_b[1]*t_c[2] - t_b[2]*t_c[1];
+    double cross_y = t_b[2]*t_c[0] - t_b[0]*t_c[2];
+    double cross_z = t_b[0]*t_c[1] - t_b[1]*t_c[0];
+    double t_c_norm = sqrt(t_c[0]*t_c[0] + t_c[1]*t_c[1] + t_c[2]*t_c[2]);
+    if (DoubleLE(t_c_norm, 0.0)) t_c_norm = 1.0;
+
+    tri_area_.push_back(area_sum);
+    tri_alpha_.push_back(atan2(sqrt(cross_x*cross_x + cross_y*cross_y +
+				    cross_z*cross_z),
+			       t_b[0]*t_c[0] + t_b[1]*t_c[1] + t_b[2]*t_c[2]));
+    tri_cos_c_.push_back(ab);
+    tri_perp_x_.push_back(t_c[0]/t_c_norm);
+    tri_perp_y_.push_back(t_c[1]/t_c_norm);
+    tri_perp_z_.push_back(t_c[2]/t_c_norm);
+  }
+
+  if (DoubleLE(area_sum, 0.0)) convex_ = false;
+}
+
 bool PolygonBound::FindAngularBounds() {
 
   double lammin = 100.0, lammax = -100.0, etamin = 200.0, etamax = -200.0;
@@ -662,6 +904,69 @@ bool PolygonBound::CheckPoint(AngularCoordinate& ang) {
   return in_polygon;
 }
 
+bool PolygonBound::_DirectRandomPoints(std::vector<double>& u,
+				       std::vector<double>& v,
+				       std::vector<double>& unit_sphere_x,
+				       std::vector<double>& unit_sphere_y,
+				       std::vector<double>& unit_sphere_z) {
+  if (!convex_) return false;
+
+  uint32_t n_point = u.size();
+  unit_sphere_x.resize(n_point);
+  unit_sphere_y.resize(n_point);
+  unit_sphere_z.resize(n_point);
+
+  double a[3] = {ang_[0].UnitSphereX(), ang_[0].UnitSphereY(),
+		 ang_[0].UnitSphereZ()};
+  uint32_t n_tri = tri_area_.size();
+  double total_area = tri_area_[n_tri-1];
+
+  for (uint32_t i=0;i<n_point;i++) {
+    // The first deviate picks the triangle and, once we subtract off the area
+    // of the preceding triangles, the sub-area within that triangle.
+    double area = u[i]*total_area;
+    uint32_t k = std::upper_bound(tri_area_.begin(), tri_area_.end(), area) -
+      tri_area_.begin();
+    if (k >= n_tri) k = n_tri - 1;
+    double sub_area = (k > 0 ? area - tri_area_[k-1] : area);
+
+    // Following Arvo, find the point C' along the arc from the first vertex
+    // to the third such that the triangle (A, B, C') has the sub-area...
+    double alpha = tri_alpha_[k];
+    double cos_alpha = cos(alpha), sin_alpha = sin(alpha);
+    double s = sin(sub_area - alpha), t = cos(sub_area - alpha);
+    double u_arvo = t - cos_alpha;
+    double v_arvo = s + sin_alpha*tri_cos_c_[k];
+    double q = ((v_arvo*t - u_arvo*s)*cos_alpha - v_arvo)/
+      ((v_arvo*s + u_arvo*t)*sin_alpha);
+    if (q > 1.0) q = 1.0;
+    if (q < -1.0) q = -1.0;
+    double sin_q = sqrt(1.0 - q*q);
+    double c_x = q*a[0] + sin_q*tri_perp_x_[k];
+    double c_y = q*a[1] + sin_q*tri_perp_y_[k];
+    double c_z = q*a[2] + sin_q*tri_perp_z_[k];
+
+    // ... and then pick a point along the arc from the second vertex to C'
+    // with the second deviate.
+    double b_x = ang_[k+1].UnitSphereX();
+    double b_y = ang_[k+1].UnitSphereY();
+    double b_z = ang_[k+1].UnitSphereZ();
+    double cos_cb = c_x*b_x + c_y*b_y + c_z*b_z;
+    double z = 1.0 - v[i]*(1.0 - cos_cb);
+    double w_x = c_x - cos_cb*b_x;
+    double w_y = c_y - cos_cb*b_y;
+    double w_z = c_z - cos_cb*b_z;
+    double w_norm = sqrt(w_x*w_x + w_y*w_y + w_z*w_z);
+    double sin_z = (w_norm > 0.0 ? sqrt(std::max(0.0, 1.0 - z*z))/w_norm : 0.0);
+
+    unit_sphere_x[i] = z*b_x + sin_z*w_x;
+    unit_sphere_y[i] = z*b_y + sin_z*w_y;
+    unit_sphere_z[i] = z*b_z + sin_z*w_z;
+  }
+
+  return true;
+}
+
 LongitudeBound::LongitudeBound(double min_longitude, double max_longitude,
 			       AngularCoordinate::Sphere sphere) {
   // Cast the input values into AngularCoordinate objects to handle vagaries
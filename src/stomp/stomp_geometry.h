@@ -119,9 +119,30 @@ class GeometricBound {
   // points within the bound.  This requires a bit more data, but it will enable
   // us to use monte carlo methods for those cases where that's more efficient
   // than pixelization.
+  //
+  // By default, the points are drawn uniformly within the angular bounds and
+  // kept if they pass CheckPoint.  For small bounds near the survey pole or
+  // thin annuli, wedges and polygons, most of those points are thrown away,
+  // so the derived classes that can draw points directly from their own area
+  // do so instead.  Either way, the points are uniformly distributed over the
+  // area accepted by CheckPoint.
   void GenerateRandomPoint(AngularCoordinate& ang);
   void GenerateRandomPoints(AngularVector& angVec, uint32_t n_rand);
 
+ protected:
+  // Derived classes with a direct sampler override this method.  For each
+  // pair of uniform deviates (u[i], v[i]) in [0,1), it should fill in the
+  // unit sphere coordinates (in the AngularCoordinate internal frame) of a
+  // point drawn uniformly from a region covering the bound and return true.
+  // The candidate points still go through CheckPoint, so that region doesn't
+  // have to match the bound exactly.  The default returns false, falling back
+  // to the bounding box.
+  virtual bool _DirectRandomPoints(std::vector<double>& u,
+				   std::vector<double>& v,
+				   std::vector<double>& unit_sphere_x,
+				   std::vector<double>& unit_sphere_y,
+				   std::vector<double>& unit_sphere_z);
+
  private:
   MTRand mtrand_;
   double area_, lammin_, lammax_, etamin_, etamax_, z_min_, z_max_;
@@ -140,6 +161,13 @@ class CircleBound : public GeometricBound {
   virtual bool FindAngularBounds();
   virtual bool FindArea();
 
+ protected:
+  virtual bool _DirectRandomPoints(std::vector<double>& u,
+				   std::vector<double>& v,
+				   std::vector<double>& unit_sphere_x,
+				   std::vector<double>& unit_sphere_y,
+				   std::vector<double>& unit_sphere_z);
+
  private:
   AngularCoordinate center_point_;
   double radius_, costhetamin_;
@@ -160,6 +188,13 @@ class AnnulusBound : public GeometricBound {
   virtual bool FindAngularBounds();
   virtual bool FindArea();
 
+ protected:
+  virtual bool _DirectRandomPoints(std::vector<double>& u,
+				   std::vector<double>& v,
+				   std::vector<double>& unit_sphere_x,
+				   std::vector<double>& unit_sphere_y,
+				   std::vector<double>& unit_sphere_z);
+
  private:
   AngularCoordinate center_point_;
   double max_radius_, min_radius_, costhetamin_, costhetamax_;
@@ -179,6 +214,15 @@ class WedgeBound : public GeometricBound {
   virtual bool FindAngularBounds();
   virtual bool FindArea();
 
+ protected:
+  // The candidate points are drawn from the circular sector between the two
+  // position angles.  CheckPoint accepts a subset of that sector.
+  virtual bool _DirectRandomPoints(std::vector<double>& u,
+				   std::vector<double>& v,
+				   std::vector<double>& unit_sphere_x,
+				   std::vector<double>& unit_sphere_y,
+				   std::vector<double>& unit_sphere_z);
+
  private:
   AngularCoordinate center_point_;
   double radius_, costhetamin_, position_angle_min_, position_angle_max_;
@@ -201,10 +245,31 @@ class PolygonBound : public GeometricBound {
   virtual bool FindAngularBounds();
   virtual bool FindArea();
 
+ protected:
+  // For convex polygons, we split the polygon into a fan of spherical
+  // triangles about the first vertex, pick a triangle with probability
+  // proportional to its area and draw a uniform point from it (Arvo 1995).
+  // Non-convex polygons fall back to the bounding box.
+  virtual bool _DirectRandomPoints(std::vector<double>& u,
+				   std::vector<double>& v,
+				   std::vector<double>& unit_sphere_x,
+				   std::vector<double>& unit_sphere_y,
+				   std::vector<double>& unit_sphere_z);
+
  private:
+  void _FindTriangles();
+
   AngularVector ang_;
   std::vector<double> x_, y_, z_, dot_;
   uint32_t n_vert_;
+
+  // For each triangle in the fan, the cumulative area (in steradians), the
+  // angle at the first vertex, the cosine of the arc between the first and
+  // second vertices and the unit vector at the first vertex pointing along
+  // the arc to the third vertex.
+  std::vector<double> tri_area_, tri_alpha_, tri_cos_c_;
+  std::vector<double> tri_perp_x_, tri_perp_y_, tri_perp_z_;
+  bool convex_;
 };
 
 class LongitudeBound : public GeometricBound {
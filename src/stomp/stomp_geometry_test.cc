@@ -286,6 +286,126 @@ void LatLonBoundTests() {
   }
 }
 
+void RandomPointTests() {
+  // Test the random point generation within the GeometricBound classes
+  std::cout << "\n";
+  std::cout << "**************************\n";
+  std::cout << "*** Random Point Tests ***\n";
+  std::cout << "**************************\n";
+
+  uint32_t n_rand = 100000;
+  Stomp::AngularVector angVec;
+
+  // A small circle right next to the survey pole, where the eta bounds are
+  // useless.  The mean value of cos(theta) from the center should be half
+  // way between 1 and cos(radius).
+  Stomp::AngularCoordinate pole_ang(89.5, 10.0,
+				    Stomp::AngularCoordinate::Survey);
+  double radius = 0.3;
+  Stomp::CircleBound circ(pole_ang, radius);
+  circ.GenerateRandomPoints(angVec, n_rand);
+
+  uint32_t n_outside = 0;
+  double mean_dot = 0.0;
+  for (Stomp::AngularIterator iter=angVec.begin();iter!=angVec.end();++iter) {
+    if (!circ.CheckPoint(*iter)) n_outside++;
+    mean_dot += pole_ang.DotProduct(*iter);
+  }
+  mean_dot /= angVec.size();
+  std::cout << "Circle: " << angVec.size() << " points, " << n_outside <<
+    " outside the bound\n";
+  std::cout << "\t1 - <cos(theta)>: " << 1.0 - mean_dot << " (" <<
+    0.5*(1.0 - cos(radius*Stomp::DegToRad)) << ")\n";
+
+  // A thin annulus.
+  Stomp::AngularCoordinate center_ang(20.0, 0.0,
+				      Stomp::AngularCoordinate::Equatorial);
+  Stomp::AnnulusBound annulus(center_ang, 1.0, 1.05);
+  annulus.GenerateRandomPoints(angVec, n_rand);
+
+  n_outside = 0;
+  mean_dot = 0.0;
+  for (Stomp::AngularIterator iter=angVec.begin();iter!=angVec.end();++iter) {
+    if (!annulus.CheckPoint(*iter)) n_outside++;
+    mean_dot += center_ang.DotProduct(*iter);
+  }
+  mean_dot /= angVec.size();
+  std::cout << "Annulus: " << angVec.size() << " points, " << n_outside <<
+    " outside the bound\n";
+  std::cout << "\t1 - <cos(theta)>: " << 1.0 - mean_dot << " (" <<
+    1.0 - 0.5*(cos(1.0*Stomp::DegToRad) + cos(1.05*Stomp::DegToRad)) <<
+    ")\n";
+
+  // For the wedge and the polygon, we compare against points drawn from a
+  // circle enclosing the bound and kept if they pass CheckPoint.
+  Stomp::CircleBound enclosing_circ(center_ang, 5.0);
+  Stomp::AngularVector enclosing_angVec;
+  enclosing_circ.GenerateRandomPoints(enclosing_angVec, 20*n_rand);
+
+  Stomp::WedgeBound wedge(center_ang, 2.0, 100.0, 120.0,
+			  Stomp::AngularCoordinate::Equatorial);
+  wedge.GenerateRandomPoints(angVec, n_rand);
+
+  n_outside = 0;
+  mean_dot = 0.0;
+  for (Stomp::AngularIterator iter=angVec.begin();iter!=angVec.end();++iter) {
+    if (!wedge.CheckPoint(*iter)) n_outside++;
+    mean_dot += center_ang.DotProduct(*iter);
+  }
+  mean_dot /= angVec.size();
+
+  uint32_t n_ref = 0;
+  double ref_dot = 0.0;
+  for (Stomp::AngularIterator iter=enclosing_angVec.begin();
+       iter!=enclosing_angVec.end();++iter) {
+    if (wedge.CheckPoint(*iter)) {
+      n_ref++;
+      ref_dot += center_ang.DotProduct(*iter);
+    }
+  }
+  std::cout << "Wedge: " << angVec.size() << " points, " << n_outside <<
+    " outside the bound\n";
+  std::cout << "\t1 - <cos(theta)>: " << 1.0 - mean_dot << " (" <<
+    1.0 - ref_dot/n_ref << " from " << n_ref << " reference points)\n";
+
+  // A long, thin convex polygon.
+  Stomp::AngularCoordinate ang;
+  Stomp::AngularVector polyVec;
+  ang.SetEquatorialCoordinates(17.0,0.1);
+  polyVec.push_back(ang);
+  ang.SetEquatorialCoordinates(17.0,-0.1);
+  polyVec.push_back(ang);
+  ang.SetEquatorialCoordinates(23.0,-0.1);
+  polyVec.push_back(ang);
+  ang.SetEquatorialCoordinates(23.0,0.1);
+  polyVec.push_back(ang);
+
+  Stomp::PolygonBound poly(polyVec);
+  poly.GenerateRandomPoints(angVec, n_rand);
+
+  n_outside = 0;
+  double mean_ra = 0.0;
+  for (Stomp::AngularIterator iter=angVec.begin();iter!=angVec.end();++iter) {
+    if (!poly.CheckPoint(*iter)) n_outside++;
+    mean_ra += iter->RA();
+  }
+  mean_ra /= angVec.size();
+
+  n_ref = 0;
+  double ref_ra = 0.0;
+  for (Stomp::AngularIterator iter=enclosing_angVec.begin();
+       iter!=enclosing_angVec.end();++iter) {
+    if (poly.CheckPoint(*iter)) {
+      n_ref++;
+      ref_ra += iter->RA();
+    }
+  }
+  std::cout << "Polygon: " << angVec.size() << " points, " << n_outside <<
+    " outside the bound\n";
+  std::cout << "\t<RA>: " << mean_ra << " (" << ref_ra/n_ref << " from " <<
+    n_ref << " reference points)\n";
+}
+
 // Define our command line flags
 DEFINE_bool(all_geometry_tests, false, "Run all class unit tests.");
 DEFINE_bool(circle_bound_tests, false, "Run CircleBound tests");
@@ -293,6 +413,8 @@ DEFINE_bool(annulus_bound_tests, false, "Run AnnulusBound tests");
 DEFINE_bool(wedge_bound_tests, false, "Run WedgeBound tests");
 DEFINE_bool(polygon_bound_tests, false, "Run PolygonBound tests");
 DEFINE_bool(latlon_bound_tests, false, "Run LatLonBound tests");
+DEFINE_bool(random_point_tests, false,
+	    "Run GeometricBound random point tests");
 
 void GeometryUnitTests(bool run_all_tests) {
   void CircleBoundTests();
@@ -300,6 +422,7 @@ void GeometryUnitTests(bool run_all_tests) {
   void WedgeBoundTests();
   void PolygonBoundTests();
   void LatLonBoundTests();
+  void RandomPointTests();
 
   if (run_all_tests) FLAGS_all_geometry_tests = true;
 
@@ -322,4 +445,8 @@ void GeometryUnitTests(bool run_all_tests) {
   // Check the LatLonBound class.
   if (FLAGS_all_geometry_tests || FLAGS_latlon_bound_tests)
     LatLonBoundTests();
+
+  // Check the random point generation.
+  if (FLAGS_all_geometry_tests || FLAGS_random_point_tests)
+    RandomPointTests();
 }
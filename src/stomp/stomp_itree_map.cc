@@ -31,6 +31,8 @@ IndexedTreeMap::IndexedTreeMap(uint32_t input_resolution,
   point_count_ = 0;
   modified_ = false;
   area_ = 0.0;
+  single_precision_ = false;
+  precision_threshold_ = SinglePrecisionThreshold;
   ClearRegions();
 }
 
@@ -45,6 +47,8 @@ IndexedTreeMap::IndexedTreeMap(const std::string& input_file,
   point_count_ = 0;
   modified_ = false;
   area_ = 0.0;
+  single_precision_ = false;
+  precision_threshold_ = SinglePrecisionThreshold;
   ClearRegions();
 
   Read(input_file, sphere, verbose, theta_column, phi_column, index_column);
@@ -319,6 +323,8 @@ bool IndexedTreeMap::AddPoint(IndexedAngularCoordinate* ang) {
 	"Creating new IndexedTreeMap node failed. Exiting.\n";
       exit(2);
     }
+    if (single_precision_)
+      iter->second->SetSinglePrecision(true, precision_threshold_);
   }
   bool added_point = (*iter).second->AddPoint(ang);
   if (added_point) point_count_++;
@@ -633,6 +639,92 @@ void IndexedTreeMap::SetPixelCapacity(int pixel_capacity) {
   maximum_points_ = pixel_capacity;
 }
 
+void IndexedTreeMap::SetSinglePrecision(bool single_precision,
+					double precision_threshold) {
+  Clear();
+  single_precision_ = single_precision;
+  precision_threshold_ = precision_threshold;
+}
+
+void IndexedTreeMap::Serialize(std::string& buffer) {
+  IAngularVector i_ang;
+  Points(i_ang);
+
+  std::vector<double> x, y, z;
+  std::vector<uint32_t> index;
+  x.reserve(i_ang.size());
+  y.reserve(i_ang.size());
+  z.reserve(i_ang.size());
+  index.reserve(i_ang.size());
+  for (IAngularIterator iter=i_ang.begin();iter!=i_ang.end();++iter) {
+    x.push_back(iter->UnitSphereX());
+    y.push_back(iter->UnitSphereY());
+    z.push_back(iter->UnitSphereZ());
+    index.push_back(iter->Index());
+  }
+
+  BinaryWriter writer(buffer, "Stomp::IndexedTreeMap");
+  writer.Reserve(i_ang.size()*(3*sizeof(double) + sizeof(uint32_t)) + 128);
+  writer.Write(resolution_);
+  writer.Write(maximum_points_);
+  writer.Write(static_cast<uint8_t>(single_precision_));
+  writer.Write(precision_threshold_);
+  writer.WriteVector(x);
+  writer.WriteVector(y);
+  writer.WriteVector(z);
+  writer.WriteVector(index);
+  SerializeRegions(writer);
+}
+
+bool IndexedTreeMap::Deserialize(const std::string& buffer) {
+  BinaryReader reader(buffer, "Stomp::IndexedTreeMap");
+  uint32_t resolution = 0;
+  uint16_t maximum_points = 0;
+  uint8_t single_precision = 0;
+  double precision_threshold = 0.0;
+  std::vector<double> x, y, z;
+  std::vector<uint32_t> index;
+  reader.Read(resolution);
+  reader.Read(maximum_points);
+  reader.Read(single_precision);
+  reader.Read(precision_threshold);
+  reader.ReadVector(x);
+  reader.ReadVector(y);
+  reader.ReadVector(z);
+  reader.ReadVector(index);
+  if (!reader.Status() || (y.size() != x.size()) ||
+      (z.size() != x.size()) || (index.size() != x.size())) {
+    std::cout << "Stomp::IndexedTreeMap::Deserialize - " <<
+      "Invalid IndexedTreeMap buffer.\n";
+    return false;
+  }
+
+  resolution_ = resolution;
+  maximum_points_ = maximum_points;
+  SetSinglePrecision(single_precision != 0, precision_threshold);
+
+  for (uint32_t i=0;i<x.size();i++) {
+    IndexedAngularCoordinate i_ang(x[i], y[i], z[i], index[i]);
+    AddPoint(i_ang);
+  }
+
+  if (!DeserializeRegions(reader) || !reader.Finished()) {
+    std::cout << "Stomp::IndexedTreeMap::Deserialize - " <<
+      "Invalid region data.\n";
+    ClearRegions();
+  }
+
+  return true;
+}
+
+bool IndexedTreeMap::SinglePrecision() {
+  return single_precision_;
+}
+
+double IndexedTreeMap::PrecisionThreshold() {
+  return precision_threshold_;
+}
+
 uint32_t IndexedTreeMap::NPoints(uint32_t k) {
   return (k == MaxPixnum ? point_count_ :
 	  (tree_map_.find(k) != tree_map_.end() ?
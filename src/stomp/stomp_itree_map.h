@@ -182,6 +182,19 @@ class IndexedTreeMap : public BaseMap {
   void SetResolution(uint32_t resolution);
   void SetPixelCapacity(int pixel_capacity);
 
+  // The points can also be stored in single precision to reduce the memory
+  // footprint of the tree (see the TreePixel and IndexedTreePixel classes).
+  // Changing the storage mode clears the map.
+  void SetSinglePrecision(bool single_precision = true,
+			  double precision_threshold = SinglePrecisionThreshold);
+  bool SinglePrecision();
+  double PrecisionThreshold();
+
+  // As with the TreeMap, the map can be packed into a binary string for
+  // passing between processes and restored (rebuilding the tree) from one.
+  void Serialize(std::string& buffer);
+  bool Deserialize(const std::string& buffer);
+
   // Total number of points in the tree map or total number of points in
   // a given base level node.
   uint32_t NPoints(uint32_t k = MaxPixnum);
@@ -223,8 +236,8 @@ class IndexedTreeMap : public BaseMap {
   ITreeDict tree_map_;
   uint16_t maximum_points_, nodes_;
   uint32_t point_count_, resolution_;
-  double area_;
-  bool modified_;
+  double area_, precision_threshold_;
+  bool modified_, single_precision_;
 };
 
 } // end namespace Stomp
@@ -18,6 +18,7 @@
 
 #include "stomp_core.h"
 #include "stomp_itree_pixel.h"
+#include "stomp_compact_leaf.h"
 #include "stomp_angular_bin.h"
 
 namespace Stomp {
@@ -26,6 +27,10 @@ IndexedTreePixel::IndexedTreePixel() {
   SetWeight(0.0);
   maximum_points_ = 0;
   point_count_ = 0;
+  initialized_subpixels_ = false;
+  leaf_ = NULL;
+  single_precision_ = false;
+  precision_threshold_ = SinglePrecisionThreshold;
   InitializeCorners();
 }
 
@@ -42,6 +47,9 @@ IndexedTreePixel::IndexedTreePixel(const uint32_t input_resolution,
   maximum_points_ = maximum_points;
   point_count_ = 0;
   initialized_subpixels_ = false;
+  leaf_ = NULL;
+  single_precision_ = false;
+  precision_threshold_ = SinglePrecisionThreshold;
   InitializeCorners();
 }
 
@@ -55,6 +63,9 @@ IndexedTreePixel:: IndexedTreePixel(const uint32_t input_x,
   maximum_points_ = maximum_points;
   point_count_ = 0;
   initialized_subpixels_ = false;
+  leaf_ = NULL;
+  single_precision_ = false;
+  precision_threshold_ = SinglePrecisionThreshold;
   InitializeCorners();
 }
 
@@ -67,6 +78,9 @@ IndexedTreePixel::IndexedTreePixel(AngularCoordinate& ang,
   maximum_points_ = maximum_points;
   point_count_ = 0;
   initialized_subpixels_ = false;
+  leaf_ = NULL;
+  single_precision_ = false;
+  precision_threshold_ = SinglePrecisionThreshold;
   InitializeCorners();
 }
 
@@ -92,6 +106,8 @@ bool IndexedTreePixel::_InitializeSubPixels() {
       IndexedTreePixel* tree_pix =
 	new IndexedTreePixel(iter->PixelX(), iter->PixelY(),
 			     iter->Resolution(), maximum_points_);
+      if (single_precision_)
+	tree_pix->SetSinglePrecision(true, precision_threshold_);
       subpix_.push_back(tree_pix);
     }
     initialized_subpixels_ = true;
@@ -111,6 +127,28 @@ bool IndexedTreePixel::_InitializeSubPixels() {
       if (!transferred_point_to_subpixels) initialized_subpixels_ = false;
     }
     ang_.clear();
+
+    // As with the TreePixel, single precision points are reconstructed and
+    // any point that rounding has pushed across a sub-pixel boundary goes to
+    // the sub-pixel with the nearest center.
+    if (leaf_ != NULL) {
+      for (uint32_t i=0;i<leaf_->NPoints();++i) {
+	IndexedAngularCoordinate tmp_ang;
+	leaf_->Point(i, tmp_ang);
+	transferred_point_to_subpixels = false;
+	for (uint32_t j=0;j<subpix_.size();++j) {
+	  if (subpix_[j]->_AddPoint(&tmp_ang, false)) {
+	    j = subpix_.size();
+	    transferred_point_to_subpixels = true;
+	  }
+	}
+	if (!transferred_point_to_subpixels &&
+	    !subpix_[_NearestSubPixel(tmp_ang)]->_AddPoint(&tmp_ang, true))
+	  initialized_subpixels_ = false;
+      }
+      delete leaf_;
+      leaf_ = NULL;
+    }
   }
 
   return initialized_subpixels_;
@@ -120,6 +158,13 @@ void IndexedTreePixel::FindPairs(AngularCoordinate& ang, AngularBin& theta,
 				 IAngularVector& i_angVec) {
   if (!i_angVec.empty()) i_angVec.clear();
 
+  // Single precision nodes don't have any objects for us to point to, so we
+  // collect copies of the matching points directly.
+  if (single_precision_) {
+    _FindPairs(ang, theta, i_angVec);
+    return;
+  }
+
   IAngularPtrVector i_ang;
 
   // If we have AngularCoordinates in this pixel, then this is just a
@@ -264,6 +309,36 @@ void IndexedTreePixel::_FindPairs(AngularCoordinate& ang, AngularBin& theta,
   }
 }
 
+void IndexedTreePixel::_FindPairs(AngularCoordinate& ang, AngularBin& theta,
+				  IAngularVector& i_ang) {
+  if (leaf_ != NULL) {
+    std::vector<uint32_t> match_idx;
+    leaf_->MatchPairs(
+      ang, theta, CompactLeaf::SinglePrecisionBin(theta, precision_threshold_),
+      match_idx);
+    for (uint32_t i=0;i<match_idx.size();i++) {
+      IndexedAngularCoordinate tmp_ang;
+      leaf_->Point(match_idx[i], tmp_ang);
+      i_ang.push_back(tmp_ang);
+    }
+  } else {
+    int8_t intersects_annulus = IntersectsAnnulus(ang, theta);
+
+    if (intersects_annulus == 1) {
+      IAngularVector tmp_ang;
+      Points(tmp_ang);
+      i_ang.insert(i_ang.end(), tmp_ang.begin(), tmp_ang.end());
+    } else {
+      if (intersects_annulus == -1) {
+	for (ITreePtrIterator iter=subpix_.begin();
+	     iter!=subpix_.end();++iter) {
+	  (*iter)->_FindPairs(ang, theta, i_ang);
+	}
+      }
+    }
+  }
+}
+
 void IndexedTreePixel::_PointPtrs(IAngularPtrVector& i_ang) {
   // Add any pointers contained in this node to the input vector or pass the
   // request along to the sub-nodes.
@@ -345,11 +420,18 @@ void IndexedTreePixel::_NeighborRecursion(AngularCoordinate& ang,
 
   neighbors.AddNode();
 
-  if (!ang_.empty()) {
+  if (HasPoints()) {
     // We have no sub-nodes in this tree, so we'll just iterate over the
     // points here and take the nearest N neighbors.
     for (IAngularPtrIterator iter=ang_.begin();iter!=ang_.end();++iter)
       neighbors.TestPoint(*iter);
+    if (leaf_ != NULL) {
+      IndexedAngularCoordinate tmp_ang;
+      for (uint32_t i=0;i<leaf_->NPoints();++i) {
+	leaf_->Point(i, tmp_ang);
+	neighbors.TestPoint(tmp_ang);
+      }
+    }
   } else {
     // This node is the root node for our tree, so we first find the sub-node
     // that contains the point and start recursing there.
@@ -424,12 +506,28 @@ void IndexedTreePixel::InitializeCorners() {
 }
 
 bool IndexedTreePixel::AddPoint(IndexedAngularCoordinate* ang) {
+  bool added_to_pixel = _AddPoint(ang, false);
+
+  // Once a point is in a single precision leaf, we no longer need the object.
+  if (added_to_pixel && single_precision_) delete ang;
+
+  return added_to_pixel;
+}
+
+bool IndexedTreePixel::_AddPoint(IndexedAngularCoordinate* ang, bool force) {
   bool added_to_pixel = false;
-  if (Contains(*ang)) {
+  if (force || Contains(*ang)) {
     if ((point_count_ < maximum_points_) ||
 	(Resolution() == Stomp::MaxPixelResolution)) {
-      if (point_count_ == 0) ang_.reserve(maximum_points_);
-      ang_.push_back(ang);
+      if (single_precision_) {
+	if (leaf_ == NULL)
+	  leaf_ = new CompactLeaf(unit_sphere_x_, unit_sphere_y_,
+				  unit_sphere_z_, maximum_points_);
+	leaf_->AddPoint(*ang);
+      } else {
+	if (point_count_ == 0) ang_.reserve(maximum_points_);
+	ang_.push_back(ang);
+      }
       added_to_pixel = true;
     } else {
       if (!initialized_subpixels_) {
@@ -441,10 +539,15 @@ bool IndexedTreePixel::AddPoint(IndexedAngularCoordinate* ang) {
       }
       for (uint32_t i=0;i<subpix_.size();++i) {
 	if (subpix_[i]->Contains(*ang)) {
-	  added_to_pixel = subpix_[i]->AddPoint(ang);
+	  added_to_pixel = subpix_[i]->_AddPoint(ang, false);
 	  i = subpix_.size();
 	}
       }
+      if (!added_to_pixel && force) {
+	// A forced point didn't land in any of the sub-pixels, so we send it
+	// to the one with the nearest center.
+	added_to_pixel = subpix_[_NearestSubPixel(*ang)]->_AddPoint(ang, true);
+      }
     }
   } else {
     added_to_pixel = false;
@@ -455,6 +558,21 @@ bool IndexedTreePixel::AddPoint(IndexedAngularCoordinate* ang) {
   return added_to_pixel;
 }
 
+uint32_t IndexedTreePixel::_NearestSubPixel(AngularCoordinate& ang) {
+  uint32_t nearest_idx = 0;
+  double max_costheta = -2.0;
+  for (uint32_t i=0;i<subpix_.size();++i) {
+    double costheta = ang.UnitSphereX()*subpix_[i]->UnitSphereX() +
+      ang.UnitSphereY()*subpix_[i]->UnitSphereY() +
+      ang.UnitSphereZ()*subpix_[i]->UnitSphereZ();
+    if (costheta > max_costheta) {
+      max_costheta = costheta;
+      nearest_idx = i;
+    }
+  }
+  return nearest_idx;
+}
+
 bool IndexedTreePixel::AddPoint(IndexedAngularCoordinate& i_ang) {
   IndexedAngularCoordinate* ang_copy =
     new IndexedAngularCoordinate(i_ang.UnitSphereX(), i_ang.UnitSphereY(),
@@ -495,6 +613,13 @@ uint32_t IndexedTreePixel::NPoints(Pixel& pix) {
 	for (IAngularPtrIterator iter=ang_.begin();iter!=ang_.end();++iter) {
 	  if (pix.Contains(*(*iter))) total_points++;
 	}
+	if (leaf_ != NULL) {
+	  IndexedAngularCoordinate tmp_ang;
+	  for (uint32_t i=0;i<leaf_->NPoints();i++) {
+	    leaf_->Point(i, tmp_ang);
+	    if (pix.Contains(tmp_ang)) total_points++;
+	  }
+	}
       }
     }
   }
@@ -504,6 +629,17 @@ uint32_t IndexedTreePixel::NPoints(Pixel& pix) {
 
 void IndexedTreePixel::Indices(Pixel& pix, IndexVector& indices) {
   if (!indices.empty()) indices.clear();
+
+  // For single precision nodes, we pull the indices from copies of the points.
+  if (single_precision_) {
+    IAngularVector tmp_ang;
+    Points(tmp_ang, pix);
+    indices.reserve(tmp_ang.size());
+    for (IAngularIterator iter=tmp_ang.begin();iter!=tmp_ang.end();++iter)
+      indices.push_back(iter->Index());
+    return;
+  }
+
   IAngularPtrVector i_ang;
 
   // First check to see if the input pixel contains the current pixel.
@@ -601,6 +737,13 @@ void IndexedTreePixel::Points(IAngularVector& i_ang) {
 
       i_ang.push_back(tmp_ang);
     }
+    if (leaf_ != NULL) {
+      for (uint32_t i=0;i<leaf_->NPoints();i++) {
+	IndexedAngularCoordinate tmp_ang;
+	leaf_->Point(i, tmp_ang);
+	i_ang.push_back(tmp_ang);
+      }
+    }
   } else {
     // If not, then we need to iterate through our sub-nodes and return an
     // aggregate list.
@@ -633,6 +776,13 @@ void IndexedTreePixel::Points(IAngularVector& i_ang, Pixel& pix) {
 	  i_ang.push_back(tmp_ang);
 	}
       }
+      if (leaf_ != NULL) {
+	for (uint32_t i=0;i<leaf_->NPoints();i++) {
+	  IndexedAngularCoordinate tmp_ang;
+	  leaf_->Point(i, tmp_ang);
+	  if (pix.Contains(tmp_ang)) i_ang.push_back(tmp_ang);
+	}
+      }
     } else {
       // If not, then we need to iterate through our sub-nodes and return an
       // aggregate list.
@@ -670,6 +820,28 @@ uint16_t IndexedTreePixel::PixelCapacity() {
   return maximum_points_;
 }
 
+bool IndexedTreePixel::SetSinglePrecision(bool single_precision,
+					  double precision_threshold) {
+  if (point_count_ > 0) {
+    std::cout << "Stomp::IndexedTreePixel::SetSinglePrecision - " <<
+      "Can't change the storage mode of a pixel containing points.\n";
+    return false;
+  }
+
+  single_precision_ = single_precision;
+  precision_threshold_ = precision_threshold;
+
+  return true;
+}
+
+bool IndexedTreePixel::SinglePrecision() {
+  return single_precision_;
+}
+
+double IndexedTreePixel::PrecisionThreshold() {
+  return precision_threshold_;
+}
+
 IAngularPtrIterator IndexedTreePixel::PointsBegin() {
   return ang_.begin();
 }
@@ -687,7 +859,8 @@ ITreePtrIterator IndexedTreePixel::NodesEnd() {
 }
 
 bool IndexedTreePixel::HasPoints() {
-  return (ang_.empty() ? false : true);
+  return ((!ang_.empty() || ((leaf_ != NULL) && (leaf_->NPoints() > 0))) ?
+	  true : false);
 }
 
 bool IndexedTreePixel::HasNodes() {
@@ -699,6 +872,10 @@ void IndexedTreePixel::Clear() {
     for (IAngularPtrIterator iter=ang_.begin();iter!=ang_.end();++iter)
       delete *iter;
   ang_.clear();
+  if (leaf_ != NULL) {
+    delete leaf_;
+    leaf_ = NULL;
+  }
   if (!subpix_.empty())
     for (uint32_t i=0;i<subpix_.size();i++) {
       subpix_[i]->Clear();
@@ -838,6 +1015,7 @@ IndexedTreeNeighbor::IndexedTreeNeighbor(AngularCoordinate& reference_ang,
 }
 
 IndexedTreeNeighbor::~IndexedTreeNeighbor() {
+  ang_copies_.clear();
   n_neighbors_ = 0;
   max_distance_ = 100.0;
   n_nodes_visited_ = 0;
@@ -903,6 +1081,21 @@ bool IndexedTreeNeighbor::TestPoint(IndexedAngularCoordinate* test_ang) {
   return kept_point;
 }
 
+bool IndexedTreeNeighbor::TestPoint(IndexedAngularCoordinate& test_ang) {
+  double costheta = reference_ang_.DotProduct(test_ang);
+
+  double sin2theta = 1.0 - costheta*costheta;
+
+  if (sin2theta < max_distance_ || Neighbors() < MaxNeighbors()) {
+    // The deque doesn't move its elements as it grows, so the pointer in our
+    // queue remains valid.
+    ang_copies_.push_back(test_ang);
+    return TestPoint(&ang_copies_.back());
+  }
+
+  return false;
+}
+
 double IndexedTreeNeighbor::MaxDistance() {
   return max_distance_;
 }
@@ -25,12 +25,14 @@
 #include <string>
 #include <map>
 #include <queue>
+#include <deque>
 #include "stomp_angular_coordinate.h"
 #include "stomp_pixel.h"
 
 namespace Stomp {
 
 class AngularBin;           // class definition in stomp_angular_bin.h
+class CompactLeaf;          // class definition in stomp_compact_leaf.h
 class IndexedTreePixel;
 class IndexedTreeNeighbor;
 class NearestNeighborIndexedPixel;
@@ -99,10 +101,12 @@ class IndexedTreePixel : public Pixel {
 		 IndexVector& pair_indices);
 
   // The above methods should be called for pair-finding on the tree objects.
-  // The following two internal methods handle the recursion within the
+  // The following internal methods handle the recursion within the
   // tree and should not be called directly.
   void _FindPairs(AngularCoordinate& ang, AngularBin& theta,
 		  IAngularPtrVector& i_ang);
+  void _FindPairs(AngularCoordinate& ang, AngularBin& theta,
+		  IAngularVector& i_ang);
   void _PointPtrs(IAngularPtrVector& i_ang);
 
   // In addition to pair finding, we can also use the tree structure we've
@@ -210,6 +214,18 @@ class IndexedTreePixel : public Pixel {
   void SetPixelCapacity(uint16_t maximum_points);
   uint16_t PixelCapacity();
 
+  // As with the TreePixel, the leaf nodes can store their points in a
+  // CompactLeaf (see stomp_compact_leaf.h) rather than as individual
+  // IndexedAngularCoordinate objects.  The positions are kept in single
+  // precision and AngularBins with a non-zero edge below the precision
+  // threshold (in degrees) are handled in double precision.  PointsBegin and
+  // PointsEnd will not return any points for single precision leaves.  The
+  // storage mode can only be changed for an empty pixel.
+  bool SetSinglePrecision(bool single_precision = true,
+			  double precision_threshold = SinglePrecisionThreshold);
+  bool SinglePrecision();
+  double PrecisionThreshold();
+
   // Occasionally, it can be useful for outside code to be able to traverse
   // the tree structure contained in the pixel and sub-nodes.  These hooks allow
   // for access to the pointers to the sub-nodes and any point data directly.
@@ -256,10 +272,17 @@ class IndexedTreePixel : public Pixel {
 			     bool check_full_pixel);
 
  private:
+  // The internal version of AddPoint.  If force is true, the bounds check is
+  // skipped; see TreePixel.
+  bool _AddPoint(IndexedAngularCoordinate* ang, bool force);
+  uint32_t _NearestSubPixel(AngularCoordinate& ang);
+
   IAngularPtrVector ang_;
+  CompactLeaf* leaf_;
   uint16_t maximum_points_;
   uint32_t point_count_;
-  bool initialized_subpixels_;
+  bool initialized_subpixels_, single_precision_;
+  double precision_threshold_;
   double unit_sphere_x_, unit_sphere_y_, unit_sphere_z_;
   double unit_sphere_x_ul_, unit_sphere_y_ul_, unit_sphere_z_ul_;
   double unit_sphere_x_ll_, unit_sphere_y_ll_, unit_sphere_z_ll_;
@@ -316,6 +339,10 @@ class IndexedTreeNeighbor {
   // distant point in the list) or not.
   bool TestPoint(IndexedAngularCoordinate* test_ang);
 
+  // Points from single precision tree nodes don't exist as objects in the
+  // tree, so this version keeps its own copy of the point if it is accepted.
+  bool TestPoint(IndexedAngularCoordinate& test_ang);
+
   // Return the maximum distance of the current list.
   double MaxDistance();
 
@@ -332,6 +359,7 @@ class IndexedTreeNeighbor {
  private:
   AngularCoordinate reference_ang_;
   IPointQueue ang_queue_;
+  std::deque<IndexedAngularCoordinate> ang_copies_;
   uint8_t n_neighbors_;
   uint16_t n_nodes_visited_;
   double max_distance_;
@@ -0,0 +1,1051 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This file contains the KDTreeMap class, a ball tree over the unit sphere
+// coordinates of a set of points.
+
+#include <math.h>
+#include <iostream>
+#include <queue>
+#include <algorithm>
+#include "stomp_core.h"
+#include "stomp_kdtree_map.h"
+#include "stomp_angular_bin.h"
+#include "stomp_angular_correlation.h"
+#include "stomp_pixel.h"
+#include "stomp_map.h"
+
+namespace Stomp {
+
+// The node tests are done on squared chord distances, which differ from the
+// squared chords implied by the cosine tests on the points by rounding
+// errors of order 1e-15.  Nodes are only pruned or accepted whole if they
+// clear the bin edges by more than this.
+const double KDChord2Tolerance = 1.0e-14;
+
+class KDCoordinateOrder {
+  // Comparison object for splitting a node's points along one axis.
+ public:
+  KDCoordinateOrder(const std::vector<double>& coordinate) :
+    coordinate_(coordinate) {}
+  bool operator()(uint32_t a, uint32_t b) const {
+    return coordinate_[a] < coordinate_[b];
+  }
+ private:
+  const std::vector<double>& coordinate_;
+};
+
+KDTreeMap::KDTreeMap(uint32_t resolution, uint16_t maximum_points) {
+  resolution_ = resolution;
+  maximum_points_ = (maximum_points > 0 ? maximum_points : 1);
+  total_weight_ = 0.0;
+  modified_ = false;
+  ClearRegions();
+}
+
+KDTreeMap::~KDTreeMap() {
+  Clear();
+}
+
+bool KDTreeMap::AddPoint(WeightedAngularCoordinate* w_ang) {
+  bool added_point = AddPoint(*w_ang);
+  delete w_ang;
+  return added_point;
+}
+
+bool KDTreeMap::AddPoint(WeightedAngularCoordinate& w_ang) {
+  Pixel pix(w_ang, resolution_);
+  pixel_count_[pix.Pixnum()]++;
+
+  index_.push_back(x_.size());
+  x_.push_back(w_ang.UnitSphereX());
+  y_.push_back(w_ang.UnitSphereY());
+  z_.push_back(w_ang.UnitSphereZ());
+  weight_.push_back(w_ang.Weight());
+  total_weight_ += w_ang.Weight();
+  modified_ = true;
+
+  return true;
+}
+
+bool KDTreeMap::AddPoint(AngularCoordinate& ang, double object_weight) {
+  WeightedAngularCoordinate w_ang(ang.UnitSphereX(), ang.UnitSphereY(),
+				  ang.UnitSphereZ(), object_weight);
+  return AddPoint(w_ang);
+}
+
+bool KDTreeMap::AddPoint(IndexedAngularCoordinate& i_ang) {
+  Pixel pix(i_ang, resolution_);
+  pixel_count_[pix.Pixnum()]++;
+
+  index_.push_back(i_ang.Index());
+  x_.push_back(i_ang.UnitSphereX());
+  y_.push_back(i_ang.UnitSphereY());
+  z_.push_back(i_ang.UnitSphereZ());
+  weight_.push_back(1.0);
+  total_weight_ += 1.0;
+  modified_ = true;
+
+  return true;
+}
+
+void KDTreeMap::Build() {
+  nodes_.clear();
+  node_weight_.clear();
+  point_region_.clear();
+  node_region_.clear();
+  modified_ = false;
+
+  uint32_t n_points = x_.size();
+  if (n_points == 0) return;
+
+  std::vector<uint32_t> order(n_points);
+  for (uint32_t i=0;i<n_points;i++) order[i] = i;
+
+  nodes_.reserve(4*(n_points/maximum_points_ + 1));
+  _Build(0, n_points, order);
+
+  // Now we put the points in the order that the tree expects.
+  std::vector<double> tmp_double(n_points);
+  for (uint32_t i=0;i<n_points;i++) tmp_double[i] = x_[order[i]];
+  x_.swap(tmp_double);
+  for (uint32_t i=0;i<n_points;i++) tmp_double[i] = y_[order[i]];
+  y_.swap(tmp_double);
+  for (uint32_t i=0;i<n_points;i++) tmp_double[i] = z_[order[i]];
+  z_.swap(tmp_double);
+  for (uint32_t i=0;i<n_points;i++) tmp_double[i] = weight_[order[i]];
+  weight_.swap(tmp_double);
+
+  std::vector<uint32_t> tmp_index(n_points);
+  for (uint32_t i=0;i<n_points;i++) tmp_index[i] = index_[order[i]];
+  index_.swap(tmp_index);
+
+  // Children always come after their parents, so working backwards gives us
+  // the total weight of the children before we need it.
+  node_weight_.resize(nodes_.size(), 0.0);
+  for (uint32_t i=nodes_.size();i>0;i--) {
+    KDNode& node = nodes_[i - 1];
+    if (node.right_child == 0) {
+      for (uint32_t j=node.point_begin;j<node.point_end;j++)
+	node_weight_[i - 1] += weight_[j];
+    } else {
+      node_weight_[i - 1] = node_weight_[i] + node_weight_[node.right_child];
+    }
+  }
+}
+
+uint32_t KDTreeMap::_Build(uint32_t point_begin, uint32_t point_end,
+			   std::vector<uint32_t>& order) {
+  uint32_t node_idx = nodes_.size();
+  nodes_.push_back(KDNode());
+
+  // The ball is centered on the middle of the bounding box of the points.
+  // That isn't the smallest possible ball, but the bounding box also tells
+  // us which axis to split along.
+  double min_x = x_[order[point_begin]], max_x = min_x;
+  double min_y = y_[order[point_begin]], max_y = min_y;
+  double min_z = z_[order[point_begin]], max_z = min_z;
+  for (uint32_t i=point_begin+1;i<point_end;i++) {
+    uint32_t idx = order[i];
+    if (x_[idx] < min_x) min_x = x_[idx];
+    if (x_[idx] > max_x) max_x = x_[idx];
+    if (y_[idx] < min_y) min_y = y_[idx];
+    if (y_[idx] > max_y) max_y = y_[idx];
+    if (z_[idx] < min_z) min_z = z_[idx];
+    if (z_[idx] > max_z) max_z = z_[idx];
+  }
+
+  double center_x = 0.5*(min_x + max_x);
+  double center_y = 0.5*(min_y + max_y);
+  double center_z = 0.5*(min_z + max_z);
+  double max_chord2 = 0.0;
+  for (uint32_t i=point_begin;i<point_end;i++) {
+    uint32_t idx = order[i];
+    double dx = x_[idx] - center_x;
+    double dy = y_[idx] - center_y;
+    double dz = z_[idx] - center_z;
+    double chord2 = dx*dx + dy*dy + dz*dz;
+    if (chord2 > max_chord2) max_chord2 = chord2;
+  }
+
+  uint32_t right_child = 0;
+  if (point_end - point_begin > maximum_points_) {
+    double extent_x = max_x - min_x;
+    double extent_y = max_y - min_y;
+    double extent_z = max_z - min_z;
+    const std::vector<double>& coordinate =
+      ((extent_x >= extent_y) && (extent_x >= extent_z) ? x_ :
+       (extent_y >= extent_z ? y_ : z_));
+
+    uint32_t point_mid = point_begin + (point_end - point_begin)/2;
+    std::nth_element(order.begin() + point_begin, order.begin() + point_mid,
+		     order.begin() + point_end, KDCoordinateOrder(coordinate));
+
+    _Build(point_begin, point_mid, order);
+    right_child = _Build(point_mid, point_end, order);
+  }
+
+  // The recursion may have reallocated the node array, so we only take a
+  // reference to our node now.
+  KDNode& node = nodes_[node_idx];
+  node.x = center_x;
+  node.y = center_y;
+  node.z = center_z;
+  node.radius = sqrt(max_chord2)*(1.0 + 1.0e-9) + 1.0e-12;
+  node.point_begin = point_begin;
+  node.point_end = point_end;
+  node.right_child = right_child;
+
+  return node_idx;
+}
+
+uint32_t KDTreeMap::FindPairs(AngularCoordinate& ang, AngularBin& theta) {
+  uint32_t region_pairs = 0;
+  double total_weight = 0.0, region_weight = 0.0;
+  uint32_t pair_count = _FindPairs(ang, theta, -1, region_pairs,
+				   total_weight, region_weight, NULL);
+  theta.AddToCounter(pair_count);
+  return pair_count;
+}
+
+uint32_t KDTreeMap::FindPairs(AngularCoordinate& ang,
+			      double theta_min, double theta_max) {
+  AngularBin theta(theta_min, theta_max);
+  return FindPairs(ang, theta);
+}
+
+uint32_t KDTreeMap::FindPairs(AngularCoordinate& ang, double theta_max) {
+  AngularBin theta(0.0, theta_max);
+  return FindPairs(ang, theta);
+}
+
+void KDTreeMap::FindPairs(AngularVector& ang, AngularBin& theta) {
+  for (AngularIterator ang_iter=ang.begin();ang_iter!=ang.end();++ang_iter)
+    FindPairs(*ang_iter, theta);
+}
+
+void KDTreeMap::FindPairs(AngularVector& ang, AngularCorrelation& wtheta) {
+  for (ThetaIterator theta_iter=wtheta.Begin(0);
+       theta_iter!=wtheta.End(0);++theta_iter)
+    FindPairs(ang, *theta_iter);
+}
+
+double KDTreeMap::FindWeightedPairs(AngularCoordinate& ang,
+				    AngularBin& theta) {
+  uint32_t region_pairs = 0;
+  double total_weight = 0.0, region_weight = 0.0;
+  uint32_t pair_count = _FindPairs(ang, theta, -1, region_pairs,
+				   total_weight, region_weight, NULL);
+  theta.AddToWeight(total_weight);
+  theta.AddToCounter(pair_count);
+  return total_weight;
+}
+
+double KDTreeMap::FindWeightedPairs(AngularCoordinate& ang,
+				    double theta_min, double theta_max) {
+  AngularBin theta(theta_min, theta_max);
+  return FindWeightedPairs(ang, theta);
+}
+
+double KDTreeMap::FindWeightedPairs(AngularCoordinate& ang, double theta_max) {
+  AngularBin theta(0.0, theta_max);
+  return FindWeightedPairs(ang, theta);
+}
+
+void KDTreeMap::FindWeightedPairs(AngularVector& ang, AngularBin& theta) {
+  for (AngularIterator ang_iter=ang.begin();ang_iter!=ang.end();++ang_iter)
+    FindWeightedPairs(*ang_iter, theta);
+}
+
+void KDTreeMap::FindWeightedPairs(AngularVector& ang,
+				  AngularCorrelation& wtheta) {
+  for (ThetaIterator theta_iter=wtheta.Begin(0);
+       theta_iter!=wtheta.End(0);++theta_iter)
+    FindWeightedPairs(ang, *theta_iter);
+}
+
+double KDTreeMap::FindWeightedPairs(WeightedAngularCoordinate& w_ang,
+				    AngularBin& theta) {
+  uint32_t region_pairs = 0;
+  double total_weight = 0.0, region_weight = 0.0;
+  uint32_t pair_count = _FindPairs(w_ang, theta, -1, region_pairs,
+				   total_weight, region_weight, NULL);
+  total_weight *= w_ang.Weight();
+  theta.AddToWeight(total_weight);
+  theta.AddToCounter(pair_count);
+  return total_weight;
+}
+
+double KDTreeMap::FindWeightedPairs(WeightedAngularCoordinate& w_ang,
+				    double theta_min, double theta_max) {
+  AngularBin theta(theta_min, theta_max);
+  return FindWeightedPairs(w_ang, theta);
+}
+
+double KDTreeMap::FindWeightedPairs(WeightedAngularCoordinate& w_ang,
+				    double theta_max) {
+  AngularBin theta(0.0, theta_max);
+  return FindWeightedPairs(w_ang, theta);
+}
+
+void KDTreeMap::FindWeightedPairs(WAngularVector& w_ang, AngularBin& theta) {
+  for (WAngularIterator ang_iter=w_ang.begin();
+       ang_iter!=w_ang.end();++ang_iter)
+    FindWeightedPairs(*ang_iter, theta);
+}
+
+void KDTreeMap::FindWeightedPairs(WAngularVector& w_ang,
+				  AngularCorrelation& wtheta) {
+  for (ThetaIterator theta_iter=wtheta.Begin(0);
+       theta_iter!=wtheta.End(0);++theta_iter)
+    FindWeightedPairs(w_ang, *theta_iter);
+}
+
+void KDTreeMap::FindPairs(AngularCoordinate& ang, AngularBin& theta,
+			  IAngularVector& i_angVec) {
+  if (!i_angVec.empty()) i_angVec.clear();
+
+  std::vector<uint32_t> match_idx;
+  uint32_t region_pairs = 0;
+  double total_weight = 0.0, region_weight = 0.0;
+  _FindPairs(ang, theta, -1, region_pairs, total_weight, region_weight,
+	     &match_idx);
+
+  i_angVec.reserve(match_idx.size());
+  for (std::vector<uint32_t>::iterator iter=match_idx.begin();
+       iter!=match_idx.end();++iter) {
+    i_angVec.push_back(IndexedAngularCoordinate(x_[*iter], y_[*iter],
+						z_[*iter], index_[*iter]));
+  }
+}
+
+void KDTreeMap::FindPairs(AngularCoordinate& ang, AngularBin& theta,
+			  IndexVector& pair_indices) {
+  if (!pair_indices.empty()) pair_indices.clear();
+
+  std::vector<uint32_t> match_idx;
+  uint32_t region_pairs = 0;
+  double total_weight = 0.0, region_weight = 0.0;
+  _FindPairs(ang, theta, -1, region_pairs, total_weight, region_weight,
+	     &match_idx);
+
+  pair_indices.reserve(match_idx.size());
+  for (std::vector<uint32_t>::iterator iter=match_idx.begin();
+       iter!=match_idx.end();++iter) pair_indices.push_back(index_[*iter]);
+}
+
+void KDTreeMap::FindPairs(AngularCoordinate& ang,
+			  double theta_min, double theta_max,
+			  IAngularVector& i_angVec) {
+  AngularBin theta(theta_min, theta_max);
+  FindPairs(ang, theta, i_angVec);
+}
+
+void KDTreeMap::FindPairs(AngularCoordinate& ang,
+			  double theta_min, double theta_max,
+			  IndexVector& pair_indices) {
+  AngularBin theta(theta_min, theta_max);
+  FindPairs(ang, theta, pair_indices);
+}
+
+void KDTreeMap::FindPairs(AngularCoordinate& ang, double theta_max,
+			  IAngularVector& i_angVec) {
+  AngularBin theta(0.0, theta_max);
+  FindPairs(ang, theta, i_angVec);
+}
+
+void KDTreeMap::FindPairs(AngularCoordinate& ang, double theta_max,
+			  IndexVector& pair_indices) {
+  AngularBin theta(0.0, theta_max);
+  FindPairs(ang, theta, pair_indices);
+}
+
+void KDTreeMap::FindPairsWithRegions(AngularVector& ang, AngularBin& theta) {
+  if (!RegionsInitialized()) {
+    std::cout <<
+      "Stomp::KDTreeMap::FindPairsWithRegions - " <<
+      "Must initialize regions before calling FindPairsWithRegions\n" <<
+      "\tExiting...\n";
+    exit(2);
+  }
+
+  _AssignRegions();
+
+  for (AngularIterator ang_iter=ang.begin();ang_iter!=ang.end();++ang_iter) {
+    int16_t region = FindRegion(*ang_iter);
+    uint32_t region_pairs = 0;
+    double total_weight = 0.0, region_weight = 0.0;
+    uint32_t pair_count = _FindPairs(*ang_iter, theta, region, region_pairs,
+				     total_weight, region_weight, NULL);
+    theta.AddToCounter(region_pairs, region);
+    theta.AddToCounter(pair_count - region_pairs);
+  }
+}
+
+void KDTreeMap::FindPairsWithRegions(AngularVector& ang,
+				     AngularCorrelation& wtheta) {
+  for (ThetaIterator theta_iter=wtheta.Begin(0);
+       theta_iter!=wtheta.End(0);++theta_iter)
+    FindPairsWithRegions(ang, *theta_iter);
+}
+
+void KDTreeMap::FindWeightedPairsWithRegions(AngularVector& ang,
+					     AngularBin& theta) {
+  if (!RegionsInitialized()) {
+    std::cout <<
+      "Stomp::KDTreeMap::FindWeightedPairsWithRegions - " <<
+      "Must initialize regions before calling FindPairsWithRegions\n" <<
+      "\tExiting...\n";
+    exit(2);
+  }
+
+  _AssignRegions();
+
+  for (AngularIterator ang_iter=ang.begin();ang_iter!=ang.end();++ang_iter) {
+    int16_t region = FindRegion(*ang_iter);
+    uint32_t region_pairs = 0;
+    double total_weight = 0.0, region_weight = 0.0;
+    uint32_t pair_count = _FindPairs(*ang_iter, theta, region, region_pairs,
+				     total_weight, region_weight, NULL);
+    theta.AddToWeight(region_weight, region);
+    theta.AddToWeight(total_weight - region_weight);
+    theta.AddToCounter(region_pairs, region);
+    theta.AddToCounter(pair_count - region_pairs);
+  }
+}
+
+void KDTreeMap::FindWeightedPairsWithRegions(AngularVector& ang,
+					     AngularCorrelation& wtheta) {
+  for (ThetaIterator theta_iter=wtheta.Begin(0);
+       theta_iter!=wtheta.End(0);++theta_iter)
+    FindWeightedPairsWithRegions(ang, *theta_iter);
+}
+
+void KDTreeMap::FindWeightedPairsWithRegions(WAngularVector& w_ang,
+					     AngularBin& theta) {
+  if (!RegionsInitialized()) {
+    std::cout <<
+      "Stomp::KDTreeMap::FindWeightedPairsWithRegions - " <<
+      "Must initialize regions before calling FindPairsWithRegions\n" <<
+      "\tExiting...\n";
+    exit(2);
+  }
+
+  _AssignRegions();
+
+  for (WAngularIterator ang_iter=w_ang.begin();
+       ang_iter!=w_ang.end();++ang_iter) {
+    int16_t region = FindRegion(*ang_iter);
+    uint32_t region_pairs = 0;
+    double total_weight = 0.0, region_weight = 0.0;
+    uint32_t pair_count = _FindPairs(*ang_iter, theta, region, region_pairs,
+				     total_weight, region_weight, NULL);
+    theta.AddToWeight(ang_iter->Weight()*region_weight, region);
+    theta.AddToWeight(ang_iter->Weight()*(total_weight - region_weight));
+    theta.AddToCounter(region_pairs, region);
+    theta.AddToCounter(pair_count - region_pairs);
+  }
+}
+
+void KDTreeMap::FindWeightedPairsWithRegions(WAngularVector& w_ang,
+					     AngularCorrelation& wtheta) {
+  for (ThetaIterator theta_iter=wtheta.Begin(0);
+       theta_iter!=wtheta.End(0);++theta_iter)
+    FindWeightedPairsWithRegions(w_ang, *theta_iter);
+}
+
+uint32_t KDTreeMap::_FindPairs(AngularCoordinate& ang, AngularBin& theta,
+			       int16_t region, uint32_t& region_pairs,
+			       double& total_weight, double& region_weight,
+			       std::vector<uint32_t>* match_idx) {
+  if (modified_) Build();
+
+  uint32_t pair_count = 0;
+  region_pairs = 0;
+  total_weight = 0.0;
+  region_weight = 0.0;
+
+  if (nodes_.empty()) return pair_count;
+
+  bool use_regions = ((region != -1) && !point_region_.empty());
+
+  double ang_x = ang.UnitSphereX();
+  double ang_y = ang.UnitSphereY();
+  double ang_z = ang.UnitSphereZ();
+
+  // Below 90 degrees, the points are tested with the same cosine bounds
+  // that AngularBin::WithinCosBounds uses, so that the results match the
+  // TreeMap.  Above that, we test the squared chord distance directly.  In
+  // either case, the node tests use the equivalent squared chord bounds.
+  bool use_cos_bounds = (theta.ThetaMax() < 90.0 ? true : false);
+  double costheta_lo = theta.CosThetaMin() - 1.0e-15;
+  double costheta_hi = theta.CosThetaMax() + 1.0e-15;
+  double chord2_min, chord2_max;
+  if (use_cos_bounds) {
+    chord2_min = 2.0 - 2.0*costheta_hi;
+    chord2_max = 2.0 - 2.0*costheta_lo;
+  } else {
+    double sin_half_min = sin(0.5*theta.ThetaMin()*DegToRad);
+    double sin_half_max = sin(0.5*theta.ThetaMax()*DegToRad);
+    chord2_min = 4.0*sin_half_min*sin_half_min - 1.0e-15;
+    chord2_max = 4.0*sin_half_max*sin_half_max + 1.0e-15;
+  }
+  bool zero_theta_min = (chord2_min <= 0.0 ? true : false);
+
+  const double* x = &x_[0];
+  const double* y = &y_[0];
+  const double* z = &z_[0];
+  const double* w = &weight_[0];
+
+  std::vector<uint32_t> node_stack;
+  node_stack.reserve(128);
+  node_stack.push_back(0);
+
+  while (!node_stack.empty()) {
+    uint32_t node_idx = node_stack.back();
+    node_stack.pop_back();
+    const KDNode& node = nodes_[node_idx];
+
+    double dx = ang_x - node.x;
+    double dy = ang_y - node.y;
+    double dz = ang_z - node.z;
+    double center_chord = sqrt(dx*dx + dy*dy + dz*dz);
+    double min_chord = center_chord - node.radius;
+    double max_chord = center_chord + node.radius;
+    double min_chord2 = (min_chord > 0.0 ? min_chord*min_chord : 0.0);
+    double max_chord2 = max_chord*max_chord;
+
+    // Skip the node if all of its points are outside the annulus.
+    if ((min_chord2 > chord2_max + KDChord2Tolerance) ||
+	(max_chord2 < chord2_min - KDChord2Tolerance)) continue;
+
+    bool inside = ((max_chord2 <= chord2_max - KDChord2Tolerance) &&
+		   (zero_theta_min ||
+		    ((min_chord > 0.0) &&
+		     (min_chord2 >= chord2_min + KDChord2Tolerance))));
+
+    if (inside) {
+      pair_count += node.point_end - node.point_begin;
+      total_weight += node_weight_[node_idx];
+      if (use_regions) {
+	if (node_region_[node_idx] == region) {
+	  region_pairs += node.point_end - node.point_begin;
+	  region_weight += node_weight_[node_idx];
+	} else if (node_region_[node_idx] == -2) {
+	  for (uint32_t i=node.point_begin;i<node.point_end;i++) {
+	    if (point_region_[i] == region) {
+	      region_pairs++;
+	      region_weight += w[i];
+	    }
+	  }
+	}
+      }
+      if (match_idx != NULL) {
+	for (uint32_t i=node.point_begin;i<node.point_end;i++)
+	  match_idx->push_back(i);
+      }
+    } else if (node.right_child != 0) {
+      node_stack.push_back(node.right_child);
+      node_stack.push_back(node_idx + 1);
+    } else if (!use_regions && (match_idx == NULL)) {
+      // The common case is written without branches so that the compiler
+      // can vectorize it.
+      if (use_cos_bounds) {
+	for (uint32_t i=node.point_begin;i<node.point_end;i++) {
+	  double costheta = ang_x*x[i] + ang_y*y[i] + ang_z*z[i];
+	  uint32_t in_bin = ((costheta >= costheta_lo) &
+			     (costheta <= costheta_hi));
+	  pair_count += in_bin;
+	  total_weight += (in_bin ? w[i] : 0.0);
+	}
+      } else {
+	for (uint32_t i=node.point_begin;i<node.point_end;i++) {
+	  double cx = ang_x - x[i];
+	  double cy = ang_y - y[i];
+	  double cz = ang_z - z[i];
+	  double chord2 = cx*cx + cy*cy + cz*cz;
+	  uint32_t in_bin = ((chord2 >= chord2_min) & (chord2 <= chord2_max));
+	  pair_count += in_bin;
+	  total_weight += (in_bin ? w[i] : 0.0);
+	}
+      }
+    } else {
+      for (uint32_t i=node.point_begin;i<node.point_end;i++) {
+	bool in_bin;
+	if (use_cos_bounds) {
+	  double costheta = ang_x*x[i] + ang_y*y[i] + ang_z*z[i];
+	  in_bin = ((costheta >= costheta_lo) && (costheta <= costheta_hi));
+	} else {
+	  double cx = ang_x - x[i];
+	  double cy = ang_y - y[i];
+	  double cz = ang_z - z[i];
+	  double chord2 = cx*cx + cy*cy + cz*cz;
+	  in_bin = ((chord2 >= chord2_min) && (chord2 <= chord2_max));
+	}
+	if (in_bin) {
+	  pair_count++;
+	  total_weight += w[i];
+	  if (use_regions && (point_region_[i] == region)) {
+	    region_pairs++;
+	    region_weight += w[i];
+	  }
+	  if (match_idx != NULL) match_idx->push_back(i);
+	}
+      }
+    }
+  }
+
+  return pair_count;
+}
+
+void KDTreeMap::_AssignRegions() {
+  // The regions can be re-initialized at any time without the map knowing
+  // about it, so we look them up again for every set of region-aware
+  // searches.
+  if (modified_) Build();
+
+  uint32_t n_points = x_.size();
+  point_region_.resize(n_points);
+  for (uint32_t i=0;i<n_points;i++) {
+    AngularCoordinate ang(x_[i], y_[i], z_[i]);
+    point_region_[i] = FindRegion(ang);
+  }
+
+  // Each node records the region shared by all of its points, or -2 if
+  // they span more than one region.
+  node_region_.resize(nodes_.size());
+  for (uint32_t i=nodes_.size();i>0;i--) {
+    KDNode& node = nodes_[i - 1];
+    if (node.right_child == 0) {
+      int16_t region = point_region_[node.point_begin];
+      for (uint32_t j=node.point_begin+1;j<node.point_end;j++) {
+	if (point_region_[j] != region) {
+	  region = -2;
+	  break;
+	}
+      }
+      node_region_[i - 1] = region;
+    } else {
+      node_region_[i - 1] =
+	(node_region_[i] == node_region_[node.right_child] ?
+	 node_region_[i] : -2);
+    }
+  }
+}
+
+double KDTreeMap::_MinChord2(AngularCoordinate& ang, uint32_t node_idx) {
+  const KDNode& node = nodes_[node_idx];
+  double dx = ang.UnitSphereX() - node.x;
+  double dy = ang.UnitSphereY() - node.y;
+  double dz = ang.UnitSphereZ() - node.z;
+  double min_chord = sqrt(dx*dx + dy*dy + dz*dz) - node.radius;
+  return (min_chord > 0.0 ? min_chord*min_chord : 0.0);
+}
+
+uint32_t KDTreeMap::_NeighborSearch(
+  AngularCoordinate& ang, uint32_t n_neighbors, double max_chord2,
+  std::vector<std::pair<double, uint32_t> >& neighbors) {
+  if (modified_) Build();
+
+  neighbors.clear();
+  uint32_t nodes_visited = 0;
+  if (nodes_.empty() || (n_neighbors == 0)) return nodes_visited;
+
+  // A best-first search: the nodes are kept in a queue ordered by the
+  // minimum possible squared chord distance to any of their points and the
+  // current neighbors are kept in a heap with the most distant on top.  Once
+  // the nearest node in the queue is farther away than the kth neighbor (or
+  // the maximum distance), we're done.
+  typedef std::pair<double, uint32_t> DistanceIndexPair;
+  std::priority_queue<DistanceIndexPair, std::vector<DistanceIndexPair>,
+    std::greater<DistanceIndexPair> > node_queue;
+  node_queue.push(DistanceIndexPair(_MinChord2(ang, 0), 0));
+
+  double ang_x = ang.UnitSphereX();
+  double ang_y = ang.UnitSphereY();
+  double ang_z = ang.UnitSphereZ();
+
+  while (!node_queue.empty()) {
+    if (node_queue.top().first > max_chord2) break;
+    if ((neighbors.size() == n_neighbors) &&
+	(node_queue.top().first >= neighbors.front().first)) break;
+
+    uint32_t node_idx = node_queue.top().second;
+    node_queue.pop();
+    nodes_visited++;
+
+    const KDNode& node = nodes_[node_idx];
+    if (node.right_child != 0) {
+      node_queue.push(DistanceIndexPair(_MinChord2(ang, node_idx + 1),
+					node_idx + 1));
+      node_queue.push(DistanceIndexPair(_MinChord2(ang, node.right_child),
+					node.right_child));
+    } else {
+      for (uint32_t i=node.point_begin;i<node.point_end;i++) {
+	double dx = ang_x - x_[i];
+	double dy = ang_y - y_[i];
+	double dz = ang_z - z_[i];
+	double chord2 = dx*dx + dy*dy + dz*dz;
+	if (chord2 > max_chord2) continue;
+	if (neighbors.size() < n_neighbors) {
+	  neighbors.push_back(DistanceIndexPair(chord2, i));
+	  std::push_heap(neighbors.begin(), neighbors.end());
+	} else if (chord2 < neighbors.front().first) {
+	  std::pop_heap(neighbors.begin(), neighbors.end());
+	  neighbors.back() = DistanceIndexPair(chord2, i);
+	  std::push_heap(neighbors.begin(), neighbors.end());
+	}
+      }
+    }
+  }
+
+  std::sort_heap(neighbors.begin(), neighbors.end());
+
+  return nodes_visited;
+}
+
+uint32_t KDTreeMap::FindKNearestNeighbors(AngularCoordinate& ang,
+					  uint32_t n_neighbors,
+					  WAngularVector& neighbors_ang) {
+  if (!neighbors_ang.empty()) neighbors_ang.clear();
+
+  std::vector<std::pair<double, uint32_t> > neighbors;
+  uint32_t nodes_visited = _NeighborSearch(ang, n_neighbors, 4.0, neighbors);
+
+  neighbors_ang.reserve(neighbors.size());
+  for (uint32_t i=neighbors.size();i>0;i--) {
+    uint32_t idx = neighbors[i - 1].second;
+    neighbors_ang.push_back(WeightedAngularCoordinate(x_[idx], y_[idx],
+						      z_[idx], weight_[idx]));
+  }
+
+  return nodes_visited;
+}
+
+uint32_t KDTreeMap::FindKNearestNeighbors(AngularCoordinate& ang,
+					  uint32_t n_neighbors,
+					  IAngularVector& neighbors_ang) {
+  if (!neighbors_ang.empty()) neighbors_ang.clear();
+
+  std::vector<std::pair<double, uint32_t> > neighbors;
+  uint32_t nodes_visited = _NeighborSearch(ang, n_neighbors, 4.0, neighbors);
+
+  neighbors_ang.reserve(neighbors.size());
+  for (uint32_t i=neighbors.size();i>0;i--) {
+    uint32_t idx = neighbors[i - 1].second;
+    neighbors_ang.push_back(IndexedAngularCoordinate(x_[idx], y_[idx],
+						     z_[idx], index_[idx]));
+  }
+
+  return nodes_visited;
+}
+
+uint32_t KDTreeMap::FindNearestNeighbor(
+  AngularCoordinate& ang, WeightedAngularCoordinate& neighbor_ang) {
+  WAngularVector neighbors_ang;
+  uint32_t nodes_visited = FindKNearestNeighbors(ang, 1, neighbors_ang);
+  if (!neighbors_ang.empty()) neighbor_ang = neighbors_ang[0];
+  return nodes_visited;
+}
+
+uint32_t KDTreeMap::FindNearestNeighbor(
+  AngularCoordinate& ang, IndexedAngularCoordinate& neighbor_ang) {
+  IAngularVector neighbors_ang;
+  uint32_t nodes_visited = FindKNearestNeighbors(ang, 1, neighbors_ang);
+  if (!neighbors_ang.empty()) neighbor_ang = neighbors_ang[0];
+  return nodes_visited;
+}
+
+double KDTreeMap::KNearestNeighborDistance(AngularCoordinate& ang,
+					   uint32_t n_neighbors,
+					   uint16_t& nodes_visited) {
+  std::vector<std::pair<double, uint32_t> > neighbors;
+  uint32_t n_visited = _NeighborSearch(ang, n_neighbors, 4.0, neighbors);
+  nodes_visited = (n_visited > 65535 ? 65535 :
+		   static_cast<uint16_t>(n_visited));
+
+  if ((neighbors.size() < n_neighbors) || neighbors.empty()) return 180.0;
+
+  double chord = sqrt(neighbors.back().first);
+  if (chord > 2.0) chord = 2.0;
+  return 2.0*RadToDeg*asin(0.5*chord);
+}
+
+double KDTreeMap::NearestNeighborDistance(AngularCoordinate& ang,
+					  uint16_t& nodes_visited) {
+  return KNearestNeighborDistance(ang, 1, nodes_visited);
+}
+
+bool KDTreeMap::ClosestMatch(AngularCoordinate& ang, double max_distance,
+			     WeightedAngularCoordinate& match_ang) {
+  double sin_half = sin(0.5*max_distance*DegToRad);
+  std::vector<std::pair<double, uint32_t> > neighbors;
+  _NeighborSearch(ang, 1, 4.0*sin_half*sin_half, neighbors);
+
+  bool found_match = false;
+  if (!neighbors.empty() &&
+      (neighbors[0].first < 4.0*sin_half*sin_half)) {
+    found_match = true;
+    uint32_t idx = neighbors[0].second;
+    match_ang.SetUnitSphereCoordinates(x_[idx], y_[idx], z_[idx]);
+    match_ang.SetWeight(weight_[idx]);
+  }
+
+  return found_match;
+}
+
+bool KDTreeMap::ClosestMatch(AngularCoordinate& ang, double max_distance,
+			     IndexedAngularCoordinate& match_ang) {
+  double sin_half = sin(0.5*max_distance*DegToRad);
+  std::vector<std::pair<double, uint32_t> > neighbors;
+  _NeighborSearch(ang, 1, 4.0*sin_half*sin_half, neighbors);
+
+  bool found_match = false;
+  if (!neighbors.empty() &&
+      (neighbors[0].first < 4.0*sin_half*sin_half)) {
+    found_match = true;
+    uint32_t idx = neighbors[0].second;
+    match_ang.SetUnitSphereCoordinates(x_[idx], y_[idx], z_[idx]);
+    match_ang.SetIndex(index_[idx]);
+  }
+
+  return found_match;
+}
+
+void KDTreeMap::Coverage(PixelVector& superpix, uint32_t resolution,
+			 bool calculate_fraction) {
+  if (!superpix.empty()) superpix.clear();
+
+  if (resolution > resolution_) {
+    std::cout << "Stomp::KDTreeMap::Coverage - " <<
+      "WARNING: Requested resolution is higher than " <<
+      "the map resolution!\nReseting to map resolution...\n";
+    resolution = resolution_;
+  }
+
+  if (resolution == resolution_) {
+    superpix.reserve(pixel_count_.size());
+    for (std::map<uint32_t, uint32_t>::iterator iter=pixel_count_.begin();
+	 iter!=pixel_count_.end();++iter)
+      superpix.push_back(Pixel(resolution_, iter->first, 1.0));
+  } else {
+    // We use a map to find the unique coarser pixels.
+    std::map<uint32_t, bool> coarse_pixnum;
+    for (std::map<uint32_t, uint32_t>::iterator iter=pixel_count_.begin();
+	 iter!=pixel_count_.end();++iter) {
+      Pixel pix(resolution_, iter->first, 1.0);
+      pix.SetToSuperPix(resolution);
+      coarse_pixnum[pix.Pixnum()] = true;
+    }
+
+    superpix.reserve(coarse_pixnum.size());
+    for (std::map<uint32_t, bool>::iterator iter=coarse_pixnum.begin();
+	 iter!=coarse_pixnum.end();++iter) {
+      Pixel pix(resolution, iter->first, 1.0);
+      if (calculate_fraction) pix.SetWeight(FindUnmaskedFraction(pix));
+      superpix.push_back(pix);
+    }
+  }
+
+  sort(superpix.begin(), superpix.end(), Pixel::SuperPixelBasedOrder);
+}
+
+bool KDTreeMap::Covering(Map& stomp_map, uint32_t maximum_pixels) {
+  if (!stomp_map.Empty()) stomp_map.Clear();
+
+  PixelVector pix;
+  Coverage(pix);
+
+  bool met_pixel_requirement;
+  if (pix.size() > maximum_pixels) {
+    // As with the TreeMap, if we can't meet the requirement with the
+    // superpixels, we return the superpixel coverage.
+    met_pixel_requirement = false;
+
+    stomp_map.Initialize(pix);
+  } else {
+    met_pixel_requirement = true;
+
+    NodeMap(stomp_map);
+
+    if (maximum_pixels < stomp_map.Size()) {
+      Map tmp_map;
+      met_pixel_requirement = stomp_map.Covering(tmp_map, maximum_pixels);
+      if (tmp_map.Size() < maximum_pixels) {
+	stomp_map = tmp_map;
+      }
+    }
+  }
+
+  return met_pixel_requirement;
+}
+
+double KDTreeMap::FindUnmaskedFraction(Pixel& pix) {
+  double unmasked_fraction = 0.0;
+
+  if (pix.Resolution() >= resolution_) {
+    // A pixel at or below the map resolution is either in an occupied pixel
+    // or it isn't.
+    Pixel tmp_pix = pix;
+    tmp_pix.SetToSuperPix(resolution_);
+    if (pixel_count_.find(tmp_pix.Pixnum()) != pixel_count_.end())
+      unmasked_fraction = 1.0;
+  } else {
+    // Otherwise, we count the occupied pixels inside the input pixel.
+    double pixel_fraction =
+      static_cast<double> (pix.Resolution()*pix.Resolution())/
+      (resolution_*resolution_);
+    for (std::map<uint32_t, uint32_t>::iterator iter=pixel_count_.begin();
+	 iter!=pixel_count_.end();++iter) {
+      Pixel tmp_pix(resolution_, iter->first, 1.0);
+      if (pix.Contains(tmp_pix)) unmasked_fraction += pixel_fraction;
+    }
+  }
+
+  return unmasked_fraction;
+}
+
+int8_t KDTreeMap::FindUnmaskedStatus(Pixel& pix) {
+  int8_t unmasked_status = 0;
+
+  if (pix.Resolution() >= resolution_) {
+    Pixel tmp_pix = pix;
+    tmp_pix.SetToSuperPix(resolution_);
+    if (pixel_count_.find(tmp_pix.Pixnum()) != pixel_count_.end())
+      unmasked_status = 1;
+  } else {
+    std::map<uint32_t, uint32_t>::iterator iter = pixel_count_.begin();
+    while ((iter != pixel_count_.end()) && (unmasked_status == 0)) {
+      Pixel tmp_pix(resolution_, iter->first, 1.0);
+      if (pix.Contains(tmp_pix)) unmasked_status = -1;
+      ++iter;
+    }
+  }
+
+  return unmasked_status;
+}
+
+void KDTreeMap::NodeMap(Map& stomp_map) {
+  if (!stomp_map.Empty()) stomp_map.Clear();
+
+  PixelVector pix;
+  pix.reserve(pixel_count_.size());
+  for (std::map<uint32_t, uint32_t>::iterator iter=pixel_count_.begin();
+       iter!=pixel_count_.end();++iter)
+    pix.push_back(Pixel(resolution_, iter->first, 1.0));
+
+  stomp_map.Initialize(pix);
+}
+
+uint32_t KDTreeMap::Resolution() {
+  return resolution_;
+}
+
+uint16_t KDTreeMap::PixelCapacity() {
+  return maximum_points_;
+}
+
+void KDTreeMap::SetResolution(uint32_t resolution) {
+  resolution_ = resolution;
+
+  // The occupied pixels need to be found again at the new resolution, which
+  // also invalidates any regions.
+  pixel_count_.clear();
+  for (uint32_t i=0;i<x_.size();i++) {
+    AngularCoordinate ang(x_[i], y_[i], z_[i]);
+    Pixel pix(ang, resolution_);
+    pixel_count_[pix.Pixnum()]++;
+  }
+  ClearRegions();
+}
+
+void KDTreeMap::SetPixelCapacity(uint16_t maximum_points) {
+  maximum_points_ = (maximum_points > 0 ? maximum_points : 1);
+  if (!x_.empty()) modified_ = true;
+}
+
+uint32_t KDTreeMap::NPoints() {
+  return x_.size();
+}
+
+double KDTreeMap::Weight() {
+  return total_weight_;
+}
+
+void KDTreeMap::Points(WAngularVector& w_ang) {
+  if (!w_ang.empty()) w_ang.clear();
+
+  w_ang.reserve(x_.size());
+  for (uint32_t i=0;i<x_.size();i++)
+    w_ang.push_back(WeightedAngularCoordinate(x_[i], y_[i], z_[i],
+					      weight_[i]));
+}
+
+void KDTreeMap::Points(IAngularVector& i_ang) {
+  if (!i_ang.empty()) i_ang.clear();
+
+  i_ang.reserve(x_.size());
+  for (uint32_t i=0;i<x_.size();i++)
+    i_ang.push_back(IndexedAngularCoordinate(x_[i], y_[i], z_[i],
+					     index_[i]));
+}
+
+uint32_t KDTreeMap::Nodes() {
+  if (modified_) Build();
+  return nodes_.size();
+}
+
+uint32_t KDTreeMap::Size() {
+  return pixel_count_.size();
+}
+
+double KDTreeMap::Area() {
+  Pixel pix;
+  pix.SetResolution(resolution_);
+  return pixel_count_.size()*pix.Area();
+}
+
+uint32_t KDTreeMap::MinResolution() {
+  return resolution_;
+}
+
+uint32_t KDTreeMap::MaxResolution() {
+  return resolution_;
+}
+
+uint8_t KDTreeMap::MinLevel() {
+  return Pixel::ResolutionToLevel(resolution_);
+}
+
+uint8_t KDTreeMap::MaxLevel() {
+  return Pixel::ResolutionToLevel(resolution_);
+}
+
+bool KDTreeMap::Empty() {
+  return (x_.empty() ? true : false);
+}
+
+void KDTreeMap::Clear() {
+  nodes_.clear();
+  node_weight_.clear();
+  x_.clear();
+  y_.clear();
+  z_.clear();
+  weight_.clear();
+  index_.clear();
+  point_region_.clear();
+  node_region_.clear();
+  pixel_count_.clear();
+  total_weight_ = 0.0;
+  modified_ = false;
+  ClearRegions();
+}
+
+} // end namespace Stomp
@@ -0,0 +1,241 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This header file contains the KDTreeMap class.  The TreeMap and
+// IndexedTreeMap classes organize their points with the STOMP pixelization,
+// splitting each node into four sub-pixels.  That ties the shape of the nodes
+// to the survey coordinate grid, which gives long, thin nodes near the survey
+// poles and doesn't adapt to strongly clustered data.  The KDTreeMap is an
+// alternative backend that splits the points themselves in the 3-D unit
+// sphere coordinates, so every node is a compact ball regardless of where the
+// points are on the sky.  It offers the same pair-finding, region and nearest
+// neighbor methods as the TreeMap and IndexedTreeMap so that the two can be
+// swapped in and benchmarked against each other for a given data set.
+
+#ifndef STOMP_KDTREE_MAP_H
+#define STOMP_KDTREE_MAP_H
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include "stomp_core.h"
+#include "stomp_angular_coordinate.h"
+#include "stomp_itree_pixel.h"
+#include "stomp_base_map.h"
+
+namespace Stomp {
+
+class AngularBin;           // class definition in stomp_angular_bin.h
+class AngularCorrelation;   // class definition in stomp_angular_correlation.h
+class Map;                  // class definition in stomp_map.h
+class KDTreeMap;
+
+struct KDNode {
+  // Each node is bounded by a ball in the 3-D unit sphere coordinates.  The
+  // radius is the largest chord distance from the center to any of the
+  // node's points, so the chord distance from an input point to any point in
+  // the node is within radius of the distance to the center.  The left child
+  // of an internal node is always the next node in the array.
+  double x, y, z, radius;
+  uint32_t point_begin, point_end, right_child;
+};
+
+class KDTreeMap : public BaseMap {
+  // Class object for a ball tree over the unit sphere coordinates of a set of
+  // points.  Points are added one at a time and the tree is built the first
+  // time it is searched after the points have changed (or explicitly with
+  // Build).  Each node is split in half at the median of the coordinate axis
+  // along which its points are most spread out, until a node holds no more
+  // than the pixel capacity.  The points and nodes are stored in contiguous
+  // arrays in depth-first order, so the points of any node form a single
+  // range.
+  //
+  // Each point carries both a weight and an index.  Points added as
+  // WeightedAngularCoordinates are indexed in the order they were added,
+  // while points added as IndexedAngularCoordinates get unit weight, so
+  // either the TreeMap or IndexedTreeMap style methods can be used on the
+  // same map.  Field values are not stored.
+  //
+  // Since the tree has no pixel structure of its own, the map keeps track of
+  // which pixels at the map resolution contain points.  Those pixels define
+  // the coverage of the map, which is used for the region methods.
+ public:
+  // The resolution sets the pixels used to describe the map coverage; as with
+  // the TreeMap, it needs to be at least as fine as the resolution used for
+  // the regions.  The pixel capacity is the maximum number of points in a
+  // leaf node.
+  KDTreeMap(uint32_t resolution=HPixResolution, uint16_t maximum_points=32);
+  ~KDTreeMap();
+
+  // Pair-finding, following the TreeMap conventions: the AngularBin and
+  // AngularCorrelation arguments accumulate the pair counts and weights and
+  // the WeightedAngularCoordinate forms scale the weighted pairs by the
+  // weight of the input point.  Unlike the TreeMap, separations beyond 90
+  // degrees are measured exactly rather than folded back through arcsine.
+  uint32_t FindPairs(AngularCoordinate& ang, AngularBin& theta);
+  uint32_t FindPairs(AngularCoordinate& ang,
+		     double theta_min, double theta_max);
+  uint32_t FindPairs(AngularCoordinate& ang, double theta_max);
+  void FindPairs(AngularVector& ang, AngularBin& theta);
+  void FindPairs(AngularVector& ang, AngularCorrelation& wtheta);
+
+  double FindWeightedPairs(AngularCoordinate& ang, AngularBin& theta);
+  double FindWeightedPairs(AngularCoordinate& ang,
+			   double theta_min, double theta_max);
+  double FindWeightedPairs(AngularCoordinate& ang, double theta_max);
+  void FindWeightedPairs(AngularVector& ang, AngularBin& theta);
+  void FindWeightedPairs(AngularVector& ang, AngularCorrelation& wtheta);
+
+  double FindWeightedPairs(WeightedAngularCoordinate& w_ang,
+			   AngularBin& theta);
+  double FindWeightedPairs(WeightedAngularCoordinate& w_ang,
+			   double theta_min, double theta_max);
+  double FindWeightedPairs(WeightedAngularCoordinate& w_ang,
+			   double theta_max);
+  void FindWeightedPairs(WAngularVector& w_ang, AngularBin& theta);
+  void FindWeightedPairs(WAngularVector& w_ang, AngularCorrelation& wtheta);
+
+  // The IndexedTreeMap forms, which return copies of the paired points or
+  // their indices.  As with the IndexedTreeMap, the AngularBin is not
+  // modified.
+  void FindPairs(AngularCoordinate& ang, AngularBin& theta,
+		 IAngularVector& i_angVec);
+  void FindPairs(AngularCoordinate& ang, AngularBin& theta,
+		 IndexVector& pair_indices);
+  void FindPairs(AngularCoordinate& ang,
+		 double theta_min, double theta_max,
+		 IAngularVector& i_angVec);
+  void FindPairs(AngularCoordinate& ang,
+		 double theta_min, double theta_max,
+		 IndexVector& pair_indices);
+  void FindPairs(AngularCoordinate& ang, double theta_max,
+		 IAngularVector& i_angVec);
+  void FindPairs(AngularCoordinate& ang, double theta_max,
+		 IndexVector& pair_indices);
+
+  // The region-aware pair-finding.  As in the TreeMap, each input point is
+  // assigned to the region containing it and pairs with tree points in the
+  // same region are excluded from that region's jack-knife sample.
+  void FindPairsWithRegions(AngularVector& ang, AngularBin& theta);
+  void FindPairsWithRegions(AngularVector& ang, AngularCorrelation& wtheta);
+  void FindWeightedPairsWithRegions(AngularVector& ang, AngularBin& theta);
+  void FindWeightedPairsWithRegions(AngularVector& ang,
+				    AngularCorrelation& wtheta);
+  void FindWeightedPairsWithRegions(WAngularVector& w_ang, AngularBin& theta);
+  void FindWeightedPairsWithRegions(WAngularVector& w_ang,
+				    AngularCorrelation& wtheta);
+
+  // Nearest neighbor searches.  The neighbors are returned with the most
+  // distant first and the return value is the number of nodes visited.
+  // There is no duplicate checking, so an input point that is also in the
+  // tree will be its own nearest neighbor.
+  uint32_t FindKNearestNeighbors(AngularCoordinate& ang, uint32_t n_neighbors,
+				 WAngularVector& neighbors_ang);
+  uint32_t FindKNearestNeighbors(AngularCoordinate& ang, uint32_t n_neighbors,
+				 IAngularVector& neighbors_ang);
+  uint32_t FindNearestNeighbor(AngularCoordinate& ang,
+			       WeightedAngularCoordinate& neighbor_ang);
+  uint32_t FindNearestNeighbor(AngularCoordinate& ang,
+			       IndexedAngularCoordinate& neighbor_ang);
+
+  // The distance in degrees to the kth nearest neighbor, or 180 degrees if
+  // the tree holds fewer than k points.  nodes_visited saturates at 65535.
+  double KNearestNeighborDistance(AngularCoordinate& ang, uint32_t n_neighbors,
+				  uint16_t& nodes_visited);
+  double NearestNeighborDistance(AngularCoordinate& ang,
+				 uint16_t& nodes_visited);
+
+  // Find the closest point within max_distance degrees of the input point.
+  // The return value indicates whether an acceptable match was found.
+  bool ClosestMatch(AngularCoordinate& ang, double max_distance,
+		    WeightedAngularCoordinate& match_ang);
+  bool ClosestMatch(AngularCoordinate& ang, double max_distance,
+		    IndexedAngularCoordinate& match_ang);
+
+  // Add points to the map.  The pointer form takes ownership of the input
+  // object, as it does for the TreeMap.  Points are always copied into the
+  // tree's own storage, so the object is deleted once it has been added.
+  bool AddPoint(WeightedAngularCoordinate* w_ang);
+  bool AddPoint(WeightedAngularCoordinate& w_ang);
+  bool AddPoint(AngularCoordinate& ang, double object_weight = 1.0);
+  bool AddPoint(IndexedAngularCoordinate& i_ang);
+
+  // Build the tree now rather than waiting for the first search.
+  void Build();
+
+  // Equivalent methods as their namesakes in the BaseMap class.
+  virtual void Coverage(PixelVector& superpix,
+			uint32_t resolution = HPixResolution,
+			bool calculate_fraction = true);
+  bool Covering(Map& stomp_map, uint32_t maximum_pixels);
+  virtual double FindUnmaskedFraction(Pixel& pix);
+  virtual int8_t FindUnmaskedStatus(Pixel& pix);
+
+  // A Map made up of the pixels at the map resolution that contain points.
+  void NodeMap(Map& stomp_map);
+
+  // Getters and setters for the coverage resolution and leaf capacity.
+  // Changing either of these keeps the points but rebuilds the tree.
+  uint32_t Resolution();
+  uint16_t PixelCapacity();
+  void SetResolution(uint32_t resolution);
+  void SetPixelCapacity(uint16_t maximum_points);
+
+  // Total number of points and their total weight.
+  uint32_t NPoints();
+  double Weight();
+
+  // Copies of all of the points in the map.
+  void Points(WAngularVector& w_ang);
+  void Points(IAngularVector& i_ang);
+
+  // Total number of nodes in the tree.
+  uint32_t Nodes();
+
+  // We need these methods to comply with the BaseMap signature.  The size of
+  // the map is the number of pixels at the map resolution that contain
+  // points.
+  virtual uint32_t Size();
+  virtual double Area();
+  virtual uint32_t MinResolution();
+  virtual uint32_t MaxResolution();
+  virtual uint8_t MinLevel();
+  virtual uint8_t MaxLevel();
+  virtual bool Empty();
+  virtual void Clear();
+
+ private:
+  uint32_t _Build(uint32_t point_begin, uint32_t point_end,
+		  std::vector<uint32_t>& order);
+  uint32_t _FindPairs(AngularCoordinate& ang, AngularBin& theta,
+		      int16_t region, uint32_t& region_pairs,
+		      double& total_weight, double& region_weight,
+		      std::vector<uint32_t>* match_idx);
+  uint32_t _NeighborSearch(AngularCoordinate& ang, uint32_t n_neighbors,
+			   double max_chord2,
+			   std::vector<std::pair<double, uint32_t> >& neighbors);
+  double _MinChord2(AngularCoordinate& ang, uint32_t node_idx);
+  void _AssignRegions();
+
+  std::vector<KDNode> nodes_;
+  std::vector<double> node_weight_;
+  std::vector<double> x_, y_, z_, weight_;
+  std::vector<uint32_t> index_;
+  std::vector<int16_t> point_region_, node_region_;
+  std::map<uint32_t, uint32_t> pixel_count_;
+  uint32_t resolution_;
+  uint16_t maximum_points_;
+  double total_weight_;
+  bool modified_;
+};
+
+} // end namespace Stomp
+
+#endif
@@ -0,0 +1,256 @@
+#include <stdint.h>
+#include <iostream>
+#include <math.h>
+#include <string>
+#include <algorithm>
+#include <gflags/gflags.h>
+#include "stomp_core.h"
+#include "stomp_util.h"
+#include "stomp_angular_coordinate.h"
+#include "stomp_angular_correlation.h"
+#include "stomp_pixel.h"
+#include "stomp_map.h"
+#include "stomp_tree_map.h"
+#include "stomp_kdtree_map.h"
+
+void KDTreeMapPairTests() {
+  std::cout << "\n";
+  std::cout << "****************************\n";
+  std::cout << "*** KDTreeMap Pair Tests ***\n";
+  std::cout << "****************************\n";
+  // We fill a TreeMap and a KDTreeMap with the same points and compare the
+  // pair counts.  We do this once at moderate survey latitude and once near
+  // the survey pole, where the TreeMap nodes are at their most elongated.
+  double lambda[2] = {30.0, 85.0};
+  for (uint32_t k=0;k<2;k++) {
+    Stomp::AngularCoordinate ang(lambda[k], 0.0,
+				 Stomp::AngularCoordinate::Survey);
+    Stomp::Pixel tmp_pix(ang, 32);
+    Stomp::PixelVector annulus_pix;
+    tmp_pix.WithinRadius(5.0, annulus_pix);
+    Stomp::Map* stomp_map = new Stomp::Map(annulus_pix);
+    uint32_t n_points = 200000;
+    Stomp::AngularVector angVec;
+    stomp_map->GenerateRandomPoints(angVec, n_points);
+
+    Stomp::StompWatch stomp_watch;
+    Stomp::TreeMap tree_map(Stomp::HPixResolution, 50);
+    Stomp::KDTreeMap kd_map(Stomp::HPixResolution, 32);
+    stomp_watch.StartTimer();
+    for (uint32_t i=0;i<angVec.size();i++)
+      tree_map.AddPoint(angVec[i], 1.0 + (i % 3));
+    stomp_watch.StopTimer();
+    double tree_time = stomp_watch.ElapsedTime();
+    stomp_watch.StartTimer();
+    for (uint32_t i=0;i<angVec.size();i++)
+      kd_map.AddPoint(angVec[i], 1.0 + (i % 3));
+    kd_map.Build();
+    stomp_watch.StopTimer();
+    std::cout << "\nlambda = " << lambda[k] << ": " << kd_map.NPoints() <<
+      " points, " << kd_map.Nodes() << " KDTreeMap nodes\n";
+    std::cout << "\tBuild: TreeMap " << tree_time << "s; KDTreeMap " <<
+      stomp_watch.ElapsedTime() << "s\n";
+
+    Stomp::AngularVector subVec(angVec.begin(), angVec.begin() + 5000);
+    Stomp::AngularCorrelation tree_wtheta(0.001, 2.0, 5.0, false);
+    Stomp::AngularCorrelation kd_wtheta(0.001, 2.0, 5.0, false);
+    stomp_watch.StartTimer();
+    tree_map.FindWeightedPairs(subVec, tree_wtheta);
+    stomp_watch.StopTimer();
+    tree_time = stomp_watch.ElapsedTime();
+    stomp_watch.StartTimer();
+    kd_map.FindWeightedPairs(subVec, kd_wtheta);
+    stomp_watch.StopTimer();
+    std::cout << "\tPair counts: TreeMap " << tree_time << "s; KDTreeMap " <<
+      stomp_watch.ElapsedTime() << "s\n";
+
+    uint32_t n_mismatch = 0;
+    Stomp::ThetaIterator kd_iter = kd_wtheta.Begin();
+    for (Stomp::ThetaIterator iter=tree_wtheta.Begin();
+	 iter!=tree_wtheta.End();++iter,++kd_iter) {
+      if ((iter->Counter() != kd_iter->Counter()) ||
+	  !Stomp::DoubleEQ(iter->Weight()/kd_iter->Weight(), 1.0))
+	n_mismatch++;
+    }
+    std::cout << "\t\t" << n_mismatch << "/" << tree_wtheta.NBins() <<
+      " bins differ between TreeMap and KDTreeMap.\n";
+
+    // Since the two can disagree, we check both against brute force counts
+    // for a handful of points.  At the same time, we check the indexed
+    // pair-finding and the region-aware counts, with the KDTreeMap using the
+    // regions from the TreeMap.
+    uint16_t n_regions = tree_map.InitializeRegions(8);
+    kd_map.InitializeRegions(tree_map);
+    std::vector<int16_t> point_region;
+    for (uint32_t i=0;i<angVec.size();i++)
+      point_region.push_back(kd_map.FindRegion(angVec[i]));
+
+    Stomp::AngularBin theta(0.01, 0.1);
+    Stomp::AngularBin region_bin(0.01, 0.1);
+    Stomp::AngularBin brute_bin(0.01, 0.1);
+    region_bin.InitializeRegions(n_regions);
+    brute_bin.InitializeRegions(n_regions);
+    Stomp::AngularVector checkVec(angVec.begin(), angVec.begin() + 100);
+    kd_map.FindPairsWithRegions(checkVec, region_bin);
+
+    uint32_t n_tree_mismatch = 0, n_kd_mismatch = 0, n_index_mismatch = 0;
+    for (uint32_t i=0;i<checkVec.size();i++) {
+      Stomp::IndexVector brute_idx;
+      uint32_t n_same_region = 0;
+      int16_t region = kd_map.FindRegion(checkVec[i]);
+      for (uint32_t j=0;j<angVec.size();j++) {
+	if (theta.WithinCosBounds(checkVec[i].DotProduct(angVec[j]))) {
+	  brute_idx.push_back(j);
+	  if (point_region[j] == region) n_same_region++;
+	}
+      }
+      brute_bin.AddToCounter(n_same_region, region);
+      brute_bin.AddToCounter(brute_idx.size() - n_same_region);
+
+      if (tree_map.FindPairs(checkVec[i], theta) != brute_idx.size())
+	n_tree_mismatch++;
+      if (kd_map.FindPairs(checkVec[i], theta) != brute_idx.size())
+	n_kd_mismatch++;
+
+      Stomp::IndexVector kd_idx;
+      kd_map.FindPairs(checkVec[i], theta, kd_idx);
+      std::sort(kd_idx.begin(), kd_idx.end());
+      if (kd_idx != brute_idx) n_index_mismatch++;
+    }
+    std::cout << "\tBrute force: " << n_tree_mismatch << "/" <<
+      checkVec.size() << " TreeMap mismatches, " << n_kd_mismatch << "/" <<
+      checkVec.size() << " KDTreeMap mismatches, " << n_index_mismatch <<
+      "/" << checkVec.size() << " KDTreeMap index mismatches.\n";
+
+    n_mismatch = 0;
+    for (int16_t i=-1;i<n_regions;i++) {
+      if (region_bin.Counter(i) != brute_bin.Counter(i)) n_mismatch++;
+    }
+    std::cout << "\tRegions: " << n_mismatch << "/" << n_regions + 1 <<
+      " mismatched region counts.\n";
+
+    delete stomp_map;
+  }
+}
+
+void KDTreeMapNeighborTests() {
+  std::cout << "\n";
+  std::cout << "********************************\n";
+  std::cout << "*** KDTreeMap Neighbor Tests ***\n";
+  std::cout << "********************************\n";
+  // Nearest neighbor searches against the TreeMap, again at moderate survey
+  // latitude and near the survey pole.
+  double lambda[2] = {30.0, 85.0};
+  for (uint32_t k=0;k<2;k++) {
+    Stomp::AngularCoordinate ang(lambda[k], 0.0,
+				 Stomp::AngularCoordinate::Survey);
+    Stomp::Pixel tmp_pix(ang, 32);
+    Stomp::PixelVector annulus_pix;
+    tmp_pix.WithinRadius(5.0, annulus_pix);
+    Stomp::Map* stomp_map = new Stomp::Map(annulus_pix);
+    uint32_t n_points = 200000;
+    Stomp::AngularVector angVec, testVec;
+    stomp_map->GenerateRandomPoints(angVec, n_points);
+    stomp_map->GenerateRandomPoints(testVec, 5000);
+
+    Stomp::TreeMap tree_map(Stomp::HPixResolution, 50);
+    Stomp::KDTreeMap kd_map(Stomp::HPixResolution, 32);
+    for (uint32_t i=0;i<angVec.size();i++) {
+      tree_map.AddPoint(angVec[i], 1.0);
+      kd_map.AddPoint(angVec[i], 1.0);
+    }
+    kd_map.Build();
+
+    uint32_t n_neighbors = 8;
+    std::vector<double> tree_dist;
+    Stomp::StompWatch stomp_watch;
+    stomp_watch.StartTimer();
+    uint16_t nodes_visited = 0;
+    for (uint32_t i=0;i<testVec.size();i++)
+      tree_dist.push_back(tree_map.KNearestNeighborDistance(testVec[i],
+							    n_neighbors,
+							    nodes_visited));
+    stomp_watch.StopTimer();
+    double tree_time = stomp_watch.ElapsedTime();
+
+    uint32_t n_mismatch = 0;
+    stomp_watch.StartTimer();
+    for (uint32_t i=0;i<testVec.size();i++) {
+      double kd_dist = kd_map.KNearestNeighborDistance(testVec[i],
+						       n_neighbors,
+						       nodes_visited);
+      if (fabs(kd_dist - tree_dist[i]) > 1.0e-9) n_mismatch++;
+    }
+    stomp_watch.StopTimer();
+    std::cout << "\nlambda = " << lambda[k] << ": " << n_neighbors <<
+      "th neighbor distances:\n";
+    std::cout << "\tTreeMap " << tree_time << "s; KDTreeMap " <<
+      stomp_watch.ElapsedTime() << "s; " << n_mismatch << "/" <<
+      testVec.size() << " differ.\n";
+
+    // The neighbors themselves should come back most distant first.
+    Stomp::WAngularVector neighbors;
+    kd_map.FindKNearestNeighbors(testVec[0], n_neighbors, neighbors);
+    bool ordered = true;
+    for (uint32_t i=1;i<neighbors.size();i++) {
+      if (testVec[0].AngularDistance(neighbors[i]) >
+	  testVec[0].AngularDistance(neighbors[i - 1])) ordered = false;
+    }
+    std::cout << "\t" << neighbors.size() << " neighbors returned " <<
+      (ordered ? "in" : "out of") << " order.\n";
+
+    // And a brute force check of the neighbor distances for a few points.
+    n_mismatch = 0;
+    for (uint32_t i=0;i<100;i++) {
+      std::vector<double> brute_dist;
+      for (uint32_t j=0;j<angVec.size();j++) {
+	double dx = testVec[i].UnitSphereX() - angVec[j].UnitSphereX();
+	double dy = testVec[i].UnitSphereY() - angVec[j].UnitSphereY();
+	double dz = testVec[i].UnitSphereZ() - angVec[j].UnitSphereZ();
+	brute_dist.push_back(2.0*Stomp::RadToDeg*
+			     asin(0.5*sqrt(dx*dx + dy*dy + dz*dz)));
+      }
+      std::nth_element(brute_dist.begin(),
+		       brute_dist.begin() + n_neighbors - 1, brute_dist.end());
+      double kd_dist = kd_map.KNearestNeighborDistance(testVec[i],
+						       n_neighbors,
+						       nodes_visited);
+      if (fabs(kd_dist - brute_dist[n_neighbors - 1]) > 1.0e-9) n_mismatch++;
+    }
+    std::cout << "\tBrute force: " << n_mismatch << "/100 mismatches.\n";
+
+    // Matching the tree points against the tree should always find the
+    // points themselves.
+    n_mismatch = 0;
+    for (uint32_t i=0;i<1000;i++) {
+      Stomp::IndexedAngularCoordinate match_ang;
+      if (!kd_map.ClosestMatch(angVec[i], 0.001, match_ang) ||
+	  (match_ang.Index() != i)) n_mismatch++;
+    }
+    std::cout << "\tClosestMatch: " << n_mismatch << "/1000 failures.\n";
+
+    delete stomp_map;
+  }
+}
+
+// Define our command line flags here so we can use these flags later.
+DEFINE_bool(all_kdtree_map_tests, false, "Run all class unit tests.");
+DEFINE_bool(kdtree_map_pair_tests, false, "Run KDTreeMap pair tests");
+DEFINE_bool(kdtree_map_neighbor_tests, false, "Run KDTreeMap neighbor tests");
+
+void KDTreeMapUnitTests(bool run_all_tests) {
+  void KDTreeMapPairTests();
+  void KDTreeMapNeighborTests();
+
+  if (run_all_tests) FLAGS_all_kdtree_map_tests = true;
+
+  // Check the Stomp::KDTreeMap pair-finding routines against the TreeMap and
+  // brute force counts.
+  if (FLAGS_all_kdtree_map_tests || FLAGS_kdtree_map_pair_tests)
+    KDTreeMapPairTests();
+
+  // Check the Stomp::KDTreeMap nearest neighbor routines against the TreeMap
+  // and brute force searches.
+  if (FLAGS_all_kdtree_map_tests || FLAGS_kdtree_map_neighbor_tests)
+    KDTreeMapNeighborTests();
+}
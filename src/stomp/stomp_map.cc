@@ -17,9 +17,13 @@
 // However, the goal of the class is to abstract away those details, allowing
 // the user to treat Maps as a pure representative of spherical geometry.
 
+#include <algorithm>
+#include <cstring>
 #include "stomp_core.h"
 #include "stomp_map.h"
+#include "stomp_pixel_index.h"
 #include "stomp_geometry.h"
+#include "stomp_util.h"
 
 namespace Stomp {
 
@@ -44,11 +48,22 @@ SubMap::SubMap(uint32_t superpixnum) {
   z_max_ = sin(lambda_max_*DegToRad);
   initialized_ = false;
   unsorted_ = false;
+  modified_ = false;
+  hashed_ = false;
+  hash_ = 0;
 
   for (uint32_t resolution=HPixResolution;
        resolution<=MaxPixelResolution;resolution*=2) {
     pixel_count_[resolution] = 0;
   }
+
+  committed_area_ = 0.0;
+  committed_size_ = 0;
+  committed_min_level_ = MaxPixelLevel;
+  committed_max_level_ = HPixLevel;
+  committed_min_weight_ = 1.0e30;
+  committed_max_weight_ = -1.0e30;
+  committed_initialized_ = false;
 }
 
 SubMap::~SubMap() {
@@ -79,6 +94,7 @@ void SubMap::AddPixel(Pixel& pix) {
   pix_.push_back(pix);
   size_ = pix_.size();
   initialized_ = true;
+  _SetModified();
 }
 
 void SubMap::Resolve(bool force_resolve) {
@@ -86,6 +102,7 @@ void SubMap::Resolve(bool force_resolve) {
 
   if (unsorted_ || force_resolve) {
     Pixel::ResolveSuperPixel(pix_);
+    _SetModified();
 
     area_ = 0.0;
     min_level_ = MaxPixelLevel;
@@ -754,6 +771,7 @@ void SubMap::ScaleWeight(const double weight_scale) {
     iter->SetWeight(iter->Weight()*weight_scale);
   min_weight_ *= weight_scale;
   max_weight_ *= weight_scale;
+  _SetModified();
 }
 
 void SubMap::AddConstantWeight(const double add_weight) {
@@ -761,6 +779,7 @@ void SubMap::AddConstantWeight(const double add_weight) {
     iter->SetWeight(iter->Weight()+add_weight);
   min_weight_ += add_weight;
   max_weight_ += add_weight;
+  _SetModified();
 }
 
 void SubMap::InvertWeight() {
@@ -776,6 +795,7 @@ void SubMap::InvertWeight() {
     if (iter->Weight() < min_weight_) min_weight_ = iter->Weight();
     if (iter->Weight() > max_weight_) max_weight_ = iter->Weight();
   }
+  _SetModified();
 }
 
 void SubMap::Pixels(PixelVector& pix) {
@@ -795,6 +815,12 @@ void SubMap::Clear() {
   if (!pix_.empty()) pix_.clear();
   initialized_ = false;
   unsorted_ = false;
+  _SetModified();
+
+  for (uint32_t resolution=HPixResolution;
+       resolution<=MaxPixelResolution;resolution*=2) {
+    pixel_count_[resolution] = 0;
+  }
 }
 
 uint32_t SubMap::Superpixnum() {
@@ -823,6 +849,7 @@ bool SubMap::Unsorted() {
 
 void SubMap::SetUnsorted() {
   unsorted_ = true;
+  _SetModified();
 }
 
 uint32_t SubMap::MinResolution() {
@@ -881,6 +908,111 @@ uint32_t SubMap::PixelCount(uint32_t resolution) {
   return (!(resolution % 2) ? pixel_count_[resolution] : 0);
 }
 
+bool SubMap::Modified() {
+  return modified_;
+}
+
+bool SubMap::Commit(double& area, uint32_t& size, ResolutionDict& pixel_count,
+		    uint8_t& min_level, uint8_t& max_level,
+		    double& min_weight, double& max_weight) {
+  bool recalculate_limits = false;
+
+  if (committed_initialized_) {
+    area -= committed_area_;
+    size -= committed_size_;
+    for (ResolutionIterator iter=committed_pixel_count_.begin();
+	 iter!=committed_pixel_count_.end();++iter)
+      pixel_count[iter->first] -= iter->second;
+
+    // If we set one of the limits before, then we need to match it now or
+    // the limit may have moved in.
+    if ((committed_min_level_ <= min_level) &&
+	(!initialized_ || (min_level_ > committed_min_level_)))
+      recalculate_limits = true;
+    if ((committed_max_level_ >= max_level) &&
+	(!initialized_ || (max_level_ < committed_max_level_)))
+      recalculate_limits = true;
+    if ((committed_min_weight_ <= min_weight) &&
+	(!initialized_ || (min_weight_ > committed_min_weight_)))
+      recalculate_limits = true;
+    if ((committed_max_weight_ >= max_weight) &&
+	(!initialized_ || (max_weight_ < committed_max_weight_)))
+      recalculate_limits = true;
+  }
+
+  if (initialized_) {
+    area += area_;
+    size += size_;
+    for (ResolutionIterator iter=pixel_count_.begin();
+	 iter!=pixel_count_.end();++iter)
+      pixel_count[iter->first] += iter->second;
+
+    if (min_level_ < min_level) min_level = min_level_;
+    if (max_level_ > max_level) max_level = max_level_;
+    if (min_weight_ < min_weight) min_weight = min_weight_;
+    if (max_weight_ > max_weight) max_weight = max_weight_;
+  }
+
+  committed_area_ = area_;
+  committed_size_ = size_;
+  committed_min_level_ = min_level_;
+  committed_max_level_ = max_level_;
+  committed_min_weight_ = min_weight_;
+  committed_max_weight_ = max_weight_;
+  committed_pixel_count_ = pixel_count_;
+  committed_initialized_ = initialized_;
+  modified_ = false;
+
+  return recalculate_limits;
+}
+
+uint64_t SubMap::Hash() {
+  // A 64-bit FNV-1a hash over the resolution, index and weight of each pixel.
+  // Since the pixels are kept in a fixed order, two SubMaps with the same
+  // pixels will always give the same hash.  The values are fed in a byte at
+  // a time from the least significant end so the hash doesn't depend on the
+  // byte order of the machine.
+  if (!hashed_) {
+    hash_ = 14695981039346656037ULL;
+    for (PixelIterator iter=pix_.begin();iter!=pix_.end();++iter) {
+      double weight = iter->Weight();
+      uint64_t weight_bits;
+      memcpy(&weight_bits, &weight, sizeof(weight_bits));
+      _HashValue(iter->Resolution(), 4);
+      _HashValue(iter->HPixnum(), 4);
+      _HashValue(weight_bits, 8);
+    }
+    hashed_ = true;
+  }
+
+  return hash_;
+}
+
+void SubMap::_HashValue(uint64_t value, uint8_t n_bytes) {
+  for (uint8_t i=0;i<n_bytes;i++) {
+    hash_ ^= (value >> (8*i)) & 0xff;
+    hash_ *= 1099511628211ULL;
+  }
+}
+
+void SubMap::_SetModified() {
+  modified_ = true;
+  hashed_ = false;
+}
+
+void SubMap::CommitPixel(Pixel& pix) {
+  committed_area_ += pix.Area();
+  committed_size_++;
+  if (pix.Level() < committed_min_level_) committed_min_level_ = pix.Level();
+  if (pix.Level() > committed_max_level_) committed_max_level_ = pix.Level();
+  if (pix.Weight() < committed_min_weight_)
+    committed_min_weight_ = pix.Weight();
+  if (pix.Weight() > committed_max_weight_)
+    committed_max_weight_ = pix.Weight();
+  committed_pixel_count_[pix.Resolution()]++;
+  committed_initialized_ = true;
+}
+
 Map::Map() {
   area_ = 0.0;
   size_ = 0;
@@ -924,30 +1056,12 @@ Map::Map(PixelVector& pix, bool force_resolve) {
   for (PixelIterator iter=pix.begin();iter!=pix.end();++iter)
     sub_map_[iter->Superpixnum()].AddPixel(*iter);
 
-  bool found_beginning = false;
-  for (SubMapIterator iter=sub_map_.begin();iter!=sub_map_.end();++iter) {
-    if (iter->Initialized()) {
-      if (iter->Unsorted() || force_resolve) iter->Resolve(force_resolve);
-
-      if (!found_beginning) {
-	begin_ = MapIterator(iter->Superpixnum(), iter->Begin());
-	found_beginning = true;
-      }
-      end_ = MapIterator(iter->Superpixnum(), iter->End());
-
-      area_ += iter->Area();
-      size_ += iter->Size();
-      if (min_level_ > iter->MinLevel()) min_level_ = iter->MinLevel();
-      if (max_level_ < iter->MaxLevel()) max_level_ = iter->MaxLevel();
-      if (iter->MinWeight() < min_weight_) min_weight_ = iter->MinWeight();
-      if (iter->MaxWeight() > max_weight_) max_weight_ = iter->MaxWeight();
-      for (uint32_t resolution=HPixResolution;
-	   resolution<=MaxPixelResolution;resolution*=2) {
-	pixel_count_[resolution] += iter->PixelCount(resolution);
-      }
-    }
+  if (force_resolve) {
+    for (SubMapIterator iter=sub_map_.begin();iter!=sub_map_.end();++iter)
+      if (iter->Initialized()) iter->Resolve(force_resolve);
   }
 
+  Initialize();
 }
 
 Map::Map(const std::string& InputFile, bool hpixel_format, bool weighted_map) {
@@ -974,45 +1088,92 @@ Map::~Map() {
 }
 
 bool Map::Initialize() {
-  area_ = 0.0;
-  size_ = 0;
-  min_level_ = MaxPixelLevel;
-  max_level_ = HPixLevel;
-  min_weight_ = 1.0e30;
-  max_weight_ = -1.0e30;
-  ClearRegions();
-  for (uint32_t resolution=HPixResolution;
-       resolution<=MaxPixelResolution;resolution*=2) {
-    pixel_count_[resolution] = 0;
+  // Rather than recalculating the summary statistics from every SubMap, we
+  // only visit the ones that have changed since the last time through here,
+  // replacing their old contributions to the totals with the new ones.
+  std::vector<uint32_t> modified_superpixnum;
+  bool recalculate_limits = false;
+  for (uint32_t k=0;k<MaxSuperpixnum;k++) {
+    if (sub_map_[k].Modified()) {
+      if (sub_map_[k].Unsorted()) sub_map_[k].Resolve();
+      if (sub_map_[k].Commit(area_, size_, pixel_count_,
+			     min_level_, max_level_,
+			     min_weight_, max_weight_))
+	recalculate_limits = true;
+      modified_superpixnum.push_back(k);
+    }
   }
 
-  bool found_valid_superpixel = false;
-  bool found_beginning = false;
-  for (SubMapIterator iter=sub_map_.begin();iter!=sub_map_.end();++iter) {
-    if (iter->Initialized()) {
-      found_valid_superpixel = true;
-      if (iter->Unsorted()) iter->Resolve();
+  // Avoid leaving round-off in the area of an empty map.
+  if (size_ == 0) area_ = 0.0;
 
-      if (!found_beginning) {
-	begin_ = MapIterator(iter->Superpixnum(), iter->Begin());
-	found_beginning = true;
+  // The level and weight limits can only grow as we add in the changes, so
+  // if a changed SubMap used to set one of the limits, we need to recompute
+  // them.  The SubMaps keep their own limits, so this is still cheap.
+  if (recalculate_limits) {
+    min_level_ = MaxPixelLevel;
+    max_level_ = HPixLevel;
+    min_weight_ = 1.0e30;
+    max_weight_ = -1.0e30;
+    for (SubMapIterator iter=sub_map_.begin();iter!=sub_map_.end();++iter) {
+      if (iter->Initialized()) {
+	if (min_level_ > iter->MinLevel()) min_level_ = iter->MinLevel();
+	if (max_level_ < iter->MaxLevel()) max_level_ = iter->MaxLevel();
+	if (iter->MinWeight() < min_weight_) min_weight_ = iter->MinWeight();
+	if (iter->MaxWeight() > max_weight_) max_weight_ = iter->MaxWeight();
       }
-      end_ = MapIterator(iter->Superpixnum(), iter->End());
+    }
+  }
 
-      area_ += iter->Area();
-      size_ += iter->Size();
-      if (min_level_ > iter->MinLevel()) min_level_ = iter->MinLevel();
-      if (max_level_ < iter->MaxLevel()) max_level_ = iter->MaxLevel();
-      if (iter->MinWeight() < min_weight_) min_weight_ = iter->MinWeight();
-      if (iter->MaxWeight() > max_weight_) max_weight_ = iter->MaxWeight();
-      for (uint32_t resolution=HPixResolution;
-	   resolution<=MaxPixelResolution;resolution*=2) {
-	pixel_count_[resolution] += iter->PixelCount(resolution);
+  // The changed SubMaps may have moved their pixels, so we need to reset
+  // the iterator bounds.
+  bool found_valid_superpixel = false;
+  uint32_t k = 0;
+  while ((k < MaxSuperpixnum) && !sub_map_[k].Initialized()) k++;
+  if (k < MaxSuperpixnum) {
+    found_valid_superpixel = true;
+    begin_ = MapIterator(k, sub_map_[k].Begin());
+    k = MaxSuperpixnum - 1;
+    while (!sub_map_[k].Initialized()) k--;
+    end_ = MapIterator(k, sub_map_[k].End());
+  } else {
+    begin_ = MapIterator(0, sub_map_[0].Begin());
+    end_ = begin_;
+  }
+
+  if (RegionsInitialized() && !modified_superpixnum.empty())
+    _UpdateRegions(modified_superpixnum);
+
+  return found_valid_superpixel;
+}
+
+void Map::_UpdateRegions(std::vector<uint32_t>& superpixnum) {
+  // The regions are defined on the pixels at the region resolution that the
+  // Map covers, so they're still good as long as none of the changed
+  // superpixels gained or lost any of those pixels.
+  uint32_t region_resolution = RegionResolution();
+  std::vector<int16_t> regions;
+  for (uint32_t i=0;i<superpixnum.size();i++) {
+    uint32_t k = superpixnum[i];
+    Pixel super_pix(HPixResolution, k, 1.0);
+    PixelVector region_pix;
+    super_pix.SubPix(region_resolution, region_pix);
+    for (PixelIterator iter=region_pix.begin();
+	 iter!=region_pix.end();++iter) {
+      int16_t region = Region(iter->Pixnum());
+      bool covered = (sub_map_[k].Initialized() &&
+		      (sub_map_[k].FindUnmaskedStatus(*iter) != 0));
+      if (covered != (region != -1)) {
+	ClearRegions();
+	return;
       }
+      if (region != -1) regions.push_back(region);
     }
   }
 
-  return found_valid_superpixel;
+  sort(regions.begin(), regions.end());
+  regions.erase(unique(regions.begin(), regions.end()), regions.end());
+  UpdateRegionArea(regions);
 }
 
 bool Map::Initialize(PixelVector& pix, bool force_resolve) {
@@ -1047,38 +1208,17 @@ bool Map::Initialize(PixelVector& pix, bool force_resolve) {
     sub_map_[k].AddPixel(*iter);
   }
 
-  bool found_valid_superpixel = false;
-  bool found_beginning = false;
-  for (SubMapIterator iter=sub_map_.begin();iter!=sub_map_.end();++iter) {
-    if (iter->Initialized()) {
-      if (iter->Unsorted() || force_resolve) iter->Resolve(force_resolve);
-
-      found_valid_superpixel = true;
-
-      if (!found_beginning) {
-	begin_ = MapIterator(iter->Superpixnum(), iter->Begin());
-	found_beginning = true;
-      }
-      end_ = MapIterator(iter->Superpixnum(), iter->End());
-
-      area_ += iter->Area();
-      size_ += iter->Size();
-      if (min_level_ > iter->MinLevel()) min_level_ = iter->MinLevel();
-      if (max_level_ < iter->MaxLevel()) max_level_ = iter->MaxLevel();
-      if (iter->MinWeight() < min_weight_) min_weight_ = iter->MinWeight();
-      if (iter->MaxWeight() > max_weight_) max_weight_ = iter->MaxWeight();
-      for (uint32_t resolution=HPixResolution;
-	   resolution<=MaxPixelResolution;resolution*=2) {
-	pixel_count_[resolution] += iter->PixelCount(resolution);
-      }
-    }
+  if (force_resolve) {
+    for (SubMapIterator iter=sub_map_.begin();iter!=sub_map_.end();++iter)
+      if (iter->Initialized()) iter->Resolve(force_resolve);
   }
 
-  return found_valid_superpixel;
+  return Initialize();
 }
 
 void Map::AddPixel(Pixel& pix) {
   sub_map_[pix.Superpixnum()].AddPixel(pix);
+  sub_map_[pix.Superpixnum()].CommitPixel(pix);
 
   area_ += pix.Area();
   size_++;
@@ -1090,6 +1230,223 @@ void Map::AddPixel(Pixel& pix) {
   pixel_count_[pix.Resolution()]++;
 }
 
+bool Map::FromPoints(AngularVector& ang, uint32_t resolution,
+		     PointWeighting weighting) {
+  if ((resolution < HPixResolution) ||
+      ((resolution & (resolution - 1)) != 0) ||
+      (resolution > MaxPixelResolution)) {
+    std::cout << "Stomp::Map::FromPoints - Invalid resolution value: " <<
+      resolution << "\n";
+    return false;
+  }
+
+  // Pixelizing the points is independent for each point, so this is the
+  // first place where we can split the work up.
+  int32_t n_points = static_cast<int32_t>(ang.size());
+  std::vector<uint32_t> superpixnum(ang.size()), hpixnum(ang.size());
+  std::vector<double> weight;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int32_t i=0;i<n_points;i++) {
+    Pixel tmp_pix(ang[i], resolution, 1.0);
+    superpixnum[i] = tmp_pix.Superpixnum();
+    hpixnum[i] = tmp_pix.HPixnum();
+  }
+
+  if (weighting == PointWeight) weighting = PointCount;
+
+  return _FromPixelIndices(superpixnum, hpixnum, weight, resolution,
+			   weighting);
+}
+
+bool Map::FromPoints(WAngularVector& w_ang, uint32_t resolution,
+		     PointWeighting weighting) {
+  if ((resolution < HPixResolution) ||
+      ((resolution & (resolution - 1)) != 0) ||
+      (resolution > MaxPixelResolution)) {
+    std::cout << "Stomp::Map::FromPoints - Invalid resolution value: " <<
+      resolution << "\n";
+    return false;
+  }
+
+  int32_t n_points = static_cast<int32_t>(w_ang.size());
+  std::vector<uint32_t> superpixnum(w_ang.size()), hpixnum(w_ang.size());
+  std::vector<double> weight;
+  if (weighting == PointWeight) weight.resize(w_ang.size());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int32_t i=0;i<n_points;i++) {
+    Pixel tmp_pix(w_ang[i], resolution, 1.0);
+    superpixnum[i] = tmp_pix.Superpixnum();
+    hpixnum[i] = tmp_pix.HPixnum();
+    if (weighting == PointWeight) weight[i] = w_ang[i].Weight();
+  }
+
+  return _FromPixelIndices(superpixnum, hpixnum, weight, resolution,
+			   weighting);
+}
+
+bool Map::_FromPixelIndices(std::vector<uint32_t>& superpixnum,
+			    std::vector<uint32_t>& hpixnum,
+			    std::vector<double>& weight, uint32_t resolution,
+			    PointWeighting weighting) {
+  // First, we bucket the points by superpixel.  Each bucket holds the
+  // hpixnum for each point and, if we need them, the point weights.
+  std::vector<uint32_t> bucket_size(MaxSuperpixnum, 0);
+  for (uint32_t i=0;i<superpixnum.size();i++) bucket_size[superpixnum[i]]++;
+
+  std::vector<std::vector<uint32_t> > bucket_hpixnum(MaxSuperpixnum);
+  std::vector<std::vector<double> > bucket_weight(MaxSuperpixnum);
+  std::vector<uint32_t> occupied_superpixnum;
+  for (uint32_t k=0;k<MaxSuperpixnum;k++) {
+    if (bucket_size[k] > 0) {
+      bucket_hpixnum[k].reserve(bucket_size[k]);
+      if (weighting == PointWeight) bucket_weight[k].reserve(bucket_size[k]);
+      occupied_superpixnum.push_back(k);
+    }
+  }
+
+  for (uint32_t i=0;i<superpixnum.size();i++) {
+    bucket_hpixnum[superpixnum[i]].push_back(hpixnum[i]);
+    if (weighting == PointWeight)
+      bucket_weight[superpixnum[i]].push_back(weight[i]);
+  }
+
+  // Now each superpixel can be handled independently.  For each, we sort
+  // the hpixnums (carrying the weights along if necessary), collapse the
+  // duplicates and then work our way up in resolution, replacing any
+  // complete cohort of equal-weight pixels with its parent.  Pixels that
+  // can't be combined at a given level are final, so the output for each
+  // superpixel comes out in the same order (resolution, then hpixnum) that
+  // SubMap uses to store its pixels.
+  std::vector<PixelVector> superpix_pix(occupied_superpixnum.size());
+  int32_t n_superpix = static_cast<int32_t>(occupied_superpixnum.size());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int32_t n=0;n<n_superpix;n++) {
+    uint32_t k = occupied_superpixnum[n];
+    std::vector<uint32_t>& bucket = bucket_hpixnum[k];
+
+    std::vector<std::pair<uint32_t, double> > level_pix;
+    if (weighting == PointWeight) {
+      std::vector<std::pair<uint32_t, double> > sorted_pix;
+      sorted_pix.reserve(bucket.size());
+      for (uint32_t i=0;i<bucket.size();i++)
+	sorted_pix.push_back(std::make_pair(bucket[i], bucket_weight[k][i]));
+      std::sort(sorted_pix.begin(), sorted_pix.end());
+      for (uint32_t i=0;i<sorted_pix.size();i++) {
+	if (level_pix.empty() || (level_pix.back().first != sorted_pix[i].first)) {
+	  level_pix.push_back(sorted_pix[i]);
+	} else {
+	  level_pix.back().second += sorted_pix[i].second;
+	}
+      }
+    } else {
+      std::sort(bucket.begin(), bucket.end());
+      for (uint32_t i=0;i<bucket.size();i++) {
+	if (level_pix.empty() || (level_pix.back().first != bucket[i])) {
+	  level_pix.push_back(std::make_pair(bucket[i], 1.0));
+	} else {
+	  if (weighting == PointCount) level_pix.back().second += 1.0;
+	}
+      }
+    }
+    bucket.clear();
+    if (weighting == PointWeight) bucket_weight[k].clear();
+
+    // The final pixels for each resolution, indexed from the input resolution
+    // down to HPixResolution.
+    std::vector<PixelVector> final_pix;
+    uint32_t level_resolution = resolution;
+    while (!level_pix.empty()) {
+      PixelVector level_final;
+      std::vector<std::pair<uint32_t, double> > parent_pix;
+
+      uint32_t hnx = level_resolution/HPixResolution;
+      if (level_resolution > HPixResolution) {
+	// Sorting the children by their parent index puts each cohort next to
+	// each other.
+	std::vector<std::pair<uint32_t, uint32_t> > parent_order;
+	parent_order.reserve(level_pix.size());
+	for (uint32_t i=0;i<level_pix.size();i++) {
+	  uint32_t y = level_pix[i].first/hnx;
+	  uint32_t x = level_pix[i].first - y*hnx;
+	  parent_order.push_back(std::make_pair((y/2)*(hnx/2) + x/2, i));
+	}
+	std::sort(parent_order.begin(), parent_order.end());
+
+	std::vector<bool> merged(level_pix.size(), false);
+	for (uint32_t i=0;i+3<parent_order.size();) {
+	  if (parent_order[i+3].first == parent_order[i].first) {
+	    double cohort_weight = level_pix[parent_order[i].second].second;
+	    bool weight_match = true;
+	    for (uint32_t j=1;j<4;j++) {
+	      double child_weight = level_pix[parent_order[i+j].second].second;
+	      if ((child_weight >= cohort_weight + 0.000001) ||
+		  (child_weight <= cohort_weight - 0.000001))
+		weight_match = false;
+	    }
+	    if (weight_match) {
+	      for (uint32_t j=0;j<4;j++) merged[parent_order[i+j].second] = true;
+	      parent_pix.push_back(std::make_pair(parent_order[i].first,
+						  cohort_weight));
+	    }
+	    i += 4;
+	  } else {
+	    i++;
+	  }
+	}
+
+	for (uint32_t i=0;i<level_pix.size();i++) {
+	  if (!merged[i]) {
+	    uint32_t pixnum;
+	    Pixel::HPix2Pix(level_resolution, level_pix[i].first, k, pixnum);
+	    level_final.push_back(Pixel(level_resolution, pixnum,
+					level_pix[i].second));
+	  }
+	}
+      } else {
+	for (uint32_t i=0;i<level_pix.size();i++) {
+	  uint32_t pixnum;
+	  Pixel::HPix2Pix(level_resolution, level_pix[i].first, k, pixnum);
+	  level_final.push_back(Pixel(level_resolution, pixnum,
+				      level_pix[i].second));
+	}
+      }
+
+      final_pix.push_back(level_final);
+      level_pix.swap(parent_pix);
+      level_resolution /= 2;
+    }
+
+    // The parents were generated in sorted order, but we need the lowest
+    // resolution pixels first.
+    for (std::vector<PixelVector>::reverse_iterator iter=final_pix.rbegin();
+	 iter!=final_pix.rend();++iter) {
+      for (PixelIterator pix_iter=iter->begin();
+	   pix_iter!=iter->end();++pix_iter)
+	superpix_pix[n].push_back(*pix_iter);
+    }
+  }
+
+  PixelVector pix;
+  uint32_t n_pix = 0;
+  for (uint32_t n=0;n<superpix_pix.size();n++) n_pix += superpix_pix[n].size();
+  pix.reserve(n_pix);
+  for (uint32_t n=0;n<superpix_pix.size();n++) {
+    for (PixelIterator iter=superpix_pix[n].begin();
+	 iter!=superpix_pix[n].end();++iter) pix.push_back(*iter);
+    superpix_pix[n].clear();
+  }
+
+  // Since the pixels are already resolved and in order, there's no need to
+  // force another pass through Resolve.
+  return Initialize(pix, false);
+}
+
 bool Map::FindLocation(AngularCoordinate& ang, double& weight) {
   bool keep = false;
 
@@ -1174,19 +1531,8 @@ void Map::FindUnmaskedFraction(PixelVector& pix) {
 }
 
 double Map::FindUnmaskedFraction(Map& stomp_map) {
-  double total_unmasked_area = 0.0;
-  for (MapIterator iter=stomp_map.Begin();
-       iter!=stomp_map.End();stomp_map.Iterate(&iter)) {
-    double pixel_unmasked_fraction = 0.0;
-    uint32_t k = iter.second->Superpixnum();
-
-    if (sub_map_[k].Initialized())
-      pixel_unmasked_fraction =
-	sub_map_[k].FindUnmaskedFraction(*(iter.second));
-    total_unmasked_area += pixel_unmasked_fraction*iter.second->Area();
-  }
-
-  return total_unmasked_area/stomp_map.Area();
+  return (stomp_map.Area() > 0.0 ?
+	  OverlapArea(stomp_map)/stomp_map.Area() : 0.0);
 }
 
 int8_t Map::FindUnmaskedStatus(Pixel& pix) {
@@ -1218,48 +1564,24 @@ void Map::FindUnmaskedStatus(PixelVector& pix,
 }
 
 int8_t Map::FindUnmaskedStatus(Map& stomp_map) {
-  // Get the status for the first pixel in the map to seed our initial status.
-  MapIterator iter=stomp_map.Begin();
-  int8_t map_unmasked_status = 0;
-  uint32_t k = iter.second->Superpixnum();
-
-  if (sub_map_[k].Initialized())
-    map_unmasked_status = sub_map_[k].FindUnmaskedStatus(*(iter.second));
-
-  stomp_map.Iterate(&iter);
-
-  // Now iterate over the rest of the map to figure out the global status.
-  for (;iter!=stomp_map.End();stomp_map.Iterate(&iter)) {
-    int8_t unmasked_status = 0;
-    k = iter.second->Superpixnum();
-
-    if (sub_map_[k].Initialized())
-      unmasked_status = sub_map_[k].FindUnmaskedStatus(*(iter.second));
-
-    if (map_unmasked_status == 1) {
-      // If we currently thought that the input Map was completely inside of our
-      // Map, but find that this Pixel is either outside the Map or only
-      // partially inside the Map, then we switch the global status to partial.
-      if (unmasked_status == 0 || unmasked_status == -1)
-	map_unmasked_status = -1;
-    }
-
-    if (map_unmasked_status == 0) {
-      // If we currently thought that the input Map was completely outside the
-      // Map, but find that this Pixel is either fully or partially contained
-      // in the Map, then we switch the global status to partial.
-      if (unmasked_status == 1 || unmasked_status == -1)
-	map_unmasked_status = -1;
-    }
-
-    if (map_unmasked_status == -1) {
-      // If we find that the input Map's unmasked status is partial, then no
-      // further testing will change that status.  At this point, we can break
-      // our loop and return the global status.
-      break;
-    }
+  // The input Map is fully inside our Map if the overlap covers all of it
+  // and fully outside if there's no overlap at all.  Anything else is a
+  // partial overlap.
+  std::vector<uint64_t> n_overlap, n_input;
+  std::vector<double> weighted_overlap;
+  _FindOverlap(stomp_map, n_overlap, n_input, weighted_overlap);
+
+  uint64_t n_total_overlap = 0, n_total_input = 0;
+  for (uint32_t k=0;k<MaxSuperpixnum;k++) {
+    n_total_overlap += n_overlap[k];
+    n_total_input += n_input[k];
   }
 
+  int8_t map_unmasked_status = -1;
+  if (n_total_overlap == 0) map_unmasked_status = 0;
+  if ((n_total_input > 0) && (n_total_overlap == n_total_input))
+    map_unmasked_status = 1;
+
   return map_unmasked_status;
 }
 
@@ -1351,6 +1673,176 @@ void Map::FindMatchingPixels(PixelVector& pix, PixelVector& match_pix,
   }
 }
 
+// Fill range with the first of the MaxPixelResolution pixels covered by each
+// pixel in the SubMap, paired with the position of that pixel in the SubMap,
+// in order.  The pixels are numbered within the superpixel in the same
+// nested order as the PixelIndex keys, so each pixel covers a contiguous
+// block of them; since the pixels in a SubMap don't overlap, neither do the
+// blocks.  The return value is the total number of MaxPixelResolution pixels
+// covered.
+static uint64_t SubMapRanges(SubMap& sub_map,
+			     std::vector<std::pair<uint32_t, uint32_t> >& range) {
+  range.clear();
+  range.reserve(sub_map.Size());
+
+  uint64_t n_covered = 0;
+  uint32_t idx = 0;
+  for (PixelIterator iter=sub_map.Begin();iter!=sub_map.End();++iter,idx++) {
+    uint8_t local_bits = 2*(iter->Level() - HPixLevel);
+    uint8_t shift = 2*(MaxPixelLevel - iter->Level());
+    uint64_t local_key =
+      PixelIndex::PixelKey(*iter) & ((static_cast<uint64_t>(1) << local_bits) - 1);
+    range.push_back(std::make_pair(static_cast<uint32_t>(local_key << shift),
+				   idx));
+    n_covered += static_cast<uint64_t>(1) << shift;
+  }
+  std::sort(range.begin(), range.end());
+
+  return n_covered;
+}
+
+// Step through the sorted blocks from two SubMaps for the same superpixel
+// together, adding up the overlap between them and the integral of the
+// product of the weights over the overlap.
+static void SweepRanges(SubMap& sub_map_a,
+			std::vector<std::pair<uint32_t, uint32_t> >& range_a,
+			SubMap& sub_map_b,
+			std::vector<std::pair<uint32_t, uint32_t> >& range_b,
+			uint64_t& n_overlap, double& weighted_overlap) {
+  n_overlap = 0;
+  weighted_overlap = 0.0;
+
+  PixelIterator begin_a = sub_map_a.Begin();
+  PixelIterator begin_b = sub_map_b.Begin();
+  uint32_t i = 0, j = 0;
+  while ((i < range_a.size()) && (j < range_b.size())) {
+    PixelIterator pix_a = begin_a + range_a[i].second;
+    PixelIterator pix_b = begin_b + range_b[j].second;
+    uint64_t start_a = range_a[i].first;
+    uint64_t end_a = start_a +
+      (static_cast<uint64_t>(1) << 2*(MaxPixelLevel - pix_a->Level()));
+    uint64_t start_b = range_b[j].first;
+    uint64_t end_b = start_b +
+      (static_cast<uint64_t>(1) << 2*(MaxPixelLevel - pix_b->Level()));
+
+    uint64_t overlap_start = (start_a > start_b ? start_a : start_b);
+    uint64_t overlap_end = (end_a < end_b ? end_a : end_b);
+    if (overlap_start < overlap_end) {
+      n_overlap += overlap_end - overlap_start;
+      weighted_overlap += pix_a->Weight()*pix_b->Weight()*
+	static_cast<double>(overlap_end - overlap_start);
+    }
+
+    if (end_a <= end_b) i++;
+    if (end_b <= end_a) j++;
+  }
+}
+
+void Map::_FindOverlap(Map& stomp_map, std::vector<uint64_t>& n_overlap,
+		       std::vector<uint64_t>& n_input,
+		       std::vector<double>& weighted_overlap) {
+  n_overlap.assign(MaxSuperpixnum, 0);
+  n_input.assign(MaxSuperpixnum, 0);
+  weighted_overlap.assign(MaxSuperpixnum, 0.0);
+
+  // Each superpixel is independent and the only memory we need is a pair of
+  // scratch vectors for each thread, re-used from one superpixel to the
+  // next.
+  int32_t n_superpix = static_cast<int32_t>(MaxSuperpixnum);
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+  {
+    std::vector<std::pair<uint32_t, uint32_t> > range, input_range;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16)
+#endif
+    for (int32_t k=0;k<n_superpix;k++) {
+      if (!stomp_map.sub_map_[k].Initialized()) continue;
+
+      n_input[k] = SubMapRanges(stomp_map.sub_map_[k], input_range);
+      if (sub_map_[k].Initialized()) {
+	SubMapRanges(sub_map_[k], range);
+	SweepRanges(sub_map_[k], range, stomp_map.sub_map_[k], input_range,
+		    n_overlap[k], weighted_overlap[k]);
+      }
+    }
+  }
+}
+
+bool Map::_HasOverlap(Map& stomp_map) {
+  // Most of the superpixels in a pair of Maps are usually empty in at least
+  // one of them, so we only need to sweep the ones they both occupy and can
+  // stop at the first one with any overlap.
+  std::vector<std::pair<uint32_t, uint32_t> > range, input_range;
+  for (uint32_t k=0;k<MaxSuperpixnum;k++) {
+    if (!sub_map_[k].Initialized() || !stomp_map.sub_map_[k].Initialized())
+      continue;
+
+    uint64_t n_overlap = 0;
+    double weighted_overlap = 0.0;
+    SubMapRanges(sub_map_[k], range);
+    SubMapRanges(stomp_map.sub_map_[k], input_range);
+    SweepRanges(sub_map_[k], range, stomp_map.sub_map_[k], input_range,
+		n_overlap, weighted_overlap);
+    if (n_overlap > 0) return true;
+  }
+
+  return false;
+}
+
+double Map::OverlapArea(Map& stomp_map) {
+  std::vector<uint64_t> n_overlap, n_input;
+  std::vector<double> weighted_overlap;
+  _FindOverlap(stomp_map, n_overlap, n_input, weighted_overlap);
+
+  uint64_t n_total = 0;
+  for (uint32_t k=0;k<MaxSuperpixnum;k++) n_total += n_overlap[k];
+
+  return static_cast<double>(n_total)*
+    Pixel::PixelArea(MaxPixelResolution);
+}
+
+double Map::WeightedOverlapArea(Map& stomp_map) {
+  std::vector<uint64_t> n_overlap, n_input;
+  std::vector<double> weighted_overlap;
+  _FindOverlap(stomp_map, n_overlap, n_input, weighted_overlap);
+
+  double total_weighted_overlap = 0.0;
+  for (uint32_t k=0;k<MaxSuperpixnum;k++)
+    total_weighted_overlap += weighted_overlap[k];
+
+  return total_weighted_overlap*Pixel::PixelArea(MaxPixelResolution);
+}
+
+double Map::JaccardIndex(Map& stomp_map) {
+  double overlap_area = OverlapArea(stomp_map);
+  double union_area = Area() + stomp_map.Area() - overlap_area;
+
+  return (union_area > 0.0 ? overlap_area/union_area : 0.0);
+}
+
+void Map::OverlapTable(Map& stomp_map, std::vector<uint32_t>& superpixnum,
+		       std::vector<double>& overlap_area,
+		       std::vector<double>& weighted_overlap_area) {
+  superpixnum.clear();
+  overlap_area.clear();
+  weighted_overlap_area.clear();
+
+  std::vector<uint64_t> n_overlap, n_input;
+  std::vector<double> weighted_overlap;
+  _FindOverlap(stomp_map, n_overlap, n_input, weighted_overlap);
+
+  double unit_area = Pixel::PixelArea(MaxPixelResolution);
+  for (uint32_t k=0;k<MaxSuperpixnum;k++) {
+    if (n_overlap[k] > 0) {
+      superpixnum.push_back(k);
+      overlap_area.push_back(static_cast<double>(n_overlap[k])*unit_area);
+      weighted_overlap_area.push_back(weighted_overlap[k]*unit_area);
+    }
+  }
+}
+
 void Map::Coverage(PixelVector& superpix, uint32_t resolution,
 		   bool calculate_fraction) {
   if (!superpix.empty()) superpix.clear();
@@ -1401,6 +1893,88 @@ void Map::Coverage(PixelVector& superpix, uint32_t resolution,
   }
 }
 
+// A node in the quadtree used by Map::Covering.  The leaves are the pixels in
+// the map and the internal nodes are all of their ancestors, up to the
+// superpixel.  Areas are measured in MaxPixelResolution pixels, so the
+// difference between a node's area and the area of the map inside it is
+// exact.
+struct CoverNode {
+  uint64_t key, area, covered_area;
+  double weighted_area;
+  uint32_t parent, n_pixel;
+  uint8_t level;
+  bool leaf;
+};
+
+// Add the nodes for the pixels in a SubMap and all of their ancestors.  We
+// work from the finest level of the SubMap up to the superpixel.  At each
+// level, the parents of the nodes one level down are runs of consecutive keys
+// (since the keys are in nested order), so they can be built with one pass
+// over the child nodes and then merged with the pixels at that level.
+static void AddCoverNodes(SubMap& sub_map, std::vector<CoverNode>& node) {
+  std::vector<std::vector<std::pair<uint64_t, double> > >
+    level_pix(MaxPixelLevel + 1);
+  uint8_t max_level = HPixLevel;
+  for (PixelIterator iter=sub_map.Begin();iter!=sub_map.End();++iter) {
+    level_pix[iter->Level()].push_back(
+      std::make_pair(PixelIndex::PixelKey(*iter), iter->Weight()));
+    if (iter->Level() > max_level) max_level = iter->Level();
+  }
+
+  std::vector<uint32_t> child_idx, parent_idx, level_idx;
+  for (int level=max_level;level>=HPixLevel;level--) {
+    uint64_t area = static_cast<uint64_t>(1) << 2*(MaxPixelLevel - level);
+
+    parent_idx.clear();
+    for (uint32_t i=0;i<child_idx.size();i++) {
+      CoverNode& child = node[child_idx[i]];
+      uint64_t key = child.key >> 2;
+      if (parent_idx.empty() || (node[parent_idx.back()].key != key)) {
+	CoverNode parent;
+	parent.key = key;
+	parent.area = area;
+	parent.covered_area = 0;
+	parent.weighted_area = 0.0;
+	parent.parent = node.size();
+	parent.n_pixel = 0;
+	parent.level = level;
+	parent.leaf = false;
+	parent_idx.push_back(node.size());
+	node.push_back(parent);
+      }
+      CoverNode& parent = node[parent_idx.back()];
+      node[child_idx[i]].parent = parent_idx.back();
+      parent.covered_area += node[child_idx[i]].covered_area;
+      parent.weighted_area += node[child_idx[i]].weighted_area;
+      parent.n_pixel += node[child_idx[i]].n_pixel;
+    }
+
+    std::vector<std::pair<uint64_t, double> >& pix = level_pix[level];
+    sort(pix.begin(), pix.end());
+    level_idx.clear();
+    level_idx.reserve(parent_idx.size() + pix.size());
+    uint32_t j = 0;
+    for (uint32_t i=0;i<pix.size();i++) {
+      while ((j < parent_idx.size()) && (node[parent_idx[j]].key < pix[i].first))
+	level_idx.push_back(parent_idx[j++]);
+      CoverNode leaf;
+      leaf.key = pix[i].first;
+      leaf.area = area;
+      leaf.covered_area = area;
+      leaf.weighted_area = pix[i].second*area;
+      leaf.parent = node.size();
+      leaf.n_pixel = 1;
+      leaf.level = level;
+      leaf.leaf = true;
+      level_idx.push_back(node.size());
+      node.push_back(leaf);
+    }
+    while (j < parent_idx.size()) level_idx.push_back(parent_idx[j++]);
+
+    child_idx.swap(level_idx);
+  }
+}
+
 bool Map::Covering(Map& stomp_map, uint32_t maximum_pixels) {
   if (!stomp_map.Empty()) stomp_map.Clear();
 
@@ -1431,55 +2005,68 @@ bool Map::Covering(Map& stomp_map, uint32_t maximum_pixels) {
       Pixels(pix);
       stomp_map.Initialize(pix);
     } else {
-      // Ok, in this case, we have to do actual work.  As a rough rule of
-      // thumb, we should expect that the number of pixels in any given
-      // resolution level would double if we were to combine all of the pixels
-      // at finer resolution into the current level.  So, we proceed from
-      // coarse to fine until adding twice a given level would take us over
-      // the maximum_pixels limit.  Then we re-sample all of the pixels below
-      // that level and check that against our limit, iterating again at a
-      // coarser resolution limit if necessary.  This should minimize
-      // the number of times that we need to re-create the pixel map.
-      uint32_t maximum_resolution = HPixResolution;
-      uint32_t reduced_map_pixels = pixel_count_[maximum_resolution];
-
-      while (reduced_map_pixels + 2*pixel_count_[2*maximum_resolution] <
-	     maximum_pixels &&
-	     maximum_resolution < MaxPixelResolution/2 ) {
-	reduced_map_pixels += pixel_count_[maximum_resolution];
-	maximum_resolution *= 2;
+      // Ok, in this case, we have to do actual work.  We build the quadtree
+      // of the map's pixels and their ancestors in one pass.  Replacing the
+      // pixels under an internal node with the node itself adds the
+      // uncovered part of the node to the map, so that's the cost of the
+      // merge.  That cost only depends on the node, and a node's cost is at
+      // least that of any node below it, so sorting the internal nodes by
+      // cost once gives us a global queue where every node comes after its
+      // descendants (ties go to the finer node).  We merge nodes in that
+      // order until we're within the pixel limit, updating the pixel counts
+      // up the tree after each merge (at most a dozen steps).  A node whose
+      // descendants have already been merged down to a single pixel has
+      // nothing left to gain and is skipped.
+      std::vector<CoverNode> node;
+      node.reserve(2*Size());
+      for (uint32_t k=0;k<MaxSuperpixnum;k++)
+	if (sub_map_[k].Initialized()) AddCoverNodes(sub_map_[k], node);
+
+      std::vector<std::pair<std::pair<uint64_t, int>, uint32_t> > queue;
+      for (uint32_t i=0;i<node.size();i++) {
+	if (node[i].n_pixel > 1)
+	  queue.push_back(std::make_pair(
+	    std::make_pair(node[i].area - node[i].covered_area,
+			   -static_cast<int>(node[i].level)), i));
       }
-
-      reduced_map_pixels = maximum_pixels + 1;
-      while ((reduced_map_pixels > maximum_pixels) &&
-	     (maximum_resolution >= HPixResolution)) {
-	pix.clear();
-	pix.reserve(Size());
-	Pixels(pix);
-
-	for (PixelIterator iter=pix.begin();iter!=pix.end();++iter) {
-	  if (iter->Resolution() > maximum_resolution) {
-	    iter->SuperPix(maximum_resolution);
-	  }
+      sort(queue.begin(), queue.end());
+
+      std::vector<bool> merged(node.size(), false);
+      uint32_t n_pixel = Size();
+      for (uint32_t n=0;(n<queue.size())&&(n_pixel>maximum_pixels);n++) {
+	uint32_t i = queue[n].second;
+	if (node[i].n_pixel < 2) continue;
+
+	uint32_t n_removed = node[i].n_pixel - 1;
+	merged[i] = true;
+	n_pixel -= n_removed;
+	for (uint32_t j=i;;j=node[j].parent) {
+	  node[j].n_pixel -= n_removed;
+	  if (node[j].parent == j) break;
 	}
+      }
 
-	// Resolve the array of pixels ignoring their current weight values.
-	// The consequence of this is that we may end up under-sampling any
-	// scalar field that's been encoded onto the current map and that we
-	// won't be producing a map that contains the most resolution possible
-	// given the pixel limit.  However, given the usage, these are probably
-	// not show-stoppers.
-	Pixel::ResolvePixel(pix, true);
-
-	reduced_map_pixels = pix.size();
-
-	if (reduced_map_pixels < maximum_pixels) {
-	  FindAverageWeight(pix);
-	  stomp_map.Initialize(pix);
-	} else {
-	  maximum_resolution /= 2;
+      // The nodes were added bottom-up, so walking through them backwards
+      // reaches each node after its parent.  The output pixels are the merged
+      // nodes and the leaves that aren't below a merged node.
+      std::vector<bool> hidden(node.size(), false);
+      pix.clear();
+      pix.reserve(n_pixel);
+      for (uint32_t i=node.size();i>0;i--) {
+	CoverNode& current = node[i-1];
+	if (current.parent != i-1)
+	  hidden[i-1] = hidden[current.parent] || merged[current.parent];
+	if (!hidden[i-1] && (merged[i-1] || current.leaf)) {
+	  Pixel tmp_pix;
+	  PixelIndex::KeyToPixel(current.key,
+				 Pixel::LevelToResolution(current.level),
+				 tmp_pix);
+	  tmp_pix.SetWeight(current.weighted_area/current.covered_area);
+	  pix.push_back(tmp_pix);
 	}
       }
+
+      stomp_map.Initialize(pix);
     }
   }
 
@@ -1579,6 +2166,59 @@ bool Map::RegionExcludedMap(int16_t region_index, Map& stomp_map) {
   return map_generation_success;
 }
 
+bool Map::SplitByRegion(MapVector& region_maps, bool exclude_region) {
+  region_maps.clear();
+
+  if (NRegion() == 0) {
+    std::cout << "Stomp::Map::SplitByRegion - " <<
+      "Map has not been regionated.\n";
+    return false;
+  }
+
+  int16_t n_region = static_cast<int16_t>(NRegion());
+  uint32_t region_resolution = RegionResolution();
+
+  // Sort the pixels into their regions.  Pixels at or above the region
+  // resolution are entirely within a single region, but coarser pixels need
+  // to be broken up first.
+  std::vector<PixelVector> region_pix(n_region);
+  bool split_pixels = false;
+  PixelVector pix;
+  for (MapIterator iter=Begin();iter!=End();Iterate(&iter)) {
+    if (iter.second->Resolution() < region_resolution) {
+      iter.second->SubPix(region_resolution, pix);
+      split_pixels = true;
+    } else {
+      pix.assign(1, *(iter.second));
+    }
+
+    // Pixels outside the regionation aren't in any of the regions, so they
+    // belong in every one of the excluded Maps and none of the region Maps.
+    for (PixelIterator pix_iter=pix.begin();pix_iter!=pix.end();++pix_iter) {
+      int16_t region = Region(pix_iter->SuperPix(region_resolution));
+      if (exclude_region) {
+	for (int16_t k=0;k<n_region;k++)
+	  if (k != region) region_pix[k].push_back(*pix_iter);
+      } else if (region != -1) {
+	region_pix[region].push_back(*pix_iter);
+      }
+    }
+  }
+
+  // Now the region Maps can be built independently.  If we had to break up
+  // any pixels, we need to resolve the results to put them back together.
+  region_maps.resize(n_region);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int16_t k=0;k<n_region;k++) {
+    region_maps[k].Initialize(region_pix[k], split_pixels);
+    PixelVector().swap(region_pix[k]);
+  }
+
+  return true;
+}
+
 void Map::GenerateRandomPoints(AngularVector& ang, uint32_t n_point,
 			       bool use_weighted_sampling, uint32_t seed) {
   if (!ang.empty()) ang.clear();
@@ -2322,12 +2962,12 @@ double Map::FindUnmaskedFraction(GeometricBound& bound, double area_resolution,
     n_rand = 20;
   }
 
-  AngularCoordinate tmp_ang;
+  AngularVector rand_ang;
+  bound.GenerateRandomPoints(rand_ang, n_rand);
+
   uint32_t n_inside = 0;
-  for (uint32_t i=0;i<n_rand;i++) {
-    bound.GenerateRandomPoint(tmp_ang);
-    if (Contains(tmp_ang)) n_inside++;
-  }
+  for (AngularIterator iter=rand_ang.begin();iter!=rand_ang.end();++iter)
+    if (Contains(*iter)) n_inside++;
 
   return static_cast<double>(n_inside)/static_cast<double>(n_rand);
 }
@@ -2421,31 +3061,7 @@ bool Map::Read(const std::string& InputFile, bool hpixel_format,
 
     input_file.close();
 
-    bool found_beginning = false;
-    for (SubMapIterator iter=sub_map_.begin();iter!=sub_map_.end();++iter) {
-      if (iter->Initialized()) {
-	if (iter->Unsorted()) iter->Resolve();
-
-	if (!found_beginning) {
-	  begin_ = MapIterator(iter->Superpixnum(), iter->Begin());
-	  found_beginning = true;
-	}
-	end_ = MapIterator(iter->Superpixnum(), iter->End());
-
-	area_ += iter->Area();
-	size_ += iter->Size();
-	if (min_level_ > iter->MinLevel()) min_level_ = iter->MinLevel();
-	if (max_level_ < iter->MaxLevel()) max_level_ = iter->MaxLevel();
-	if (iter->MinWeight() < min_weight_) min_weight_ = iter->MinWeight();
-	if (iter->MaxWeight() > max_weight_) max_weight_ = iter->MaxWeight();
-	for (uint32_t resolution_iter=HPixResolution;
-	     resolution_iter<=MaxPixelResolution;resolution_iter*=2) {
-	  pixel_count_[resolution_iter] += iter->PixelCount(resolution_iter);
-	}
-      }
-    }
-
-    if (!found_beginning) found_file = false;
+    if (!Initialize()) found_file = false;
   } else {
     std::cout << "Stomp::Map::Read - " << InputFile <<
       " does not exist!.  No Map ingested\n";
@@ -2866,39 +3482,11 @@ bool Map::IntersectMap(PixelVector& pix) {
 }
 
 bool Map::IntersectMap(Map& stomp_map) {
-  bool found_overlapping_area = false;
-
   uint32_t superpixnum = 0;
 
   // First, just check to see that we've got some overlapping area between
   // the two maps.
-  while (superpixnum < MaxSuperpixnum && !found_overlapping_area) {
-    if (sub_map_[superpixnum].Initialized() &&
-	stomp_map.ContainsSuperpixel(superpixnum)) {
-      if (Area(superpixnum) < stomp_map.Area(superpixnum)) {
-	PixelVector tmp_pix;
-        PixelVector match_pix;
-
-        sub_map_[superpixnum].Pixels(tmp_pix);
-
-	// FindMatchingPixels using the weights from this map
-	stomp_map.FindMatchingPixels(tmp_pix, match_pix, false);
-
-	if (!match_pix.empty()) found_overlapping_area = true;
-      } else {
-	PixelVector tmp_pix;
-        PixelVector match_pix;
-
-        stomp_map.Pixels(tmp_pix, superpixnum);
-
-	// FindMatchingPixels using the weights from this map
-	FindMatchingPixels(tmp_pix, match_pix, true);
-
-	if (!match_pix.empty()) found_overlapping_area = true;
-      }
-    }
-    superpixnum++;
-  }
+  bool found_overlapping_area = _HasOverlap(stomp_map);
 
   // Provided that we've got some overlap, now do a full calculation for the
   // whole map.
@@ -3079,33 +3667,8 @@ bool Map::ImprintMap(PixelVector& pix) {
 }
 
 bool Map::ImprintMap(Map& stomp_map) {
-  bool found_overlapping_area = false;
-
   uint32_t k = 0;
-  while (k<MaxSuperpixnum && !found_overlapping_area) {
-    if (sub_map_[k].Initialized() && stomp_map.ContainsSuperpixel(k)) {
-      if (Area(k) < stomp_map.Area(k)) {
-	PixelVector tmp_pix;
-        PixelVector match_pix;
-
-        sub_map_[k].Pixels(tmp_pix);
-
-	stomp_map.FindMatchingPixels(tmp_pix,match_pix,false);
-
-	if (!match_pix.empty()) found_overlapping_area = true;
-      } else {
-	PixelVector tmp_pix;
-        PixelVector match_pix;
-
-        stomp_map.Pixels(tmp_pix,k);
-
-	FindMatchingPixels(tmp_pix, match_pix, true);
-
-	if (!match_pix.empty()) found_overlapping_area = true;
-      }
-    }
-    k++;
-  }
+  bool found_overlapping_area = _HasOverlap(stomp_map);
 
   if (found_overlapping_area) {
     for (k=0;k<MaxSuperpixnum;k++) {
@@ -3351,5 +3914,109 @@ uint32_t Map::PixelCount(uint32_t resolution) {
   return (!(resolution % 2) ? pixel_count_[resolution] : 0);
 }
 
+void Map::Serialize(std::string& buffer) {
+  // The pixels are stored as columns so that each one goes into the buffer in
+  // a single block.
+  std::vector<uint32_t> x, y;
+  std::vector<uint8_t> level;
+  std::vector<double> weight;
+  x.reserve(size_);
+  y.reserve(size_);
+  level.reserve(size_);
+  weight.reserve(size_);
+  for (SubMapIterator sub_iter=sub_map_.begin();
+       sub_iter!=sub_map_.end();++sub_iter) {
+    if (sub_iter->Initialized()) {
+      for (PixelIterator iter=sub_iter->Begin();
+	   iter!=sub_iter->End();++iter) {
+	x.push_back(iter->PixelX());
+	y.push_back(iter->PixelY());
+	level.push_back(iter->Level());
+	weight.push_back(iter->Weight());
+      }
+    }
+  }
+
+  BinaryWriter writer(buffer, "Stomp::Map");
+  writer.Reserve(x.size()*(2*sizeof(uint32_t) + sizeof(uint8_t) +
+			   sizeof(double)) + 64);
+  writer.WriteVector(x);
+  writer.WriteVector(y);
+  writer.WriteVector(level);
+  writer.WriteVector(weight);
+  SerializeRegions(writer);
+}
+
+bool Map::Deserialize(const std::string& buffer) {
+  BinaryReader reader(buffer, "Stomp::Map");
+  std::vector<uint32_t> x, y;
+  std::vector<uint8_t> level;
+  std::vector<double> weight;
+  reader.ReadVector(x);
+  reader.ReadVector(y);
+  reader.ReadVector(level);
+  reader.ReadVector(weight);
+  if (!reader.Status() || (y.size() != x.size()) ||
+      (level.size() != x.size()) || (weight.size() != x.size())) {
+    std::cout << "Stomp::Map::Deserialize - Invalid Map buffer.\n";
+    return false;
+  }
+
+  // The pixel indices go straight into the SubMaps, so a corrupt level or
+  // position has to be caught here rather than as a write outside them.
+  for (uint32_t i=0;i<x.size();i++) {
+    if ((level[i] < HPixLevel) || (level[i] > MaxPixelLevel) ||
+	(x[i] >= Nx0*Pixel::LevelToResolution(level[i])) ||
+	(y[i] >= Ny0*Pixel::LevelToResolution(level[i]))) {
+      std::cout << "Stomp::Map::Deserialize - Invalid Map buffer.\n";
+      return false;
+    }
+  }
+
+  PixelVector pix;
+  pix.reserve(x.size());
+  for (uint32_t i=0;i<x.size();i++)
+    pix.push_back(Pixel(x[i], y[i], Pixel::LevelToResolution(level[i]),
+			weight[i]));
+
+  // The pixels were written from a resolved Map, so there's no need to
+  // resolve them again.
+  Initialize(pix, false);
+
+  if (!DeserializeRegions(reader) || !reader.Finished()) {
+    std::cout << "Stomp::Map::Deserialize - Invalid region data.\n";
+    ClearRegions();
+  }
+
+  return true;
+}
+
+uint64_t Map::Fingerprint() {
+  // Combine the superpixel hashes the same way SubMap::Hash combines the
+  // pixels, including the superpixel index so that moving a block of pixels
+  // from one superpixel to another changes the result.
+  uint64_t fingerprint = 14695981039346656037ULL;
+  for (uint32_t k=0;k<MaxSuperpixnum;k++) {
+    if (sub_map_[k].Initialized()) {
+      uint64_t hash = sub_map_[k].Hash();
+      for (uint32_t i=0;i<4;i++) {
+	fingerprint ^= static_cast<uint64_t>((k >> (8*i)) & 0xff);
+	fingerprint *= 1099511628211ULL;
+      }
+      for (uint32_t i=0;i<8;i++) {
+	fingerprint ^= (hash >> (8*i)) & 0xff;
+	fingerprint *= 1099511628211ULL;
+      }
+    }
+  }
+
+  return fingerprint;
+}
+
+uint64_t Map::Fingerprint(uint32_t superpixnum) {
+  return ((superpixnum < MaxSuperpixnum) &&
+	  sub_map_[superpixnum].Initialized() ?
+	  sub_map_[superpixnum].Hash() : 0);
+}
 
 } // end namespace Stomp
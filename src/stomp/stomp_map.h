@@ -55,6 +55,7 @@ namespace Stomp {
 class AngularCoordinate;  // class declaration in stomp_angular_coordinate.h
 class Pixel;              // class declaration in stomp_pixel.h
 class GeometricBound;     // class declaration in stomp_geometry.h
+class MapExpr;            // class declaration in stomp_map_expr.h
 class SubMap;
 class Map;
 
@@ -69,6 +70,9 @@ typedef std::pair<SubMapIterator, SubMapIterator> SubMapPair;
 typedef std::pair<uint32_t, PixelIterator> MapIterator;
 typedef std::pair<MapIterator, MapIterator> MapPair;
 
+typedef std::vector<Map> MapVector;
+typedef MapVector::iterator MapVectorIterator;
+
 class SubMap {
   // While the preferred interface for interacting with a Map is through
   // that class, the actual work is deferred to the SubMap class.  Each
@@ -125,14 +129,43 @@ class SubMap {
   uint32_t Size();
   uint32_t PixelCount(uint32_t resolution);
 
+  // So that the Map doesn't have to recalculate its summary statistics from
+  // every SubMap after each change, each SubMap keeps track of whether it
+  // has been modified since its statistics were last folded into the Map
+  // totals and what it contributed to them at that point.  Commit replaces
+  // the old contribution in the input totals with the current one, extending
+  // the level and weight limits as needed.  Since the limits can't be
+  // shrunk that way, the return value is true if the old contribution set
+  // one of the limits and the current one doesn't, in which case the limits
+  // need to be recalculated.  CommitPixel adds a single pixel to the
+  // recorded contribution, for when the Map has already added that pixel to
+  // its totals directly.
+  bool Modified();
+  bool Commit(double& area, uint32_t& size, ResolutionDict& pixel_count,
+	      uint8_t& min_level, uint8_t& max_level,
+	      double& min_weight, double& max_weight);
+  void CommitPixel(Pixel& pix);
+
+  // A hash of the SubMap contents, which is kept until the SubMap changes.
+  uint64_t Hash();
+
  private:
+  void _SetModified();
+  void _HashValue(uint64_t value, uint8_t n_bytes);
+
   uint32_t superpixnum_, size_;
   PixelVector pix_;
   double area_, lambda_min_, lambda_max_, eta_min_, eta_max_, z_min_, z_max_;
   double min_weight_, max_weight_;
   uint8_t min_level_, max_level_;
-  bool initialized_, unsorted_;
+  bool initialized_, unsorted_, modified_, hashed_;
+  uint64_t hash_;
   ResolutionDict pixel_count_;
+  double committed_area_, committed_min_weight_, committed_max_weight_;
+  uint32_t committed_size_;
+  uint8_t committed_min_level_, committed_max_level_;
+  bool committed_initialized_;
+  ResolutionDict committed_pixel_count_;
 };
 
 class Map : public BaseMap {
@@ -148,6 +181,7 @@ class Map : public BaseMap {
   // query the angular extent and area of a Map on the Sky.
 
  public:
+  friend class MapExpr;
   // The preferred constructor for a Map takes a vector of Pixels
   // as its argument.  However, it can be constructed from a properly formatted
   // ASCII text file as well.
@@ -172,7 +206,12 @@ class Map : public BaseMap {
 
   // Initialize is called to organize the Map internally.  Unless the
   // map is being reset with a new set of pixels, as in the second instance of
-  // this method, Initialize should probably never be invoked.
+  // this method, Initialize should probably never be invoked.  The first
+  // instance only revisits the superpixels that have changed since it was
+  // last called, so its cost scales with the size of the change rather than
+  // the size of the Map.  Likewise, any regions are kept as long as the
+  // changes leave the Map covering the same pixels at the region resolution
+  // (the region areas are updated); otherwise, they are cleared.
   bool Initialize();
   bool Initialize(PixelVector& pix, bool force_resolve = true);
 
@@ -182,6 +221,31 @@ class Map : public BaseMap {
   // before most of the Map methods will work properly.
   void AddPixel(Pixel& pix);
 
+  // A common use for a Map is as the footprint of a point catalog, where we
+  // want every pixel at a given resolution that contains at least one point.
+  // Rather than adding those pixels one at a time and resolving the
+  // duplicates afterwards, FromPoints re-initializes the Map from the input
+  // points in one pass: the points are pixelized, bucketed by superpixel and
+  // each superpixel is sorted, de-duplicated and resolved (combining
+  // complete, equal-weight cohorts into their parent pixels) before being
+  // stored, so the Map is ready to use on return.  The superpixels are
+  // processed in parallel if the library is compiled with OpenMP.  The
+  // weighting controls the pixel weights: Occupancy gives every occupied
+  // pixel unit weight, PointCount uses the number of points in the pixel
+  // and PointWeight uses the sum of the point weights.  For AngularVector
+  // input, PointWeight is the same as PointCount.  The return value is
+  // false if the resolution is invalid or none of the points could be
+  // pixelized.
+  enum PointWeighting {
+    Occupancy,
+    PointCount,
+    PointWeight
+  };
+  bool FromPoints(AngularVector& ang, uint32_t resolution,
+		  PointWeighting weighting = Occupancy);
+  bool FromPoints(WAngularVector& w_ang, uint32_t resolution,
+		  PointWeighting weighting = Occupancy);
+
   // Simple call to determine if a point is within the current Map
   // instance.  Returns true if the point is within the map; false, otherwise.
   // If the location is within the Map, then the weight of value of the map
@@ -245,6 +309,23 @@ class Map : public BaseMap {
 			  PixelVector& match_pix,
 			  bool use_local_weights = false);
 
+  // If all we want is a measure of how much two Maps overlap, there's no
+  // need to build the intersection.  These methods sweep through the pixels
+  // of both Maps together, one superpixel at a time (in parallel, if the
+  // library is compiled with OpenMP), without changing either Map.
+  // OverlapArea returns the area common to both Maps and WeightedOverlapArea
+  // the integral of the product of the two Maps' weights over that area.
+  // JaccardIndex is the ratio of the overlap area to the area of the union
+  // of the two Maps.  OverlapTable breaks the overlap area and weighted
+  // overlap area down by superpixel, listing only the superpixels where the
+  // Maps overlap.
+  double OverlapArea(Map& stomp_map);
+  double WeightedOverlapArea(Map& stomp_map);
+  double JaccardIndex(Map& stomp_map);
+  void OverlapTable(Map& stomp_map, std::vector<uint32_t>& superpixnum,
+		    std::vector<double>& overlap_area,
+		    std::vector<double>& weighted_overlap_area);
+
   // Return a vector of SuperPixels that cover the Map.  This serves two
   // purposes.  First, it acts as a rough proxy for the area of the current
   // map, which can occasionally be useful.  More importantly, all of the real
@@ -269,6 +350,9 @@ class Map : public BaseMap {
   // map.  In that case, the returned boolean is false and the stomp_map is
   // composed of the superpixels for the current map.  If the method is able
   // to generate a map with at most maximum_pixels the return value is true.
+  // The pixels are merged into their parents in order of the area that each
+  // merge adds to the map, so the covering adds as little area as it can for
+  // the given number of pixels.
   //
   // Unlike Coverage, the weights in the returned stomp_map will be based on
   // the area-averaged weights in the current Map.
@@ -309,6 +393,19 @@ class Map : public BaseMap {
   // boolean.
   bool RegionExcludedMap(int16_t region_index, Map& stomp_map);
 
+  // Calling either of the previous methods for every region means copying
+  // and intersecting the whole Map once per region.  This method makes all
+  // of the region Maps at once in a single pass through the current Map,
+  // splitting pixels coarser than the region resolution as needed.  If
+  // exclude_region is true, the output Maps are the RegionExcludedMaps
+  // (the Map minus each region, for jack-knife sampling); otherwise they are
+  // the RegionOnlyMaps.  As with those methods, any part of the Map outside
+  // the regionation (e.g., if the regions were copied from a smaller Map) is
+  // in all of the excluded Maps and none of the region Maps.  In both cases,
+  // region_maps[k] corresponds to region k.  The return value is false if the
+  // Map hasn't been regionated.
+  bool SplitByRegion(MapVector& region_maps, bool exclude_region = false);
+
   // Given a requested number of points, return a vector of Poisson random
   // angular positions within the current Map's area.
   //
@@ -422,6 +519,15 @@ class Map : public BaseMap {
   bool Read(const std::string& InputFile, const bool hpixel_format = true,
 	    const bool weighted_map = true);
 
+  // For passing a Map between processes (through Python's pickle module, for
+  // instance), the Map can be packed into a compact binary string and
+  // restored from one.  Regions are included.  The string uses the native
+  // byte order (see the BinaryWriter class), so use Write and Read for
+  // files.  Deserialize returns false (leaving the Map unchanged) if the
+  // string doesn't hold a Map.
+  void Serialize(std::string& buffer);
+  bool Deserialize(const std::string& buffer);
+
   // Another option for specifying the Map geometry is to use a GeometricBound
   // object.  This translates from the analytic region described in the
   // GeometricBound to a pixel-based version that we can use as a basis for a
@@ -546,15 +652,53 @@ class Map : public BaseMap {
   virtual bool Empty();
   uint32_t PixelCount(uint32_t resolution);
 
+  // A 64-bit fingerprint of the Map contents (the pixels and their weights),
+  // so that products derived from a Map can be matched up with it later (see
+  // the MapCache class).  Each superpixel's hash is kept until that
+  // superpixel changes, so the fingerprint is cheap to update after small
+  // changes to the Map.  The single argument version returns the hash for a
+  // single superpixel (0 if the Map doesn't cover it).
+  uint64_t Fingerprint();
+  uint64_t Fingerprint(uint32_t superpixnum);
+
 
 private:
 
+  // The shared back end for FromPoints.  The input vectors hold the
+  // superpixel index, the hpixnum at the requested resolution and (for
+  // PointWeight) the weight for each point.
+  bool _FromPixelIndices(std::vector<uint32_t>& superpixnum,
+			 std::vector<uint32_t>& hpixnum,
+			 std::vector<double>& weight, uint32_t resolution,
+			 PointWeighting weighting);
+
+  // The shared back end for the overlap methods (as well as Contains,
+  // FindUnmaskedFraction and FindUnmaskedStatus for Maps).  For each
+  // superpixel, we find the overlap between the two Maps, the area of the
+  // input Map and the integral of the product of the two Maps' weights over
+  // the overlap.  The areas are counted in pixels at MaxPixelResolution, so
+  // comparisons between them are exact.
+  void _FindOverlap(Map& stomp_map, std::vector<uint64_t>& n_overlap,
+		    std::vector<uint64_t>& n_input,
+		    std::vector<double>& weighted_overlap);
+
+  // A cheaper check for whether there's any overlap at all, used by
+  // IntersectMap and ImprintMap before they do any real work.  Only the
+  // superpixels occupied by both Maps are swept and we stop at the first one
+  // that overlaps.
+  bool _HasOverlap(Map& stomp_map);
+
   // generate a random point in the specified quadrant in sdss survey
   // coordinates
   // lambda, eta, R in degrees. quadrant in [0,3]
   void _GenerateRandLamEtaQuadrant(double lambda, double eta, double R,
       int quadrant, double& rand_lambda, double& rand_eta) throw (const char*);
 
+  // Called by Initialize to check whether the current regions survive the
+  // changes to the input superpixels, updating the region areas if they do
+  // and clearing the regions if they don't.
+  void _UpdateRegions(std::vector<uint32_t>& superpixnum);
+
   SubMapVector sub_map_;
   MapIterator begin_, end_;
   double area_, min_weight_, max_weight_;
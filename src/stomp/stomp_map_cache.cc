@@ -0,0 +1,383 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This file contains the MapCache class, which stores products derived from
+// Maps on disk, keyed by the Map fingerprint.
+
+#include <stdio.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include "stomp_core.h"
+#include "stomp_map_cache.h"
+#include "stomp_map.h"
+#include "stomp_scalar_map.h"
+
+namespace Stomp {
+
+MapCache::MapCache(const std::string& cache_directory) {
+  cache_directory_ = cache_directory;
+  hits_ = 0;
+  misses_ = 0;
+
+  struct stat dir_stat;
+  if (stat(cache_directory_.c_str(), &dir_stat) != 0) {
+    if (mkdir(cache_directory_.c_str(), 0755) != 0) {
+      std::cout << "Stomp::MapCache::MapCache - " <<
+	"Unable to create cache directory " << cache_directory_ << "\n";
+    }
+  } else if (!S_ISDIR(dir_stat.st_mode)) {
+    std::cout << "Stomp::MapCache::MapCache - " <<
+      cache_directory_ << " is not a directory\n";
+  }
+}
+
+MapCache::~MapCache() {
+  cache_directory_.clear();
+}
+
+void MapCache::Coverage(Map& stomp_map, PixelVector& superpix,
+			uint32_t resolution, bool calculate_fraction) {
+  std::ostringstream parameters;
+  parameters << resolution << "_" << (calculate_fraction ? 1 : 0);
+  std::string cache_file =
+    _CacheFile(stomp_map, "coverage", parameters.str());
+
+  int32_t status;
+  if (_ReadPixels(cache_file, status, superpix)) {
+    hits_++;
+    return;
+  }
+
+  misses_++;
+  stomp_map.Coverage(superpix, resolution, calculate_fraction);
+  _Store(cache_file, _WritePixels(0, superpix));
+}
+
+bool MapCache::Covering(Map& stomp_map, Map& output_map,
+			uint32_t maximum_pixels) {
+  std::ostringstream parameters;
+  parameters << maximum_pixels;
+  std::string cache_file =
+    _CacheFile(stomp_map, "covering", parameters.str());
+
+  int32_t status;
+  PixelVector pix;
+  if (_ReadPixels(cache_file, status, pix)) {
+    hits_++;
+    output_map.Initialize(pix, false);
+    return (status == 1);
+  }
+
+  misses_++;
+  bool met_pixel_requirement = stomp_map.Covering(output_map, maximum_pixels);
+  output_map.Pixels(pix);
+  _Store(cache_file, _WritePixels(met_pixel_requirement ? 1 : 0, pix));
+
+  return met_pixel_requirement;
+}
+
+void MapCache::Soften(Map& stomp_map, Map& output_map,
+		      uint32_t maximum_resolution, bool average_weights) {
+  std::ostringstream parameters;
+  parameters << maximum_resolution << "_" << (average_weights ? 1 : 0);
+  std::string cache_file = _CacheFile(stomp_map, "soften", parameters.str());
+
+  int32_t status;
+  PixelVector pix;
+  if (_ReadPixels(cache_file, status, pix)) {
+    hits_++;
+    output_map.Initialize(pix, false);
+    return;
+  }
+
+  misses_++;
+  stomp_map.Soften(output_map, maximum_resolution, average_weights);
+  output_map.Pixels(pix);
+  _Store(cache_file, _WritePixels(0, pix));
+}
+
+void MapCache::InitializeScalarMap(Map& stomp_map, ScalarMap& scalar_map,
+				   uint32_t resolution,
+				   ScalarMap::ScalarMapType scalar_map_type,
+				   double min_unmasked_fraction,
+				   bool use_map_weight_as_intensity) {
+  std::ostringstream parameters;
+  parameters << std::setprecision(17) << resolution << "_" <<
+    scalar_map_type << "_" << min_unmasked_fraction << "_" <<
+    (use_map_weight_as_intensity ? 1 : 0);
+  std::string cache_file =
+    _CacheFile(stomp_map, "scalar_map", parameters.str());
+
+  std::ifstream input_file(cache_file.c_str());
+  if (input_file) {
+    // The first line gives the ScalarMapType and number of pixels, followed
+    // by the pixels in the same format as ScalarMap::Write.
+    int32_t map_type;
+    uint32_t n_pixel, hpixnum, superpixnum, pixel_resolution, x, y;
+    double unmasked, intensity;
+    int n_points;
+    ScalarVector pix;
+    bool read_file = false;
+    if (input_file >> map_type >> n_pixel) {
+      pix.reserve(n_pixel);
+      while ((pix.size() < n_pixel) &&
+	     (input_file >> hpixnum >> superpixnum >> pixel_resolution >>
+	      unmasked >> intensity >> n_points)) {
+	Pixel::HPix2XY(pixel_resolution, hpixnum, superpixnum, x, y);
+	pix.push_back(ScalarPixel(x, y, pixel_resolution,
+				  unmasked, intensity, n_points));
+      }
+      read_file = (pix.size() == n_pixel);
+    }
+    input_file.close();
+
+    if (read_file) {
+      hits_++;
+      scalar_map.Clear();
+      scalar_map.SetResolution(resolution);
+      if (!pix.empty())
+	scalar_map.InitializeFromScalarPixels(
+	  pix, static_cast<ScalarMap::ScalarMapType>(map_type));
+      return;
+    }
+  }
+
+  misses_++;
+  ScalarMap tmp_map(stomp_map, resolution, scalar_map_type,
+		    min_unmasked_fraction, use_map_weight_as_intensity);
+  ScalarVector pix;
+  tmp_map.ScalarPixels(pix);
+
+  scalar_map.Clear();
+  scalar_map.SetResolution(resolution);
+  if (!pix.empty())
+    scalar_map.InitializeFromScalarPixels(pix, tmp_map.MapType());
+
+  std::ostringstream contents;
+  contents << std::setprecision(17) <<
+    tmp_map.MapType() << " " << pix.size() << "\n";
+  for (ScalarIterator iter=pix.begin();iter!=pix.end();++iter) {
+    contents << iter->HPixnum() << " " <<
+      iter->Superpixnum() << " " <<
+      iter->Resolution() << " " <<
+      iter->Weight() << " " <<
+      iter->Intensity() << " " <<
+      iter->NPoints() << "\n";
+  }
+  _Store(cache_file, contents.str());
+}
+
+uint16_t MapCache::InitializeRegions(Map& stomp_map, uint16_t n_region,
+				     uint32_t region_resolution) {
+  std::ostringstream parameters;
+  parameters << n_region << "_" << region_resolution;
+  std::string cache_file = _CacheFile(stomp_map, "regions", parameters.str());
+
+  std::ifstream input_file(cache_file.c_str());
+  if (input_file) {
+    // The first line gives the region resolution and the number of region
+    // pixels, followed by the pixel index and region for each pixel.
+    uint32_t resolution, n_pixel, pixnum;
+    int16_t region;
+    RegionDict region_dict;
+    bool read_file = false;
+    if (input_file >> resolution >> n_pixel) {
+      while ((region_dict.size() < n_pixel) &&
+	     (input_file >> pixnum >> region)) region_dict[pixnum] = region;
+      read_file = (region_dict.size() == n_pixel);
+    }
+    input_file.close();
+
+    if (read_file && stomp_map.InitializeRegions(region_dict, resolution)) {
+      hits_++;
+      return stomp_map.NRegion();
+    }
+  }
+
+  misses_++;
+  uint16_t n_region_used =
+    stomp_map.InitializeRegions(n_region, region_resolution);
+
+  if (stomp_map.RegionsInitialized()) {
+    std::ostringstream contents;
+    uint32_t n_pixel = 0;
+    for (RegionIterator iter=stomp_map.RegionBegin();
+	 iter!=stomp_map.RegionEnd();++iter) n_pixel++;
+    contents << stomp_map.RegionResolution() << " " << n_pixel << "\n";
+    for (RegionIterator iter=stomp_map.RegionBegin();
+	 iter!=stomp_map.RegionEnd();++iter)
+      contents << iter->first << " " << iter->second << "\n";
+    _Store(cache_file, contents.str());
+  }
+
+  return n_region_used;
+}
+
+void MapCache::GenerateRandomPoints(Map& stomp_map, AngularVector& ang,
+				    uint32_t n_point,
+				    bool use_weighted_sampling, uint32_t seed) {
+  if (seed == 0) {
+    misses_++;
+    stomp_map.GenerateRandomPoints(ang, n_point, use_weighted_sampling, seed);
+    return;
+  }
+
+  std::ostringstream parameters;
+  parameters << n_point << "_" << (use_weighted_sampling ? 1 : 0) <<
+    "_" << seed;
+  std::string cache_file = _CacheFile(stomp_map, "random", parameters.str());
+
+  std::ifstream input_file(cache_file.c_str());
+  if (input_file) {
+    // The first line gives the number of points, followed by the unit sphere
+    // coordinates of each point.
+    uint32_t n_stored;
+    double unit_sphere_x, unit_sphere_y, unit_sphere_z;
+    AngularVector tmp_ang;
+    if (input_file >> n_stored) {
+      tmp_ang.reserve(n_stored);
+      while ((tmp_ang.size() < n_stored) &&
+	     (input_file >> unit_sphere_x >> unit_sphere_y >> unit_sphere_z))
+	tmp_ang.push_back(AngularCoordinate(unit_sphere_x, unit_sphere_y,
+					    unit_sphere_z));
+    }
+    input_file.close();
+
+    if (!tmp_ang.empty() && (tmp_ang.size() == n_stored)) {
+      hits_++;
+      ang.swap(tmp_ang);
+      return;
+    }
+  }
+
+  misses_++;
+  stomp_map.GenerateRandomPoints(ang, n_point, use_weighted_sampling, seed);
+
+  std::ostringstream contents;
+  contents << std::setprecision(17) << ang.size() << "\n";
+  for (AngularIterator iter=ang.begin();iter!=ang.end();++iter)
+    contents << iter->UnitSphereX() << " " << iter->UnitSphereY() << " " <<
+      iter->UnitSphereZ() << "\n";
+  _Store(cache_file, contents.str());
+}
+
+uint32_t MapCache::Hits() {
+  return hits_;
+}
+
+uint32_t MapCache::Misses() {
+  return misses_;
+}
+
+uint32_t MapCache::ClearCache() {
+  uint32_t n_removed = 0;
+
+  DIR* cache_dir = opendir(cache_directory_.c_str());
+  if (cache_dir == NULL) return n_removed;
+
+  std::vector<std::string> cache_files;
+  struct dirent* entry;
+  while ((entry = readdir(cache_dir)) != NULL) {
+    std::string file_name(entry->d_name);
+    if ((file_name.size() > 6) &&
+	(file_name.compare(file_name.size() - 6, 6, ".cache") == 0))
+      cache_files.push_back(cache_directory_ + "/" + file_name);
+  }
+  closedir(cache_dir);
+
+  for (uint32_t i=0;i<cache_files.size();i++)
+    if (remove(cache_files[i].c_str()) == 0) n_removed++;
+
+  return n_removed;
+}
+
+std::string MapCache::CacheDirectory() {
+  return cache_directory_;
+}
+
+std::string MapCache::_CacheFile(Map& stomp_map, const std::string& operation,
+				 const std::string& parameters) {
+  std::ostringstream cache_file;
+  cache_file << cache_directory_ << "/" << std::hex << std::setfill('0') <<
+    std::setw(16) << stomp_map.Fingerprint() << "_" << operation << "_" <<
+    parameters << ".cache";
+  return cache_file.str();
+}
+
+bool MapCache::_Store(const std::string& cache_file,
+		      const std::string& contents) {
+  // Write to a file unique to this process and then move it into place, so
+  // that anyone reading the cache either sees the complete file or nothing.
+  std::ostringstream tmp_file;
+  tmp_file << cache_file << ".tmp" << getpid();
+
+  std::ofstream output_file(tmp_file.str().c_str());
+  if (!output_file.is_open()) {
+    std::cout << "Stomp::MapCache::_Store - " <<
+      "Unable to write " << tmp_file.str() << "\n";
+    return false;
+  }
+  output_file << contents;
+  output_file.close();
+
+  if (output_file.fail() ||
+      (rename(tmp_file.str().c_str(), cache_file.c_str()) != 0)) {
+    std::cout << "Stomp::MapCache::_Store - " <<
+      "Unable to write " << cache_file << "\n";
+    remove(tmp_file.str().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool MapCache::_ReadPixels(const std::string& cache_file, int32_t& status,
+			   PixelVector& pix) {
+  // The first line gives a status value and the number of pixels, followed
+  // by the pixels in the same format as Map::Write.
+  std::ifstream input_file(cache_file.c_str());
+  if (!input_file) return false;
+
+  uint32_t n_pixel, hpixnum, superpixnum, resolution, x, y;
+  double weight;
+  PixelVector tmp_pix;
+  bool read_file = false;
+  if (input_file >> status >> n_pixel) {
+    tmp_pix.reserve(n_pixel);
+    while ((tmp_pix.size() < n_pixel) &&
+	   (input_file >> hpixnum >> superpixnum >> resolution >> weight)) {
+      Pixel::HPix2XY(resolution, hpixnum, superpixnum, x, y);
+      tmp_pix.push_back(Pixel(x, y, resolution, weight));
+    }
+    read_file = (tmp_pix.size() == n_pixel);
+  }
+  input_file.close();
+
+  if (read_file) pix.swap(tmp_pix);
+
+  return read_file;
+}
+
+std::string MapCache::_WritePixels(int32_t status, PixelVector& pix) {
+  std::ostringstream contents;
+  contents << std::setprecision(17) << status << " " << pix.size() << "\n";
+  for (PixelIterator iter=pix.begin();iter!=pix.end();++iter)
+    contents << iter->HPixnum() << " " << iter->Superpixnum() << " " <<
+      iter->Resolution() << " " << iter->Weight() << "\n";
+  return contents.str();
+}
+
+} // end namespace Stomp
@@ -0,0 +1,120 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This header file contains the MapCache class.  A lot of the work done with
+// a survey footprint consists of deriving the same products from the same Map
+// over and over again: the Coverage at some resolution, a Covering or
+// softened version of the Map, a ScalarMap to hold the galaxy counts, the
+// jack-knife regions and random catalogs.  All of these depend only on the
+// contents of the Map (and the parameters used to make them), so the MapCache
+// keeps them on disk, keyed by the Map's Fingerprint, and loads them again
+// the next time they are requested for the same footprint.
+
+#ifndef STOMP_MAP_CACHE_H
+#define STOMP_MAP_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "stomp_core.h"
+#include "stomp_angular_coordinate.h"
+#include "stomp_pixel.h"
+#include "stomp_scalar_map.h"
+
+namespace Stomp {
+
+class Map;                  // class definition in stomp_map.h
+class MapCache;
+
+class MapCache {
+  // Class object for an on-disk cache of products derived from Maps.  Each of
+  // the methods below has the same effect as the equivalent Map (or
+  // ScalarMap) method, but the product is first looked up in the cache
+  // directory.  If it isn't there, it is calculated and written to the cache
+  // before it's returned.
+  //
+  // Each product is stored in its own ASCII file, named after the Map
+  // fingerprint, the operation and its parameters.  Since any change to the
+  // Map changes the fingerprint, stale products are simply never found again;
+  // ClearCache removes them.  Files are written under a temporary name and
+  // then renamed, so several jobs can safely share the same cache directory.
+  //
+  // Products are written with full double precision, so a product loaded
+  // from the cache is the same as one calculated from scratch, up to the
+  // last bit of the random point coordinates (which are re-normalized when
+  // they are read in).
+ public:
+  // The cache directory is created if it doesn't already exist.
+  MapCache(const std::string& cache_directory);
+  ~MapCache();
+
+  // Equivalent to stomp_map.Coverage(superpix, resolution,
+  // calculate_fraction).
+  void Coverage(Map& stomp_map, PixelVector& superpix,
+		uint32_t resolution = HPixResolution,
+		bool calculate_fraction = true);
+
+  // Equivalent to stomp_map.Covering(output_map, maximum_pixels).
+  bool Covering(Map& stomp_map, Map& output_map, uint32_t maximum_pixels);
+
+  // Equivalent to stomp_map.Soften(output_map, maximum_resolution,
+  // average_weights).
+  void Soften(Map& stomp_map, Map& output_map, uint32_t maximum_resolution,
+	      bool average_weights = false);
+
+  // Equivalent to initializing the ScalarMap with the ScalarMap(Map&, ...)
+  // constructor.  Any existing contents of the ScalarMap are replaced.
+  void InitializeScalarMap(Map& stomp_map, ScalarMap& scalar_map,
+			   uint32_t resolution,
+			   ScalarMap::ScalarMapType scalar_map_type =
+			   ScalarMap::ScalarField,
+			   double min_unmasked_fraction = 0.0000001,
+			   bool use_map_weight_as_intensity = false);
+
+  // Equivalent to stomp_map.InitializeRegions(n_region, region_resolution).
+  // The regionation is stored on the Map itself, as usual.
+  uint16_t InitializeRegions(Map& stomp_map, uint16_t n_region,
+			     uint32_t region_resolution = 0);
+
+  // Equivalent to stomp_map.GenerateRandomPoints(ang, n_point,
+  // use_weighted_sampling, seed).  Only reproducible catalogs are cached, so
+  // if the seed is 0 (a random seed), the points are always generated from
+  // scratch.
+  void GenerateRandomPoints(Map& stomp_map, AngularVector& ang,
+			    uint32_t n_point = 1,
+			    bool use_weighted_sampling = false,
+			    uint32_t seed = 0);
+
+  // The number of products loaded from the cache and the number that had to
+  // be calculated since the object was created.
+  uint32_t Hits();
+  uint32_t Misses();
+
+  // Remove all of the cache files from the cache directory.  The return value
+  // is the number of files removed.
+  uint32_t ClearCache();
+
+  std::string CacheDirectory();
+
+ private:
+  std::string _CacheFile(Map& stomp_map, const std::string& operation,
+			 const std::string& parameters);
+  bool _Store(const std::string& cache_file, const std::string& contents);
+  bool _ReadPixels(const std::string& cache_file, int32_t& status,
+		   PixelVector& pix);
+  std::string _WritePixels(int32_t status, PixelVector& pix);
+
+  std::string cache_directory_;
+  uint32_t hits_, misses_;
+};
+
+} // end namespace Stomp
+
+#endif
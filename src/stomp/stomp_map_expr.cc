@@ -0,0 +1,415 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This file contains the implementation of the MapExpr class.  See the header
+// file for a description of how the expressions are evaluated.
+
+#include <algorithm>
+#include "stomp_core.h"
+#include "stomp_map_expr.h"
+#include "stomp_map.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace Stomp {
+
+MapExpr::MapExpr() {
+  n_threads_ = 0;
+}
+
+MapExpr::MapExpr(Map& stomp_map) {
+  MapExprStep step;
+  step.operation = Operand;
+  step.operand_idx = 0;
+  step.value = 0.0;
+  steps_.push_back(step);
+  maps_.push_back(&stomp_map);
+  n_threads_ = 0;
+}
+
+MapExpr::~MapExpr() {
+  steps_.clear();
+  maps_.clear();
+}
+
+MapExpr MapExpr::Intersect(const MapExpr& expr) const {
+  return _Combine(expr, IntersectOperation);
+}
+
+MapExpr MapExpr::Imprint(const MapExpr& expr) const {
+  return _Combine(expr, ImprintOperation);
+}
+
+MapExpr MapExpr::Exclude(const MapExpr& expr) const {
+  return _Combine(expr, ExcludeOperation);
+}
+
+MapExpr MapExpr::Union(const MapExpr& expr) const {
+  return _Combine(expr, UnionOperation);
+}
+
+MapExpr MapExpr::Add(const MapExpr& expr, bool drop_single) const {
+  return _Combine(expr, drop_single ? AddOperation : AddKeepSingleOperation);
+}
+
+MapExpr MapExpr::Multiply(const MapExpr& expr, bool drop_single) const {
+  return _Combine(expr, drop_single ? MultiplyOperation :
+		  MultiplyKeepSingleOperation);
+}
+
+MapExpr MapExpr::ScaleWeight(double weight_scale) const {
+  return _Modify(ScaleOperation, weight_scale);
+}
+
+MapExpr MapExpr::AddConstantWeight(double add_weight) const {
+  return _Modify(OffsetOperation, add_weight);
+}
+
+MapExpr MapExpr::operator&(const MapExpr& expr) const {
+  return Intersect(expr);
+}
+
+MapExpr MapExpr::operator|(const MapExpr& expr) const {
+  return Union(expr);
+}
+
+MapExpr MapExpr::operator-(const MapExpr& expr) const {
+  return Exclude(expr);
+}
+
+MapExpr MapExpr::_Combine(const MapExpr& expr, Operation operation) const {
+  // The new program is our program followed by the input program, with the
+  // input operands mapped onto the combined operand list so that a Map that
+  // appears more than once is only broken down once per superpixel.
+  MapExpr new_expr;
+  new_expr.steps_ = steps_;
+  new_expr.maps_ = maps_;
+  new_expr.n_threads_ = n_threads_;
+
+  for (uint32_t i=0;i<expr.steps_.size();i++) {
+    MapExprStep step = expr.steps_[i];
+    if (step.operation == Operand) {
+      Map* stomp_map = expr.maps_[step.operand_idx];
+      uint32_t operand_idx = 0;
+      while ((operand_idx < new_expr.maps_.size()) &&
+	     (new_expr.maps_[operand_idx] != stomp_map)) operand_idx++;
+      if (operand_idx == new_expr.maps_.size())
+	new_expr.maps_.push_back(stomp_map);
+      step.operand_idx = operand_idx;
+    }
+    new_expr.steps_.push_back(step);
+  }
+
+  MapExprStep step;
+  step.operation = operation;
+  step.operand_idx = 0;
+  step.value = 0.0;
+  new_expr.steps_.push_back(step);
+
+  return new_expr;
+}
+
+MapExpr MapExpr::_Modify(Operation operation, double value) const {
+  MapExpr new_expr;
+  new_expr.steps_ = steps_;
+  new_expr.maps_ = maps_;
+  new_expr.n_threads_ = n_threads_;
+
+  MapExprStep step;
+  step.operation = operation;
+  step.operand_idx = 0;
+  step.value = value;
+  new_expr.steps_.push_back(step);
+
+  return new_expr;
+}
+
+bool MapExpr::Evaluate(Map& stomp_map) {
+  if (steps_.empty()) {
+    std::cout << "Stomp::MapExpr::Evaluate - Empty expression.\n";
+    return false;
+  }
+
+  // First, we figure out which superpixels can contribute to the result.
+  // Treating any superpixel that an operand touches as partially covered
+  // (and the rest as outside) and running the program on that gives us the
+  // superpixels where the result might have area.  For intersections, that
+  // can be far fewer than the superpixels covered by any of the operands.
+  std::vector<uint32_t> active_superpixnum;
+  std::vector<MapExprValue> stack;
+  stack.reserve(steps_.size());
+  for (uint32_t k=0;k<MaxSuperpixnum;k++) {
+    stack.clear();
+    for (uint32_t i=0;i<steps_.size();i++) {
+      if (steps_[i].operation == Operand) {
+	MapExprValue value;
+	value.status =
+	  maps_[steps_[i].operand_idx]->ContainsSuperpixel(k) ? -1 : 0;
+	value.weight = 0.0;
+	stack.push_back(value);
+      } else if ((steps_[i].operation == ScaleOperation) ||
+		 (steps_[i].operation == OffsetOperation)) {
+	continue;
+      } else {
+	MapExprValue b = stack.back();
+	stack.pop_back();
+	MapExprValue& a = stack.back();
+	switch (steps_[i].operation) {
+	case IntersectOperation:
+	case ImprintOperation:
+	case AddOperation:
+	case MultiplyOperation:
+	  if (b.status == 0) a.status = 0;
+	  break;
+	case ExcludeOperation:
+	  break;
+	default:
+	  if (b.status != 0) a.status = -1;
+	  break;
+	}
+      }
+    }
+    if (stack.back().status != 0) active_superpixnum.push_back(k);
+  }
+
+  // Now each superpixel can be evaluated independently.  We hold on to all of
+  // the results until the end, since the output Map may also be one of the
+  // operands.
+  std::vector<PixelVector> superpix_pix(active_superpixnum.size());
+  int32_t n_superpix = static_cast<int32_t>(active_superpixnum.size());
+#ifdef _OPENMP
+  int n_threads = static_cast<int>(NThreads());
+#pragma omp parallel for schedule(dynamic) num_threads(n_threads)
+#endif
+  for (int32_t n=0;n<n_superpix;n++) {
+    _EvaluateSuperpixel(active_superpixnum[n], superpix_pix[n]);
+  }
+
+  stomp_map.Clear();
+  for (uint32_t n=0;n<active_superpixnum.size();n++) {
+    uint32_t k = active_superpixnum[n];
+    for (PixelIterator iter=superpix_pix[n].begin();
+	 iter!=superpix_pix[n].end();++iter) {
+      stomp_map.sub_map_[k].AddPixel(*iter);
+    }
+    if (stomp_map.sub_map_[k].Unsorted()) stomp_map.sub_map_[k].Resolve();
+  }
+
+  return stomp_map.Initialize();
+}
+
+void MapExpr::_EvaluateSuperpixel(uint32_t superpixnum, PixelVector& pix) {
+  // Convert each operand's pixels in this superpixel into ranges of Z-curve
+  // indices at MaxPixelResolution.  With the Z-curve, every pixel at any
+  // resolution maps onto a single contiguous range, so a pixel is inside an
+  // operand if one range covers it, outside if no range touches it and
+  // partially covered otherwise.
+  uint32_t superpix_x = superpixnum%(Nx0*HPixResolution);
+  uint32_t superpix_y = superpixnum/(Nx0*HPixResolution);
+
+  std::vector<std::vector<MapExprRange> > ranges(maps_.size());
+  for (uint32_t m=0;m<maps_.size();m++) {
+    SubMap& sub_map = maps_[m]->sub_map_[superpixnum];
+    if (!sub_map.Initialized()) continue;
+
+    ranges[m].reserve(sub_map.Size());
+    for (PixelIterator iter=sub_map.Begin();iter!=sub_map.End();++iter) {
+      uint32_t n_sub = iter->Resolution()/HPixResolution;
+      uint32_t scale = MaxPixelResolution/iter->Resolution();
+      uint32_t x = iter->PixelX() - superpix_x*n_sub;
+      uint32_t y = iter->PixelY() - superpix_y*n_sub;
+
+      MapExprRange range;
+      range.begin = _ZIndex(x*scale, y*scale);
+      range.end = range.begin + scale*scale;
+      range.weight = iter->Weight();
+      ranges[m].push_back(range);
+    }
+    std::sort(ranges[m].begin(), ranges[m].end());
+  }
+
+  std::vector<uint32_t> cursor(maps_.size(), 0);
+  std::vector<MapExprValue> stack;
+  stack.reserve(steps_.size());
+
+  uint32_t n_max = MaxPixelResolution/HPixResolution;
+  _EvaluatePixel(superpix_x, superpix_y, HPixResolution, 0, n_max*n_max,
+		 ranges, cursor, stack, pix);
+
+  // The pixels come out in Z-curve order, so we need to put them in the
+  // order that the SubMap expects.
+  std::sort(pix.begin(), pix.end(), Pixel::LocalOrder);
+}
+
+void MapExpr::_EvaluatePixel(uint32_t x, uint32_t y, uint32_t resolution,
+			     uint32_t range_begin, uint32_t range_length,
+			     std::vector<std::vector<MapExprRange> >& ranges,
+			     std::vector<uint32_t>& cursor,
+			     std::vector<MapExprValue>& stack,
+			     PixelVector& pix) {
+  uint32_t range_end = range_begin + range_length;
+
+  // Since we visit the pixels in Z-curve order, any operand range that ends
+  // before this pixel can be dropped for good.
+  for (uint32_t m=0;m<ranges.size();m++) {
+    while ((cursor[m] < ranges[m].size()) &&
+	   (ranges[m][cursor[m]].end <= range_begin)) cursor[m]++;
+  }
+
+  stack.clear();
+  for (uint32_t i=0;i<steps_.size();i++) {
+    const MapExprStep& step = steps_[i];
+    if (step.operation == Operand) {
+      MapExprValue value;
+      value.status = 0;
+      value.weight = 0.0;
+      uint32_t m = step.operand_idx;
+      if (cursor[m] < ranges[m].size()) {
+	MapExprRange& range = ranges[m][cursor[m]];
+	if ((range.begin <= range_begin) && (range.end >= range_end)) {
+	  value.status = 1;
+	  value.weight = range.weight;
+	} else {
+	  if (range.begin < range_end) value.status = -1;
+	}
+      }
+      stack.push_back(value);
+      continue;
+    }
+
+    if (step.operation == ScaleOperation) {
+      if (stack.back().status == 1) stack.back().weight *= step.value;
+      continue;
+    }
+
+    if (step.operation == OffsetOperation) {
+      if (stack.back().status == 1) stack.back().weight += step.value;
+      continue;
+    }
+
+    MapExprValue b = stack.back();
+    stack.pop_back();
+    MapExprValue& a = stack.back();
+
+    switch (step.operation) {
+    case IntersectOperation:
+    case ImprintOperation:
+    case AddOperation:
+    case MultiplyOperation:
+      // Area in both operands.
+      if ((a.status == 0) || (b.status == 0)) {
+	a.status = 0;
+      } else if ((a.status == 1) && (b.status == 1)) {
+	if (step.operation == ImprintOperation) a.weight = b.weight;
+	if (step.operation == AddOperation) a.weight += b.weight;
+	if (step.operation == MultiplyOperation) a.weight *= b.weight;
+      } else {
+	a.status = -1;
+      }
+      break;
+    case ExcludeOperation:
+      if ((a.status == 0) || (b.status == 1)) {
+	a.status = 0;
+      } else if ((a.status == -1) || (b.status == -1)) {
+	a.status = -1;
+      }
+      break;
+    case UnionOperation:
+    case AddKeepSingleOperation:
+    case MultiplyKeepSingleOperation:
+      // Area in either operand.
+      if ((a.status == -1) || (b.status == -1)) {
+	a.status = -1;
+      } else if (a.status == 0) {
+	a = b;
+      } else if (b.status == 1) {
+	if (step.operation == UnionOperation)
+	  a.weight = 0.5*(a.weight + b.weight);
+	if (step.operation == AddKeepSingleOperation) a.weight += b.weight;
+	if (step.operation == MultiplyKeepSingleOperation)
+	  a.weight *= b.weight;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  MapExprValue result = stack.back();
+  if (result.status == 0) return;
+
+  if (result.status == 1) {
+    pix.push_back(Pixel(x, y, resolution, result.weight));
+    return;
+  }
+
+  // The result isn't uniform over this pixel, so we work through its
+  // sub-pixels in Z-curve order.  If they all come back uniform with the
+  // same weight (which can happen when the boundaries of the operands cancel
+  // out), we replace them with this pixel.
+  uint32_t sub_length = range_length/4;
+  uint32_t n_pix = pix.size();
+  for (uint32_t j=0;j<4;j++) {
+    _EvaluatePixel(2*x + j%2, 2*y + j/2, 2*resolution,
+		   range_begin + j*sub_length, sub_length,
+		   ranges, cursor, stack, pix);
+  }
+
+  if ((pix.size() == n_pix + 4) &&
+      (pix[n_pix].Resolution() == 2*resolution) &&
+      (pix[n_pix+3].Resolution() == 2*resolution)) {
+    double weight = pix[n_pix].Weight();
+    bool uniform = true;
+    for (uint32_t j=n_pix+1;j<pix.size();j++) {
+      if ((pix[j].Resolution() != 2*resolution) ||
+	  !DoubleEQ(pix[j].Weight(), weight)) uniform = false;
+    }
+    if (uniform) {
+      pix.resize(n_pix);
+      pix.push_back(Pixel(x, y, resolution, weight));
+    }
+  }
+}
+
+uint32_t MapExpr::_ZIndex(uint32_t x, uint32_t y) {
+  // Interleave the bits of the local x and y indices, with x in the lower
+  // bit, so that the four sub-pixels of any pixel come out in the order
+  // (2x, 2y), (2x+1, 2y), (2x, 2y+1), (2x+1, 2y+1).
+  uint32_t z_index = 0;
+  for (uint32_t bit=0;(x >> bit) || (y >> bit);bit++) {
+    z_index |= ((x >> bit) & 1) << (2*bit);
+    z_index |= ((y >> bit) & 1) << (2*bit + 1);
+  }
+  return z_index;
+}
+
+void MapExpr::SetNThreads(uint16_t n_threads) {
+  n_threads_ = n_threads;
+}
+
+uint16_t MapExpr::NThreads() {
+#ifdef _OPENMP
+  return (n_threads_ > 0 ? n_threads_ : omp_get_max_threads());
+#else
+  return 1;
+#endif
+}
+
+uint32_t MapExpr::NOperands() {
+  return maps_.size();
+}
+
+uint32_t MapExpr::NOperations() {
+  return steps_.size();
+}
+
+} // end namespace Stomp
@@ -0,0 +1,163 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This header file contains the MapExpr class.  Building up a final survey
+// footprint usually means a chain of Map operations (IntersectMap, ExcludeMap,
+// MultiplyMap and so on), each of which produces a complete intermediate Map
+// that is immediately thrown away by the next step.  A MapExpr records the
+// chain of operations instead and evaluates the whole thing in one pass once
+// the result is needed.
+
+#ifndef STOMP_MAP_EXPR_H
+#define STOMP_MAP_EXPR_H
+
+#include <stdint.h>
+#include <vector>
+#include "stomp_core.h"
+#include "stomp_pixel.h"
+
+namespace Stomp {
+
+class Map;                  // class definition in stomp_map.h
+class MapExpr;
+
+class MapExpr {
+  // Class object for a lazily evaluated combination of Maps.  Each MapExpr
+  // starts as a single Map operand and the combination methods return new
+  // MapExprs, so expressions can be built up in the same way as the
+  // equivalent chain of Map methods:
+  //
+  //   Stomp::MapExpr expr = Stomp::MapExpr(footprint).Intersect(depth_map).
+  //     Exclude(bright_stars).Exclude(bad_fields).Multiply(completeness);
+  //   expr.Evaluate(final_map);
+  //
+  // The operand Maps are not copied, so they need to remain unchanged until
+  // the expression has been evaluated.
+  //
+  // Evaluation is done one superpixel at a time.  Within a superpixel, each
+  // operand's pixels are put in hierarchical (Z-curve) order, which lets us
+  // walk down the pixel hierarchy once for the whole expression, stepping
+  // through all of the operands' pixels in parallel.  Any pixel where the
+  // result is uniform is written out immediately, so only the final Map is
+  // ever created.  The superpixels are independent, so they are divided
+  // among threads if OpenMP is available.
+ public:
+  // The operations we know about.  The weights of the results follow the
+  // equivalent Map methods:
+  //
+  //   Intersect: the area in both operands, with the weights of the first
+  //              (IntersectMap).
+  //   Imprint:   the area in both operands, with the weights of the second
+  //              (ImprintMap).
+  //   Exclude:   the area in the first operand but not the second
+  //              (ExcludeMap).
+  //   Union:     the area in either operand, with overlapping areas taking
+  //              the average of the two weights (IngestMap).
+  //   Add:       the sum of the weights (AddMap).
+  //   Multiply:  the product of the weights (MultiplyMap).
+  //   Scale:     the weights multiplied by a constant (ScaleWeight).
+  //   Offset:    a constant added to the weights (AddConstantWeight).
+  //
+  // For Add and Multiply, drop_single determines whether area covered by
+  // only one of the operands is dropped (true) or kept with its original
+  // weight (false).
+  enum Operation {
+    Operand,
+    IntersectOperation,
+    ImprintOperation,
+    ExcludeOperation,
+    UnionOperation,
+    AddOperation,
+    AddKeepSingleOperation,
+    MultiplyOperation,
+    MultiplyKeepSingleOperation,
+    ScaleOperation,
+    OffsetOperation
+  };
+
+  MapExpr(Map& stomp_map);
+  ~MapExpr();
+
+  MapExpr Intersect(const MapExpr& expr) const;
+  MapExpr Imprint(const MapExpr& expr) const;
+  MapExpr Exclude(const MapExpr& expr) const;
+  MapExpr Union(const MapExpr& expr) const;
+  MapExpr Add(const MapExpr& expr, bool drop_single = true) const;
+  MapExpr Multiply(const MapExpr& expr, bool drop_single = true) const;
+  MapExpr ScaleWeight(double weight_scale) const;
+  MapExpr AddConstantWeight(double add_weight) const;
+
+  // Operator shorthand for the set operations: & for Intersect, | for Union
+  // and - for Exclude.
+  MapExpr operator&(const MapExpr& expr) const;
+  MapExpr operator|(const MapExpr& expr) const;
+  MapExpr operator-(const MapExpr& expr) const;
+
+  // Evaluate the expression, replacing the contents of the input Map.  The
+  // output Map can be one of the operands.  As with the Map methods, the
+  // return value is false if the result has no area.
+  bool Evaluate(Map& stomp_map);
+
+  // If OpenMP is available, the superpixels are divided among n_threads
+  // threads.  The default (0) uses the OpenMP default.
+  void SetNThreads(uint16_t n_threads);
+  uint16_t NThreads();
+
+  // The number of distinct Maps in the expression and the number of
+  // operations (including the operands themselves).
+  uint32_t NOperands();
+  uint32_t NOperations();
+
+ private:
+  // The expression is stored in postfix order: each operation acts on the
+  // results of the operations before it.
+  struct MapExprStep {
+    Operation operation;
+    uint32_t operand_idx;
+    double value;
+  };
+
+  // A pixel's status relative to part of the expression: 0 if it's outside,
+  // 1 if it's entirely inside with a single weight and -1 if it isn't
+  // uniform, so we need to look at its sub-pixels.
+  struct MapExprValue {
+    int8_t status;
+    double weight;
+  };
+
+  // The operand pixels for a superpixel, as ranges of Z-curve indices at
+  // MaxPixelResolution.
+  struct MapExprRange {
+    uint32_t begin, end;
+    double weight;
+    bool operator<(const MapExprRange& range) const {
+      return begin < range.begin;
+    }
+  };
+
+  MapExpr();
+  MapExpr _Combine(const MapExpr& expr, Operation operation) const;
+  MapExpr _Modify(Operation operation, double value) const;
+  void _EvaluateSuperpixel(uint32_t superpixnum, PixelVector& pix);
+  void _EvaluatePixel(uint32_t x, uint32_t y, uint32_t resolution,
+		      uint32_t range_begin, uint32_t range_length,
+		      std::vector<std::vector<MapExprRange> >& ranges,
+		      std::vector<uint32_t>& cursor,
+		      std::vector<MapExprValue>& stack, PixelVector& pix);
+  static uint32_t _ZIndex(uint32_t x, uint32_t y);
+
+  std::vector<MapExprStep> steps_;
+  std::vector<Map*> maps_;
+  uint16_t n_threads_;
+};
+
+} // end namespace Stomp
+
+#endif
@@ -0,0 +1,464 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This file contains the MapRaster class for turning Maps and ScalarMaps into
+// dense images.
+
+#include <math.h>
+#include <iostream>
+#include "stomp_core.h"
+#include "stomp_map_raster.h"
+#include "stomp_map.h"
+#include "stomp_scalar_map.h"
+#include "stomp_scalar_pixel.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace Stomp {
+
+// The longitude and latitude of a point in the grid's coordinate system.
+static void LonLat(AngularCoordinate& ang, AngularCoordinate::Sphere sphere,
+		   double& lon, double& lat) {
+  switch (sphere) {
+  case AngularCoordinate::Equatorial:
+    lon = ang.RA();
+    lat = ang.DEC();
+    break;
+  case AngularCoordinate::Galactic:
+    lon = ang.GalLon();
+    lat = ang.GalLat();
+    break;
+  default:
+    lon = ang.Eta();
+    lat = ang.Lambda();
+    break;
+  }
+}
+
+MapRaster::MapRaster() {
+  n_threads_ = 0;
+  Clear();
+}
+
+MapRaster::MapRaster(double lon_min, double lon_max, double lat_min,
+		     double lat_max, uint32_t n_x, uint32_t n_y,
+		     AngularCoordinate::Sphere sphere, Projection projection) {
+  n_threads_ = 0;
+  Initialize(lon_min, lon_max, lat_min, lat_max, n_x, n_y, sphere,
+	     projection);
+}
+
+MapRaster::~MapRaster() {
+  Clear();
+}
+
+bool MapRaster::Initialize(double lon_min, double lon_max, double lat_min,
+			   double lat_max, uint32_t n_x, uint32_t n_y,
+			   AngularCoordinate::Sphere sphere,
+			   Projection projection) {
+  Clear();
+
+  if ((n_x == 0) || (n_y == 0)) {
+    std::cout << "Stomp::MapRaster::Initialize - " <<
+      "Grid needs at least one cell in each direction.\n";
+    return false;
+  }
+
+  if (!(lon_min < lon_max) || (lon_max - lon_min > 360.0)) {
+    std::cout << "Stomp::MapRaster::Initialize - " <<
+      "Invalid longitude range: " << lon_min << " - " << lon_max << "\n";
+    return false;
+  }
+
+  if (!(lat_min < lat_max) || (lat_min < -90.0) || (lat_max > 90.0)) {
+    std::cout << "Stomp::MapRaster::Initialize - " <<
+      "Invalid latitude range: " << lat_min << " - " << lat_max << "\n";
+    return false;
+  }
+
+  lon_min_ = lon_min;
+  lon_max_ = lon_max;
+  lat_min_ = lat_min;
+  lat_max_ = lat_max;
+  n_x_ = n_x;
+  n_y_ = n_y;
+  sphere_ = sphere;
+  projection_ = projection;
+
+  grid_lat_min_ = _GridLatitude(lat_min_);
+  grid_lat_max_ = _GridLatitude(lat_max_);
+  d_lon_ = (lon_max_ - lon_min_)/n_x_;
+  d_lat_ = (grid_lat_max_ - grid_lat_min_)/n_y_;
+
+  return true;
+}
+
+bool MapRaster::Rasterize(Map& stomp_map, std::vector<double>& image,
+			  Field field) {
+  image.assign(Size(), 0.0);
+  return Rasterize(stomp_map, (image.empty() ? static_cast<double*>(NULL) :
+			       &image[0]), field);
+}
+
+bool MapRaster::Rasterize(Map& stomp_map, double* image, Field field) {
+  if (Empty()) {
+    std::cout << "Stomp::MapRaster::Rasterize - Grid is empty.\n";
+    return false;
+  }
+
+  if (field == Intensity) {
+    std::cout << "Stomp::MapRaster::Rasterize - " <<
+      "Maps don't have an Intensity field.\n";
+    return false;
+  }
+
+  PixelVector pix;
+  stomp_map.Pixels(pix);
+
+  std::vector<double> coverage;
+  _Rasterize(pix, coverage, (field == Weight), image);
+
+  return true;
+}
+
+bool MapRaster::Rasterize(ScalarMap& scalar_map, std::vector<double>& image,
+			  Field field) {
+  image.assign(Size(), 0.0);
+  return Rasterize(scalar_map, (image.empty() ? static_cast<double*>(NULL) :
+			       &image[0]), field);
+}
+
+bool MapRaster::Rasterize(ScalarMap& scalar_map, double* image, Field field) {
+  if (Empty()) {
+    std::cout << "Stomp::MapRaster::Rasterize - Grid is empty.\n";
+    return false;
+  }
+
+  if (field == Weight) {
+    std::cout << "Stomp::MapRaster::Rasterize - " <<
+      "ScalarMaps don't have a Weight field.\n";
+    return false;
+  }
+
+  // The ScalarPixel weights are the unmasked fractions, which scale the
+  // pixel areas, so we carry the intensities in the Pixel weights instead.
+  PixelVector pix;
+  std::vector<double> coverage;
+  pix.reserve(scalar_map.Size());
+  coverage.reserve(scalar_map.Size());
+  for (ScalarIterator iter=scalar_map.Begin();
+       iter!=scalar_map.End();++iter) {
+    pix.push_back(Pixel(iter->PixelX(), iter->PixelY(), iter->Resolution(),
+			iter->Intensity()));
+    coverage.push_back(iter->Weight());
+  }
+
+  _Rasterize(pix, coverage, (field == Intensity), image);
+
+  return true;
+}
+
+void MapRaster::_Rasterize(PixelVector& pix, std::vector<double>& coverage,
+			   bool mean_weight, double* image) {
+  uint32_t n_cell = Size();
+  uint32_t n_pixel = pix.size();
+
+  // Each thread gets its own copy of the sums, so the pixels can be split
+  // among the threads without any locking.  That takes one or two images'
+  // worth of memory per thread, so we use fewer threads for large images.
+  uint16_t n_threads = 1;
+#ifdef _OPENMP
+  n_threads = NThreads();
+  uint64_t thread_bytes =
+    static_cast<uint64_t>(n_cell)*sizeof(double)*(mean_weight ? 2 : 1);
+  uint64_t max_threads =
+    (thread_bytes > 0 ? MaxRasterThreadBytes/thread_bytes : n_threads);
+  if (max_threads < 1) max_threads = 1;
+  if (n_threads > max_threads) n_threads = static_cast<uint16_t>(max_threads);
+#endif
+  std::vector<std::vector<double> >
+    area_sum(n_threads, std::vector<double>(n_cell, 0.0)),
+    weight_sum(n_threads, std::vector<double>(mean_weight ? n_cell : 0, 0.0));
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 64) num_threads(n_threads)
+#endif
+  for (int32_t i=0;i<static_cast<int32_t>(n_pixel);i++) {
+    uint16_t thread_idx = 0;
+#ifdef _OPENMP
+    thread_idx = omp_get_thread_num();
+#endif
+    _SplatPixel(pix[i], (coverage.empty() ? 1.0 : coverage[i]),
+		&area_sum[thread_idx][0],
+		(mean_weight ? &weight_sum[thread_idx][0] : NULL));
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads)
+#endif
+  for (int32_t k=0;k<static_cast<int32_t>(n_cell);k++) {
+    double area = 0.0, weight = 0.0;
+    for (uint16_t m=0;m<n_threads;m++) {
+      area += area_sum[m][k];
+      if (mean_weight) weight += weight_sum[m][k];
+    }
+    if (mean_weight) {
+      image[k] = (area > 0.0 ? weight/area : 0.0);
+    } else {
+      image[k] = area/CellArea(k/n_x_);
+    }
+  }
+}
+
+void MapRaster::_SplatPixel(Pixel& pix, double coverage, double* area_sum,
+			    double* weight_sum) {
+  if (sphere_ == AngularCoordinate::Survey) {
+    _SplatSurveyPixel(pix, coverage, area_sum, weight_sum);
+    return;
+  }
+
+  AngularCoordinate ang = pix.Ang();
+  uint32_t x, y;
+  bool on_grid = _Cell(ang, x, y);
+
+  if (!on_grid) {
+    // Skip the pixels that can't reach the grid.  Every point in the pixel is
+    // within the center to corner distance of the center, which bounds how
+    // far the pixel extends in latitude and, away from the poles, longitude.
+    double lon, lat;
+    LonLat(ang, sphere_, lon, lat);
+    double radius = asin(sqrt(pix.FarCornerDistance(ang)))*RadToDeg;
+    if ((lat + radius < lat_min_) || (lat - radius > lat_max_)) return;
+    if (fabs(lat) + radius < 90.0) {
+      double d_lon = RadToDeg*asin(sin(radius*DegToRad)/cos(lat*DegToRad));
+      while (lon < lon_min_) lon += 360.0;
+      while (lon >= lon_min_ + 360.0) lon -= 360.0;
+      if ((lon - d_lon > lon_max_) && (lon + d_lon < lon_min_ + 360.0)) return;
+    }
+  }
+
+  // Split the pixel until the pieces are small compared to the cell the
+  // pixel's center lands in (or the nearest row of cells).
+  uint32_t sub_resolution = pix.Resolution();
+  double cell_area = CellArea(y);
+  while ((sub_resolution < MaxPixelResolution) &&
+	 (Pixel::Area(sub_resolution)*RasterSubSampling*RasterSubSampling >
+	  cell_area)) sub_resolution *= 2;
+
+  if (sub_resolution == pix.Resolution()) {
+    if (on_grid) {
+      uint32_t k = y*n_x_ + x;
+      area_sum[k] += coverage*pix.Area();
+      if (weight_sum != NULL) weight_sum[k] += coverage*pix.Area()*pix.Weight();
+    }
+    return;
+  }
+
+  double sub_area = coverage*Pixel::Area(sub_resolution);
+  uint32_t x_min, x_max, y_min, y_max;
+  pix.SubPix(sub_resolution, x_min, x_max, y_min, y_max);
+  for (uint32_t sub_y=y_min;sub_y<=y_max;sub_y++) {
+    for (uint32_t sub_x=x_min;sub_x<=x_max;sub_x++) {
+      Pixel sub_pix(sub_x, sub_y, sub_resolution);
+      AngularCoordinate sub_ang = sub_pix.Ang();
+      if (_Cell(sub_ang, x, y)) {
+	uint32_t k = y*n_x_ + x;
+	area_sum[k] += sub_area;
+	if (weight_sum != NULL) weight_sum[k] += sub_area*pix.Weight();
+      }
+    }
+  }
+}
+
+void MapRaster::_SplatSurveyPixel(Pixel& pix, double coverage,
+				  double* area_sum, double* weight_sum) {
+  // In Survey coordinates, the pixel is a rectangle in Eta and Lambda, so the
+  // overlap with each cell is the product of the overlap in longitude and
+  // the difference in sin(Lambda) over the overlap in latitude.
+  double grid_lat_lo = _GridLatitude(pix.LambdaMin());
+  double grid_lat_hi = _GridLatitude(pix.LambdaMax());
+  if ((grid_lat_hi <= grid_lat_min_) || (grid_lat_lo >= grid_lat_max_)) return;
+  if (grid_lat_lo < grid_lat_min_) grid_lat_lo = grid_lat_min_;
+  if (grid_lat_hi > grid_lat_max_) grid_lat_hi = grid_lat_max_;
+
+  uint32_t y_min = static_cast<uint32_t>((grid_lat_lo - grid_lat_min_)/d_lat_);
+  uint32_t y_max = static_cast<uint32_t>((grid_lat_hi - grid_lat_min_)/d_lat_);
+  if (y_min >= n_y_) y_min = n_y_ - 1;
+  if (y_max >= n_y_) y_max = n_y_ - 1;
+
+  // The pixel may overlap the grid once it's shifted by a multiple of 360
+  // degrees, possibly more than once if the grid spans the full circle.
+  double eta_min = pix.EtaMin();
+  double eta_max = pix.EtaMaxContinuous();
+  int32_t shift_min = static_cast<int32_t>(ceil((lon_min_ - eta_max)/360.0));
+  int32_t shift_max = static_cast<int32_t>(floor((lon_max_ - eta_min)/360.0));
+
+  for (int32_t shift=shift_min;shift<=shift_max;shift++) {
+    double lon_lo = eta_min + 360.0*shift;
+    double lon_hi = eta_max + 360.0*shift;
+    if (lon_lo < lon_min_) lon_lo = lon_min_;
+    if (lon_hi > lon_max_) lon_hi = lon_max_;
+    if (lon_hi <= lon_lo) continue;
+
+    uint32_t x_min = static_cast<uint32_t>((lon_lo - lon_min_)/d_lon_);
+    uint32_t x_max = static_cast<uint32_t>((lon_hi - lon_min_)/d_lon_);
+    if (x_min >= n_x_) x_min = n_x_ - 1;
+    if (x_max >= n_x_) x_max = n_x_ - 1;
+
+    for (uint32_t y=y_min;y<=y_max;y++) {
+      double row_lo = grid_lat_min_ + y*d_lat_;
+      double row_hi = (y == n_y_ - 1 ? grid_lat_max_ : row_lo + d_lat_);
+      if (row_lo < grid_lat_lo) row_lo = grid_lat_lo;
+      if (row_hi > grid_lat_hi) row_hi = grid_lat_hi;
+      if (row_hi <= row_lo) continue;
+
+      double d_sin_lat = (projection_ == EqualArea ? row_hi - row_lo :
+			  sin(row_hi*DegToRad) - sin(row_lo*DegToRad));
+
+      for (uint32_t x=x_min;x<=x_max;x++) {
+	double cell_lo = lon_min_ + x*d_lon_;
+	double cell_hi = (x == n_x_ - 1 ? lon_max_ : cell_lo + d_lon_);
+	if (cell_lo < lon_lo) cell_lo = lon_lo;
+	if (cell_hi > lon_hi) cell_hi = lon_hi;
+	if (cell_hi <= cell_lo) continue;
+
+	double area = coverage*(cell_hi - cell_lo)*d_sin_lat*RadToDeg;
+	uint32_t k = y*n_x_ + x;
+	area_sum[k] += area;
+	if (weight_sum != NULL) weight_sum[k] += area*pix.Weight();
+      }
+    }
+  }
+}
+
+double MapRaster::_GridLatitude(double lat) {
+  return (projection_ == EqualArea ? sin(lat*DegToRad) : lat);
+}
+
+double MapRaster::_Latitude(double grid_lat) {
+  return (projection_ == EqualArea ? asin(grid_lat)*RadToDeg : grid_lat);
+}
+
+bool MapRaster::_Cell(AngularCoordinate& ang, uint32_t& x, uint32_t& y) {
+  double lon, lat;
+  LonLat(ang, sphere_, lon, lat);
+
+  double grid_lat = _GridLatitude(lat);
+  bool on_grid = ((grid_lat >= grid_lat_min_) && (grid_lat <= grid_lat_max_));
+  if (grid_lat < grid_lat_min_) grid_lat = grid_lat_min_;
+  if (grid_lat > grid_lat_max_) grid_lat = grid_lat_max_;
+  y = static_cast<uint32_t>((grid_lat - grid_lat_min_)/d_lat_);
+  if (y >= n_y_) y = n_y_ - 1;
+
+  while (lon < lon_min_) lon += 360.0;
+  while (lon >= lon_min_ + 360.0) lon -= 360.0;
+  if (lon > lon_max_) return false;
+  x = static_cast<uint32_t>((lon - lon_min_)/d_lon_);
+  if (x >= n_x_) x = n_x_ - 1;
+
+  return on_grid;
+}
+
+void MapRaster::CellBound(uint32_t x, uint32_t y, double& lon_min,
+			  double& lon_max, double& lat_min, double& lat_max) {
+  lon_min = lon_min_ + x*d_lon_;
+  lon_max = (x == n_x_ - 1 ? lon_max_ : lon_min + d_lon_);
+  lat_min = _Latitude(grid_lat_min_ + y*d_lat_);
+  lat_max = (y == n_y_ - 1 ? lat_max_ :
+	     _Latitude(grid_lat_min_ + (y + 1)*d_lat_));
+}
+
+void MapRaster::CellCenter(uint32_t x, uint32_t y, AngularCoordinate& ang) {
+  double lon = lon_min_ + (x + 0.5)*d_lon_;
+  double lat = _Latitude(grid_lat_min_ + (y + 0.5)*d_lat_);
+  switch (sphere_) {
+  case AngularCoordinate::Equatorial:
+    ang.SetEquatorialCoordinates(lon, lat);
+    break;
+  case AngularCoordinate::Galactic:
+    ang.SetGalacticCoordinates(lon, lat);
+    break;
+  default:
+    ang.SetSurveyCoordinates(lat, lon);
+    break;
+  }
+}
+
+double MapRaster::CellArea(uint32_t y) {
+  if (projection_ == EqualArea) return d_lon_*d_lat_*RadToDeg;
+
+  double lon_min, lon_max, lat_min, lat_max;
+  CellBound(0, y, lon_min, lon_max, lat_min, lat_max);
+  return d_lon_*(sin(lat_max*DegToRad) - sin(lat_min*DegToRad))*RadToDeg;
+}
+
+void MapRaster::SetNThreads(uint16_t n_threads) {
+  n_threads_ = n_threads;
+}
+
+uint16_t MapRaster::NThreads() {
+#ifdef _OPENMP
+  return (n_threads_ > 0 ? n_threads_ : omp_get_max_threads());
+#else
+  return 1;
+#endif
+}
+
+uint32_t MapRaster::NX() {
+  return n_x_;
+}
+
+uint32_t MapRaster::NY() {
+  return n_y_;
+}
+
+uint32_t MapRaster::Size() {
+  return n_x_*n_y_;
+}
+
+double MapRaster::LonMin() {
+  return lon_min_;
+}
+
+double MapRaster::LonMax() {
+  return lon_max_;
+}
+
+double MapRaster::LatMin() {
+  return lat_min_;
+}
+
+double MapRaster::LatMax() {
+  return lat_max_;
+}
+
+AngularCoordinate::Sphere MapRaster::GridSphere() {
+  return sphere_;
+}
+
+MapRaster::Projection MapRaster::GridProjection() {
+  return projection_;
+}
+
+bool MapRaster::Empty() {
+  return (Size() == 0);
+}
+
+void MapRaster::Clear() {
+  lon_min_ = lon_max_ = lat_min_ = lat_max_ = 0.0;
+  grid_lat_min_ = grid_lat_max_ = d_lon_ = d_lat_ = 0.0;
+  n_x_ = n_y_ = 0;
+  sphere_ = AngularCoordinate::Survey;
+  projection_ = Cartesian;
+}
+
+} // end namespace Stomp
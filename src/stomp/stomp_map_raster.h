@@ -0,0 +1,158 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This header file contains the MapRaster class.  For plotting, or for
+// handing a survey mask to code that works on images, we often want a Map or
+// ScalarMap as a dense 2-D array on a regular longitude-latitude grid rather
+// than as a list of pixels.  Looking up the weight at the center of each
+// output cell is slow and ignores the parts of the map that don't happen to
+// cover a cell center.  Instead, MapRaster makes a single pass over the
+// map's pixels, adding each pixel's area to the cells it overlaps.
+
+#ifndef STOMP_MAP_RASTER_H
+#define STOMP_MAP_RASTER_H
+
+#include <stdint.h>
+#include <vector>
+#include "stomp_core.h"
+#include "stomp_angular_coordinate.h"
+#include "stomp_pixel.h"
+
+namespace Stomp {
+
+class Map;        // class definition in stomp_map.h
+class ScalarMap;  // class definition in stomp_scalar_map.h
+class MapRaster;
+
+class MapRaster {
+  // Class object for a grid of n_x by n_y cells covering a range of
+  // longitude and latitude in one of the AngularCoordinate systems.  The
+  // longitude is Eta, RA or GalLon and the latitude Lambda, DEC or GalLat for
+  // the Survey, Equatorial and Galactic systems, respectively.  The cells
+  // are evenly spaced in longitude and either evenly spaced in latitude
+  // (Cartesian) or in the sine of the latitude (EqualArea), in which case all
+  // of the cells have the same area on the sky.
+  //
+  // The images are stored row by row, with the first row at the minimum
+  // latitude, so that the value for cell (x, y) is image[y*NX() + x].
+  //
+  // In the Survey system, the pixel edges follow lines of constant Lambda and
+  // Eta, so the overlap between each pixel and each cell is calculated
+  // exactly.  In the other systems, pixels are split into sub-pixels with no
+  // more than 1/RasterSubSampling^2 of the area of the cell they land in and
+  // each sub-pixel's area goes to the cell containing its center.
+ public:
+  enum Projection {
+    Cartesian,
+    EqualArea
+  };
+
+  // The values we can put in the image:
+  //
+  //  * UnmaskedFraction: the fraction of each cell's area covered by the map
+  //                      (for ScalarMaps, each pixel's area is scaled by its
+  //                      unmasked fraction).
+  //  * Weight:           the area-weighted mean Map weight in each cell.
+  //  * Intensity:        the area-weighted mean ScalarMap intensity in each
+  //                      cell.
+  //
+  // Cells that the map doesn't touch are set to 0 in every case.
+  enum Field {
+    UnmaskedFraction,
+    Weight,
+    Intensity
+  };
+
+  MapRaster();
+  MapRaster(double lon_min, double lon_max, double lat_min, double lat_max,
+	    uint32_t n_x, uint32_t n_y,
+	    AngularCoordinate::Sphere sphere = AngularCoordinate::Survey,
+	    Projection projection = Cartesian);
+  ~MapRaster();
+
+  // Re-initialize the grid.  The longitude range can't exceed 360 degrees
+  // and the latitude range must be within [-90, 90].  If the inputs don't
+  // describe a valid grid, the return value is false and the grid is left
+  // empty.
+  bool Initialize(double lon_min, double lon_max, double lat_min,
+		  double lat_max, uint32_t n_x, uint32_t n_y,
+		  AngularCoordinate::Sphere sphere = AngularCoordinate::Survey,
+		  Projection projection = Cartesian);
+
+  // Fill the image with the requested field for the input map.  Maps can
+  // give the UnmaskedFraction or Weight and ScalarMaps the UnmaskedFraction
+  // or Intensity; the return value is false for any other combination or if
+  // the grid is empty.  The pointer forms expect room for NX()*NY() values.
+  bool Rasterize(Map& stomp_map, std::vector<double>& image,
+		 Field field = UnmaskedFraction);
+  bool Rasterize(Map& stomp_map, double* image,
+		 Field field = UnmaskedFraction);
+  bool Rasterize(ScalarMap& scalar_map, std::vector<double>& image,
+		 Field field = Intensity);
+  bool Rasterize(ScalarMap& scalar_map, double* image,
+		 Field field = Intensity);
+
+  // The geometry of the cells.  CellArea is in square degrees and the
+  // bounds in degrees.
+  void CellBound(uint32_t x, uint32_t y, double& lon_min, double& lon_max,
+		 double& lat_min, double& lat_max);
+  void CellCenter(uint32_t x, uint32_t y, AngularCoordinate& ang);
+  double CellArea(uint32_t y);
+
+  // If OpenMP is available, the pixels are divided among n_threads threads,
+  // each with its own copy of the image.  The default (0) uses the OpenMP
+  // default.  For large images, fewer threads are used so that the copies
+  // fit within MaxRasterThreadBytes.
+  void SetNThreads(uint16_t n_threads);
+  uint16_t NThreads();
+
+  uint32_t NX();
+  uint32_t NY();
+  uint32_t Size();
+  double LonMin();
+  double LonMax();
+  double LatMin();
+  double LatMax();
+  AngularCoordinate::Sphere GridSphere();
+  Projection GridProjection();
+  bool Empty();
+  void Clear();
+
+ private:
+  // Sum the overlap area (scaled by the coverage values, if there are any)
+  // and the area times the pixel weights into each cell, then turn those
+  // into the output image.
+  void _Rasterize(PixelVector& pix, std::vector<double>& coverage,
+		  bool mean_weight, double* image);
+  void _SplatPixel(Pixel& pix, double coverage, double* area_sum,
+		   double* weight_sum);
+  void _SplatSurveyPixel(Pixel& pix, double coverage, double* area_sum,
+			 double* weight_sum);
+
+  // Conversions to and from the latitude coordinate the rows are evenly
+  // spaced in (the latitude itself or its sine).
+  double _GridLatitude(double lat);
+  double _Latitude(double grid_lat);
+
+  // Find the cell containing a point.  The return value is false if the
+  // point is off the grid, in which case y is the nearest row.
+  bool _Cell(AngularCoordinate& ang, uint32_t& x, uint32_t& y);
+
+  double lon_min_, lon_max_, lat_min_, lat_max_;
+  double grid_lat_min_, grid_lat_max_, d_lon_, d_lat_;
+  uint32_t n_x_, n_y_;
+  AngularCoordinate::Sphere sphere_;
+  Projection projection_;
+  uint16_t n_threads_;
+};
+
+} // end namespace Stomp
+
+#endif
@@ -2,12 +2,25 @@
 #include <iostream>
 #include <math.h>
 #include <string>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
 #include <gflags/gflags.h>
 #include "stomp_core.h"
+#include "stomp_util.h"
 #include "stomp_angular_coordinate.h"
 #include "stomp_pixel.h"
 #include "stomp_geometry.h"
 #include "stomp_map.h"
+#include "stomp_map_expr.h"
+#include "stomp_map_cache.h"
+#include "stomp_map_raster.h"
+#include "stomp_mask_server.h"
+#include "stomp_scalar_map.h"
+#include "stomp_tree_map.h"
+#include "stomp_itree_map.h"
+#include "stomp_angular_correlation.h"
 
 void MapBasicTests() {
   // Ok, now we're ready to start playing with the Stomp::Map interfaces.  We'll
@@ -180,6 +193,28 @@ void MapCoverTests() {
     std::cout << "Failed to make covering Stomp::Map with <" <<
       10*superpix.size() << " pixels (" << tmp_map.Size() << ")\n";
   }
+
+  // Now step through a range of pixel limits and check that each covering
+  // stays within the limit and still contains the original map.
+  for (Stomp::PixelIterator iter=annulus_pix.begin();
+       iter!=annulus_pix.end();++iter) iter->SetWeight(iter->Pixnum()%7 + 1.0);
+  Stomp::Map weighted_map(annulus_pix);
+  std::cout << "\tCovering a " << weighted_map.Size() <<
+    " pixel Stomp::Map (" << weighted_map.Area() << " sq. degrees):\n";
+  for (uint32_t maximum_pixels=superpix.size();
+       maximum_pixels<weighted_map.Size();maximum_pixels*=4) {
+    made_covering = weighted_map.Covering(tmp_map, maximum_pixels);
+    std::cout << "\t\t" << maximum_pixels << " pixel limit: " <<
+      tmp_map.Size() << " pixels, " << tmp_map.Area() << " sq. degrees, " <<
+      "average weight " << tmp_map.AverageWeight() << " (" <<
+      weighted_map.AverageWeight() << ")";
+    if (made_covering && (tmp_map.Size() <= maximum_pixels) &&
+	tmp_map.Contains(weighted_map)) {
+      std::cout << ". Good.\n";
+    } else {
+      std::cout << ". BAD.\n";
+    }
+  }
 }
 
 void MapIteratorTests() {
@@ -909,6 +944,959 @@ void MapSoftenTests() {
     ", Min weight: " << soft_map.MinWeight() << "\n";
 }
 
+void MapFromPointsTests() {
+  // Building a Map from a point catalog should give the same pixels as
+  // pixelizing each point by hand and resolving the result.
+  std::cout << "\n";
+  std::cout << "****************************\n";
+  std::cout << "*** Map FromPoints Tests ***\n";
+  std::cout << "****************************\n";
+
+  Stomp::AngularCoordinate ang(60.0, 0.0, Stomp::AngularCoordinate::Survey);
+  double theta_bound = 3.0;
+  Stomp::Pixel tmp_pix(ang, 256);
+  Stomp::PixelVector map_pix;
+  tmp_pix.WithinRadius(theta_bound, map_pix);
+  Stomp::Map* stomp_map = new Stomp::Map(map_pix);
+
+  // We want a catalog dense enough that most of the pixels are occupied, so
+  // that FromPoints has to combine pixels into their parents.
+  uint32_t n_points = 500000;
+  uint32_t resolution = 512;
+  Stomp::AngularVector angVec;
+  stomp_map->GenerateRandomPoints(angVec, n_points);
+  Stomp::WAngularVector w_ang;
+  w_ang.reserve(angVec.size());
+  for (uint32_t i=0;i<angVec.size();i++) {
+    double weight = (i%2 == 0 ? 1.0 : 2.0);
+    w_ang.push_back(Stomp::WeightedAngularCoordinate(angVec[i].UnitSphereX(),
+						     angVec[i].UnitSphereY(),
+						     angVec[i].UnitSphereZ(),
+						     weight));
+  }
+  std::cout << n_points << " points; pixelizing at resolution " <<
+    resolution << "\n";
+
+  for (uint8_t weighting=0;weighting<3;weighting++) {
+    Stomp::Map::PointWeighting point_weighting =
+      static_cast<Stomp::Map::PointWeighting>(weighting);
+    std::cout << (point_weighting == Stomp::Map::Occupancy ? "Occupancy" :
+		  (point_weighting == Stomp::Map::PointCount ? "PointCount" :
+		   "PointWeight")) << ":\n";
+
+    // First, the old way: one pixel per point, summing the weights for
+    // duplicates and then resolving the full list.
+    Stomp::StompWatch stomp_watch;
+    stomp_watch.StartTimer();
+    std::map<uint32_t, double> pix_weight;
+    for (Stomp::WAngularIterator iter=w_ang.begin();iter!=w_ang.end();++iter) {
+      Stomp::Pixel pix(*iter, resolution, 1.0);
+      double weight = (point_weighting == Stomp::Map::PointWeight ?
+		       iter->Weight() : 1.0);
+      if (pix_weight.find(pix.Pixnum()) == pix_weight.end()) {
+	pix_weight[pix.Pixnum()] = weight;
+      } else {
+	if (point_weighting != Stomp::Map::Occupancy)
+	  pix_weight[pix.Pixnum()] += weight;
+      }
+    }
+    Stomp::PixelVector pix;
+    for (std::map<uint32_t, double>::iterator iter=pix_weight.begin();
+	 iter!=pix_weight.end();++iter)
+      pix.push_back(Stomp::Pixel(resolution, iter->first, iter->second));
+    Stomp::Map resolve_map(pix);
+    stomp_watch.StopTimer();
+    std::cout << "\tPixelize + Resolve: " << resolve_map.Size() <<
+      " pixels, " << resolve_map.Area() << " sq. degrees (" <<
+      stomp_watch.ElapsedTime() << "s)\n";
+
+    Stomp::Map points_map;
+    stomp_watch.StartTimer();
+    if (point_weighting == Stomp::Map::PointWeight) {
+      points_map.FromPoints(w_ang, resolution, point_weighting);
+    } else {
+      points_map.FromPoints(angVec, resolution, point_weighting);
+    }
+    stomp_watch.StopTimer();
+    std::cout << "\tFromPoints: " << points_map.Size() << " pixels, " <<
+      points_map.Area() << " sq. degrees (" <<
+      stomp_watch.ElapsedTime() << "s)\n";
+
+    Stomp::PixelVector resolve_pix, points_pix;
+    resolve_map.Pixels(resolve_pix);
+    points_map.Pixels(points_pix);
+    uint32_t n_mismatch = 0;
+    if (resolve_pix.size() != points_pix.size()) {
+      n_mismatch = resolve_pix.size();
+    } else {
+      for (uint32_t i=0;i<resolve_pix.size();i++) {
+	if ((resolve_pix[i].Resolution() != points_pix[i].Resolution()) ||
+	    (resolve_pix[i].Pixnum() != points_pix[i].Pixnum()) ||
+	    !Stomp::DoubleEQ(resolve_pix[i].Weight(), points_pix[i].Weight()))
+	  n_mismatch++;
+      }
+    }
+    std::cout << "\t" << n_mismatch << " mismatched pixels; " <<
+      "total weight: " << resolve_map.AverageWeight()*resolve_map.Area() <<
+      " vs. " << points_map.AverageWeight()*points_map.Area() << "\n";
+  }
+
+  // Resolutions that aren't powers of two should be rejected.
+  Stomp::Map bad_map;
+  bool accepted = bad_map.FromPoints(angVec, 24);
+  std::cout << "\tResolution 24 " << (accepted ? "accepted" : "rejected") <<
+    "\n";
+
+  delete stomp_map;
+}
+
+uint32_t MapExprMismatches(Stomp::Map& map_a, Stomp::Map& map_b) {
+  Stomp::PixelVector pix_a, pix_b;
+  map_a.Pixels(pix_a);
+  map_b.Pixels(pix_b);
+  if (pix_a.size() != pix_b.size())
+    return (pix_a.size() > pix_b.size() ? pix_a.size() : pix_b.size());
+
+  uint32_t n_mismatch = 0;
+  for (uint32_t i=0;i<pix_a.size();i++) {
+    if ((pix_a[i].Resolution() != pix_b[i].Resolution()) ||
+	(pix_a[i].Pixnum() != pix_b[i].Pixnum()) ||
+	!Stomp::DoubleEQ(pix_a[i].Weight(), pix_b[i].Weight())) n_mismatch++;
+  }
+  return n_mismatch;
+}
+
+void MapExprTests() {
+  // A MapExpr should give exactly the same Map as the equivalent chain of Map
+  // operations, without building any of the intermediate Maps.
+  std::cout << "\n";
+  std::cout << "*************************\n";
+  std::cout << "*** Map MapExpr Tests ***\n";
+  std::cout << "*************************\n";
+  uint32_t pixelate_resolution = 4096;
+
+  Stomp::AngularCoordinate footprint_ang(20.0, 0.0,
+					 Stomp::AngularCoordinate::Survey);
+  Stomp::CircleBound footprint_circle(footprint_ang, 5.0);
+  Stomp::Map footprint_map(footprint_circle, 1.0, pixelate_resolution);
+
+  Stomp::AngularCoordinate depth_ang(22.0, 1.0,
+				     Stomp::AngularCoordinate::Survey);
+  Stomp::CircleBound depth_circle(depth_ang, 4.0);
+  Stomp::Map depth_map(depth_circle, 2.0, pixelate_resolution);
+
+  Stomp::AngularCoordinate completeness_ang(19.0, -1.0,
+					    Stomp::AngularCoordinate::Survey);
+  Stomp::CircleBound completeness_circle(completeness_ang, 4.0);
+  Stomp::Map completeness_map(completeness_circle, 0.9, pixelate_resolution);
+
+  // A handful of small holes for the exclusion masks.
+  Stomp::Map star_map;
+  for (uint32_t i=0;i<5;i++) {
+    Stomp::AngularCoordinate star_ang(18.0 + 1.0*i, -2.0 + 1.0*i,
+				      Stomp::AngularCoordinate::Survey);
+    Stomp::CircleBound star_circle(star_ang, 0.3);
+    Stomp::Map tmp_map(star_circle, 1.0, pixelate_resolution);
+    star_map.IngestMap(tmp_map, false);
+  }
+  Stomp::AngularCoordinate field_ang(21.0, -1.5,
+				     Stomp::AngularCoordinate::Survey);
+  Stomp::CircleBound field_circle(field_ang, 1.0);
+  Stomp::Map field_map(field_circle, 1.0, pixelate_resolution);
+
+  std::cout << "\tFootprint: " << footprint_map.Area() << " sq. degrees, " <<
+    "Depth: " << depth_map.Area() << " sq. degrees\n";
+  std::cout << "\tStars: " << star_map.Area() << " sq. degrees, " <<
+    "Fields: " << field_map.Area() << " sq. degrees\n";
+
+  // First, the full footprint chain.
+  Stomp::StompWatch stomp_watch;
+  stomp_watch.StartTimer();
+  Stomp::Map chain_map(footprint_circle, 1.0, pixelate_resolution);
+  chain_map.IntersectMap(depth_map);
+  chain_map.ExcludeMap(star_map, false);
+  chain_map.ExcludeMap(field_map, false);
+  chain_map.MultiplyMap(completeness_map);
+  stomp_watch.StopTimer();
+  std::cout << "\tMap chain: " << chain_map.Size() << " pixels, " <<
+    chain_map.Area() << " sq. degrees (" <<
+    stomp_watch.ElapsedTime() << "s)\n";
+
+  Stomp::Map expr_map;
+  stomp_watch.StartTimer();
+  Stomp::MapExpr expr = Stomp::MapExpr(footprint_map).Intersect(depth_map).
+    Exclude(star_map).Exclude(field_map).Multiply(completeness_map);
+  expr.Evaluate(expr_map);
+  stomp_watch.StopTimer();
+  std::cout << "\tMapExpr: " << expr_map.Size() << " pixels, " <<
+    expr_map.Area() << " sq. degrees (" <<
+    stomp_watch.ElapsedTime() << "s, " << expr.NThreads() << " threads)\n";
+  std::cout << "\t\t" << MapExprMismatches(chain_map, expr_map) <<
+    " mismatched pixels\n";
+
+  // For maps with the same weight, Union should match IngestMap.  Where the
+  // weights differ, Union gives the overlap the average weight, so it should
+  // have the same area as the equivalent AddMap.
+  Stomp::Map ingest_map(footprint_circle, 1.0, pixelate_resolution);
+  Stomp::Map unit_depth_map(depth_circle, 1.0, pixelate_resolution);
+  ingest_map.IngestMap(unit_depth_map, false);
+  (Stomp::MapExpr(footprint_map) | unit_depth_map).Evaluate(expr_map);
+  std::cout << "\tUnion: " << expr_map.Area() << " (" <<
+    ingest_map.Area() << ") sq. degrees, " <<
+    MapExprMismatches(ingest_map, expr_map) << " mismatched pixels\n";
+  (Stomp::MapExpr(footprint_map) | depth_map).Evaluate(expr_map);
+  std::cout << "\t\tWeighted union: " << expr_map.Area() <<
+    " sq. degrees, weights " << expr_map.MinWeight() << " - " <<
+    expr_map.MaxWeight() << "\n";
+
+  // Keeping the non-overlapping area with AddMap and MultiplyMap.
+  Stomp::Map add_map(footprint_circle, 1.0, pixelate_resolution);
+  add_map.AddMap(depth_map, false);
+  Stomp::MapExpr(footprint_map).Add(depth_map, false).Evaluate(expr_map);
+  std::cout << "\tAdd: " << expr_map.Area() << " (" <<
+    add_map.Area() << ") sq. degrees, " <<
+    MapExprMismatches(add_map, expr_map) << " mismatched pixels\n";
+
+  Stomp::Map multiply_map(footprint_circle, 1.0, pixelate_resolution);
+  multiply_map.MultiplyMap(completeness_map, false);
+  multiply_map.ScaleWeight(2.0);
+  Stomp::MapExpr(footprint_map).Multiply(completeness_map, false).
+    ScaleWeight(2.0).Evaluate(expr_map);
+  std::cout << "\tMultiply + Scale: " << expr_map.Area() << " (" <<
+    multiply_map.Area() << ") sq. degrees, " <<
+    MapExprMismatches(multiply_map, expr_map) << " mismatched pixels\n";
+
+  // Finally, the output Map can be one of the operands.
+  Stomp::Map exclude_map(footprint_circle, 1.0, pixelate_resolution);
+  exclude_map.ExcludeMap(star_map, false);
+  Stomp::Map self_map(footprint_circle, 1.0, pixelate_resolution);
+  (Stomp::MapExpr(self_map) - star_map).Evaluate(self_map);
+  std::cout << "\tIn place exclusion: " << self_map.Area() << " (" <<
+    exclude_map.Area() << ") sq. degrees, " <<
+    MapExprMismatches(exclude_map, self_map) << " mismatched pixels\n";
+}
+
+uint32_t MapInitializeMismatches(Stomp::Map& stomp_map) {
+  // Compare the incrementally maintained summary statistics against a fresh
+  // Map built from the same pixels.
+  Stomp::PixelVector pix;
+  stomp_map.Pixels(pix);
+  Stomp::Map fresh_map(pix, false);
+
+  // The area is a running sum, so we allow for some round-off.
+  uint32_t n_mismatch = 0;
+  if (fabs(stomp_map.Area() - fresh_map.Area()) > 1.0e-10*fresh_map.Area())
+    n_mismatch++;
+  if (stomp_map.Size() != fresh_map.Size()) n_mismatch++;
+  if (stomp_map.MinLevel() != fresh_map.MinLevel()) n_mismatch++;
+  if (stomp_map.MaxLevel() != fresh_map.MaxLevel()) n_mismatch++;
+  if (!Stomp::DoubleEQ(stomp_map.MinWeight(), fresh_map.MinWeight()))
+    n_mismatch++;
+  if (!Stomp::DoubleEQ(stomp_map.MaxWeight(), fresh_map.MaxWeight()))
+    n_mismatch++;
+  for (uint32_t resolution=Stomp::HPixResolution;
+       resolution<=Stomp::MaxPixelResolution;resolution*=2) {
+    if (stomp_map.PixelCount(resolution) != fresh_map.PixelCount(resolution))
+      n_mismatch++;
+  }
+  return n_mismatch;
+}
+
+void MapInitializeTests() {
+  // Once a Map has been built, changes to a few superpixels should only
+  // update the summary statistics for those superpixels and shouldn't wipe
+  // out the regions unless the coverage at the region resolution changes.
+  std::cout << "\n";
+  std::cout << "****************************\n";
+  std::cout << "*** Map Initialize Tests ***\n";
+  std::cout << "****************************\n";
+  uint32_t pixelate_resolution = 2048;
+  Stomp::AngularCoordinate center_ang(20.0, 0.0,
+				      Stomp::AngularCoordinate::Survey);
+  Stomp::CircleBound center_circle(center_ang, 8.0);
+  Stomp::Map stomp_map(center_circle, 1.0, pixelate_resolution);
+
+  uint16_t n_regions = stomp_map.InitializeRegions(20);
+  std::cout << "\tMap: " << stomp_map.Area() << " sq. degrees, " <<
+    stomp_map.Size() << " pixels, " << n_regions << " regions at " <<
+    stomp_map.RegionResolution() << "\n";
+
+  // A hole well inside one of the region pixels shouldn't change the region
+  // coverage, so the regions should survive with updated areas.
+  Stomp::Pixel region_pix(center_ang, stomp_map.RegionResolution(), 1.0);
+  Stomp::AngularCoordinate hole_ang;
+  region_pix.Ang(hole_ang);
+  Stomp::CircleBound hole_circle(hole_ang, 0.02);
+  Stomp::Map hole_map(hole_circle, 1.0, pixelate_resolution);
+  stomp_map.ExcludeMap(hole_map, false);
+
+  double region_area = 0.0;
+  for (uint16_t region=0;region<stomp_map.NRegion();region++)
+    region_area += stomp_map.RegionArea(region);
+  std::cout << "\tSmall hole: " << stomp_map.NRegion() << " regions; " <<
+    "total region area " << region_area << " (" << stomp_map.Area() <<
+    ") sq. degrees\n";
+  std::cout << "\t\t" << MapInitializeMismatches(stomp_map) <<
+    " mismatched statistics\n";
+
+  // Raising the weight in part of the map and then cutting on it changes the
+  // weight range and the pixel counts.
+  Stomp::AngularCoordinate bump_ang(22.0, 2.0,
+				    Stomp::AngularCoordinate::Survey);
+  Stomp::CircleBound bump_circle(bump_ang, 2.0);
+  Stomp::Map bump_map(bump_circle, 2.0, pixelate_resolution);
+  stomp_map.AddMap(bump_map, false);
+  std::cout << "\tAdded weight: " << stomp_map.MinWeight() << " - " <<
+    stomp_map.MaxWeight() << ", " << MapInitializeMismatches(stomp_map) <<
+    " mismatched statistics\n";
+  stomp_map.SetMinimumWeight(2.5);
+  std::cout << "\tWeight cut: " << stomp_map.Area() << " sq. degrees, " <<
+    stomp_map.MinWeight() << " - " << stomp_map.MaxWeight() << ", " <<
+    MapInitializeMismatches(stomp_map) << " mismatched statistics, " <<
+    stomp_map.NRegion() << " regions\n";
+
+  // Adding pixels one at a time should keep the statistics current until
+  // the next Initialize call sorts everything out.
+  Stomp::Map pixel_map;
+  Stomp::PixelVector pix;
+  bump_map.Pixels(pix);
+  for (Stomp::PixelIterator iter=pix.begin();iter!=pix.end();++iter)
+    pixel_map.AddPixel(*iter);
+  std::cout << "\tAddPixel: " << pixel_map.Area() << " (" <<
+    bump_map.Area() << ") sq. degrees before Initialize; ";
+  pixel_map.Initialize();
+  std::cout << MapInitializeMismatches(pixel_map) <<
+    " mismatched statistics after\n";
+
+  // Now time the update for a change to a single superpixel, alternately
+  // adding a pixel well away from the rest of the map and clearing it out.
+  Stomp::Map big_map(center_circle, 1.0, pixelate_resolution);
+  Stomp::AngularCoordinate far_ang(-20.0, 60.0,
+				   Stomp::AngularCoordinate::Survey);
+  Stomp::Pixel far_pix(far_ang, pixelate_resolution, 3.0);
+  Stomp::StompWatch stomp_watch;
+  uint32_t n_trials = 100;
+  stomp_watch.StartTimer();
+  for (uint32_t i=0;i<n_trials;i++) {
+    if (i%2 == 0) {
+      big_map.AddPixel(far_pix);
+    } else {
+      big_map.Clear(far_pix.Superpixnum());
+    }
+    big_map.Initialize();
+  }
+  stomp_watch.StopTimer();
+  std::cout << "\t" << n_trials << " single superpixel updates: " <<
+    stomp_watch.ElapsedTime()/n_trials << "s per Initialize; " <<
+    MapInitializeMismatches(big_map) << " mismatched statistics\n";
+}
+
+void MapCacheTests() {
+  // The Map fingerprint should only depend on the Map contents and products
+  // loaded from the MapCache should match the ones calculated directly.
+  std::cout << "\n";
+  std::cout << "***********************\n";
+  std::cout << "*** Map Cache Tests ***\n";
+  std::cout << "***********************\n";
+  uint32_t pixelate_resolution = 2048;
+  Stomp::AngularCoordinate center_ang(20.0, 0.0,
+				      Stomp::AngularCoordinate::Survey);
+  Stomp::CircleBound center_circle(center_ang, 6.0);
+  Stomp::Map stomp_map(center_circle, 1.0, pixelate_resolution);
+  Stomp::Map same_map(center_circle, 1.0, pixelate_resolution);
+
+  uint64_t fingerprint = stomp_map.Fingerprint();
+  std::cout << "\tFingerprint: " << std::hex << fingerprint << std::dec <<
+    "; identical Map " <<
+    (same_map.Fingerprint() == fingerprint ? "matches" : "DIFFERS") << "\n";
+
+  // Changing the weights or the area should change the fingerprint, but only
+  // for the superpixels that changed.
+  Stomp::AngularCoordinate hole_ang(20.0, 3.0,
+				    Stomp::AngularCoordinate::Survey);
+  Stomp::Pixel hole_pix(hole_ang, pixelate_resolution, 1.0);
+  Stomp::CircleBound hole_circle(hole_ang, 0.1);
+  Stomp::Map hole_map(hole_circle, 1.0, pixelate_resolution);
+  same_map.ExcludeMap(hole_map, false);
+  uint32_t n_changed = 0;
+  for (uint32_t k=0;k<Stomp::MaxSuperpixnum;k++)
+    if (same_map.Fingerprint(k) != stomp_map.Fingerprint(k)) n_changed++;
+  std::cout << "\tHole: fingerprint " <<
+    (same_map.Fingerprint() != fingerprint ? "changed" : "UNCHANGED") <<
+    ", " << n_changed << " superpixel(s) changed\n";
+  same_map.ScaleWeight(2.0);
+  uint64_t scaled_fingerprint = same_map.Fingerprint();
+  same_map.ScaleWeight(0.5);
+  std::cout << "\tScaled weight: fingerprint " <<
+    (scaled_fingerprint != same_map.Fingerprint() ? "changed" : "UNCHANGED") <<
+    "\n";
+
+  // Now run each product through the cache twice.  The first pass should
+  // miss and calculate the products; the second should load them.
+  Stomp::MapCache map_cache("stomp_map_cache_test");
+  map_cache.ClearCache();
+
+  Stomp::StompWatch stomp_watch;
+  for (uint32_t pass=0;pass<2;pass++) {
+    stomp_watch.StartTimer();
+    Stomp::PixelVector coverage_pix;
+    map_cache.Coverage(stomp_map, coverage_pix, 256);
+    Stomp::Map covering_map, soft_map;
+    bool covering_ok = map_cache.Covering(stomp_map, covering_map, 100);
+    map_cache.Soften(stomp_map, soft_map, 256, true);
+    Stomp::ScalarMap scalar_map;
+    map_cache.InitializeScalarMap(stomp_map, scalar_map, 256,
+				  Stomp::ScalarMap::DensityField);
+    Stomp::Map region_map(center_circle, 1.0, pixelate_resolution);
+    uint16_t n_regions = map_cache.InitializeRegions(region_map, 10, 64);
+    Stomp::AngularVector ang;
+    map_cache.GenerateRandomPoints(stomp_map, ang, 10000, false, 12345);
+    stomp_watch.StopTimer();
+
+    // Compare against the products calculated directly.
+    Stomp::PixelVector check_pix;
+    stomp_map.Coverage(check_pix, 256);
+    uint32_t n_mismatch = (check_pix.size() != coverage_pix.size() ? 1 : 0);
+    for (uint32_t i=0;(i<check_pix.size()) && (n_mismatch == 0);i++)
+      if ((check_pix[i].Pixnum() != coverage_pix[i].Pixnum()) ||
+	  (check_pix[i].Weight() != coverage_pix[i].Weight())) n_mismatch++;
+    Stomp::Map check_map;
+    if (stomp_map.Covering(check_map, 100) != covering_ok) n_mismatch++;
+    if (check_map.Fingerprint() != covering_map.Fingerprint()) n_mismatch++;
+    stomp_map.Soften(check_map, 256, true);
+    if (check_map.Fingerprint() != soft_map.Fingerprint()) n_mismatch++;
+    Stomp::ScalarMap check_scalar_map(stomp_map, 256,
+				      Stomp::ScalarMap::DensityField);
+    if ((check_scalar_map.Size() != scalar_map.Size()) ||
+	(check_scalar_map.Area() != scalar_map.Area()) ||
+	(check_scalar_map.MapType() != scalar_map.MapType())) n_mismatch++;
+    Stomp::Map check_region_map(center_circle, 1.0, pixelate_resolution);
+    if (check_region_map.InitializeRegions(10, 64) != n_regions)
+      n_mismatch++;
+    for (uint16_t region=0;region<n_regions;region++)
+      if (fabs(check_region_map.RegionArea(region) -
+	       region_map.RegionArea(region)) > 1.0e-10) n_mismatch++;
+    Stomp::AngularVector check_ang;
+    stomp_map.GenerateRandomPoints(check_ang, 10000, false, 12345);
+    if (check_ang.size() != ang.size()) n_mismatch++;
+    for (uint32_t i=0;(i<check_ang.size()) && (n_mismatch == 0);i++)
+      if ((fabs(check_ang[i].UnitSphereX() - ang[i].UnitSphereX()) > 1.0e-12) ||
+	  (fabs(check_ang[i].UnitSphereY() - ang[i].UnitSphereY()) > 1.0e-12) ||
+	  (fabs(check_ang[i].UnitSphereZ() - ang[i].UnitSphereZ()) > 1.0e-12))
+	n_mismatch++;
+
+    std::cout << "\t" << (pass == 0 ? "First" : "Second") << " pass: " <<
+      map_cache.Hits() << " hits, " << map_cache.Misses() << " misses, " <<
+      stomp_watch.ElapsedTime() << "s; " << n_mismatch <<
+      " mismatched products\n";
+  }
+
+  std::cout << "\tRemoved " << map_cache.ClearCache() << " cache files\n";
+}
+
+void MapSerializeTests() {
+  // The binary Serialize and Deserialize methods should restore each of the
+  // map classes exactly and much more quickly than the ASCII Write and Read.
+  std::cout << "\n";
+  std::cout << "***************************\n";
+  std::cout << "*** Map Serialize Tests ***\n";
+  std::cout << "***************************\n";
+  uint32_t pixelate_resolution = 2048;
+  Stomp::AngularCoordinate center_ang(20.0, 0.0,
+				      Stomp::AngularCoordinate::Survey);
+  Stomp::CircleBound center_circle(center_ang, 6.0);
+  Stomp::Map stomp_map(center_circle, 1.0, pixelate_resolution);
+  uint16_t n_regions = stomp_map.InitializeRegions(10, 64);
+
+  Stomp::StompWatch stomp_watch;
+  std::string buffer;
+  stomp_watch.StartTimer();
+  stomp_map.Serialize(buffer);
+  Stomp::Map new_map;
+  bool map_ok = new_map.Deserialize(buffer);
+  stomp_watch.StopTimer();
+  uint32_t n_mismatch = 0;
+  if (new_map.Fingerprint() != stomp_map.Fingerprint()) n_mismatch++;
+  if (new_map.NRegion() != n_regions) n_mismatch++;
+  for (uint16_t region=0;region<n_regions;region++)
+    if (fabs(new_map.RegionArea(region) - stomp_map.RegionArea(region)) >
+	1.0e-10) n_mismatch++;
+  std::cout << "\tMap: " << buffer.size() << " bytes, " <<
+    stomp_watch.ElapsedTime() << "s; " << (map_ok ? "restored" : "FAILED") <<
+    " with " << n_mismatch << " mismatches\n";
+
+  stomp_watch.StartTimer();
+  stomp_map.Write("stomp_serialize_test.map");
+  Stomp::Map read_map("stomp_serialize_test.map");
+  stomp_watch.StopTimer();
+  std::cout << "\tMap Write/Read: " << stomp_watch.ElapsedTime() << "s\n";
+  remove("stomp_serialize_test.map");
+
+  // A truncated buffer should leave the Map alone.
+  std::string short_buffer = buffer.substr(0, buffer.size()/2);
+  std::cout << "\tTruncated buffer: " <<
+    (new_map.Deserialize(short_buffer) ? "ACCEPTED" : "rejected") <<
+    "; Map " << (new_map.Fingerprint() == stomp_map.Fingerprint() ?
+		 "unchanged" : "CHANGED") << "\n";
+
+  // So should a pixel level or position outside the valid range.  The x, y
+  // and level vectors follow the tag and version, each with its length.
+  size_t x_offset =
+    sizeof(uint32_t) + std::string("Stomp::Map").size() + sizeof(uint32_t);
+  uint32_t n_pix = 0;
+  memcpy(&n_pix, buffer.data() + x_offset, sizeof(uint32_t));
+  size_t level_offset =
+    x_offset + 2*sizeof(uint32_t)*(1 + n_pix) + sizeof(uint32_t);
+  std::string bad_level_buffer = buffer;
+  bad_level_buffer[level_offset] = static_cast<char>(40);
+  std::string bad_x_buffer = buffer;
+  uint32_t bad_x = 0xfffffff0;
+  bad_x_buffer.replace(x_offset + sizeof(uint32_t), sizeof(uint32_t),
+		       reinterpret_cast<const char*>(&bad_x),
+		       sizeof(uint32_t));
+  bool bad_level_ok = new_map.Deserialize(bad_level_buffer);
+  bool bad_x_ok = new_map.Deserialize(bad_x_buffer);
+  std::cout << "\tCorrupt pixel level: " <<
+    (bad_level_ok ? "ACCEPTED" : "rejected") << "; corrupt pixel x: " <<
+    (bad_x_ok ? "ACCEPTED" : "rejected") << "; Map " <<
+    (new_map.Fingerprint() == stomp_map.Fingerprint() ?
+     "unchanged" : "CHANGED") << "\n";
+
+  Stomp::AngularVector ang;
+  stomp_map.GenerateRandomPoints(ang, 10000, false, 12345);
+  Stomp::ScalarMap scalar_map(stomp_map, 256, Stomp::ScalarMap::DensityField);
+  for (uint32_t i=0;i<ang.size();i++) scalar_map.AddToMap(ang[i]);
+  scalar_map.ConvertToOverDensity();
+  scalar_map.Serialize(buffer);
+  Stomp::ScalarMap new_scalar_map;
+  bool scalar_ok = new_scalar_map.Deserialize(buffer);
+  n_mismatch = 0;
+  if ((new_scalar_map.Size() != scalar_map.Size()) ||
+      (new_scalar_map.Area() != scalar_map.Area()) ||
+      (new_scalar_map.NPoints() != scalar_map.NPoints()) ||
+      (new_scalar_map.MeanIntensity() != scalar_map.MeanIntensity()) ||
+      (new_scalar_map.IsOverDensityMap() != scalar_map.IsOverDensityMap()))
+    n_mismatch++;
+  for (Stomp::ScalarIterator iter=scalar_map.Begin(),
+	 new_iter=new_scalar_map.Begin();
+       (iter!=scalar_map.End()) && (n_mismatch == 0);++iter,++new_iter)
+    if ((iter->Pixnum() != new_iter->Pixnum()) ||
+	(iter->Intensity() != new_iter->Intensity())) n_mismatch++;
+  std::cout << "\tScalarMap: " << buffer.size() << " bytes; " <<
+    (scalar_ok ? "restored" : "FAILED") << " with " << n_mismatch <<
+    " mismatches\n";
+
+  // The resolution comes first, right after the tag and version.
+  std::string bad_scalar_buffer = buffer;
+  uint32_t bad_resolution = 24;
+  bad_scalar_buffer.replace(
+    sizeof(uint32_t) + std::string("Stomp::ScalarMap").size() +
+    sizeof(uint32_t), sizeof(uint32_t),
+    reinterpret_cast<const char*>(&bad_resolution), sizeof(uint32_t));
+  bool bad_scalar_ok = new_scalar_map.Deserialize(bad_scalar_buffer);
+  std::cout << "\tCorrupt ScalarMap resolution: " <<
+    (bad_scalar_ok ? "ACCEPTED" : "rejected") << "; ScalarMap " <<
+    (new_scalar_map.Size() == scalar_map.Size() ? "unchanged" : "CHANGED") <<
+    "\n";
+
+  Stomp::TreeMap tree_map(64);
+  for (uint32_t i=0;i<ang.size();i++) {
+    Stomp::WeightedAngularCoordinate w_ang(ang[i].UnitSphereX(),
+					   ang[i].UnitSphereY(),
+					   ang[i].UnitSphereZ(), 1.0 + 0.1*i);
+    w_ang.SetField("magnitude", 20.0 + 0.001*i);
+    tree_map.AddPoint(w_ang);
+  }
+  tree_map.InitializeRegions(stomp_map);
+  tree_map.Serialize(buffer);
+  Stomp::TreeMap new_tree_map;
+  bool tree_ok = new_tree_map.Deserialize(buffer);
+  n_mismatch = 0;
+  if ((new_tree_map.NPoints() != tree_map.NPoints()) ||
+      (fabs(new_tree_map.Weight() - tree_map.Weight()) > 1.0e-6) ||
+      (fabs(new_tree_map.FieldTotal("magnitude") -
+	    tree_map.FieldTotal("magnitude")) > 1.0e-6) ||
+      (new_tree_map.NRegion() != tree_map.NRegion())) n_mismatch++;
+  std::cout << "\tTreeMap: " << buffer.size() << " bytes; " <<
+    (tree_ok ? "restored" : "FAILED") << " with " << n_mismatch <<
+    " mismatches\n";
+
+  // A corrupt Field count (just after the tag, the settings and the four
+  // coordinate and weight vectors) should be caught before it is used to
+  // size anything.
+  std::string bad_buffer = buffer;
+  size_t n_field_offset =
+    sizeof(uint32_t) + std::string("Stomp::TreeMap").size() +
+    2*sizeof(uint32_t) + sizeof(uint16_t) + 2*sizeof(uint8_t) +
+    sizeof(double) + 4*(sizeof(uint32_t) + ang.size()*sizeof(double));
+  uint32_t bad_n_field = 0xfffffff0;
+  bad_buffer.replace(n_field_offset, sizeof(uint32_t),
+		     reinterpret_cast<const char*>(&bad_n_field),
+		     sizeof(uint32_t));
+  bool bad_ok = new_tree_map.Deserialize(bad_buffer);
+  std::cout << "\tCorrupt TreeMap Field count: " <<
+    (bad_ok ? "ACCEPTED" : "rejected") << "; TreeMap " <<
+    (new_tree_map.NPoints() == tree_map.NPoints() ? "unchanged" : "CHANGED") <<
+    "\n";
+
+  Stomp::IndexedTreeMap itree_map;
+  for (uint32_t i=0;i<ang.size();i++) itree_map.AddPoint(ang[i], i);
+  itree_map.Serialize(buffer);
+  Stomp::IndexedTreeMap new_itree_map;
+  bool itree_ok = new_itree_map.Deserialize(buffer);
+  n_mismatch = (new_itree_map.NPoints() != itree_map.NPoints() ? 1 : 0);
+  Stomp::IAngularVector i_ang, new_i_ang;
+  itree_map.Points(i_ang);
+  new_itree_map.Points(new_i_ang);
+  if (i_ang.size() != new_i_ang.size()) n_mismatch++;
+  for (uint32_t i=0;(i<i_ang.size()) && (n_mismatch == 0);i++)
+    if ((i_ang[i].Index() != new_i_ang[i].Index()) ||
+	(i_ang[i].UnitSphereX() != new_i_ang[i].UnitSphereX())) n_mismatch++;
+  std::cout << "\tIndexedTreeMap: " << buffer.size() << " bytes; " <<
+    (itree_ok ? "restored" : "FAILED") << " with " << n_mismatch <<
+    " mismatches\n";
+
+  Stomp::AngularCorrelation wtheta(0.01, 1.0, 6.0);
+  wtheta.InitializeRegions(n_regions);
+  for (Stomp::ThetaIterator iter=wtheta.Begin(0);iter!=wtheta.End(0);++iter) {
+    iter->AddToPixelWtheta(0.5*iter->Theta(), 2.0, 1, 2);
+    iter->AddToWeight(iter->Theta(), 3);
+    iter->MoveWeightToGalGal();
+  }
+  wtheta.Serialize(buffer);
+  Stomp::AngularCorrelation new_wtheta;
+  bool wtheta_ok = new_wtheta.Deserialize(buffer);
+  n_mismatch = 0;
+  if ((new_wtheta.NBins() != wtheta.NBins()) ||
+      (new_wtheta.MinResolution() != wtheta.MinResolution()) ||
+      (new_wtheta.NRegion() != wtheta.NRegion()) ||
+      (new_wtheta.End(0) - new_wtheta.Begin(0) !=
+       wtheta.End(0) - wtheta.Begin(0))) n_mismatch++;
+  for (Stomp::ThetaIterator iter=wtheta.Begin(0),new_iter=new_wtheta.Begin(0);
+       (iter!=wtheta.End(0)) && (n_mismatch == 0);++iter,++new_iter)
+    if ((iter->Theta() != new_iter->Theta()) ||
+	(iter->Wtheta(1) != new_iter->Wtheta(1)) ||
+	(iter->GalGal(3) != new_iter->GalGal(3))) n_mismatch++;
+  std::cout << "\tAngularCorrelation: " << buffer.size() << " bytes; " <<
+    (wtheta_ok ? "restored" : "FAILED") << " with " << n_mismatch <<
+    " mismatches\n";
+}
+
+void MapSplitRegionTests() {
+  // SplitByRegion should produce the same Maps as calling RegionOnlyMap and
+  // RegionExcludedMap for each region in turn.
+  std::cout << "\n";
+  std::cout << "******************************\n";
+  std::cout << "*** Map Split Region Tests ***\n";
+  std::cout << "******************************\n";
+  Stomp::AngularCoordinate center_ang(20.0, 0.0,
+				      Stomp::AngularCoordinate::Survey);
+  Stomp::CircleBound center_circle(center_ang, 8.0);
+  Stomp::Map stomp_map(center_circle, 1.0, 1024);
+  stomp_map.InitializeRegions(20, 64);
+
+  // The second Map takes its regions from a smaller Map, so the outer ring is
+  // outside the regionation.
+  Stomp::CircleBound inner_circle(center_ang, 5.0);
+  Stomp::Map inner_map(inner_circle, 1.0, 1024);
+  inner_map.InitializeRegions(10, 64);
+  Stomp::Map partial_map(center_circle, 1.0, 1024);
+  partial_map.InitializeRegions(inner_map);
+
+  for (uint8_t partial=0;partial<2;partial++) {
+    Stomp::Map& split_map = (partial == 1 ? partial_map : stomp_map);
+    uint16_t n_regions = split_map.NRegion();
+    if (partial == 1)
+      std::cout << "\tPartially regionated map (" <<
+	inner_map.Area() << " of " << split_map.Area() << " sq. deg.):\n";
+
+    for (uint8_t exclude=0;exclude<2;exclude++) {
+      Stomp::StompWatch stomp_watch;
+      stomp_watch.StartTimer();
+      Stomp::MapVector region_maps;
+      split_map.SplitByRegion(region_maps, exclude == 1);
+      stomp_watch.StopTimer();
+      double split_time = stomp_watch.ElapsedTime();
+
+      uint32_t n_mismatch = (region_maps.size() != n_regions ? 1 : 0);
+      double total_area = 0.0, expected_area = 0.0;
+      stomp_watch.StartTimer();
+      for (int16_t region=0;(region<n_regions) && (n_mismatch == 0);
+	   region++) {
+	Stomp::Map region_map;
+	if (exclude == 1) {
+	  split_map.RegionExcludedMap(region, region_map);
+	} else {
+	  split_map.RegionOnlyMap(region, region_map);
+	}
+	if ((fabs(region_map.Area() - region_maps[region].Area()) > 1.0e-8) ||
+	    !region_map.Contains(region_maps[region]) ||
+	    !region_maps[region].Contains(region_map)) n_mismatch++;
+	total_area += region_maps[region].Area();
+	expected_area += region_map.Area();
+      }
+      stomp_watch.StopTimer();
+
+      std::cout << "\t" << (exclude == 1 ? "Excluded" : "Region only") <<
+	": " << n_regions << " maps in " << split_time << "s (vs. " <<
+	stomp_watch.ElapsedTime() << "s); " << n_mismatch <<
+	" mismatches; total area " << total_area << " (" <<
+	expected_area << ")\n";
+    }
+  }
+}
+
+void MapOverlapTests() {
+  // The overlap measures should agree with building the intersection.
+  std::cout << "\n";
+  std::cout << "*************************\n";
+  std::cout << "*** Map Overlap Tests ***\n";
+  std::cout << "*************************\n";
+  Stomp::AngularCoordinate ang_a(20.0, 10.0, Stomp::AngularCoordinate::Survey);
+  Stomp::AngularCoordinate ang_b(21.5, 11.0, Stomp::AngularCoordinate::Survey);
+  Stomp::CircleBound circle_a(ang_a, 3.0);
+  Stomp::CircleBound circle_b(ang_b, 2.0);
+  Stomp::Map map_a(circle_a, 1.0, 2048);
+  Stomp::Map map_b(circle_b, 2.0, 512);
+
+  Stomp::StompWatch stomp_watch;
+  stomp_watch.StartTimer();
+  double overlap_area = map_a.OverlapArea(map_b);
+  stomp_watch.StopTimer();
+  double overlap_time = stomp_watch.ElapsedTime();
+
+  stomp_watch.StartTimer();
+  Stomp::Map intersect_map = map_a;
+  intersect_map.IntersectMap(map_b);
+  stomp_watch.StopTimer();
+
+  std::cout << "\tOverlap area: " << overlap_area << " sq. degrees in " <<
+    overlap_time << "s (IntersectMap: " << intersect_map.Area() <<
+    " sq. degrees in " << stomp_watch.ElapsedTime() << "s)\n";
+  std::cout << "\tReversed: " << map_b.OverlapArea(map_a) <<
+    "; Unmasked fraction: " << map_a.FindUnmaskedFraction(map_b) << " (" <<
+    intersect_map.Area()/map_b.Area() << ")\n";
+  std::cout << "\tWeighted overlap: " << map_a.WeightedOverlapArea(map_b) <<
+    " (" << 2.0*intersect_map.Area() << ")\n";
+  std::cout << "\tJaccard index: " << map_a.JaccardIndex(map_b) << " (" <<
+    intersect_map.Area()/
+    (map_a.Area() + map_b.Area() - intersect_map.Area()) << ")\n";
+
+  std::vector<uint32_t> superpixnum;
+  std::vector<double> superpix_area, superpix_weighted_area;
+  map_a.OverlapTable(map_b, superpixnum, superpix_area, superpix_weighted_area);
+  uint32_t n_mismatch = 0;
+  for (uint32_t i=0;i<superpixnum.size();i++)
+    if (fabs(superpix_area[i] - intersect_map.Area(superpixnum[i])) > 1.0e-8)
+      n_mismatch++;
+  std::cout << "\t" << superpixnum.size() << " overlapping superpixels, " <<
+    n_mismatch << " mismatched with IntersectMap\n";
+
+  if (map_a.Contains(intersect_map) && !map_a.Contains(map_b) &&
+      (map_a.FindUnmaskedStatus(map_b) == -1)) {
+    std::cout << "\tGood: Contains and FindUnmaskedStatus agree\n";
+  } else {
+    std::cout << "\tBad: Contains and FindUnmaskedStatus disagree\n";
+  }
+
+  // A disjoint Map shouldn't need any sweeping at all before IntersectMap
+  // and ImprintMap give up.
+  Stomp::AngularCoordinate ang_c(-20.0, 100.0,
+				 Stomp::AngularCoordinate::Survey);
+  Stomp::CircleBound circle_c(ang_c, 3.0);
+  Stomp::Map map_c(circle_c, 1.0, 2048);
+  Stomp::Map disjoint_map = map_a;
+  stomp_watch.StartTimer();
+  bool intersected = disjoint_map.IntersectMap(map_c);
+  bool imprinted = disjoint_map.ImprintMap(map_c);
+  stomp_watch.StopTimer();
+  std::cout << "\tDisjoint maps: IntersectMap " <<
+    (intersected ? "true" : "false") << ", ImprintMap " <<
+    (imprinted ? "true" : "false") << " (false, false) in " <<
+    stomp_watch.ElapsedTime() << "s; overlap area " <<
+    map_a.OverlapArea(map_c) << "\n";
+}
+
+void MapMaskServerTests() {
+  // Queries through a MaskServer should match the same queries on the Map.
+  std::cout << "\n";
+  std::cout << "*****************************\n";
+  std::cout << "*** Map Mask Server Tests ***\n";
+  std::cout << "*****************************\n";
+  Stomp::AngularCoordinate center_ang(20.0, 0.0,
+				      Stomp::AngularCoordinate::Survey);
+  Stomp::CircleBound center_circle(center_ang, 4.0);
+  Stomp::Map stomp_map(center_circle, 2.5, 1024);
+  stomp_map.InitializeRegions(8);
+
+  Stomp::Map* served_map = new Stomp::Map(center_circle, 2.5, 1024);
+  served_map->InitializeRegions(8);
+
+  std::ostringstream socket_path;
+  socket_path << "/tmp/stomp_mask_server_test." << getpid() << ".sock";
+  // A single worker thread has to share itself between both of the clients
+  // below, which keep their connections open throughout.
+  Stomp::MaskServer server;
+  server.SetNThreads(1);
+  server.AddMap("circle", served_map);
+  if (!server.Listen(socket_path.str())) {
+    std::cout << "\tBad: failed to start the MaskServer\n";
+    return;
+  }
+  std::thread server_thread(&Stomp::MaskServer::Serve, &server);
+
+  // Half of the random points fall outside of the Map.
+  Stomp::CircleBound outer_circle(center_ang, 4.0*sqrt(2.0));
+  Stomp::Map outer_map(outer_circle, 1.0, 256);
+  Stomp::AngularVector ang;
+  outer_map.GenerateRandomPoints(ang, 20000);
+
+  Stomp::MaskClient client(socket_path.str());
+  Stomp::MaskClient other_client(socket_path.str());
+  std::vector<std::string> map_names;
+  std::vector<double> area;
+  std::vector<uint16_t> n_region;
+  if (client.ListMaps(map_names, area, n_region) && (map_names.size() == 1)) {
+    std::cout << "\tServing " << map_names[0] << ": " << area[0] <<
+      " sq. degrees (" << stomp_map.Area() << "), " << n_region[0] <<
+      " regions\n";
+  } else {
+    std::cout << "\tBad: ListMaps failed\n";
+  }
+
+  std::vector<uint8_t> contained;
+  std::vector<double> weight;
+  std::vector<int16_t> region;
+  bool query_ok = client.Contains("circle", ang, contained) &&
+    other_client.Region("circle", ang, region) &&
+    client.Weight("circle", ang, weight);
+
+  uint32_t n_inside = 0, n_mismatch = 0;
+  for (uint32_t i=0;query_ok&&(i<ang.size());i++) {
+    bool inside = stomp_map.Contains(ang[i]);
+    if (inside) n_inside++;
+    double map_weight = (inside ? stomp_map.FindLocationWeight(ang[i]) : 0.0);
+    int16_t map_region = (inside ? stomp_map.FindRegion(ang[i]) : -1);
+    if ((inside != (contained[i] == 1)) || (weight[i] != map_weight) ||
+	(region[i] != map_region)) n_mismatch++;
+  }
+  std::cout << "\t" << ang.size() << " points, " << n_inside <<
+    " inside the Map, " << n_mismatch << " mismatched\n";
+
+  // The connection should survive a request for a Map that isn't there.
+  bool unknown_ok = client.Contains("missing", ang, contained);
+  std::cout << "\tUnknown Map: " << (unknown_ok ? "BAD" : "refused") <<
+    "; connection " << (client.Connected() ? "still open" : "CLOSED") << "\n";
+
+  if (query_ok && (n_mismatch == 0) && !unknown_ok && client.Connected()) {
+    std::cout << "\tGood: MaskServer queries match the Map\n";
+  } else {
+    std::cout << "\tBad: MaskServer queries don't match the Map\n";
+  }
+
+  client.Close();
+  other_client.Close();
+  server.Stop();
+  server_thread.join();
+}
+
+void MapRasterTests() {
+  // The rasterized images should conserve the Map area, be fully covered
+  // inside the Map and agree with the look-ups at the cell centers away from
+  // the edges.
+  std::cout << "\n";
+  std::cout << "************************\n";
+  std::cout << "*** Map Raster Tests ***\n";
+  std::cout << "************************\n";
+  Stomp::AngularCoordinate center_ang(20.0, 0.0,
+				      Stomp::AngularCoordinate::Survey);
+  Stomp::CircleBound center_circle(center_ang, 4.0);
+  Stomp::Map stomp_map(center_circle, 2.5, 1024);
+
+  // Outside of the Survey system, the sub-pixels near the cell edges land on
+  // one side or the other, so the fractions are only good to roughly
+  // 1/RasterSubSampling.
+  Stomp::StompWatch stomp_watch;
+  for (uint8_t i=0;i<3;i++) {
+    Stomp::AngularCoordinate::Sphere sphere =
+      (i < 2 ? Stomp::AngularCoordinate::Survey :
+       Stomp::AngularCoordinate::Equatorial);
+    Stomp::MapRaster::Projection projection =
+      (i == 1 ? Stomp::MapRaster::EqualArea : Stomp::MapRaster::Cartesian);
+    double lon_center = (i < 2 ? center_ang.Eta() : center_ang.RA());
+    double lat_center = (i < 2 ? center_ang.Lambda() : center_ang.DEC());
+    Stomp::MapRaster raster(lon_center - 6.0, lon_center + 6.0,
+			    lat_center - 6.0, lat_center + 6.0, 120, 100,
+			    sphere, projection);
+
+    std::vector<double> fraction, weight;
+    stomp_watch.StartTimer();
+    raster.Rasterize(stomp_map, fraction);
+    stomp_watch.StopTimer();
+    raster.Rasterize(stomp_map, weight, Stomp::MapRaster::Weight);
+
+    double max_fraction =
+      1.0 + (i < 2 ? 1.0e-10 : 1.0/Stomp::RasterSubSampling);
+    double area = 0.0;
+    uint32_t n_bad = 0, n_center_mismatch = 0;
+    for (uint32_t y=0;y<raster.NY();y++) {
+      for (uint32_t x=0;x<raster.NX();x++) {
+	uint32_t k = y*raster.NX() + x;
+	area += fraction[k]*raster.CellArea(y);
+	if ((fraction[k] < 0.0) || (fraction[k] > max_fraction)) n_bad++;
+	if ((fraction[k] > 0.0) && (fabs(weight[k] - 2.5) > 1.0e-10)) n_bad++;
+
+	Stomp::AngularCoordinate ang;
+	raster.CellCenter(x, y, ang);
+	bool inside = stomp_map.Contains(ang);
+	if ((inside && (fraction[k] < 0.5)) || (!inside && (fraction[k] > 0.5)))
+	  n_center_mismatch++;
+      }
+    }
+
+    std::vector<double> thread_fraction;
+    raster.SetNThreads(3);
+    raster.Rasterize(stomp_map, thread_fraction);
+    double max_thread_diff = 0.0;
+    for (uint32_t k=0;k<raster.Size();k++) {
+      if (fabs(thread_fraction[k] - fraction[k]) > max_thread_diff)
+	max_thread_diff = fabs(thread_fraction[k] - fraction[k]);
+    }
+
+    std::cout << "\t" << (i == 0 ? "Survey Cartesian" :
+			  (i == 1 ? "Survey EqualArea" :
+			   "Equatorial Cartesian")) << ": " <<
+      stomp_watch.ElapsedTime() << "s; area " << area << " (" <<
+      stomp_map.Area() << "); " << n_bad << " bad cells, " <<
+      n_center_mismatch << " cell centers disagree; " <<
+      max_thread_diff << " max difference with 3 threads\n";
+  }
+
+  // For a ScalarMap, the unmasked fraction scales the pixel areas and the
+  // intensity is averaged over the covered area.
+  Stomp::ScalarMap scalar_map(stomp_map, 64, Stomp::ScalarMap::ScalarField);
+  for (Stomp::ScalarIterator iter=scalar_map.Begin();
+       iter!=scalar_map.End();++iter) iter->SetIntensity(3.0);
+  Stomp::MapRaster raster(center_ang.Eta() - 6.0, center_ang.Eta() + 6.0,
+			  center_ang.Lambda() - 6.0, center_ang.Lambda() + 6.0,
+			  60, 60);
+  std::vector<double> fraction, intensity;
+  raster.Rasterize(scalar_map, fraction, Stomp::MapRaster::UnmaskedFraction);
+  raster.Rasterize(scalar_map, intensity);
+  double area = 0.0;
+  uint32_t n_bad = 0;
+  for (uint32_t k=0;k<raster.Size();k++) {
+    area += fraction[k]*raster.CellArea(k/raster.NX());
+    if ((fraction[k] > 0.0) && (fabs(intensity[k] - 3.0) > 1.0e-10)) n_bad++;
+  }
+  std::vector<double> bad_image;
+  bool bad_field = raster.Rasterize(scalar_map, bad_image,
+				    Stomp::MapRaster::Weight);
+  std::cout << "\tScalarMap: area " << area << " (" << scalar_map.Area() <<
+    "); " << n_bad << " bad cells; Weight field " <<
+    (bad_field ? "accepted" : "rejected") << "\n";
+}
+
 // Define our command line flags here so we can use these flags later.
 DEFINE_bool(all_map_tests, false, "Run all class unit tests.");
 DEFINE_bool(map_basic_tests, false, "Run Map basic tests");
@@ -925,7 +1913,16 @@ DEFINE_bool(map_random_points_tests, false, "Run Map random points tests");
 DEFINE_bool(map_multimap_tests, false, "Run Map multi-map tests");
 DEFINE_bool(map_region_tests, false, "Run Map region tests");
 DEFINE_bool(map_region_bound_tests, false, "Run Map RegionBound tests");
+DEFINE_bool(map_split_region_tests, false, "Run Map SplitByRegion tests");
 DEFINE_bool(map_soften_tests, false, "Run Map soften tests");
+DEFINE_bool(map_from_points_tests, false, "Run Map FromPoints tests");
+DEFINE_bool(map_expr_tests, false, "Run Map MapExpr tests");
+DEFINE_bool(map_initialize_tests, false, "Run Map Initialize tests");
+DEFINE_bool(map_cache_tests, false, "Run Map fingerprint and MapCache tests");
+DEFINE_bool(map_serialize_tests, false, "Run Map binary serialization tests");
+DEFINE_bool(map_overlap_tests, false, "Run Map overlap tests");
+DEFINE_bool(map_mask_server_tests, false, "Run Map MaskServer tests");
+DEFINE_bool(map_raster_tests, false, "Run Map MapRaster tests");
 
 void MapUnitTests(bool run_all_tests) {
   void MapBasicTests();
@@ -941,7 +1938,16 @@ void MapUnitTests(bool run_all_tests) {
   void MapMultiMapTests();
   void MapRegionTests();
   void MapRegionBoundTests();
+  void MapSplitRegionTests();
   void MapSoftenTests();
+  void MapFromPointsTests();
+  void MapExprTests();
+  void MapInitializeTests();
+  void MapCacheTests();
+  void MapSerializeTests();
+  void MapOverlapTests();
+  void MapMaskServerTests();
+  void MapRasterTests();
 
   if (run_all_tests) FLAGS_all_map_tests = true;
 
@@ -993,7 +1999,38 @@ void MapUnitTests(bool run_all_tests) {
   if (FLAGS_all_map_tests || FLAGS_map_region_bound_tests)
     MapRegionBoundTests();
 
+  // Check the routine for splitting a Stomp::Map into all of its region Maps
+  // at once.
+  if (FLAGS_all_map_tests || FLAGS_map_split_region_tests)
+    MapSplitRegionTests();
+
   // Check the routines for softening the maximum resolution of the
   // Map and cutting the map based on the Weight.
   if (FLAGS_all_map_tests || FLAGS_map_soften_tests) MapSoftenTests();
+
+  // Check the routine for building a Map directly from a point catalog.
+  if (FLAGS_all_map_tests || FLAGS_map_from_points_tests)
+    MapFromPointsTests();
+
+  // Check that lazily evaluated Map expressions match the Map operations.
+  if (FLAGS_all_map_tests || FLAGS_map_expr_tests) MapExprTests();
+
+  // Check that the Map statistics and regions are updated incrementally.
+  if (FLAGS_all_map_tests || FLAGS_map_initialize_tests) MapInitializeTests();
+
+  // Check the Map fingerprints and the on-disk cache of derived products.
+  if (FLAGS_all_map_tests || FLAGS_map_cache_tests) MapCacheTests();
+
+  // Check the binary serialization used for pickling the map classes.
+  if (FLAGS_all_map_tests || FLAGS_map_serialize_tests) MapSerializeTests();
+
+  // Check the overlap measures between two Maps.
+  if (FLAGS_all_map_tests || FLAGS_map_overlap_tests) MapOverlapTests();
+
+  // Check the queries through a MaskServer against the Map itself.
+  if (FLAGS_all_map_tests || FLAGS_map_mask_server_tests)
+    MapMaskServerTests();
+
+  // Check the rasterized images of Maps and ScalarMaps.
+  if (FLAGS_all_map_tests || FLAGS_map_raster_tests) MapRasterTests();
 }
@@ -0,0 +1,644 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This file contains the MaskServer and MaskClient classes, which answer
+// point queries against a set of Maps over a Unix domain socket.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include "stomp_core.h"
+#include "stomp_mask_server.h"
+#include "stomp_map.h"
+
+namespace Stomp {
+
+const uint32_t MaskServer::MaskMagic;
+const uint32_t MaskServer::MaxBatchSize;
+
+// How long (in milliseconds) the server waits on a socket before checking
+// whether it has been stopped.
+static const int MaskPollInterval = 100;
+
+static const size_t MaskRequestSize = 16;
+static const size_t MaskReplySize = 12;
+
+// Send or receive exactly n_byte bytes, retrying on interruptions and short
+// transfers.  The return value is false if the connection fails or is closed
+// by the other end.
+static bool SendAll(int socket, const char* buffer, size_t n_byte) {
+  while (n_byte > 0) {
+    ssize_t n_sent = send(socket, buffer, n_byte, MSG_NOSIGNAL);
+    if (n_sent < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    buffer += n_sent;
+    n_byte -= n_sent;
+  }
+  return true;
+}
+
+static bool ReceiveAll(int socket, char* buffer, size_t n_byte) {
+  while (n_byte > 0) {
+    ssize_t n_received = recv(socket, buffer, n_byte, 0);
+    if (n_received < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (n_received == 0) return false;
+    buffer += n_received;
+    n_byte -= n_received;
+  }
+  return true;
+}
+
+template<class T> static void AppendValue(std::string& buffer, const T& value) {
+  buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<class T> static T ExtractValue(const std::string& buffer,
+					size_t offset) {
+  T value;
+  memcpy(&value, buffer.data() + offset, sizeof(T));
+  return value;
+}
+
+static bool SocketAddress(const std::string& socket_path,
+			  struct sockaddr_un& address) {
+  if (socket_path.empty() ||
+      (socket_path.size() >= sizeof(address.sun_path))) return false;
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+  return true;
+}
+
+MaskServer::MaskServer() {
+  stop_ = false;
+  running_ = false;
+  listen_socket_ = -1;
+  wake_pipe_[0] = wake_pipe_[1] = -1;
+  n_threads_ = 0;
+}
+
+MaskServer::~MaskServer() {
+  if (listen_socket_ >= 0) {
+    close(listen_socket_);
+    unlink(socket_path_.c_str());
+  }
+
+  for (std::map<std::string, Map*>::iterator iter=map_.begin();
+       iter!=map_.end();++iter) delete iter->second;
+  map_.clear();
+}
+
+bool MaskServer::AddMap(const std::string& map_name, Map* stomp_map) {
+  if (running_ || map_name.empty() || (map_name.size() > 0xFFFF) ||
+      (map_.find(map_name) != map_.end())) {
+    std::cout << "Stomp::MaskServer::AddMap - Can't add Map '" <<
+      map_name << "'\n";
+    delete stomp_map;
+    return false;
+  }
+
+  map_[map_name] = stomp_map;
+
+  return true;
+}
+
+bool MaskServer::ReadMap(const std::string& map_name,
+			 const std::string& input_file, uint16_t n_region,
+			 bool hpixel_format, bool weighted_map) {
+  Map* stomp_map = new Map();
+  if (!stomp_map->Read(input_file, hpixel_format, weighted_map) ||
+      stomp_map->Empty()) {
+    std::cout << "Stomp::MaskServer::ReadMap - Failed to read " <<
+      input_file << "\n";
+    delete stomp_map;
+    return false;
+  }
+
+  if ((n_region > 0) && (stomp_map->InitializeRegions(n_region) != n_region))
+    std::cout << "Stomp::MaskServer::ReadMap - Only made " <<
+      stomp_map->NRegion() << " of " << n_region << " regions for " <<
+      map_name << "\n";
+
+  return AddMap(map_name, stomp_map);
+}
+
+bool MaskServer::Listen(const std::string& socket_path) {
+  struct sockaddr_un address;
+  if (!SocketAddress(socket_path, address)) {
+    std::cout << "Stomp::MaskServer::Listen - Invalid socket path: " <<
+      socket_path << "\n";
+    return false;
+  }
+
+  if (listen_socket_ >= 0) {
+    close(listen_socket_);
+    unlink(socket_path_.c_str());
+  }
+
+  listen_socket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_socket_ < 0) {
+    std::cout << "Stomp::MaskServer::Listen - Failed to create socket: " <<
+      strerror(errno) << "\n";
+    return false;
+  }
+
+  unlink(socket_path.c_str());
+  if ((bind(listen_socket_, reinterpret_cast<struct sockaddr*>(&address),
+	    sizeof(address)) < 0) ||
+      (listen(listen_socket_, SOMAXCONN) < 0)) {
+    std::cout << "Stomp::MaskServer::Listen - Failed to listen on " <<
+      socket_path << ": " << strerror(errno) << "\n";
+    close(listen_socket_);
+    listen_socket_ = -1;
+    return false;
+  }
+  socket_path_ = socket_path;
+
+  return true;
+}
+
+void MaskServer::Serve() {
+  if (listen_socket_ < 0) {
+    std::cout << "Stomp::MaskServer::Serve - Must call Listen first\n";
+    return;
+  }
+
+  // The workers write to this pipe when they hand a connection back, so the
+  // poll below picks it up right away rather than on the next time-out.
+  if (pipe(wake_pipe_) < 0) {
+    std::cout << "Stomp::MaskServer::Serve - Failed to create pipe: " <<
+      strerror(errno) << "\n";
+    return;
+  }
+  fcntl(wake_pipe_[0], F_SETFL, O_NONBLOCK);
+  fcntl(wake_pipe_[1], F_SETFL, O_NONBLOCK);
+
+  stop_ = false;
+  running_ = true;
+
+  std::vector<std::thread> worker;
+  for (uint16_t i=0;i<NThreads();i++)
+    worker.push_back(std::thread(&MaskServer::_Worker, this));
+
+  // The accept loop watches the listening socket and every connection that
+  // isn't waiting for or being handled by a worker.  A connection with a
+  // request waiting is queued for the workers and comes back here once the
+  // reply has been sent, so any number of open connections share the
+  // workers.  The loop also wakes up periodically to check whether we've
+  // been stopped, since Stop can't safely do anything more than set the
+  // flag.
+  std::vector<int> idle_connection;
+  std::vector<struct pollfd> connection_poll;
+  while (!stop_) {
+    connection_poll.resize(2 + idle_connection.size());
+    connection_poll[0].fd = listen_socket_;
+    connection_poll[1].fd = wake_pipe_[0];
+    for (uint32_t i=0;i<idle_connection.size();i++)
+      connection_poll[2+i].fd = idle_connection[i];
+    for (uint32_t i=0;i<connection_poll.size();i++) {
+      connection_poll[i].events = POLLIN;
+      connection_poll[i].revents = 0;
+    }
+
+    if (poll(&connection_poll[0], connection_poll.size(),
+	     MaskPollInterval) <= 0) continue;
+
+    // Closed connections are queued as well; the worker finds the end of
+    // the stream and closes them.
+    uint32_t n_idle = 0;
+    {
+      std::lock_guard<std::mutex> lock(connection_mutex_);
+      for (uint32_t i=0;i<idle_connection.size();i++) {
+	if (connection_poll[2+i].revents != 0) {
+	  ready_connection_.push_back(idle_connection[i]);
+	  connection_ready_.notify_one();
+	} else {
+	  idle_connection[n_idle] = idle_connection[i];
+	  n_idle++;
+	}
+      }
+      idle_connection.resize(n_idle);
+
+      if (connection_poll[1].revents != 0) {
+	char wake[64];
+	while (read(wake_pipe_[0], wake, sizeof(wake)) > 0) continue;
+	idle_connection.insert(idle_connection.end(),
+			       returned_connection_.begin(),
+			       returned_connection_.end());
+	returned_connection_.clear();
+      }
+    }
+
+    if (connection_poll[0].revents != 0) {
+      int connection = accept(listen_socket_, NULL, NULL);
+      if (connection >= 0) idle_connection.push_back(connection);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(connection_mutex_);
+    connection_ready_.notify_all();
+  }
+  for (uint16_t i=0;i<worker.size();i++) worker[i].join();
+
+  // Everything still open gets closed, whether it was waiting for a worker,
+  // on its way back from one or idle.
+  while (!ready_connection_.empty()) {
+    close(ready_connection_.front());
+    ready_connection_.pop_front();
+  }
+  while (!returned_connection_.empty()) {
+    close(returned_connection_.front());
+    returned_connection_.pop_front();
+  }
+  for (uint32_t i=0;i<idle_connection.size();i++) close(idle_connection[i]);
+
+  close(wake_pipe_[0]);
+  close(wake_pipe_[1]);
+  wake_pipe_[0] = wake_pipe_[1] = -1;
+
+  close(listen_socket_);
+  unlink(socket_path_.c_str());
+  listen_socket_ = -1;
+  running_ = false;
+}
+
+void MaskServer::Stop() {
+  stop_ = true;
+}
+
+void MaskServer::_Worker() {
+  // The buffers are re-used for each request, so a client sending a long
+  // series of batches doesn't re-allocate them every time.
+  std::string request_buffer, reply_buffer;
+
+  while (true) {
+    int connection;
+    {
+      std::unique_lock<std::mutex> lock(connection_mutex_);
+      while (ready_connection_.empty() && !stop_)
+	connection_ready_.wait_for(
+	  lock, std::chrono::milliseconds(MaskPollInterval));
+      if (stop_) return;
+      connection = ready_connection_.front();
+      ready_connection_.pop_front();
+    }
+
+    if (!_HandleRequest(connection, request_buffer, reply_buffer)) {
+      close(connection);
+      continue;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(connection_mutex_);
+      returned_connection_.push_back(connection);
+    }
+    char wake = 0;
+    if (write(wake_pipe_[1], &wake, 1) < 0) continue;
+  }
+}
+
+bool MaskServer::_HandleRequest(int connection, std::string& request_buffer,
+				std::string& reply_buffer) {
+  request_buffer.resize(MaskRequestSize);
+  if (!ReceiveAll(connection, &request_buffer[0], MaskRequestSize))
+    return false;
+
+  uint32_t magic = ExtractValue<uint32_t>(request_buffer, 0);
+  uint32_t query = ExtractValue<uint32_t>(request_buffer, 4);
+  uint32_t n_point = ExtractValue<uint32_t>(request_buffer, 8);
+  uint16_t sphere = ExtractValue<uint16_t>(request_buffer, 12);
+  uint16_t name_length = ExtractValue<uint16_t>(request_buffer, 14);
+
+  // If the header doesn't make sense, we can't tell where the next request
+  // starts, so the connection is closed.
+  if ((magic != MaskMagic) || (n_point > MaxBatchSize)) {
+    reply_buffer.clear();
+    AppendValue(reply_buffer, MaskMagic);
+    AppendValue(reply_buffer, static_cast<uint32_t>(StatusBadRequest));
+    AppendValue(reply_buffer, static_cast<uint32_t>(0));
+    SendAll(connection, reply_buffer.data(), reply_buffer.size());
+    return false;
+  }
+
+  size_t n_byte = name_length + 2*sizeof(double)*n_point;
+  request_buffer.resize(n_byte);
+  if ((n_byte > 0) && !ReceiveAll(connection, &request_buffer[0], n_byte))
+    return false;
+
+  std::string map_name(request_buffer.data(), name_length);
+  std::vector<double> coordinate(2*n_point);
+  if (n_point > 0)
+    memcpy(&coordinate[0], request_buffer.data() + name_length,
+	   2*sizeof(double)*n_point);
+
+  reply_buffer.clear();
+  AppendValue(reply_buffer, MaskMagic);
+
+  if (query == QueryList) {
+    AppendValue(reply_buffer, static_cast<uint32_t>(StatusOK));
+    AppendValue(reply_buffer, static_cast<uint32_t>(map_.size()));
+    for (std::map<std::string, Map*>::iterator iter=map_.begin();
+	 iter!=map_.end();++iter) {
+      AppendValue(reply_buffer, static_cast<uint32_t>(iter->first.size()));
+      AppendValue(reply_buffer,
+		  static_cast<uint32_t>(iter->second->NRegion()));
+      AppendValue(reply_buffer, iter->second->Area());
+      reply_buffer.append(iter->first);
+    }
+    return SendAll(connection, reply_buffer.data(), reply_buffer.size());
+  }
+
+  std::map<std::string, Map*>::iterator map_iter = map_.find(map_name);
+  if ((query > QueryRegion) || (sphere > AngularCoordinate::Galactic) ||
+      (map_iter == map_.end())) {
+    AppendValue(reply_buffer, static_cast<uint32_t>(
+      map_iter == map_.end() ? StatusUnknownMap : StatusBadRequest));
+    AppendValue(reply_buffer, static_cast<uint32_t>(0));
+    return SendAll(connection, reply_buffer.data(), reply_buffer.size());
+  }
+
+  Map* stomp_map = map_iter->second;
+  AngularCoordinate::Sphere coordinate_sphere =
+    static_cast<AngularCoordinate::Sphere>(sphere);
+  bool regionated = stomp_map->RegionsInitialized();
+
+  AppendValue(reply_buffer, static_cast<uint32_t>(StatusOK));
+  AppendValue(reply_buffer, n_point);
+  for (uint32_t i=0;i<n_point;i++) {
+    AngularCoordinate ang(coordinate[2*i], coordinate[2*i+1],
+			  coordinate_sphere);
+    if (query == QueryContains) {
+      AppendValue(reply_buffer,
+		  static_cast<uint8_t>(stomp_map->Contains(ang) ? 1 : 0));
+    } else if (query == QueryWeight) {
+      double weight;
+      if (!stomp_map->FindLocation(ang, weight)) weight = 0.0;
+      AppendValue(reply_buffer, weight);
+    } else {
+      AppendValue(reply_buffer, static_cast<int16_t>(
+	regionated && stomp_map->Contains(ang) ?
+	stomp_map->FindRegion(ang) : -1));
+    }
+  }
+
+  return SendAll(connection, reply_buffer.data(), reply_buffer.size());
+}
+
+void MaskServer::SetNThreads(uint16_t n_threads) {
+  n_threads_ = n_threads;
+}
+
+uint16_t MaskServer::NThreads() {
+  if (n_threads_ > 0) return n_threads_;
+
+  uint16_t n_core = std::thread::hardware_concurrency();
+  return (n_core > 0 ? n_core : 1);
+}
+
+uint32_t MaskServer::NMap() {
+  return map_.size();
+}
+
+bool MaskServer::Listening() {
+  return (listen_socket_ >= 0);
+}
+
+bool MaskServer::Running() {
+  return running_;
+}
+
+MaskClient::MaskClient() {
+  socket_ = -1;
+}
+
+MaskClient::MaskClient(const std::string& socket_path) {
+  socket_ = -1;
+  Connect(socket_path);
+}
+
+MaskClient::~MaskClient() {
+  Close();
+}
+
+bool MaskClient::Connect(const std::string& socket_path) {
+  Close();
+
+  struct sockaddr_un address;
+  if (!SocketAddress(socket_path, address)) {
+    std::cout << "Stomp::MaskClient::Connect - Invalid socket path: " <<
+      socket_path << "\n";
+    return false;
+  }
+
+  socket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((socket_ < 0) ||
+      (connect(socket_, reinterpret_cast<struct sockaddr*>(&address),
+	       sizeof(address)) < 0)) {
+    std::cout << "Stomp::MaskClient::Connect - Failed to connect to " <<
+      socket_path << ": " << strerror(errno) << "\n";
+    Close();
+    return false;
+  }
+
+  return true;
+}
+
+void MaskClient::Close() {
+  if (socket_ >= 0) close(socket_);
+  socket_ = -1;
+}
+
+bool MaskClient::Connected() {
+  return (socket_ >= 0);
+}
+
+bool MaskClient::ListMaps(std::vector<std::string>& map_names,
+			  std::vector<double>& area,
+			  std::vector<uint16_t>& n_region) {
+  map_names.clear();
+  area.clear();
+  n_region.clear();
+
+  if (!Connected()) return false;
+
+  std::string request;
+  AppendValue(request, MaskServer::MaskMagic);
+  AppendValue(request, static_cast<uint32_t>(MaskServer::QueryList));
+  AppendValue(request, static_cast<uint32_t>(0));
+  AppendValue(request, static_cast<uint16_t>(AngularCoordinate::Survey));
+  AppendValue(request, static_cast<uint16_t>(0));
+
+  std::string reply(MaskReplySize, '\0');
+  if (!SendAll(socket_, request.data(), request.size()) ||
+      !ReceiveAll(socket_, &reply[0], MaskReplySize) ||
+      (ExtractValue<uint32_t>(reply, 0) != MaskServer::MaskMagic) ||
+      (ExtractValue<uint32_t>(reply, 4) != MaskServer::StatusOK)) {
+    std::cout << "Stomp::MaskClient::ListMaps - Request failed\n";
+    Close();
+    return false;
+  }
+
+  uint32_t n_map = ExtractValue<uint32_t>(reply, 8);
+  std::string entry(16, '\0');
+  for (uint32_t i=0;i<n_map;i++) {
+    if (!ReceiveAll(socket_, &entry[0], 16)) {
+      Close();
+      return false;
+    }
+    std::string map_name(ExtractValue<uint32_t>(entry, 0), '\0');
+    if (!map_name.empty() &&
+	!ReceiveAll(socket_, &map_name[0], map_name.size())) {
+      Close();
+      return false;
+    }
+    map_names.push_back(map_name);
+    n_region.push_back(static_cast<uint16_t>(ExtractValue<uint32_t>(entry, 4)));
+    area.push_back(ExtractValue<double>(entry, 8));
+  }
+
+  return true;
+}
+
+bool MaskClient::Contains(const std::string& map_name, AngularVector& ang,
+			  std::vector<uint8_t>& contained) {
+  std::vector<double> lambda, eta;
+  _SurveyCoordinates(ang, lambda, eta);
+  contained.resize(ang.size());
+  return Contains(map_name, ang.size(), lambda.data(), eta.data(),
+		  AngularCoordinate::Survey, contained.data());
+}
+
+bool MaskClient::Weight(const std::string& map_name, AngularVector& ang,
+			std::vector<double>& weight) {
+  std::vector<double> lambda, eta;
+  _SurveyCoordinates(ang, lambda, eta);
+  weight.resize(ang.size());
+  return Weight(map_name, ang.size(), lambda.data(), eta.data(),
+		AngularCoordinate::Survey, weight.data());
+}
+
+bool MaskClient::Region(const std::string& map_name, AngularVector& ang,
+			std::vector<int16_t>& region) {
+  std::vector<double> lambda, eta;
+  _SurveyCoordinates(ang, lambda, eta);
+  region.resize(ang.size());
+  return Region(map_name, ang.size(), lambda.data(), eta.data(),
+		AngularCoordinate::Survey, region.data());
+}
+
+bool MaskClient::Contains(const std::string& map_name, uint32_t n_point,
+			  const double* theta, const double* phi,
+			  AngularCoordinate::Sphere sphere,
+			  uint8_t* contained) {
+  return _Query(MaskServer::QueryContains, map_name, n_point, theta, phi,
+		sphere, sizeof(uint8_t), reinterpret_cast<char*>(contained));
+}
+
+bool MaskClient::Weight(const std::string& map_name, uint32_t n_point,
+			const double* theta, const double* phi,
+			AngularCoordinate::Sphere sphere, double* weight) {
+  return _Query(MaskServer::QueryWeight, map_name, n_point, theta, phi,
+		sphere, sizeof(double), reinterpret_cast<char*>(weight));
+}
+
+bool MaskClient::Region(const std::string& map_name, uint32_t n_point,
+			const double* theta, const double* phi,
+			AngularCoordinate::Sphere sphere, int16_t* region) {
+  return _Query(MaskServer::QueryRegion, map_name, n_point, theta, phi,
+		sphere, sizeof(int16_t), reinterpret_cast<char*>(region));
+}
+
+bool MaskClient::_Query(uint32_t query, const std::string& map_name,
+			uint32_t n_point, const double* theta,
+			const double* phi, AngularCoordinate::Sphere sphere,
+			size_t item_size, char* output) {
+  if (!Connected()) return false;
+
+  if (map_name.size() > 0xFFFF) {
+    std::cout << "Stomp::MaskClient::_Query - Map name too long\n";
+    return false;
+  }
+
+  std::string request, reply(MaskReplySize, '\0');
+  for (uint32_t first=0;first<n_point;first+=MaskServer::MaxBatchSize) {
+    uint32_t n_batch = std::min(n_point - first, MaskServer::MaxBatchSize);
+
+    request.clear();
+    request.reserve(MaskRequestSize + map_name.size() +
+		    2*sizeof(double)*n_batch);
+    AppendValue(request, MaskServer::MaskMagic);
+    AppendValue(request, query);
+    AppendValue(request, n_batch);
+    AppendValue(request, static_cast<uint16_t>(sphere));
+    AppendValue(request, static_cast<uint16_t>(map_name.size()));
+    request.append(map_name);
+    for (uint32_t i=first;i<first+n_batch;i++) {
+      AppendValue(request, theta[i]);
+      AppendValue(request, phi[i]);
+    }
+
+    if (!SendAll(socket_, request.data(), request.size()) ||
+	!ReceiveAll(socket_, &reply[0], MaskReplySize) ||
+	(ExtractValue<uint32_t>(reply, 0) != MaskServer::MaskMagic)) {
+      std::cout << "Stomp::MaskClient::_Query - Connection failed\n";
+      Close();
+      return false;
+    }
+
+    uint32_t status = ExtractValue<uint32_t>(reply, 4);
+    if (status != MaskServer::StatusOK) {
+      std::cout << "Stomp::MaskClient::_Query - Request for '" << map_name <<
+	"' refused (" << (status == MaskServer::StatusUnknownMap ?
+			  "unknown map" : "bad request") << ")\n";
+      if (status != MaskServer::StatusUnknownMap) Close();
+      return false;
+    }
+
+    if ((ExtractValue<uint32_t>(reply, 8) != n_batch) ||
+	!ReceiveAll(socket_, output + first*item_size, n_batch*item_size)) {
+      std::cout << "Stomp::MaskClient::_Query - Connection failed\n";
+      Close();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void MaskClient::_SurveyCoordinates(AngularVector& ang,
+				    std::vector<double>& lambda,
+				    std::vector<double>& eta) {
+  lambda.resize(ang.size());
+  eta.resize(ang.size());
+  for (uint32_t i=0;i<ang.size();i++) {
+    lambda[i] = ang[i].Lambda();
+    eta[i] = ang[i].Eta();
+  }
+}
+
+} // end namespace Stomp
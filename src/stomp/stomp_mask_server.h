@@ -0,0 +1,197 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This header file contains the MaskServer and MaskClient classes.  Many of
+// the jobs run against a survey only need its Map to ask whether a set of
+// points is inside the mask, what the Map weight is at those points or which
+// jack-knife region they fall in.  If each job loads the Map itself, each one
+// pays for Map::Read and keeps its own copy of the Map in memory.  A
+// MaskServer loads its Maps once and answers batches of those queries from
+// any number of processes on the same machine over a Unix domain socket.
+// The MaskClient class is the C++ end of that connection; stomp/mask_client.py
+// is the Python equivalent and stomp_mask_server_main.cc is the stand-alone
+// server executable.
+
+#ifndef STOMP_MASK_SERVER_H
+#define STOMP_MASK_SERVER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "stomp_core.h"
+#include "stomp_angular_coordinate.h"
+
+namespace Stomp {
+
+class Map;                  // class definition in stomp_map.h
+class MaskServer;
+class MaskClient;
+
+class MaskServer {
+  // Class object for serving point queries against a set of named Maps.  The
+  // Maps are added before the server starts (and are owned by the server from
+  // then on), so the worker threads only ever read from them.  Requests are
+  // dispatched one at a time: whenever a request arrives on one of the open
+  // connections, the next free worker thread answers it and hands the
+  // connection back, so any number of clients can keep their connections
+  // open while sharing the workers.
+  //
+  // The protocol is a simple request-reply exchange of binary messages in the
+  // machine's native byte order, since both ends are on the same machine.
+  // Each request is a 16 byte header
+  //
+  //   uint32_t magic (MaskMagic), uint32_t query, uint32_t n_point,
+  //   uint16_t sphere, uint16_t name_length
+  //
+  // followed by the name of the Map and then n_point pairs of double
+  // coordinates (theta, phi) in the AngularCoordinate::Sphere given by
+  // sphere, in degrees.  The reply is a 12 byte header
+  //
+  //   uint32_t magic (MaskMagic), uint32_t status, uint32_t n_item
+  //
+  // followed by n_item results: a uint8_t (1 for points inside the Map, 0
+  // otherwise) for QueryContains, the double weight for QueryWeight (0 for
+  // points outside the Map) and the int16_t region index for QueryRegion (-1
+  // for points outside the regions or if the Map hasn't been regionated).
+  // For QueryList, the name and coordinates in the request are ignored and
+  // each of the n_item entries in the reply is a uint32_t name length, a
+  // uint32_t region count, the double area of the Map and then the name.
+  //
+  // Requests with more than MaxBatchSize points are refused with
+  // StatusBadRequest; the clients split larger sets of points into batches.
+ public:
+  enum MaskQuery {
+    QueryList,
+    QueryContains,
+    QueryWeight,
+    QueryRegion
+  };
+
+  enum MaskStatus {
+    StatusOK,
+    StatusUnknownMap,
+    StatusBadRequest
+  };
+
+  static const uint32_t MaskMagic = 0x51504d53;
+  static const uint32_t MaxBatchSize = 1 << 22;
+
+  MaskServer();
+  ~MaskServer();
+
+  // Add a Map to the set being served.  The server takes ownership of the
+  // Map.  The return value is false (and the Map is deleted) if the name is
+  // already in use, the name is empty or the server is already running.
+  bool AddMap(const std::string& map_name, Map* stomp_map);
+
+  // Alternatively, read the Map from an ASCII file (see Map::Read) and, if
+  // n_region is positive, divide it into that many regions.
+  bool ReadMap(const std::string& map_name, const std::string& input_file,
+	       uint16_t n_region = 0, bool hpixel_format = true,
+	       bool weighted_map = true);
+
+  // Create the socket and start listening on it.  Any existing file at
+  // socket_path is removed first.  The return value is false if the socket
+  // couldn't be created.
+  bool Listen(const std::string& socket_path);
+
+  // Accept connections and answer queries until Stop is called.  The calling
+  // thread accepts the connections and n_threads worker threads answer them.
+  // Stop only sets a flag, so it is safe to call from a signal handler or
+  // from another thread; Serve notices it within a fraction of a second,
+  // closes the remaining connections, removes the socket file and returns.
+  void Serve();
+  void Stop();
+
+  // The number of worker threads.  The default (0) uses one thread per core.
+  void SetNThreads(uint16_t n_threads);
+  uint16_t NThreads();
+
+  uint32_t NMap();
+  bool Listening();
+  bool Running();
+
+ private:
+  // Answer one request on each connection taken from ready_connection_ and
+  // hand the connection back to Serve through returned_connection_.  The
+  // connection is closed instead if the client has closed it or sent
+  // something we can't parse.
+  void _Worker();
+  bool _HandleRequest(int connection, std::string& request_buffer,
+		      std::string& reply_buffer);
+
+  std::map<std::string, Map*> map_;
+  std::deque<int> ready_connection_, returned_connection_;
+  std::mutex connection_mutex_;
+  std::condition_variable connection_ready_;
+  std::string socket_path_;
+  std::atomic<bool> stop_, running_;
+  int listen_socket_, wake_pipe_[2];
+  uint16_t n_threads_;
+};
+
+class MaskClient {
+  // Class object for the client end of a MaskServer connection.  Each query
+  // method sends the points in batches of at most MaskServer::MaxBatchSize
+  // and fills the output vector with one result per input point.  The
+  // AngularVector methods send the coordinates in the Survey system; the
+  // array methods take the coordinates in whatever system they're in.  All of
+  // the query methods return false if the connection has failed or the
+  // server doesn't recognize the Map name.
+ public:
+  MaskClient();
+  MaskClient(const std::string& socket_path);
+  ~MaskClient();
+
+  bool Connect(const std::string& socket_path);
+  void Close();
+  bool Connected();
+
+  // The names, areas and number of regions for the Maps on the server.
+  bool ListMaps(std::vector<std::string>& map_names,
+		std::vector<double>& area, std::vector<uint16_t>& n_region);
+
+  bool Contains(const std::string& map_name, AngularVector& ang,
+		std::vector<uint8_t>& contained);
+  bool Weight(const std::string& map_name, AngularVector& ang,
+	      std::vector<double>& weight);
+  bool Region(const std::string& map_name, AngularVector& ang,
+	      std::vector<int16_t>& region);
+
+  bool Contains(const std::string& map_name, uint32_t n_point,
+		const double* theta, const double* phi,
+		AngularCoordinate::Sphere sphere, uint8_t* contained);
+  bool Weight(const std::string& map_name, uint32_t n_point,
+	      const double* theta, const double* phi,
+	      AngularCoordinate::Sphere sphere, double* weight);
+  bool Region(const std::string& map_name, uint32_t n_point,
+	      const double* theta, const double* phi,
+	      AngularCoordinate::Sphere sphere, int16_t* region);
+
+ private:
+  // Send the points in batches and copy the replies into the output array,
+  // item_size bytes per point.
+  bool _Query(uint32_t query, const std::string& map_name, uint32_t n_point,
+	      const double* theta, const double* phi,
+	      AngularCoordinate::Sphere sphere, size_t item_size, char* output);
+  void _SurveyCoordinates(AngularVector& ang, std::vector<double>& lambda,
+			  std::vector<double>& eta);
+
+  int socket_;
+};
+
+} // end namespace Stomp
+
+#endif
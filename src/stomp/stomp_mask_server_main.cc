@@ -0,0 +1,146 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This file contains the stand-alone MaskServer executable.  Each of the
+// arguments after the flags names a Map and the file to read it from, as
+//
+//   stomp_mask_server --socket=/tmp/stomp_mask.sock
+//     survey=survey_map.hmap bright_stars=star_mask.hmap:20
+//
+// (all on one line) where the optional number after the file name divides
+// that Map into regions.  The server runs until it gets SIGINT or SIGTERM.
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "stomp_core.h"
+#include "stomp_mask_server.h"
+
+// The library doesn't depend on gflags, so the handful of flags are parsed
+// by hand.  Each takes the form --flag=value; the boolean flags accept true
+// or false (or 1 or 0).
+//
+//   --socket       Path for the server's Unix domain socket.
+//   --n_threads    Number of worker threads (0 for one per core, at most
+//                  65535).
+//   --hpixel_format, --weighted_map
+//                  The map file format (see Map::Read); both default to true.
+static bool ParseBool(const std::string& value, bool& flag) {
+  if ((value == "true") || (value == "1")) {
+    flag = true;
+  } else if ((value == "false") || (value == "0")) {
+    flag = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static Stomp::MaskServer* active_server = NULL;
+
+static void StopServer(int signal_number) {
+  if (active_server != NULL) active_server->Stop();
+}
+
+int main(int argc, char **argv) {
+  std::string usage = "Usage: ";
+  usage += argv[0];
+  usage += " [--socket=path] [--n_threads=n] [--hpixel_format=true|false]";
+  usage += " [--weighted_map=true|false] map_name=map_file[:n_region] ...";
+
+  std::string socket_path = "/tmp/stomp_mask.sock";
+  int32_t n_threads = 0;
+  bool hpixel_format = true, weighted_map = true;
+  std::vector<std::string> map_specs;
+
+  for (int i=1;i<argc;i++) {
+    std::string arg = argv[i];
+    if (arg.compare(0, 2, "--") != 0) {
+      map_specs.push_back(arg);
+      continue;
+    }
+
+    std::string::size_type value_start = arg.find('=');
+    std::string flag = arg.substr(2, value_start - 2);
+    std::string value =
+      (value_start == std::string::npos ? "" : arg.substr(value_start + 1));
+    bool valid_flag = false;
+    if (value_start != std::string::npos) {
+      if (flag == "socket") {
+	socket_path = value;
+	valid_flag = !value.empty();
+      } else if (flag == "n_threads") {
+	// SetNThreads takes a uint16_t, so anything larger would wrap.
+	char* value_end = NULL;
+	long n_threads_value = strtol(value.c_str(), &value_end, 10);
+	valid_flag = (!value.empty() && (*value_end == '\0') &&
+		      (n_threads_value >= 0) && (n_threads_value <= 0xFFFF));
+	if (valid_flag) n_threads = static_cast<int32_t>(n_threads_value);
+      } else if (flag == "hpixel_format") {
+	valid_flag = ParseBool(value, hpixel_format);
+      } else if (flag == "weighted_map") {
+	valid_flag = ParseBool(value, weighted_map);
+      }
+    }
+
+    if (!valid_flag) {
+      std::cout << "Invalid flag: " << arg << "\n" << usage << "\n";
+      return 1;
+    }
+  }
+
+  if (map_specs.empty()) {
+    std::cout << usage << "\n";
+    return 1;
+  }
+
+  Stomp::MaskServer server;
+  server.SetNThreads(static_cast<uint16_t>(n_threads));
+
+  for (uint32_t i=0;i<map_specs.size();i++) {
+    std::string map_spec = map_specs[i];
+    std::string::size_type name_end = map_spec.find('=');
+    if ((name_end == std::string::npos) || (name_end == 0)) {
+      std::cout << "Invalid map argument: " << map_spec << "\n" <<
+	usage << "\n";
+      return 1;
+    }
+
+    std::string map_name = map_spec.substr(0, name_end);
+    std::string map_file = map_spec.substr(name_end + 1);
+    uint16_t n_region = 0;
+    std::string::size_type region_start = map_file.rfind(':');
+    if (region_start != std::string::npos) {
+      n_region = static_cast<uint16_t>(
+	strtoul(map_file.c_str() + region_start + 1, NULL, 10));
+      map_file = map_file.substr(0, region_start);
+    }
+
+    if (!server.ReadMap(map_name, map_file, n_region,
+			hpixel_format, weighted_map)) return 1;
+    std::cout << "Loaded " << map_name << " from " << map_file << "\n";
+  }
+
+  if (!server.Listen(socket_path)) return 1;
+
+  active_server = &server;
+  signal(SIGINT, StopServer);
+  signal(SIGTERM, StopServer);
+
+  std::cout << "Serving " << server.NMap() << " maps on " << socket_path <<
+    " with " << server.NThreads() << " threads\n";
+  server.Serve();
+  active_server = NULL;
+
+  return 0;
+}
@@ -0,0 +1,547 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This file contains the implementation of the MultiScalarMap class.  See the
+// header file for a description of how the channels are laid out.
+
+#include <algorithm>
+#include "stomp_core.h"
+#include "stomp_multi_scalar_map.h"
+#include "stomp_pixel.h"
+#include "stomp_scalar_pixel.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace Stomp {
+
+MultiScalarMap::MultiScalarMap() {
+  resolution_ = 0;
+  n_channel_ = 0;
+  n_region_ = 0;
+  n_threads_ = 0;
+}
+
+MultiScalarMap::MultiScalarMap(ScalarMapVector& scalar_maps) {
+  n_threads_ = 0;
+  Initialize(scalar_maps);
+}
+
+MultiScalarMap::~MultiScalarMap() {
+  Clear();
+}
+
+bool MultiScalarMap::Initialize(ScalarMapVector& scalar_maps) {
+  Clear();
+
+  if (scalar_maps.empty()) {
+    std::cout << "Stomp::MultiScalarMap::Initialize - " <<
+      "No input ScalarMaps.\n";
+    return false;
+  }
+
+  for (ScalarMapIterator iter=scalar_maps.begin();
+       iter!=scalar_maps.end();++iter) {
+    if (iter->Resolution() != scalar_maps[0].Resolution()) {
+      std::cout << "Stomp::MultiScalarMap::Initialize - " <<
+	"Map resolutions must match!\n";
+      return false;
+    }
+  }
+
+  resolution_ = scalar_maps[0].Resolution();
+  n_channel_ = static_cast<uint16_t>(scalar_maps.size());
+  uint64_t nx = Nx0*resolution_;
+
+  // First, find the union of the pixels in all of the maps.
+  for (ScalarMapIterator map_iter=scalar_maps.begin();
+       map_iter!=scalar_maps.end();++map_iter) {
+    for (ScalarIterator iter=map_iter->Begin();iter!=map_iter->End();++iter)
+      pixel_key_.push_back(iter->PixelY()*nx + iter->PixelX());
+  }
+  std::sort(pixel_key_.begin(), pixel_key_.end());
+  pixel_key_.erase(std::unique(pixel_key_.begin(), pixel_key_.end()),
+		   pixel_key_.end());
+
+  uint32_t n_pixel = pixel_key_.size();
+  pixel_x_.resize(n_pixel);
+  pixel_y_.resize(n_pixel);
+  unit_sphere_x_.resize(n_pixel);
+  unit_sphere_y_.resize(n_pixel);
+  unit_sphere_z_.resize(n_pixel);
+  region_.assign(n_pixel, -1);
+  intensity_.assign(n_pixel*n_channel_, 0.0);
+  weight_.assign(n_pixel*n_channel_, 0.0);
+
+  // Now fill in the channels, working with the over-density in each map.  The
+  // conversion is done on a copy so that the input maps are left untouched
+  // (converting a DensityField to over-density and back again doesn't
+  // reproduce the raw intensities exactly).
+  for (uint16_t channel=0;channel<n_channel_;channel++) {
+    ScalarMap over_density_map(scalar_maps[channel]);
+    if (!over_density_map.IsOverDensityMap())
+      over_density_map.ConvertToOverDensity();
+
+    for (ScalarIterator iter=over_density_map.Begin();
+	 iter!=over_density_map.End();++iter) {
+      uint32_t idx = std::lower_bound(pixel_key_.begin(), pixel_key_.end(),
+				      iter->PixelY()*nx + iter->PixelX()) -
+	pixel_key_.begin();
+      pixel_x_[idx] = iter->PixelX();
+      pixel_y_[idx] = iter->PixelY();
+      unit_sphere_x_[idx] = iter->UnitSphereX();
+      unit_sphere_y_[idx] = iter->UnitSphereY();
+      unit_sphere_z_[idx] = iter->UnitSphereZ();
+      intensity_[idx*n_channel_ + channel] = iter->Intensity()*iter->Weight();
+      weight_[idx*n_channel_ + channel] = iter->Weight();
+    }
+  }
+
+  if (scalar_maps[0].NRegion() > 0) {
+    n_region_ = scalar_maps[0].NRegion();
+    uint32_t region_resolution = scalar_maps[0].RegionResolution();
+    for (uint32_t i=0;i<n_pixel;i++) {
+      Pixel pix(pixel_x_[i], pixel_y_[i], resolution_);
+      region_[i] = scalar_maps[0].Region(pix.SuperPix(region_resolution));
+    }
+  }
+
+  return true;
+}
+
+void MultiScalarMap::CorrelationMatrix(AngularCorrelation& wtheta,
+				       WThetaVector& wtheta_matrix) {
+  _CorrelationMatrix(wtheta, wtheta_matrix, false);
+}
+
+void MultiScalarMap::CorrelationMatrixWithRegions(AngularCorrelation& wtheta,
+						  WThetaVector& wtheta_matrix) {
+  _CorrelationMatrix(wtheta, wtheta_matrix, true);
+}
+
+void MultiScalarMap::_CorrelationMatrix(AngularCorrelation& wtheta,
+					WThetaVector& wtheta_matrix,
+					bool use_regions) {
+  ThetaIterator theta_begin = wtheta.Begin(resolution_);
+  ThetaIterator theta_end = wtheta.End(resolution_);
+
+  if (theta_begin == theta_end) {
+    std::cout << "Stomp::MultiScalarMap::CorrelationMatrix - " <<
+      "No angular bins have resolution " << resolution_ << "...\n";
+    return;
+  }
+
+  // Copy the bin limits so that the threads aren't sharing the AngularBins.
+  // Bins using the annulus kernel are handled separately: rather than binning
+  // the pairs by the separation of the pixel centers, each pair is weighted
+  // by the kernel fraction, just as in ScalarMap::AutoCorrelate.
+  std::vector<double> costheta_min, costheta_max;
+  std::vector<uint32_t> center_bin, kernel_bin;
+  std::vector<ThetaIterator> kernel_theta;
+  double theta_max = 0.0;
+  uint32_t n_bin = 0;
+  for (ThetaIterator iter=theta_begin;iter!=theta_end;++iter,n_bin++) {
+    if (iter->UsingAnnulusKernel()) {
+      kernel_bin.push_back(n_bin);
+      kernel_theta.push_back(iter);
+    } else {
+      center_bin.push_back(n_bin);
+      costheta_min.push_back(iter->CosThetaMin());
+      costheta_max.push_back(iter->CosThetaMax());
+      if (iter->ThetaMax() > theta_max) theta_max = iter->ThetaMax();
+    }
+  }
+  uint32_t n_center_bin = center_bin.size();
+  uint32_t n_kernel_bin = kernel_bin.size();
+
+  // Pixels outside the regionation (or all of the pixels, if we're not using
+  // regions) go into an extra region slot at the end.
+  uint16_t n_slot = (use_regions ? n_region_ + 1 : 1);
+  uint32_t n_region_pair = n_slot*(n_slot + 1)/2;
+  uint32_t n_pair = NChannelPair();
+  uint32_t bin_stride = n_region_pair*n_pair;
+  uint32_t n_pixel = Size();
+  uint64_t nx = Nx0*resolution_;
+
+  // The pixels are processed one region slot at a time.  Every pair counted
+  // from a pixel in the current slot lands in the region pair row for that
+  // slot, so each thread only needs an accumulator for that row rather than
+  // for the full set of region pairs.  The rows are folded into the totals
+  // before moving on to the next slot.
+  std::vector<uint32_t> slot_begin(n_slot + 1, 0), slot_pixel(n_pixel);
+  for (uint32_t i=0;i<n_pixel;i++)
+    slot_begin[_RegionSlot(i, use_regions, n_slot) + 1]++;
+  for (uint16_t slot=0;slot<n_slot;slot++)
+    slot_begin[slot + 1] += slot_begin[slot];
+  std::vector<uint32_t> slot_fill(slot_begin.begin(), slot_begin.end() - 1);
+  for (uint32_t i=0;i<n_pixel;i++)
+    slot_pixel[slot_fill[_RegionSlot(i, use_regions, n_slot)]++] = i;
+
+  // The kernels only depend on the row of the first pixel, so we build one
+  // for each occupied row and kernel bin up front.  The pixels are sorted by
+  // row, so the first pixel in each row stands in for the rest.
+  std::vector<uint32_t> kernel_row, kernel_row_pixel;
+  for (uint32_t i=0;(i<n_pixel) && (n_kernel_bin>0);i++) {
+    if (kernel_row.empty() || (pixel_y_[i] != kernel_row.back())) {
+      kernel_row.push_back(pixel_y_[i]);
+      kernel_row_pixel.push_back(i);
+    }
+  }
+  uint32_t n_kernel_row = kernel_row.size();
+  std::vector<AnnulusKernel> kernel(n_kernel_bin*n_kernel_row);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(NThreads())
+#endif
+  for (int32_t m=0;m<static_cast<int32_t>(kernel.size());m++) {
+    uint32_t row_pixel = kernel_row_pixel[m % n_kernel_row];
+    Pixel pix(pixel_x_[row_pixel], pixel_y_[row_pixel], resolution_);
+    BuildAnnulusKernel(pix, *kernel_theta[m/n_kernel_row], kernel[m]);
+  }
+
+  uint32_t row_stride = n_slot*n_pair;
+  std::vector<double> intensity_total(n_bin*bin_stride, 0.0);
+  std::vector<double> weight_total(n_bin*bin_stride, 0.0);
+
+  uint16_t n_threads = 1;
+#ifdef _OPENMP
+  n_threads = NThreads();
+#endif
+  std::vector<std::vector<double> >
+    intensity_sum(n_threads, std::vector<double>(n_bin*row_stride, 0.0)),
+    weight_sum(n_threads, std::vector<double>(n_bin*row_stride, 0.0));
+
+  for (uint16_t slot_i=0;slot_i<n_slot;slot_i++) {
+    int32_t n_slot_pixel =
+      static_cast<int32_t>(slot_begin[slot_i + 1] - slot_begin[slot_i]);
+    if (n_slot_pixel == 0) continue;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 64) num_threads(n_threads)
+#endif
+    for (int32_t k=0;k<n_slot_pixel;k++) {
+      uint32_t i = slot_pixel[slot_begin[slot_i] + k];
+      uint16_t thread_idx = 0;
+#ifdef _OPENMP
+      thread_idx = omp_get_thread_num();
+#endif
+      double* thread_intensity_sum = &intensity_sum[thread_idx][0];
+      double* thread_weight_sum = &weight_sum[thread_idx][0];
+
+      // First the kernel bins.  Each entry gives the offset to a pixel that
+      // may or may not be in the map; as with the center-binned pairs, each
+      // pair is only counted from the pixel that comes first.
+      if (n_kernel_bin > 0) {
+	uint32_t row_idx =
+	  std::lower_bound(kernel_row.begin(), kernel_row.end(),
+			   pixel_y_[i]) - kernel_row.begin();
+	for (uint32_t b=0;b<n_kernel_bin;b++) {
+	  AnnulusKernel& row_kernel = kernel[b*n_kernel_row + row_idx];
+	  uint32_t t = kernel_bin[b];
+	  for (AnnulusKernel::iterator iter=row_kernel.begin();
+	       iter!=row_kernel.end();++iter) {
+	    uint64_t key = iter->y*nx + (pixel_x_[i] + iter->dx) % nx;
+	    if (key <= pixel_key_[i]) continue;
+	    std::vector<uint64_t>::iterator key_iter =
+	      std::lower_bound(pixel_key_.begin() + i + 1, pixel_key_.end(),
+			       key);
+	    if ((key_iter == pixel_key_.end()) || (*key_iter != key)) continue;
+	    uint32_t j = key_iter - pixel_key_.begin();
+	    uint32_t offset = _RegionSlot(j, use_regions, n_slot)*n_pair;
+	    _AddPairProducts(i, j, iter->fraction,
+			     thread_intensity_sum + t*row_stride + offset,
+			     thread_weight_sum + t*row_stride + offset);
+	  }
+	}
+      }
+      if (n_center_bin == 0) continue;
+
+      uint32_t y_min, y_max;
+      std::vector<uint32_t> x_min, x_max;
+      Pixel pix(pixel_x_[i], pixel_y_[i], resolution_);
+      pix.XYBounds(theta_max, x_min, x_max, y_min, y_max, false);
+
+      // Each pair of pixels is only counted once, from the pixel that comes
+      // first in our ordering, so we can skip the rows before this one.
+      for (uint32_t y=y_min,n=0;y<=y_max;y++,n++) {
+	if (y < pixel_y_[i]) continue;
+
+	// The same row bounds as in ScalarPixel::_WithinAnnulus, wrapping
+	// around in x if need be.
+	uint32_t nx_pix;
+	if ((x_max[n] < x_min[n]) && (x_min[n] > nx/2)) {
+	  nx_pix = nx - x_min[n] + x_max[n] + 1;
+	} else {
+	  nx_pix = x_max[n] - x_min[n] + 1;
+	}
+	if (nx_pix > nx) nx_pix = nx;
+
+	uint64_t range_begin[2], range_end[2];
+	uint8_t n_range = 1;
+	range_begin[0] = y*nx + x_min[n];
+	if (x_min[n] + nx_pix <= nx) {
+	  range_end[0] = range_begin[0] + nx_pix;
+	} else {
+	  range_end[0] = (y + 1)*nx;
+	  range_begin[1] = y*nx;
+	  range_end[1] = y*nx + x_min[n] + nx_pix - nx;
+	  n_range = 2;
+	}
+
+	for (uint8_t m=0;m<n_range;m++) {
+	  uint32_t j = std::lower_bound(pixel_key_.begin(), pixel_key_.end(),
+					range_begin[m]) - pixel_key_.begin();
+	  if (j <= i) j = i + 1;
+	  for (;(j<n_pixel) && (pixel_key_[j]<range_end[m]);j++) {
+	    double costheta =
+	      unit_sphere_x_[i]*unit_sphere_x_[j] +
+	      unit_sphere_y_[i]*unit_sphere_y_[j] +
+	      unit_sphere_z_[i]*unit_sphere_z_[j];
+	    uint32_t offset = _RegionSlot(j, use_regions, n_slot)*n_pair;
+
+	    // The bins are tested independently, just as they would be with
+	    // separate calls to AutoCorrelate.
+	    for (uint32_t c=0;c<n_center_bin;c++) {
+	      if (DoubleGE(costheta, costheta_min[c]) &&
+		  DoubleLE(costheta, costheta_max[c])) {
+		uint32_t t = center_bin[c];
+		_AddPairProducts(i, j, 1.0,
+				 thread_intensity_sum + t*row_stride + offset,
+				 thread_weight_sum + t*row_stride + offset);
+	      }
+	    }
+	  }
+	}
+      }
+    }
+
+    // Fold this row into the totals and clear it for the next slot.
+    for (uint16_t k=0;k<n_threads;k++) {
+      for (uint32_t t=0;t<n_bin;t++) {
+	for (uint16_t slot_j=0;slot_j<n_slot;slot_j++) {
+	  uint32_t row_offset = t*row_stride + slot_j*n_pair;
+	  uint32_t total_offset =
+	    t*bin_stride + _RegionPairIndex(slot_i, slot_j)*n_pair;
+	  for (uint32_t p=0;p<n_pair;p++) {
+	    intensity_total[total_offset + p] +=
+	      intensity_sum[k][row_offset + p];
+	    weight_total[total_offset + p] += weight_sum[k][row_offset + p];
+	  }
+	}
+      }
+      std::fill(intensity_sum[k].begin(), intensity_sum[k].end(), 0.0);
+      std::fill(weight_sum[k].begin(), weight_sum[k].end(), 0.0);
+    }
+  }
+
+  // Now transfer the sums into the output bins.  If the output vector is
+  // already set up, we leave the bins at other resolutions alone so that the
+  // same vector can be used for a series of maps at different resolutions.
+  if (wtheta_matrix.size() != n_pair) wtheta_matrix.assign(n_pair, wtheta);
+
+  for (uint32_t p=0;p<n_pair;p++) {
+    ThetaIterator theta_iter = wtheta_matrix[p].Begin(resolution_);
+    for (uint32_t t=0;t<n_bin;t++,++theta_iter) {
+      if (use_regions && (theta_iter->NRegion() != n_region_)) {
+	theta_iter->ClearRegions();
+	theta_iter->InitializeRegions(n_region_);
+      }
+      theta_iter->ResetPixelWtheta();
+
+      for (uint16_t slot_a=0,r=0;slot_a<n_slot;slot_a++) {
+	for (uint16_t slot_b=slot_a;slot_b<n_slot;slot_b++,r++) {
+	  uint32_t m = t*bin_stride + r*n_pair + p;
+	  if ((intensity_total[m] == 0.0) && (weight_total[m] == 0.0))
+	    continue;
+	  int16_t region_a = (slot_a < n_slot - 1 ? slot_a : -1);
+	  int16_t region_b = (slot_b < n_slot - 1 ? slot_b : -1);
+	  theta_iter->AddToPixelWtheta(intensity_total[m], weight_total[m],
+				       region_a, region_b);
+	}
+      }
+    }
+  }
+}
+
+void MultiScalarMap::_AddPairProducts(uint32_t pix_a, uint32_t pix_b,
+				      double fraction, double* intensity_sum,
+				      double* weight_sum) {
+  // The diagonal terms are the same products as in ScalarMap::AutoCorrelate.
+  // For the off-diagonal terms, we need both orderings of the pixel pair to
+  // match ScalarMap::CrossCorrelate, which counts every ordered pair.  The
+  // inner loops run over contiguous channels so that the compiler can
+  // vectorize them.  Every product is scaled by the pair's kernel fraction
+  // (1 for the center-binned bins).
+  const double* intensity_a = &intensity_[pix_a*n_channel_];
+  const double* intensity_b = &intensity_[pix_b*n_channel_];
+  const double* weight_a = &weight_[pix_a*n_channel_];
+  const double* weight_b = &weight_[pix_b*n_channel_];
+
+  for (uint16_t a=0,p=0;a<n_channel_;a++) {
+    double x_a = fraction*intensity_a[a], x_b = fraction*intensity_b[a];
+    double w_a = fraction*weight_a[a], w_b = fraction*weight_b[a];
+    intensity_sum[p] += x_a*intensity_b[a];
+    weight_sum[p] += w_a*weight_b[a];
+    p++;
+
+    double* row_intensity_sum = intensity_sum + p - a - 1;
+    double* row_weight_sum = weight_sum + p - a - 1;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (uint16_t b=a+1;b<n_channel_;b++) {
+      row_intensity_sum[b] += x_a*intensity_b[b] + x_b*intensity_a[b];
+      row_weight_sum[b] += w_a*weight_b[b] + w_b*weight_a[b];
+    }
+    p += n_channel_ - a - 1;
+  }
+}
+
+void MultiScalarMap::CovarianceMatrix(std::vector<double>& covariance) {
+  uint32_t n_pair = NChannelPair();
+  std::vector<double> covariance_norm(n_pair, 0.0);
+  covariance.assign(n_pair, 0.0);
+
+  for (uint32_t i=0;i<Size();i++) {
+    const double* intensity = &intensity_[i*n_channel_];
+    const double* weight = &weight_[i*n_channel_];
+    for (uint16_t a=0,p=0;a<n_channel_;a++) {
+      for (uint16_t b=a;b<n_channel_;b++,p++) {
+	covariance[p] += intensity[a]*intensity[b];
+	covariance_norm[p] += weight[a]*weight[b];
+      }
+    }
+  }
+
+  for (uint32_t p=0;p<n_pair;p++)
+    covariance[p] = (DoubleGT(covariance_norm[p], 1.0e-10) ?
+		     covariance[p]/covariance_norm[p] : 0.0);
+}
+
+void MultiScalarMap::CovarianceMatrixWithErrors(
+  std::vector<double>& covariance, std::vector<double>& covariance_error) {
+  uint32_t n_pair = NChannelPair();
+  std::vector<double> region_covariance(n_region_*n_pair, 0.0);
+  std::vector<double> region_covariance_norm(n_region_*n_pair, 0.0);
+
+  for (uint32_t i=0;i<Size();i++) {
+    if (region_[i] == -1) continue;
+    const double* intensity = &intensity_[i*n_channel_];
+    const double* weight = &weight_[i*n_channel_];
+    double* region_sum = &region_covariance[region_[i]*n_pair];
+    double* region_norm = &region_covariance_norm[region_[i]*n_pair];
+    for (uint16_t a=0,p=0;a<n_channel_;a++) {
+      for (uint16_t b=a;b<n_channel_;b++,p++) {
+	region_sum[p] += intensity[a]*intensity[b];
+	region_norm[p] += weight[a]*weight[b];
+      }
+    }
+  }
+
+  // As in ScalarMap::CovarianceWithErrors, the covariance is the mean of the
+  // region values and the error comes from their scatter.
+  covariance.assign(n_pair, 0.0);
+  covariance_error.assign(n_pair, 0.0);
+  for (uint32_t p=0;p<n_pair;p++) {
+    uint16_t n_region = 0;
+    for (uint16_t k=0;k<n_region_;k++) {
+      if (DoubleGT(region_covariance_norm[k*n_pair + p], 1.0e-10)) {
+	covariance[p] +=
+	  region_covariance[k*n_pair + p]/region_covariance_norm[k*n_pair + p];
+	n_region++;
+      }
+    }
+
+    if (n_region > 0) {
+      covariance[p] /= n_region;
+      for (uint16_t k=0;k<n_region_;k++) {
+	if (DoubleGT(region_covariance_norm[k*n_pair + p], 1.0e-10)) {
+	  double delta = covariance[p] -
+	    region_covariance[k*n_pair + p]/region_covariance_norm[k*n_pair + p];
+	  covariance_error[p] += delta*delta;
+	}
+      }
+      covariance_error[p] = sqrt(covariance_error[p])/n_region;
+    }
+  }
+}
+
+uint32_t MultiScalarMap::ChannelPairIndex(uint16_t channel_a,
+					  uint16_t channel_b) {
+  if (channel_a > channel_b) std::swap(channel_a, channel_b);
+  return channel_a*n_channel_ - channel_a*(channel_a - 1)/2 +
+    channel_b - channel_a;
+}
+
+uint32_t MultiScalarMap::_RegionPairIndex(uint16_t region_a,
+					  uint16_t region_b) {
+  if (region_a > region_b) std::swap(region_a, region_b);
+  uint32_t n_slot = n_region_ + 1;
+  return region_a*n_slot - region_a*(region_a - 1)/2 + region_b - region_a;
+}
+
+uint16_t MultiScalarMap::_RegionSlot(uint32_t pix_idx, bool use_regions,
+				     uint16_t n_slot) {
+  return ((use_regions && (region_[pix_idx] != -1)) ?
+	  static_cast<uint16_t>(region_[pix_idx]) : n_slot - 1);
+}
+
+uint32_t MultiScalarMap::NChannelPair() {
+  return static_cast<uint32_t>(n_channel_)*(n_channel_ + 1)/2;
+}
+
+void MultiScalarMap::SetNThreads(uint16_t n_threads) {
+  n_threads_ = n_threads;
+}
+
+uint16_t MultiScalarMap::NThreads() {
+#ifdef _OPENMP
+  return (n_threads_ > 0 ? n_threads_ : omp_get_max_threads());
+#else
+  return 1;
+#endif
+}
+
+uint16_t MultiScalarMap::NChannel() {
+  return n_channel_;
+}
+
+uint32_t MultiScalarMap::Size() {
+  return pixel_key_.size();
+}
+
+uint32_t MultiScalarMap::Resolution() {
+  return resolution_;
+}
+
+uint16_t MultiScalarMap::NRegion() {
+  return n_region_;
+}
+
+bool MultiScalarMap::Empty() {
+  return pixel_key_.empty();
+}
+
+void MultiScalarMap::Clear() {
+  pixel_key_.clear();
+  pixel_x_.clear();
+  pixel_y_.clear();
+  unit_sphere_x_.clear();
+  unit_sphere_y_.clear();
+  unit_sphere_z_.clear();
+  region_.clear();
+  intensity_.clear();
+  weight_.clear();
+  resolution_ = 0;
+  n_channel_ = 0;
+  n_region_ = 0;
+}
+
+} // end namespace Stomp
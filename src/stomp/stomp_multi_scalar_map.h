@@ -0,0 +1,133 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This header file contains the MultiScalarMap class.  Tomographic analyses
+// work with a set of ScalarMaps on the same pixel grid (the galaxy density in
+// each redshift slice, say) and need every auto- and cross-correlation
+// between them.  Doing that with the ScalarMap methods means calling
+// CrossCorrelate once for each pair of maps, finding the same neighboring
+// pixels over and over again.  A MultiScalarMap stacks the maps into a single
+// object with one intensity channel per input map, so that the neighboring
+// pixels are found once and the products for every pair of channels are
+// accumulated together.
+
+#ifndef STOMP_MULTI_SCALAR_MAP_H
+#define STOMP_MULTI_SCALAR_MAP_H
+
+#include <stdint.h>
+#include <vector>
+#include "stomp_core.h"
+#include "stomp_angular_bin.h"
+#include "stomp_angular_correlation.h"
+#include "stomp_scalar_map.h"
+
+namespace Stomp {
+
+class MultiScalarMap;
+
+class MultiScalarMap {
+  // Class object for a set of ScalarMaps sharing a common resolution.  The
+  // pixels are the union of the pixels in the input maps; for each pixel we
+  // store the over-density and weight (the unmasked fraction) from each map
+  // in a contiguous block of channels.  A pixel missing from one of the input
+  // maps gets zero weight in that channel, so it doesn't contribute to any of
+  // the correlations involving that map, just as in the ScalarMap methods.
+  //
+  // The correlation results are returned as a vector of AngularCorrelations,
+  // one for each pair of channels (a, b) with a <= b, in the order
+  // (0, 0), (0, 1), ..., (0, K-1), (1, 1), ..., (K-1, K-1).  ChannelPairIndex
+  // gives the position of a given pair in that vector.  The diagonal entries
+  // match the results of ScalarMap::AutoCorrelate for the corresponding map
+  // and the off-diagonal entries those of ScalarMap::CrossCorrelate.
+ public:
+  MultiScalarMap();
+
+  // The input maps must all have the same resolution.  The channels hold the
+  // over-density of each map; the conversion is done on a temporary copy, so
+  // the input maps themselves aren't modified.  Later changes to the input
+  // maps aren't seen by the MultiScalarMap.  If the first map has been
+  // divided into regions, that regionation is used for all of the channels.
+  MultiScalarMap(ScalarMapVector& scalar_maps);
+  ~MultiScalarMap();
+
+  // Re-initialize with a new set of ScalarMaps.  The return value is false
+  // (and the MultiScalarMap is left empty) if the input maps are empty or
+  // their resolutions don't match.
+  bool Initialize(ScalarMapVector& scalar_maps);
+
+  // Find the correlations between every pair of channels for all of the
+  // angular bins in wtheta whose resolution matches that of the map.  The
+  // output vector is filled with copies of wtheta, one per channel pair.  The
+  // second variant also accumulates the jack-knife values for each region.
+  // Bins using the annulus kernel (AngularBin::UseAnnulusKernel) weight each
+  // pixel pair by the same kernel fractions as the ScalarMap methods.
+  void CorrelationMatrix(AngularCorrelation& wtheta,
+			 WThetaVector& wtheta_matrix);
+  void CorrelationMatrixWithRegions(AngularCorrelation& wtheta,
+				    WThetaVector& wtheta_matrix);
+
+  // The zero-lag equivalent: the variance of each channel and the covariance
+  // between each pair of channels, in the same order as above.  With regions,
+  // the errors on those values come from the jack-knife samples, as in
+  // ScalarMap::CovarianceWithErrors.
+  void CovarianceMatrix(std::vector<double>& covariance);
+  void CovarianceMatrixWithErrors(std::vector<double>& covariance,
+				  std::vector<double>& covariance_error);
+
+  // The position of the (channel_a, channel_b) pair in the output vectors.
+  // The order of the channels doesn't matter.
+  uint32_t ChannelPairIndex(uint16_t channel_a, uint16_t channel_b);
+  uint32_t NChannelPair();
+
+  // If OpenMP is available, the pixels are divided among n_threads threads.
+  // The default (0) uses the OpenMP default.
+  void SetNThreads(uint16_t n_threads);
+  uint16_t NThreads();
+
+  uint16_t NChannel();
+  uint32_t Size();
+  uint32_t Resolution();
+  uint16_t NRegion();
+  bool Empty();
+  void Clear();
+
+ private:
+  // Accumulate the sums of the channel products for each angular bin.  The
+  // sums are kept separately for each pair of region indices (counting pixels
+  // outside the regionation as a region of their own), so that the
+  // jack-knife values can be built up afterwards.
+  void _CorrelationMatrix(AngularCorrelation& wtheta,
+			  WThetaVector& wtheta_matrix, bool use_regions);
+  void _AddPairProducts(uint32_t pix_a, uint32_t pix_b, double fraction,
+			double* intensity_sum, double* weight_sum);
+  uint32_t _RegionPairIndex(uint16_t region_a, uint16_t region_b);
+
+  // The region slot for a given pixel: its region index, or the extra slot at
+  // the end if it's outside the regionation or we're not using regions.
+  uint16_t _RegionSlot(uint32_t pix_idx, bool use_regions, uint16_t n_slot);
+
+  // The pixels are sorted by their y and then x index, so all of the pixels
+  // in a given row of the map are contiguous.
+  std::vector<uint64_t> pixel_key_;
+  std::vector<uint32_t> pixel_x_, pixel_y_;
+  std::vector<double> unit_sphere_x_, unit_sphere_y_, unit_sphere_z_;
+  std::vector<int16_t> region_;
+
+  // The intensity*weight and weight values for each pixel and channel, with
+  // all of the channels for a given pixel stored together.
+  std::vector<double> intensity_, weight_;
+
+  uint32_t resolution_;
+  uint16_t n_channel_, n_region_, n_threads_;
+};
+
+} // end namespace Stomp
+
+#endif
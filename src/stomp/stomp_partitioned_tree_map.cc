@@ -0,0 +1,533 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This file contains the PartitionedTreeMap class.  Each base level node of
+// the map is stored as a block of points on disk and read back into a
+// TreePixel on demand, with a least recently used cache limiting the number
+// of nodes in memory at any one time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include "stomp_core.h"
+#include "stomp_partitioned_tree_map.h"
+#include "stomp_angular_bin.h"
+#include "stomp_angular_correlation.h"
+
+namespace Stomp {
+
+PartitionedTreeMap::PartitionedTreeMap(const std::string& block_directory,
+				       uint32_t resolution,
+				       uint16_t maximum_points,
+				       uint16_t cache_size,
+				       uint32_t buffer_points) {
+  resolution_ = resolution;
+  maximum_points_ = maximum_points;
+  cache_size_ = (cache_size > 0 ? cache_size : 1);
+  buffer_points_ = (buffer_points > 0 ? buffer_points : 1);
+  buffer_count_ = 0;
+  point_count_ = 0;
+  block_reads_ = 0;
+  weight_ = 0.0;
+
+  if ((mkdir(block_directory.c_str(), 0755) != 0) && (errno != EEXIST)) {
+    std::cout << "Stomp::PartitionedTreeMap::PartitionedTreeMap - " <<
+      "Unable to create block directory " << block_directory << "\n" <<
+      "\tExiting...\n";
+    exit(2);
+  }
+
+  // Each instance writes to its own sub-directory so that block files left
+  // behind by an earlier run (or in use by another map) never get mixed in
+  // with ours.
+  std::string directory_template = block_directory + "/partition_XXXXXX";
+  std::vector<char> directory_name(directory_template.begin(),
+				   directory_template.end());
+  directory_name.push_back('\0');
+  if (mkdtemp(&directory_name[0]) == NULL) {
+    std::cout << "Stomp::PartitionedTreeMap::PartitionedTreeMap - " <<
+      "Unable to create a block sub-directory in " << block_directory <<
+      "\n\tExiting...\n";
+    exit(2);
+  }
+  block_directory_ = &directory_name[0];
+}
+
+PartitionedTreeMap::~PartitionedTreeMap() {
+  Clear();
+  rmdir(block_directory_.c_str());
+}
+
+bool PartitionedTreeMap::AddPoint(WeightedAngularCoordinate& w_ang) {
+  uint32_t pixnum = 0;
+  Pixel::Ang2Pix(resolution_, w_ang, pixnum);
+
+  buffer_[pixnum].push_back(WeightedAngularCoordinate(w_ang.UnitSphereX(),
+						      w_ang.UnitSphereY(),
+						      w_ang.UnitSphereZ(),
+						      w_ang.Weight()));
+  buffer_count_++;
+  point_count_++;
+  weight_ += w_ang.Weight();
+
+  // Any cached copy of this node is now out of date.
+  TreeDictIterator iter = cache_.find(pixnum);
+  if (iter != cache_.end()) {
+    iter->second->Clear();
+    delete iter->second;
+    cache_.erase(iter);
+    cache_order_.remove(pixnum);
+  }
+
+  bool added_point = true;
+  if (buffer_count_ >= buffer_points_) added_point = Flush();
+
+  return added_point;
+}
+
+bool PartitionedTreeMap::AddPoint(AngularCoordinate& ang,
+				  double object_weight) {
+  WeightedAngularCoordinate w_ang(ang.UnitSphereX(), ang.UnitSphereY(),
+				  ang.UnitSphereZ(), object_weight);
+  return AddPoint(w_ang);
+}
+
+bool PartitionedTreeMap::Flush() {
+  bool io_success = true;
+
+  for (BlockBufferIterator iter=buffer_.begin();iter!=buffer_.end();++iter) {
+    if (!_WriteBlock(iter->first, iter->second)) io_success = false;
+  }
+  buffer_.clear();
+  buffer_count_ = 0;
+
+  return io_success;
+}
+
+uint32_t PartitionedTreeMap::FindPairs(AngularCoordinate& ang,
+				       AngularBin& theta) {
+  uint32_t pair_count = 0;
+
+  Flush();
+
+  Pixel center_pix;
+  center_pix.SetResolution(resolution_);
+  PixelVector pix;
+  center_pix.BoundingRadius(ang, theta.ThetaMax(), pix);
+
+  for (PixelIterator pix_iter=pix.begin();pix_iter!=pix.end();++pix_iter) {
+    TreePixel* node = Node(pix_iter->Pixnum());
+    if (node != NULL) pair_count += node->FindPairs(ang, theta);
+  }
+
+  return pair_count;
+}
+
+uint32_t PartitionedTreeMap::FindPairs(AngularCoordinate& ang,
+				       double theta_min, double theta_max) {
+  AngularBin theta(theta_min, theta_max);
+  return FindPairs(ang, theta);
+}
+
+uint32_t PartitionedTreeMap::FindPairs(AngularCoordinate& ang,
+				       double theta_max) {
+  AngularBin theta(0.0, theta_max);
+  return FindPairs(ang, theta);
+}
+
+void PartitionedTreeMap::FindPairs(AngularVector& ang, AngularBin& theta) {
+  Flush();
+
+  BlockQueryDict queries;
+  for (uint32_t i=0;i<ang.size();i++)
+    _AddQuery(ang[i], i, theta.ThetaMax(), queries);
+
+  PixelVector nodes;
+  _QueryOrder(queries, nodes);
+
+  for (PixelIterator pix_iter=nodes.begin();
+       pix_iter!=nodes.end();++pix_iter) {
+    TreePixel* node = Node(pix_iter->Pixnum());
+    std::vector<uint32_t>& idx = queries[pix_iter->Pixnum()];
+    for (std::vector<uint32_t>::iterator iter=idx.begin();
+	 iter!=idx.end();++iter) node->FindPairs(ang[*iter], theta);
+  }
+}
+
+void PartitionedTreeMap::FindPairs(AngularVector& ang,
+				   AngularCorrelation& wtheta) {
+  Flush();
+
+  double theta_max = 0.0;
+  for (ThetaIterator theta_iter=wtheta.Begin(0);
+       theta_iter!=wtheta.End(0);++theta_iter)
+    if (theta_iter->ThetaMax() > theta_max) theta_max = theta_iter->ThetaMax();
+
+  BlockQueryDict queries;
+  for (uint32_t i=0;i<ang.size();i++)
+    _AddQuery(ang[i], i, theta_max, queries);
+
+  PixelVector nodes;
+  _QueryOrder(queries, nodes);
+
+  // Each node is handled for all of the angular bins before we move on to the
+  // next, so that the node is only read once.  The pixel-level bounds checks
+  // in TreePixel take care of pairs that are outside a given bin.
+  for (PixelIterator pix_iter=nodes.begin();
+       pix_iter!=nodes.end();++pix_iter) {
+    TreePixel* node = Node(pix_iter->Pixnum());
+    std::vector<uint32_t>& idx = queries[pix_iter->Pixnum()];
+    for (ThetaIterator theta_iter=wtheta.Begin(0);
+	 theta_iter!=wtheta.End(0);++theta_iter) {
+      for (std::vector<uint32_t>::iterator iter=idx.begin();
+	   iter!=idx.end();++iter) node->FindPairs(ang[*iter], *theta_iter);
+    }
+  }
+}
+
+double PartitionedTreeMap::FindWeightedPairs(AngularCoordinate& ang,
+					     AngularBin& theta) {
+  double total_weight = 0.0;
+
+  Flush();
+
+  Pixel center_pix;
+  center_pix.SetResolution(resolution_);
+  PixelVector pix;
+  center_pix.BoundingRadius(ang, theta.ThetaMax(), pix);
+
+  for (PixelIterator pix_iter=pix.begin();pix_iter!=pix.end();++pix_iter) {
+    TreePixel* node = Node(pix_iter->Pixnum());
+    if (node != NULL) total_weight += node->FindWeightedPairs(ang, theta);
+  }
+
+  return total_weight;
+}
+
+double PartitionedTreeMap::FindWeightedPairs(AngularCoordinate& ang,
+					     double theta_min,
+					     double theta_max) {
+  AngularBin theta(theta_min, theta_max);
+  return FindWeightedPairs(ang, theta);
+}
+
+double PartitionedTreeMap::FindWeightedPairs(AngularCoordinate& ang,
+					     double theta_max) {
+  AngularBin theta(0.0, theta_max);
+  return FindWeightedPairs(ang, theta);
+}
+
+void PartitionedTreeMap::FindWeightedPairs(AngularVector& ang,
+					   AngularBin& theta) {
+  Flush();
+
+  BlockQueryDict queries;
+  for (uint32_t i=0;i<ang.size();i++)
+    _AddQuery(ang[i], i, theta.ThetaMax(), queries);
+
+  PixelVector nodes;
+  _QueryOrder(queries, nodes);
+
+  for (PixelIterator pix_iter=nodes.begin();
+       pix_iter!=nodes.end();++pix_iter) {
+    TreePixel* node = Node(pix_iter->Pixnum());
+    std::vector<uint32_t>& idx = queries[pix_iter->Pixnum()];
+    for (std::vector<uint32_t>::iterator iter=idx.begin();
+	 iter!=idx.end();++iter) node->FindWeightedPairs(ang[*iter], theta);
+  }
+}
+
+void PartitionedTreeMap::FindWeightedPairs(AngularVector& ang,
+					   AngularCorrelation& wtheta) {
+  Flush();
+
+  double theta_max = 0.0;
+  for (ThetaIterator theta_iter=wtheta.Begin(0);
+       theta_iter!=wtheta.End(0);++theta_iter)
+    if (theta_iter->ThetaMax() > theta_max) theta_max = theta_iter->ThetaMax();
+
+  BlockQueryDict queries;
+  for (uint32_t i=0;i<ang.size();i++)
+    _AddQuery(ang[i], i, theta_max, queries);
+
+  PixelVector nodes;
+  _QueryOrder(queries, nodes);
+
+  for (PixelIterator pix_iter=nodes.begin();
+       pix_iter!=nodes.end();++pix_iter) {
+    TreePixel* node = Node(pix_iter->Pixnum());
+    std::vector<uint32_t>& idx = queries[pix_iter->Pixnum()];
+    for (ThetaIterator theta_iter=wtheta.Begin(0);
+	 theta_iter!=wtheta.End(0);++theta_iter) {
+      for (std::vector<uint32_t>::iterator iter=idx.begin();
+	   iter!=idx.end();++iter)
+	node->FindWeightedPairs(ang[*iter], *theta_iter);
+    }
+  }
+}
+
+double PartitionedTreeMap::FindWeightedPairs(WeightedAngularCoordinate& w_ang,
+					     AngularBin& theta) {
+  double total_weight = 0.0;
+
+  Flush();
+
+  Pixel center_pix;
+  center_pix.SetResolution(resolution_);
+  PixelVector pix;
+  center_pix.BoundingRadius(w_ang, theta.ThetaMax(), pix);
+
+  for (PixelIterator pix_iter=pix.begin();pix_iter!=pix.end();++pix_iter) {
+    TreePixel* node = Node(pix_iter->Pixnum());
+    if (node != NULL) total_weight += node->FindWeightedPairs(w_ang, theta);
+  }
+
+  return total_weight;
+}
+
+void PartitionedTreeMap::FindWeightedPairs(WAngularVector& w_ang,
+					   AngularBin& theta) {
+  Flush();
+
+  BlockQueryDict queries;
+  for (uint32_t i=0;i<w_ang.size();i++)
+    _AddQuery(w_ang[i], i, theta.ThetaMax(), queries);
+
+  PixelVector nodes;
+  _QueryOrder(queries, nodes);
+
+  for (PixelIterator pix_iter=nodes.begin();
+       pix_iter!=nodes.end();++pix_iter) {
+    TreePixel* node = Node(pix_iter->Pixnum());
+    std::vector<uint32_t>& idx = queries[pix_iter->Pixnum()];
+    for (std::vector<uint32_t>::iterator iter=idx.begin();
+	 iter!=idx.end();++iter) node->FindWeightedPairs(w_ang[*iter], theta);
+  }
+}
+
+void PartitionedTreeMap::FindWeightedPairs(WAngularVector& w_ang,
+					   AngularCorrelation& wtheta) {
+  Flush();
+
+  double theta_max = 0.0;
+  for (ThetaIterator theta_iter=wtheta.Begin(0);
+       theta_iter!=wtheta.End(0);++theta_iter)
+    if (theta_iter->ThetaMax() > theta_max) theta_max = theta_iter->ThetaMax();
+
+  BlockQueryDict queries;
+  for (uint32_t i=0;i<w_ang.size();i++)
+    _AddQuery(w_ang[i], i, theta_max, queries);
+
+  PixelVector nodes;
+  _QueryOrder(queries, nodes);
+
+  for (PixelIterator pix_iter=nodes.begin();
+       pix_iter!=nodes.end();++pix_iter) {
+    TreePixel* node = Node(pix_iter->Pixnum());
+    std::vector<uint32_t>& idx = queries[pix_iter->Pixnum()];
+    for (ThetaIterator theta_iter=wtheta.Begin(0);
+	 theta_iter!=wtheta.End(0);++theta_iter) {
+      for (std::vector<uint32_t>::iterator iter=idx.begin();
+	   iter!=idx.end();++iter)
+	node->FindWeightedPairs(w_ang[*iter], *theta_iter);
+    }
+  }
+}
+
+TreePixel* PartitionedTreeMap::Node(uint32_t pixnum) {
+  if (buffer_count_ > 0) Flush();
+
+  if (block_points_.find(pixnum) == block_points_.end()) return NULL;
+
+  TreeDictIterator iter = cache_.find(pixnum);
+  if (iter != cache_.end()) {
+    // Move this node to the front of the queue.
+    cache_order_.remove(pixnum);
+    cache_order_.push_front(pixnum);
+    return iter->second;
+  }
+
+  _TrimCache(cache_size_ - 1);
+
+  TreePixel* node = _ReadBlock(pixnum);
+  cache_[pixnum] = node;
+  cache_order_.push_front(pixnum);
+
+  return node;
+}
+
+uint32_t PartitionedTreeMap::Superpixnum(uint32_t pixnum) {
+  uint32_t superpixnum = 0;
+  Pixel::SuperPix(resolution_, pixnum, HPixResolution, superpixnum);
+  return superpixnum;
+}
+
+uint32_t PartitionedTreeMap::Resolution() {
+  return resolution_;
+}
+
+uint16_t PartitionedTreeMap::PixelCapacity() {
+  return maximum_points_;
+}
+
+uint16_t PartitionedTreeMap::CacheSize() {
+  return cache_size_;
+}
+
+void PartitionedTreeMap::SetCacheSize(uint16_t cache_size) {
+  cache_size_ = (cache_size > 0 ? cache_size : 1);
+  _TrimCache(cache_size_);
+}
+
+uint16_t PartitionedTreeMap::CachedNodes() {
+  return cache_.size();
+}
+
+const std::string& PartitionedTreeMap::BlockDirectory() {
+  return block_directory_;
+}
+
+uint32_t PartitionedTreeMap::NPoints() {
+  return point_count_;
+}
+
+double PartitionedTreeMap::Weight() {
+  return weight_;
+}
+
+uint16_t PartitionedTreeMap::BaseNodes() {
+  // Any buffered nodes that haven't been written yet still count.
+  uint16_t n_nodes = block_points_.size();
+  for (BlockBufferIterator iter=buffer_.begin();iter!=buffer_.end();++iter)
+    if (block_points_.find(iter->first) == block_points_.end()) n_nodes++;
+  return n_nodes;
+}
+
+uint32_t PartitionedTreeMap::BlockReads() {
+  return block_reads_;
+}
+
+bool PartitionedTreeMap::Empty() {
+  return (point_count_ == 0 ? true : false);
+}
+
+void PartitionedTreeMap::Clear() {
+  _TrimCache(0);
+
+  for (BlockDictIterator iter=block_points_.begin();
+       iter!=block_points_.end();++iter)
+    remove(_BlockFileName(iter->first).c_str());
+
+  block_points_.clear();
+  buffer_.clear();
+  buffer_count_ = 0;
+  point_count_ = 0;
+  weight_ = 0.0;
+}
+
+std::string PartitionedTreeMap::_BlockFileName(uint32_t pixnum) {
+  std::ostringstream file_name;
+  file_name << block_directory_ << "/block_" << resolution_ << "_" <<
+    pixnum << ".bin";
+  return file_name.str();
+}
+
+bool PartitionedTreeMap::_WriteBlock(uint32_t pixnum, WAngularVector& w_ang) {
+  FILE* block_file = fopen(_BlockFileName(pixnum).c_str(), "ab");
+  if (block_file == NULL) {
+    std::cout << "Stomp::PartitionedTreeMap::_WriteBlock - " <<
+      "Unable to open " << _BlockFileName(pixnum) << "\n";
+    return false;
+  }
+
+  bool io_success = true;
+  double point[4];
+  for (WAngularIterator iter=w_ang.begin();iter!=w_ang.end();++iter) {
+    point[0] = iter->UnitSphereX();
+    point[1] = iter->UnitSphereY();
+    point[2] = iter->UnitSphereZ();
+    point[3] = iter->Weight();
+    if (fwrite(point, sizeof(double), 4, block_file) != 4) io_success = false;
+  }
+  fclose(block_file);
+
+  if (io_success) block_points_[pixnum] += w_ang.size();
+
+  return io_success;
+}
+
+TreePixel* PartitionedTreeMap::_ReadBlock(uint32_t pixnum) {
+  FILE* block_file = fopen(_BlockFileName(pixnum).c_str(), "rb");
+  if (block_file == NULL) {
+    std::cout << "Stomp::PartitionedTreeMap::_ReadBlock - " <<
+      "Unable to open " << _BlockFileName(pixnum) << "\n" <<
+      "\tExiting...\n";
+    exit(2);
+  }
+
+  TreePixel* node = new TreePixel(resolution_, pixnum, maximum_points_);
+
+  double point[4];
+  while (fread(point, sizeof(double), 4, block_file) == 4) {
+    node->AddPoint(new WeightedAngularCoordinate(point[0], point[1],
+						 point[2], point[3]));
+  }
+  fclose(block_file);
+
+  block_reads_++;
+
+  return node;
+}
+
+void PartitionedTreeMap::_TrimCache(uint16_t cache_size) {
+  while (cache_.size() > cache_size) {
+    uint32_t pixnum = cache_order_.back();
+    cache_order_.pop_back();
+    TreeDictIterator iter = cache_.find(pixnum);
+    iter->second->Clear();
+    delete iter->second;
+    cache_.erase(iter);
+  }
+}
+
+void PartitionedTreeMap::_AddQuery(AngularCoordinate& ang, uint32_t idx,
+				   double theta_max, BlockQueryDict& queries) {
+  Pixel center_pix;
+  center_pix.SetResolution(resolution_);
+  PixelVector pix;
+  center_pix.BoundingRadius(ang, theta_max, pix);
+
+  for (PixelIterator pix_iter=pix.begin();pix_iter!=pix.end();++pix_iter) {
+    if (block_points_.find(pix_iter->Pixnum()) != block_points_.end())
+      queries[pix_iter->Pixnum()].push_back(idx);
+  }
+}
+
+void PartitionedTreeMap::_QueryOrder(BlockQueryDict& queries,
+				     PixelVector& nodes) {
+  // Pixnum order runs along rows of the full sky, so we re-order the nodes
+  // to keep the ones in the same superpixel together.
+  nodes.clear();
+  nodes.reserve(queries.size());
+  for (BlockQueryIterator iter=queries.begin();iter!=queries.end();++iter) {
+    uint32_t x = 0, y = 0;
+    Pixel::Pix2XY(resolution_, iter->first, x, y);
+    nodes.push_back(Pixel(x, y, resolution_));
+  }
+  sort(nodes.begin(), nodes.end(), Pixel::SuperPixelBasedOrder);
+}
+
+} // end namespace Stomp
@@ -0,0 +1,178 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This header file contains the PartitionedTreeMap class.  TreeMap keeps all
+// of its points and nodes in memory, which becomes impossible for very large
+// catalogs (random catalogs with 10^9 points, for instance).  The
+// PartitionedTreeMap instead stores the points for each base level node in a
+// separate block on disk and only builds the TreePixel for that node when it
+// is needed, keeping a limited number of those nodes around in a least
+// recently used cache.
+
+#ifndef STOMP_PARTITIONED_TREE_MAP_H
+#define STOMP_PARTITIONED_TREE_MAP_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include "stomp_core.h"
+#include "stomp_angular_coordinate.h"
+#include "stomp_tree_pixel.h"
+#include "stomp_tree_map.h"
+
+namespace Stomp {
+
+class AngularBin;           // class definition in stomp_angular_bin.h
+class AngularCorrelation;   // class definition in stomp_angular_correlation.h
+class PartitionedTreeMap;
+
+typedef std::map<const uint32_t, uint32_t> BlockDict;
+typedef BlockDict::iterator BlockDictIterator;
+
+typedef std::map<const uint32_t, WAngularVector> BlockBufferDict;
+typedef BlockBufferDict::iterator BlockBufferIterator;
+
+typedef std::map<const uint32_t, std::vector<uint32_t> > BlockQueryDict;
+typedef BlockQueryDict::iterator BlockQueryIterator;
+
+class PartitionedTreeMap {
+  // An out-of-core variant of the TreeMap.  As with TreeMap, points are
+  // assigned to base level nodes at a fixed resolution, keyed by their
+  // pixnum.  Rather than keeping those nodes in memory, though, each node's
+  // points are written to a binary block file in the input directory.  When a
+  // query needs a node, the block is read back into a TreePixel (which builds
+  // the usual sub-node structure) and that TreePixel is kept in a cache of
+  // fixed size.  When the cache is full, the least recently used node is
+  // dropped.
+  //
+  // The vector forms of the pair finding methods first work out every base
+  // node that each input point might touch, sort those (node, point) pairs by
+  // superpixel and node and then do all of the work for a given node at once.
+  // Hence, each block is read at most once per pass through the input points,
+  // regardless of the cache size.  The single point methods go through the
+  // cache, so a cache that is large enough to hold the nodes around a typical
+  // query will avoid repeated reads.
+  //
+  // Block files are written in the machine's native binary format and are
+  // intended as scratch space.  Each map puts its files in a new, uniquely
+  // named sub-directory of the input directory, so several maps (or an
+  // earlier, aborted run) can share the same scratch directory.  The files
+  // are removed when the map is cleared and the sub-directory when the map
+  // is destroyed.  Only the position and Weight of each point are stored, so any
+  // Field values attached to the input points are not available to the
+  // pair finding methods.
+
+ public:
+  // The block directory will be created if it does not already exist.  The
+  // resolution and maximum points per node have the same meaning as in
+  // TreeMap.  The cache size is the number of base level nodes that will be
+  // kept in memory at any given time and buffer_points is the total number of
+  // points that will be held in memory during ingest before they are appended
+  // to their block files.
+  PartitionedTreeMap(const std::string& block_directory,
+		     uint32_t resolution=HPixResolution,
+		     uint16_t maximum_points=50, uint16_t cache_size=16,
+		     uint32_t buffer_points=1000000);
+  ~PartitionedTreeMap();
+
+  // Add points to the map.  Unlike TreeMap, the map never takes ownership of
+  // the input point; its position and weight are copied into the ingest
+  // buffer.  The returned boolean indicates whether the point could be
+  // written to the buffer.
+  bool AddPoint(WeightedAngularCoordinate& w_ang);
+  bool AddPoint(AngularCoordinate& ang, double object_weight = 1.0);
+
+  // Write any buffered points to their block files.  This is called
+  // automatically before any query, but it can be called explicitly once
+  // ingest is done to release the buffer memory.
+  bool Flush();
+
+  // The pair finding methods mirror those in TreeMap.  The single point
+  // versions return the number of pairs (or the sum of the weights); the
+  // vector versions put the results in the Counter and Weight values for
+  // each angular bin.
+  uint32_t FindPairs(AngularCoordinate& ang, AngularBin& theta);
+  uint32_t FindPairs(AngularCoordinate& ang,
+		     double theta_min, double theta_max);
+  uint32_t FindPairs(AngularCoordinate& ang, double theta_max);
+  void FindPairs(AngularVector& ang, AngularBin& theta);
+  void FindPairs(AngularVector& ang, AngularCorrelation& wtheta);
+
+  double FindWeightedPairs(AngularCoordinate& ang, AngularBin& theta);
+  double FindWeightedPairs(AngularCoordinate& ang,
+			   double theta_min, double theta_max);
+  double FindWeightedPairs(AngularCoordinate& ang, double theta_max);
+  void FindWeightedPairs(AngularVector& ang, AngularBin& theta);
+  void FindWeightedPairs(AngularVector& ang, AngularCorrelation& wtheta);
+
+  double FindWeightedPairs(WeightedAngularCoordinate& w_ang,
+			   AngularBin& theta);
+  void FindWeightedPairs(WAngularVector& w_ang, AngularBin& theta);
+  void FindWeightedPairs(WAngularVector& w_ang,
+			 AngularCorrelation& wtheta);
+
+  // Access to the node for a given base level pixnum, loading it from disk
+  // if necessary.  The returned pointer is owned by the cache and is only
+  // guaranteed to be valid until the next call that touches the cache.  If
+  // there are no points in the requested node, the return value is NULL.
+  TreePixel* Node(uint32_t pixnum);
+
+  // Since the queries are ordered by superpixel, it is occasionally useful to
+  // know the superpixel that a given base level node belongs to.
+  uint32_t Superpixnum(uint32_t pixnum);
+
+  // Some getters and setters.  Shrinking the cache will drop the least
+  // recently used nodes until the new size is reached.
+  uint32_t Resolution();
+  uint16_t PixelCapacity();
+  uint16_t CacheSize();
+  void SetCacheSize(uint16_t cache_size);
+  uint16_t CachedNodes();
+
+  // The sub-directory holding this map's block files.
+  const std::string& BlockDirectory();
+
+  // Total number of points and weight in the map, the number of base level
+  // nodes (i.e. blocks on disk) and the number of blocks that have been read
+  // from disk since the map was created.
+  uint32_t NPoints();
+  double Weight();
+  uint16_t BaseNodes();
+  uint32_t BlockReads();
+  bool Empty();
+
+  // Remove all of the block files and cached nodes.
+  void Clear();
+
+ private:
+  std::string _BlockFileName(uint32_t pixnum);
+  bool _WriteBlock(uint32_t pixnum, WAngularVector& w_ang);
+  TreePixel* _ReadBlock(uint32_t pixnum);
+  void _TrimCache(uint16_t cache_size);
+  void _AddQuery(AngularCoordinate& ang, uint32_t idx, double theta_max,
+		 BlockQueryDict& queries);
+  void _QueryOrder(BlockQueryDict& queries, PixelVector& nodes);
+
+  std::string block_directory_;
+  BlockDict block_points_;
+  BlockBufferDict buffer_;
+  TreeDict cache_;
+  std::list<uint32_t> cache_order_;
+  uint16_t maximum_points_, cache_size_;
+  uint32_t resolution_, point_count_, buffer_points_, buffer_count_;
+  uint32_t block_reads_;
+  double weight_;
+};
+
+} // end namespace Stomp
+
+#endif
@@ -2208,6 +2208,273 @@ void Pixel::Pix2XY(uint32_t resolution, uint32_t pixnum,
   x = pixnum - Nx0*resolution*y;
 }
 
+// For the array forms of the index methods, we need integer division by the
+// number of pixels in a row, which isn't a power of two and so can't be
+// vectorized as a shift.  Instead, we do the division in double precision
+// (exact for 32-bit integers) and correct the rounding of the reciprocal.
+static inline uint32_t _ArrayDivide(uint32_t numerator, double denominator,
+				    double inv_denominator) {
+  double quotient = floor(numerator*inv_denominator);
+  double remainder = numerator - quotient*denominator;
+  quotient += (remainder >= denominator ? 1.0 : 0.0);
+  quotient -= (remainder < 0.0 ? 1.0 : 0.0);
+  return static_cast<uint32_t>(quotient);
+}
+
+void Pixel::Pix2XY(uint32_t resolution, const uint32_t* pixnum,
+		   uint32_t n_pixel, uint32_t* x, uint32_t* y) {
+  uint32_t nx = Nx0*resolution;
+  double inv_nx = 1.0/nx;
+
+#ifdef _OPENMP
+#pragma omp parallel for simd schedule(static) \
+  if (n_pixel >= MinParallelArraySize)
+#endif
+  for (uint32_t i=0;i<n_pixel;i++) {
+    uint32_t tmp_y = _ArrayDivide(pixnum[i], nx, inv_nx);
+    y[i] = tmp_y;
+    x[i] = pixnum[i] - nx*tmp_y;
+  }
+}
+
+void Pixel::XY2Pix(uint32_t resolution, const uint32_t* x, const uint32_t* y,
+		   uint32_t n_pixel, uint32_t* pixnum) {
+  uint32_t nx = Nx0*resolution;
+
+#ifdef _OPENMP
+#pragma omp parallel for simd schedule(static) \
+  if (n_pixel >= MinParallelArraySize)
+#endif
+  for (uint32_t i=0;i<n_pixel;i++) pixnum[i] = nx*y[i] + x[i];
+}
+
+void Pixel::Pix2HPix(uint32_t resolution, const uint32_t* pixnum,
+		     uint32_t n_pixel, uint32_t* hpixnum,
+		     uint32_t* superpixnum) {
+  uint32_t nx = Nx0*resolution;
+  double inv_nx = 1.0/nx;
+
+  // The number of pixels on a side of a superpixel is a power of two, so
+  // the rest of the arithmetic is shifts and masks.
+  uint8_t hpix_shift = ResolutionToLevel(resolution) - HPixLevel;
+  uint32_t hpix_mask = (1 << hpix_shift) - 1;
+
+#ifdef _OPENMP
+#pragma omp parallel for simd schedule(static) \
+  if (n_pixel >= MinParallelArraySize)
+#endif
+  for (uint32_t i=0;i<n_pixel;i++) {
+    uint32_t y = _ArrayDivide(pixnum[i], nx, inv_nx);
+    uint32_t x = pixnum[i] - nx*y;
+    hpixnum[i] = ((y & hpix_mask) << hpix_shift) + (x & hpix_mask);
+    superpixnum[i] = Nx0*HPixResolution*(y >> hpix_shift) + (x >> hpix_shift);
+  }
+}
+
+void Pixel::HPix2Pix(uint32_t resolution, const uint32_t* hpixnum,
+		     const uint32_t* superpixnum, uint32_t n_pixel,
+		     uint32_t* pixnum) {
+  uint32_t nx = Nx0*resolution;
+  double superpix_nx = Nx0*HPixResolution;
+  double inv_superpix_nx = 1.0/superpix_nx;
+  uint8_t hpix_shift = ResolutionToLevel(resolution) - HPixLevel;
+  uint32_t hpix_mask = (1 << hpix_shift) - 1;
+
+#ifdef _OPENMP
+#pragma omp parallel for simd schedule(static) \
+  if (n_pixel >= MinParallelArraySize)
+#endif
+  for (uint32_t i=0;i<n_pixel;i++) {
+    uint32_t y0 = _ArrayDivide(superpixnum[i], superpix_nx, inv_superpix_nx);
+    uint32_t x0 = superpixnum[i] - Nx0*HPixResolution*y0;
+    uint32_t y = (y0 << hpix_shift) + (hpixnum[i] >> hpix_shift);
+    uint32_t x = (x0 << hpix_shift) + (hpixnum[i] & hpix_mask);
+    pixnum[i] = nx*y + x;
+  }
+}
+
+bool Pixel::SuperPix(uint32_t hi_resolution, const uint32_t* hi_pixnum,
+		     uint32_t n_pixel, uint32_t lo_resolution,
+		     uint32_t* lo_pixnum) {
+  if (hi_resolution < lo_resolution) {
+    std::cout << "Stomp::Pixel::SuperPix - " <<
+      "Can't go from low resolution to higher resolution.\n";
+    return false;
+  }
+
+  uint32_t nx_hi = Nx0*hi_resolution;
+  uint32_t nx_lo = Nx0*lo_resolution;
+  double inv_nx_hi = 1.0/nx_hi;
+  uint8_t shift = ResolutionToLevel(hi_resolution) -
+    ResolutionToLevel(lo_resolution);
+
+#ifdef _OPENMP
+#pragma omp parallel for simd schedule(static) \
+  if (n_pixel >= MinParallelArraySize)
+#endif
+  for (uint32_t i=0;i<n_pixel;i++) {
+    uint32_t y = _ArrayDivide(hi_pixnum[i], nx_hi, inv_nx_hi);
+    uint32_t x = hi_pixnum[i] - nx_hi*y;
+    lo_pixnum[i] = nx_lo*(y >> shift) + (x >> shift);
+  }
+
+  return true;
+}
+
+bool Pixel::SubPixels(uint32_t lo_resolution, const uint32_t* lo_pixnum,
+		      uint32_t n_pixel, uint32_t hi_resolution,
+		      uint32_t* x_min, uint32_t* x_max, uint32_t* y_min,
+		      uint32_t* y_max) {
+  if (hi_resolution < lo_resolution) {
+    std::cout << "Stomp::Pixel::SubPixels - " <<
+      "Can't go from high resolution to lower resolution.\n";
+    return false;
+  }
+
+  uint32_t nx_lo = Nx0*lo_resolution;
+  double inv_nx_lo = 1.0/nx_lo;
+  uint8_t shift = ResolutionToLevel(hi_resolution) -
+    ResolutionToLevel(lo_resolution);
+  uint32_t last_sub_pix = (1 << shift) - 1;
+
+#ifdef _OPENMP
+#pragma omp parallel for simd schedule(static) \
+  if (n_pixel >= MinParallelArraySize)
+#endif
+  for (uint32_t i=0;i<n_pixel;i++) {
+    uint32_t y = _ArrayDivide(lo_pixnum[i], nx_lo, inv_nx_lo);
+    uint32_t x = lo_pixnum[i] - nx_lo*y;
+    x_min[i] = x << shift;
+    x_max[i] = (x << shift) + last_sub_pix;
+    y_min[i] = y << shift;
+    y_max[i] = (y << shift) + last_sub_pix;
+  }
+
+  return true;
+}
+
+void Pixel::PixelBound(uint32_t resolution, const uint32_t* pixnum,
+		       uint32_t n_pixel, double* lammin, double* lammax,
+		       double* etamin, double* etamax) {
+  uint32_t nx = Nx0*resolution;
+  uint32_t ny = Ny0*resolution;
+  double inv_nx = 1.0/nx;
+
+#ifdef _OPENMP
+#pragma omp parallel for simd schedule(static) \
+  if (n_pixel >= MinParallelArraySize)
+#endif
+  for (uint32_t i=0;i<n_pixel;i++) {
+    uint32_t y = _ArrayDivide(pixnum[i], nx, inv_nx);
+    uint32_t x = pixnum[i] - nx*y;
+
+    lammin[i] = 90.0 - RadToDeg*acos(1.0 - 2.0*(y+1)/ny);
+    lammax[i] = 90.0 - RadToDeg*acos(1.0 - 2.0*y/ny);
+    double tmp_etamin = RadToDeg*2.0*Pi*(x+0.0)/nx + EtaOffSet;
+    double tmp_etamax = RadToDeg*2.0*Pi*(x+1.0)/nx + EtaOffSet;
+    etamin[i] = (tmp_etamin >= 180.0 ? tmp_etamin - 360.0 : tmp_etamin);
+    etamax[i] = (tmp_etamax >= 180.0 ? tmp_etamax - 360.0 : tmp_etamax);
+  }
+}
+
+void Pixel::Pix2Ang(uint32_t resolution, const uint32_t* pixnum,
+		    uint32_t n_pixel, double* lambda, double* eta) {
+  uint32_t nx = Nx0*resolution;
+  uint32_t ny = Ny0*resolution;
+  double inv_nx = 1.0/nx;
+
+  // Unlike the scalar form, there's no AngularCoordinate to wrap eta back
+  // into [-180, 180), so we do that here.
+#ifdef _OPENMP
+#pragma omp parallel for simd schedule(static) \
+  if (n_pixel >= MinParallelArraySize)
+#endif
+  for (uint32_t i=0;i<n_pixel;i++) {
+    uint32_t y = _ArrayDivide(pixnum[i], nx, inv_nx);
+    uint32_t x = pixnum[i] - nx*y;
+
+    lambda[i] = 90.0 - RadToDeg*acos(1.0-2.0*(y+0.5)/ny);
+    double tmp_eta = RadToDeg*(2.0*Pi*(x+0.5))/nx + EtaOffSet;
+    eta[i] = (tmp_eta >= 180.0 ? tmp_eta - 360.0 : tmp_eta);
+  }
+}
+
+void Pixel::Ang2Pix(uint32_t resolution, const double* lambda,
+		    const double* eta, uint32_t n_pixel, uint32_t* pixnum) {
+  uint32_t nx = Nx0*resolution;
+  uint32_t ny = Ny0*resolution;
+
+#ifdef _OPENMP
+#pragma omp parallel for simd schedule(static) \
+  if (n_pixel >= MinParallelArraySize)
+#endif
+  for (uint32_t i=0;i<n_pixel;i++) {
+    double tmp_eta = (eta[i] - EtaOffSet)*DegToRad;
+    if (tmp_eta <= 0.0) tmp_eta += 2.0*Pi;
+    tmp_eta /= 2.0*Pi;
+    uint32_t x = static_cast<uint32_t>(nx*tmp_eta);
+
+    double tmp_lambda = (90.0 - lambda[i])*DegToRad;
+    uint32_t y = (tmp_lambda >= Pi ? ny - 1 :
+		  static_cast<uint32_t>(ny*((1.0 - cos(tmp_lambda))/2.0)));
+
+    pixnum[i] = nx*y + x;
+  }
+}
+
+void Pixel::Ang2HPix(uint32_t resolution, const double* lambda,
+		     const double* eta, uint32_t n_pixel,
+		     uint32_t* hpixnum, uint32_t* superpixnum) {
+  uint32_t nx = Nx0*resolution;
+  uint32_t ny = Ny0*resolution;
+  uint8_t hpix_shift = ResolutionToLevel(resolution) - HPixLevel;
+  uint32_t hpix_mask = (1 << hpix_shift) - 1;
+
+#ifdef _OPENMP
+#pragma omp parallel for simd schedule(static) \
+  if (n_pixel >= MinParallelArraySize)
+#endif
+  for (uint32_t i=0;i<n_pixel;i++) {
+    double tmp_eta = (eta[i] - EtaOffSet)*DegToRad;
+    if (tmp_eta <= 0.0) tmp_eta += 2.0*Pi;
+    tmp_eta /= 2.0*Pi;
+    uint32_t x = static_cast<uint32_t>(nx*tmp_eta);
+
+    double tmp_lambda = (90.0 - lambda[i])*DegToRad;
+    uint32_t y = (tmp_lambda >= Pi ? ny - 1 :
+		  static_cast<uint32_t>(ny*((1.0 - cos(tmp_lambda))/2.0)));
+
+    hpixnum[i] = ((y & hpix_mask) << hpix_shift) + (x & hpix_mask);
+    superpixnum[i] = Nx0*HPixResolution*(y >> hpix_shift) + (x >> hpix_shift);
+  }
+}
+
+void Pixel::HPix2Ang(uint32_t resolution, const uint32_t* hpixnum,
+		     const uint32_t* superpixnum, uint32_t n_pixel,
+		     double* lambda, double* eta) {
+  uint32_t nx = Nx0*resolution;
+  uint32_t ny = Ny0*resolution;
+  double superpix_nx = Nx0*HPixResolution;
+  double inv_superpix_nx = 1.0/superpix_nx;
+  uint8_t hpix_shift = ResolutionToLevel(resolution) - HPixLevel;
+  uint32_t hpix_mask = (1 << hpix_shift) - 1;
+
+#ifdef _OPENMP
+#pragma omp parallel for simd schedule(static) \
+  if (n_pixel >= MinParallelArraySize)
+#endif
+  for (uint32_t i=0;i<n_pixel;i++) {
+    uint32_t y0 = _ArrayDivide(superpixnum[i], superpix_nx, inv_superpix_nx);
+    uint32_t x0 = superpixnum[i] - Nx0*HPixResolution*y0;
+    uint32_t y = (y0 << hpix_shift) + (hpixnum[i] >> hpix_shift);
+    uint32_t x = (x0 << hpix_shift) + (hpixnum[i] & hpix_mask);
+
+    lambda[i] = 90.0 - RadToDeg*acos(1.0-2.0*(y+0.5)/ny);
+    double tmp_eta = RadToDeg*(2.0*Pi*(x+0.5))/nx + EtaOffSet;
+    eta[i] = (tmp_eta >= 180.0 ? tmp_eta - 360.0 : tmp_eta);
+  }
+}
+
 bool Pixel::LocalOrder(Pixel pix_a, Pixel pix_b) {
   if (pix_a.Resolution() == pix_b.Resolution()) {
     if (pix_a.PixelY() == pix_b.PixelY()) {
@@ -2466,7 +2733,7 @@ void Pixel::Ang2HPix(uint32_t input_resolution, AngularCoordinate& ang,
   x -= x0*hnx;
   y -= y0*hnx;
 
-  output_hpixnum = nx*y + x;
+  output_hpixnum = hnx*y + x;
   output_superpixnum = Nx0*HPixResolution*y0 + x0;
 }
 
@@ -2500,8 +2767,8 @@ void Pixel::XY2HPix(uint32_t input_resolution, uint32_t x,
   uint32_t x0 = x/hnx;
   uint32_t y0 = y/hnx;
 
-  x -= x0;
-  y -= y0;
+  x -= x0*hnx;
+  y -= y0*hnx;
 
   output_hpixnum = hnx*y + x;
   output_superpixnum = Nx0*HPixResolution*y0 + x0;
@@ -439,6 +439,49 @@ class Pixel {
   static void Pix2XY(uint32_t resolution, uint32_t pixnum,
 		     uint32_t& x, uint32_t& y);
 
+  // Array forms of the methods above for whole catalogs of pixels or
+  // points.  Each takes n_pixel values from contiguous input arrays and
+  // writes to caller-allocated output arrays of the same length, giving the
+  // same results as calling the scalar method on each element.  The loops
+  // are written so that the compiler can vectorize them (the divisions by
+  // the non-power-of-two row length are done in double precision and
+  // corrected back to exact integers) and are split among OpenMP threads
+  // for arrays longer than MinParallelArraySize.  As with the scalar forms,
+  // the pixnum-based methods are limited to resolutions where the pixel
+  // index fits in 32 bits (MaxPixnum).  Angles are in Survey coordinates
+  // and degrees.  The resolution-changing methods return false (and leave
+  // the outputs untouched) if the resolutions are in the wrong order.
+  static void Pix2XY(uint32_t resolution, const uint32_t* pixnum,
+		     uint32_t n_pixel, uint32_t* x, uint32_t* y);
+  static void XY2Pix(uint32_t resolution, const uint32_t* x,
+		     const uint32_t* y, uint32_t n_pixel, uint32_t* pixnum);
+  static void Pix2HPix(uint32_t resolution, const uint32_t* pixnum,
+		       uint32_t n_pixel, uint32_t* hpixnum,
+		       uint32_t* superpixnum);
+  static void HPix2Pix(uint32_t resolution, const uint32_t* hpixnum,
+		       const uint32_t* superpixnum, uint32_t n_pixel,
+		       uint32_t* pixnum);
+  static bool SuperPix(uint32_t hi_resolution, const uint32_t* hi_pixnum,
+		       uint32_t n_pixel, uint32_t lo_resolution,
+		       uint32_t* lo_pixnum);
+  static bool SubPixels(uint32_t lo_resolution, const uint32_t* lo_pixnum,
+			uint32_t n_pixel, uint32_t hi_resolution,
+			uint32_t* x_min, uint32_t* x_max, uint32_t* y_min,
+			uint32_t* y_max);
+  static void PixelBound(uint32_t resolution, const uint32_t* pixnum,
+			 uint32_t n_pixel, double* lammin, double* lammax,
+			 double* etamin, double* etamax);
+  static void Pix2Ang(uint32_t resolution, const uint32_t* pixnum,
+		      uint32_t n_pixel, double* lambda, double* eta);
+  static void Ang2Pix(uint32_t resolution, const double* lambda,
+		      const double* eta, uint32_t n_pixel, uint32_t* pixnum);
+  static void Ang2HPix(uint32_t resolution, const double* lambda,
+		       const double* eta, uint32_t n_pixel,
+		       uint32_t* hpixnum, uint32_t* superpixnum);
+  static void HPix2Ang(uint32_t resolution, const uint32_t* hpixnum,
+		       const uint32_t* superpixnum, uint32_t n_pixel,
+		       double* lambda, double* eta);
+
   // Now we've got the various methods to establish ordering on the pixels.
   // LocalOrder is the the simplest, just arranging all of the pixels in
   // vanilla row-column order.  That's useful for some operations where you
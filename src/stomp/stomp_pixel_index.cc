@@ -0,0 +1,328 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This file contains the PixelIndex class.  A PixelIndex pixelizes a point
+// catalog once and stores the point indices grouped by pixel, so that the
+// points in any pixel at the index resolution (or any coarser resolution)
+// can be found without searching through the catalog again.
+
+#include <algorithm>
+#include <iostream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "stomp_core.h"
+#include "stomp_pixel_index.h"
+
+namespace Stomp {
+
+PixelIndex::PixelIndex() {
+  resolution_ = 0;
+  n_threads_ = 0;
+}
+
+PixelIndex::PixelIndex(AngularVector& ang, uint32_t resolution) {
+  resolution_ = 0;
+  n_threads_ = 0;
+  Initialize(ang, resolution);
+}
+
+PixelIndex::PixelIndex(WAngularVector& w_ang, uint32_t resolution) {
+  resolution_ = 0;
+  n_threads_ = 0;
+  Initialize(w_ang, resolution);
+}
+
+PixelIndex::~PixelIndex() {
+  Clear();
+}
+
+bool PixelIndex::Initialize(AngularVector& ang, uint32_t resolution) {
+  Clear();
+
+  if ((resolution < HPixResolution) ||
+      ((resolution & (resolution - 1)) != 0) ||
+      (resolution > MaxPixelResolution)) {
+    std::cout << "Stomp::PixelIndex::Initialize - Invalid resolution value: " <<
+      resolution << "\n";
+    return false;
+  }
+  resolution_ = resolution;
+
+  // Pixelizing the points is independent for each point.
+  int32_t n_points = static_cast<int32_t>(ang.size());
+  std::vector<uint64_t> point_key(ang.size());
+#ifdef _OPENMP
+  int n_threads = static_cast<int>(NThreads());
+#pragma omp parallel for schedule(static) num_threads(n_threads)
+#endif
+  for (int32_t i=0;i<n_points;i++) {
+    Pixel tmp_pix(ang[i], resolution_, 1.0);
+    point_key[i] = PixelKey(tmp_pix);
+  }
+
+  _BuildIndex(point_key);
+
+  return true;
+}
+
+bool PixelIndex::Initialize(WAngularVector& w_ang, uint32_t resolution) {
+  Clear();
+
+  if ((resolution < HPixResolution) ||
+      ((resolution & (resolution - 1)) != 0) ||
+      (resolution > MaxPixelResolution)) {
+    std::cout << "Stomp::PixelIndex::Initialize - Invalid resolution value: " <<
+      resolution << "\n";
+    return false;
+  }
+  resolution_ = resolution;
+
+  int32_t n_points = static_cast<int32_t>(w_ang.size());
+  std::vector<uint64_t> point_key(w_ang.size());
+#ifdef _OPENMP
+  int n_threads = static_cast<int>(NThreads());
+#pragma omp parallel for schedule(static) num_threads(n_threads)
+#endif
+  for (int32_t i=0;i<n_points;i++) {
+    Pixel tmp_pix(w_ang[i], resolution_, 1.0);
+    point_key[i] = PixelKey(tmp_pix);
+  }
+
+  _BuildIndex(point_key);
+
+  return true;
+}
+
+void PixelIndex::_BuildIndex(std::vector<uint64_t>& point_key) {
+  uint32_t n_points = point_key.size();
+  uint8_t shift = 2*(Pixel::ResolutionToLevel(resolution_) - HPixLevel);
+
+  // The leading bits of each key give the superpixel, so we can counting
+  // sort the points into superpixel buckets in two passes over the catalog.
+  // Since we go through the points in order, each bucket starts out in
+  // catalog order.
+  std::vector<uint32_t> bucket_offset(MaxSuperpixnum + 1, 0);
+  for (uint32_t i=0;i<n_points;i++)
+    bucket_offset[(point_key[i] >> shift) + 1]++;
+  for (uint32_t k=0;k<MaxSuperpixnum;k++)
+    bucket_offset[k+1] += bucket_offset[k];
+
+  std::vector<std::pair<uint64_t, uint32_t> > sorted_points(n_points);
+  std::vector<uint32_t> bucket_fill(bucket_offset.begin(),
+				    bucket_offset.end() - 1);
+  for (uint32_t i=0;i<n_points;i++) {
+    uint32_t k = static_cast<uint32_t>(point_key[i] >> shift);
+    sorted_points[bucket_fill[k]++] = std::make_pair(point_key[i], i);
+  }
+
+  // Then each bucket is sorted by the full key independently.  Ties in the
+  // key are broken by the point index, so the points in each pixel stay in
+  // catalog order.
+  std::vector<uint32_t> occupied_superpixnum;
+  for (uint32_t k=0;k<MaxSuperpixnum;k++)
+    if (bucket_offset[k+1] > bucket_offset[k])
+      occupied_superpixnum.push_back(k);
+
+  int32_t n_superpix = static_cast<int32_t>(occupied_superpixnum.size());
+#ifdef _OPENMP
+  int n_threads = static_cast<int>(NThreads());
+#pragma omp parallel for schedule(dynamic) num_threads(n_threads)
+#endif
+  for (int32_t n=0;n<n_superpix;n++) {
+    uint32_t k = occupied_superpixnum[n];
+    std::sort(sorted_points.begin() + bucket_offset[k],
+	      sorted_points.begin() + bucket_offset[k+1]);
+  }
+
+  // Finally, we collapse the sorted keys into the occupied pixels.
+  point_idx_.resize(n_points);
+  for (uint32_t i=0;i<n_points;i++) {
+    if ((i == 0) || (sorted_points[i].first != sorted_points[i-1].first)) {
+      pixel_key_.push_back(sorted_points[i].first);
+      offset_.push_back(i);
+    }
+    point_idx_[i] = sorted_points[i].second;
+  }
+  offset_.push_back(n_points);
+}
+
+bool PixelIndex::Coarsen(uint32_t resolution, PixelIndex& coarse_index) {
+  if ((resolution < HPixResolution) ||
+      ((resolution & (resolution - 1)) != 0) ||
+      (resolution > resolution_)) {
+    std::cout << "Stomp::PixelIndex::Coarsen - Invalid resolution value: " <<
+      resolution << "\n";
+    return false;
+  }
+
+  uint8_t shift = 2*(Pixel::ResolutionToLevel(resolution_) -
+		     Pixel::ResolutionToLevel(resolution));
+
+  // Since the parent key is a prefix of the child keys, the children of
+  // each coarse pixel are already next to each other and in order.
+  std::vector<uint64_t> coarse_key;
+  std::vector<uint32_t> coarse_offset;
+  for (uint32_t i=0;i<pixel_key_.size();i++) {
+    uint64_t key = pixel_key_[i] >> shift;
+    if (coarse_key.empty() || (coarse_key.back() != key)) {
+      coarse_key.push_back(key);
+      coarse_offset.push_back(offset_[i]);
+    }
+  }
+  coarse_offset.push_back(point_idx_.size());
+
+  if (&coarse_index != this) {
+    coarse_index.Clear();
+    coarse_index.point_idx_ = point_idx_;
+  }
+  coarse_index.pixel_key_.swap(coarse_key);
+  coarse_index.offset_.swap(coarse_offset);
+  coarse_index.resolution_ = resolution;
+
+  return true;
+}
+
+bool PixelIndex::FindPoints(Pixel& pix, uint32_t& first_offset,
+			    uint32_t& last_offset) {
+  first_offset = last_offset = 0;
+
+  if (Empty() || (pix.Level() < HPixLevel) ||
+      (pix.Resolution() > resolution_)) return false;
+
+  // The keys for the pixels inside the input pixel all start with the input
+  // pixel's key.
+  uint8_t shift = 2*(Pixel::ResolutionToLevel(resolution_) - pix.Level());
+  uint64_t key = PixelKey(pix);
+
+  std::vector<uint64_t>::iterator first_iter =
+    std::lower_bound(pixel_key_.begin(), pixel_key_.end(), key << shift);
+  std::vector<uint64_t>::iterator last_iter =
+    std::lower_bound(first_iter, pixel_key_.end(), (key + 1) << shift);
+  if (first_iter == last_iter) return false;
+
+  first_offset = offset_[first_iter - pixel_key_.begin()];
+  last_offset = offset_[last_iter - pixel_key_.begin()];
+
+  return true;
+}
+
+void PixelIndex::Indices(Pixel& pix, IndexVector& indices) {
+  if (!indices.empty()) indices.clear();
+
+  uint32_t first_offset, last_offset;
+  if (FindPoints(pix, first_offset, last_offset))
+    indices.assign(point_idx_.begin() + first_offset,
+		   point_idx_.begin() + last_offset);
+}
+
+uint32_t PixelIndex::NPoints(Pixel& pix) {
+  uint32_t first_offset, last_offset;
+  FindPoints(pix, first_offset, last_offset);
+  return last_offset - first_offset;
+}
+
+void PixelIndex::Pixels(PixelVector& pix) {
+  if (!pix.empty()) pix.clear();
+  pix.reserve(pixel_key_.size());
+
+  for (uint32_t i=0;i<pixel_key_.size();i++) pix.push_back(OccupiedPixel(i));
+}
+
+uint32_t PixelIndex::NPixel() {
+  return pixel_key_.size();
+}
+
+uint32_t PixelIndex::NPoints() {
+  return point_idx_.size();
+}
+
+Pixel PixelIndex::OccupiedPixel(uint32_t pixel_idx) {
+  Pixel pix;
+  KeyToPixel(pixel_key_[pixel_idx], resolution_, pix);
+  pix.SetWeight(static_cast<double>(PixelNPoints(pixel_idx)));
+  return pix;
+}
+
+uint32_t PixelIndex::Offset(uint32_t pixel_idx) {
+  return offset_[pixel_idx];
+}
+
+uint32_t PixelIndex::PixelNPoints(uint32_t pixel_idx) {
+  return offset_[pixel_idx+1] - offset_[pixel_idx];
+}
+
+uint32_t PixelIndex::Point(uint32_t offset) {
+  return point_idx_[offset];
+}
+
+uint64_t PixelIndex::PixelKey(Pixel& pix) {
+  uint32_t hnx = pix.Resolution()/HPixResolution;
+  uint32_t superpix_x = pix.PixelX()/hnx;
+  uint32_t superpix_y = pix.PixelY()/hnx;
+  uint32_t local_x = pix.PixelX() - superpix_x*hnx;
+  uint32_t local_y = pix.PixelY() - superpix_y*hnx;
+
+  // The superpixel index, then the x and y bits from the most significant
+  // down, with the y bit first in each pair.
+  uint64_t key = Nx0*HPixResolution*superpix_y + superpix_x;
+  for (uint8_t bit=pix.Level()-HPixLevel;bit>0;bit--) {
+    key = (key << 2) | (((local_y >> (bit-1)) & 1) << 1) |
+      ((local_x >> (bit-1)) & 1);
+  }
+
+  return key;
+}
+
+void PixelIndex::KeyToPixel(uint64_t key, uint32_t resolution, Pixel& pix) {
+  uint8_t n_bit = Pixel::ResolutionToLevel(resolution) - HPixLevel;
+
+  uint32_t local_x = 0, local_y = 0;
+  for (uint8_t bit=0;bit<n_bit;bit++) {
+    local_x |= static_cast<uint32_t>((key >> 2*bit) & 1) << bit;
+    local_y |= static_cast<uint32_t>((key >> (2*bit + 1)) & 1) << bit;
+  }
+
+  uint32_t superpixnum = static_cast<uint32_t>(key >> 2*n_bit);
+  uint32_t hnx = resolution/HPixResolution;
+
+  pix.SetResolution(resolution);
+  pix.SetPixnumFromXY((superpixnum%(Nx0*HPixResolution))*hnx + local_x,
+		      (superpixnum/(Nx0*HPixResolution))*hnx + local_y);
+}
+
+void PixelIndex::SetNThreads(uint16_t n_threads) {
+  n_threads_ = n_threads;
+}
+
+uint16_t PixelIndex::NThreads() {
+#ifdef _OPENMP
+  return (n_threads_ > 0 ? n_threads_ : omp_get_max_threads());
+#else
+  return 1;
+#endif
+}
+
+uint32_t PixelIndex::Resolution() {
+  return resolution_;
+}
+
+bool PixelIndex::Empty() {
+  return point_idx_.empty();
+}
+
+void PixelIndex::Clear() {
+  pixel_key_.clear();
+  offset_.clear();
+  point_idx_.clear();
+  resolution_ = 0;
+}
+
+} // end namespace Stomp
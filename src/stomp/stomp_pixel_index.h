@@ -0,0 +1,119 @@
+// Copyright 2010  All Rights Reserved.
+// Author: ryan.scranton@gmail.com (Ryan Scranton)
+
+// STOMP is a set of libraries for doing astrostatistical analysis on the
+// celestial sphere.  The goal is to enable descriptions of arbitrary regions
+// on the sky which may or may not encode futher spatial information (galaxy
+// density, CMB temperature, observational depth, etc.) and to do so in such
+// a way as to make the analysis of that data as algorithmically efficient as
+// possible.
+//
+// This header file contains the PixelIndex class.  A lot of the work done
+// with a point catalog starts by asking which of the points fall in each
+// pixel at some resolution: filling a ScalarMap, assigning points to
+// regions, pulling the points in a given pixel out of an IndexedTreeMap.
+// Doing that one point at a time means pixelizing the point and searching
+// for its pixel again for every step.  A PixelIndex pixelizes a catalog once
+// and groups the point indices by pixel, so that the points in any pixel
+// (at the index resolution or any coarser one) can be found with a single
+// binary search.
+
+#ifndef STOMP_PIXEL_INDEX_H
+#define STOMP_PIXEL_INDEX_H
+
+#include <stdint.h>
+#include <vector>
+#include "stomp_core.h"
+#include "stomp_angular_coordinate.h"
+#include "stomp_pixel.h"
+#include "stomp_itree_pixel.h"
+
+namespace Stomp {
+
+class PixelIndex;
+
+class PixelIndex {
+  // Class object for a catalog of points grouped by pixel.  The index is
+  // stored in compressed sparse row form: a sorted list of the keys for the
+  // occupied pixels, the offset of each pixel's first point in a permuted
+  // list of the point indices and the permutation itself.  The points in
+  // the i-th occupied pixel are Point(Offset(i)) through
+  // Point(Offset(i+1)-1), where Point returns the index of the point in the
+  // original catalog.  Within each pixel, the points are kept in the order
+  // they appeared in the catalog.
+  //
+  // The pixel keys are built from the superpixel index, followed by the bits
+  // of the x and y indices within that superpixel, interleaved so that the
+  // four sub-pixels of a given pixel have adjacent keys.  Dropping the last
+  // two bits of a key gives the key of the parent pixel, so the occupied
+  // pixels at any coarser resolution (down to HPixResolution) are runs of
+  // consecutive pixels in the index and the points in any coarser pixel are
+  // a contiguous block of the permutation.
+ public:
+  PixelIndex();
+  PixelIndex(AngularVector& ang, uint32_t resolution);
+  PixelIndex(WAngularVector& w_ang, uint32_t resolution);
+  ~PixelIndex();
+
+  // Build the index from a new catalog.  The points are pixelized and
+  // bucketed by superpixel, then the buckets are sorted in parallel if the
+  // library is compiled with OpenMP.  The return value is false (and the
+  // index is left empty) if the resolution is invalid.
+  bool Initialize(AngularVector& ang, uint32_t resolution);
+  bool Initialize(WAngularVector& w_ang, uint32_t resolution);
+
+  // Create an index at a coarser resolution by merging the runs of occupied
+  // pixels that share the same parent.  The permutation is unchanged, so
+  // this is much faster than building a new index from the catalog.
+  bool Coarsen(uint32_t resolution, PixelIndex& coarse_index);
+
+  // The range [first_offset, last_offset) of the permutation holding the
+  // points inside the input pixel, which can be at the index resolution or
+  // any coarser resolution.  The return value is false if the pixel is
+  // finer than the index or contains no points.
+  bool FindPoints(Pixel& pix, uint32_t& first_offset, uint32_t& last_offset);
+
+  // Convenience methods built on FindPoints: the catalog indices of the
+  // points in the input pixel and the number of those points.
+  void Indices(Pixel& pix, IndexVector& indices);
+  uint32_t NPoints(Pixel& pix);
+
+  // The occupied pixels at the index resolution, with the number of points
+  // in each pixel as the pixel weight.
+  void Pixels(PixelVector& pix);
+
+  // Access to the index itself.
+  uint32_t NPixel();
+  uint32_t NPoints();
+  Pixel OccupiedPixel(uint32_t pixel_idx);
+  uint32_t Offset(uint32_t pixel_idx);
+  uint32_t PixelNPoints(uint32_t pixel_idx);
+  uint32_t Point(uint32_t offset);
+
+  // The key for a pixel at its own resolution and the inverse.  Keys from
+  // different resolutions can't be compared directly.
+  static uint64_t PixelKey(Pixel& pix);
+  static void KeyToPixel(uint64_t key, uint32_t resolution, Pixel& pix);
+
+  // If OpenMP is available, the work is divided among n_threads threads.
+  // The default (0) uses the OpenMP default.
+  void SetNThreads(uint16_t n_threads);
+  uint16_t NThreads();
+
+  uint32_t Resolution();
+  bool Empty();
+  void Clear();
+
+ private:
+  // The shared back end for Initialize, taking the key for each point.
+  void _BuildIndex(std::vector<uint64_t>& point_key);
+
+  std::vector<uint64_t> pixel_key_;
+  std::vector<uint32_t> offset_, point_idx_;
+  uint32_t resolution_;
+  uint16_t n_threads_;
+};
+
+} // end namespace Stomp
+
+#endif
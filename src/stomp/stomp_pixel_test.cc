@@ -7,6 +7,7 @@
 #include "stomp_util.h"
 #include "stomp_angular_coordinate.h"
 #include "stomp_pixel.h"
+#include "stomp_pixel_index.h"
 
 void PixelBasicTests() {
   // Ok, now we'll try moving around a bit in resolution space.
@@ -577,6 +578,211 @@ void PixelAnnulusIntersectionTests() {
     "\t\tElapsed Time: " << stomp_watch.ElapsedTime() << " seconds.\n";
 }
 
+void PixelIndexTests() {
+  // Check that the PixelIndex groups the points by pixel correctly.
+  std::cout << "\n";
+  std::cout << "************************\n";
+  std::cout << "*** PixelIndex Tests ***\n";
+  std::cout << "************************\n";
+  Stomp::AngularCoordinate center_ang(60.0, 20.0,
+				      Stomp::AngularCoordinate::Survey);
+  Stomp::Pixel center_pix(center_ang, 16, 1.0);
+  Stomp::AngularVector ang;
+  uint32_t n_points = 200000;
+  center_pix.GenerateRandomPoints(ang, n_points);
+
+  Stomp::StompWatch stomp_watch;
+  uint32_t resolution = 1024;
+  stomp_watch.StartTimer();
+  Stomp::PixelIndex pixel_index(ang, resolution);
+  stomp_watch.StopTimer();
+  std::cout << "\t" << pixel_index.NPoints() << " points in " <<
+    pixel_index.NPixel() << " pixels at " << resolution << ": " <<
+    stomp_watch.ElapsedTime() << " seconds.\n";
+
+  // Every point should be listed under its own pixel, once.
+  uint32_t n_bad = 0, n_found = 0;
+  std::vector<uint32_t> n_seen(ang.size(), 0);
+  for (uint32_t i=0;i<pixel_index.NPixel();i++) {
+    Stomp::Pixel pix = pixel_index.OccupiedPixel(i);
+    for (uint32_t j=pixel_index.Offset(i);j<pixel_index.Offset(i+1);j++) {
+      uint32_t idx = pixel_index.Point(j);
+      Stomp::Pixel point_pix(ang[idx], resolution, 1.0);
+      if (point_pix != pix) n_bad++;
+      n_seen[idx]++;
+      n_found++;
+    }
+  }
+  for (uint32_t i=0;i<ang.size();i++)
+    if (n_seen[i] != 1) n_bad++;
+  std::cout << "\t" << n_found << " points found, " << n_bad <<
+    " mis-assigned.\n";
+
+  // The coarsened index and direct look-ups of coarse pixels in the original
+  // index should both agree with counting the points by hand.
+  uint32_t coarse_resolution = 64;
+  Stomp::PixelIndex coarse_index;
+  stomp_watch.StartTimer();
+  pixel_index.Coarsen(coarse_resolution, coarse_index);
+  stomp_watch.StopTimer();
+
+  Stomp::PixelVector coarse_pix;
+  center_pix.SubPix(coarse_resolution, coarse_pix);
+  n_bad = 0;
+  uint32_t n_coarse = 0;
+  for (Stomp::PixelIterator iter=coarse_pix.begin();
+       iter!=coarse_pix.end();++iter) {
+    uint32_t n_expected = 0;
+    for (uint32_t i=0;i<ang.size();i++)
+      if (iter->Contains(ang[i])) n_expected++;
+    Stomp::IndexVector indices;
+    pixel_index.Indices(*iter, indices);
+    if ((coarse_index.NPoints(*iter) != n_expected) ||
+	(indices.size() != n_expected)) n_bad++;
+    if (n_expected > 0) n_coarse++;
+  }
+  std::cout << "\tCoarsened to " << coarse_index.NPixel() << " pixels (" <<
+    n_coarse << " expected) at " << coarse_resolution << ": " <<
+    stomp_watch.ElapsedTime() << " seconds.\n";
+  std::cout << "\t" << n_bad << " coarse pixels with mismatched counts.\n";
+
+  // Resolutions that aren't powers of 2 don't correspond to any pixel level,
+  // so they should be rejected rather than rounded down.
+  Stomp::PixelIndex bad_index;
+  bool bad_initialize = bad_index.Initialize(ang, 24);
+  bool bad_coarsen = pixel_index.Coarsen(12, coarse_index);
+  std::cout << "\tResolution 24: " <<
+    (bad_initialize ? "ACCEPTED" : "rejected") << "; coarsen to 12: " <<
+    (bad_coarsen ? "ACCEPTED" : "rejected") << "\n";
+}
+
+void PixelArrayTests() {
+  // Check the array forms of the pixel index methods against the scalar
+  // forms, one element at a time.
+  std::cout << "\n";
+  std::cout << "*************************\n";
+  std::cout << "*** Pixel Array Tests ***\n";
+  std::cout << "*************************\n";
+  Stomp::AngularCoordinate center_ang(60.0, 20.0,
+				      Stomp::AngularCoordinate::Survey);
+  Stomp::Pixel center_pix(center_ang, 4, 1.0);
+  Stomp::AngularVector ang;
+  uint32_t n_points = 500000;
+  center_pix.GenerateRandomPoints(ang, n_points);
+
+  std::vector<double> lambda(n_points), eta(n_points);
+  for (uint32_t i=0;i<n_points;i++) {
+    lambda[i] = ang[i].Lambda();
+    eta[i] = ang[i].Eta();
+  }
+
+  uint32_t resolution = 2048, lo_resolution = 64;
+  std::vector<uint32_t> pixnum(n_points), x(n_points), y(n_points);
+  std::vector<uint32_t> hpixnum(n_points), superpixnum(n_points);
+  std::vector<uint32_t> lo_pixnum(n_points), round_trip(n_points);
+
+  Stomp::StompWatch stomp_watch;
+  stomp_watch.StartTimer();
+  Stomp::Pixel::Ang2Pix(resolution, &lambda[0], &eta[0], n_points,
+			&pixnum[0]);
+  stomp_watch.StopTimer();
+  double array_time = stomp_watch.ElapsedTime();
+
+  stomp_watch.StartTimer();
+  uint32_t n_bad = 0;
+  for (uint32_t i=0;i<n_points;i++) {
+    uint32_t tmp_pixnum;
+    Stomp::Pixel::Ang2Pix(resolution, ang[i], tmp_pixnum);
+    if (tmp_pixnum != pixnum[i]) n_bad++;
+  }
+  stomp_watch.StopTimer();
+  std::cout << "\tAng2Pix: " << n_bad << " mismatches; " << array_time <<
+    "s for the array, " << stomp_watch.ElapsedTime() << "s one at a time\n";
+
+  n_bad = 0;
+  Stomp::Pixel::Pix2XY(resolution, &pixnum[0], n_points, &x[0], &y[0]);
+  Stomp::Pixel::XY2Pix(resolution, &x[0], &y[0], n_points, &round_trip[0]);
+  for (uint32_t i=0;i<n_points;i++) {
+    uint32_t tmp_x, tmp_y;
+    Stomp::Pixel::Pix2XY(resolution, pixnum[i], tmp_x, tmp_y);
+    if ((tmp_x != x[i]) || (tmp_y != y[i]) ||
+	(round_trip[i] != pixnum[i])) n_bad++;
+  }
+  std::cout << "\tPix2XY, XY2Pix: " << n_bad << " mismatches\n";
+
+  n_bad = 0;
+  Stomp::Pixel::Pix2HPix(resolution, &pixnum[0], n_points, &hpixnum[0],
+			 &superpixnum[0]);
+  Stomp::Pixel::HPix2Pix(resolution, &hpixnum[0], &superpixnum[0], n_points,
+			 &round_trip[0]);
+  std::vector<uint32_t> ang_hpixnum(n_points), ang_superpixnum(n_points);
+  Stomp::Pixel::Ang2HPix(resolution, &lambda[0], &eta[0], n_points,
+			 &ang_hpixnum[0], &ang_superpixnum[0]);
+  for (uint32_t i=0;i<n_points;i++) {
+    uint32_t tmp_hpixnum, tmp_superpixnum;
+    Stomp::Pixel::Pix2HPix(resolution, pixnum[i], tmp_hpixnum,
+			   tmp_superpixnum);
+    Stomp::Pixel pix(ang[i], resolution, 1.0);
+    if ((tmp_hpixnum != hpixnum[i]) || (tmp_superpixnum != superpixnum[i]) ||
+	(pix.HPixnum() != hpixnum[i]) || (pix.Superpixnum() != superpixnum[i]) ||
+	(ang_hpixnum[i] != hpixnum[i]) ||
+	(ang_superpixnum[i] != superpixnum[i]) ||
+	(round_trip[i] != pixnum[i])) n_bad++;
+  }
+  std::cout << "\tPix2HPix, HPix2Pix, Ang2HPix: " << n_bad <<
+    " mismatches\n";
+
+  n_bad = 0;
+  std::vector<uint32_t> x_min(n_points), x_max(n_points);
+  std::vector<uint32_t> y_min(n_points), y_max(n_points);
+  Stomp::Pixel::SuperPix(resolution, &pixnum[0], n_points, lo_resolution,
+			 &lo_pixnum[0]);
+  Stomp::Pixel::SubPixels(lo_resolution, &lo_pixnum[0], n_points, resolution,
+			  &x_min[0], &x_max[0], &y_min[0], &y_max[0]);
+  for (uint32_t i=0;i<n_points;i++) {
+    uint32_t tmp_pixnum, tmp_x_min, tmp_x_max, tmp_y_min, tmp_y_max;
+    Stomp::Pixel::SuperPix(resolution, pixnum[i], lo_resolution, tmp_pixnum);
+    Stomp::Pixel::SubPixels(lo_resolution, tmp_pixnum, resolution,
+			    tmp_x_min, tmp_x_max, tmp_y_min, tmp_y_max);
+    if ((tmp_pixnum != lo_pixnum[i]) ||
+	(tmp_x_min != x_min[i]) || (tmp_x_max != x_max[i]) ||
+	(tmp_y_min != y_min[i]) || (tmp_y_max != y_max[i]) ||
+	(x[i] < x_min[i]) || (x[i] > x_max[i]) ||
+	(y[i] < y_min[i]) || (y[i] > y_max[i])) n_bad++;
+  }
+  std::cout << "\tSuperPix, SubPixels: " << n_bad << " mismatches\n";
+
+  // The angles should match to rounding.  Eta can come back from the
+  // AngularCoordinate on either side of the +/-180 degree seam.
+  n_bad = 0;
+  std::vector<double> lammin(n_points), lammax(n_points);
+  std::vector<double> etamin(n_points), etamax(n_points);
+  std::vector<double> center_lambda(n_points), center_eta(n_points);
+  std::vector<double> hpix_lambda(n_points), hpix_eta(n_points);
+  Stomp::Pixel::PixelBound(resolution, &pixnum[0], n_points, &lammin[0],
+			   &lammax[0], &etamin[0], &etamax[0]);
+  Stomp::Pixel::Pix2Ang(resolution, &pixnum[0], n_points, &center_lambda[0],
+			&center_eta[0]);
+  Stomp::Pixel::HPix2Ang(resolution, &hpixnum[0], &superpixnum[0], n_points,
+			 &hpix_lambda[0], &hpix_eta[0]);
+  for (uint32_t i=0;i<n_points;i++) {
+    double tmp_lammin, tmp_lammax, tmp_etamin, tmp_etamax;
+    Stomp::Pixel::PixelBound(resolution, pixnum[i], tmp_lammin, tmp_lammax,
+			     tmp_etamin, tmp_etamax);
+    Stomp::AngularCoordinate tmp_ang;
+    Stomp::Pixel::Pix2Ang(resolution, pixnum[i], tmp_ang);
+    double delta_eta = fabs(tmp_ang.Eta() - center_eta[i]);
+    if ((tmp_lammin != lammin[i]) || (tmp_lammax != lammax[i]) ||
+	(tmp_etamin != etamin[i]) || (tmp_etamax != etamax[i]) ||
+	(fabs(tmp_ang.Lambda() - center_lambda[i]) > 1.0e-9) ||
+	((delta_eta > 1.0e-9) && (fabs(delta_eta - 360.0) > 1.0e-9)) ||
+	(hpix_lambda[i] != center_lambda[i]) ||
+	(hpix_eta[i] != center_eta[i])) n_bad++;
+  }
+  std::cout << "\tPixelBound, Pix2Ang, HPix2Ang: " << n_bad <<
+    " mismatches\n";
+}
+
 // Define our command line flags
 DEFINE_bool(all_pixel_tests, false, "Run all class unit tests.");
 DEFINE_bool(pixel_basic_tests, false, "Run Pixel resolution tests");
@@ -586,6 +792,8 @@ DEFINE_bool(pixel_bound_tests, false, "Run Pixel bound tests");
 DEFINE_bool(pixel_within_radius_tests, false, "Run Pixel WithinRadius tests");
 DEFINE_bool(pixel_annulus_intersection_tests, false,
             "Run Pixel AnnulusIntersection tests");
+DEFINE_bool(pixel_index_tests, false, "Run PixelIndex tests");
+DEFINE_bool(pixel_array_tests, false, "Run Pixel array method tests");
 
 void PixelUnitTests(bool run_all_tests) {
   void PixelBasicTests();
@@ -594,6 +802,8 @@ void PixelUnitTests(bool run_all_tests) {
   void PixelBoundTests();
   void PixelWithinRadiusTests();
   void PixelAnnulusIntersectionTests();
+  void PixelIndexTests();
+  void PixelArrayTests();
 
   if (run_all_tests) FLAGS_all_pixel_tests = true;
 
@@ -620,4 +830,10 @@ void PixelUnitTests(bool run_all_tests) {
   // Check the routines for determining whether or not annuli intersect pixels.
   if (FLAGS_all_pixel_tests || FLAGS_pixel_annulus_intersection_tests)
     PixelAnnulusIntersectionTests();
+
+  // Check the grouping of point catalogs by pixel.
+  if (FLAGS_all_pixel_tests || FLAGS_pixel_index_tests) PixelIndexTests();
+
+  // Check the array forms of the pixel index methods.
+  if (FLAGS_all_pixel_tests || FLAGS_pixel_array_tests) PixelArrayTests();
 }
@@ -15,13 +15,19 @@
 // question.  This makes the class ideal for calculating angular correlation
 // functions on the encoded field.
 
+#include <math.h>
+#include <map>
 #include "stomp_core.h"
 #include "stomp_scalar_map.h"
 #include "stomp_map.h"
+#include "stomp_pixel_index.h"
 #include "stomp_angular_correlation.h"
+#include "stomp_util.h"
 
 namespace Stomp {
 
+const uint32_t ScalarMap::EmptyLookup;
+
 ScalarMap::ScalarMap() {
   area_ = 0.0;
   resolution_ = 0;
@@ -34,6 +40,8 @@ ScalarMap::ScalarMap() {
   calculated_mean_intensity_ = false;
   use_local_mean_intensity_ = false;
   map_type_ = ScalarField;
+  lookup_shift_ = 0;
+  dense_lookup_ = false;
 }
 
 ScalarMap::ScalarMap(Map& stomp_map, uint32_t input_resolution,
@@ -80,6 +88,7 @@ ScalarMap::ScalarMap(Map& stomp_map, uint32_t input_resolution,
   pix_.resize(pix_.size());
 
   sort(pix_.begin(), pix_.end(), Pixel::LocalOrder);
+  _BuildPixelLookup();
   mean_intensity_ = 0.0;
   converted_to_overdensity_ = false;
   calculated_mean_intensity_ = false;
@@ -134,6 +143,7 @@ ScalarMap::ScalarMap(ScalarMap& scalar_map,
   pix_.resize(pix_.size());
 
   sort(pix_.begin(), pix_.end(), Pixel::LocalOrder);
+  _BuildPixelLookup();
   mean_intensity_ = 0.0;
   converted_to_overdensity_ = false;
   calculated_mean_intensity_ = false;
@@ -181,7 +191,7 @@ ScalarMap::ScalarMap(ScalarMap& scalar_map,
     PixelVector superpix;
     scalar_map.Coverage(superpix, resolution_, true);
 
-    pix_.resize(superpix.size());
+    pix_.reserve(superpix.size());
     for (PixelIterator iter=superpix.begin();iter!=superpix.end();++iter) {
     	if (iter->Weight() > unmasked_fraction_minimum_) {
     		area_ += iter->Area()*iter->Weight();
@@ -193,6 +203,7 @@ ScalarMap::ScalarMap(ScalarMap& scalar_map,
   }
 
   sort(pix_.begin(), pix_.end(), Pixel::LocalOrder);
+  _BuildPixelLookup();
   mean_intensity_ = 0.0;
   converted_to_overdensity_ = false;
   calculated_mean_intensity_ = false;
@@ -226,6 +237,7 @@ ScalarMap::ScalarMap(ScalarVector& pix,
   }
 
   sort(pix_.begin(), pix_.end(), Pixel::LocalOrder);
+  _BuildPixelLookup();
   mean_intensity_ = 0.0;
   converted_to_overdensity_ = false;
   calculated_mean_intensity_ = false;
@@ -259,6 +271,7 @@ ScalarMap::ScalarMap(Map& stomp_map,
   pix_.resize(pix_.size());
 
   sort(pix_.begin(), pix_.end(), Pixel::LocalOrder);
+  _BuildPixelLookup();
   mean_intensity_ = 0.0;
   converted_to_overdensity_ = false;
   calculated_mean_intensity_ = false;
@@ -341,6 +354,7 @@ bool ScalarMap::Read(const std::string& InputFile,
   }
 
   sort(pix_.begin(), pix_.end(), Pixel::LocalOrder);
+  _BuildPixelLookup();
   mean_intensity_ = 0.0;
   converted_to_overdensity_ = false;
   calculated_mean_intensity_ = false;
@@ -371,6 +385,131 @@ bool ScalarMap::Write(const std::string& OutputFile) {
   }
 }
 
+void ScalarMap::Serialize(std::string& buffer) {
+  std::vector<uint32_t> x, y, n_points;
+  std::vector<double> weight, intensity;
+  std::vector<uint8_t> is_overdensity;
+  x.reserve(pix_.size());
+  y.reserve(pix_.size());
+  n_points.reserve(pix_.size());
+  weight.reserve(pix_.size());
+  intensity.reserve(pix_.size());
+  is_overdensity.reserve(pix_.size());
+  for (ScalarIterator iter=pix_.begin();iter!=pix_.end();++iter) {
+    x.push_back(iter->PixelX());
+    y.push_back(iter->PixelY());
+    n_points.push_back(iter->NPoints());
+    weight.push_back(iter->Weight());
+    intensity.push_back(iter->Intensity());
+    is_overdensity.push_back(iter->IsOverDensity() ? 1 : 0);
+  }
+
+  BinaryWriter writer(buffer, "Stomp::ScalarMap");
+  writer.Reserve(pix_.size()*(3*sizeof(uint32_t) + 2*sizeof(double) +
+			      sizeof(uint8_t)) + 128);
+  writer.Write(resolution_);
+  writer.Write(static_cast<int32_t>(map_type_));
+  writer.Write(area_);
+  writer.Write(mean_intensity_);
+  writer.Write(unmasked_fraction_minimum_);
+  writer.Write(total_intensity_);
+  writer.Write(total_points_);
+  writer.Write(static_cast<uint8_t>(converted_to_overdensity_));
+  writer.Write(static_cast<uint8_t>(calculated_mean_intensity_));
+  writer.Write(static_cast<uint8_t>(use_local_mean_intensity_));
+  writer.WriteVector(local_mean_intensity_);
+  writer.WriteVector(x);
+  writer.WriteVector(y);
+  writer.WriteVector(n_points);
+  writer.WriteVector(weight);
+  writer.WriteVector(intensity);
+  writer.WriteVector(is_overdensity);
+  SerializeRegions(writer);
+}
+
+bool ScalarMap::Deserialize(const std::string& buffer) {
+  BinaryReader reader(buffer, "Stomp::ScalarMap");
+  uint32_t resolution = 0, total_points = 0;
+  int32_t map_type = 0;
+  double area = 0.0, mean_intensity = 0.0, unmasked_fraction_minimum = 0.0;
+  double total_intensity = 0.0;
+  uint8_t converted_to_overdensity = 0, calculated_mean_intensity = 0;
+  uint8_t use_local_mean_intensity = 0;
+  std::vector<double> local_mean_intensity;
+  std::vector<uint32_t> x, y, n_points;
+  std::vector<double> weight, intensity;
+  std::vector<uint8_t> is_overdensity;
+  reader.Read(resolution);
+  reader.Read(map_type);
+  reader.Read(area);
+  reader.Read(mean_intensity);
+  reader.Read(unmasked_fraction_minimum);
+  reader.Read(total_intensity);
+  reader.Read(total_points);
+  reader.Read(converted_to_overdensity);
+  reader.Read(calculated_mean_intensity);
+  reader.Read(use_local_mean_intensity);
+  reader.ReadVector(local_mean_intensity);
+  reader.ReadVector(x);
+  reader.ReadVector(y);
+  reader.ReadVector(n_points);
+  reader.ReadVector(weight);
+  reader.ReadVector(intensity);
+  reader.ReadVector(is_overdensity);
+  if (!reader.Status() || (y.size() != x.size()) ||
+      (n_points.size() != x.size()) || (weight.size() != x.size()) ||
+      (intensity.size() != x.size()) || (is_overdensity.size() != x.size())) {
+    std::cout << "Stomp::ScalarMap::Deserialize - " <<
+      "Invalid ScalarMap buffer.\n";
+    return false;
+  }
+
+  // Likewise for the resolution, map type and pixel positions, which would
+  // otherwise end up as indices into the look-up table.
+  bool valid_pixels =
+    ((resolution >= HPixResolution) && (resolution <= MaxPixelResolution) &&
+     ((resolution & (resolution - 1)) == 0) &&
+     (map_type >= ScalarField) && (map_type <= SampledField));
+  for (uint32_t i=0;(i<x.size()) && valid_pixels;i++)
+    if ((x[i] >= Nx0*resolution) || (y[i] >= Ny0*resolution))
+      valid_pixels = false;
+  if (!valid_pixels) {
+    std::cout << "Stomp::ScalarMap::Deserialize - " <<
+      "Invalid ScalarMap buffer.\n";
+    return false;
+  }
+
+  Clear();
+  resolution_ = resolution;
+  map_type_ = static_cast<ScalarMapType>(map_type);
+  unmasked_fraction_minimum_ = unmasked_fraction_minimum;
+
+  pix_.reserve(x.size());
+  for (uint32_t i=0;i<x.size();i++) {
+    ScalarPixel tmp_pix(x[i], y[i], resolution_, weight[i], intensity[i],
+			n_points[i]);
+    if (is_overdensity[i]) tmp_pix.ConvertToOverDensity(0.0);
+    pix_.push_back(tmp_pix);
+  }
+  _BuildPixelLookup();
+
+  area_ = area;
+  mean_intensity_ = mean_intensity;
+  total_intensity_ = total_intensity;
+  total_points_ = total_points;
+  converted_to_overdensity_ = (converted_to_overdensity != 0);
+  calculated_mean_intensity_ = (calculated_mean_intensity != 0);
+  use_local_mean_intensity_ = (use_local_mean_intensity != 0);
+  local_mean_intensity_.swap(local_mean_intensity);
+
+  if (!DeserializeRegions(reader) || !reader.Finished()) {
+    std::cout << "Stomp::ScalarMap::Deserialize - Invalid region data.\n";
+    ClearRegions();
+  }
+
+  return true;
+}
+
 void ScalarMap::SetResolution(uint32_t resolution) {
   Clear();
   resolution_ = resolution;
@@ -420,6 +559,7 @@ void ScalarMap::InitializeFromMap(Map& stomp_map, uint32_t input_resolution,
   pix_.resize(pix_.size());
 
   sort(pix_.begin(), pix_.end(), Pixel::LocalOrder);
+  _BuildPixelLookup();
   mean_intensity_ = 0.0;
   converted_to_overdensity_ = false;
   calculated_mean_intensity_ = false;
@@ -480,6 +620,7 @@ void ScalarMap::InitializeFromScalarMap(ScalarMap& scalar_map,
   pix_.resize(pix_.size());
 
   sort(pix_.begin(), pix_.end(), Pixel::LocalOrder);
+  _BuildPixelLookup();
   mean_intensity_ = 0.0;
   converted_to_overdensity_ = false;
   calculated_mean_intensity_ = false;
@@ -519,6 +660,7 @@ void ScalarMap::InitializeFromScalarPixels(ScalarVector& pix,
   }
 
   sort(pix_.begin(), pix_.end(), Pixel::LocalOrder);
+  _BuildPixelLookup();
   mean_intensity_ = 0.0;
   converted_to_overdensity_ = false;
   calculated_mean_intensity_ = false;
@@ -529,13 +671,12 @@ bool ScalarMap::AddToMap(AngularCoordinate& ang, double object_weight) {
   ScalarPixel tmp_pix(ang, resolution_, object_weight, 1);
   bool added_point = false;
 
-  ScalarPair iter;
-  iter = equal_range(pix_.begin(), pix_.end(), tmp_pix, Pixel::LocalOrder);
-  if (iter.first != iter.second) {
+  ScalarIterator iter = _FindPixel(tmp_pix);
+  if (iter != pix_.end()) {
     if (map_type_ == ScalarField) {
-      iter.first->AddToIntensity(object_weight, 0);
+      iter->AddToIntensity(object_weight, 0);
     } else {
-      iter.first->AddToIntensity(object_weight, 1);
+      iter->AddToIntensity(object_weight, 1);
     }
     total_intensity_ += object_weight;
     total_points_++;
@@ -549,13 +690,12 @@ bool ScalarMap::AddToMap(WeightedAngularCoordinate& ang) {
   ScalarPixel tmp_pix(ang, resolution_, ang.Weight());
   bool added_point = false;
 
-  ScalarPair iter;
-  iter = equal_range(pix_.begin(),pix_.end(),tmp_pix, Pixel::LocalOrder);
-  if (iter.first != iter.second) {
+  ScalarIterator iter = _FindPixel(tmp_pix);
+  if (iter != pix_.end()) {
     if (map_type_ == ScalarField) {
-      iter.first->AddToIntensity(ang.Weight(), 0);
+      iter->AddToIntensity(ang.Weight(), 0);
     } else {
-      iter.first->AddToIntensity(ang.Weight(), 1);
+      iter->AddToIntensity(ang.Weight(), 1);
     }
     total_intensity_ += ang.Weight();
     total_points_++;
@@ -565,6 +705,63 @@ bool ScalarMap::AddToMap(WeightedAngularCoordinate& ang) {
   return added_point;
 }
 
+uint32_t ScalarMap::AddToMap(PixelIndex& pixel_index) {
+  uint32_t n_added = 0;
+
+  if (pixel_index.Resolution() < resolution_) {
+    std::cout << "Stomp::ScalarMap::AddToMap - " <<
+      "PixelIndex resolution must be at least the map resolution.\n";
+    return n_added;
+  }
+
+  for (ScalarIterator iter=pix_.begin();iter!=pix_.end();++iter) {
+    uint32_t n_points = pixel_index.NPoints(*iter);
+    if (n_points > 0) {
+      double object_weight = static_cast<double>(n_points);
+      iter->AddToIntensity(object_weight,
+			   (map_type_ == ScalarField ? 0 : n_points));
+      total_intensity_ += object_weight;
+      total_points_ += n_points;
+      n_added += n_points;
+    }
+  }
+
+  return n_added;
+}
+
+uint32_t ScalarMap::AddToMap(PixelIndex& pixel_index, WAngularVector& w_ang) {
+  uint32_t n_added = 0;
+
+  if (pixel_index.Resolution() < resolution_) {
+    std::cout << "Stomp::ScalarMap::AddToMap - " <<
+      "PixelIndex resolution must be at least the map resolution.\n";
+    return n_added;
+  }
+
+  if (pixel_index.NPoints() != w_ang.size()) {
+    std::cout << "Stomp::ScalarMap::AddToMap - " <<
+      "PixelIndex doesn't match the input catalog.\n";
+    return n_added;
+  }
+
+  for (ScalarIterator iter=pix_.begin();iter!=pix_.end();++iter) {
+    uint32_t first_offset, last_offset;
+    if (pixel_index.FindPoints(*iter, first_offset, last_offset)) {
+      double object_weight = 0.0;
+      for (uint32_t j=first_offset;j<last_offset;j++)
+	object_weight += w_ang[pixel_index.Point(j)].Weight();
+      uint32_t n_points = last_offset - first_offset;
+      iter->AddToIntensity(object_weight,
+			   (map_type_ == ScalarField ? 0 : n_points));
+      total_intensity_ += object_weight;
+      total_points_ += n_points;
+      n_added += n_points;
+    }
+  }
+
+  return n_added;
+}
+
 bool ScalarMap::AddToMap(Pixel& pix) {
   bool added_pixel = false;
 
@@ -577,10 +774,9 @@ bool ScalarMap::AddToMap(Pixel& pix) {
       ScalarPixel tmp_pix(pix_iter->PixelX(), pix_iter->PixelY(),
 			  pix_iter->Resolution());
 
-      ScalarPair iter;
-      iter = equal_range(pix_.begin(), pix_.end(), tmp_pix, Pixel::LocalOrder);
-      if (iter.first != iter.second) {
-	iter.first->SetIntensity(pix.Weight());
+      ScalarIterator iter = _FindPixel(tmp_pix);
+      if (iter != pix_.end()) {
+	iter->SetIntensity(pix.Weight());
 	total_intensity_ += pix.Weight();
       }
     }
@@ -674,9 +870,7 @@ int8_t ScalarMap::FindUnmaskedStatus(Pixel& pix) {
     Pixel tmp_pix = pix;
     tmp_pix.SetToSuperPix(resolution_);
 
-    ScalarPair iter = equal_range(pix_.begin(), pix_.end(), tmp_pix,
-                                  Pixel::LocalOrder);
-    if (iter.first != iter.second) unmasked_status = 1;
+    if (_FindPixel(tmp_pix) != pix_.end()) unmasked_status = 1;
   }
 
   // If the input pixel is larger than the ScalarMap pixels, then we scan
@@ -686,10 +880,7 @@ int8_t ScalarMap::FindUnmaskedStatus(Pixel& pix) {
     pix.SubPix(resolution_, pixVec);
 
     for (uint32_t i=0; i < pixVec.size(); i++) {
-      ScalarPair iter;
-      iter = equal_range(pix_.begin(), pix_.end(), pixVec[i],
-                         Pixel::LocalOrder);
-      if (iter.first != iter.second) {
+      if (_FindPixel(pixVec[i]) != pix_.end()) {
         unmasked_status = -1;
         break;
       }
@@ -723,13 +914,12 @@ void ScalarMap::Resample(ScalarPixel& pix) {
     if (pix.Resolution() == resolution_) {
       ScalarPixel tmp_pix(pix.PixelX(), pix.PixelY(), pix.Resolution());
 
-      ScalarPair iter = equal_range(pix_.begin(), pix_.end(), tmp_pix,
-                                    Pixel::LocalOrder);
-      if (iter.first != iter.second) {
-        unmasked_fraction = iter.first->Weight();
-        total_intensity = iter.first->Intensity();
+      ScalarIterator iter = _FindPixel(tmp_pix);
+      if (iter != pix_.end()) {
+        unmasked_fraction = iter->Weight();
+        total_intensity = iter->Intensity();
         weighted_intensity = total_intensity*unmasked_fraction;
-        total_points = iter.first->NPoints();
+        total_points = iter->NPoints();
       }
     } else {
       double pixel_fraction =
@@ -739,15 +929,13 @@ void ScalarMap::Resample(ScalarPixel& pix) {
       pix.SubPix(resolution_, pixVec);
 
       for (uint32_t i=0; i < pixVec.size(); i++) {
-        ScalarPair iter;
-        iter = equal_range(pix_.begin(), pix_.end(), pixVec[i],
-                           Pixel::LocalOrder);
-        if (iter.first != iter.second) {
-          unmasked_fraction += pixel_fraction*iter.first->Weight();
-          total_intensity += iter.first->Intensity();
+        ScalarIterator iter = _FindPixel(pixVec[i]);
+        if (iter != pix_.end()) {
+          unmasked_fraction += pixel_fraction*iter->Weight();
+          total_intensity += iter->Intensity();
           weighted_intensity +=
-              iter.first->Intensity()*pixel_fraction*iter.first->Weight();
-          total_points += iter.first->NPoints();
+              iter->Intensity()*pixel_fraction*iter->Weight();
+          total_points += iter->NPoints();
         }
       }
     }
@@ -1208,6 +1396,124 @@ bool ScalarMap::ImprintMap(Map& stomp_map, bool use_mean_local_intensity) {
   }
 }
 
+// The pixel-pair annulus kernels (see stomp_scalar_map.h).  The correlation
+// methods keep one kernel per row, built as they're needed.
+typedef std::map<uint32_t, AnnulusKernel> AnnulusKernelMap;
+
+static void SubPixelUnitSphere(Pixel& pix, uint32_t sub_resolution,
+			       std::vector<double>& unit_sphere) {
+  uint32_t x_min, x_max, y_min, y_max;
+  pix.SubPix(sub_resolution, x_min, x_max, y_min, y_max);
+
+  unit_sphere.clear();
+  for (uint32_t y=y_min;y<=y_max;y++) {
+    for (uint32_t x=x_min;x<=x_max;x++) {
+      Pixel sub_pix(x, y, sub_resolution);
+      unit_sphere.push_back(sub_pix.UnitSphereX());
+      unit_sphere.push_back(sub_pix.UnitSphereY());
+      unit_sphere.push_back(sub_pix.UnitSphereZ());
+    }
+  }
+}
+
+void BuildAnnulusKernel(Pixel& pix, AngularBin& theta, AnnulusKernel& kernel) {
+  kernel.clear();
+
+  uint32_t sub_resolution = pix.Resolution();
+  for (uint32_t n=1;(n<AnnulusKernelSampling)&&
+	 (sub_resolution<MaxPixelResolution);n*=2) sub_resolution *= 2;
+
+  std::vector<double> pix_sphere, sub_sphere;
+  SubPixelUnitSphere(pix, sub_resolution, pix_sphere);
+  double n_sub_pair =
+    static_cast<double>(pix_sphere.size()/3)*(pix_sphere.size()/3);
+
+  // Every point pair for the two pixels is within twice the center-to-corner
+  // distance of the separation of the pixel centers, which sets the range
+  // of pixels we need to check.
+  AngularCoordinate center = pix.Ang();
+  double buffer = 2.0*asin(sqrt(pix.FarCornerDistance(center)))*RadToDeg;
+  double costheta_near = (theta.ThetaMin() > buffer ?
+			  cos((theta.ThetaMin() - buffer)*DegToRad) : 1.0);
+  double costheta_far = (theta.ThetaMax() + buffer < 180.0 ?
+			 cos((theta.ThetaMax() + buffer)*DegToRad) : -1.0);
+
+  uint32_t y_min;
+  uint32_t y_max;
+  std::vector<uint32_t> x_min;
+  std::vector<uint32_t> x_max;
+
+  pix.XYBounds(theta.ThetaMax() + buffer, x_min, x_max, y_min, y_max, false);
+
+  uint32_t nx = Nx0*pix.Resolution();
+  uint32_t nx_pix;
+  for (uint32_t y=y_min,n=0;y<=y_max;y++,n++) {
+    if ((x_max[n] < x_min[n]) && (x_min[n] > nx/2)) {
+      nx_pix = nx - x_min[n] + x_max[n] + 1;
+    } else {
+      nx_pix = x_max[n] - x_min[n] + 1;
+    }
+    if (nx_pix > nx) nx_pix = nx;
+    for (uint32_t m=0,x=x_min[n];m<nx_pix;m++,x++) {
+      if (x == nx) x = 0;
+      Pixel tmp_pix(x, y, pix.Resolution());
+      double costheta = pix.UnitSphereX()*tmp_pix.UnitSphereX() +
+	pix.UnitSphereY()*tmp_pix.UnitSphereY() +
+	pix.UnitSphereZ()*tmp_pix.UnitSphereZ();
+      if ((costheta > costheta_near) || (costheta < costheta_far)) continue;
+
+      SubPixelUnitSphere(tmp_pix, sub_resolution, sub_sphere);
+      uint32_t n_within = 0;
+      for (uint32_t i=0;i<pix_sphere.size();i+=3) {
+	for (uint32_t j=0;j<sub_sphere.size();j+=3) {
+	  if (theta.WithinCosBounds(pix_sphere[i]*sub_sphere[j] +
+				    pix_sphere[i+1]*sub_sphere[j+1] +
+				    pix_sphere[i+2]*sub_sphere[j+2])) n_within++;
+	}
+      }
+
+      if (n_within > 0) {
+	AnnulusKernelEntry entry;
+	entry.y = y;
+	entry.dx = (x + nx - pix.PixelX()) % nx;
+	entry.fraction = n_within/n_sub_pair;
+	kernel.push_back(entry);
+      }
+    }
+  }
+}
+
+// The counterpart to ScalarPixel::_WithinAnnulus for the correlation methods
+// below: find the pixels paired with the input pixel for the given bin along
+// with the weight for each pair.  Without the annulus kernel, the pairs are
+// the pixels whose centers are within the bin and every weight is 1.
+static void AnnulusPixels(ScalarPixel& pix, AngularBin& theta,
+			  AnnulusKernelMap& kernels, ScalarVector& pixVec,
+			  std::vector<double>& fraction) {
+  if (!theta.UsingAnnulusKernel()) {
+    pix._WithinAnnulus(theta, pixVec);
+    fraction.assign(pixVec.size(), 1.0);
+    return;
+  }
+
+  AnnulusKernelMap::iterator kernel_iter = kernels.find(pix.PixelY());
+  if (kernel_iter == kernels.end()) {
+    kernel_iter =
+      kernels.insert(std::make_pair(pix.PixelY(), AnnulusKernel())).first;
+    BuildAnnulusKernel(pix, theta, kernel_iter->second);
+  }
+
+  pixVec.clear();
+  fraction.clear();
+  uint32_t nx = Nx0*pix.Resolution();
+  for (AnnulusKernel::iterator iter=kernel_iter->second.begin();
+       iter!=kernel_iter->second.end();++iter) {
+    pixVec.push_back(ScalarPixel((pix.PixelX() + iter->dx) % nx, iter->y,
+				 pix.Resolution()));
+    fraction.push_back(iter->fraction);
+  }
+}
+
 void ScalarMap::AutoCorrelate(AngularCorrelation& wtheta) {
   ThetaIterator theta_begin = wtheta.Begin(resolution_);
   ThetaIterator theta_end = wtheta.End(resolution_);
@@ -1238,28 +1544,31 @@ void ScalarMap::AutoCorrelate(ThetaIterator theta_iter) {
 
   theta_iter->ResetPixelWtheta();
 
+  AnnulusKernelMap kernels;
   for (ScalarIterator map_iter=pix_.begin();
        map_iter!=pix_.end();++map_iter) {
     // From a readability standpoint, the simplest thing to do is to
     // use the Pixel.WithinAnnulus method to get a vector of pixel
     // candidates and then check each in turn.  This isn't the fastest thing
-    // we could do (probably), but it is easy to read.
+    // we could do (probably), but it is easy to read.  If the bin uses the
+    // annulus kernel, each pair is weighted by the fraction of its area
+    // within the bin.
     ScalarVector pixVec;
-    map_iter->_WithinAnnulus(*theta_iter, pixVec);
+    std::vector<double> fraction;
+    AnnulusPixels(*map_iter, *theta_iter, kernels, pixVec, fraction);
 
-    for (ScalarIterator pix_iter=pixVec.begin();
-         pix_iter!=pixVec.end();++pix_iter) {
+    for (uint32_t k=0;k<pixVec.size();k++) {
       // We can skip all pixels that preceed our current pixel since the
       // products would be the same.  This keeps us from double counting and
       // saves some time.
-      if (Pixel::LocalOrder(*map_iter, *pix_iter)) {
-        ScalarPair iter = equal_range(map_iter, pix_.end(), *pix_iter,
-                                      Pixel::LocalOrder);
-        if (iter.first != iter.second) {
-          theta_iter->AddToPixelWtheta(map_iter->Intensity()*map_iter->Weight()*
-                                       iter.first->Intensity()*
-                                       iter.first->Weight(),
-                                       map_iter->Weight()*iter.first->Weight());
+      if (Pixel::LocalOrder(*map_iter, pixVec[k])) {
+        ScalarIterator iter = _FindPixel(pixVec[k], map_iter);
+        if (iter != pix_.end()) {
+          theta_iter->AddToPixelWtheta(fraction[k]*
+                                       map_iter->Intensity()*map_iter->Weight()*
+                                       iter->Intensity()*iter->Weight(),
+                                       fraction[k]*
+                                       map_iter->Weight()*iter->Weight());
         }
       }
     }
@@ -1306,25 +1615,25 @@ void ScalarMap::AutoCorrelateWithRegions(ThetaIterator theta_iter) {
 
   // Same as the method without the regions, we just need to keep track of
   // the region values for the two pixels involved.
+  AnnulusKernelMap kernels;
   for (ScalarIterator map_iter=pix_.begin();
        map_iter!=pix_.end();++map_iter) {
     uint32_t map_region = Region(map_iter->SuperPix(RegionResolution()));
 
     ScalarVector pixVec;
-    map_iter->_WithinAnnulus(*theta_iter, pixVec);
-
-    for (ScalarIterator pix_iter=pixVec.begin();
-         pix_iter!=pixVec.end();++pix_iter) {
-      if (Pixel::LocalOrder(*map_iter, *pix_iter)) {
-        ScalarPair iter = equal_range(map_iter, pix_.end(), *pix_iter,
-                                      Pixel::LocalOrder);
-        if (iter.first != iter.second) {
-          uint32_t pix_region =
-              Region(iter.first->SuperPix(RegionResolution()));
-          theta_iter->AddToPixelWtheta(map_iter->Intensity()*map_iter->Weight()*
-                                       iter.first->Intensity()*
-                                       iter.first->Weight(),
-                                       map_iter->Weight()*iter.first->Weight(),
+    std::vector<double> fraction;
+    AnnulusPixels(*map_iter, *theta_iter, kernels, pixVec, fraction);
+
+    for (uint32_t k=0;k<pixVec.size();k++) {
+      if (Pixel::LocalOrder(*map_iter, pixVec[k])) {
+        ScalarIterator iter = _FindPixel(pixVec[k], map_iter);
+        if (iter != pix_.end()) {
+          uint32_t pix_region = Region(iter->SuperPix(RegionResolution()));
+          theta_iter->AddToPixelWtheta(fraction[k]*
+                                       map_iter->Intensity()*map_iter->Weight()*
+                                       iter->Intensity()*iter->Weight(),
+                                       fraction[k]*
+                                       map_iter->Weight()*iter->Weight(),
                                        map_region, pix_region);
         }
       }
@@ -1390,20 +1699,21 @@ void ScalarMap::CrossCorrelate(ScalarMap& scalar_map,
   // over the pixels in the input ScalarMap.  We also don't exclude pixels
   // if their LocalOrder puts them before our input ScalarMap's pixel since
   // double-counting isn't an issue.
+  AnnulusKernelMap kernels;
   for (ScalarIterator map_iter=scalar_map.Begin();
        map_iter!=scalar_map.End();++map_iter) {
     ScalarVector pixVec;
-    map_iter->_WithinAnnulus(*theta_iter, pixVec);
-
-    for (ScalarIterator pix_iter=pixVec.begin();
-         pix_iter!=pixVec.end();++pix_iter) {
-      ScalarPair iter = equal_range(pix_.begin(), pix_.end(), *pix_iter,
-                                    Pixel::LocalOrder);
-      if (iter.first != iter.second) {
-        theta_iter->AddToPixelWtheta(map_iter->Intensity()*map_iter->Weight()*
-                                     iter.first->Intensity()*
-                                     iter.first->Weight(),
-                                     map_iter->Weight()*iter.first->Weight());
+    std::vector<double> fraction;
+    AnnulusPixels(*map_iter, *theta_iter, kernels, pixVec, fraction);
+
+    for (uint32_t k=0;k<pixVec.size();k++) {
+      ScalarIterator iter = _FindPixel(pixVec[k]);
+      if (iter != pix_.end()) {
+        theta_iter->AddToPixelWtheta(fraction[k]*
+                                     map_iter->Intensity()*map_iter->Weight()*
+                                     iter->Intensity()*iter->Weight(),
+                                     fraction[k]*
+                                     map_iter->Weight()*iter->Weight());
       }
     }
   }
@@ -1460,12 +1770,11 @@ void ScalarMap::CrossCorrelate(WAngularVector& wang_vect,
 
     for (ScalarIterator pix_iter=pixVec.begin();
          pix_iter!=pixVec.end();++pix_iter) {
-    	ScalarPair iter = equal_range(pix_.begin(), pix_.end(), *pix_iter,
-    			Pixel::LocalOrder);
-      if (iter.first != iter.second) {
+      ScalarIterator iter = _FindPixel(*pix_iter);
+      if (iter != pix_.end()) {
         theta_iter->AddToPixelWtheta(
-        		iter.first->Intensity()*iter.first->Weight()*wang_iter->Weight(),
-        		iter.first->Weight());
+        		iter->Intensity()*iter->Weight()*wang_iter->Weight(),
+        		iter->Weight());
       }
     }
   }
@@ -1538,24 +1847,24 @@ void ScalarMap::CrossCorrelateWithRegions(ScalarMap& scalar_map,
 
   // Same as the method without the regions, we just need to keep track of
   // the region values for the two pixels involved.
+  AnnulusKernelMap kernels;
   for (ScalarIterator map_iter=scalar_map.Begin();
        map_iter!=scalar_map.End();++map_iter) {
     int16_t map_region = Region(map_iter->SuperPix(RegionResolution()));
 
     ScalarVector pixVec;
-    map_iter->_WithinAnnulus(*theta_iter, pixVec);
-
-    for (ScalarIterator pix_iter=pixVec.begin();
-         pix_iter!=pixVec.end();++pix_iter) {
-      ScalarPair iter = equal_range(pix_.begin(), pix_.end(), *pix_iter,
-                                    Pixel::LocalOrder);
-      if (iter.first != iter.second) {
-        int16_t pix_region =
-            Region(iter.first->SuperPix(RegionResolution()));
-        theta_iter->AddToPixelWtheta(map_iter->Intensity()*map_iter->Weight()*
-                                     iter.first->Intensity()*
-                                     iter.first->Weight(),
-                                     map_iter->Weight()*iter.first->Weight(),
+    std::vector<double> fraction;
+    AnnulusPixels(*map_iter, *theta_iter, kernels, pixVec, fraction);
+
+    for (uint32_t k=0;k<pixVec.size();k++) {
+      ScalarIterator iter = _FindPixel(pixVec[k]);
+      if (iter != pix_.end()) {
+        int16_t pix_region = Region(iter->SuperPix(RegionResolution()));
+        theta_iter->AddToPixelWtheta(fraction[k]*
+                                     map_iter->Intensity()*map_iter->Weight()*
+                                     iter->Intensity()*iter->Weight(),
+                                     fraction[k]*
+                                     map_iter->Weight()*iter->Weight(),
                                      map_region, pix_region);
       }
     }
@@ -1831,6 +2140,7 @@ void ScalarMap::Clear() {
   converted_to_overdensity_ = false;
   calculated_mean_intensity_ = false;
   ClearRegions();
+  _BuildPixelLookup();
 }
 
 double ScalarMap::MeanIntensity() {
@@ -1846,4 +2156,76 @@ ScalarMap::ScalarMapType ScalarMap::MapType() {
   return map_type_;
 }
 
+bool ScalarMap::UsingDenseLookup() {
+  return dense_lookup_;
+}
+
+ScalarIterator ScalarMap::_FindPixel(Pixel& pix) {
+  return _FindPixel(pix, pix_.begin());
+}
+
+ScalarIterator ScalarMap::_FindPixel(Pixel& pix, ScalarIterator search_begin) {
+  if (dense_lookup_) {
+    uint32_t x = pix.PixelX(), y = pix.PixelY();
+    uint32_t superpixnum =
+      Nx0*HPixResolution*(y >> lookup_shift_) + (x >> lookup_shift_);
+    if (superpixnum >= MaxSuperpixnum) return pix_.end();
+
+    uint32_t block = lookup_block_[superpixnum];
+    if (block == EmptyLookup) return pix_.end();
+
+    uint32_t mask = (1 << lookup_shift_) - 1;
+    uint32_t idx = lookup_index_[(static_cast<uint64_t>(block) <<
+				  2*lookup_shift_) +
+				 ((y & mask) << lookup_shift_) + (x & mask)];
+    return (idx == EmptyLookup ? pix_.end() : pix_.begin() + idx);
+  }
+
+  ScalarPair iter = equal_range(search_begin, pix_.end(), pix,
+				Pixel::LocalOrder);
+  return (iter.first != iter.second ? iter.first : pix_.end());
+}
+
+void ScalarMap::_BuildPixelLookup() {
+  lookup_block_.clear();
+  lookup_index_.clear();
+  lookup_shift_ = 0;
+  dense_lookup_ = false;
+
+  if (pix_.empty() || (resolution_ < HPixResolution)) return;
+
+  // First, we find the occupied superpixels and give each of them a block
+  // of the table.
+  uint8_t shift = Pixel::ResolutionToLevel(resolution_) - HPixLevel;
+  std::vector<uint32_t> lookup_block(MaxSuperpixnum, EmptyLookup);
+  uint32_t n_block = 0;
+  for (ScalarIterator iter=pix_.begin();iter!=pix_.end();++iter) {
+    if (iter->Resolution() != resolution_) return;
+    uint32_t superpixnum = Nx0*HPixResolution*(iter->PixelY() >> shift) +
+      (iter->PixelX() >> shift);
+    if (lookup_block[superpixnum] == EmptyLookup)
+      lookup_block[superpixnum] = n_block++;
+  }
+
+  // If the map is sparse within those superpixels, the table would be
+  // larger than the map itself and we stick with the binary search.
+  uint64_t block_size = static_cast<uint64_t>(1) << 2*shift;
+  if (pix_.size() < DenseLookupFillFraction*n_block*block_size) return;
+
+  lookup_index_.assign(n_block*block_size, EmptyLookup);
+  uint32_t mask = (1 << shift) - 1;
+  for (uint32_t i=0;i<pix_.size();i++) {
+    uint32_t x = pix_[i].PixelX(), y = pix_[i].PixelY();
+    uint32_t superpixnum = Nx0*HPixResolution*(y >> shift) + (x >> shift);
+    uint64_t cell = (static_cast<uint64_t>(lookup_block[superpixnum]) <<
+		     2*shift) + ((y & mask) << shift) + (x & mask);
+    // Keep the first of any duplicates, as the binary search would.
+    if (lookup_index_[cell] == EmptyLookup) lookup_index_[cell] = i;
+  }
+
+  lookup_block_.swap(lookup_block);
+  lookup_shift_ = shift;
+  dense_lookup_ = true;
+}
+
 } // end namespace Stomp
@@ -31,12 +31,31 @@ class AngularCoordinate;           // class def. in stomp_angular_coordinate.h
 class WeightedAngularCoordinate;   // class def. in stomp_angular_coordinate.h
 class AngularCorrelation;          // class def. in stomp_angular_correlation.h
 class Map;                         // class definition in stomp_map.h
+class PixelIndex;                  // class definition in stomp_pixel_index.h
 class ScalarMap;
 
 typedef std::vector<ScalarMap> ScalarMapVector;
 typedef ScalarMapVector::iterator ScalarMapIterator;
 typedef std::pair<ScalarMapIterator, ScalarMapIterator> ScalarMapPair;
 
+// The pixel-pair annulus kernels used by the correlation methods for bins
+// with AngularBin::UseAnnulusKernel set.  The pixels in a given row (fixed y)
+// are rotations of each other about the survey pole, so the fraction of the
+// area of a pixel pair whose separation falls within an AngularBin only
+// depends on the row of the first pixel and the offsets to the second one.
+// Each entry gives the row of the second pixel, its x offset (modulo the
+// pixels in a row) and the fraction.  BuildAnnulusKernel finds the kernel
+// for the row of the input pixel by sampling both pixels of each pair at
+// AnnulusKernelSampling times their resolution.
+struct AnnulusKernelEntry {
+  uint32_t y, dx;
+  double fraction;
+};
+
+typedef std::vector<AnnulusKernelEntry> AnnulusKernel;
+
+void BuildAnnulusKernel(Pixel& pix, AngularBin& theta, AnnulusKernel& kernel);
+
 class ScalarMap : public BaseMap {
   // Unlike a Map, where the set of Pixels is intended to match the
   // geometry of a particular region, ScalarMaps are intended to be
@@ -122,6 +141,12 @@ class ScalarMap : public BaseMap {
   		double min_unmasked_fraction = 0.0000001);
   bool Write(const std::string& OutputFile);
 
+  // As with the Map, we can pack the ScalarMap (including its regions and
+  // over-density state) into a binary string for passing between processes
+  // and restore it from one.
+  void Serialize(std::string& buffer);
+  bool Deserialize(const std::string& buffer);
+
   // This is generally set through the constructor.  However, if
   // you want to re-initialize the same object with different parameters or
   // use the constructor without any arguments, this will set the
@@ -154,6 +179,14 @@ class ScalarMap : public BaseMap {
   bool AddToMap(AngularCoordinate& ang, double object_weight = 1.0);
   bool AddToMap(WeightedAngularCoordinate& ang);
 
+  // For a whole catalog, it's faster to build a PixelIndex from the catalog
+  // (at the map resolution or finer) and add all of the objects in each map
+  // pixel at once.  The first variation gives each object unit weight; the
+  // second takes the weights from the catalog used to build the index.  The
+  // return value is the number of objects that landed in the map.
+  uint32_t AddToMap(PixelIndex& pixel_index);
+  uint32_t AddToMap(PixelIndex& pixel_index, WAngularVector& w_ang);
+
   // Alternatively, if we are encoding a pure scalar field, then this method
   // will import the weight value from the input pixel into the proper fields.
   // If the input pixel is at a higher resolution than the current resolution
@@ -247,7 +280,12 @@ class ScalarMap : public BaseMap {
   // iterator for an angular bin.  Given the angular extent of that bin, the
   // code will find the auto-correlation of the field.  If the second option
   // is used, then the code will find the auto-correlation for all of the
-  // angular bins whose resolution values match that of the current map.
+  // angular bins whose resolution values match that of the current map.  For
+  // bins using the annulus kernel (AngularBin::UseAnnulusKernel), each pixel
+  // pair is weighted by the fraction of its area within the bin rather than
+  // binned by the separation of the pixel centers, which keeps the binning
+  // accurate on coarser maps.  This holds for all of the correlation methods
+  // below that take a ScalarMap or work on the current one.
   void AutoCorrelate(ThetaIterator theta_iter);
   void AutoCorrelate(AngularCorrelation& wtheta);
 
@@ -297,6 +335,16 @@ class ScalarMap : public BaseMap {
   bool IsOverDensityMap();
   ScalarMapType MapType();
 
+  // Finding the map pixel that matches a given pixel is normally a binary
+  // search through the sorted pixel list.  If the map covers most of the
+  // area of the superpixels it touches (DenseLookupFillFraction), we also
+  // keep a dense table for each occupied superpixel, indexed by the x-y
+  // position within the superpixel, and the look-ups (including the
+  // neighbor searches in the correlation methods) become direct indexing.
+  // The choice is made automatically whenever the pixels are set; this
+  // reports which mode the map is in.
+  bool UsingDenseLookup();
+
   // We need these methods to comply with the BaseMap signature.
   virtual double Area();
   virtual uint32_t Size();
@@ -309,6 +357,13 @@ class ScalarMap : public BaseMap {
 
 
  private:
+  // Find the map pixel matching the input pixel, which must be at the map
+  // resolution.  The return value is End() if there's no match.  For the
+  // binary search, the second form only searches from search_begin onwards.
+  ScalarIterator _FindPixel(Pixel& pix);
+  ScalarIterator _FindPixel(Pixel& pix, ScalarIterator search_begin);
+  void _BuildPixelLookup();
+
   ScalarVector pix_;
   ScalarMapType map_type_;
   double area_, mean_intensity_, unmasked_fraction_minimum_, total_intensity_;
@@ -316,6 +371,15 @@ class ScalarMap : public BaseMap {
   bool converted_to_overdensity_, calculated_mean_intensity_;
   bool use_local_mean_intensity_;
   std::vector<double> local_mean_intensity_;
+
+  // The dense look-up table: the block of the table for each superpixel
+  // (or EmptyLookup if it has no pixels) and, for each position within the
+  // occupied superpixels, the index of the matching pixel in pix_ (or
+  // EmptyLookup if the position isn't in the map).
+  static const uint32_t EmptyLookup = 0xFFFFFFFF;
+  std::vector<uint32_t> lookup_block_, lookup_index_;
+  uint8_t lookup_shift_;
+  bool dense_lookup_;
 };
 
 } // end namespace Stomp
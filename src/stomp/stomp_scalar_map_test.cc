@@ -4,12 +4,15 @@
 #include <string>
 #include <gflags/gflags.h>
 #include "stomp_core.h"
+#include "stomp_util.h"
 #include "stomp_angular_coordinate.h"
 #include "stomp_angular_bin.h"
 #include "stomp_angular_correlation.h"
 #include "stomp_pixel.h"
 #include "stomp_map.h"
 #include "stomp_scalar_map.h"
+#include "stomp_multi_scalar_map.h"
+#include "stomp_pixel_index.h"
 
 void ScalarMapBasicTests() {
   // Now we start testing the density map functions.  First we make a density
@@ -84,6 +87,19 @@ void ScalarMapBasicTests() {
     " points in second map.\n";
   std::cout << "\t\t\t" << second_map->MeanIntensity() <<
     " points/sq. degree.\n";
+
+  // The same points, added all at once through a PixelIndex.
+  Stomp::ScalarMap* third_map =
+      new Stomp::ScalarMap(scalar_pix, Stomp::ScalarMap::DensityField);
+  Stomp::PixelIndex pixel_index(rand_ang, third_map->Resolution());
+  uint32_t n_found_third = third_map->AddToMap(pixel_index);
+  if (n_random != n_found_third)
+    std::cout << "Failed to add all random points to the 3rd density map.\n";
+
+  std::cout << "\t\tPut " << n_found_third << "/" << rand_ang.size() <<
+    " points in third map via PixelIndex.\n";
+  std::cout << "\t\t\t" << third_map->MeanIntensity() <<
+    " points/sq. degree.\n";
 }
 
 void ScalarMapLocalTests() {
@@ -396,6 +412,317 @@ void ScalarMapCrossCorrelationTests() {
   }
 }
 
+void ScalarMapMultiChannelTests() {
+  // The MultiScalarMap should reproduce the auto- and cross-correlations from
+  // the individual ScalarMaps with a single pass through the pixel pairs.
+  std::cout << "\n";
+  std::cout << "*************************************\n";
+  std::cout << "*** ScalarMap Multi-Channel Tests ***\n";
+  std::cout << "*************************************\n";
+  double theta = 3.0;
+  Stomp::AngularCoordinate ang(60.0, 0.0, Stomp::AngularCoordinate::Survey);
+  Stomp::Pixel tmp_pix(ang, 256);
+  Stomp::PixelVector annulus_pix;
+  tmp_pix.WithinRadius(theta, annulus_pix);
+  Stomp::Map stomp_map(annulus_pix);
+
+  // Three density maps, each with its own set of random points.
+  uint32_t scalar_resolution = 256;
+  uint16_t n_channel = 3;
+  Stomp::ScalarMapVector scalar_maps;
+  for (uint16_t i=0;i<n_channel;i++) {
+    Stomp::ScalarMap scalar_map(stomp_map, scalar_resolution,
+				Stomp::ScalarMap::DensityField);
+    Stomp::AngularVector rand_ang;
+    stomp_map.GenerateRandomPoints(rand_ang, 20000*(i + 1), false, 1000 + i);
+    for (Stomp::AngularIterator iter=rand_ang.begin();
+	 iter!=rand_ang.end();++iter) scalar_map.AddToMap(*iter);
+    scalar_maps.push_back(scalar_map);
+  }
+  uint16_t n_region = scalar_maps[0].InitializeRegions(8);
+  for (uint16_t i=1;i<n_channel;i++)
+    scalar_maps[i].InitializeRegions(scalar_maps[0]);
+
+  Stomp::AngularCorrelation wtheta(0.1, 3.0, 6.0);
+  Stomp::StompWatch stomp_watch;
+  stomp_watch.StartTimer();
+  Stomp::MultiScalarMap multi_map(scalar_maps);
+  Stomp::WThetaVector wtheta_matrix;
+  multi_map.CorrelationMatrixWithRegions(wtheta, wtheta_matrix);
+  stomp_watch.StopTimer();
+  double multi_time = stomp_watch.ElapsedTime();
+  std::cout << "\t" << multi_map.NChannel() << " channels, " <<
+    multi_map.Size() << " pixels, " << multi_map.NRegion() << " (" <<
+    n_region << ") regions\n";
+
+  // Building the channels shouldn't have touched the input maps.
+  uint32_t n_changed = 0;
+  for (uint16_t i=0;i<n_channel;i++) {
+    if (scalar_maps[i].IsOverDensityMap()) n_changed++;
+    for (Stomp::ScalarIterator iter=scalar_maps[i].Begin();
+	 iter!=scalar_maps[i].End();++iter) {
+      if (iter->Intensity() != static_cast<double>(iter->NPoints()))
+	n_changed++;
+    }
+  }
+  std::cout << "\t" << n_changed << " input map pixels changed\n";
+
+  // Now the same thing, one pair of maps at a time.
+  Stomp::WThetaVector pair_wtheta(multi_map.NChannelPair(), wtheta);
+  stomp_watch.StartTimer();
+  for (uint16_t a=0;a<n_channel;a++) {
+    for (uint16_t b=a;b<n_channel;b++) {
+      Stomp::AngularCorrelation& pair_w =
+	pair_wtheta[multi_map.ChannelPairIndex(a, b)];
+      if (a == b) {
+	scalar_maps[a].AutoCorrelateWithRegions(pair_w);
+      } else {
+	scalar_maps[a].CrossCorrelateWithRegions(scalar_maps[b], pair_w);
+      }
+    }
+  }
+  stomp_watch.StopTimer();
+
+  uint32_t n_mismatch = 0, n_bin = 0;
+  for (uint32_t p=0;p<multi_map.NChannelPair();p++) {
+    Stomp::ThetaIterator pair_iter = pair_wtheta[p].Begin(scalar_resolution);
+    for (Stomp::ThetaIterator iter=wtheta_matrix[p].Begin(scalar_resolution);
+	 iter!=wtheta_matrix[p].End(scalar_resolution);++iter,++pair_iter) {
+      n_bin++;
+      for (int16_t region=-1;region<n_region;region++) {
+	if ((fabs(iter->PixelWtheta(region) - pair_iter->PixelWtheta(region)) >
+	     1.0e-8*(fabs(pair_iter->PixelWtheta(region)) + 1.0)) ||
+	    (fabs(iter->PixelWeight(region) - pair_iter->PixelWeight(region)) >
+	     1.0e-8*(fabs(pair_iter->PixelWeight(region)) + 1.0)))
+	  n_mismatch++;
+      }
+    }
+  }
+  std::cout << "\tCorrelationMatrix: " << multi_time << "s (" <<
+    multi_map.NThreads() << " threads); pairwise: " <<
+    stomp_watch.ElapsedTime() << "s; " << n_bin << " bins, " <<
+    n_mismatch << " mismatches\n";
+
+  for (Stomp::ThetaIterator iter=wtheta_matrix[1].Begin(scalar_resolution);
+       iter!=wtheta_matrix[1].End(scalar_resolution);++iter)
+    std::cout << "\tw_01(" << iter->Theta() << ") = " << iter->Wtheta() <<
+      " +- " << iter->WthetaError() << "\n";
+
+  // And the zero-lag covariances.
+  std::vector<double> covariance, covariance_error;
+  multi_map.CovarianceMatrix(covariance);
+  n_mismatch = 0;
+  for (uint16_t a=0;a<n_channel;a++) {
+    for (uint16_t b=a;b<n_channel;b++) {
+      double pair_covariance = (a == b ? scalar_maps[a].Variance() :
+				scalar_maps[a].Covariance(scalar_maps[b]));
+      if (fabs(covariance[multi_map.ChannelPairIndex(a, b)] -
+	       pair_covariance) > 1.0e-10) n_mismatch++;
+    }
+  }
+  multi_map.CovarianceMatrixWithErrors(covariance, covariance_error);
+  for (uint16_t a=0;a<n_channel;a++) {
+    for (uint16_t b=a;b<n_channel;b++) {
+      double pair_covariance, pair_error;
+      if (a == b) {
+	scalar_maps[a].VarianceWithErrors(pair_covariance, pair_error);
+      } else {
+	scalar_maps[a].CovarianceWithErrors(scalar_maps[b], pair_covariance,
+					    pair_error);
+      }
+      uint32_t p = multi_map.ChannelPairIndex(a, b);
+      if ((fabs(covariance[p] - pair_covariance) > 1.0e-10) ||
+	  (fabs(covariance_error[p] - pair_error) > 1.0e-10)) n_mismatch++;
+    }
+  }
+  std::cout << "\tCovarianceMatrix: " << n_mismatch << " mismatches\n";
+}
+
+void ScalarMapDenseLookupTests() {
+  // ScalarMaps that fill their superpixels should switch to the dense pixel
+  // look-up; sparse ones should stay with the binary search.  Either way, the
+  // correlations should match the MultiScalarMap, which does its own pixel
+  // look-ups.
+  std::cout << "\n";
+  std::cout << "*************************************\n";
+  std::cout << "*** ScalarMap Dense Look-up Tests ***\n";
+  std::cout << "*************************************\n";
+  Stomp::AngularCoordinate ang(60.0, 0.0, Stomp::AngularCoordinate::Survey);
+  Stomp::Pixel tmp_pix(ang, 256);
+  Stomp::PixelVector circle_pix;
+  tmp_pix.WithinRadius(3.0, circle_pix);
+  Stomp::Map stomp_map(circle_pix);
+
+  uint32_t scalar_resolution = 256;
+  Stomp::ScalarMap dense_map(stomp_map, scalar_resolution,
+			     Stomp::ScalarMap::DensityField);
+
+  // Every fifth pixel in each direction leaves the superpixels mostly empty.
+  Stomp::ScalarVector sparse_pix;
+  for (Stomp::ScalarIterator iter=dense_map.Begin();
+       iter!=dense_map.End();++iter) {
+    if ((iter->PixelX()%5 == 0) && (iter->PixelY()%5 == 0))
+      sparse_pix.push_back(*iter);
+  }
+  Stomp::ScalarMap sparse_map(sparse_pix, Stomp::ScalarMap::DensityField);
+
+  std::cout << "\t" << dense_map.Size() << " pixels, dense look-up: " <<
+    dense_map.UsingDenseLookup() << "; " << sparse_map.Size() <<
+    " pixels, dense look-up: " << sparse_map.UsingDenseLookup() << "\n";
+
+  Stomp::AngularVector rand_ang;
+  stomp_map.GenerateRandomPoints(rand_ang, 100000, false, 2000);
+  uint32_t n_dense = 0, n_sparse = 0;
+  for (Stomp::AngularIterator iter=rand_ang.begin();
+       iter!=rand_ang.end();++iter) {
+    if (dense_map.AddToMap(*iter)) n_dense++;
+    if (sparse_map.AddToMap(*iter)) n_sparse++;
+  }
+
+  // Each pixel should be found, and the points that landed in the sparse
+  // map should be in the pixels it actually has.
+  uint32_t n_bad = 0;
+  for (Stomp::ScalarIterator iter=dense_map.Begin();
+       iter!=dense_map.End();++iter) {
+    if (dense_map.FindIntensity(*iter) != iter->Intensity()) n_bad++;
+    bool in_sparse_map =
+      ((iter->PixelX()%5 == 0) && (iter->PixelY()%5 == 0));
+    if ((sparse_map.FindUnmaskedStatus(*iter) == 1) != in_sparse_map) n_bad++;
+  }
+  std::cout << "\t" << n_dense << " and " << n_sparse <<
+    " points added; " << n_bad << " bad pixel look-ups\n";
+
+  // The second set of bins switches every other bin at the map resolution to
+  // the annulus kernel, which the MultiScalarMap has to apply the same way.
+  Stomp::StompWatch stomp_watch;
+  Stomp::AngularCorrelation wtheta(0.1, 3.0, 6.0);
+  Stomp::AngularCorrelation kernel_wtheta = wtheta;
+  uint32_t n_kernel_bin = 0;
+  for (Stomp::ThetaIterator iter=kernel_wtheta.Begin(scalar_resolution);
+       iter!=kernel_wtheta.End(scalar_resolution);++iter) {
+    if ((iter - kernel_wtheta.Begin(scalar_resolution))%2 == 0) {
+      iter->UseAnnulusKernel(true);
+      n_kernel_bin++;
+    }
+  }
+
+  for (uint8_t k=0;k<2;k++) {
+    Stomp::AngularCorrelation& test_wtheta = (k == 0 ? wtheta : kernel_wtheta);
+    if (k == 1)
+      std::cout << "\tWith " << n_kernel_bin << " annulus kernel bins:\n";
+
+    for (uint8_t i=0;i<2;i++) {
+      Stomp::ScalarMap& scalar_map = (i == 0 ? dense_map : sparse_map);
+      Stomp::AngularCorrelation map_wtheta = test_wtheta;
+      stomp_watch.StartTimer();
+      scalar_map.AutoCorrelate(map_wtheta);
+      stomp_watch.StopTimer();
+
+      Stomp::ScalarMapVector scalar_maps(1, scalar_map);
+      Stomp::MultiScalarMap multi_map(scalar_maps);
+      Stomp::WThetaVector wtheta_matrix;
+      multi_map.CorrelationMatrix(test_wtheta, wtheta_matrix);
+
+      uint32_t n_mismatch = 0;
+      Stomp::ThetaIterator multi_iter =
+	wtheta_matrix[0].Begin(scalar_resolution);
+      for (Stomp::ThetaIterator iter=map_wtheta.Begin(scalar_resolution);
+	   iter!=map_wtheta.End(scalar_resolution);++iter,++multi_iter) {
+	if ((fabs(iter->PixelWtheta() - multi_iter->PixelWtheta()) >
+	     1.0e-8*(fabs(multi_iter->PixelWtheta()) + 1.0)) ||
+	    (fabs(iter->PixelWeight() - multi_iter->PixelWeight()) >
+	     1.0e-8*(fabs(multi_iter->PixelWeight()) + 1.0))) n_mismatch++;
+      }
+      std::cout << "\t" << (i == 0 ? "Dense" : "Sparse") <<
+	" AutoCorrelate: " << stomp_watch.ElapsedTime() << "s; " <<
+	n_mismatch << " mismatches with MultiScalarMap\n";
+    }
+  }
+}
+
+void ScalarMapAnnulusKernelTests() {
+  // With the annulus kernels, the pixel-pair weights should add up to the
+  // area of the pairs in each bin even on coarse maps, where binning by the
+  // pixel centers is badly off.  The reference is the kernel-weighted sum on
+  // a fine map.
+  std::cout << "\n";
+  std::cout << "**************************************\n";
+  std::cout << "*** ScalarMap Annulus Kernel Tests ***\n";
+  std::cout << "**************************************\n";
+  Stomp::AngularCoordinate ang(20.0, 0.0, Stomp::AngularCoordinate::Survey);
+  Stomp::Pixel tmp_pix(ang, 256);
+  Stomp::PixelVector circle_pix;
+  tmp_pix.WithinRadius(2.0, circle_pix);
+  Stomp::Map stomp_map(circle_pix);
+
+  Stomp::AngularCorrelation wtheta(0.2, 1.0, 4.0, false);
+  Stomp::AngularCorrelation kernel_wtheta = wtheta;
+  wtheta.AssignBinResolutions();
+  kernel_wtheta.AssignBinResolutions();
+  kernel_wtheta.UseAnnulusKernels();
+  Stomp::ThetaIterator kernel_iter = kernel_wtheta.Begin();
+  for (Stomp::ThetaIterator iter=wtheta.Begin();
+       iter!=wtheta.End();++iter,++kernel_iter)
+    std::cout << "\t" << iter->ThetaMin() << " - " << iter->ThetaMax() <<
+      ": resolution " << iter->Resolution() << " (" <<
+      kernel_iter->Resolution() << " with the kernel)\n";
+
+  // Switching to the kernels shouldn't undo the limits on the resolutions,
+  // either from AssignBinResolutions or SetMinResolution.
+  Stomp::AngularCorrelation capped_wtheta(0.2, 1.0, 4.0, false);
+  capped_wtheta.AssignBinResolutions(-70.0, 70.0, 16);
+  capped_wtheta.UseAnnulusKernels();
+  Stomp::AngularCorrelation floor_wtheta(0.2, 1.0, 4.0, false);
+  floor_wtheta.AssignBinResolutions();
+  floor_wtheta.SetMinResolution(32);
+  floor_wtheta.UseAnnulusKernels();
+  uint32_t n_outside = 0;
+  for (Stomp::ThetaIterator iter=capped_wtheta.Begin();
+       iter!=capped_wtheta.End();++iter)
+    if (iter->Resolution() > 16) n_outside++;
+  for (Stomp::ThetaIterator iter=floor_wtheta.Begin();
+       iter!=floor_wtheta.End();++iter)
+    if (iter->Resolution() < 32) n_outside++;
+  std::cout << "\tMaximum resolution 16: " << capped_wtheta.MinResolution() <<
+    " - " << capped_wtheta.MaxResolution() << "; minimum resolution 32: " <<
+    floor_wtheta.MinResolution() << " - " << floor_wtheta.MaxResolution() <<
+    "; " << n_outside << " bins outside the limits\n";
+
+  Stomp::ScalarMap fine_map(stomp_map, 256, Stomp::ScalarMap::DensityField);
+  Stomp::AngularCorrelation fine_wtheta = kernel_wtheta;
+  std::vector<double> pair_area;
+  for (Stomp::ThetaIterator iter=fine_wtheta.Begin();
+       iter!=fine_wtheta.End();++iter) {
+    fine_map.AutoCorrelate(iter);
+    pair_area.push_back(iter->PixelWeight()*Stomp::Pixel::Area(256)*
+			Stomp::Pixel::Area(256));
+  }
+
+  for (uint32_t resolution=32;resolution<=128;resolution*=2) {
+    Stomp::ScalarMap scalar_map(stomp_map, resolution,
+				Stomp::ScalarMap::DensityField);
+    double pixel_area = Stomp::Pixel::Area(resolution);
+    Stomp::AngularCorrelation center_wtheta = wtheta;
+    Stomp::AngularCorrelation map_wtheta = kernel_wtheta;
+    Stomp::ThetaIterator center_iter = center_wtheta.Begin();
+    Stomp::ThetaIterator map_iter = map_wtheta.Begin();
+    double max_center_error = 0.0, max_kernel_error = 0.0;
+    for (uint32_t k=0;k<pair_area.size();k++,++center_iter,++map_iter) {
+      scalar_map.AutoCorrelate(center_iter);
+      scalar_map.AutoCorrelate(map_iter);
+      double center_error = fabs(center_iter->PixelWeight()*
+				 pixel_area*pixel_area/pair_area[k] - 1.0);
+      double kernel_error = fabs(map_iter->PixelWeight()*
+				 pixel_area*pixel_area/pair_area[k] - 1.0);
+      if (center_error > max_center_error) max_center_error = center_error;
+      if (kernel_error > max_kernel_error) max_kernel_error = kernel_error;
+    }
+    std::cout << "\t" << resolution << ": max pair area error " <<
+      max_center_error << " by pixel centers, " << max_kernel_error <<
+      " with the kernel\n";
+  }
+}
+
 // Define our command line flags
 DEFINE_bool(all_scalar_map_tests, false, "Run all class unit tests.");
 DEFINE_bool(scalar_map_basic_tests, false, "Run ScalarMap basic tests");
@@ -407,6 +734,12 @@ DEFINE_bool(scalar_map_autocorrelation_tests, false,
             "Run ScalarMap auto-correlation tests");
 DEFINE_bool(scalar_map_crosscorrelation_tests, false,
             "Run ScalarMap cross-correlation tests");
+DEFINE_bool(scalar_map_multi_channel_tests, false,
+            "Run MultiScalarMap correlation matrix tests");
+DEFINE_bool(scalar_map_dense_lookup_tests, false,
+            "Run ScalarMap dense pixel look-up tests");
+DEFINE_bool(scalar_map_annulus_kernel_tests, false,
+            "Run ScalarMap annulus kernel tests");
 
 void ScalarMapUnitTests(bool run_all_tests) {
   void ScalarMapBasicTests();
@@ -415,6 +748,9 @@ void ScalarMapUnitTests(bool run_all_tests) {
   void ScalarMapRegionTests();
   void ScalarMapAutoCorrelationTests();
   void ScalarMapCrossCorrelationTests();
+  void ScalarMapMultiChannelTests();
+  void ScalarMapDenseLookupTests();
+  void ScalarMapAnnulusKernelTests();
 
   if (run_all_tests) FLAGS_all_scalar_map_tests = true;
 
@@ -445,4 +781,19 @@ void ScalarMapUnitTests(bool run_all_tests) {
   // Check the cross-correlation methods in the Stomp::ScalarMap class.
   if (FLAGS_all_scalar_map_tests || FLAGS_scalar_map_crosscorrelation_tests)
     ScalarMapCrossCorrelationTests();
+
+  // Check the MultiScalarMap correlation and covariance matrices against the
+  // equivalent Stomp::ScalarMap methods.
+  if (FLAGS_all_scalar_map_tests || FLAGS_scalar_map_multi_channel_tests)
+    ScalarMapMultiChannelTests();
+
+  // Check that the dense pixel look-up is chosen when it should be and gives
+  // the same results as the binary search.
+  if (FLAGS_all_scalar_map_tests || FLAGS_scalar_map_dense_lookup_tests)
+    ScalarMapDenseLookupTests();
+
+  // Check that the annulus kernels bin the pixel pairs accurately on coarse
+  // maps.
+  if (FLAGS_all_scalar_map_tests || FLAGS_scalar_map_annulus_kernel_tests)
+    ScalarMapAnnulusKernelTests();
 }
@@ -16,8 +16,14 @@
 // that vector of TreePixels, adding them as necessary based on the input
 // points.
 
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
 #include "stomp_core.h"
 #include "stomp_tree_map.h"
+#include "stomp_frozen_tree.h"
 #include "stomp_map.h"
 #include "stomp_angular_bin.h"
 #include "stomp_radial_bin.h"
@@ -33,6 +39,10 @@ TreeMap::TreeMap(uint32_t input_resolution, uint16_t maximum_points) {
   point_count_ = 0;
   modified_ = false;
   area_ = 0.0;
+  single_precision_ = false;
+  precision_threshold_ = SinglePrecisionThreshold;
+  frozen_tree_ = NULL;
+  n_threads_ = 0;
   ClearRegions();
 }
 
@@ -46,6 +56,10 @@ TreeMap::TreeMap(const std::string& input_file, uint32_t input_resolution,
   point_count_ = 0;
   modified_ = false;
   area_ = 0.0;
+  single_precision_ = false;
+  precision_threshold_ = SinglePrecisionThreshold;
+  frozen_tree_ = NULL;
+  n_threads_ = 0;
   ClearRegions();
 
   Read(input_file, sphere, verbose, theta_column, phi_column, weight_column);
@@ -62,6 +76,10 @@ TreeMap::TreeMap(const std::string& input_file, FieldColumnDict& field_columns,
   point_count_ = 0;
   modified_ = false;
   area_ = 0.0;
+  single_precision_ = false;
+  precision_threshold_ = SinglePrecisionThreshold;
+  frozen_tree_ = NULL;
+  n_threads_ = 0;
   ClearRegions();
 
   Read(input_file, field_columns, sphere, verbose,
@@ -82,6 +100,12 @@ TreeMap::~TreeMap() {
 uint32_t TreeMap::FindPairs(AngularCoordinate& ang, AngularBin& theta) {
   uint32_t pair_count = 0;
 
+  if (frozen_tree_ != NULL) {
+    pair_count = frozen_tree_->FindPairs(ang, theta);
+    theta.AddToCounter(pair_count);
+    return pair_count;
+  }
+
   // First we need to find out which pixels this angular bin possibly touches.
   Pixel center_pix;
   center_pix.SetResolution(resolution_);
@@ -130,6 +154,14 @@ void TreeMap::FindPairs(AngularVector& ang, AngularCorrelation& wtheta) {
 double TreeMap::FindWeightedPairs(AngularCoordinate& ang, AngularBin& theta) {
   double total_weight = 0.0;
 
+  if (frozen_tree_ != NULL) {
+    uint32_t n_pairs = frozen_tree_->FindWeightedPairs(ang, theta,
+						       total_weight);
+    theta.AddToWeight(total_weight);
+    theta.AddToCounter(n_pairs);
+    return total_weight;
+  }
+
   // First we need to find out which pixels this angular bin possibly touches.
   Pixel center_pix;
   center_pix.SetResolution(resolution_);
@@ -183,6 +215,15 @@ double TreeMap::FindWeightedPairs(WeightedAngularCoordinate& w_ang,
 				  AngularBin& theta) {
   double total_weight = 0.0;
 
+  if (frozen_tree_ != NULL) {
+    uint32_t n_pairs = frozen_tree_->FindWeightedPairs(w_ang, theta,
+						       total_weight);
+    total_weight *= w_ang.Weight();
+    theta.AddToWeight(total_weight);
+    theta.AddToCounter(n_pairs);
+    return total_weight;
+  }
+
   // First we need to find out which pixels this angular bin possibly touches.
   Pixel center_pix;
   center_pix.SetResolution(resolution_);
@@ -733,10 +774,50 @@ void TreeMap::FindWeightedPairsWithRegions(WAngularVector& w_ang,
 				 *theta_iter, field_name);
 }
 
-uint16_t TreeMap::FindKNearestNeighbors(AngularCoordinate& ang,
-					uint8_t n_neighbors,
-					WAngularVector& neighbor_ang) {
+void TreeMap::FindCumulativePairs(AngularCoordinate& ang,
+				  std::vector<double>& radii,
+				  std::vector<uint32_t>& counts,
+				  std::vector<double>& weights) {
+  counts.assign(radii.size(), 0);
+  weights.assign(radii.size(), 0.0);
+  if (radii.empty()) return;
+
+  ThetaVector disks;
+  disks.reserve(radii.size());
+  for (uint32_t i=0;i<radii.size();i++)
+    disks.push_back(AngularBin(0.0, radii[i]));
+
+  // The frozen tree only handles one bin at a time, so we always use the
+  // linked nodes here.
+  Pixel center_pix;
+  center_pix.SetResolution(resolution_);
+  PixelVector pix;
+  center_pix.BoundingRadius(ang, radii.back(), pix);
+
+  for (PixelIterator pix_iter=pix.begin();pix_iter!=pix.end();++pix_iter) {
+    TreeDictIterator iter = tree_map_.find(pix_iter->Pixnum());
+    if (iter != tree_map_.end())
+      iter->second->FindNestedPairs(ang, disks, counts, weights);
+  }
+
+  for (uint32_t i=1;i<radii.size();i++) {
+    counts[i] += counts[i-1];
+    weights[i] += weights[i-1];
+  }
+}
+
+uint32_t TreeMap::FindKNearestNeighbors(AngularCoordinate& ang,
+					uint32_t n_neighbors,
+					WAngularVector& neighbor_ang,
+					double epsilon) {
+  // The frozen tree doesn't keep the Fields, so we only use it if there
+  // aren't any to return.
+  if ((frozen_tree_ != NULL) && (epsilon <= 0.0) && field_total_.empty())
+    return frozen_tree_->FindKNearestNeighbors(ang, n_neighbors,
+					       neighbor_ang);
+
   TreeNeighbor neighbors(ang, n_neighbors);
+  neighbors.SetEpsilon(epsilon);
 
   _NeighborRecursion(ang, neighbors);
 
@@ -745,11 +826,11 @@ uint16_t TreeMap::FindKNearestNeighbors(AngularCoordinate& ang,
   return neighbors.NodesVisited();
 }
 
-uint16_t TreeMap::FindNearestNeighbor(AngularCoordinate& ang,
+uint32_t TreeMap::FindNearestNeighbor(AngularCoordinate& ang,
 				    WeightedAngularCoordinate& neighbor_ang) {
   WAngularVector angVec;
 
-  uint16_t nodes_visited = FindKNearestNeighbors(ang, 1, angVec);
+  uint32_t nodes_visited = FindKNearestNeighbors(ang, 1, angVec);
 
   neighbor_ang = angVec[0];
 
@@ -757,10 +838,15 @@ uint16_t TreeMap::FindNearestNeighbor(AngularCoordinate& ang,
 }
 
 double TreeMap::KNearestNeighborDistance(AngularCoordinate& ang,
-					 uint8_t n_neighbors,
-					 uint16_t& nodes_visited) {
+					 uint32_t n_neighbors,
+					 uint32_t& nodes_visited,
+					 double epsilon) {
+  if ((frozen_tree_ != NULL) && (epsilon <= 0.0))
+    return frozen_tree_->KNearestNeighborDistance(ang, n_neighbors,
+						  nodes_visited);
 
   TreeNeighbor neighbors(ang, n_neighbors);
+  neighbors.SetEpsilon(epsilon);
 
   _NeighborRecursion(ang, neighbors);
 
@@ -769,11 +855,32 @@ double TreeMap::KNearestNeighborDistance(AngularCoordinate& ang,
   return neighbors.MaxAngularDistance();
 }
 
+double TreeMap::KNearestNeighborDistance(AngularCoordinate& ang,
+					 uint32_t n_neighbors,
+					 uint16_t& nodes_visited,
+					 double epsilon) {
+  uint32_t n_visited = 0;
+  double max_distance =
+    KNearestNeighborDistance(ang, n_neighbors, n_visited, epsilon);
+  nodes_visited = (n_visited > 65535 ? 65535 :
+		   static_cast<uint16_t>(n_visited));
+  return max_distance;
+}
+
+double TreeMap::NearestNeighborDistance(AngularCoordinate& ang,
+					uint32_t& nodes_visited) {
+  return KNearestNeighborDistance(ang, 1, nodes_visited);
+}
+
 double TreeMap::NearestNeighborDistance(AngularCoordinate& ang,
 					uint16_t& nodes_visited) {
   return KNearestNeighborDistance(ang, 1, nodes_visited);
 }
 
+void TreeMap::FindNeighbors(AngularCoordinate& ang, TreeNeighbor& neighbors) {
+  _NeighborRecursion(ang, neighbors);
+}
+
 bool TreeMap::ClosestMatch(AngularCoordinate& ang,
 			   double max_distance,
 			   WeightedAngularCoordinate& match_ang) {
@@ -819,7 +926,7 @@ void TreeMap::_NeighborRecursion(AngularCoordinate& ang,
   if (neighbors.Neighbors() == neighbors.MaxNeighbors()) {
     // We've got a starting list of neighbors, so we only have to look at
     // nodes within our current range.
-    center_pix.BoundingRadius(ang, neighbors.MaxAngularDistance(), pix);
+    center_pix.BoundingRadius(ang, neighbors.PruneAngularDistance(), pix);
   } else {
     // The point is outside of the map area, so we have to check all of the
     // nodes.
@@ -832,11 +939,11 @@ void TreeMap::_NeighborRecursion(AngularCoordinate& ang,
   for (PixelIterator pix_iter=pix.begin();pix_iter!=pix.end();++pix_iter) {
     TreeDictIterator iter = tree_map_.find(pix_iter->Pixnum());
     if (iter != tree_map_.end() && !pix_iter->Contains(ang)) {
-      double min_edge_distance, max_edge_distance;
-      tree_map_[pix_iter->Pixnum()]->EdgeDistances(ang, min_edge_distance,
-						   max_edge_distance);
-      DistancePixelPair dist_pair(min_edge_distance,
-				  tree_map_[pix_iter->Pixnum()]);
+      // NearEdgeDistance falls back to the corner distance when the point
+      // is outside both the lambda and eta ranges of the node, which
+      // EdgeDistances leaves undefined.
+      DistancePixelPair dist_pair(iter->second->NearEdgeDistance(ang),
+				  iter->second);
       pix_queue.push(dist_pair);
     }
   }
@@ -845,7 +952,7 @@ void TreeMap::_NeighborRecursion(AngularCoordinate& ang,
   while (!pix_queue.empty()) {
     double pix_distance = pix_queue.top().first;
     TreePixel* pix_iter = pix_queue.top().second;
-    if (pix_distance < neighbors.MaxDistance()) {
+    if (pix_distance < neighbors.PruneDistance()) {
       pix_iter->_NeighborRecursion(ang, neighbors);
     }
     pix_queue.pop();
@@ -901,6 +1008,9 @@ void TreeMap::_MatchRecursion(AngularCoordinate& ang,
 }
 
 bool TreeMap::AddPoint(WeightedAngularCoordinate* ang) {
+  // Any change to the points invalidates the frozen copy of the tree.
+  Thaw();
+
   Pixel pix;
   pix.SetResolution(resolution_);
   pix.SetPixnumFromAng(*ang);
@@ -919,12 +1029,19 @@ bool TreeMap::AddPoint(WeightedAngularCoordinate* ang) {
 	"Creating new TreeMap node failed. Exiting.\n";
       exit(2);
     }
+    if (single_precision_)
+      iter->second->SetSinglePrecision(true, precision_threshold_);
   }
+
+  // In single precision mode, the node deletes the point once it has been
+  // stored, so we need to grab the weight first.  Points with Fields are
+  // rejected in that mode.
+  double point_weight = ang->Weight();
   bool added_point = (*iter).second->AddPoint(ang);
   if (added_point) {
     point_count_++;
-    weight_ += ang->Weight();
-    if (ang->HasFields()) {
+    weight_ += point_weight;
+    if (!single_precision_ && ang->HasFields()) {
       for (FieldIterator iter=ang->FieldBegin();iter!=ang->FieldEnd();++iter) {
 	if (field_total_.find(iter->first) != field_total_.end()) {
 	  field_total_[iter->first] += iter->second;
@@ -955,142 +1072,413 @@ bool TreeMap::AddPoint(AngularCoordinate& ang, double object_weight) {
   return AddPoint(w_ang);
 }
 
-bool TreeMap::Read(const std::string& input_file,
-		   AngularCoordinate::Sphere sphere, bool verbose,
-		   uint8_t theta_column, uint8_t phi_column,
-		   int8_t weight_column) {
-  bool io_success = false;
+// The pieces of the pipeline behind TreeMap::Read.  The file is read in blocks
+// of about ReadBlockSize bytes.  Each block carries its position in the file,
+// so the parsed points can be put back in file order before they're handed to
+// the insertion threads.
+static const uint32_t ReadBlockSize = 1 << 20;
+
+struct ReadBlock {
+  uint32_t sequence;
+  std::string text;
+};
+
+typedef std::vector<std::pair<uint32_t, WeightedAngularCoordinate*> >
+  NodePointVector;
+
+struct ParsedBlock {
+  uint32_t sequence, n_lines;
+  NodePointVector point;
+};
+
+// A queue with a fixed capacity connecting two stages of the pipeline.  Push
+// blocks while the queue is full, which keeps a fast stage from running ahead
+// of a slow one.  Pop blocks until there is something in the queue, returning
+// false once the queue has been closed and emptied.
+template<class T> class PipelineQueue {
+ public:
+  PipelineQueue(size_t capacity) {
+    capacity_ = capacity;
+    closed_ = false;
+  }
 
-  uint32_t n_lines = 0;
-  uint32_t check_lines = 128;
-  if (theta_column != phi_column) {
-    std::ifstream input_file_str(input_file.c_str());
-
-    uint8_t weight_idx = static_cast<uint8_t>(weight_column);
-
-    if (input_file_str) {
-      io_success = true;
-      if (verbose) std::cout << "Stomp::TreeMap::Read - " <<
-		     "Reading from " << input_file << "...\n";
-      while (!input_file_str.eof()) {
-	if (!input_file_str.eof()) {
-	  // This should read each line into a buffer, convert that buffer into
-	  // a string and then break that string into a vector of strings.  We
-	  // should then be able to access theta and phi by converting the
-	  // appropriate elements of that vector to doubles.
-	  char line_buffer[1000];
-	  std::vector<std::string> line_elements;
-
-	  input_file_str.getline(line_buffer, 1000);
-	  std::string line_string(line_buffer);
-	  Tokenize(line_string, line_elements, " ");
-	  n_lines++;
-	  if (verbose && n_lines == check_lines) {
-	    std::cout << "\tRead " << check_lines << " lines...\n";
-	    check_lines *= 2;
-	  }
+  void Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (queue_.size() >= capacity_) not_full_.wait(lock);
+    queue_.push_back(item);
+    not_empty_.notify_one();
+  }
 
-	  if ((line_elements.size() > theta_column) &&
-	      (line_elements.size() > phi_column)) {
-	    double theta = strtod(line_elements[theta_column].c_str(), NULL);
-	    double phi = strtod(line_elements[phi_column].c_str(), NULL);
-	    double weight = 1.0;
-	    if ((weight_column > -1) &&
-		(line_elements.size() > weight_idx)) {
-	      weight = strtod(line_elements[weight_idx].c_str(), NULL);
-	    }
+  bool Pop(T& item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (queue_.empty() && !closed_) not_empty_.wait(lock);
+    if (queue_.empty()) return false;
+    item = queue_.front();
+    queue_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+ private:
+  std::deque<T> queue_;
+  std::mutex mutex_;
+  std::condition_variable not_full_, not_empty_;
+  size_t capacity_;
+  bool closed_;
+};
+
+// Parsed blocks can finish out of order, so they wait here until all of the
+// blocks before them have been passed on.  A block more than window blocks
+// ahead of the next one in line waits in its parsing thread, which caps the
+// number of points held here.
+class ParsedBlockBuffer {
+ public:
+  ParsedBlockBuffer(uint32_t window) {
+    window_ = window;
+    next_sequence_ = 0;
+    n_blocks_ = 0;
+    finished_reading_ = false;
+  }
+
+  void Add(ParsedBlock* block) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (block->sequence >= next_sequence_ + window_) changed_.wait(lock);
+    block_[block->sequence] = block;
+    changed_.notify_all();
+  }
+
+  void FinishReading(uint32_t n_blocks) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    n_blocks_ = n_blocks;
+    finished_reading_ = true;
+    changed_.notify_all();
+  }
+
+  // The next block in file order, or NULL once all of the blocks are done.
+  ParsedBlock* Next() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while ((block_.find(next_sequence_) == block_.end()) &&
+	   !(finished_reading_ && (next_sequence_ == n_blocks_)))
+      changed_.wait(lock);
+    if (finished_reading_ && (next_sequence_ == n_blocks_)) return NULL;
+
+    ParsedBlock* block = block_[next_sequence_];
+    block_.erase(next_sequence_);
+    next_sequence_++;
+    changed_.notify_all();
+    return block;
+  }
+
+ private:
+  std::map<uint32_t, ParsedBlock*> block_;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  uint32_t window_, next_sequence_, n_blocks_;
+  bool finished_reading_;
+};
+
+// The settings the parsing threads need to turn lines into points.
+struct ReadFormat {
+  FieldColumnDict* field_columns;
+  AngularCoordinate::Sphere sphere;
+  uint32_t resolution;
+  uint8_t theta_column, phi_column;
+  int8_t weight_column;
+};
+
+static void ParseBlocks(PipelineQueue<ReadBlock*>* read_queue,
+			ParsedBlockBuffer* parsed_buffer, ReadFormat format) {
+  uint8_t weight_idx = static_cast<uint8_t>(format.weight_column);
+
+  ReadBlock* read_block;
+  std::vector<std::string> line_elements;
+  while (read_queue->Pop(read_block)) {
+    ParsedBlock* parsed_block = new ParsedBlock;
+    parsed_block->sequence = read_block->sequence;
+    parsed_block->n_lines = 0;
+
+    std::string::size_type line_start = 0;
+    while (line_start < read_block->text.size()) {
+      std::string::size_type line_end =
+	read_block->text.find('\n', line_start);
+      if (line_end == std::string::npos) line_end = read_block->text.size();
+      std::string line_string =
+	read_block->text.substr(line_start, line_end - line_start);
+      line_start = line_end + 1;
+      parsed_block->n_lines++;
+
+      line_elements.clear();
+      Tokenize(line_string, line_elements, " ");
+      if ((line_elements.size() > format.theta_column) &&
+	  (line_elements.size() > format.phi_column)) {
+	double theta = strtod(line_elements[format.theta_column].c_str(), NULL);
+	double phi = strtod(line_elements[format.phi_column].c_str(), NULL);
+	double weight = 1.0;
+	if ((format.weight_column > -1) &&
+	    (line_elements.size() > weight_idx)) {
+	  weight = strtod(line_elements[weight_idx].c_str(), NULL);
+	}
 
-	    WeightedAngularCoordinate* w_ang =
-	      new WeightedAngularCoordinate(theta, phi, weight, sphere);
-	    if (!AddPoint(w_ang)) io_success = false;
+	WeightedAngularCoordinate* w_ang;
+	if (format.field_columns != NULL) {
+	  FieldDict fields;
+	  for (FieldColumnIterator iter=format.field_columns->begin();
+	       iter!=format.field_columns->end();++iter) {
+	    fields[iter->first] = 0.0;
+	    if (line_elements.size() > iter->second) {
+	      fields[iter->first] =
+		strtod(line_elements[iter->second].c_str(), NULL);
+	    }
 	  }
+	  w_ang = new WeightedAngularCoordinate(theta, phi, weight, fields,
+						format.sphere);
+	} else {
+	  w_ang = new WeightedAngularCoordinate(theta, phi, weight,
+						format.sphere);
 	}
+
+	Pixel pix;
+	pix.SetResolution(format.resolution);
+	pix.SetPixnumFromAng(*w_ang);
+	parsed_block->point.push_back(std::make_pair(pix.Pixnum(), w_ang));
       }
-      input_file_str.close();
-    } else {
-      std::cout << "Stomp::TreeMap::Read - " << input_file <<
-	" does not exist!\n";
     }
+
+    delete read_block;
+    parsed_buffer->Add(parsed_block);
   }
+}
 
-  if (verbose && io_success)
-    std::cout << "Stomp::TreeMap::Read - Read " << n_lines-1 <<
-      " lines from " << input_file << "; loaded " << NPoints() <<
-      " into tree...\n";
+// Each insertion thread builds its own set of base level nodes (the ones
+// whose pixel index modulo the number of threads matches the thread index)
+// and keeps its own totals, which are merged into the TreeMap at the end.
+struct NodeInserter {
+  TreeDict tree_map;
+  TreeDict* existing_tree_map;
+  FieldDict field_total;
+  uint32_t point_count, resolution;
+  uint16_t maximum_points;
+  double weight, precision_threshold;
+  bool single_precision, success;
+};
+
+static void InsertPoints(PipelineQueue<NodePointVector*>* insert_queue,
+			 NodeInserter* inserter) {
+  NodePointVector* point;
+  while (insert_queue->Pop(point)) {
+    for (NodePointVector::iterator iter=point->begin();
+	 iter!=point->end();++iter) {
+      // Nodes that were already in the map are only ever touched by this
+      // thread, so we can add to them directly.
+      TreePixel* node;
+      TreeDictIterator node_iter = inserter->existing_tree_map->find(iter->first);
+      if (node_iter != inserter->existing_tree_map->end()) {
+	node = node_iter->second;
+      } else {
+	node_iter = inserter->tree_map.find(iter->first);
+	if (node_iter != inserter->tree_map.end()) {
+	  node = node_iter->second;
+	} else {
+	  uint32_t x, y;
+	  Pixel::Pix2XY(inserter->resolution, iter->first, x, y);
+	  node = new TreePixel(x, y, inserter->resolution,
+			       inserter->maximum_points);
+	  if (inserter->single_precision)
+	    node->SetSinglePrecision(true, inserter->precision_threshold);
+	  inserter->tree_map[iter->first] = node;
+	}
+      }
 
-  return io_success;
+      // In single precision mode, the node deletes the point once it has
+      // been stored, so we need to grab the weight first.  Points with Fields
+      // are rejected in that mode.
+      WeightedAngularCoordinate* w_ang = iter->second;
+      double point_weight = w_ang->Weight();
+      if (node->AddPoint(w_ang)) {
+	inserter->point_count++;
+	inserter->weight += point_weight;
+	if (!inserter->single_precision && w_ang->HasFields()) {
+	  for (FieldIterator field_iter=w_ang->FieldBegin();
+	       field_iter!=w_ang->FieldEnd();++field_iter)
+	    inserter->field_total[field_iter->first] += field_iter->second;
+	}
+      } else {
+	inserter->success = false;
+	delete w_ang;
+      }
+    }
+    delete point;
+  }
+}
+
+// Hand the parsed points to the insertion threads in file order.
+static void DispatchBlocks(ParsedBlockBuffer* parsed_buffer,
+			   std::vector<PipelineQueue<NodePointVector*>*>*
+			   insert_queue, bool verbose, uint32_t* n_lines) {
+  uint32_t n_inserter = insert_queue->size();
+  uint32_t check_lines = 128;
+
+  ParsedBlock* block;
+  while ((block = parsed_buffer->Next()) != NULL) {
+    std::vector<NodePointVector*> point(n_inserter);
+    for (uint32_t i=0;i<n_inserter;i++) point[i] = new NodePointVector;
+    for (NodePointVector::iterator iter=block->point.begin();
+	 iter!=block->point.end();++iter)
+      point[iter->first%n_inserter]->push_back(*iter);
+
+    for (uint32_t i=0;i<n_inserter;i++) {
+      if (point[i]->empty()) {
+	delete point[i];
+      } else {
+	(*insert_queue)[i]->Push(point[i]);
+      }
+    }
+
+    *n_lines += block->n_lines;
+    while (verbose && (*n_lines >= check_lines)) {
+      std::cout << "\tRead " << check_lines << " lines...\n";
+      check_lines *= 2;
+    }
+    delete block;
+  }
+
+  for (uint32_t i=0;i<n_inserter;i++) (*insert_queue)[i]->Close();
 }
 
 bool TreeMap::Read(const std::string& input_file,
-		   FieldColumnDict& field_columns,
 		   AngularCoordinate::Sphere sphere, bool verbose,
 		   uint8_t theta_column, uint8_t phi_column,
 		   int8_t weight_column) {
-  bool io_success = false;
+  return _Read(input_file, NULL, sphere, verbose, theta_column, phi_column,
+	       weight_column);
+}
 
-  uint32_t n_lines = 0;
-  uint32_t check_lines = 128;
-  if (theta_column != phi_column) {
-    std::ifstream input_file_str(input_file.c_str());
-
-    uint8_t weight_idx = static_cast<uint8_t>(weight_column);
-
-    if (input_file_str) {
-      io_success = true;
-      if (verbose) std::cout << "Stomp::TreeMap::Read - Reading from " <<
-		     input_file << "...\n";
-      while (!input_file_str.eof()) {
-	if (!input_file_str.eof()) {
-	  // This should read each line into a buffer, convert that buffer into
-	  // a string and then break that string into a vector of strings.  We
-	  // should then be able to access theta and phi by converting the
-	  // appropriate elements of that vector to doubles.
-	  char line_buffer[1000];
-	  std::vector<std::string> line_elements;
-
-	  input_file_str.getline(line_buffer, 1000);
-	  std::string line_string(line_buffer);
-	  Tokenize(line_string, line_elements, " ");
-	  n_lines++;
-	  if (verbose && n_lines == check_lines) {
-	    std::cout << "\tRead " << check_lines << " lines...\n";
-	    check_lines *= 2;
-	  }
-	  if ((line_elements.size() > theta_column) &&
-	      (line_elements.size() > phi_column)) {
-	    double theta = strtod(line_elements[theta_column].c_str(), NULL);
-	    double phi = strtod(line_elements[phi_column].c_str(), NULL);
-	    double weight = 1.0;
-	    if ((weight_column > -1) &&
-		(line_elements.size() > weight_idx)) {
-	      weight = strtod(line_elements[weight_idx].c_str(), NULL);
-	    }
+bool TreeMap::Read(const std::string& input_file,
+		   FieldColumnDict& field_columns,
+		   AngularCoordinate::Sphere sphere, bool verbose,
+		   uint8_t theta_column, uint8_t phi_column,
+		   int8_t weight_column) {
+  return _Read(input_file, &field_columns, sphere, verbose, theta_column,
+	       phi_column, weight_column);
+}
+
+bool TreeMap::_Read(const std::string& input_file,
+		    FieldColumnDict* field_columns,
+		    AngularCoordinate::Sphere sphere, bool verbose,
+		    uint8_t theta_column, uint8_t phi_column,
+		    int8_t weight_column) {
+  if (theta_column == phi_column) return false;
+
+  std::ifstream input_file_str(input_file.c_str(), std::ios::binary);
+  if (!input_file_str) {
+    std::cout << "Stomp::TreeMap::Read - " << input_file <<
+      " does not exist!\n";
+    return false;
+  }
 
-	    FieldDict fields;
-	    for (FieldColumnIterator iter=field_columns.begin();
-		 iter!=field_columns.end();++iter) {
-	      fields[iter->first] = 0.0;
-	      if (line_elements.size() > iter->second) {
-		fields[iter->first] =
-		  strtod(line_elements[iter->second].c_str(), NULL);
-	      }
-	    }
+  // Any change to the points invalidates the frozen copy of the tree.
+  Thaw();
+
+  if (verbose) std::cout << "Stomp::TreeMap::Read - " <<
+		 "Reading from " << input_file << "...\n";
+
+  // Split the threads between parsing and insertion, with at least one of
+  // each.  The calling thread does the reading.
+  uint16_t n_threads = NThreads();
+  uint16_t n_parser = (n_threads > 1 ? n_threads/2 : 1);
+  uint16_t n_inserter = (n_threads > n_parser ? n_threads - n_parser : 1);
+
+  ReadFormat format;
+  format.field_columns = field_columns;
+  format.sphere = sphere;
+  format.resolution = resolution_;
+  format.theta_column = theta_column;
+  format.phi_column = phi_column;
+  format.weight_column = weight_column;
+
+  PipelineQueue<ReadBlock*> read_queue(2*n_parser);
+  ParsedBlockBuffer parsed_buffer(4*n_parser);
+  std::vector<PipelineQueue<NodePointVector*>*> insert_queue;
+  std::vector<NodeInserter> inserter(n_inserter);
+  for (uint16_t i=0;i<n_inserter;i++) {
+    insert_queue.push_back(new PipelineQueue<NodePointVector*>(4));
+    inserter[i].existing_tree_map = &tree_map_;
+    inserter[i].point_count = 0;
+    inserter[i].resolution = resolution_;
+    inserter[i].maximum_points = maximum_points_;
+    inserter[i].weight = 0.0;
+    inserter[i].precision_threshold = precision_threshold_;
+    inserter[i].single_precision = single_precision_;
+    inserter[i].success = true;
+  }
 
-	    WeightedAngularCoordinate* w_ang =
-	      new WeightedAngularCoordinate(theta, phi, weight, fields, sphere);
-	    if (!AddPoint(w_ang)) io_success = false;
-	  }
-	}
-      }
-      input_file_str.close();
-    } else {
-      std::cout << "Stomp::TreeMap::Read - " << input_file <<
-	" does not exist!\n";
-    }
+  uint32_t n_lines = 0;
+  std::vector<std::thread> parse_thread, insert_thread;
+  for (uint16_t i=0;i<n_parser;i++)
+    parse_thread.push_back(std::thread(ParseBlocks, &read_queue,
+				       &parsed_buffer, format));
+  std::thread dispatch_thread(DispatchBlocks, &parsed_buffer, &insert_queue,
+			      verbose, &n_lines);
+  for (uint16_t i=0;i<n_inserter;i++)
+    insert_thread.push_back(std::thread(InsertPoints, insert_queue[i],
+					&inserter[i]));
+
+  // Each block ends at the last complete line read so far; the rest of the
+  // line is carried over to the start of the next block.
+  std::vector<char> buffer(ReadBlockSize);
+  std::string carry;
+  uint32_t n_blocks = 0;
+  while (input_file_str) {
+    input_file_str.read(&buffer[0], buffer.size());
+    std::streamsize n_read = input_file_str.gcount();
+    if (n_read <= 0) break;
+
+    carry.append(&buffer[0], n_read);
+    std::string::size_type last_newline = carry.rfind('\n');
+    if (last_newline == std::string::npos) continue;
+
+    ReadBlock* block = new ReadBlock;
+    block->sequence = n_blocks++;
+    block->text.assign(carry, 0, last_newline + 1);
+    carry.erase(0, last_newline + 1);
+    read_queue.Push(block);
+  }
+  if (!carry.empty()) {
+    ReadBlock* block = new ReadBlock;
+    block->sequence = n_blocks++;
+    block->text.swap(carry);
+    read_queue.Push(block);
+  }
+  input_file_str.close();
+
+  read_queue.Close();
+  parsed_buffer.FinishReading(n_blocks);
+  for (uint16_t i=0;i<n_parser;i++) parse_thread[i].join();
+  dispatch_thread.join();
+  for (uint16_t i=0;i<n_inserter;i++) insert_thread[i].join();
+
+  // Finally, merge the new nodes and the totals from each thread.
+  bool io_success = true;
+  for (uint16_t i=0;i<n_inserter;i++) {
+    tree_map_.insert(inserter[i].tree_map.begin(), inserter[i].tree_map.end());
+    point_count_ += inserter[i].point_count;
+    weight_ += inserter[i].weight;
+    for (FieldIterator iter=inserter[i].field_total.begin();
+	 iter!=inserter[i].field_total.end();++iter)
+      field_total_[iter->first] += iter->second;
+    if (!inserter[i].success) io_success = false;
+    delete insert_queue[i];
   }
+  modified_ = true;
 
   if (verbose && io_success)
-    std::cout << "Stomp::TreeMap::Read - Read " << n_lines-1 <<
+    std::cout << "Stomp::TreeMap::Read - Read " << n_lines <<
       " lines from " << input_file << "; loaded " << NPoints() <<
       " into tree...\n";
 
@@ -1320,6 +1708,153 @@ void TreeMap::SetPixelCapacity(int pixel_capacity) {
   maximum_points_ = pixel_capacity;
 }
 
+void TreeMap::SetNThreads(uint16_t n_threads) {
+  n_threads_ = n_threads;
+}
+
+uint16_t TreeMap::NThreads() {
+  if (n_threads_ > 0) return n_threads_;
+
+  uint16_t n_core = std::thread::hardware_concurrency();
+  return (n_core > 0 ? n_core : 1);
+}
+
+void TreeMap::SetSinglePrecision(bool single_precision,
+				 double precision_threshold) {
+  Clear();
+  single_precision_ = single_precision;
+  precision_threshold_ = precision_threshold;
+}
+
+bool TreeMap::SinglePrecision() {
+  return single_precision_;
+}
+
+double TreeMap::PrecisionThreshold() {
+  return precision_threshold_;
+}
+
+void TreeMap::Freeze() {
+  if (frozen_tree_ == NULL) frozen_tree_ = new FrozenTree();
+  frozen_tree_->Build(tree_map_, resolution_);
+}
+
+void TreeMap::Serialize(std::string& buffer) {
+  WAngularVector w_ang;
+  Points(w_ang);
+
+  std::vector<std::string> field_names;
+  FieldNames(field_names);
+
+  std::vector<double> x, y, z, weight;
+  std::vector<std::vector<double> > field(field_names.size());
+  x.reserve(w_ang.size());
+  y.reserve(w_ang.size());
+  z.reserve(w_ang.size());
+  weight.reserve(w_ang.size());
+  for (uint32_t j=0;j<field_names.size();j++) field[j].reserve(w_ang.size());
+  for (WAngularIterator iter=w_ang.begin();iter!=w_ang.end();++iter) {
+    x.push_back(iter->UnitSphereX());
+    y.push_back(iter->UnitSphereY());
+    z.push_back(iter->UnitSphereZ());
+    weight.push_back(iter->Weight());
+    for (uint32_t j=0;j<field_names.size();j++)
+      field[j].push_back(iter->Field(field_names[j]));
+  }
+
+  BinaryWriter writer(buffer, "Stomp::TreeMap");
+  writer.Reserve(w_ang.size()*(4 + field_names.size())*sizeof(double) + 128);
+  writer.Write(resolution_);
+  writer.Write(maximum_points_);
+  writer.Write(static_cast<uint8_t>(single_precision_));
+  writer.Write(precision_threshold_);
+  writer.Write(static_cast<uint8_t>(Frozen()));
+  writer.WriteVector(x);
+  writer.WriteVector(y);
+  writer.WriteVector(z);
+  writer.WriteVector(weight);
+  writer.Write(static_cast<uint32_t>(field_names.size()));
+  for (uint32_t j=0;j<field_names.size();j++) {
+    writer.WriteString(field_names[j]);
+    writer.WriteVector(field[j]);
+  }
+  SerializeRegions(writer);
+}
+
+bool TreeMap::Deserialize(const std::string& buffer) {
+  BinaryReader reader(buffer, "Stomp::TreeMap");
+  uint32_t resolution = 0, n_field = 0;
+  uint16_t maximum_points = 0;
+  uint8_t single_precision = 0, frozen = 0;
+  double precision_threshold = 0.0;
+  std::vector<double> x, y, z, weight;
+  reader.Read(resolution);
+  reader.Read(maximum_points);
+  reader.Read(single_precision);
+  reader.Read(precision_threshold);
+  reader.Read(frozen);
+  reader.ReadVector(x);
+  reader.ReadVector(y);
+  reader.ReadVector(z);
+  reader.ReadVector(weight);
+  reader.Read(n_field);
+
+  // Each Field needs at least its name length and its vector length, so a
+  // corrupt count shows up here rather than as a huge allocation.
+  if (n_field > reader.Remaining()/(2*sizeof(uint32_t))) {
+    std::cout << "Stomp::TreeMap::Deserialize - Invalid TreeMap buffer.\n";
+    return false;
+  }
+
+  std::vector<std::string> field_names(reader.Status() ? n_field : 0);
+  std::vector<std::vector<double> > field(field_names.size());
+  bool valid_fields = true;
+  for (uint32_t j=0;j<field_names.size();j++) {
+    reader.ReadString(field_names[j]);
+    reader.ReadVector(field[j]);
+    if (field[j].size() != x.size()) valid_fields = false;
+  }
+
+  if (!reader.Status() || !valid_fields || (y.size() != x.size()) ||
+      (z.size() != x.size()) || (weight.size() != x.size())) {
+    std::cout << "Stomp::TreeMap::Deserialize - Invalid TreeMap buffer.\n";
+    return false;
+  }
+
+  // SetSinglePrecision clears the map, so this also wipes out any existing
+  // points and regions.
+  resolution_ = resolution;
+  maximum_points_ = maximum_points;
+  SetSinglePrecision(single_precision != 0, precision_threshold);
+
+  for (uint32_t i=0;i<x.size();i++) {
+    WeightedAngularCoordinate w_ang(x[i], y[i], z[i], weight[i]);
+    for (uint32_t j=0;j<field_names.size();j++)
+      w_ang.SetField(field_names[j], field[j][i]);
+    AddPoint(w_ang);
+  }
+
+  if (frozen) Freeze();
+
+  if (!DeserializeRegions(reader) || !reader.Finished()) {
+    std::cout << "Stomp::TreeMap::Deserialize - Invalid region data.\n";
+    ClearRegions();
+  }
+
+  return true;
+}
+
+void TreeMap::Thaw() {
+  if (frozen_tree_ != NULL) {
+    delete frozen_tree_;
+    frozen_tree_ = NULL;
+  }
+}
+
+bool TreeMap::Frozen() {
+  return (frozen_tree_ != NULL ? true : false);
+}
+
 uint32_t TreeMap::NPoints(uint32_t k) {
   return (k == MaxPixnum ? point_count_ :
 	  (tree_map_.find(k) != tree_map_.end() ?
@@ -1556,6 +2091,7 @@ bool TreeMap::Empty() {
 }
 
 void TreeMap::Clear() {
+  Thaw();
   if (!tree_map_.empty()) {
     for (TreeDictIterator iter=tree_map_.begin();
 	 iter!=tree_map_.end();++iter) {
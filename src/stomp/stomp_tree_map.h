@@ -38,6 +38,7 @@ class AngularCorrelation;   // class definition in stomp_angular_correlation.h
 class RadialBin;           
 class Map;                  // class definition in stomp_map.h
 class TreePixel;            // class definition in stomp_tree_pixel.h
+class FrozenTree;           // class definition in stomp_frozen_tree.h
 class TreeMap;
 
 typedef std::map<const uint32_t, TreePixel *> TreeDict;
@@ -193,6 +194,15 @@ class TreeMap : public BaseMap {
                                     AngularCorrelation& wtheta,
                                     const std::string& field_name);
 
+  // For a set of radii (in degrees, in ascending order), find the number of
+  // points within each radius of the input point and the sum of their
+  // weights with a single pass through the tree, rather than one pass per
+  // radius.  counts[j] and weights[j] match FindPairs(ang, radii[j]) and
+  // FindWeightedPairs(ang, radii[j]).
+  void FindCumulativePairs(AngularCoordinate& ang, std::vector<double>& radii,
+			   std::vector<uint32_t>& counts,
+			   std::vector<double>& weights);
+
   // In addition to pair finding, we can also use the tree structure we've
   // built to do efficient nearest neighbor searches.  In the general case,
   // we'll be finding the k nearest neighbors of an input point.  The return
@@ -201,19 +211,37 @@ class TreeMap : public BaseMap {
   // NOTE: There is no duplication checking.  Hence, if the input point is a
   // copy of a point in the tree, then that point will be included in the
   // returned vector of points.
-  uint16_t FindKNearestNeighbors(AngularCoordinate& ang, uint8_t n_neighbors,
-				 WAngularVector& neighbors_ang);
+  //
+  // As in the TreePixel class, a non-zero epsilon gives an approximate
+  // search, where the returned kth neighbor distance is at most (1+epsilon)
+  // times the true value.
+  uint32_t FindKNearestNeighbors(AngularCoordinate& ang, uint32_t n_neighbors,
+				 WAngularVector& neighbors_ang,
+				 double epsilon = 0.0);
 
   // The special case where we're only interested in the nearest matching point.
-  uint16_t FindNearestNeighbor(AngularCoordinate& ang,
+  uint32_t FindNearestNeighbor(AngularCoordinate& ang,
 			       WeightedAngularCoordinate& neighbor_ang);
 
   // In some cases, we're only interested in the distance to the kth nearest
   // neighbor.  The return value will be the angular distance in degrees.
-  double KNearestNeighborDistance(AngularCoordinate& ang, uint8_t n_neighbors,
-				  uint16_t& nodes_visited);
+  // Large-k searches can visit more than 2^16 nodes, so the uint16_t form
+  // saturates at 65535; use the uint32_t form for the full count.
+  double KNearestNeighborDistance(AngularCoordinate& ang, uint32_t n_neighbors,
+				  uint32_t& nodes_visited,
+				  double epsilon = 0.0);
+  double KNearestNeighborDistance(AngularCoordinate& ang, uint32_t n_neighbors,
+				  uint16_t& nodes_visited,
+				  double epsilon = 0.0);
+
+  // If we want the statistics for the search (nodes visited, points tested)
+  // or need to set up the TreeNeighbor object by hand, this method fills an
+  // input TreeNeighbor.
+  void FindNeighbors(AngularCoordinate& ang, TreeNeighbor& neighbors);
 
   // Or in the distance to the nearest neighbor.
+  double NearestNeighborDistance(AngularCoordinate& ang,
+				 uint32_t& nodes_visited);
   double NearestNeighborDistance(AngularCoordinate& ang,
 				 uint16_t& nodes_visited);
 
@@ -254,6 +282,16 @@ class TreeMap : public BaseMap {
   // not specified, then the Weight is set to unity for each point.  As with
   // the ToWAngularVector methods in the WeightedAngularCoordinate class, the
   // returned boolean indicates success or failure in adding all of the points.
+  //
+  // The file is read as a pipeline: the calling thread reads the file in
+  // blocks of lines, a set of threads parses the blocks into points and finds
+  // the base level node for each one, and another set of threads adds the
+  // points to the nodes, each thread taking its own share of the nodes.  The
+  // queues between the stages hold a fixed number of blocks, so a slow stage
+  // holds up the earlier ones rather than letting the points pile up in
+  // memory.  The points in each node are added in the order they appear in
+  // the file, so the tree is the same as it would be if the points were added
+  // one at a time.
   bool Read(const std::string& input_file,
 	    AngularCoordinate::Sphere sphere = AngularCoordinate::Equatorial,
 	    bool verbose = false, uint8_t theta_column = 0,
@@ -284,6 +322,46 @@ class TreeMap : public BaseMap {
   void SetResolution(uint32_t resolution);
   void SetPixelCapacity(int pixel_capacity);
 
+  // For large data sets, the points can be stored in single precision to
+  // cut the memory needed for the tree (see the TreePixel class for details).
+  // Pair counts for angular bins with a non-zero edge smaller than the
+  // precision threshold (in degrees) are done with double precision
+  // arithmetic.  Points with Fields can't be added to a single precision
+  // map.  As with the resolution and pixel capacity, changing the storage
+  // mode clears the map.
+  void SetSinglePrecision(bool single_precision = true,
+			  double precision_threshold = SinglePrecisionThreshold);
+  bool SinglePrecision();
+  double PrecisionThreshold();
+
+  // The number of threads used by the pipeline in the Read methods.  The
+  // default (0) uses one thread per core.
+  void SetNThreads(uint16_t n_threads);
+  uint16_t NThreads();
+
+  // Once all of the points have been added, the tree can be frozen.  This
+  // makes a read-only copy of the tree with the nodes and points laid out in
+  // contiguous arrays (see stomp_frozen_tree.h), which FindPairs,
+  // FindWeightedPairs and the nearest neighbor methods then use instead of
+  // the linked nodes.  The region-based pair-finding methods, the Field
+  // methods and approximate nearest neighbor searches still use the linked
+  // nodes.  The frozen copy holds the points in double precision, so it
+  // roughly doubles the memory footprint of the map.  Adding points to the
+  // map or clearing it thaws the tree.
+  void Freeze();
+  void Thaw();
+  bool Frozen();
+
+  // Pack the map (its settings, points, Fields and regions) into a binary
+  // string for passing between processes and restore it from one.  Only the
+  // points are stored, not the node layout, so restoring a map rebuilds the
+  // tree by adding the points one at a time (O(N log N), as for the original
+  // build) and freezes it again if it was frozen when it was packed.  Fields
+  // are stored for every point, so a point which was missing one of the
+  // map's Fields comes back with that Field set to zero.
+  void Serialize(std::string& buffer);
+  bool Deserialize(const std::string& buffer);
+
   // Total number of points in the tree map or total number of points in
   // a given base level node.
   uint32_t NPoints(uint32_t k = MaxPixnum);
@@ -334,12 +412,19 @@ class TreeMap : public BaseMap {
   virtual void Clear();
 
  private:
+  // The shared back end for the Read methods; field_columns is NULL if the
+  // points don't have Fields.
+  bool _Read(const std::string& input_file, FieldColumnDict* field_columns,
+	     AngularCoordinate::Sphere sphere, bool verbose,
+	     uint8_t theta_column, uint8_t phi_column, int8_t weight_column);
+
   TreeDict tree_map_;
+  FrozenTree* frozen_tree_;
   FieldDict field_total_;
-  uint16_t maximum_points_, nodes_;
+  uint16_t maximum_points_, nodes_, n_threads_;
   uint32_t point_count_, resolution_;
-  double weight_, area_;
-  bool modified_;
+  double weight_, area_, precision_threshold_;
+  bool modified_, single_precision_;
 };
 
 } // end namespace Stomp
@@ -2,6 +2,9 @@
 #include <iostream>
 #include <math.h>
 #include <string>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
 #include <gflags/gflags.h>
 #include "stomp_core.h"
 #include "stomp_util.h"
@@ -11,6 +14,8 @@
 #include "stomp_pixel.h"
 #include "stomp_map.h"
 #include "stomp_tree_map.h"
+#include "stomp_partitioned_tree_map.h"
+#include "stomp_itree_map.h"
 
 void TreeMapBasicTests() {
   std::cout << "\n";
@@ -915,6 +920,555 @@ void TreeMapMatchTests() {
     stomp_watch.ElapsedTime()/n_test_points << "s\n";
 }
 
+void TreeMapApproximateNeighborTests() {
+  // Checking the large-k and approximate nearest neighbor searches.
+  std::cout << "\n";
+  std::cout << "**************************************************\n";
+  std::cout << "*** TreeMap Approximate Nearest Neighbor Tests ***\n";
+  std::cout << "**************************************************\n";
+
+  Stomp::AngularCoordinate ang(60.0, 0.0, Stomp::AngularCoordinate::Survey);
+  uint16_t n_points_per_node = 50;
+  uint32_t resolution = 32;
+  Stomp::TreeMap tree_map(resolution, n_points_per_node);
+  std::cout << "Building Stomp::TreeMap at " << resolution <<
+    " resolution...\n";
+
+  double theta_bound = 5.0;
+  uint32_t annulus_resolution = 32;
+  Stomp::Pixel tmp_pix(ang, annulus_resolution);
+  Stomp::PixelVector annulus_pix;
+  tmp_pix.WithinRadius(theta_bound, annulus_pix);
+  Stomp::Map* stomp_map = new Stomp::Map(annulus_pix);
+
+  uint32_t n_points = 200000;
+  Stomp::AngularVector angVec;
+  std::cout << "Adding " << n_points << " points\n";
+  stomp_map->GenerateRandomPoints(angVec, n_points);
+
+  for (Stomp::AngularIterator iter=angVec.begin();iter!=angVec.end();++iter) {
+    Stomp::WeightedAngularCoordinate tmp_ang(iter->UnitSphereX(),
+					     iter->UnitSphereY(),
+					     iter->UnitSphereZ(), 1.0);
+    tree_map.AddPoint(tmp_ang);
+  }
+  std::cout << "\t" << tree_map.NPoints() << " points added; " <<
+    tree_map.Nodes() << " total nodes.\n";
+
+  uint32_t n_test_points = 200;
+  Stomp::AngularVector test_angVec;
+  stomp_map->GenerateRandomPoints(test_angVec, n_test_points);
+
+  // For each value of k, we do an exact search and then a set of
+  // approximate searches, checking that the approximate kth neighbor
+  // distance is never more than (1+epsilon) times the exact one and
+  // tracking how much work the approximation saves us.
+  Stomp::StompWatch stomp_watch;
+  uint32_t n_neighbors[3] = {10, 100, 1000};
+  double epsilon[3] = {0.0, 0.1, 0.5};
+
+  for (uint8_t k_idx=0;k_idx<3;k_idx++) {
+    std::cout << "\nFinding " << n_neighbors[k_idx] <<
+      " nearest neighbors for " << n_test_points << " points...\n";
+
+    std::vector<double> exact_distance(n_test_points, 0.0);
+    for (uint8_t e_idx=0;e_idx<3;e_idx++) {
+      double mean_distance = 0.0;
+      double mean_nodes_visited = 0.0;
+      double mean_points_tested = 0.0;
+      double max_ratio = 0.0;
+      uint32_t n_bad = 0;
+      stomp_watch.StartTimer();
+      for (uint32_t i=0;i<n_test_points;i++) {
+	Stomp::TreeNeighbor neighbors(test_angVec[i], n_neighbors[k_idx]);
+	neighbors.SetEpsilon(epsilon[e_idx]);
+	tree_map.FindNeighbors(test_angVec[i], neighbors);
+
+	double distance = neighbors.MaxAngularDistance();
+	mean_distance += distance;
+	mean_nodes_visited += neighbors.NodesVisited();
+	mean_points_tested += neighbors.PointsTested();
+
+	if (e_idx == 0) {
+	  exact_distance[i] = distance;
+	} else {
+	  double ratio = distance/exact_distance[i];
+	  if (ratio > max_ratio) max_ratio = ratio;
+	  if (ratio > 1.0 + epsilon[e_idx] + 1.0e-10) n_bad++;
+	}
+      }
+      stomp_watch.StopTimer();
+
+      std::cout << "\tepsilon = " << epsilon[e_idx] <<
+	": Mean kth neighbor distance = " <<
+	mean_distance/n_test_points << "\n";
+      std::cout << "\t\tMean nodes visited = " <<
+	mean_nodes_visited/n_test_points << "; mean points tested = " <<
+	mean_points_tested/n_test_points << "\n";
+      if (e_idx > 0)
+	std::cout << "\t\tMax distance ratio = " << max_ratio << " (" <<
+	  n_bad << " outside tolerance)\n";
+      std::cout << "\t\tTime elapsed = " <<
+	stomp_watch.ElapsedTime()/n_test_points << "s\n";
+    }
+  }
+
+  // With one point per node, a large-k search visits more nodes than a
+  // uint16_t can hold.  The uint32_t count should match the TreeNeighbor
+  // and the uint16_t count should saturate rather than wrap.
+  Stomp::TreeMap fine_tree_map(resolution, 1);
+  for (Stomp::AngularIterator iter=angVec.begin();iter!=angVec.end();++iter)
+    fine_tree_map.AddPoint(*iter);
+  uint32_t large_k = 50000;
+  Stomp::TreeNeighbor neighbors(test_angVec[0], large_k);
+  fine_tree_map.FindNeighbors(test_angVec[0], neighbors);
+  uint32_t nodes_visited = 0;
+  uint16_t short_nodes_visited = 0;
+  fine_tree_map.KNearestNeighborDistance(test_angVec[0], large_k,
+					 nodes_visited);
+  fine_tree_map.KNearestNeighborDistance(test_angVec[0], large_k,
+					 short_nodes_visited);
+  std::cout << "\nFinding " << large_k << " nearest neighbors with " <<
+    "one point per node:\n\t" << nodes_visited <<
+    " nodes visited (" << neighbors.NodesVisited() << " from TreeNeighbor, " <<
+    short_nodes_visited << " as uint16_t)\n";
+
+  delete stomp_map;
+}
+
+void TreeMapPartitionedTests() {
+  std::cout << "\n";
+  std::cout << "*********************************\n";
+  std::cout << "*** TreeMap Partitioned Tests ***\n";
+  std::cout << "*********************************\n";
+  // We build a regular TreeMap and a PartitionedTreeMap from the same set of
+  // points.  The resolution is chosen so that the points are spread over a
+  // number of base level nodes and the cache is deliberately too small to
+  // hold all of them.
+  uint16_t n_points_per_node = 50;
+  uint32_t resolution = 64;
+  uint16_t cache_size = 2;
+  Stomp::TreeMap tree_map(resolution, n_points_per_node);
+  Stomp::PartitionedTreeMap part_map("/tmp/stomp_partitioned_tree_map_test",
+                                     resolution, n_points_per_node,
+                                     cache_size, 1000);
+
+  double lambda = 60.0;
+  double eta = 0.0;
+  Stomp::AngularCoordinate ang(lambda, eta, Stomp::AngularCoordinate::Survey);
+  double theta_radius = 5.0;
+  Stomp::Pixel tmp_pix(ang, 32);
+  Stomp::PixelVector annulus_pix;
+  tmp_pix.WithinRadius(theta_radius, annulus_pix);
+  Stomp::Map* stomp_map = new Stomp::Map(annulus_pix);
+  uint32_t n_points = 10000;
+  Stomp::AngularVector angVec;
+  stomp_map->GenerateRandomPoints(angVec, n_points);
+
+  for (Stomp::AngularIterator iter=angVec.begin();iter!=angVec.end();++iter) {
+    tree_map.AddPoint(*iter);
+    part_map.AddPoint(*iter);
+  }
+  part_map.Flush();
+  std::cout << "\t" << part_map.NPoints() << " points in " <<
+    part_map.BaseNodes() << " blocks (" << tree_map.BaseNodes() <<
+    " TreeMap base nodes).\n";
+
+  std::cout << "\nSingle point test:\n";
+  double theta_min = 0.3;
+  double theta_max = 0.5;
+  std::cout << "\tFound " << part_map.FindPairs(ang, theta_min, theta_max) <<
+    " pairs; " << tree_map.FindPairs(ang, theta_min, theta_max) <<
+    " pairs from TreeMap.\n";
+
+  std::cout << "\nAngular Bin test:\n";
+  Stomp::StompWatch stomp_watch;
+  Stomp::AngularCorrelation wtheta(0.01, 1.0, 5.0, false);
+  Stomp::AngularCorrelation wtheta_tree(0.01, 1.0, 5.0, false);
+  uint32_t block_reads = part_map.BlockReads();
+  stomp_watch.StartTimer();
+  part_map.FindWeightedPairs(angVec, wtheta);
+  stomp_watch.StopTimer();
+  std::cout << "\tTime elapsed: " << stomp_watch.ElapsedTime() <<
+    " seconds; " << part_map.BlockReads() - block_reads <<
+    " block reads for " << part_map.BaseNodes() << " blocks with " <<
+    part_map.CachedNodes() << "/" << part_map.CacheSize() <<
+    " nodes cached.\n";
+  tree_map.FindWeightedPairs(angVec, wtheta_tree);
+
+  std::cout << "TreeMap comparison:\n";
+  Stomp::ThetaIterator tree_iter = wtheta_tree.Begin();
+  for (Stomp::ThetaIterator iter=wtheta.Begin();
+       iter!=wtheta.End();++iter,++tree_iter) {
+    std::cout << "\t" << iter->ThetaMin() << " - " << iter->ThetaMax() <<
+      ": " << iter->Counter() << " pairs; " << tree_iter->Counter() <<
+      " TreeMap pairs.\n";
+  }
+
+  // A second map sharing the same scratch directory (and the same block file
+  // names) shouldn't see the first map's points.
+  Stomp::PartitionedTreeMap other_map("/tmp/stomp_partitioned_tree_map_test",
+                                      resolution, n_points_per_node,
+                                      cache_size, 1000);
+  for (Stomp::AngularIterator iter=angVec.begin();iter!=angVec.end();++iter)
+    other_map.AddPoint(*iter);
+  std::cout << "\nShared directory test:\n\tFound " <<
+    other_map.FindPairs(ang, theta_min, theta_max) << " pairs; " <<
+    tree_map.FindPairs(ang, theta_min, theta_max) <<
+    " pairs from TreeMap (" << other_map.BlockDirectory() << " vs. " <<
+    part_map.BlockDirectory() << ").\n";
+
+  part_map.Clear();
+  delete stomp_map;
+}
+
+void TreeMapSinglePrecisionTests() {
+  std::cout << "\n";
+  std::cout << "**************************************\n";
+  std::cout << "*** TreeMap Single Precision Tests ***\n";
+  std::cout << "**************************************\n";
+  // We fill a double precision and a single precision TreeMap with the same
+  // random points.  A set of close companions (half an arcsecond away) is
+  // added so that the bins below the precision threshold have pairs in them.
+  Stomp::AngularCoordinate ang(60.0, 0.0, Stomp::AngularCoordinate::Survey);
+  Stomp::Pixel tmp_pix(ang, 32);
+  Stomp::PixelVector annulus_pix;
+  tmp_pix.WithinRadius(5.0, annulus_pix);
+  Stomp::Map* stomp_map = new Stomp::Map(annulus_pix);
+  uint32_t n_points = 50000;
+  Stomp::AngularVector angVec;
+  stomp_map->GenerateRandomPoints(angVec, n_points);
+  for (uint32_t i=0;i<1000;i++) {
+    Stomp::AngularCoordinate companion(angVec[i].Lambda() + 0.5/3600.0,
+				       angVec[i].Eta(),
+				       Stomp::AngularCoordinate::Survey);
+    angVec.push_back(companion);
+  }
+
+  Stomp::TreeMap tree_map(128, 50);
+  Stomp::TreeMap sp_tree_map(128, 50);
+  sp_tree_map.SetSinglePrecision();
+  Stomp::StompWatch stomp_watch;
+  stomp_watch.StartTimer();
+  for (uint32_t i=0;i<angVec.size();i++) {
+    Stomp::WeightedAngularCoordinate tmp_ang(angVec[i].UnitSphereX(),
+					     angVec[i].UnitSphereY(),
+					     angVec[i].UnitSphereZ(),
+					     1.0 + (i % 3));
+    tree_map.AddPoint(tmp_ang);
+    sp_tree_map.AddPoint(tmp_ang);
+  }
+  stomp_watch.StopTimer();
+  std::cout << "\t" << tree_map.NPoints() << " points (" <<
+    sp_tree_map.NPoints() << " single precision); weights: " <<
+    tree_map.Weight() << ", " << sp_tree_map.Weight() << ".\n";
+  std::cout << "\t" << tree_map.Nodes() << " nodes (" <<
+    sp_tree_map.Nodes() << " single precision).\n";
+
+  std::cout << "\nAngular bin comparison:\n";
+  Stomp::AngularVector subVec(angVec.begin(), angVec.begin() + 2000);
+  Stomp::AngularCorrelation wtheta(0.0001, 1.0, 5.0, false);
+  Stomp::AngularCorrelation sp_wtheta(0.0001, 1.0, 5.0, false);
+  stomp_watch.StartTimer();
+  tree_map.FindWeightedPairs(subVec, wtheta);
+  stomp_watch.StopTimer();
+  double double_time = stomp_watch.ElapsedTime();
+  stomp_watch.StartTimer();
+  sp_tree_map.FindWeightedPairs(subVec, sp_wtheta);
+  stomp_watch.StopTimer();
+  std::cout << "\tDouble precision: " << double_time <<
+    "s; single precision: " << stomp_watch.ElapsedTime() << "s\n";
+  Stomp::ThetaIterator sp_iter = sp_wtheta.Begin();
+  for (Stomp::ThetaIterator iter=wtheta.Begin();
+       iter!=wtheta.End();++iter,++sp_iter) {
+    std::cout << "\t" << iter->ThetaMin() << " - " << iter->ThetaMax() <<
+      ": " << iter->PixelWeight() << " vs. " << sp_iter->PixelWeight() <<
+      " (" << iter->Weight() << " vs. " << sp_iter->Weight() << ")\n";
+  }
+
+  // Bins below the precision threshold fall back to double precision, so the
+  // companion pairs should be found in both cases.
+  uint32_t n_mismatch = 0;
+  Stomp::AngularBin small_theta(0.0, 1.0/3600.0);
+  for (uint32_t i=0;i<1000;i++) {
+    if (tree_map.FindPairs(angVec[i], small_theta) !=
+	sp_tree_map.FindPairs(angVec[i], small_theta)) n_mismatch++;
+  }
+  std::cout << "\t" << n_mismatch <<
+    " mismatched counts for sub-arcsecond pairs.\n";
+
+  // Nearest neighbor distances should agree to well below an arcsecond.
+  n_mismatch = 0;
+  for (uint32_t i=0;i<2000;i++) {
+    uint16_t nodes_visited;
+    double dist = tree_map.KNearestNeighborDistance(angVec[i], 4,
+						    nodes_visited);
+    double sp_dist = sp_tree_map.KNearestNeighborDistance(angVec[i], 4,
+							  nodes_visited);
+    if (fabs(dist - sp_dist) > 1.0e-4/3600.0) n_mismatch++;
+  }
+  std::cout << "\t" << n_mismatch <<
+    " mismatched 4th nearest neighbor distances.\n";
+
+  // The IndexedTreeMap works the same way.
+  Stomp::IndexedTreeMap itree_map(128, 50);
+  Stomp::IndexedTreeMap sp_itree_map(128, 50);
+  sp_itree_map.SetSinglePrecision();
+  for (uint32_t i=0;i<angVec.size();i++) {
+    itree_map.AddPoint(angVec[i], i);
+    sp_itree_map.AddPoint(angVec[i], i);
+  }
+  n_mismatch = 0;
+  for (uint32_t i=0;i<200;i++) {
+    Stomp::IndexVector indices, sp_indices;
+    itree_map.FindPairs(angVec[i], 0.1, indices);
+    sp_itree_map.FindPairs(angVec[i], 0.1, sp_indices);
+    std::sort(indices.begin(), indices.end());
+    std::sort(sp_indices.begin(), sp_indices.end());
+    if (indices != sp_indices) n_mismatch++;
+  }
+  std::cout << "\t" << sp_itree_map.NPoints() << " points in IndexedTreeMap; " <<
+    n_mismatch << " mismatched index lists.\n";
+
+  delete stomp_map;
+}
+
+void TreeMapFrozenTests() {
+  std::cout << "\n";
+  std::cout << "****************************\n";
+  std::cout << "*** TreeMap Frozen Tests ***\n";
+  std::cout << "****************************\n";
+  // We fill a TreeMap, run a set of pair counts and nearest neighbor
+  // searches, then freeze the map and repeat them.  The frozen version should
+  // be faster.  The linked nodes can be off by a pair or two when a point
+  // sits right at a bin edge (the node containment tests have a small
+  // tolerance), so any bins that disagree are checked by brute force.
+  Stomp::AngularCoordinate ang(60.0, 0.0, Stomp::AngularCoordinate::Survey);
+  Stomp::Pixel tmp_pix(ang, 32);
+  Stomp::PixelVector annulus_pix;
+  tmp_pix.WithinRadius(10.0, annulus_pix);
+  Stomp::Map* stomp_map = new Stomp::Map(annulus_pix);
+  uint32_t n_points = 200000;
+  Stomp::AngularVector angVec;
+  stomp_map->GenerateRandomPoints(angVec, n_points);
+
+  Stomp::TreeMap tree_map(Stomp::HPixResolution, 50);
+  for (uint32_t i=0;i<angVec.size();i++)
+    tree_map.AddPoint(angVec[i], 1.0 + (i % 3));
+  std::cout << "\t" << tree_map.NPoints() << " points in " <<
+    tree_map.BaseNodes() << " base nodes.\n";
+
+  Stomp::AngularVector subVec(angVec.begin(), angVec.begin() + 5000);
+  Stomp::StompWatch stomp_watch;
+
+  std::cout << "\nPair counting:\n";
+  Stomp::AngularCorrelation wtheta(0.001, 2.0, 5.0, false);
+  stomp_watch.StartTimer();
+  tree_map.FindWeightedPairs(subVec, wtheta);
+  stomp_watch.StopTimer();
+  double linked_time = stomp_watch.ElapsedTime();
+
+  stomp_watch.StartTimer();
+  tree_map.Freeze();
+  stomp_watch.StopTimer();
+  std::cout << "\tFroze tree in " << stomp_watch.ElapsedTime() << "s.\n";
+
+  Stomp::AngularCorrelation frozen_wtheta(0.001, 2.0, 5.0, false);
+  stomp_watch.StartTimer();
+  tree_map.FindWeightedPairs(subVec, frozen_wtheta);
+  stomp_watch.StopTimer();
+  std::cout << "\tLinked nodes: " << linked_time << "s; frozen: " <<
+    stomp_watch.ElapsedTime() << "s\n";
+
+  uint32_t n_mismatch = 0;
+  Stomp::ThetaIterator frozen_iter = frozen_wtheta.Begin();
+  for (Stomp::ThetaIterator iter=wtheta.Begin();
+       iter!=wtheta.End();++iter,++frozen_iter) {
+    if ((iter->Counter() != frozen_iter->Counter()) ||
+	!Stomp::DoubleEQ(iter->Weight()/frozen_iter->Weight(), 1.0)) {
+      n_mismatch++;
+      uint32_t n_brute = 0;
+      for (uint32_t i=0;i<subVec.size();i++) {
+	for (uint32_t j=0;j<angVec.size();j++) {
+	  if (iter->WithinCosBounds(subVec[i].DotProduct(angVec[j])))
+	    n_brute++;
+	}
+      }
+      std::cout << "\t" << iter->ThetaMin() << " - " << iter->ThetaMax() <<
+	": " << iter->Counter() << " pairs from the linked nodes, " <<
+	frozen_iter->Counter() << " frozen, " << n_brute <<
+	" by brute force.\n";
+    }
+  }
+  std::cout << "\t" << n_mismatch << "/" << wtheta.NBins() <<
+    " bins differ between the linked nodes and the frozen tree.\n";
+
+  // For a smaller set of points, we can check every bin for both layouts
+  // against brute force.
+  Stomp::AngularVector checkVec(angVec.begin(), angVec.begin() + 500);
+  Stomp::AngularCorrelation check_frozen(0.001, 2.0, 5.0, false);
+  Stomp::AngularCorrelation check_linked(0.001, 2.0, 5.0, false);
+  tree_map.FindWeightedPairs(checkVec, check_frozen);
+  tree_map.Thaw();
+  tree_map.FindWeightedPairs(checkVec, check_linked);
+  std::vector<uint32_t> brute_counts(check_frozen.NBins(), 0);
+  double costheta_min = cos(check_frozen.ThetaMax()*Stomp::DegToRad);
+  for (uint32_t i=0;i<checkVec.size();i++) {
+    for (uint32_t j=0;j<angVec.size();j++) {
+      double costheta = checkVec[i].DotProduct(angVec[j]);
+      if (costheta < costheta_min - 1.0e-10) continue;
+      uint32_t bin_idx = 0;
+      for (Stomp::ThetaIterator iter=check_frozen.Begin();
+	   iter!=check_frozen.End();++iter,++bin_idx) {
+	if (iter->WithinCosBounds(costheta)) brute_counts[bin_idx]++;
+      }
+    }
+  }
+  uint32_t n_linked_bad = 0, n_frozen_bad = 0, bin_idx = 0;
+  Stomp::ThetaIterator linked_iter = check_linked.Begin();
+  for (Stomp::ThetaIterator iter=check_frozen.Begin();
+       iter!=check_frozen.End();++iter,++linked_iter,++bin_idx) {
+    if (iter->Counter() != brute_counts[bin_idx]) n_frozen_bad++;
+    if (linked_iter->Counter() != brute_counts[bin_idx]) n_linked_bad++;
+  }
+  std::cout << "\tAgainst brute force for " << checkVec.size() <<
+    " points: " << n_frozen_bad << "/" << check_frozen.NBins() <<
+    " frozen bins and " << n_linked_bad << "/" << check_linked.NBins() <<
+    " linked node bins differ.\n";
+
+  std::cout << "\nNearest neighbors:\n";
+  uint32_t n_neighbors = 8;
+  std::vector<double> neighbor_dist;
+  tree_map.Thaw();
+  stomp_watch.StartTimer();
+  for (uint32_t i=0;i<subVec.size();i++) {
+    uint16_t nodes_visited;
+    neighbor_dist.push_back(
+      tree_map.KNearestNeighborDistance(subVec[i], n_neighbors,
+					nodes_visited));
+  }
+  stomp_watch.StopTimer();
+  linked_time = stomp_watch.ElapsedTime();
+
+  tree_map.Freeze();
+  n_mismatch = 0;
+  stomp_watch.StartTimer();
+  for (uint32_t i=0;i<subVec.size();i++) {
+    uint16_t nodes_visited;
+    double dist = tree_map.KNearestNeighborDistance(subVec[i], n_neighbors,
+						    nodes_visited);
+    if (fabs(dist - neighbor_dist[i]) > 1.0e-8) n_mismatch++;
+  }
+  stomp_watch.StopTimer();
+  std::cout << "\tLinked nodes: " << linked_time << "s; frozen: " <<
+    stomp_watch.ElapsedTime() << "s\n";
+  std::cout << "\t" << n_mismatch << "/" << subVec.size() <<
+    " mismatched " << static_cast<int>(n_neighbors) <<
+    "th nearest neighbor distances.\n";
+
+  // Adding a point should thaw the tree.
+  tree_map.AddPoint(angVec[0], 1.0);
+  std::cout << "\tAfter adding a point, frozen = " << tree_map.Frozen() <<
+    "\n";
+
+  delete stomp_map;
+}
+
+void TreeMapReadTests() {
+  std::cout << "\n";
+  std::cout << "**************************\n";
+  std::cout << "*** TreeMap Read Tests ***\n";
+  std::cout << "**************************\n";
+  // We write a catalog to disk, read it back point by point and build a
+  // TreeMap from it, then compare that to TreeMaps built with the pipelined
+  // Read method.  The trees should be identical, down to the order of the
+  // points in each node, regardless of the number of threads.
+  Stomp::AngularCoordinate ang(60.0, 0.0, Stomp::AngularCoordinate::Survey);
+  Stomp::CircleBound circle(ang, 10.0);
+  Stomp::Map stomp_map(circle, 1.0, 256);
+  uint32_t n_points = 200000;
+  Stomp::AngularVector angVec;
+  stomp_map.GenerateRandomPoints(angVec, n_points);
+
+  std::string catalog_file = "TreeMapReadTest.dat";
+  std::ofstream catalog_str(catalog_file.c_str());
+  catalog_str << std::setprecision(12);
+  for (uint32_t i=0;i<angVec.size();i++)
+    catalog_str << angVec[i].RA() << " " << angVec[i].DEC() << " " <<
+      1.0 + 0.25*(i%5) << " " << 1.0*(i%11) << "\n";
+  catalog_str.close();
+
+  Stomp::FieldColumnDict field_columns;
+  field_columns["mag"] = 3;
+  Stomp::StompWatch stomp_watch;
+
+  stomp_watch.StartTimer();
+  Stomp::TreeMap serial_map(256, 50);
+  std::ifstream input_str(catalog_file.c_str());
+  double ra, dec, weight, mag;
+  while (input_str >> ra >> dec >> weight >> mag) {
+    Stomp::FieldDict fields;
+    fields["mag"] = mag;
+    serial_map.AddPoint(new Stomp::WeightedAngularCoordinate(
+      ra, dec, weight, fields, Stomp::AngularCoordinate::Equatorial));
+  }
+  input_str.close();
+  stomp_watch.StopTimer();
+  std::cout << "\tSerial: " << serial_map.NPoints() << " points in " <<
+    serial_map.BaseNodes() << " base nodes in " <<
+    stomp_watch.ElapsedTime() << "s\n";
+
+  Stomp::WAngularVector serial_points;
+  serial_map.Points(serial_points);
+  Stomp::AngularVector subVec(angVec.begin(), angVec.begin() + 1000);
+  Stomp::AngularCorrelation serial_wtheta(0.01, 2.0, 5.0, false);
+  serial_map.FindWeightedPairs(subVec, serial_wtheta);
+
+  uint16_t n_threads[3] = {1, 2, 4};
+  for (uint32_t n=0;n<3;n++) {
+    Stomp::TreeMap tree_map(256, 50);
+    tree_map.SetNThreads(n_threads[n]);
+    stomp_watch.StartTimer();
+    bool read_ok = tree_map.Read(catalog_file, field_columns,
+				 Stomp::AngularCoordinate::Equatorial,
+				 false, 0, 1, 2);
+    stomp_watch.StopTimer();
+
+    Stomp::WAngularVector points;
+    tree_map.Points(points);
+    uint32_t n_mismatch = 0;
+    for (uint32_t i=0;(i<points.size())&&(i<serial_points.size());i++) {
+      if ((points[i].UnitSphereX() != serial_points[i].UnitSphereX()) ||
+	  (points[i].UnitSphereY() != serial_points[i].UnitSphereY()) ||
+	  (points[i].Weight() != serial_points[i].Weight()) ||
+	  (points[i].Field("mag") != serial_points[i].Field("mag")))
+	n_mismatch++;
+    }
+
+    Stomp::AngularCorrelation wtheta(0.01, 2.0, 5.0, false);
+    tree_map.FindWeightedPairs(subVec, wtheta);
+    Stomp::ThetaIterator serial_iter = serial_wtheta.Begin();
+    for (Stomp::ThetaIterator iter=wtheta.Begin();
+	 iter!=wtheta.End();++iter,++serial_iter)
+      if (iter->Weight() != serial_iter->Weight()) n_mismatch++;
+
+    std::cout << "\t" << n_threads[n] << " thread(s): " <<
+      tree_map.NPoints() << " points in " << tree_map.BaseNodes() <<
+      " base nodes in " << stomp_watch.ElapsedTime() << "s; " <<
+      n_mismatch << " mismatches.\n";
+    if (read_ok && (n_mismatch == 0) &&
+	(points.size() == serial_points.size()) &&
+	(tree_map.Nodes() == serial_map.Nodes()) &&
+	Stomp::DoubleEQ(tree_map.Weight(), serial_map.Weight()) &&
+	Stomp::DoubleEQ(tree_map.FieldTotal("mag"),
+			serial_map.FieldTotal("mag"))) {
+      std::cout << "\t\tGood: matches the serial TreeMap.\n";
+    } else {
+      std::cout << "\t\tBad: doesn't match the serial TreeMap.\n";
+    }
+  }
+}
+
 // Define our command line flags here so we can use these flags later.
 DEFINE_bool(all_tree_map_tests, false, "Run all class unit tests.");
 DEFINE_bool(tree_map_basic_tests, false, "Run TreeMap basic tests");
@@ -926,6 +1480,16 @@ DEFINE_bool(tree_map_neighbor_tests, false,
             "Run TreeMap nearest neighbor tests");
 DEFINE_bool(tree_map_match_tests, false,
             "Run TreeMap closest match tests");
+DEFINE_bool(tree_map_approximate_neighbor_tests, false,
+            "Run TreeMap large-k and approximate nearest neighbor tests");
+DEFINE_bool(tree_map_partitioned_tests, false,
+            "Run PartitionedTreeMap pair tests");
+DEFINE_bool(tree_map_single_precision_tests, false,
+            "Run TreeMap single precision storage tests");
+DEFINE_bool(tree_map_frozen_tests, false,
+            "Run frozen TreeMap pair and nearest neighbor tests");
+DEFINE_bool(tree_map_read_tests, false,
+            "Run pipelined TreeMap Read tests");
 
 void TreeMapUnitTests(bool run_all_tests) {
   void TreeMapBasicTests();
@@ -935,6 +1499,11 @@ void TreeMapUnitTests(bool run_all_tests) {
   void TreeMapFieldPairTests();
   void TreeMapNeighborTests();
   void TreeMapMatchTests();
+  void TreeMapApproximateNeighborTests();
+  void TreeMapPartitionedTests();
+  void TreeMapSinglePrecisionTests();
+  void TreeMapFrozenTests();
+  void TreeMapReadTests();
 
   if (run_all_tests) FLAGS_all_tree_map_tests = true;
 
@@ -967,4 +1536,24 @@ void TreeMapUnitTests(bool run_all_tests) {
   // Checking closest match routines.
   if (FLAGS_all_tree_map_tests || FLAGS_tree_map_match_tests)
     TreeMapMatchTests();
+
+  // Checking large-k and approximate nearest neighbor routines.
+  if (FLAGS_all_tree_map_tests || FLAGS_tree_map_approximate_neighbor_tests)
+    TreeMapApproximateNeighborTests();
+
+  // Checking the out-of-core PartitionedTreeMap against TreeMap.
+  if (FLAGS_all_tree_map_tests || FLAGS_tree_map_partitioned_tests)
+    TreeMapPartitionedTests();
+
+  // Checking single precision storage against the default storage.
+  if (FLAGS_all_tree_map_tests || FLAGS_tree_map_single_precision_tests)
+    TreeMapSinglePrecisionTests();
+
+  // Checking the frozen tree layout against the linked nodes.
+  if (FLAGS_all_tree_map_tests || FLAGS_tree_map_frozen_tests)
+    TreeMapFrozenTests();
+
+  // Checking the pipelined Read against adding the points one at a time.
+  if (FLAGS_all_tree_map_tests || FLAGS_tree_map_read_tests)
+    TreeMapReadTests();
 }
@@ -16,6 +16,7 @@
 
 #include "stomp_core.h"
 #include "stomp_tree_pixel.h"
+#include "stomp_compact_leaf.h"
 #include "stomp_angular_bin.h"
 #include "stomp_radial_bin.h"
 #include "stomp_angular_correlation.h"
@@ -26,6 +27,10 @@ TreePixel::TreePixel() {
   SetWeight(0.0);
   maximum_points_ = 0;
   point_count_ = 0;
+  initialized_subpixels_ = false;
+  leaf_ = NULL;
+  single_precision_ = false;
+  precision_threshold_ = SinglePrecisionThreshold;
   InitializeCorners();
 }
 
@@ -42,6 +47,9 @@ TreePixel::TreePixel(const uint32_t input_resolution,
   maximum_points_ = maximum_points;
   point_count_ = 0;
   initialized_subpixels_ = false;
+  leaf_ = NULL;
+  single_precision_ = false;
+  precision_threshold_ = SinglePrecisionThreshold;
   InitializeCorners();
 }
 
@@ -55,6 +63,9 @@ TreePixel:: TreePixel(const uint32_t input_x,
   maximum_points_ = maximum_points;
   point_count_ = 0;
   initialized_subpixels_ = false;
+  leaf_ = NULL;
+  single_precision_ = false;
+  precision_threshold_ = SinglePrecisionThreshold;
   InitializeCorners();
 }
 
@@ -67,6 +78,9 @@ TreePixel::TreePixel(AngularCoordinate& ang,
   maximum_points_ = maximum_points;
   point_count_ = 0;
   initialized_subpixels_ = false;
+  leaf_ = NULL;
+  single_precision_ = false;
+  precision_threshold_ = SinglePrecisionThreshold;
   InitializeCorners();
 }
 
@@ -91,6 +105,8 @@ bool TreePixel::_InitializeSubPixels() {
     for (PixelIterator iter=tmp_pix.begin();iter!=tmp_pix.end();++iter) {
       TreePixel* tree_pix = new TreePixel(iter->PixelX(), iter->PixelY(),
 					  iter->Resolution(), maximum_points_);
+      if (single_precision_)
+	tree_pix->SetSinglePrecision(true, precision_threshold_);
       subpix_.push_back(tree_pix);
     }
     initialized_subpixels_ = true;
@@ -110,6 +126,29 @@ bool TreePixel::_InitializeSubPixels() {
       if (!transferred_point_to_subpixels) initialized_subpixels_ = false;
     }
     ang_.clear();
+
+    // Single precision points are reconstructed and handed to the sub-pixels
+    // as new objects.  Rounding can move a point that was very close to a
+    // sub-pixel boundary across that boundary, in which case we put it in the
+    // sub-pixel with the nearest center rather than losing it.
+    if (leaf_ != NULL) {
+      for (uint32_t i=0;i<leaf_->NPoints();++i) {
+	WeightedAngularCoordinate tmp_ang;
+	leaf_->Point(i, tmp_ang);
+	transferred_point_to_subpixels = false;
+	for (uint32_t j=0;j<subpix_.size();++j) {
+	  if (subpix_[j]->_AddPoint(&tmp_ang, false)) {
+	    j = subpix_.size();
+	    transferred_point_to_subpixels = true;
+	  }
+	}
+	if (!transferred_point_to_subpixels &&
+	    !subpix_[_NearestSubPixel(tmp_ang)]->_AddPoint(&tmp_ang, true))
+	  initialized_subpixels_ = false;
+      }
+      delete leaf_;
+      leaf_ = NULL;
+    }
   }
 
   return initialized_subpixels_;
@@ -119,7 +158,10 @@ uint32_t TreePixel::DirectPairCount(AngularCoordinate& ang,
 				    AngularBin& theta,
 				    int16_t region) {
   uint32_t pair_count = 0;
-  if (theta.ThetaMax() < 90.0) {
+  if (leaf_ != NULL) {
+    pair_count = leaf_->FindPairs(
+      ang, theta, CompactLeaf::SinglePrecisionBin(theta, precision_threshold_));
+  } else if (theta.ThetaMax() < 90.0) {
     for (WAngularPtrIterator iter=ang_.begin();iter!=ang_.end();++iter) {
       if (theta.WithinCosBounds((*iter)->DotProduct(ang))) pair_count++;
     }
@@ -140,7 +182,7 @@ uint32_t TreePixel::FindPairs(AngularCoordinate& ang, AngularBin& theta,
   // If we have AngularCoordinates in this pixel, then this is just a
   // matter of iterating through them and finding how many satisfy the
   // angular bounds.
-  if (!ang_.empty()) {
+  if (HasPoints()) {
     pair_count = DirectPairCount(ang, theta, region);
   } else {
     // If the current pixel doesn't contain any points, then we need to see
@@ -187,7 +229,11 @@ double TreePixel::DirectWeightedPairs(AngularCoordinate& ang, AngularBin& theta,
   double total_weight = 0.0;
   uint32_t n_pairs = 0;
 
-  if (theta.ThetaMax() < 90.0) {
+  if (leaf_ != NULL) {
+    n_pairs = leaf_->FindWeightedPairs(
+      ang, theta, CompactLeaf::SinglePrecisionBin(theta, precision_threshold_),
+      total_weight);
+  } else if (theta.ThetaMax() < 90.0) {
     for (WAngularPtrIterator iter=ang_.begin();iter!=ang_.end();++iter) {
       if (theta.WithinCosBounds((*iter)->DotProduct(ang))) {
 	total_weight += (*iter)->Weight();
@@ -215,7 +261,7 @@ double TreePixel::FindWeightedPairs(AngularCoordinate& ang, AngularBin& theta,
   // If we have AngularCoordinates in this pixel, then this is just a
   // matter of iterating through them and finding how many satisfy the
   // angular bounds.
-  if (!ang_.empty()) {
+  if (HasPoints()) {
     total_weight = DirectWeightedPairs(ang, theta, region);
   } else {
     // If the current pixel doesn't contain any points, then we need to see
@@ -262,7 +308,12 @@ double TreePixel::DirectWeightedPairs(WeightedAngularCoordinate& w_ang,
   double total_weight = 0.0;
   uint32_t n_pairs = 0;
 
-  if (theta.ThetaMax() < 90.0) {
+  if (leaf_ != NULL) {
+    n_pairs = leaf_->FindWeightedPairs(
+      w_ang, theta,
+      CompactLeaf::SinglePrecisionBin(theta, precision_threshold_),
+      total_weight);
+  } else if (theta.ThetaMax() < 90.0) {
     for (WAngularPtrIterator iter=ang_.begin();iter!=ang_.end();++iter) {
       if (theta.WithinCosBounds((*iter)->DotProduct(w_ang))) {
 	total_weight += (*iter)->Weight();
@@ -292,7 +343,7 @@ double TreePixel::FindWeightedPairs(WeightedAngularCoordinate& w_ang,
   // If we have AngularCoordinates in this pixel, then this is just a
   // matter of iterating through them and finding how many satisfy the
   // angular bounds.
-  if (!ang_.empty()) {
+  if (HasPoints()) {
     total_weight = DirectWeightedPairs(w_ang, theta, region);
   } else {
     // If the current pixel doesn't contain any points, then we need to see
@@ -403,7 +454,12 @@ double TreePixel::DirectWeightedPairs(AngularCoordinate& ang, AngularBin& theta,
   double total_weight = 0.0;
   uint32_t n_pairs = 0;
 
-  if (theta.ThetaMax() < 90.0) {
+  if (leaf_ != NULL) {
+    // Single precision leaves don't store Fields, so only the pair count
+    // is non-zero.
+    n_pairs = leaf_->FindPairs(
+      ang, theta, CompactLeaf::SinglePrecisionBin(theta, precision_threshold_));
+  } else if (theta.ThetaMax() < 90.0) {
     for (WAngularPtrIterator iter=ang_.begin();iter!=ang_.end();++iter) {
       if (theta.WithinCosBounds((*iter)->DotProduct(ang))) {
 	total_weight += (*iter)->Field(field_name);
@@ -432,7 +488,7 @@ double TreePixel::FindWeightedPairs(AngularCoordinate& ang, AngularBin& theta,
   // If we have AngularCoordinates in this pixel, then this is just a
   // matter of iterating through them and finding how many satisfy the
   // angular bounds.
-  if (!ang_.empty()) {
+  if (HasPoints()) {
     total_weight = DirectWeightedPairs(ang, theta, field_name, region);
   } else {
     // If the current pixel doesn't contain any points, then we need to see
@@ -507,7 +563,13 @@ double TreePixel::DirectWeightedPairs(WeightedAngularCoordinate& w_ang,
   double total_weight = 0.0;
   uint32_t n_pairs = 0;
 
-  if (theta.ThetaMax() < 90.0) {
+  if (leaf_ != NULL) {
+    // Single precision leaves don't store Fields, so only the pair count
+    // is non-zero.
+    n_pairs = leaf_->FindPairs(
+      w_ang, theta,
+      CompactLeaf::SinglePrecisionBin(theta, precision_threshold_));
+  } else if (theta.ThetaMax() < 90.0) {
     for (WAngularPtrIterator iter=ang_.begin();iter!=ang_.end();++iter) {
       if (theta.WithinCosBounds((*iter)->DotProduct(w_ang))) {
 	total_weight += (*iter)->Field(field_name);
@@ -539,7 +601,7 @@ double TreePixel::FindWeightedPairs(WeightedAngularCoordinate& w_ang,
   // If we have AngularCoordinates in this pixel, then this is just a
   // matter of iterating through them and finding how many satisfy the
   // angular bounds.
-  if (!ang_.empty()) {
+  if (HasPoints()) {
     total_weight = DirectWeightedPairs(w_ang, theta, field_name, region);
   } else {
     // If the current pixel doesn't contain any points, then we need to see
@@ -619,7 +681,13 @@ double TreePixel::DirectWeightedPairs(WeightedAngularCoordinate& w_ang,
   double total_weight = 0.0;
   uint32_t n_pairs = 0;
 
-  if (theta.ThetaMax() < 90.0) {
+  if (leaf_ != NULL) {
+    // Single precision leaves don't store Fields, so only the pair count
+    // is non-zero.
+    n_pairs = leaf_->FindPairs(
+      w_ang, theta,
+      CompactLeaf::SinglePrecisionBin(theta, precision_threshold_));
+  } else if (theta.ThetaMax() < 90.0) {
     for (WAngularPtrIterator iter=ang_.begin();iter!=ang_.end();++iter) {
       if (theta.WithinCosBounds((*iter)->DotProduct(w_ang))) {
 	total_weight += (*iter)->Field(field_name);
@@ -652,7 +720,7 @@ double TreePixel::FindWeightedPairs(WeightedAngularCoordinate& w_ang,
   // If we have AngularCoordinates in this pixel, then this is just a
   // matter of iterating through them and finding how many satisfy the
   // angular bounds.
-  if (!ang_.empty()) {
+  if (HasPoints()) {
     total_weight =
       DirectWeightedPairs(w_ang, ang_field_name, theta, field_name, region);
   } else {
@@ -732,10 +800,84 @@ void TreePixel::FindWeightedPairs(WAngularVector& w_ang,
   }
 }
 
-uint16_t TreePixel::FindKNearestNeighbors(AngularCoordinate& ang,
-					  uint8_t n_neighbors,
-					  WAngularVector& neighbor_ang) {
+void TreePixel::FindNestedPairs(AngularCoordinate& ang,
+				std::vector<AngularBin>& disks,
+				std::vector<uint32_t>& counts,
+				std::vector<double>& weights) {
+  if (!disks.empty())
+    _NestedPairRecursion(ang, disks, 0, disks.size(), counts, weights);
+}
+
+void TreePixel::_NestedPairRecursion(AngularCoordinate& ang,
+				     std::vector<AngularBin>& disks,
+				     uint32_t min_disk, uint32_t max_disk,
+				     std::vector<uint32_t>& counts,
+				     std::vector<double>& weights) {
+  if (HasPoints()) {
+    // Each point goes to the first disk that contains it.  The tests are
+    // the same ones that DirectPairCount uses for a single disk, so the
+    // running sums match FindPairs for each radius.
+    WeightedAngularCoordinate tmp_ang;
+    uint32_t n_points = ang_.size() + (leaf_ != NULL ? leaf_->NPoints() : 0);
+    for (uint32_t i=0;i<n_points;i++) {
+      WeightedAngularCoordinate* point = &tmp_ang;
+      if (i < ang_.size()) {
+	point = ang_[i];
+      } else {
+	leaf_->Point(i - ang_.size(), tmp_ang);
+      }
+      // Most of the points in a node are in the outer disks, so we work in
+      // from the largest one.
+      double costheta = point->DotProduct(ang);
+      uint32_t disk_idx = max_disk;
+      while ((disk_idx > min_disk) &&
+	     (disks[disk_idx-1].ThetaMax() < 90.0 ?
+	      disks[disk_idx-1].WithinCosBounds(costheta) :
+	      disks[disk_idx-1].WithinBounds(point->AngularDistance(ang))))
+	disk_idx--;
+      if (disk_idx < disks.size()) {
+	counts[disk_idx]++;
+	weights[disk_idx] += point->Weight();
+      }
+    }
+  } else {
+    // Working in from the largest disk, we find the smallest disk that
+    // contains all of the node and the smallest one that contains any of
+    // it; since the disks are nested, we can stop at the first disk that
+    // misses the node entirely.  If those are the same disk, then all of
+    // the node's points belong to it.  Otherwise, the sub-nodes only need
+    // to check the disks in between.
+    uint32_t disk_idx = max_disk;
+    uint32_t first_partial = max_disk;
+    for (uint32_t i=max_disk;i>min_disk;i--) {
+      int8_t intersects_annulus = IntersectsAnnulus(ang, disks[i-1]);
+      if (intersects_annulus == 0) break;
+      if (intersects_annulus == 1) {
+	disk_idx = i - 1;
+      } else {
+	first_partial = i - 1;
+      }
+    }
+
+    if (first_partial >= disk_idx) {
+      if (disk_idx < disks.size()) {
+	counts[disk_idx] += point_count_;
+	weights[disk_idx] += Weight();
+      }
+    } else {
+      for (TreePtrIterator iter=subpix_.begin();iter!=subpix_.end();++iter)
+	(*iter)->_NestedPairRecursion(ang, disks, first_partial, disk_idx,
+				      counts, weights);
+    }
+  }
+}
+
+uint32_t TreePixel::FindKNearestNeighbors(AngularCoordinate& ang,
+					  uint32_t n_neighbors,
+					  WAngularVector& neighbor_ang,
+					  double epsilon) {
   TreeNeighbor neighbors(ang, n_neighbors);
+  neighbors.SetEpsilon(epsilon);
 
   _NeighborRecursion(ang, neighbors);
 
@@ -744,11 +886,11 @@ uint16_t TreePixel::FindKNearestNeighbors(AngularCoordinate& ang,
   return neighbors.NodesVisited();
 }
 
-uint16_t TreePixel::FindNearestNeighbor(AngularCoordinate& ang,
+uint32_t TreePixel::FindNearestNeighbor(AngularCoordinate& ang,
 					WeightedAngularCoordinate& nbr_ang) {
   WAngularVector angVec;
 
-  uint16_t nodes_visited = FindKNearestNeighbors(ang, 1, angVec);
+  uint32_t nodes_visited = FindKNearestNeighbors(ang, 1, angVec);
 
   nbr_ang = angVec[0];
 
@@ -756,10 +898,12 @@ uint16_t TreePixel::FindNearestNeighbor(AngularCoordinate& ang,
 }
 
 double TreePixel::KNearestNeighborDistance(AngularCoordinate& ang,
-					   uint8_t n_neighbors,
-					   uint16_t& nodes_visited) {
+					   uint32_t n_neighbors,
+					   uint32_t& nodes_visited,
+					   double epsilon) {
 
   TreeNeighbor neighbors(ang, n_neighbors);
+  neighbors.SetEpsilon(epsilon);
 
   _NeighborRecursion(ang, neighbors);
 
@@ -768,11 +912,33 @@ double TreePixel::KNearestNeighborDistance(AngularCoordinate& ang,
   return neighbors.MaxAngularDistance();
 }
 
+double TreePixel::KNearestNeighborDistance(AngularCoordinate& ang,
+					   uint32_t n_neighbors,
+					   uint16_t& nodes_visited,
+					   double epsilon) {
+  uint32_t n_visited = 0;
+  double max_distance =
+    KNearestNeighborDistance(ang, n_neighbors, n_visited, epsilon);
+  nodes_visited = (n_visited > 65535 ? 65535 :
+		   static_cast<uint16_t>(n_visited));
+  return max_distance;
+}
+
+double TreePixel::NearestNeighborDistance(AngularCoordinate& ang,
+					  uint32_t& nodes_visited) {
+  return KNearestNeighborDistance(ang, 1, nodes_visited);
+}
+
 double TreePixel::NearestNeighborDistance(AngularCoordinate& ang,
 					  uint16_t& nodes_visited) {
   return KNearestNeighborDistance(ang, 1, nodes_visited);
 }
 
+void TreePixel::FindNeighbors(AngularCoordinate& ang,
+			      TreeNeighbor& neighbors) {
+  _NeighborRecursion(ang, neighbors);
+}
+
 bool TreePixel::ClosestMatch(AngularCoordinate& ang, double max_distance,
 			     WeightedAngularCoordinate& match_ang) {
   TreeNeighbor neighbors(ang, 1, max_distance);
@@ -797,11 +963,18 @@ void TreePixel::_NeighborRecursion(AngularCoordinate& ang,
 
   neighbors.AddNode();
 
-  if (!ang_.empty()) {
+  if (HasPoints()) {
     // We have no sub-nodes in this tree, so we'll just iterate over the
     // points here and take the nearest N neighbors.
     for (WAngularPtrIterator iter=ang_.begin();iter!=ang_.end();++iter)
       neighbors.TestPoint(*iter);
+    if (leaf_ != NULL) {
+      WeightedAngularCoordinate tmp_ang;
+      for (uint32_t i=0;i<leaf_->NPoints();++i) {
+	leaf_->Point(i, tmp_ang);
+	neighbors.TestPoint(tmp_ang);
+      }
+    }
   } else {
     // This node is the root node for our tree, so we first find the sub-node
     // that contains the point and start recursing there.
@@ -815,9 +988,10 @@ void TreePixel::_NeighborRecursion(AngularCoordinate& ang,
       if ((*iter)->Contains(ang)) {
 	(*iter)->_NeighborRecursion(ang, neighbors);
       } else {
-	double min_edge_distance, max_edge_distance;
-	(*iter)->EdgeDistances(ang, min_edge_distance, max_edge_distance);
-	DistancePixelPair dist_pair(min_edge_distance, (*iter));
+	// NearEdgeDistance falls back to the corner distance when the point is
+	// outside both the lambda and eta ranges of the sub-node, which
+	// EdgeDistances leaves undefined.
+	DistancePixelPair dist_pair((*iter)->NearEdgeDistance(ang), (*iter));
 	pix_queue.push(dist_pair);
       }
     }
@@ -835,7 +1009,7 @@ void TreePixel::_NeighborRecursion(AngularCoordinate& ang,
     while (!pix_queue.empty()) {
       double pix_distance = pix_queue.top().first;
       TreePixel* pix_iter = pix_queue.top().second;
-      if (pix_distance < neighbors.MaxDistance()) {
+      if (pix_distance < neighbors.PruneDistance()) {
 	pix_iter->_NeighborRecursion(ang, neighbors);
       }
       pix_queue.pop();
@@ -876,12 +1050,34 @@ void TreePixel::InitializeCorners() {
 }
 
 bool TreePixel::AddPoint(WeightedAngularCoordinate* ang) {
+  bool added_to_pixel = _AddPoint(ang, false);
+
+  // Once a point is in a single precision leaf, we no longer need the object.
+  if (added_to_pixel && single_precision_) delete ang;
+
+  return added_to_pixel;
+}
+
+bool TreePixel::_AddPoint(WeightedAngularCoordinate* ang, bool force) {
+  if (single_precision_ && ang->HasFields()) {
+    std::cout << "Stomp::TreePixel::AddPoint - " <<
+      "Single precision nodes can't store Fields.\n";
+    return false;
+  }
+
   bool added_to_pixel = false;
-  if (Contains(*ang)) {
+  if (force || Contains(*ang)) {
     if ((point_count_ < maximum_points_) ||
 	(Resolution() == Stomp::MaxPixelResolution)) {
-      if (point_count_ == 0) ang_.reserve(maximum_points_);
-      ang_.push_back(ang);
+      if (single_precision_) {
+	if (leaf_ == NULL)
+	  leaf_ = new CompactLeaf(unit_sphere_x_, unit_sphere_y_,
+				  unit_sphere_z_, maximum_points_);
+	leaf_->AddPoint(*ang);
+      } else {
+	if (point_count_ == 0) ang_.reserve(maximum_points_);
+	ang_.push_back(ang);
+      }
       added_to_pixel = true;
     } else {
       if (!initialized_subpixels_) {
@@ -893,10 +1089,15 @@ bool TreePixel::AddPoint(WeightedAngularCoordinate* ang) {
       }
       for (uint32_t i=0;i<subpix_.size();++i) {
 	if (subpix_[i]->Contains(*ang)) {
-	  added_to_pixel = subpix_[i]->AddPoint(ang);
+	  added_to_pixel = subpix_[i]->_AddPoint(ang, false);
 	  i = subpix_.size();
 	}
       }
+      if (!added_to_pixel && force) {
+	// A forced point didn't land in any of the sub-pixels, so we send it
+	// to the one with the nearest center.
+	added_to_pixel = subpix_[_NearestSubPixel(*ang)]->_AddPoint(ang, true);
+      }
     }
   } else {
     added_to_pixel = false;
@@ -919,6 +1120,21 @@ bool TreePixel::AddPoint(WeightedAngularCoordinate* ang) {
   return added_to_pixel;
 }
 
+uint32_t TreePixel::_NearestSubPixel(AngularCoordinate& ang) {
+  uint32_t nearest_idx = 0;
+  double max_costheta = -2.0;
+  for (uint32_t i=0;i<subpix_.size();++i) {
+    double costheta = ang.UnitSphereX()*subpix_[i]->UnitSphereX() +
+      ang.UnitSphereY()*subpix_[i]->UnitSphereY() +
+      ang.UnitSphereZ()*subpix_[i]->UnitSphereZ();
+    if (costheta > max_costheta) {
+      max_costheta = costheta;
+      nearest_idx = i;
+    }
+  }
+  return nearest_idx;
+}
+
 bool TreePixel::AddPoint(WeightedAngularCoordinate& w_ang) {
   WeightedAngularCoordinate* ang_copy =
     new WeightedAngularCoordinate(w_ang.UnitSphereX(), w_ang.UnitSphereY(),
@@ -960,6 +1176,13 @@ uint32_t TreePixel::NPoints(Pixel& pix) {
 	for (WAngularPtrIterator iter=ang_.begin();iter!=ang_.end();++iter) {
 	  if (pix.Contains(*(*iter))) total_points++;
 	}
+	if (leaf_ != NULL) {
+	  WeightedAngularCoordinate tmp_ang;
+	  for (uint32_t i=0;i<leaf_->NPoints();i++) {
+	    leaf_->Point(i, tmp_ang);
+	    if (pix.Contains(tmp_ang)) total_points++;
+	  }
+	}
       }
     }
   }
@@ -989,6 +1212,13 @@ double TreePixel::PixelWeight(Pixel& pix) {
 	for (WAngularPtrIterator iter=ang_.begin();iter!=ang_.end();++iter) {
 	  if (pix.Contains(*(*iter))) total_weight += (*iter)->Weight();
 	}
+	if (leaf_ != NULL) {
+	  WeightedAngularCoordinate tmp_ang;
+	  for (uint32_t i=0;i<leaf_->NPoints();i++) {
+	    leaf_->Point(i, tmp_ang);
+	    if (pix.Contains(tmp_ang)) total_weight += tmp_ang.Weight();
+	  }
+	}
       }
     }
   }
@@ -1061,6 +1291,13 @@ void TreePixel::Points(WAngularVector& w_ang) {
 
       w_ang.push_back(tmp_ang);
     }
+    if (leaf_ != NULL) {
+      for (uint32_t i=0;i<leaf_->NPoints();i++) {
+	WeightedAngularCoordinate tmp_ang;
+	leaf_->Point(i, tmp_ang);
+	w_ang.push_back(tmp_ang);
+      }
+    }
   } else {
     // If not, then we need to iterate through our sub-nodes and return an
     // aggregate list.
@@ -1099,6 +1336,13 @@ void TreePixel::Points(WAngularVector& w_ang, Pixel& pix) {
 	  w_ang.push_back(tmp_ang);
 	}
       }
+      if (leaf_ != NULL) {
+	for (uint32_t i=0;i<leaf_->NPoints();i++) {
+	  WeightedAngularCoordinate tmp_ang;
+	  leaf_->Point(i, tmp_ang);
+	  if (pix.Contains(tmp_ang)) w_ang.push_back(tmp_ang);
+	}
+      }
     } else {
       // If not, then we need to iterate through our sub-nodes and return an
       // aggregate list.
@@ -1197,6 +1441,28 @@ uint16_t TreePixel::PixelCapacity() {
   return maximum_points_;
 }
 
+bool TreePixel::SetSinglePrecision(bool single_precision,
+				   double precision_threshold) {
+  if (point_count_ > 0) {
+    std::cout << "Stomp::TreePixel::SetSinglePrecision - " <<
+      "Can't change the storage mode of a pixel containing points.\n";
+    return false;
+  }
+
+  single_precision_ = single_precision;
+  precision_threshold_ = precision_threshold;
+
+  return true;
+}
+
+bool TreePixel::SinglePrecision() {
+  return single_precision_;
+}
+
+double TreePixel::PrecisionThreshold() {
+  return precision_threshold_;
+}
+
 WAngularPtrIterator TreePixel::PointsBegin() {
   return ang_.begin();
 }
@@ -1214,7 +1480,8 @@ TreePtrIterator TreePixel::NodesEnd() {
 }
 
 bool TreePixel::HasPoints() {
-  return (ang_.empty() ? false : true);
+  return ((!ang_.empty() || ((leaf_ != NULL) && (leaf_->NPoints() > 0))) ?
+	  true : false);
 }
 
 bool TreePixel::HasNodes() {
@@ -1226,6 +1493,10 @@ void TreePixel::Clear() {
     for (WAngularPtrIterator iter=ang_.begin();iter!=ang_.end();++iter)
       delete *iter;
   ang_.clear();
+  if (leaf_ != NULL) {
+    delete leaf_;
+    leaf_ = NULL;
+  }
   if (!subpix_.empty())
     for (uint32_t i=0;i<subpix_.size();i++) {
       subpix_[i]->Clear();
@@ -1348,86 +1619,117 @@ void TreePixel::WithinAnnulus(AngularBin& theta, PixelVector& pix,
 }
 
 TreeNeighbor::TreeNeighbor(AngularCoordinate& reference_ang,
-			   uint8_t n_neighbor) {
+			   uint32_t n_neighbor) {
   reference_ang_ = reference_ang;
   n_neighbors_ = n_neighbor;
   max_distance_ = 100.0;
+  prune_distance_ = 100.0;
+  epsilon_ = 0.0;
   n_nodes_visited_ = 0;
+  n_points_tested_ = 0;
+  ang_list_.reserve(n_neighbors_ + 1);
 }
 
 TreeNeighbor::TreeNeighbor(AngularCoordinate& reference_ang,
-			   uint8_t n_neighbor, double max_distance) {
+			   uint32_t n_neighbor, double max_distance) {
   reference_ang_ = reference_ang;
   n_neighbors_ = n_neighbor;
   max_distance_ = sin(DegToRad*max_distance)*sin(DegToRad*max_distance);
+  prune_distance_ = max_distance_;
+  epsilon_ = 0.0;
   n_nodes_visited_ = 0;
+  n_points_tested_ = 0;
+  ang_list_.reserve(n_neighbors_ + 1);
 }
 
 TreeNeighbor::~TreeNeighbor() {
+  ang_list_.clear();
+  ang_copies_.clear();
   n_neighbors_ = 0;
   max_distance_ = 100.0;
   n_nodes_visited_ = 0;
+  n_points_tested_ = 0;
 }
 
 void TreeNeighbor::NearestNeighbors(WAngularVector& w_ang,
 				    bool save_neighbors) {
   if (!w_ang.empty()) w_ang.clear();
+  w_ang.reserve(ang_list_.size());
 
-  std::vector<DistancePointPair> backup_copy;
-
-  while (!ang_queue_.empty()) {
-    DistancePointPair dist_pair = ang_queue_.top();
-    ang_queue_.pop();
-
-    WeightedAngularCoordinate tmp_ang(dist_pair.second->UnitSphereX(),
-				      dist_pair.second->UnitSphereY(),
-				      dist_pair.second->UnitSphereZ(),
-				      dist_pair.second->Weight());
-    tmp_ang.CopyFields(dist_pair.second);
+  for (DistancePointVector::reverse_iterator iter=ang_list_.rbegin();
+       iter!=ang_list_.rend();++iter) {
+    WeightedAngularCoordinate tmp_ang(iter->second->UnitSphereX(),
+				      iter->second->UnitSphereY(),
+				      iter->second->UnitSphereZ(),
+				      iter->second->Weight());
+    tmp_ang.CopyFields(iter->second);
 
     w_ang.push_back(tmp_ang);
-    backup_copy.push_back(dist_pair);
   }
 
-  if (save_neighbors) {
-    for (uint8_t i=0;i<backup_copy.size();i++) {
-      ang_queue_.push(backup_copy[i]);
-    }
-  }
+  if (!save_neighbors) ang_list_.clear();
 }
 
-uint8_t TreeNeighbor::Neighbors() {
-  return ang_queue_.size();
+uint32_t TreeNeighbor::Neighbors() {
+  return ang_list_.size();
 }
 
-uint8_t TreeNeighbor::MaxNeighbors() {
+uint32_t TreeNeighbor::MaxNeighbors() {
   return n_neighbors_;
 }
 
 bool TreeNeighbor::TestPoint(WeightedAngularCoordinate* test_ang) {
-  bool kept_point = false;
+  n_points_tested_++;
 
-  double costheta = reference_ang_.DotProduct(test_ang);
+  double sin2theta = _Sin2Distance(*test_ang);
 
-  double sin2theta = 1.0 - costheta*costheta;
+  // Once the list is full, anything farther away than the current kth
+  // neighbor can be thrown out immediately.  Until then, max_distance_ is
+  // the limit set on instantiation, so points outside that radius are never
+  // kept and can't widen the search.
+  if (sin2theta >= max_distance_) return false;
 
-  if (sin2theta < max_distance_ || Neighbors() < MaxNeighbors()) {
-    // If the new point is closer than the most distant point in our queue or
-    // we're still filling our heap, then we keep it.
-    kept_point = true;
+  _InsertPoint(sin2theta, test_ang);
 
-    // Throw away the current most distant point if we're at capacity.
-    if (Neighbors() == MaxNeighbors()) ang_queue_.pop();
+  return true;
+}
 
-    // Create a new pair for the test point and add it to the queue.
-    DistancePointPair dist_pair(sin2theta, test_ang);
-    ang_queue_.push(dist_pair);
+bool TreeNeighbor::TestPoint(WeightedAngularCoordinate& test_ang) {
+  n_points_tested_++;
 
-    // And reset our maximum distance using the new top of the heap.
-    max_distance_ = ang_queue_.top().first;
-  }
+  double sin2theta = _Sin2Distance(test_ang);
 
-  return kept_point;
+  if (sin2theta >= max_distance_) return false;
+
+  // The deque doesn't move its elements as it grows, so the pointers in our
+  // list remain valid.
+  ang_copies_.push_back(test_ang);
+  _InsertPoint(sin2theta, &ang_copies_.back());
+
+  return true;
+}
+
+double TreeNeighbor::_Sin2Distance(WeightedAngularCoordinate& test_ang) {
+  double costheta = reference_ang_.DotProduct(test_ang);
+
+  return 1.0 - costheta*costheta;
+}
+
+void TreeNeighbor::_InsertPoint(double sin2theta,
+				WeightedAngularCoordinate* test_ang) {
+  // We insert the point into its place in the sorted list and drop the most
+  // distant point if we're over capacity.
+  DistancePointPair dist_pair(sin2theta, test_ang);
+  ang_list_.insert(std::upper_bound(ang_list_.begin(), ang_list_.end(),
+				    dist_pair, NearestNeighborPoint()),
+		   dist_pair);
+  if (ang_list_.size() > n_neighbors_) ang_list_.pop_back();
+
+  // And reset our maximum distance using the new end of the list.
+  if (Neighbors() >= MaxNeighbors()) {
+    max_distance_ = ang_list_.back().first;
+    _SetPruneDistance();
+  }
 }
 
 double TreeNeighbor::MaxDistance() {
@@ -1439,7 +1741,24 @@ double TreeNeighbor::MaxAngularDistance() {
   return RadToDeg*asin(sqrt(fabs(max_distance_)));
 }
 
-uint16_t TreeNeighbor::NodesVisited() {
+void TreeNeighbor::SetEpsilon(double epsilon) {
+  epsilon_ = (epsilon > 0.0 ? epsilon : 0.0);
+  _SetPruneDistance();
+}
+
+double TreeNeighbor::Epsilon() {
+  return epsilon_;
+}
+
+double TreeNeighbor::PruneDistance() {
+  return prune_distance_;
+}
+
+double TreeNeighbor::PruneAngularDistance() {
+  return RadToDeg*asin(sqrt(fabs(prune_distance_)));
+}
+
+uint32_t TreeNeighbor::NodesVisited() {
   return n_nodes_visited_;
 }
 
@@ -1447,4 +1766,20 @@ void TreeNeighbor::AddNode() {
   n_nodes_visited_++;
 }
 
+uint32_t TreeNeighbor::PointsTested() {
+  return n_points_tested_;
+}
+
+void TreeNeighbor::_SetPruneDistance() {
+  // We only loosen the search once we have a full list of neighbors;
+  // otherwise, we might skip nodes we need to fill the list.
+  if ((epsilon_ > 0.0) && (Neighbors() >= MaxNeighbors())) {
+    double sintheta =
+      sin(asin(sqrt(fabs(max_distance_)))/(1.0 + epsilon_));
+    prune_distance_ = sintheta*sintheta;
+  } else {
+    prune_distance_ = max_distance_;
+  }
+}
+
 } // end namespace Stomp
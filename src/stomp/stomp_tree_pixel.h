@@ -22,6 +22,8 @@
 #include <string>
 #include <map>
 #include <queue>
+#include <deque>
+#include <algorithm>
 #include "stomp_angular_coordinate.h"
 #include "stomp_pixel.h"
 
@@ -30,6 +32,7 @@ namespace Stomp {
 class AngularBin;           // class definition in stomp_angular_bin.h
 class AngularCorrelation;   // class definition in stomp_angular_correlation.h
 class RadialBin;
+class CompactLeaf;          // class definition in stomp_compact_leaf.h
 class TreePixel;
 class TreeNeighbor;
 class NearestNeighborPixel;
@@ -48,6 +51,8 @@ typedef std::priority_queue<DistancePixelPair,
 typedef std::pair<double, WeightedAngularCoordinate*> DistancePointPair;
 typedef std::priority_queue<DistancePointPair,
   std::vector<DistancePointPair>, NearestNeighborPoint> PointQueue;
+typedef std::vector<DistancePointPair> DistancePointVector;
+typedef DistancePointVector::iterator DistancePointIterator;
 
 class TreePixel : public Pixel {
   // Our second variation on the Pixel.  Like ScalarPixel, the idea
@@ -192,6 +197,17 @@ class TreePixel : public Pixel {
 			 AngularCorrelation& wtheta,
 			 const std::string& field_name, int16_t region = -1);
 
+  // For a set of nested disks (AngularBins running from zero out to each
+  // radius, in ascending order), every point within the largest disk is
+  // added to the counts and weights for the smallest disk that contains it.
+  // Nodes that fall entirely between two consecutive radii are added in one
+  // go, so a single pass through the tree handles all of the radii.  The
+  // counts and weights need one element per disk and hold differential
+  // values; the running sums give the pairs within each radius.
+  void FindNestedPairs(AngularCoordinate& ang, std::vector<AngularBin>& disks,
+		       std::vector<uint32_t>& counts,
+		       std::vector<double>& weights);
+
   // In addition to pair finding, we can also use the tree structure we've
   // built to do efficient nearest neighbor searches.  In the general case,
   // we'll be finding the k nearest neighbors of an input point.  The return
@@ -200,19 +216,39 @@ class TreePixel : public Pixel {
   // NOTE: There is no duplication checking.  Hence, if the input point is a
   // copy of a point in the tree, then that point will be included in the
   // returned vector of points.
-  uint16_t FindKNearestNeighbors(AngularCoordinate& ang, uint8_t n_neighbors,
-				 WAngularVector& neighbors_ang);
+  //
+  // If epsilon is greater than zero, the search is approximate: nodes are
+  // skipped unless they could contain a point closer than 1/(1+epsilon) times
+  // the current kth neighbor distance.  The returned neighbors are then
+  // guaranteed to be within a factor of (1+epsilon) of the true kth
+  // neighbor distance, usually at a fraction of the cost for large k.
+  uint32_t FindKNearestNeighbors(AngularCoordinate& ang, uint32_t n_neighbors,
+				 WAngularVector& neighbors_ang,
+				 double epsilon = 0.0);
 
   // The special case where we're only interested in the nearest matching point.
-  uint16_t FindNearestNeighbor(AngularCoordinate& ang,
+  uint32_t FindNearestNeighbor(AngularCoordinate& ang,
 			       WeightedAngularCoordinate& neighbor_ang);
 
   // In some cases, we're only interested in the distance to the kth nearest
   // neighbor.  The return value will be the angular distance in degrees.
-  double KNearestNeighborDistance(AngularCoordinate& ang, uint8_t n_neighbors,
-				  uint16_t& nodes_visited);
+  // Large-k searches can visit more than 2^16 nodes, so the uint16_t form
+  // saturates at 65535; use the uint32_t form for the full count.
+  double KNearestNeighborDistance(AngularCoordinate& ang, uint32_t n_neighbors,
+				  uint32_t& nodes_visited,
+				  double epsilon = 0.0);
+  double KNearestNeighborDistance(AngularCoordinate& ang, uint32_t n_neighbors,
+				  uint16_t& nodes_visited,
+				  double epsilon = 0.0);
+
+  // For full control over the search (and access to the search statistics
+  // in the TreeNeighbor object), a TreeNeighbor can be set up by hand and
+  // filled by this method.
+  void FindNeighbors(AngularCoordinate& ang, TreeNeighbor& neighbors);
 
   // Or in the distance to the nearest neighbor.
+  double NearestNeighborDistance(AngularCoordinate& ang,
+				 uint32_t& nodes_visited);
   double NearestNeighborDistance(AngularCoordinate& ang,
 				 uint16_t& nodes_visited);
 
@@ -231,6 +267,15 @@ class TreePixel : public Pixel {
   // internal method.
   void _NeighborRecursion(AngularCoordinate& ang, TreeNeighbor& neighbor);
 
+  // The recursion behind FindNestedPairs.  The node is known to be outside
+  // the disks before min_disk and inside the disk at max_disk (if there is
+  // one), so only the disks in between need to be checked.
+  void _NestedPairRecursion(AngularCoordinate& ang,
+			    std::vector<AngularBin>& disks,
+			    uint32_t min_disk, uint32_t max_disk,
+			    std::vector<uint32_t>& counts,
+			    std::vector<double>& weights);
+
   // And a method to set these values up internally.
   void InitializeCorners();
 
@@ -312,6 +357,24 @@ class TreePixel : public Pixel {
   void SetPixelCapacity(uint16_t maximum_points);
   uint16_t PixelCapacity();
 
+  // By default, the points in the leaf nodes are stored as pointers to
+  // WeightedAngularCoordinate objects.  For large data sets, the memory used
+  // by those objects can be prohibitive, so the leaf nodes can instead keep
+  // their points in a CompactLeaf, which stores the positions and weights in
+  // single precision (see stomp_compact_leaf.h).  The node geometry and the
+  // pair-counting sums remain in double precision and any AngularBin with a
+  // non-zero edge smaller than the precision threshold (in degrees) is
+  // handled with double precision arithmetic on the stored positions.  Field
+  // values are not kept for single precision leaves, so points with Fields
+  // can't be added in this mode.  Likewise, PointsBegin and PointsEnd will
+  // not return any points for single precision leaves; use Points instead.
+  // The storage mode can only be changed for an empty pixel; the return
+  // value indicates success.
+  bool SetSinglePrecision(bool single_precision = true,
+			  double precision_threshold = SinglePrecisionThreshold);
+  bool SinglePrecision();
+  double PrecisionThreshold();
+
   // Occasionally, it can be useful for outside code to be able to traverse
   // the tree structure contained in the pixel and sub-nodes.  These hooks allow
   // for access to the pointers to the sub-nodes and any point data directly.
@@ -358,11 +421,19 @@ class TreePixel : public Pixel {
 			     bool check_full_pixel);
 
  private:
+  // The internal version of AddPoint.  If force is true, the bounds check is
+  // skipped; this is used to place single precision points that have drifted
+  // across a sub-pixel boundary due to rounding.
+  bool _AddPoint(WeightedAngularCoordinate* ang, bool force);
+  uint32_t _NearestSubPixel(AngularCoordinate& ang);
+
   WAngularPtrVector ang_;
+  CompactLeaf* leaf_;
   FieldDict field_total_;
   uint16_t maximum_points_;
   uint32_t point_count_;
-  bool initialized_subpixels_;
+  bool initialized_subpixels_, single_precision_;
+  double precision_threshold_;
   double unit_sphere_x_, unit_sphere_y_, unit_sphere_z_;
   double unit_sphere_x_ul_, unit_sphere_y_ul_, unit_sphere_z_ul_;
   double unit_sphere_x_ll_, unit_sphere_y_ll_, unit_sphere_z_ll_;
@@ -392,26 +463,29 @@ class NearestNeighborPoint {
 class TreeNeighbor {
   // In order to do the nearest neighbor finding in the TreePixel class, we
   // need a secondary class to handle storage of the nearest neighbor list.
-  // The natural data structure for that list is a priority queue, which we're
-  // using, but the fact that our list of points is sorted based on their
-  // distance to a reference point means that we need a little extra plumbing
-  // in order to pull that off.  Hence, the TreeNeighbor class.
+  // Since k can be quite large (thousands of neighbors for density
+  // estimators), the list is kept as a vector sorted by distance to the
+  // reference point, with room for exactly k points.  New points are placed
+  // with a binary search and points that are farther away than the current
+  // kth neighbor are rejected with a single comparison once the list is
+  // full.  Hence, the TreeNeighbor class.
  public:
   friend class NearestNeighborPoint;
   TreeNeighbor(AngularCoordinate& reference_ang,
-	       uint8_t n_neighbors = 1);
+	       uint32_t n_neighbors = 1);
   TreeNeighbor(AngularCoordinate& reference_ang,
-	       uint8_t n_neighbors, double max_distance);
+	       uint32_t n_neighbors, double max_distance);
   ~TreeNeighbor();
 
-  // Return a list of the nearest neighbors found so far.
+  // Return a list of the nearest neighbors found so far.  As with the
+  // original heap-based version, the most distant neighbor comes first.
   void NearestNeighbors(WAngularVector& w_ang, bool save_neighbors = true);
 
   // Return the number of neighbors in the list.  This should always be at most
   // the value used to instantiate the class, which is returned by calling
   // MaxNeighbors()
-  uint8_t Neighbors();
-  uint8_t MaxNeighbors();
+  uint32_t Neighbors();
+  uint32_t MaxNeighbors();
 
   // Submit a point for possible inclusion.  Return value indicates whether the
   // point was successfully included in the list (i.e., the distance between
@@ -419,7 +493,12 @@ class TreeNeighbor {
   // distant point in the list) or not.
   bool TestPoint(WeightedAngularCoordinate* test_ang);
 
-  // Return the maximum distance of the current list.
+  // Points from single precision tree nodes don't exist as objects in the
+  // tree, so this version keeps its own copy of the point if it is accepted.
+  bool TestPoint(WeightedAngularCoordinate& test_ang);
+
+  // Return the maximum distance of the current list.  Until the list is full,
+  // this is the maximum distance used to instantiate the object (if any).
   double MaxDistance();
 
   // The default distance returned is in sin^2(theta) units since that's what
@@ -427,17 +506,33 @@ class TreeNeighbor {
   // provides that distance in degrees.
   double MaxAngularDistance();
 
+  // For approximate searches, we can set a tolerance, epsilon.  Once the
+  // list is full, nodes are only searched if their edges are closer than
+  // the pruning distance, which is the current kth neighbor angular distance
+  // divided by (1+epsilon).  With epsilon = 0 (the default), the pruning
+  // distance is identical to MaxDistance and the search is exact.
+  void SetEpsilon(double epsilon);
+  double Epsilon();
+  double PruneDistance();
+  double PruneAngularDistance();
+
   // For accounting purposes, it can be useful to keep track of how many nodes
-  // we have visited during our traversal through the tree.
-  uint16_t NodesVisited();
+  // we have visited during our traversal through the tree and how many
+  // individual points were compared to the reference point.
+  uint32_t NodesVisited();
   void AddNode();
+  uint32_t PointsTested();
 
  private:
+  void _SetPruneDistance();
+  double _Sin2Distance(WeightedAngularCoordinate& test_ang);
+  void _InsertPoint(double sin2theta, WeightedAngularCoordinate* test_ang);
+
   AngularCoordinate reference_ang_;
-  PointQueue ang_queue_;
-  uint8_t n_neighbors_;
-  uint16_t n_nodes_visited_;
-  double max_distance_;
+  DistancePointVector ang_list_;
+  std::deque<WeightedAngularCoordinate> ang_copies_;
+  uint32_t n_neighbors_, n_nodes_visited_, n_points_tested_;
+  double max_distance_, prune_distance_, epsilon_;
 };
 
 } // end namespace Stomp
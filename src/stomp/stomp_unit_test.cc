@@ -18,6 +18,8 @@ int main(int argc, char **argv) {
   void MapUnitTests(bool run_all_tests);
   void ScalarMapUnitTests(bool run_all_tests);
   void TreeMapUnitTests(bool run_all_tests);
+  void CountsInCellsUnitTests(bool run_all_tests);
+  void KDTreeMapUnitTests(bool run_all_tests);
   void IndexedTreeMapUnitTests(bool run_all_tests);
   void GeometryUnitTests(bool run_all_tests);
   void UtilUnitTests(bool run_all_tests);
@@ -60,6 +62,12 @@ int main(int argc, char **argv) {
   // The TreeMap class
   TreeMapUnitTests(FLAGS_all_tests);
 
+  // The CountsInCells class
+  CountsInCellsUnitTests(FLAGS_all_tests);
+
+  // The KDTreeMap class
+  KDTreeMapUnitTests(FLAGS_all_tests);
+
   // The IndexedTreeMap class
   IndexedTreeMapUnitTests(FLAGS_all_tests);
 
@@ -387,6 +387,67 @@ double Histogram::MeanWeightedBinValue() {
   return weighted_bin_value/total_weight;
 }
 
+// The format version for the BinaryWriter and BinaryReader.  This should be
+// incremented whenever the layout of any of the Serialize methods changes.
+static const uint32_t BinaryFormatVersion = 1;
+
+BinaryWriter::BinaryWriter(std::string& buffer, const std::string& tag) :
+  buffer_(buffer) {
+  buffer_.clear();
+  WriteString(tag);
+  Write(BinaryFormatVersion);
+}
+
+BinaryWriter::~BinaryWriter() {
+}
+
+void BinaryWriter::WriteString(const std::string& value) {
+  Write(static_cast<uint32_t>(value.size()));
+  buffer_.append(value);
+}
+
+void BinaryWriter::Reserve(uint32_t n_bytes) {
+  buffer_.reserve(buffer_.size() + n_bytes);
+}
+
+BinaryReader::BinaryReader(const std::string& buffer,
+			   const std::string& tag) : buffer_(buffer) {
+  position_ = 0;
+  status_ = true;
+
+  std::string buffer_tag;
+  uint32_t version = 0;
+  if (!ReadString(buffer_tag) || !Read(version) ||
+      (buffer_tag != tag) || (version != BinaryFormatVersion))
+    status_ = false;
+}
+
+BinaryReader::~BinaryReader() {
+}
+
+bool BinaryReader::ReadString(std::string& value) {
+  uint32_t n_char = 0;
+  if (!Read(n_char) || (position_ + n_char > buffer_.size())) {
+    status_ = false;
+    return false;
+  }
+  value.assign(buffer_, position_, n_char);
+  position_ += n_char;
+  return true;
+}
+
+size_t BinaryReader::Remaining() {
+  return (position_ < buffer_.size() ? buffer_.size() - position_ : 0);
+}
+
+bool BinaryReader::Status() {
+  return status_;
+}
+
+bool BinaryReader::Finished() {
+  return (status_ && (position_ == buffer_.size()));
+}
+
 void Tokenize(const std::string& str, std::vector<std::string>& tokens,
 	 const std::string& delimiters) {
   // Skip delimiters at beginning.
@@ -14,8 +14,11 @@
 #ifndef STOMP_UTIL_H
 #define STOMP_UTIL_H
 
+#include <stdint.h>
+#include <string.h>
 #include <sys/time.h>
 #include <string>
+#include <vector>
 
 namespace Stomp {
 
@@ -23,6 +26,8 @@ class Cosmology;
 class StompWatch;
 class HistogramBin;
 class Histogram;
+class BinaryWriter;
+class BinaryReader;
 
 typedef std::vector<HistogramBin> BinVector;
 typedef BinVector::iterator BinIterator;
@@ -187,6 +192,94 @@ private:
   BinVector bins_;
 };
 
+class BinaryWriter {
+  // Simple class for packing the contents of an object into a binary string,
+  // used by the Serialize methods in the map classes.  Values are copied in
+  // the machine's native byte order, so the result is intended for passing
+  // objects between processes (Python's pickle module, for instance) rather
+  // than long-term storage.  The Write and Read methods of the map classes
+  // give a portable ASCII format for that.
+  //
+  // Each string starts with a tag identifying the class that wrote it and a
+  // format version, which the BinaryReader checks before anything else.
+
+ public:
+  BinaryWriter(std::string& buffer, const std::string& tag);
+  ~BinaryWriter();
+
+  // Append a single value or a block of values of any plain data type.
+  template<class T> void Write(const T& value) {
+    buffer_.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+  template<class T> void WriteArray(const T* values, uint32_t n_values) {
+    Write(n_values);
+    if (n_values > 0)
+      buffer_.append(reinterpret_cast<const char*>(values),
+		     n_values*sizeof(T));
+  }
+  template<class T> void WriteVector(const std::vector<T>& values) {
+    WriteArray(values.empty() ? NULL : &values[0],
+	       static_cast<uint32_t>(values.size()));
+  }
+  void WriteString(const std::string& value);
+
+  // Reserve space ahead of a large set of writes.
+  void Reserve(uint32_t n_bytes);
+
+ private:
+  std::string& buffer_;
+};
+
+class BinaryReader {
+  // The counterpart to the BinaryWriter.  All of the Read methods return false
+  // once the reader runs past the end of the buffer, so the calling code can
+  // do all of its reads and then check the result once.
+
+ public:
+  // Status will be false if the buffer doesn't start with the input tag and
+  // the current format version.
+  BinaryReader(const std::string& buffer, const std::string& tag);
+  ~BinaryReader();
+
+  template<class T> bool Read(T& value) {
+    if (!status_ || (position_ + sizeof(T) > buffer_.size())) {
+      status_ = false;
+      return false;
+    }
+    memcpy(&value, buffer_.data() + position_, sizeof(T));
+    position_ += sizeof(T);
+    return true;
+  }
+  template<class T> bool ReadVector(std::vector<T>& values) {
+    uint32_t n_values = 0;
+    if (!Read(n_values) ||
+	(position_ + static_cast<size_t>(n_values)*sizeof(T) >
+	 buffer_.size())) {
+      status_ = false;
+      return false;
+    }
+    values.resize(n_values);
+    if (n_values > 0)
+      memcpy(&values[0], buffer_.data() + position_, n_values*sizeof(T));
+    position_ += n_values*sizeof(T);
+    return true;
+  }
+  bool ReadString(std::string& value);
+
+  // The number of bytes left in the buffer.  Counts read from the buffer
+  // should be checked against this before they are used to size anything.
+  size_t Remaining();
+
+  // True if every read so far has succeeded.  Finished is true if, in
+  // addition, the whole buffer has been read.
+  bool Status();
+  bool Finished();
+
+ private:
+  const std::string& buffer_;
+  size_t position_;
+  bool status_;
+};
 
 // A simple utility function for breaking up a string into its component items,
 // generally when the string is a list of filenames or such (separated by the
@@ -156,4 +156,5 @@ from .stomp import (
     WeightedAngularCoordinate_AddField,
     WeightedAngularCoordinate_FromWAngularVector,
     WeightedAngularCoordinate_ToWAngularVector,
-)
\ No newline at end of file
+)
+from .mask_client import MaskClient
@@ -0,0 +1,182 @@
+# Python client for the STOMP mask server
+# Copyright (c) 2010, Ryan Scranton
+#
+# All rights reserved.
+
+"""
+STOMP is a set of libraries for doing astrostatistical analysis on the
+celestial sphere.  The goal is to enable descriptions of arbitrary regions
+on the sky which may or may not encode futher spatial information (galaxy
+density, CMB temperature, observational depth, etc.) and to do so in such
+a way as to make the analysis of that data as algorithmically efficient as
+possible.
+
+This module contains the Python client for the stomp_mask_server executable
+(the MaskServer class in stomp_mask_server.h, which also documents the
+protocol).  The client only needs the standard library and numpy, so jobs
+that just need to check points against a survey mask don't have to load the
+Map themselves.
+"""
+
+__author__ = "Ryan Scranton (ryan.scranton@gmail.com)"
+__copyright__ = "Copyright 2010, Ryan Scranton"
+__license__ = "BSD"
+__version__ = "1.0"
+
+import socket
+import struct
+
+import numpy
+
+# These must match the values in stomp_mask_server.h.
+MASK_MAGIC = 0x51504d53
+MAX_BATCH_SIZE = 1 << 22
+
+QUERY_LIST = 0
+QUERY_CONTAINS = 1
+QUERY_WEIGHT = 2
+QUERY_REGION = 3
+
+STATUS_OK = 0
+STATUS_UNKNOWN_MAP = 1
+STATUS_BAD_REQUEST = 2
+
+# The AngularCoordinate.Sphere values.
+SURVEY = 0
+EQUATORIAL = 1
+GALACTIC = 2
+
+_REQUEST_HEADER = struct.Struct("=IIIHH")
+_REPLY_HEADER = struct.Struct("=III")
+_MAP_ENTRY = struct.Struct("=IId")
+
+
+class MaskClient(object):
+
+    """
+    Client for a running stomp_mask_server.  Each query takes arrays of
+    coordinates (in degrees, in the coordinate system given by sphere) and
+    returns a numpy array with one result per point:
+
+        contains(map_name, theta, phi) -> bool array
+        weight(map_name, theta, phi)   -> float64 array (0 outside the Map)
+        region(map_name, theta, phi)   -> int16 array (-1 outside the regions)
+
+    Large arrays are sent in batches of at most MAX_BATCH_SIZE points.  A
+    KeyError is raised for Map names the server doesn't know and an IOError
+    if the connection fails.
+    """
+
+    def __init__(self, socket_path=None):
+        self._socket = None
+        if socket_path is not None:
+            self.connect(socket_path)
+
+    def connect(self, socket_path):
+        """Connect to the server listening on socket_path."""
+        self.close()
+        self._socket = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            self._socket.connect(socket_path)
+        except socket.error:
+            self.close()
+            raise
+
+    def close(self):
+        """Close the connection to the server."""
+        if self._socket is not None:
+            self._socket.close()
+        self._socket = None
+
+    def connected(self):
+        return self._socket is not None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def list_maps(self):
+        """Return a dict of (area, n_region) tuples keyed by Map name."""
+        self._send(_REQUEST_HEADER.pack(MASK_MAGIC, QUERY_LIST, 0, SURVEY, 0))
+        n_map = self._receive_header("")
+        maps = {}
+        for i in range(n_map):
+            name_length, n_region, area = _MAP_ENTRY.unpack(
+                self._receive(_MAP_ENTRY.size))
+            name = self._receive(name_length).decode("utf-8")
+            maps[name] = (area, n_region)
+        return maps
+
+    def contains(self, map_name, theta, phi, sphere=SURVEY):
+        """Whether each point is inside the Map."""
+        return self._query(QUERY_CONTAINS, map_name, theta, phi, sphere,
+                           numpy.uint8).astype(bool)
+
+    def weight(self, map_name, theta, phi, sphere=SURVEY):
+        """The Map weight at each point (0 for points outside the Map)."""
+        return self._query(QUERY_WEIGHT, map_name, theta, phi, sphere,
+                           numpy.float64)
+
+    def region(self, map_name, theta, phi, sphere=SURVEY):
+        """The region index for each point (-1 outside the regions)."""
+        return self._query(QUERY_REGION, map_name, theta, phi, sphere,
+                           numpy.int16)
+
+    def _query(self, query, map_name, theta, phi, sphere, dtype):
+        theta = numpy.atleast_1d(numpy.asarray(theta, dtype=numpy.float64))
+        phi = numpy.atleast_1d(numpy.asarray(phi, dtype=numpy.float64))
+        if theta.shape != phi.shape:
+            raise ValueError("theta and phi must have the same shape")
+        name = map_name.encode("utf-8")
+
+        # The coordinates go over the wire as interleaved (theta, phi) pairs.
+        coordinates = numpy.empty((theta.size, 2), dtype=numpy.float64)
+        coordinates[:, 0] = theta.ravel()
+        coordinates[:, 1] = phi.ravel()
+
+        result = numpy.empty(theta.size, dtype=dtype)
+        for first in range(0, theta.size, MAX_BATCH_SIZE):
+            batch = coordinates[first:first + MAX_BATCH_SIZE]
+            self._send(_REQUEST_HEADER.pack(MASK_MAGIC, query, len(batch),
+                                            sphere, len(name)) +
+                       name + batch.tobytes())
+            n_item = self._receive_header(map_name)
+            if n_item != len(batch):
+                self.close()
+                raise IOError("unexpected reply from the mask server")
+            result[first:first + n_item] = numpy.frombuffer(
+                self._receive(n_item*result.itemsize), dtype=dtype)
+        return result.reshape(theta.shape)
+
+    def _receive_header(self, map_name):
+        magic, status, n_item = _REPLY_HEADER.unpack(
+            self._receive(_REPLY_HEADER.size))
+        if magic != MASK_MAGIC:
+            self.close()
+            raise IOError("unexpected reply from the mask server")
+        if status == STATUS_UNKNOWN_MAP:
+            raise KeyError(map_name)
+        if status != STATUS_OK:
+            self.close()
+            raise IOError("request refused by the mask server")
+        return n_item
+
+    def _send(self, data):
+        if self._socket is None:
+            raise IOError("not connected to a mask server")
+        self._socket.sendall(data)
+
+    def _receive(self, n_byte):
+        if self._socket is None:
+            raise IOError("not connected to a mask server")
+        chunks = []
+        while n_byte > 0:
+            chunk = self._socket.recv(min(n_byte, 1 << 20))
+            if not chunk:
+                self.close()
+                raise IOError("mask server closed the connection")
+            chunks.append(chunk)
+            n_byte -= len(chunk)
+        return b"".join(chunks)
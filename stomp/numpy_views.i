@@ -0,0 +1,643 @@
+/*
+ * numpy_views.i
+ *
+ * Bulk access to the contents of the STOMP vectors and maps from Python.
+ * Iterating over a PixelVector (or any of the other std::vector templates)
+ * from Python goes through a proxy object for every element, which is far
+ * too slow for the millions of pixels or points in a typical survey.
+ * Instead, each of the classes below gets a Buffer method, which returns
+ * the contents as a single block of memory through the Python buffer
+ * protocol, and an Array method, which wraps that block as a numpy array.
+ *
+ * DoubleVector and IndexVector are already stored as contiguous arrays of
+ * doubles and uint32_t, so their buffers are views onto the vector itself:
+ * no data are copied and changes made through the array show up in the
+ * vector.  The views are only valid until the vector is resized, so don't
+ * hold on to them across calls that change the vector.
+ *
+ * The pixel and coordinate classes carry a vtable and other state that
+ * numpy can't describe, so for those we make a single pass over the
+ * vector (or Map) and copy the fields into an array of plain C structs.
+ * The numpy record types are:
+ *
+ *   PixelVector, Map:        x, y (uint32), level (uint8), weight (double)
+ *   ScalarVector, ScalarMap: x, y, level, weight (the unmasked fraction),
+ *                            intensity (double), n_points (int32)
+ *   AngularVector:           x, y, z (the unit sphere coordinates, double)
+ *   WAngularVector:          x, y, z, weight
+ *   IAngularVector:          x, y, z, index (uint32)
+ *
+ * The Buffer methods don't need numpy at all; numpy is only imported the
+ * first time Array is called.
+ *
+ * Going the other way, the array forms of the Pixel index methods
+ * (Pixel.Pix2XYArray and friends) take numpy arrays (or anything that
+ * numpy.ascontiguousarray accepts) of pixel indices or Survey coordinates
+ * and return numpy arrays, running the C++ loop over the whole array with
+ * the interpreter lock released.  Likewise, MapRaster.RasterArray returns
+ * the image of a Map or ScalarMap as a 2-D numpy array.
+ */
+
+%{
+namespace Stomp {
+
+// The C structs behind the copied buffers.  These need to stay in step with
+// the numpy dtypes below, which use the same field order and alignment.
+struct PixelRecord {
+  uint32_t x, y;
+  uint8_t level;
+  double weight;
+};
+
+struct ScalarPixelRecord {
+  uint32_t x, y;
+  uint8_t level;
+  double weight, intensity;
+  int32_t n_points;
+};
+
+struct AngularRecord {
+  double x, y, z;
+};
+
+struct WAngularRecord {
+  double x, y, z, weight;
+};
+
+struct IAngularRecord {
+  double x, y, z;
+  uint32_t index;
+};
+
+}  // end namespace Stomp
+
+// Allocate a bytearray to hold n_record records of type T and hand back a
+// pointer to its contents.
+template<class T>
+static PyObject* _StompRecordBuffer(size_t n_record, T** records) {
+  PyObject* buffer =
+    PyByteArray_FromStringAndSize(NULL, n_record*sizeof(T));
+  *records = (buffer != NULL ?
+	      reinterpret_cast<T*>(PyByteArray_AsString(buffer)) : NULL);
+  return buffer;
+}
+
+// A writable view onto the memory of a contiguous vector.
+template<class T>
+static PyObject* _StompVectorView(std::vector<T>* vec) {
+  if (vec->empty()) return PyByteArray_FromStringAndSize(NULL, 0);
+  return PyMemoryView_FromMemory(reinterpret_cast<char*>(&(*vec)[0]),
+				 vec->size()*sizeof(T), PyBUF_WRITE);
+}
+
+static void _StompFillPixelRecord(Stomp::Pixel& pix,
+				  Stomp::PixelRecord* record) {
+  record->x = pix.PixelX();
+  record->y = pix.PixelY();
+  record->level = pix.Level();
+  record->weight = pix.Weight();
+}
+
+static void _StompFillScalarPixelRecord(Stomp::ScalarPixel& pix,
+					Stomp::ScalarPixelRecord* record) {
+  record->x = pix.PixelX();
+  record->y = pix.PixelY();
+  record->level = pix.Level();
+  record->weight = pix.Weight();
+  record->intensity = pix.Intensity();
+  record->n_points = pix.NPoints();
+}
+
+static void _StompFillAngularRecord(Stomp::AngularCoordinate& ang,
+				    Stomp::AngularRecord* record) {
+  record->x = ang.UnitSphereX();
+  record->y = ang.UnitSphereY();
+  record->z = ang.UnitSphereZ();
+}
+
+static void _StompFillWAngularRecord(Stomp::WeightedAngularCoordinate& ang,
+				     Stomp::WAngularRecord* record) {
+  record->x = ang.UnitSphereX();
+  record->y = ang.UnitSphereY();
+  record->z = ang.UnitSphereZ();
+  record->weight = ang.Weight();
+}
+
+// Collects the buffers behind the input and output arrays for one of the
+// array methods, checking that they're contiguous, have the right item size
+// and all have the same length.  The buffers are released when the list
+// goes out of scope.
+class _StompBufferList {
+ public:
+  _StompBufferList() : n_buffer_(0), n_item_(0), ok_(true) {}
+  ~_StompBufferList() {
+    for (int i=0;i<n_buffer_;i++) PyBuffer_Release(&buffer_[i]);
+  }
+  template<class T>
+  T* Add(PyObject* obj, bool writable) {
+    if (!ok_) return NULL;
+    Py_buffer* view = &buffer_[n_buffer_];
+    int flags = PyBUF_C_CONTIGUOUS | (writable ? PyBUF_WRITABLE : 0);
+    if (PyObject_GetBuffer(obj, view, flags) != 0) {
+      ok_ = false;
+      return NULL;
+    }
+    n_buffer_++;
+    uint32_t n_item = static_cast<uint32_t>(view->len/sizeof(T));
+    if ((view->itemsize != static_cast<Py_ssize_t>(sizeof(T))) ||
+	((n_buffer_ > 1) && (n_item != n_item_))) {
+      PyErr_SetString(PyExc_ValueError,
+		      "Array arguments must have matching lengths and types");
+      ok_ = false;
+      return NULL;
+    }
+    n_item_ = n_item;
+    return reinterpret_cast<T*>(view->buf);
+  }
+  bool Ok() {
+    return ok_;
+  }
+  uint32_t NItem() {
+    return n_item_;
+  }
+
+ private:
+  Py_buffer buffer_[8];
+  int n_buffer_;
+  uint32_t n_item_;
+  bool ok_;
+};
+
+static void _StompFillIAngularRecord(Stomp::IndexedAngularCoordinate& ang,
+				     Stomp::IAngularRecord* record) {
+  record->x = ang.UnitSphereX();
+  record->y = ang.UnitSphereY();
+  record->z = ang.UnitSphereZ();
+  record->index = ang.Index();
+}
+%}
+
+%pythoncode %{
+_stomp_dtypes = {}
+_stomp_view_class = None
+
+def _StompDtype(name):
+    """Return the numpy record type for one of the buffer layouts."""
+    import numpy
+    if not _stomp_dtypes:
+        _stomp_dtypes["pixel"] = numpy.dtype(
+            [("x", "u4"), ("y", "u4"), ("level", "u1"), ("weight", "f8")],
+            align=True)
+        _stomp_dtypes["scalar_pixel"] = numpy.dtype(
+            [("x", "u4"), ("y", "u4"), ("level", "u1"), ("weight", "f8"),
+             ("intensity", "f8"), ("n_points", "i4")], align=True)
+        _stomp_dtypes["angular"] = numpy.dtype(
+            [("x", "f8"), ("y", "f8"), ("z", "f8")], align=True)
+        _stomp_dtypes["weighted_angular"] = numpy.dtype(
+            [("x", "f8"), ("y", "f8"), ("z", "f8"), ("weight", "f8")],
+            align=True)
+        _stomp_dtypes["indexed_angular"] = numpy.dtype(
+            [("x", "f8"), ("y", "f8"), ("z", "f8"), ("index", "u4")],
+            align=True)
+        _stomp_dtypes["double"] = numpy.dtype("f8")
+        _stomp_dtypes["index"] = numpy.dtype("u4")
+    return _stomp_dtypes[name]
+
+def _StompInputArray(values, name):
+    """Convert the input to one of the array methods to a contiguous array."""
+    import numpy
+    return numpy.ascontiguousarray(values, dtype=_StompDtype(name))
+
+def _StompOutputArrays(input_array, name, n_array):
+    """Allocate the outputs for one of the array methods."""
+    import numpy
+    return [numpy.empty(len(input_array), dtype=_StompDtype(name))
+            for i in range(n_array)]
+
+def _StompArray(owner, buffer, name):
+    """Wrap a buffer as a numpy array.
+
+    Views onto a vector's own memory keep a reference to the vector so that
+    it isn't deleted out from under the array.
+    """
+    import numpy
+    global _stomp_view_class
+    array = numpy.frombuffer(buffer, dtype=_StompDtype(name))
+    if isinstance(buffer, memoryview):
+        if _stomp_view_class is None:
+            class StompView(numpy.ndarray):
+                pass
+            _stomp_view_class = StompView
+        array = array.view(_stomp_view_class)
+        array._stomp_owner = owner
+    return array
+%}
+
+%define STOMP_RECORD_VIEW( CLASS, RECORD, FILL, DTYPE )
+%extend CLASS {
+  PyObject* Buffer() {
+    RECORD* records;
+    PyObject* buffer = _StompRecordBuffer<RECORD>($self->size(), &records);
+    if (buffer != NULL)
+      for (size_t i=0;i<$self->size();i++) FILL((*$self)[i], &records[i]);
+    return buffer;
+  }
+%pythoncode %{
+    def Array(self):
+        "Return a numpy record array copy of the vector contents."
+        return _StompArray(self, self.Buffer(), DTYPE)
+%}
+}
+%enddef
+
+%define STOMP_VECTOR_VIEW( CLASS, DTYPE )
+%extend CLASS {
+  PyObject* Buffer() {
+    return _StompVectorView($self);
+  }
+%pythoncode %{
+    def Array(self):
+        "Return a numpy array view onto the vector contents."
+        return _StompArray(self, self.Buffer(), DTYPE)
+%}
+}
+%enddef
+
+STOMP_RECORD_VIEW(std::vector<Stomp::Pixel>, Stomp::PixelRecord,
+		  _StompFillPixelRecord, "pixel")
+STOMP_RECORD_VIEW(std::vector<Stomp::ScalarPixel>, Stomp::ScalarPixelRecord,
+		  _StompFillScalarPixelRecord, "scalar_pixel")
+STOMP_RECORD_VIEW(std::vector<Stomp::AngularCoordinate>, Stomp::AngularRecord,
+		  _StompFillAngularRecord, "angular")
+STOMP_RECORD_VIEW(std::vector<Stomp::WeightedAngularCoordinate>,
+		  Stomp::WAngularRecord, _StompFillWAngularRecord,
+		  "weighted_angular")
+STOMP_RECORD_VIEW(std::vector<Stomp::IndexedAngularCoordinate>,
+		  Stomp::IAngularRecord, _StompFillIAngularRecord,
+		  "indexed_angular")
+STOMP_VECTOR_VIEW(std::vector<double>, "double")
+STOMP_VECTOR_VIEW(std::vector<uint32_t>, "index")
+
+// The Maps don't hold their pixels in a single vector, so we walk through
+// them with the usual iterators, copying as we go.
+%extend Stomp::Map {
+  PyObject* PixelBuffer() {
+    Stomp::PixelRecord* records;
+    PyObject* buffer =
+      _StompRecordBuffer<Stomp::PixelRecord>($self->Size(), &records);
+    if (buffer != NULL) {
+      size_t i = 0;
+      for (Stomp::MapIterator iter=$self->Begin();
+	   iter!=$self->End();$self->Iterate(&iter),i++)
+	_StompFillPixelRecord(*(iter.second), &records[i]);
+    }
+    return buffer;
+  }
+%pythoncode %{
+    def PixelArray(self):
+        "Return a numpy record array copy of the Map pixels."
+        return _StompArray(self, self.PixelBuffer(), "pixel")
+%}
+}
+
+%extend Stomp::ScalarMap {
+  PyObject* PixelBuffer() {
+    Stomp::ScalarPixelRecord* records;
+    PyObject* buffer =
+      _StompRecordBuffer<Stomp::ScalarPixelRecord>($self->Size(), &records);
+    if (buffer != NULL) {
+      size_t i = 0;
+      for (Stomp::ScalarIterator iter=$self->Begin();
+	   iter!=$self->End();++iter,i++)
+	_StompFillScalarPixelRecord(*iter, &records[i]);
+    }
+    return buffer;
+  }
+%pythoncode %{
+    def PixelArray(self):
+        "Return a numpy record array copy of the ScalarMap pixels."
+        return _StompArray(self, self.PixelBuffer(), "scalar_pixel")
+%}
+}
+
+// MapRaster fills a numpy image in place, with the interpreter lock
+// released while the map is rasterized.
+%extend Stomp::MapRaster {
+  PyObject* _RasterizeMapBuffer(Stomp::Map& stomp_map, PyObject* image,
+				Stomp::MapRaster::Field field) {
+    _StompBufferList buffers;
+    double* image_ptr = buffers.Add<double>(image, true);
+    if (!buffers.Ok()) return NULL;
+    if (buffers.NItem() != $self->Size()) {
+      PyErr_SetString(PyExc_ValueError,
+		      "Image size doesn't match the raster grid");
+      return NULL;
+    }
+    bool success;
+    Py_BEGIN_ALLOW_THREADS
+    success = $self->Rasterize(stomp_map, image_ptr, field);
+    Py_END_ALLOW_THREADS
+    return PyBool_FromLong(success);
+  }
+  PyObject* _RasterizeScalarMapBuffer(Stomp::ScalarMap& scalar_map,
+				      PyObject* image,
+				      Stomp::MapRaster::Field field) {
+    _StompBufferList buffers;
+    double* image_ptr = buffers.Add<double>(image, true);
+    if (!buffers.Ok()) return NULL;
+    if (buffers.NItem() != $self->Size()) {
+      PyErr_SetString(PyExc_ValueError,
+		      "Image size doesn't match the raster grid");
+      return NULL;
+    }
+    bool success;
+    Py_BEGIN_ALLOW_THREADS
+    success = $self->Rasterize(scalar_map, image_ptr, field);
+    Py_END_ALLOW_THREADS
+    return PyBool_FromLong(success);
+  }
+%pythoncode %{
+    def RasterArray(self, stomp_map, field=None):
+        """Rasterize a Map or ScalarMap; returns an (NY(), NX()) numpy array.
+
+        The default field is UnmaskedFraction for Maps and Intensity for
+        ScalarMaps.
+        """
+        import numpy
+        image = numpy.zeros((self.NY(), self.NX()),
+                            dtype=_StompDtype("double"))
+        if isinstance(stomp_map, ScalarMap):
+            if field is None:
+                field = MapRaster.Intensity
+            success = self._RasterizeScalarMapBuffer(stomp_map, image, field)
+        else:
+            if field is None:
+                field = MapRaster.UnmaskedFraction
+            success = self._RasterizeMapBuffer(stomp_map, image, field)
+        if not success:
+            raise ValueError("Empty raster grid or invalid field for this map")
+        return image
+%}
+}
+
+// The array forms of the Pixel index methods.  The underscored methods take
+// the output arrays as arguments; the Python wrappers allocate those and
+// convert the inputs.
+%extend Stomp::Pixel {
+  static PyObject* _Pix2XYBuffer(uint32_t resolution, PyObject* pixnum,
+				 PyObject* x, PyObject* y) {
+    _StompBufferList buffers;
+    const uint32_t* pixnum_ptr = buffers.Add<uint32_t>(pixnum, false);
+    uint32_t* x_ptr = buffers.Add<uint32_t>(x, true);
+    uint32_t* y_ptr = buffers.Add<uint32_t>(y, true);
+    if (!buffers.Ok()) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    Stomp::Pixel::Pix2XY(resolution, pixnum_ptr, buffers.NItem(), x_ptr, y_ptr);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+  }
+  static PyObject* _XY2PixBuffer(uint32_t resolution, PyObject* x,
+				 PyObject* y, PyObject* pixnum) {
+    _StompBufferList buffers;
+    const uint32_t* x_ptr = buffers.Add<uint32_t>(x, false);
+    const uint32_t* y_ptr = buffers.Add<uint32_t>(y, false);
+    uint32_t* pixnum_ptr = buffers.Add<uint32_t>(pixnum, true);
+    if (!buffers.Ok()) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    Stomp::Pixel::XY2Pix(resolution, x_ptr, y_ptr, buffers.NItem(), pixnum_ptr);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+  }
+  static PyObject* _Pix2HPixBuffer(uint32_t resolution, PyObject* pixnum,
+				   PyObject* hpixnum, PyObject* superpixnum) {
+    _StompBufferList buffers;
+    const uint32_t* pixnum_ptr = buffers.Add<uint32_t>(pixnum, false);
+    uint32_t* hpixnum_ptr = buffers.Add<uint32_t>(hpixnum, true);
+    uint32_t* superpixnum_ptr = buffers.Add<uint32_t>(superpixnum, true);
+    if (!buffers.Ok()) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    Stomp::Pixel::Pix2HPix(resolution, pixnum_ptr, buffers.NItem(),
+			   hpixnum_ptr, superpixnum_ptr);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+  }
+  static PyObject* _HPix2PixBuffer(uint32_t resolution, PyObject* hpixnum,
+				   PyObject* superpixnum, PyObject* pixnum) {
+    _StompBufferList buffers;
+    const uint32_t* hpixnum_ptr = buffers.Add<uint32_t>(hpixnum, false);
+    const uint32_t* superpixnum_ptr = buffers.Add<uint32_t>(superpixnum, false);
+    uint32_t* pixnum_ptr = buffers.Add<uint32_t>(pixnum, true);
+    if (!buffers.Ok()) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    Stomp::Pixel::HPix2Pix(resolution, hpixnum_ptr, superpixnum_ptr,
+			   buffers.NItem(), pixnum_ptr);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+  }
+  static PyObject* _SuperPixBuffer(uint32_t hi_resolution, PyObject* hi_pixnum,
+				   uint32_t lo_resolution,
+				   PyObject* lo_pixnum) {
+    _StompBufferList buffers;
+    const uint32_t* hi_pixnum_ptr = buffers.Add<uint32_t>(hi_pixnum, false);
+    uint32_t* lo_pixnum_ptr = buffers.Add<uint32_t>(lo_pixnum, true);
+    if (!buffers.Ok()) return NULL;
+    bool success;
+    Py_BEGIN_ALLOW_THREADS
+    success = Stomp::Pixel::SuperPix(hi_resolution, hi_pixnum_ptr,
+				     buffers.NItem(), lo_resolution,
+				     lo_pixnum_ptr);
+    Py_END_ALLOW_THREADS
+    return PyBool_FromLong(success);
+  }
+  static PyObject* _SubPixelsBuffer(uint32_t lo_resolution,
+				    PyObject* lo_pixnum,
+				    uint32_t hi_resolution, PyObject* x_min,
+				    PyObject* x_max, PyObject* y_min,
+				    PyObject* y_max) {
+    _StompBufferList buffers;
+    const uint32_t* lo_pixnum_ptr = buffers.Add<uint32_t>(lo_pixnum, false);
+    uint32_t* x_min_ptr = buffers.Add<uint32_t>(x_min, true);
+    uint32_t* x_max_ptr = buffers.Add<uint32_t>(x_max, true);
+    uint32_t* y_min_ptr = buffers.Add<uint32_t>(y_min, true);
+    uint32_t* y_max_ptr = buffers.Add<uint32_t>(y_max, true);
+    if (!buffers.Ok()) return NULL;
+    bool success;
+    Py_BEGIN_ALLOW_THREADS
+    success = Stomp::Pixel::SubPixels(lo_resolution, lo_pixnum_ptr,
+				      buffers.NItem(), hi_resolution,
+				      x_min_ptr, x_max_ptr, y_min_ptr,
+				      y_max_ptr);
+    Py_END_ALLOW_THREADS
+    return PyBool_FromLong(success);
+  }
+  static PyObject* _PixelBoundBuffer(uint32_t resolution, PyObject* pixnum,
+				     PyObject* lammin, PyObject* lammax,
+				     PyObject* etamin, PyObject* etamax) {
+    _StompBufferList buffers;
+    const uint32_t* pixnum_ptr = buffers.Add<uint32_t>(pixnum, false);
+    double* lammin_ptr = buffers.Add<double>(lammin, true);
+    double* lammax_ptr = buffers.Add<double>(lammax, true);
+    double* etamin_ptr = buffers.Add<double>(etamin, true);
+    double* etamax_ptr = buffers.Add<double>(etamax, true);
+    if (!buffers.Ok()) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    Stomp::Pixel::PixelBound(resolution, pixnum_ptr, buffers.NItem(),
+			     lammin_ptr, lammax_ptr, etamin_ptr, etamax_ptr);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+  }
+  static PyObject* _Pix2AngBuffer(uint32_t resolution, PyObject* pixnum,
+				  PyObject* lambda, PyObject* eta) {
+    _StompBufferList buffers;
+    const uint32_t* pixnum_ptr = buffers.Add<uint32_t>(pixnum, false);
+    double* lambda_ptr = buffers.Add<double>(lambda, true);
+    double* eta_ptr = buffers.Add<double>(eta, true);
+    if (!buffers.Ok()) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    Stomp::Pixel::Pix2Ang(resolution, pixnum_ptr, buffers.NItem(),
+			  lambda_ptr, eta_ptr);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+  }
+  static PyObject* _Ang2PixBuffer(uint32_t resolution, PyObject* lambda,
+				  PyObject* eta, PyObject* pixnum) {
+    _StompBufferList buffers;
+    const double* lambda_ptr = buffers.Add<double>(lambda, false);
+    const double* eta_ptr = buffers.Add<double>(eta, false);
+    uint32_t* pixnum_ptr = buffers.Add<uint32_t>(pixnum, true);
+    if (!buffers.Ok()) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    Stomp::Pixel::Ang2Pix(resolution, lambda_ptr, eta_ptr, buffers.NItem(),
+			  pixnum_ptr);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+  }
+  static PyObject* _Ang2HPixBuffer(uint32_t resolution, PyObject* lambda,
+				   PyObject* eta, PyObject* hpixnum,
+				   PyObject* superpixnum) {
+    _StompBufferList buffers;
+    const double* lambda_ptr = buffers.Add<double>(lambda, false);
+    const double* eta_ptr = buffers.Add<double>(eta, false);
+    uint32_t* hpixnum_ptr = buffers.Add<uint32_t>(hpixnum, true);
+    uint32_t* superpixnum_ptr = buffers.Add<uint32_t>(superpixnum, true);
+    if (!buffers.Ok()) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    Stomp::Pixel::Ang2HPix(resolution, lambda_ptr, eta_ptr, buffers.NItem(),
+			   hpixnum_ptr, superpixnum_ptr);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+  }
+  static PyObject* _HPix2AngBuffer(uint32_t resolution, PyObject* hpixnum,
+				   PyObject* superpixnum, PyObject* lambda,
+				   PyObject* eta) {
+    _StompBufferList buffers;
+    const uint32_t* hpixnum_ptr = buffers.Add<uint32_t>(hpixnum, false);
+    const uint32_t* superpixnum_ptr = buffers.Add<uint32_t>(superpixnum, false);
+    double* lambda_ptr = buffers.Add<double>(lambda, true);
+    double* eta_ptr = buffers.Add<double>(eta, true);
+    if (!buffers.Ok()) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    Stomp::Pixel::HPix2Ang(resolution, hpixnum_ptr, superpixnum_ptr,
+			   buffers.NItem(), lambda_ptr, eta_ptr);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+  }
+%pythoncode %{
+    @staticmethod
+    def Pix2XYArray(resolution, pixnum):
+        "Array form of Pix2XY; returns the x and y index arrays."
+        pixnum = _StompInputArray(pixnum, "index")
+        x, y = _StompOutputArrays(pixnum, "index", 2)
+        Pixel._Pix2XYBuffer(resolution, pixnum, x, y)
+        return x, y
+
+    @staticmethod
+    def XY2PixArray(resolution, x, y):
+        "Array form of XY2Pix; returns the pixnum array."
+        x = _StompInputArray(x, "index")
+        y = _StompInputArray(y, "index")
+        pixnum, = _StompOutputArrays(x, "index", 1)
+        Pixel._XY2PixBuffer(resolution, x, y, pixnum)
+        return pixnum
+
+    @staticmethod
+    def Pix2HPixArray(resolution, pixnum):
+        "Array form of Pix2HPix; returns the hpixnum and superpixnum arrays."
+        pixnum = _StompInputArray(pixnum, "index")
+        hpixnum, superpixnum = _StompOutputArrays(pixnum, "index", 2)
+        Pixel._Pix2HPixBuffer(resolution, pixnum, hpixnum, superpixnum)
+        return hpixnum, superpixnum
+
+    @staticmethod
+    def HPix2PixArray(resolution, hpixnum, superpixnum):
+        "Array form of HPix2Pix; returns the pixnum array."
+        hpixnum = _StompInputArray(hpixnum, "index")
+        superpixnum = _StompInputArray(superpixnum, "index")
+        pixnum, = _StompOutputArrays(hpixnum, "index", 1)
+        Pixel._HPix2PixBuffer(resolution, hpixnum, superpixnum, pixnum)
+        return pixnum
+
+    @staticmethod
+    def SuperPixArray(hi_resolution, hi_pixnum, lo_resolution):
+        "Array form of SuperPix; returns the lower resolution pixnum array."
+        hi_pixnum = _StompInputArray(hi_pixnum, "index")
+        lo_pixnum, = _StompOutputArrays(hi_pixnum, "index", 1)
+        if not Pixel._SuperPixBuffer(hi_resolution, hi_pixnum, lo_resolution,
+                                     lo_pixnum):
+            raise ValueError("lo_resolution must not exceed hi_resolution")
+        return lo_pixnum
+
+    @staticmethod
+    def SubPixelsArray(lo_resolution, lo_pixnum, hi_resolution):
+        "Array form of SubPixels; returns the x_min, x_max, y_min and y_max arrays."
+        lo_pixnum = _StompInputArray(lo_pixnum, "index")
+        bounds = _StompOutputArrays(lo_pixnum, "index", 4)
+        if not Pixel._SubPixelsBuffer(lo_resolution, lo_pixnum, hi_resolution,
+                                      *bounds):
+            raise ValueError("lo_resolution must not exceed hi_resolution")
+        return tuple(bounds)
+
+    @staticmethod
+    def PixelBoundArray(resolution, pixnum):
+        "Array form of PixelBound; returns the lammin, lammax, etamin and etamax arrays."
+        pixnum = _StompInputArray(pixnum, "index")
+        bounds = _StompOutputArrays(pixnum, "double", 4)
+        Pixel._PixelBoundBuffer(resolution, pixnum, *bounds)
+        return tuple(bounds)
+
+    @staticmethod
+    def Pix2AngArray(resolution, pixnum):
+        "Array form of Pix2Ang; returns the Survey lambda and eta arrays of the pixel centers."
+        pixnum = _StompInputArray(pixnum, "index")
+        lam, eta = _StompOutputArrays(pixnum, "double", 2)
+        Pixel._Pix2AngBuffer(resolution, pixnum, lam, eta)
+        return lam, eta
+
+    @staticmethod
+    def Ang2PixArray(resolution, lam, eta):
+        "Array form of Ang2Pix, taking Survey lambda and eta arrays; returns the pixnum array."
+        lam = _StompInputArray(lam, "double")
+        eta = _StompInputArray(eta, "double")
+        pixnum, = _StompOutputArrays(lam, "index", 1)
+        Pixel._Ang2PixBuffer(resolution, lam, eta, pixnum)
+        return pixnum
+
+    @staticmethod
+    def Ang2HPixArray(resolution, lam, eta):
+        "Array form of Ang2HPix, taking Survey lambda and eta arrays; returns the hpixnum and superpixnum arrays."
+        lam = _StompInputArray(lam, "double")
+        eta = _StompInputArray(eta, "double")
+        hpixnum, superpixnum = _StompOutputArrays(lam, "index", 2)
+        Pixel._Ang2HPixBuffer(resolution, lam, eta, hpixnum, superpixnum)
+        return hpixnum, superpixnum
+
+    @staticmethod
+    def HPix2AngArray(resolution, hpixnum, superpixnum):
+        "Array form of HPix2Ang; returns the Survey lambda and eta arrays of the pixel centers."
+        hpixnum = _StompInputArray(hpixnum, "index")
+        superpixnum = _StompInputArray(superpixnum, "index")
+        lam, eta = _StompOutputArrays(hpixnum, "double", 2)
+        Pixel._HPix2AngBuffer(resolution, hpixnum, superpixnum, lam, eta)
+        return lam, eta
+%}
+}
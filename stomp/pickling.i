@@ -0,0 +1,63 @@
+/*
+ * pickling.i
+ *
+ * Pickle support for the STOMP maps and correlation functions.  Passing a
+ * Map, ScalarMap, TreeMap, IndexedTreeMap or AngularCorrelation to a
+ * multiprocessing worker means pickling it, and the default SWIG proxies
+ * can't be pickled at all.  Rather than going through the ASCII Write and
+ * Read methods (and a temporary file), each class gets __getstate__ and
+ * __setstate__ methods built on its C++ Serialize and Deserialize methods,
+ * which pack the object into a compact binary string in a single pass.
+ *
+ * The binary format is the native one for the machine (it isn't meant for
+ * long-term storage; use Write for that), so objects can only be unpickled
+ * on a machine with the same byte order.
+ */
+
+%{
+// Hand the serialized object back to Python as a bytes object.
+template<class T>
+static PyObject* _StompSerialize(T* stomp_object) {
+  std::string buffer;
+  stomp_object->Serialize(buffer);
+  return PyBytes_FromStringAndSize(buffer.data(), buffer.size());
+}
+
+template<class T>
+static bool _StompDeserialize(T* stomp_object, PyObject* state) {
+  char* data;
+  Py_ssize_t length;
+  if (PyBytes_AsStringAndSize(state, &data, &length) != 0) {
+    PyErr_Clear();
+    return false;
+  }
+  return stomp_object->Deserialize(std::string(data, length));
+}
+%}
+
+%define STOMP_PICKLE( CLASS )
+%extend CLASS {
+  PyObject* _Serialize() {
+    return _StompSerialize($self);
+  }
+  bool _Deserialize(PyObject* state) {
+    return _StompDeserialize($self, state);
+  }
+%pythoncode %{
+    def __getstate__(self):
+        return self._Serialize()
+
+    def __setstate__(self, state):
+        self.__init__()
+        if not self._Deserialize(state):
+            raise ValueError("Invalid pickled state for %s" %
+                             self.__class__.__name__)
+%}
+}
+%enddef
+
+STOMP_PICKLE(Stomp::Map)
+STOMP_PICKLE(Stomp::ScalarMap)
+STOMP_PICKLE(Stomp::TreeMap)
+STOMP_PICKLE(Stomp::IndexedTreeMap)
+STOMP_PICKLE(Stomp::AngularCorrelation)
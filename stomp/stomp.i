@@ -10,11 +10,18 @@
 #include "../src/stomp/stomp_scalar_pixel.h"
 #include "../src/stomp/stomp_tree_pixel.h"
 #include "../src/stomp/stomp_itree_pixel.h"
+#include "../src/stomp/stomp_pixel_index.h"
 #include "../src/stomp/stomp_base_map.h"
 #include "../src/stomp/stomp_map.h"
+#include "../src/stomp/stomp_map_expr.h"
+#include "../src/stomp/stomp_map_cache.h"
+#include "../src/stomp/stomp_map_raster.h"
 #include "../src/stomp/stomp_scalar_map.h"
+#include "../src/stomp/stomp_multi_scalar_map.h"
 #include "../src/stomp/stomp_tree_map.h"
 #include "../src/stomp/stomp_itree_map.h"
+#include "../src/stomp/stomp_counts_in_cells.h"
+#include "../src/stomp/stomp_kdtree_map.h"
 #include "../src/stomp/stomp_geometry.h"
 #include "../src/stomp/stomp_util.h"
 %}
@@ -34,6 +41,8 @@
 %include std_map.i
 %include std_vector.i
 %include generators.i
+%include numpy_views.i
+%include pickling.i
 
 %include typemaps.i
 %apply double& INPUT { double& }
@@ -118,11 +127,18 @@ typedef IndexVector::iterator IndexIterator;
 %include "../src/stomp/stomp_radial_correlation.h"
 %include "../src/stomp/stomp_pixel.h"
 %include "../src/stomp/stomp_scalar_pixel.h"
+%include "../src/stomp/stomp_pixel_index.h"
 %include "../src/stomp/stomp_base_map.h"
 %include "../src/stomp/stomp_map.h"
+%include "../src/stomp/stomp_map_expr.h"
 %include "../src/stomp/stomp_scalar_map.h"
+%include "../src/stomp/stomp_multi_scalar_map.h"
+%include "../src/stomp/stomp_map_cache.h"
+%include "../src/stomp/stomp_map_raster.h"
 %include "../src/stomp/stomp_geometry.h"
 %include "../src/stomp/stomp_util.h"
+%include "../src/stomp/stomp_counts_in_cells.h"
+%include "../src/stomp/stomp_kdtree_map.h"
 
 namespace Stomp {
 
@@ -501,14 +517,20 @@ class TreePixel : public Pixel {
 			 const std::string& ang_field_name,
 			 AngularCorrelation& wtheta,
 			 const std::string& field_name, int16_t region = -1);
-  uint16_t FindKNearestNeighbors(AngularCoordinate& ang, uint8_t n_neighbors,
-				 WAngularVector& neighbors_ang);
-  uint16_t FindNearestNeighbor(AngularCoordinate& ang,
+  void FindNestedPairs(AngularCoordinate& ang, std::vector<AngularBin>& disks,
+		       std::vector<uint32_t>& counts,
+		       std::vector<double>& weights);
+  uint32_t FindKNearestNeighbors(AngularCoordinate& ang, uint32_t n_neighbors,
+				 WAngularVector& neighbors_ang,
+				 double epsilon = 0.0);
+  uint32_t FindNearestNeighbor(AngularCoordinate& ang,
 			       WeightedAngularCoordinate& neighbor_ang);
-  double KNearestNeighborDistance(AngularCoordinate& ang, uint8_t n_neighbors,
-				  uint16_t& nodes_visited);
+  double KNearestNeighborDistance(AngularCoordinate& ang, uint32_t n_neighbors,
+				  uint32_t& nodes_visited,
+				  double epsilon = 0.0);
+  void FindNeighbors(AngularCoordinate& ang, TreeNeighbor& neighbors);
   double NearestNeighborDistance(AngularCoordinate& ang,
-				 uint16_t& nodes_visited);
+				 uint32_t& nodes_visited);
   bool ClosestMatch(AngularCoordinate& ang, double max_distance,
 		    WeightedAngularCoordinate& match_ang);
   void InitializeCorners();
@@ -531,6 +553,10 @@ class TreePixel : public Pixel {
   void FieldNames(std::vector<std::string>& field_names);
   void SetPixelCapacity(uint16_t maximum_points);
   uint16_t PixelCapacity();
+  bool SetSinglePrecision(bool single_precision = true,
+			  double precision_threshold = SinglePrecisionThreshold);
+  bool SinglePrecision();
+  double PrecisionThreshold();
   bool HasPoints();
   bool HasNodes();
   void Clear();
@@ -571,17 +597,25 @@ class TreeNeighbor {
  public:
   friend class NearestNeighborPoint;
   TreeNeighbor(AngularCoordinate& reference_ang,
-	       uint8_t n_neighbors = 1);
+	       uint32_t n_neighbors = 1);
+  TreeNeighbor(AngularCoordinate& reference_ang,
+	       uint32_t n_neighbors, double max_distance);
   ~TreeNeighbor();
 
   void NearestNeighbors(WAngularVector& w_ang, bool save_neighbors = true);
-  uint8_t Neighbors();
-  uint8_t MaxNeighbors();
+  uint32_t Neighbors();
+  uint32_t MaxNeighbors();
   bool TestPoint(WeightedAngularCoordinate* test_ang);
+  bool TestPoint(WeightedAngularCoordinate& test_ang);
   double MaxDistance();
   double MaxAngularDistance();
-  uint16_t NodesVisited();
+  void SetEpsilon(double epsilon);
+  double Epsilon();
+  double PruneDistance();
+  double PruneAngularDistance();
+  uint32_t NodesVisited();
   void AddNode();
+  uint32_t PointsTested();
 };
 
 class IndexedTreePixel : public Pixel {
@@ -635,6 +669,10 @@ class IndexedTreePixel : public Pixel {
   uint16_t Nodes();
   void SetPixelCapacity(uint16_t maximum_points);
   uint16_t PixelCapacity();
+  bool SetSinglePrecision(bool single_precision = true,
+			  double precision_threshold = SinglePrecisionThreshold);
+  bool SinglePrecision();
+  double PrecisionThreshold();
   bool HasPoints();
   bool HasNodes();
   void Clear();
@@ -684,6 +722,7 @@ class IndexedTreeNeighbor {
   uint8_t Neighbors();
   uint8_t MaxNeighbors();
   bool TestPoint(IndexedAngularCoordinate* test_ang);
+  bool TestPoint(IndexedAngularCoordinate& test_ang);
   double MaxDistance();
   double MaxAngularDistance();
   uint16_t NodesVisited();
@@ -793,14 +832,20 @@ class TreeMap : public BaseMap {
                                     const std::string& ang_field_name,
                                     AngularCorrelation& wtheta,
                                     const std::string& field_name);
-  uint16_t FindKNearestNeighbors(AngularCoordinate& ang, uint8_t n_neighbors,
-				 WAngularVector& neighbors_ang);
-  uint16_t FindNearestNeighbor(AngularCoordinate& ang,
+  void FindCumulativePairs(AngularCoordinate& ang, std::vector<double>& radii,
+			   std::vector<uint32_t>& counts,
+			   std::vector<double>& weights);
+  uint32_t FindKNearestNeighbors(AngularCoordinate& ang, uint32_t n_neighbors,
+				 WAngularVector& neighbors_ang,
+				 double epsilon = 0.0);
+  uint32_t FindNearestNeighbor(AngularCoordinate& ang,
 			       WeightedAngularCoordinate& neighbor_ang);
-  double KNearestNeighborDistance(AngularCoordinate& ang, uint8_t n_neighbors,
-				  uint16_t& nodes_visited);
+  double KNearestNeighborDistance(AngularCoordinate& ang, uint32_t n_neighbors,
+				  uint32_t& nodes_visited,
+				  double epsilon = 0.0);
+  void FindNeighbors(AngularCoordinate& ang, TreeNeighbor& neighbors);
   double NearestNeighborDistance(AngularCoordinate& ang,
-				 uint16_t& nodes_visited);
+				 uint32_t& nodes_visited);
   bool ClosestMatch(AngularCoordinate& ang, double max_distance,
 		    WeightedAngularCoordinate& match_ang);
   bool AddPoint(WeightedAngularCoordinate& w_ang);
@@ -823,6 +868,15 @@ class TreeMap : public BaseMap {
   uint16_t PixelCapacity();
   void SetResolution(uint32_t resolution);
   void SetPixelCapacity(int pixel_capacity);
+  void SetSinglePrecision(bool single_precision = true,
+			  double precision_threshold = SinglePrecisionThreshold);
+  bool SinglePrecision();
+  double PrecisionThreshold();
+  void SetNThreads(uint16_t n_threads);
+  uint16_t NThreads();
+  void Freeze();
+  void Thaw();
+  bool Frozen();
   uint32_t NPoints(uint32_t k = MaxPixnum);
   uint32_t NPoints(Pixel& pix);
   void Points(WAngularVector& w_ang);
@@ -903,6 +957,10 @@ class IndexedTreeMap : public BaseMap {
   uint16_t PixelCapacity();
   void SetResolution(uint32_t resolution);
   void SetPixelCapacity(int pixel_capacity);
+  void SetSinglePrecision(bool single_precision = true,
+			  double precision_threshold = SinglePrecisionThreshold);
+  bool SinglePrecision();
+  double PrecisionThreshold();
   uint32_t NPoints(uint32_t k = MaxPixnum);
   uint32_t NPoints(Pixel& pix);
   void Points(IAngularVector& i_ang);
@@ -935,6 +993,9 @@ class IndexedTreeMap : public BaseMap {
 %template(FieldColumnDict) std::map<std::string, uint8_t>;
 %template(DoubleVector) std::vector<double>;
 %template(IndexVector) std::vector<uint32_t>;
+%template(WThetaVector) std::vector<Stomp::AngularCorrelation>;
+%template(ScalarMapVector) std::vector<Stomp::ScalarMap>;
+%template(MapVector) std::vector<Stomp::Map>;
 
 SETUP_GENERATOR(std::vector<Stomp::AngularBin>::const_iterator)
 ADD_GENERATOR(Stomp::AngularCorrelation, Bins,
@@ -0,0 +1,100 @@
+#!/usr/bin/env python
+
+# Unit testing module for the STOMP mask server client
+# Copyright (c) 2010, Ryan Scranton
+#
+# All rights reserved.
+
+"""
+STOMP is a set of libraries for doing astrostatistical analysis on the
+celestial sphere.  The goal is to enable descriptions of arbitrary regions
+on the sky which may or may not encode futher spatial information (galaxy
+density, CMB temperature, observational depth, etc.) and to do so in such
+a way as to make the analysis of that data as algorithmically efficient as
+possible.
+
+This module tests the Python MaskClient against a stomp_mask_server process.
+The server executable needs to be on the PATH.
+"""
+
+__author__ = "Ryan Scranton (ryan.scranton@gmail.com)"
+__copyright__ = "Copyright 2010, Ryan Scranton"
+__license__ = "BSD"
+__version__ = "1.0"
+
+import distutils.spawn
+import os
+import subprocess
+import tempfile
+import time
+import stomp
+import numpy
+import unittest
+
+class TestStompMaskClient(unittest.TestCase):
+
+    """
+    Unit testing class for the Python MaskClient.
+    """
+
+    def setUp(self):
+        server_path = distutils.spawn.find_executable("stomp_mask_server")
+        if server_path is None:
+            self.skipTest("stomp_mask_server not found")
+
+        center = stomp.AngularCoordinate(20.0, 0.0,
+                                         stomp.AngularCoordinate.Survey)
+        self.stomp_map = stomp.Map(stomp.CircleBound(center, 4.0), 2.5, 1024)
+        self.stomp_map.InitializeRegions(8)
+
+        self.tmp_dir = tempfile.mkdtemp()
+        map_file = os.path.join(self.tmp_dir, "circle.hmap")
+        self.stomp_map.Write(map_file)
+        self.socket_path = os.path.join(self.tmp_dir, "mask.sock")
+        self.server = subprocess.Popen(
+            [server_path, "--socket=" + self.socket_path,
+             "circle=" + map_file + ":8"], stdout=subprocess.PIPE)
+        for i in range(100):
+            if os.path.exists(self.socket_path):
+                break
+            time.sleep(0.1)
+
+    def tearDown(self):
+        self.server.terminate()
+        self.server.communicate()
+        for file_name in os.listdir(self.tmp_dir):
+            os.remove(os.path.join(self.tmp_dir, file_name))
+        os.rmdir(self.tmp_dir)
+
+    def testQueries(self):
+        """Test the client queries against the Map itself."""
+        lam = numpy.linspace(14.0, 26.0, 61)
+        eta = numpy.linspace(-6.0, 6.0, 61)
+        lam, eta = [array.ravel() for array in numpy.meshgrid(lam, eta)]
+
+        with stomp.MaskClient(self.socket_path) as client:
+            maps = client.list_maps()
+            self.assertEqual(list(maps.keys()), ["circle"])
+            self.assertAlmostEqual(maps["circle"][0], self.stomp_map.Area())
+            self.assertEqual(maps["circle"][1], 8)
+
+            contained = client.contains("circle", lam, eta)
+            weight = client.weight("circle", lam, eta)
+            region = client.region("circle", lam, eta)
+            self.assertTrue(contained.any() and not contained.all())
+            for i in range(len(lam)):
+                ang = stomp.AngularCoordinate(lam[i], eta[i],
+                                              stomp.AngularCoordinate.Survey)
+                inside = self.stomp_map.Contains(ang)
+                self.assertEqual(contained[i], inside)
+                self.assertEqual(weight[i], 2.5 if inside else 0.0)
+                self.assertEqual(region[i] >= 0, inside)
+
+            # Unknown Maps raise a KeyError, but leave the connection open.
+            self.assertRaises(KeyError, client.contains, "missing", lam, eta)
+            self.assertTrue(client.connected())
+
+
+if __name__ == '__main__':
+    suite = unittest.TestLoader().loadTestsFromTestCase(TestStompMaskClient)
+    unittest.TextTestRunner(verbosity=2).run(suite)
@@ -0,0 +1,136 @@
+#!/usr/bin/env python
+
+# Unit testing module for STOMP numpy views
+# Copyright (c) 2010, Ryan Scranton
+#
+# All rights reserved.
+
+"""
+STOMP is a set of libraries for doing astrostatistical analysis on the
+celestial sphere.  The goal is to enable descriptions of arbitrary regions
+on the sky which may or may not encode futher spatial information (galaxy
+density, CMB temperature, observational depth, etc.) and to do so in such
+a way as to make the analysis of that data as algorithmically efficient as
+possible.
+
+This module tests the numpy views of the STOMP vectors and maps.
+"""
+
+__author__ = "Ryan Scranton (ryan.scranton@gmail.com)"
+__copyright__ = "Copyright 2010, Ryan Scranton"
+__license__ = "BSD"
+__version__ = "1.0"
+
+import stomp
+import numpy
+import unittest
+
+class TestStompNumpyViews(unittest.TestCase):
+
+    """
+    Unit testing class for the numpy views of the STOMP vectors and maps.
+    """
+
+    def testVectorViews(self):
+        """Test that the contiguous vectors are viewed without copying."""
+        weights = stomp.DoubleVector()
+        for i in range(10):
+            weights.push_back(0.5*i)
+        array = weights.Array()
+        self.assertEqual(array.dtype, numpy.float64)
+        self.assertTrue(numpy.allclose(array, 0.5*numpy.arange(10)))
+
+        # Changes through the view should show up in the vector.
+        array[3] = 100.0
+        self.assertEqual(weights[3], 100.0)
+
+        # The view should keep the vector alive.
+        del weights
+        self.assertEqual(array[3], 100.0)
+
+        indices = stomp.IndexVector()
+        for i in range(5):
+            indices.push_back(2*i)
+        self.assertEqual(list(indices.Array()), [0, 2, 4, 6, 8])
+
+    def testPixelViews(self):
+        """Test the pixel record arrays against the pixels themselves."""
+        ang = stomp.AngularCoordinate(60.0, 20.0,
+                                      stomp.AngularCoordinate.Survey)
+        pix = stomp.Pixel(ang, 256, 2.5)
+        sub_pix = stomp.PixelVector()
+        pix.SubPix(1024, sub_pix)
+
+        array = sub_pix.Array()
+        self.assertEqual(len(array), sub_pix.size())
+        for i in range(sub_pix.size()):
+            self.assertEqual(array["x"][i], sub_pix[i].PixelX())
+            self.assertEqual(array["y"][i], sub_pix[i].PixelY())
+            self.assertEqual(array["level"][i], sub_pix[i].Level())
+            self.assertEqual(array["weight"][i], sub_pix[i].Weight())
+
+        stomp_map = stomp.Map(sub_pix)
+        map_array = stomp_map.PixelArray()
+        self.assertEqual(len(map_array), stomp_map.Size())
+        self.assertEqual(map_array["level"][0], pix.Level())
+
+    def testAngularViews(self):
+        """Test the coordinate record arrays."""
+        ang_vec = stomp.AngularVector()
+        for i in range(10):
+            ang_vec.push_back(stomp.AngularCoordinate(
+                    5.0*i, 10.0, stomp.AngularCoordinate.Equatorial))
+        array = ang_vec.Array()
+        for i in range(ang_vec.size()):
+            self.assertAlmostEqual(array["x"][i], ang_vec[i].UnitSphereX())
+            self.assertAlmostEqual(array["y"][i], ang_vec[i].UnitSphereY())
+            self.assertAlmostEqual(array["z"][i], ang_vec[i].UnitSphereZ())
+        self.assertTrue(numpy.allclose(
+                array["x"]**2 + array["y"]**2 + array["z"]**2, 1.0))
+
+    def testPixelArrays(self):
+        """Test the array forms of the Pixel index methods."""
+        resolution = 256
+        lam = numpy.linspace(-60.0, 60.0, 50)
+        eta = numpy.linspace(-170.0, 170.0, 50)
+        pixnum = stomp.Pixel.Ang2PixArray(resolution, lam, eta)
+        x, y = stomp.Pixel.Pix2XYArray(resolution, pixnum)
+        hpixnum, superpixnum = stomp.Pixel.Pix2HPixArray(resolution, pixnum)
+        lo_pixnum = stomp.Pixel.SuperPixArray(resolution, pixnum, 16)
+        lammin, lammax, etamin, etamax = stomp.Pixel.PixelBoundArray(
+            resolution, pixnum)
+        for i in range(len(lam)):
+            ang = stomp.AngularCoordinate(lam[i], eta[i],
+                                          stomp.AngularCoordinate.Survey)
+            pix = stomp.Pixel(ang, resolution)
+            self.assertEqual(x[i], pix.PixelX())
+            self.assertEqual(y[i], pix.PixelY())
+            self.assertEqual(hpixnum[i], pix.HPixnum())
+            self.assertEqual(superpixnum[i], pix.Superpixnum())
+            self.assertTrue(lammin[i] <= lam[i] <= lammax[i])
+            self.assertTrue(etamin[i] <= eta[i] <= etamax[i])
+            pix.SetToSuperPix(16)
+            self.assertEqual(lo_pixnum[i], pix.Pixnum())
+
+        # The round trips should give back the same pixels.
+        self.assertTrue(numpy.array_equal(
+                stomp.Pixel.XY2PixArray(resolution, x, y), pixnum))
+        self.assertTrue(numpy.array_equal(
+                stomp.Pixel.HPix2PixArray(resolution, hpixnum, superpixnum),
+                pixnum))
+        center_lam, center_eta = stomp.Pixel.Pix2AngArray(resolution, pixnum)
+        self.assertTrue(numpy.array_equal(
+                stomp.Pixel.Ang2PixArray(resolution, center_lam, center_eta),
+                pixnum))
+        x_min, x_max, y_min, y_max = stomp.Pixel.SubPixelsArray(
+            16, lo_pixnum, resolution)
+        self.assertTrue(numpy.all((x_min <= x) & (x <= x_max)))
+        self.assertTrue(numpy.all((y_min <= y) & (y <= y_max)))
+
+        self.assertRaises(ValueError, stomp.Pixel.SuperPixArray,
+                          16, lo_pixnum, resolution)
+
+
+if __name__ == '__main__':
+    suite = unittest.TestLoader().loadTestsFromTestCase(TestStompNumpyViews)
+    unittest.TextTestRunner(verbosity=2).run(suite)
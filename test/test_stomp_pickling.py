@@ -0,0 +1,97 @@
+#!/usr/bin/env python
+
+# Unit testing module for pickling STOMP objects
+# Copyright (c) 2010, Ryan Scranton
+#
+# All rights reserved.
+
+"""
+STOMP is a set of libraries for doing astrostatistical analysis on the
+celestial sphere.  The goal is to enable descriptions of arbitrary regions
+on the sky which may or may not encode futher spatial information (galaxy
+density, CMB temperature, observational depth, etc.) and to do so in such
+a way as to make the analysis of that data as algorithmically efficient as
+possible.
+
+This module tests pickling the STOMP maps and correlation functions.
+"""
+
+__author__ = "Ryan Scranton (ryan.scranton@gmail.com)"
+__copyright__ = "Copyright 2010, Ryan Scranton"
+__license__ = "BSD"
+__version__ = "1.0"
+
+import stomp
+import pickle
+import unittest
+
+class TestStompPickling(unittest.TestCase):
+
+    """
+    Unit testing class for pickling the STOMP maps and correlation functions.
+    """
+
+    def setUp(self):
+        ang = stomp.AngularCoordinate(20.0, 0.0,
+                                      stomp.AngularCoordinate.Survey)
+        self.bound = stomp.CircleBound(ang, 3.0)
+        self.map = stomp.Map(self.bound, 1.0, 512)
+        self.n_region = self.map.InitializeRegions(5, 64)
+        self.ang_vec = stomp.AngularVector()
+        self.map.GenerateRandomPoints(self.ang_vec, 1000, False, 12345)
+
+    def _RoundTrip(self, stomp_object):
+        return pickle.loads(pickle.dumps(stomp_object,
+                                         pickle.HIGHEST_PROTOCOL))
+
+    def testMapPickling(self):
+        """Test that a Map and its regions survive pickling."""
+        new_map = self._RoundTrip(self.map)
+        self.assertEqual(new_map.Fingerprint(), self.map.Fingerprint())
+        self.assertEqual(new_map.NRegion(), self.n_region)
+        for region in range(self.n_region):
+            self.assertAlmostEqual(new_map.RegionArea(region),
+                                   self.map.RegionArea(region))
+
+    def testScalarMapPickling(self):
+        """Test that a ScalarMap survives pickling."""
+        scalar_map = stomp.ScalarMap(self.map, 128,
+                                     stomp.ScalarMap.DensityField)
+        for i in range(self.ang_vec.size()):
+            scalar_map.AddToMap(self.ang_vec[i])
+        new_map = self._RoundTrip(scalar_map)
+        self.assertEqual(new_map.Size(), scalar_map.Size())
+        self.assertEqual(new_map.NPoints(), scalar_map.NPoints())
+        self.assertAlmostEqual(new_map.Area(), scalar_map.Area())
+        self.assertEqual(new_map.MapType(), scalar_map.MapType())
+
+    def testTreeMapPickling(self):
+        """Test that the tree maps survive pickling."""
+        tree_map = stomp.TreeMap()
+        itree_map = stomp.IndexedTreeMap()
+        for i in range(self.ang_vec.size()):
+            tree_map.AddPoint(self.ang_vec[i], 2.0)
+            itree_map.AddPoint(self.ang_vec[i], i)
+        new_tree_map = self._RoundTrip(tree_map)
+        self.assertEqual(new_tree_map.NPoints(), tree_map.NPoints())
+        self.assertAlmostEqual(new_tree_map.Weight(), tree_map.Weight())
+        new_itree_map = self._RoundTrip(itree_map)
+        self.assertEqual(new_itree_map.NPoints(), itree_map.NPoints())
+
+    def testAngularCorrelationPickling(self):
+        """Test that an AngularCorrelation survives pickling."""
+        wtheta = stomp.AngularCorrelation(0.01, 1.0, 6.0)
+        new_wtheta = self._RoundTrip(wtheta)
+        self.assertEqual(new_wtheta.NBins(), wtheta.NBins())
+        self.assertEqual(new_wtheta.MinResolution(), wtheta.MinResolution())
+        self.assertAlmostEqual(new_wtheta.ThetaMin(), wtheta.ThetaMin())
+
+    def testInvalidState(self):
+        """Test that a corrupted pickle is rejected."""
+        new_map = stomp.Map()
+        self.assertRaises(ValueError, new_map.__setstate__, b"not a map")
+
+
+if __name__ == '__main__':
+    suite = unittest.TestLoader().loadTestsFromTestCase(TestStompPickling)
+    unittest.TextTestRunner(verbosity=2).run(suite)